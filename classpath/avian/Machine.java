@@ -18,6 +18,29 @@ public abstract class Machine {
 
   public static native void dumpHeap(String outputFile);
 
+  /**
+   * Saves the heap to the file named by the avian.checkpoint system
+   * property, so that later runs of the same program may start from
+   * it, skipping the static initializers which have run so far.
+   *
+   * <p>A run started from such a file does not resume here; it runs
+   * main from the beginning as usual, but classes initialized before
+   * the checkpoint are already initialized, and static fields hold
+   * what they held then.  In that run this method returns true and
+   * does nothing.  Otherwise it returns false once the file is
+   * written.
+   *
+   * <p>Only VMs built with bootimage=true support this, and only
+   * while no other non-daemon thread is running.  Classes must have
+   * been loaded by the system class loaders, and the saved state may
+   * not refer to threads or to native resources.  Weak and soft
+   * references are cleared in the saved heap, and objects in it are
+   * never finalized.
+   *
+   * @throws IllegalStateException if the heap cannot be saved
+   */
+  public static native boolean checkpoint();
+
   public static Unsafe getUnsafe() {
     return unsafe;
   }
@@ -42,8 +42,10 @@ public class SystemClassLoader extends ClassLoader {
   {
     Class c = findLoadedClass(name);
     if (c == null) {
+      // findClass already searches a SystemClassLoader parent without
+      // throwing, so only other parents need to be asked here:
       ClassLoader parent = getParent();
-      if (parent != null) {
+      if (parent != null && parent.getClass() != SystemClassLoader.class) {
         try {
           c = parent.loadClass(name);
         } catch (ClassNotFoundException ok) { }
@@ -61,6 +63,18 @@ public class SystemClassLoader extends ClassLoader {
     return c;
   }
 
+  // Number of class and resource lookups answered from (and added to)
+  // the cache of names known to be missing from this loader's path.
+  public native int negativeCacheHits();
+
+  public native int negativeCacheMisses();
+
+  // Number of compressed jar entries found in (or added to) the cache
+  // of inflated entries shared by all system class loaders.
+  public static native int inflateCacheHits();
+
+  public static native int inflateCacheMisses();
+
   private native String resourceURLPrefix(String name);
 
   protected URL findResource(String name) {
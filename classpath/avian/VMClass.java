@@ -29,4 +29,5 @@ public class VMClass {
   public Object staticTable;
   public ClassLoader loader;
   public byte[] source;
+  public int hash;
 }
@@ -115,6 +115,32 @@ public final class Integer extends Number implements Comparable<Integer> {
     return (byte0 | byte1 | byte2 | byte3);
   }
 
+  public static int numberOfLeadingZeros(int v) {
+    if (v == 0) return 32;
+
+    int n = 0;
+    if ((v >>> 16) == 0) { n += 16; v <<= 16; }
+    if ((v >>> 24) == 0) { n +=  8; v <<=  8; }
+    if ((v >>> 28) == 0) { n +=  4; v <<=  4; }
+    if ((v >>> 30) == 0) { n +=  2; v <<=  2; }
+    if ((v >>> 31) == 0) { n +=  1; }
+    return n;
+  }
+
+  public static int numberOfTrailingZeros(int v) {
+    if (v == 0) return 32;
+
+    return 31 - numberOfLeadingZeros(v & -v);
+  }
+
+  public static int rotateLeft(int v, int distance) {
+    return (v << distance) | (v >>> -distance);
+  }
+
+  public static int rotateRight(int v, int distance) {
+    return (v >>> distance) | (v << -distance);
+  }
+
   public static int parseInt(String s) {
     return parseInt(s, 10);
   }
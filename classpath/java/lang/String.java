@@ -278,6 +278,10 @@ public final class String
   }
 
   public int indexOf(int c, int start) {
+    if (Character.isSupplementaryCodePoint(c)) {
+      return indexOf(new String(Character.toChars(c), 0, 2, false), start);
+    }
+
     for (int i = start; i < length; ++i) {
       if (charAt(i) == c) {
         return i;
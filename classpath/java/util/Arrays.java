@@ -136,6 +136,24 @@ public class Arrays {
     };
   }
 
+  public static void fill(boolean[] array, boolean value) {
+    for (int i=0;i<array.length;i++) {
+      array[i] = value;
+    }
+  }
+
+  public static void fill(byte[] array, byte value) {
+    for (int i=0;i<array.length;i++) {
+      array[i] = value;
+    }
+  }
+
+  public static void fill(short[] array, short value) {
+    for (int i=0;i<array.length;i++) {
+      array[i] = value;
+    }
+  }
+
   public static void fill(int[] array, int value) {
     for (int i=0;i<array.length;i++) {
       array[i] = value;
@@ -148,7 +166,31 @@ public class Arrays {
     }
   }
   
+  public static void fill(long[] array, long value) {
+    for (int i=0;i<array.length;i++) {
+      array[i] = value;
+    }
+  }
+
+  public static void fill(float[] array, float value) {
+    for (int i=0;i<array.length;i++) {
+      array[i] = value;
+    }
+  }
+
+  public static void fill(double[] array, double value) {
+    for (int i=0;i<array.length;i++) {
+      array[i] = value;
+    }
+  }
+
   public static <T> void fill(T[] array, T value) {
+    if (value != null
+        && ! array.getClass().getComponentType().isInstance(value))
+    {
+      throw new ArrayStoreException(value.getClass().getName());
+    }
+
     for (int i=0;i<array.length;i++) {
       array[i] = value;
     }
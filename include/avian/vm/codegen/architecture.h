@@ -127,6 +127,12 @@ virtual void planDestination
 
 virtual Assembler* makeAssembler(vm::Allocator*, vm::Zone*) = 0;
 
+// processor features used when generating code, as detected at
+// startup (if native features were requested); overriding them only
+// affects code generated afterwards
+virtual unsigned features() = 0;
+virtual void setFeatures(unsigned features) = 0;
+
 virtual void acquire() = 0;
 virtual void release() = 0;
 };
@@ -47,10 +47,36 @@ class Compiler {
     VoidType
   };
 
+  // LocalAllocation assigns registers greedily as each event is
+  // compiled.  LoopWeightedAllocation additionally weighs every value by
+  // its uses across the whole method, scaled by loop depth, and gives
+  // the heaviest values registers at control flow merges.
+  // LinearScanAllocation uses the same weights, but first computes a
+  // live interval for each value and runs a linear scan over them,
+  // which decides which values keep a register and which one.
+  enum AllocationPolicy {
+    LocalAllocation,
+    LoopWeightedAllocation,
+    LinearScanAllocation
+  };
+
   class Operand { };
   class State { };
   class Subroutine { };
 
+  // a rarely taken path (e.g. a call which throws on a failed bounds
+  // check) emitted after the rest of the method
+  class ColdPath {
+   public:
+    ColdPath(unsigned logicalIp, Promise* address):
+      next(0), logicalIp(logicalIp), address(address)
+    { }
+
+    ColdPath* next;
+    unsigned logicalIp;
+    Promise* address;
+  };
+
   virtual State* saveState() = 0;
   virtual void restoreState(State* state) = 0;
 
@@ -115,7 +141,8 @@ class Compiler {
   virtual void saveLocals() = 0;
 
   virtual void checkBounds(Operand* object, unsigned lengthOffset,
-                           Operand* index, intptr_t handler) = 0;
+                           Operand* index, intptr_t handler,
+                           bool outOfLine) = 0;
 
   virtual void store(unsigned srcSize, Operand* src, unsigned dstSize,
                      Operand* dst) = 0;
@@ -176,9 +203,17 @@ class Compiler {
   virtual Operand* and_(unsigned size, Operand* a, Operand* b) = 0;
   virtual Operand* or_(unsigned size, Operand* a, Operand* b) = 0;
   virtual Operand* xor_(unsigned size, Operand* a, Operand* b) = 0;
+  virtual Operand* rol(unsigned size, Operand* a, Operand* b) = 0;
+  virtual Operand* ror(unsigned size, Operand* a, Operand* b) = 0;
+  virtual Operand* min(unsigned size, Operand* a, Operand* b) = 0;
+  virtual Operand* max(unsigned size, Operand* a, Operand* b) = 0;
   virtual Operand* neg(unsigned size, Operand* a) = 0;
   virtual Operand* fneg(unsigned size, Operand* a) = 0;
   virtual Operand* abs(unsigned size, Operand* a) = 0;
+  virtual Operand* popcnt(unsigned size, Operand* a) = 0;
+  virtual Operand* clz(unsigned size, Operand* a) = 0;
+  virtual Operand* ctz(unsigned size, Operand* a) = 0;
+  virtual Operand* bswap(unsigned size, Operand* a) = 0;
   virtual Operand* fabs(unsigned size, Operand* a) = 0;
   virtual Operand* fsqrt(unsigned size, Operand* a) = 0;
   virtual Operand* f2f(unsigned aSize, unsigned resSize, Operand* a) = 0;
@@ -194,6 +229,8 @@ class Compiler {
   virtual void compile(uintptr_t stackOverflowHandler,
                        unsigned stackLimitOffset) = 0;
   virtual unsigned resolve(uint8_t* dst) = 0;
+  virtual void setDestination(uint8_t* dst) = 0;
+  virtual ColdPath* coldPaths() = 0;
   virtual unsigned poolSize() = 0;
   virtual void write() = 0;
 
@@ -202,7 +239,7 @@ class Compiler {
 
 Compiler*
 makeCompiler(vm::System* system, Assembler* assembler, vm::Zone* zone,
-             Compiler::Client* client);
+             Compiler::Client* client, Compiler::AllocationPolicy policy);
 
 } // namespace codegen
 } // namespace avian
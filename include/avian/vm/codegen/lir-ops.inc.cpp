@@ -25,6 +25,10 @@ LIR_OP_2(Int2Float)
 LIR_OP_2(FloatSquareRoot)
 LIR_OP_2(FloatAbsolute)
 LIR_OP_2(Absolute)
+LIR_OP_2(PopCount)
+LIR_OP_2(CountLeadingZeros)
+LIR_OP_2(CountTrailingZeros)
+LIR_OP_2(ByteSwap)
 
 LIR_OP_3(Add)
 LIR_OP_3(Subtract)
@@ -37,6 +41,10 @@ LIR_OP_3(UnsignedShiftRight)
 LIR_OP_3(And)
 LIR_OP_3(Or)
 LIR_OP_3(Xor)
+LIR_OP_3(RotateLeft)
+LIR_OP_3(RotateRight)
+LIR_OP_3(Min)
+LIR_OP_3(Max)
 LIR_OP_3(FloatAdd)
 LIR_OP_3(FloatSubtract)
 LIR_OP_3(FloatMultiply)
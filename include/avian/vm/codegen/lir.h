@@ -60,7 +60,7 @@ enum BinaryOperation {
   NoBinaryOperation = -1
 };
 
-const unsigned BinaryOperationCount = Absolute + 1;
+const unsigned BinaryOperationCount = ByteSwap + 1;
 
 enum TernaryOperation {
   #define LIR_OP_0(x)
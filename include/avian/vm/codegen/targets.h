@@ -26,6 +26,19 @@ Architecture* makeArchitectureX86(vm::System* system, bool useNativeFeatures);
 Architecture* makeArchitectureArm(vm::System* system, bool useNativeFeatures);
 Architecture* makeArchitecturePowerpc(vm::System* system, bool useNativeFeatures);
 
+namespace x86 {
+
+// processor features which the x86 backend may take advantage of (see
+// Architecture::features)
+const unsigned SSEFeature = 1 << 0;
+const unsigned SSE2Feature = 1 << 1;
+const unsigned PopcntFeature = 1 << 2;
+const unsigned LzcntFeature = 1 << 3;
+const unsigned Bmi1Feature = 1 << 4;
+const unsigned AvxFeature = 1 << 5;
+
+} // namespace x86
+
 } // namespace codegen
 } // namespace avian
 
@@ -69,6 +69,7 @@ class Heap: public Allocator {
   virtual void* allocateImmortalFixed(Allocator* allocator,
                                       unsigned sizeInWords,
                                       bool objectMask) = 0;
+  virtual void* tryAllocateTenured(unsigned sizeInWords) = 0;
   virtual void mark(void* p, unsigned offset, unsigned count) = 0;
   virtual void pad(void* p) = 0;
   virtual void* follow(void* p) = 0;
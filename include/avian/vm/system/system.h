@@ -123,7 +123,7 @@ class System : public avian::util::Aborter {
   virtual void* tryAllocate(unsigned sizeInBytes) = 0;
   virtual void free(const void* p) = 0;
 #if !defined(AVIAN_AOT_ONLY)
-  virtual void* tryAllocateExecutable(unsigned sizeInBytes) = 0;
+  virtual void* tryAllocateExecutable(unsigned sizeInBytes, void* hint) = 0;
   virtual void freeExecutable(const void* p, unsigned sizeInBytes) = 0;
 #endif
   virtual Status attach(Runnable*) = 0;
@@ -139,7 +139,9 @@ class System : public avian::util::Aborter {
                         unsigned count, unsigned size,
                         unsigned returnType) = 0;
   virtual Status map(Region**, const char* name) = 0;
+  virtual Status map(Region**, const char* name, void* address) = 0;
   virtual FileType stat(const char* name, unsigned* length) = 0;
+  virtual int64_t lastModified(const char* name) = 0;
   virtual Status open(Directory**, const char* name) = 0;
   virtual const char* libraryPrefix() = 0;
   virtual const char* librarySuffix() = 0;
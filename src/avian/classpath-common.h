@@ -65,8 +65,7 @@ compatibleArrayTypes(Thread* t, object a, object b)
   return classArrayElementSize(t, a)
     and classArrayElementSize(t, b)
     and (a == b
-         or (not ((classVmFlags(t, a) & PrimitiveFlag)
-                  or (classVmFlags(t, b) & PrimitiveFlag))));
+         or (classObjectMask(t, a) and classObjectMask(t, b)));
 }
 
 void
@@ -83,8 +82,8 @@ arrayCopy(Thread* t, object src, int32_t srcOffset, object dst,
         intptr_t sl = fieldAtOffset<uintptr_t>(src, BytesPerWord);
         intptr_t dl = fieldAtOffset<uintptr_t>(dst, BytesPerWord);
         if (LIKELY(length > 0)) {
-          if (LIKELY(srcOffset >= 0 and srcOffset + length <= sl and
-                     dstOffset >= 0 and dstOffset + length <= dl))
+          if (LIKELY(srcOffset >= 0 and length <= sl - srcOffset and
+                     dstOffset >= 0 and length <= dl - dstOffset))
           {
             uint8_t* sbody = &fieldAtOffset<uint8_t>(src, ArrayBody);
             uint8_t* dbody = &fieldAtOffset<uint8_t>(dst, ArrayBody);
@@ -106,8 +105,10 @@ arrayCopy(Thread* t, object src, int32_t srcOffset, object dst,
           } else {
             throwNew(t, Machine::IndexOutOfBoundsExceptionType);
           }
-        } else {
+        } else if (length == 0) {
           return;
+        } else {
+          throwNew(t, Machine::IndexOutOfBoundsExceptionType);
         }
       }
     }
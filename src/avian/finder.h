@@ -121,6 +121,17 @@ readLine(const uint8_t* base, unsigned total, unsigned* start,
   return *length != 0;
 }
 
+// A size-bounded cache of inflated jar entries, which may be shared by
+// several finders.  It is reference counted and goes away when the
+// last finder using it does.
+class InflateCache {
+ public:
+  virtual void acquire() = 0;
+  virtual void release() = 0;
+  virtual unsigned hits() = 0;
+  virtual unsigned misses() = 0;
+};
+
 class Finder {
  public:
   class IteratorImp {
@@ -170,16 +181,28 @@ class Finder {
   virtual const char* urlPrefix(const char* name) = 0;
   virtual const char* sourceUrl(const char* name) = 0;
   virtual const char* path() = 0;
+
+  // Forgets any names recorded as missing from the path, which
+  // otherwise are not searched for again.
+  virtual void invalidate() = 0;
+  virtual unsigned negativeCacheHits() = 0;
+  virtual unsigned negativeCacheMisses() = 0;
+  virtual InflateCache* inflateCache() = 0;
+
   virtual void dispose() = 0;
 };
 
 JNIEXPORT Finder*
-makeFinder(System* s, Allocator* a, const char* path, const char* bootLibrary);
+makeFinder(System* s, Allocator* a, const char* path, const char* bootLibrary,
+           const char* indexPath = 0, InflateCache* cache = 0);
 
 Finder*
 makeFinder(System* s, Allocator* a, const uint8_t* jarData,
            unsigned jarLength);
 
+InflateCache*
+makeInflateCache(System* s, Allocator* a, unsigned budget);
+
 } // namespace vm
 
 #endif//FINDER_H
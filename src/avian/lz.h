@@ -0,0 +1,62 @@
+/* Copyright (c) 2008-2012, Avian Contributors
+
+   Permission to use, copy, modify, and/or distribute this software
+   for any purpose with or without fee is hereby granted, provided
+   that the above copyright notice and this permission notice appear
+   in all copies.
+
+   There is NO WARRANTY for this software.  See license.txt for
+   details. */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <avian/vm/system/system.h>
+#include "avian/allocator.h"
+
+namespace vm {
+
+// A simple LZ77 codec which trades compression ratio for decoding
+// speed, for images and embedded jars which should load quickly.  An
+// image starts with LZMagic and the uncompressed size, each a
+// little-endian 32-bit word, and continues with sequences in the
+// style of LZ4's block format: a token byte giving the lengths of a
+// run of literals and of the match which follows them, any extra
+// length bytes, the literals, and a 16-bit offset back to the match.
+// The last sequence has literals only.
+
+const uint32_t LZMagic = 0x5a4c5641; // "AVLZ"
+const unsigned LZHeaderSize = 8;
+
+bool
+isLZ(const uint8_t* in, unsigned inSize);
+
+// returns the uncompressed size recorded in the header of an image
+unsigned
+decodedLZSize(const uint8_t* in);
+
+// the largest image encodeLZ could make from inSize bytes
+unsigned
+maxEncodedLZSize(unsigned inSize);
+
+// Encodes the specified data into a buffer of at least
+// maxEncodedLZSize(inSize) bytes, returning the size of the image.
+unsigned
+encodeLZ(const uint8_t* in, unsigned inSize, uint8_t* out);
+
+// Decodes an image into a buffer of exactly decodedLZSize(in) bytes,
+// returning false if the image is malformed.
+bool
+decodeLZ(const uint8_t* in, unsigned inSize, uint8_t* out, unsigned outSize);
+
+uint8_t*
+encodeLZ(System* s, Allocator* a, const uint8_t* in, unsigned inSize,
+         unsigned* outSize);
+
+uint8_t*
+decodeLZ(System* s, Allocator* a, const uint8_t* in, unsigned inSize,
+         unsigned* outSize);
+
+} // namespace vm
+
+#endif // LZ_H
@@ -20,6 +20,16 @@ namespace vm {
 
 const unsigned Padding = 16;
 
+// An image made by encodeLZMABlocks starts with a header of four
+// little-endian 32-bit words: BlocksMagic, the uncompressed size, the
+// block size, and the block count.  That is followed by the compressed
+// size of each block, also as a 32-bit word, and then by the blocks
+// themselves, each an ordinary image as made by encodeLZMA.  The first
+// byte of the magic number is never a valid LZMA properties byte, so
+// the two formats can't be confused.
+const uint32_t BlocksMagic = 0x425a4cff; // "\xffLZB"
+const unsigned BlocksHeaderSize = 16;
+
 class LzmaAllocator {
  public:
   LzmaAllocator(Allocator* a): a(a) {
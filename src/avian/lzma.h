@@ -16,14 +16,41 @@
 
 namespace vm {
 
+// default size of the independently compressed blocks of an image
+// made by encodeLZMABlocks
+const unsigned LZMABlockSize = 1024 * 1024;
+
+// A region holding the contents of an image made by encodeLZMABlocks,
+// whose blocks are only decoded when some part of them is asked for.
+// The caller must ensure a range before reading it.
+class LZMARegion: public System::Region {
+ public:
+  virtual void ensure(unsigned offset, unsigned length) = 0;
+};
+
+// Decodes an image made by encodeLZMA or encodeLZMABlocks.  In the
+// latter case, the blocks are decoded in parallel.
 uint8_t*
 decodeLZMA(System* s, Allocator* a, uint8_t* in, unsigned inSize,
            unsigned* outSize);
 
+bool
+isLZMABlocks(const uint8_t* in, unsigned inSize);
+
+LZMARegion*
+makeLZMARegion(System* s, Allocator* a, const uint8_t* in, unsigned inSize);
+
 uint8_t*
 encodeLZMA(System* s, Allocator* a, uint8_t* in, unsigned inSize,
            unsigned* outSize);
 
+// Encodes the specified data as a sequence of independently compressed
+// blocks of blockSize bytes each, which may be decoded concurrently or
+// on demand.
+uint8_t*
+encodeLZMABlocks(System* s, Allocator* a, uint8_t* in, unsigned inSize,
+                 unsigned blockSize, unsigned* outSize);
+
 } // namespace vm
 
 #endif // LZMA_H
@@ -126,6 +126,19 @@ const unsigned FixedFootprintThresholdInBytes
 // to clean them up:
 const unsigned ZombieCollectionThreshold = 16;
 
+// one in this many allocations at a profiled allocation site is
+// sampled for survival:
+const unsigned AllocationSiteSampleInterval = 64;
+
+// number of sampled objects an allocation site tracks at once:
+const unsigned AllocationSiteSampleCount = 4;
+
+// an allocation site is pretenured once at least this many of its
+// samples have either died or been tenured, and at least
+// PretenureSurvivalPercent of them were tenured:
+const unsigned PretenureMinimumSamples = 16;
+const unsigned PretenureSurvivalPercent = 90;
+
 enum FieldCode {
   VoidField,
   ByteField,
@@ -160,10 +173,12 @@ const unsigned LinkFlag = 1 << 8;
 const unsigned HasFinalMemberFlag = 1 << 9;
 const unsigned SingletonFlag = 1 << 10;
 const unsigned ContinuationFlag = 1 << 11;
+const unsigned PackedFlag = 1 << 12;
 
 // method vmFlags:
 const unsigned ClassInitFlag = 1 << 0;
 const unsigned ConstructorFlag = 1 << 1;
+const unsigned LazyCodeFlag = 1 << 2;
 
 #ifndef JNI_VERSION_1_6
 #define JNI_VERSION_1_6 0x00010006
@@ -1193,6 +1208,46 @@ class Reference {
   bool weak;
 };
 
+class AllocationSite {
+ public:
+  AllocationSite(char* name, unsigned ip, AllocationSite* next):
+    name(name),
+    ip(ip),
+    allocationCount(0),
+    survivorCount(0),
+    deathCount(0),
+    pretenured(false),
+    next(next)
+  {
+    memset(samples, 0, sizeof(samples));
+  }
+
+  char* name;
+  unsigned ip;
+  unsigned allocationCount;
+  unsigned survivorCount;
+  unsigned deathCount;
+  bool pretenured;
+  AllocationSite* next;
+
+  // these are weak references, updated (or cleared) by
+  // visitAllocationSites after each collection:
+  object samples[AllocationSiteSampleCount];
+};
+
+// A class file region kept alive for the life of the VM because
+// methods parsed from it refer to their bytecode in place (see
+// avian.lazy.code):
+class RetainedRegion {
+ public:
+  RetainedRegion(System::Region* region, RetainedRegion* next):
+    region(region), next(next)
+  { }
+
+  System::Region* region;
+  RetainedRegion* next;
+};
+
 class Classpath;
 
 class Machine {
@@ -1204,7 +1259,8 @@ class Machine {
   enum AllocationType {
     MovableAllocation,
     FixedAllocation,
-    ImmortalAllocation
+    ImmortalAllocation,
+    TenuredAllocation
   };
 
   enum Root {
@@ -1262,6 +1318,9 @@ class Machine {
   Thread* exclusive;
   Thread* finalizeThread;
   Reference* jniReferences;
+  AllocationSite* allocationSites;
+  FILE* pretenureLog;
+  RetainedRegion* retainedRegions;
   const char** properties;
   unsigned propertyCount;
   const char** arguments;
@@ -1281,6 +1340,11 @@ class Machine {
   System::Library* libraries;
   FILE* errorLog;
   BootImage* bootimage;
+  uint8_t* codeimage;
+  const uint32_t* savedHashes;
+  unsigned savedHashCount;
+  uintptr_t* savedHashHeap;
+  uintptr_t* savedHashHeapEnd;
   object types;
   object roots;
   object finalizers;
@@ -1292,12 +1356,14 @@ class Machine {
   bool collecting;
   bool triedBuiltinOnLoad;
   bool dumpedHeapOnOOM;
+  bool lazyCode;
   bool alive;
   JavaVMVTable javaVMVTable;
   JNIEnvVTable jniEnvVTable;
   uintptr_t* heapPool[ThreadHeapPoolSize];
   unsigned heapPoolIndex;
   unsigned bootimageSize;
+  unsigned codeimageSize;
 };
 
 void
@@ -1804,7 +1870,7 @@ class FixedAllocator: public Allocator {
 
   void* allocate(unsigned size, unsigned padAlignment) {
     unsigned paddedSize = pad(size, padAlignment);
-    expect(s, offset + paddedSize < capacity);
+    expect(s, offset + paddedSize <= capacity);
 
     void* p = base + offset;
     offset += paddedSize;
@@ -2199,6 +2265,12 @@ makeNew(Thread* t, object class_)
 object
 makeNewGeneral(Thread* t, object class_);
 
+AllocationSite*
+makeAllocationSite(Thread* t, object method, unsigned ip);
+
+object
+makeNew(Thread* t, object class_, AllocationSite* site);
+
 inline object
 make(Thread* t, object class_)
 {
@@ -2336,12 +2408,20 @@ takeHash(Thread*, object o)
   return (reinterpret_cast<uintptr_t>(o) / BytesPerWord) & 0x7FFFFFFF;
 }
 
+bool
+findSavedHash(Thread* t, object o, uint32_t* hash);
+
 inline uint32_t
 objectHash(Thread* t, object o)
 {
   if (objectExtended(t, o)) {
     return extendedWord(t, o, baseSize(t, o, objectClass(t, o)));
   } else {
+    uint32_t hash;
+    if (UNLIKELY(t->m->savedHashCount) and findSavedHash(t, o, &hash)) {
+      return hash;
+    }
+
     if (not objectFixed(t, o)) {
       markHashTaken(t, o);
     }
@@ -2529,11 +2609,35 @@ scanMethodSpec(Thread* t, const char* s, unsigned* parameterCount,
 object
 findLoadedClass(Thread* t, object loader, object spec);
 
+void
+loadLazyCode(Thread* t, object method);
+
+// Replaces the placeholder code of a method whose body was left in
+// its class file by the real thing.  This must be done before
+// anything but the pool, maxStack or maxLocals of the code is used.
+inline void
+loadMethodCode(Thread* t, object method)
+{
+  if (UNLIKELY(methodVmFlags(t, method) & LazyCodeFlag)) {
+    loadLazyCode(t, method);
+  }
+  loadMemoryBarrier();
+}
+
 inline bool
 emptyMethod(Thread* t, object method)
 {
-  return ((methodFlags(t, method) & ACC_NATIVE) == 0)
-    and (codeLength(t, methodCode(t, method)) == 1)
+  // empty methods are always parsed eagerly, so a method whose code
+  // has yet to be loaded is known not to be one
+  if ((methodFlags(t, method) & ACC_NATIVE)
+      or (methodVmFlags(t, method) & LazyCodeFlag))
+  {
+    return false;
+  }
+
+  loadMemoryBarrier();
+
+  return (codeLength(t, methodCode(t, method)) == 1)
     and (codeBody(t, methodCode(t, method), 0) == return_);
 }
 
@@ -2545,7 +2649,8 @@ parseUtf8(Thread* t, object array);
 
 object
 parseClass(Thread* t, object loader, const uint8_t* data, unsigned length,
-           Machine::Type throwType = Machine::NoClassDefFoundErrorType);
+           Machine::Type throwType = Machine::NoClassDefFoundErrorType,
+           bool* retain = 0);
 
 object
 resolveClass(Thread* t, object loader, object name, bool throw_ = true,
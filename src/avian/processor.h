@@ -162,6 +162,12 @@ class Processor {
   virtual void
   boot(Thread* t, BootImage* image, uint8_t* code) = 0;
 
+  virtual bool
+  checkpoint(Thread* t) = 0;
+
+  virtual void
+  shutDown(Thread* t) = 0;
+
   virtual void
   callWithCurrentContinuation(Thread* t, object receiver) = 0;
 
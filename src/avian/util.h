@@ -72,6 +72,28 @@ hashMapRemove(Thread* t, object map, object key,
               uint32_t (*hash)(Thread*, object),
               bool (*equal)(Thread*, object, object));
 
+object
+weakHashMapFindNode(Thread* t, object map, object key, uint32_t hash,
+                    bool (*equal)(Thread*, object, object));
+
+inline object
+weakHashMapFind(Thread* t, object map, object key, uint32_t hash,
+                bool (*equal)(Thread*, object, object))
+{
+  object n = weakHashMapFindNode(t, map, key, hash, equal);
+  return (n ? weakHashMapNodeValue(t, n) : 0);
+}
+
+void
+weakHashMapResize(Thread* t, object map, unsigned size);
+
+void
+weakHashMapInsert(Thread* t, object map, object key, object value,
+                  uint32_t hash);
+
+void
+weakHashMapSweep(Thread* t, Heap::Visitor* v, object map);
+
 object
 hashMapIterator(Thread* t, object map);
 
@@ -100,6 +122,9 @@ void
 treeUpdate(Thread* t, object tree, intptr_t key, object value, object sentinal,
            intptr_t (*compare)(Thread* t, intptr_t key, object b));
 
+object
+treeValues(Thread* t, object tree, object sentinal);
+
 class HashMapIterator: public Thread::Protector {
  public:
   HashMapIterator(Thread* t, object map):
@@ -4,6 +4,7 @@
 #endif
 
 FIELD(magic)
+FIELD(checksum)
 
 FIELD(initialized)
 
@@ -14,6 +15,7 @@ FIELD(bootClassCount)
 FIELD(appClassCount)
 FIELD(stringCount)
 FIELD(callCount)
+FIELD(hashCount)
 
 FIELD(bootLoader)
 FIELD(appLoader)
@@ -21,6 +23,7 @@ FIELD(types)
 FIELD(methodTree)
 FIELD(methodTreeSentinal)
 FIELD(virtualThunks)
+FIELD(classRuntimeData)
 
 #ifdef FIELD_DEFINED
 #  undef FIELD
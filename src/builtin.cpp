@@ -152,6 +152,42 @@ Avian_avian_SystemClassLoader_resourceURLPrefix
   }
 }
 
+extern "C" JNIEXPORT int64_t JNICALL
+Avian_avian_SystemClassLoader_negativeCacheHits
+(Thread* t, object, uintptr_t* arguments)
+{
+  object loader = reinterpret_cast<object>(arguments[0]);
+
+  return static_cast<Finder*>
+    (systemClassLoaderFinder(t, loader))->negativeCacheHits();
+}
+
+extern "C" JNIEXPORT int64_t JNICALL
+Avian_avian_SystemClassLoader_negativeCacheMisses
+(Thread* t, object, uintptr_t* arguments)
+{
+  object loader = reinterpret_cast<object>(arguments[0]);
+
+  return static_cast<Finder*>
+    (systemClassLoaderFinder(t, loader))->negativeCacheMisses();
+}
+
+extern "C" JNIEXPORT int64_t JNICALL
+Avian_avian_SystemClassLoader_inflateCacheHits
+(Thread* t, object, uintptr_t*)
+{
+  InflateCache* cache = t->m->appFinder->inflateCache();
+  return cache ? cache->hits() : 0;
+}
+
+extern "C" JNIEXPORT int64_t JNICALL
+Avian_avian_SystemClassLoader_inflateCacheMisses
+(Thread* t, object, uintptr_t*)
+{
+  InflateCache* cache = t->m->appFinder->inflateCache();
+  return cache ? cache->misses() : 0;
+}
+
 extern "C" JNIEXPORT int64_t JNICALL
 Avian_avian_SystemClassLoader_getClass
 (Thread* t, object, uintptr_t* arguments)
@@ -185,6 +221,13 @@ Avian_avian_Machine_dumpHeap
 
 #endif//AVIAN_HEAPDUMP
 
+extern "C" JNIEXPORT int64_t JNICALL
+Avian_avian_Machine_checkpoint
+(Thread* t, object, uintptr_t*)
+{
+  return t->m->processor->checkpoint(t);
+}
+
 extern "C" JNIEXPORT void JNICALL
 Avian_java_lang_Runtime_exit
 (Thread* t, object, uintptr_t* arguments)
@@ -657,6 +700,30 @@ Avian_sun_misc_Unsafe_compareAndSwapInt
     (&fieldAtOffset<uint32_t>(target, offset), expect, update);
 }
 
+extern "C" JNIEXPORT int64_t JNICALL
+Avian_sun_misc_Unsafe_compareAndSwapLong
+(Thread* t UNUSED, object, uintptr_t* arguments)
+{
+  object target = reinterpret_cast<object>(arguments[1]);
+  int64_t offset; memcpy(&offset, arguments + 2, 8);
+  uint64_t expect; memcpy(&expect, arguments + 4, 8);
+  uint64_t update; memcpy(&update, arguments + 6, 8);
+
+#ifdef AVIAN_HAS_CAS64
+  return atomicCompareAndSwap64
+    (&fieldAtOffset<uint64_t>(target, offset), expect, update);
+#else
+  PROTECT(t, target);
+  ACQUIRE_OBJECT(t, target);
+  if (fieldAtOffset<uint64_t>(target, offset) == expect) {
+    fieldAtOffset<uint64_t>(target, offset) = update;
+    return true;
+  } else {
+    return false;
+  }
+#endif
+}
+
 extern "C" JNIEXPORT void JNICALL
 Avian_sun_misc_Unsafe_unpark
 (Thread* t, object, uintptr_t* arguments)
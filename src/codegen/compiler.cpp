@@ -47,6 +47,9 @@ const unsigned StealRegisterReserveCount = 2;
 // compare instruction:
 const unsigned ResolveRegisterReserveCount = (TargetBytesPerWord == 8 ? 2 : 4);
 
+// loops nested deeper than this don't make their values any heavier:
+const unsigned MaxLoopWeightDepth = 6;
+
 void
 apply(Context* c, lir::UnaryOperation op,
       unsigned s1Size, Site* s1Low, Site* s1High);
@@ -595,12 +598,26 @@ isHome(Value* v, int frameIndex)
   return false;
 }
 
+// Returns true if the specified value may stay in a register across
+// the junction currently being resolved.
+bool
+mayKeepRegister(Context* c, Value* v)
+{
+  if (c->allocationPolicy == Compiler::LinearScanAllocation) {
+    LiveInterval* i = liveInterval(c, v);
+    return i == 0 or not i->spilled;
+  } else {
+    return spillWeight(c, v) >= c->junctionWeightThreshold;
+  }
+}
+
 bool
 acceptForResolve(Context* c, Site* s, Read* read, const SiteMask& mask)
 {
   if (acceptMatch(c, s, read, mask) and (not s->frozen(c))) {
     if (s->type(c) == lir::RegisterOperand) {
-      return c->availableGeneralRegisterCount > ResolveRegisterReserveCount;
+      return c->availableGeneralRegisterCount > ResolveRegisterReserveCount
+        and mayKeepRegister(c, read->value);
     } else {
       assert(c, s->match(c, SiteMask(1 << lir::MemoryOperand, 0, AnyFrameIndex)));
 
@@ -1347,6 +1364,7 @@ append(Context* c, Event* e)
     c->firstEvent = e;
   }
   c->lastEvent = e;
+  e->sequence = c->eventCount++;
 
   Event* p = c->predecessor;
   if (p) {
@@ -1563,6 +1581,11 @@ resolveTargetSites(Context* c, Event* e, SiteRecordList* frozen, Site** sites)
       SiteMask mask((1 << lir::RegisterOperand) | (1 << lir::MemoryOperand),
                     c->regFile->generalRegisters.mask, AnyFrameIndex);
 
+      if (not mayKeepRegister(c, v)) {
+        // leave the registers to heavier values
+        mask = SiteMask(1 << lir::MemoryOperand, 0, AnyFrameIndex);
+      }
+
       Site* s = pickSourceSite
         (c, r, 0, 0, &mask, false, true, true, acceptForResolve);
 
@@ -1644,12 +1667,52 @@ captureBranchSnapshots(Context* c, Event* e)
   }
 }
 
+unsigned
+junctionWeightThreshold(Context* c, Event* e)
+{
+  if (c->allocationPolicy != Compiler::LoopWeightedAllocation) {
+    return 0;
+  }
+
+  unsigned registerCount
+    = c->availableGeneralRegisterCount > ResolveRegisterReserveCount
+    ? c->availableGeneralRegisterCount - ResolveRegisterReserveCount : 0;
+
+  // sort the weights of the live values, heaviest first, and let only
+  // as many of them as we have registers for stay in registers
+  unsigned footprint = frameFootprint(c, e->stackAfter);
+  RUNTIME_ARRAY(unsigned, weights, footprint);
+  unsigned count = 0;
+  for (FrameIterator it(c, e->stackAfter, e->localsAfter); it.hasMore();) {
+    Value* v = it.next(c).value;
+    if (live(c, v)) {
+      unsigned weight = spillWeight(c, v);
+      unsigned i = count++;
+      for (; i and RUNTIME_ARRAY_BODY(weights)[i - 1] < weight; --i) {
+        RUNTIME_ARRAY_BODY(weights)[i] = RUNTIME_ARRAY_BODY(weights)[i - 1];
+      }
+      RUNTIME_ARRAY_BODY(weights)[i] = weight;
+    }
+  }
+
+  if (count > registerCount) {
+    return registerCount
+      ? RUNTIME_ARRAY_BODY(weights)[registerCount - 1] : ~0u;
+  } else {
+    return 0;
+  }
+}
+
 void
 populateSiteTables(Context* c, Event* e, SiteRecordList* frozen)
 {
+  c->junctionWeightThreshold = junctionWeightThreshold(c, e);
+
   resolveJunctionSites(c, e, frozen);
 
   resolveBranchSites(c, e, frozen);
+
+  c->junctionWeightThreshold = 0;
 }
 
 void
@@ -1832,6 +1895,226 @@ updateJunctionReads(Context* c, JunctionState* state)
   }
 }
 
+void
+computeSpillWeights(Context* c)
+{
+  // a branch to an earlier instruction closes a loop, and every
+  // instruction between the target and the branch belongs to it
+  for (Event* e = c->firstEvent; e; e = e->next) {
+    int start = e->logicalInstruction->index;
+    int end = start;
+    for (Link* pl = e->predecessors; pl; pl = pl->nextPredecessor) {
+      int index = pl->predecessor->logicalInstruction->index;
+      if (index > end) {
+        end = index;
+      }
+    }
+
+    if (end > start) {
+      for (int i = start; i <= end; ++i) {
+        if (c->logicalCode[i]) {
+          ++ c->logicalCode[i]->loopDepth;
+        }
+      }
+    }
+  }
+
+  // weigh each read by the depth of the loop it occurs in, assuming
+  // every level of nesting runs its body eight times as often
+  for (Event* e = c->firstEvent; e; e = e->next) {
+    unsigned depth = e->logicalInstruction->loopDepth;
+    unsigned weight = 1 << (3 * (depth < MaxLoopWeightDepth
+                                 ? depth : MaxLoopWeightDepth));
+
+    for (Read* r = e->reads; r; r = r->eventNext) {
+      Value* v = r->value;
+      v->weight = (v->weight + weight < v->weight)
+        ? ~0u : v->weight + weight;
+    }
+  }
+}
+
+class Loop {
+ public:
+  Loop(Loop* next, unsigned start, unsigned end):
+    next(next), start(start), end(end)
+  { }
+
+  Loop* next;
+  unsigned start;
+  unsigned end;
+};
+
+// Computes the live interval of each value read by an event, and
+// returns them as an array indexed by the event they start at.
+LiveInterval**
+computeLiveIntervals(Context* c)
+{
+  LiveInterval* intervals = 0;
+  Loop* loops = 0;
+
+  for (Event* e = c->firstEvent; e; e = e->next) {
+    for (Link* pl = e->predecessors; pl; pl = pl->nextPredecessor) {
+      if (pl->predecessor->sequence > e->sequence) {
+        loops = new(c->zone) Loop(loops, e->sequence, pl->predecessor->sequence);
+      }
+    }
+
+    // a value is live from the event which defines it to its last
+    // read, and buddies share one interval, since they share sites
+    for (Read* r = e->reads; r; r = r->eventNext) {
+      Value* v = r->value;
+      LiveInterval* i = liveInterval(c, v);
+      if (i == 0) {
+        i = intervals = new(c->zone) LiveInterval
+          (intervals, v, v->definition, e->sequence);
+      }
+
+      v->interval = i;
+      if (v->definition < i->start) {
+        i->start = v->definition;
+      }
+      if (e->sequence > i->end) {
+        i->end = e->sequence;
+      }
+    }
+  }
+
+  // a value which is live on entry to a loop and read inside it must
+  // stay live until the branch back to the start of the loop
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (LiveInterval* i = intervals; i; i = i->next) {
+      for (Loop* l = loops; l; l = l->next) {
+        if (i->start < l->start and i->end >= l->start and i->end < l->end) {
+          i->end = l->end;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  LiveInterval** byStart = static_cast<LiveInterval**>
+    (c->zone->allocate(c->eventCount * sizeof(LiveInterval*)));
+  memset(byStart, 0, c->eventCount * sizeof(LiveInterval*));
+
+  for (LiveInterval* i = intervals; i;) {
+    LiveInterval* next = i->next;
+    i->next = byStart[i->start];
+    byStart[i->start] = i;
+    i = next;
+  }
+
+  return byStart;
+}
+
+// Assigns general registers to live intervals in order of their
+// start, spilling the lightest interval whenever there are more live
+// than registers to go around.  The assignments are only advice:
+// pickRegisterTarget prefers a value's assigned register, and values
+// whose intervals were spilled go to memory at junctions, but the
+// events still allocate as they always have.  Floating point values
+// are left to the events.
+void
+linearScan(Context* c)
+{
+  LiveInterval** byStart = computeLiveIntervals(c);
+
+  // pickRegisterTarget tries the highest registers first, so we leave
+  // the lowest ones for temporaries:
+  int available[32];
+  unsigned availableCount = 0;
+  unsigned reserve = ResolveRegisterReserveCount;
+  for (int r = c->regFile->generalRegisters.start;
+       r < static_cast<int>(c->regFile->generalRegisters.limit); ++r)
+  {
+    if (not c->registerResources[r].reserved) {
+      if (reserve) {
+        -- reserve;
+      } else {
+        available[availableCount++] = r;
+      }
+    }
+  }
+
+  LiveInterval* active[32];
+  unsigned activeCount = 0;
+
+  for (unsigned start = 0; start < c->eventCount; ++start) {
+    for (LiveInterval* i = byStart[start]; i; i = i->next) {
+      if (i->value->type != lir::ValueGeneral) {
+        continue;
+      }
+
+      i->weight = spillWeight(c, i->value);
+
+      for (unsigned j = 0; j < activeCount;) {
+        if (active[j]->end < start) {
+          available[availableCount++] = active[j]->number;
+          active[j] = active[--activeCount];
+        } else {
+          ++ j;
+        }
+      }
+
+      if (availableCount) {
+        i->number = available[--availableCount];
+        active[activeCount++] = i;
+      } else {
+        unsigned lightest = 0;
+        for (unsigned j = 1; j < activeCount; ++j) {
+          if (active[j]->weight < active[lightest]->weight) {
+            lightest = j;
+          }
+        }
+
+        if (activeCount and active[lightest]->weight < i->weight) {
+          i->number = active[lightest]->number;
+          active[lightest]->number = lir::NoRegister;
+          active[lightest]->spilled = true;
+          active[lightest] = i;
+        } else {
+          i->spilled = true;
+        }
+      }
+    }
+  }
+}
+
+void
+compileColdCalls(Context* c)
+{
+  Assembler* a = c->assembler;
+
+  // rarely taken calls are placed after everything else, so find the
+  // block which resolve() will visit last and chain them onto it:
+  Block* last = c->firstBlock;
+  while (last->nextBlock or last->nextInstruction) {
+    last = last->nextBlock
+      ? last->nextBlock
+      : last->nextInstruction->firstEvent->block;
+  }
+
+  Block* cold = compiler::block(c, 0);
+  last->nextBlock = cold;
+
+  for (ColdCall* p = c->firstColdCall; p;
+       p = static_cast<ColdCall*>(p->next))
+  {
+    p->promise->offset = a->offset();
+
+    lir::Constant handler(resolvedPromise(c, p->handler));
+    a->apply(lir::Call, OperandInfo
+             (TargetBytesPerWord, lir::ConstantOperand, &handler));
+
+    // the handler never returns, but stack walking may still inspect
+    // the instruction at the return address:
+    a->apply(lir::Trap);
+  }
+
+  cold->assemblerBlock = a->endBlock(false);
+}
+
 void
 compile(Context* c, uintptr_t stackOverflowHandler, unsigned stackLimitOffset)
 {
@@ -1839,6 +2122,14 @@ compile(Context* c, uintptr_t stackOverflowHandler, unsigned stackLimitOffset)
     appendDummy(c);
   }
 
+  if (c->allocationPolicy != Compiler::LocalAllocation) {
+    computeSpillWeights(c);
+
+    if (c->allocationPolicy == Compiler::LinearScanAllocation) {
+      linearScan(c);
+    }
+  }
+
   Assembler* a = c->assembler;
 
   Block* firstBlock = block(c, c->firstEvent);
@@ -1953,7 +2244,8 @@ compile(Context* c, uintptr_t stackOverflowHandler, unsigned stackLimitOffset)
       }
 
       block->nextInstruction = nextInstruction;
-      block->assemblerBlock = a->endBlock(e->next != 0);
+      block->assemblerBlock = a->endBlock
+        (e->next != 0 or c->firstColdCall != 0);
 
       if (e->next) {
         block = compiler::block(c, e->next);
@@ -1962,6 +2254,10 @@ compile(Context* c, uintptr_t stackOverflowHandler, unsigned stackLimitOffset)
   }
 
   c->firstBlock = firstBlock;
+
+  if (c->firstColdCall) {
+    compileColdCalls(c);
+  }
 }
 
 void
@@ -2112,8 +2408,8 @@ class Client: public Assembler::Client {
 class MyCompiler: public Compiler {
  public:
   MyCompiler(System* s, Assembler* assembler, Zone* zone,
-             Compiler::Client* compilerClient):
-    c(s, assembler, zone, compilerClient), client(&c)
+             Compiler::Client* compilerClient, AllocationPolicy policy):
+    c(s, assembler, zone, compilerClient, policy), client(&c)
   {
     assembler->setClient(&client);
   }
@@ -2556,10 +2852,10 @@ class MyCompiler: public Compiler {
   }
 
   virtual void checkBounds(Operand* object, unsigned lengthOffset,
-                           Operand* index, intptr_t handler)
+                           Operand* index, intptr_t handler, bool outOfLine)
   {
     appendBoundsCheck(&c, static_cast<Value*>(object), lengthOffset,
-                      static_cast<Value*>(index), handler);
+                      static_cast<Value*>(index), handler, outOfLine);
   }
 
   virtual void store(unsigned srcSize, Operand* src, unsigned dstSize,
@@ -2905,6 +3201,38 @@ class MyCompiler: public Compiler {
     return result;
   }
 
+  virtual Operand* rol(unsigned size, Operand* a, Operand* b) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendCombine(&c, lir::RotateLeft, TargetBytesPerWord, static_cast<Value*>(a),
+                  size, static_cast<Value*>(b), size, result);
+    return result;
+  }
+
+  virtual Operand* ror(unsigned size, Operand* a, Operand* b) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendCombine(&c, lir::RotateRight, TargetBytesPerWord, static_cast<Value*>(a),
+                  size, static_cast<Value*>(b), size, result);
+    return result;
+  }
+
+  virtual Operand* min(unsigned size, Operand* a, Operand* b) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendCombine(&c, lir::Min, size, static_cast<Value*>(a),
+                  size, static_cast<Value*>(b), size, result);
+    return result;
+  }
+
+  virtual Operand* max(unsigned size, Operand* a, Operand* b) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendCombine(&c, lir::Max, size, static_cast<Value*>(a),
+                  size, static_cast<Value*>(b), size, result);
+    return result;
+  }
+
   virtual Operand* neg(unsigned size, Operand* a) {
   	assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
     Value* result = value(&c, lir::ValueGeneral);
@@ -2926,6 +3254,36 @@ class MyCompiler: public Compiler {
     return result;
   }
 
+  virtual Operand* popcnt(unsigned size, Operand* a) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendTranslate(&c, lir::PopCount, size, static_cast<Value*>(a), size, result);
+    return result;
+  }
+
+  virtual Operand* clz(unsigned size, Operand* a) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendTranslate
+      (&c, lir::CountLeadingZeros, size, static_cast<Value*>(a), size, result);
+    return result;
+  }
+
+  virtual Operand* ctz(unsigned size, Operand* a) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendTranslate
+      (&c, lir::CountTrailingZeros, size, static_cast<Value*>(a), size, result);
+    return result;
+  }
+
+  virtual Operand* bswap(unsigned size, Operand* a) {
+    assert(&c, static_cast<Value*>(a)->type == lir::ValueGeneral);
+    Value* result = value(&c, lir::ValueGeneral);
+    appendTranslate(&c, lir::ByteSwap, size, static_cast<Value*>(a), size, result);
+    return result;
+  }
+
   virtual Operand* fabs(unsigned size, Operand* a) {
     assert(&c, static_cast<Value*>(a)->type == lir::ValueFloat);
     Value* result = value(&c, lir::ValueFloat);
@@ -3008,6 +3366,18 @@ class MyCompiler: public Compiler {
       (block->start, 0) + c.assembler->footerSize();
   }
 
+  virtual void setDestination(uint8_t* dst) {
+    // the resolved code is position-independent apart from word
+    // alignment, so it may be written somewhere other than where it
+    // was resolved:
+    c.machineCode = dst;
+    c.assembler->setDestination(dst);
+  }
+
+  virtual ColdPath* coldPaths() {
+    return c.firstColdCall;
+  }
+
   virtual unsigned poolSize() {
     return c.constantCount * TargetBytesPerWord;
   }
@@ -3054,9 +3424,10 @@ class MyCompiler: public Compiler {
 
 Compiler*
 makeCompiler(System* system, Assembler* assembler, Zone* zone,
-             Compiler::Client* client)
+             Compiler::Client* client, Compiler::AllocationPolicy policy)
 {
-  return new(zone) compiler::MyCompiler(system, assembler, zone, client);
+  return new(zone) compiler::MyCompiler
+    (system, assembler, zone, client, policy);
 }
 
 } // namespace codegen
@@ -18,7 +18,7 @@ namespace codegen {
 namespace compiler {
 
 Context::Context(vm::System* system, Assembler* assembler, vm::Zone* zone,
-          Compiler::Client* client):
+          Compiler::Client* client, Compiler::AllocationPolicy policy):
   system(system),
   assembler(assembler),
   arch(assembler->arch()),
@@ -44,6 +44,8 @@ Context::Context(vm::System* system, Assembler* assembler, vm::Zone* zone,
   forkState(0),
   subroutine(0),
   firstBlock(0),
+  firstColdCall(0),
+  lastColdCall(0),
   logicalIp(-1),
   constantCount(0),
   logicalCodeLength(0),
@@ -51,7 +53,10 @@ Context::Context(vm::System* system, Assembler* assembler, vm::Zone* zone,
   localFootprint(0),
   machineCodeSize(0),
   alignedFrameSize(0),
-  availableGeneralRegisterCount(regFile->generalRegisters.limit - regFile->generalRegisters.start)
+  availableGeneralRegisterCount(regFile->generalRegisters.limit - regFile->generalRegisters.start),
+  eventCount(0),
+  junctionWeightThreshold(0),
+  allocationPolicy(policy)
 {
   for (unsigned i = regFile->generalRegisters.start; i < regFile->generalRegisters.limit; ++i) {
     new (registerResources + i) RegisterResource(arch->reserved(i));
@@ -36,6 +36,7 @@ class ConstantPoolNode;
 class ForkState;
 class MySubroutine;
 class Block;
+class ColdCall;
 
 template<class T>
 class Cell {
@@ -71,7 +72,7 @@ Cell<T>* reverseDestroy(Cell<T>* cell) {
 class Context {
  public:
   Context(vm::System* system, Assembler* assembler, vm::Zone* zone,
-          Compiler::Client* client);
+          Compiler::Client* client, Compiler::AllocationPolicy policy);
 
   vm::System* system;
   Assembler* assembler;
@@ -96,6 +97,8 @@ class Context {
   ForkState* forkState;
   MySubroutine* subroutine;
   Block* firstBlock;
+  ColdCall* firstColdCall;
+  ColdCall* lastColdCall;
   int logicalIp;
   unsigned constantCount;
   unsigned logicalCodeLength;
@@ -104,6 +107,9 @@ class Context {
   unsigned machineCodeSize;
   unsigned alignedFrameSize;
   unsigned availableGeneralRegisterCount;
+  unsigned eventCount;
+  unsigned junctionWeightThreshold;
+  Compiler::AllocationPolicy allocationPolicy;
 };
 
 inline Aborter* getAborter(Context* c) {
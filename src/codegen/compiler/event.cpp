@@ -90,7 +90,7 @@ Event::Event(Context* c):
   stackAfter(0), localsAfter(0), promises(0), reads(0),
   junctionSites(0), snapshots(0), predecessors(0), successors(0),
   visitLinks(0), block(0), logicalInstruction(c->logicalCode[c->logicalIp]),
-  readCount(0)
+  readCount(0), sequence(0)
 { }
 
 void Event::addRead(Context* c, Value* v, Read* r) {
@@ -1517,12 +1517,25 @@ void appendJump(Context* c, lir::UnaryOperation type, Value* address, bool exit,
   append(c, new(c->zone) JumpEvent(c, type, address, exit, cleanLocals));
 }
 
+void
+appendColdCall(Context* c, unsigned logicalIp, CodePromise* promise,
+               intptr_t handler)
+{
+  ColdCall* call = new(c->zone) ColdCall(logicalIp, promise, handler);
+  if (c->lastColdCall) {
+    c->lastColdCall->next = call;
+  } else {
+    c->firstColdCall = call;
+  }
+  c->lastColdCall = call;
+}
+
 class BoundsCheckEvent: public Event {
  public:
   BoundsCheckEvent(Context* c, Value* object, unsigned lengthOffset,
-                   Value* index, intptr_t handler):
+                   Value* index, intptr_t handler, bool outOfLine):
     Event(c), object(object), lengthOffset(lengthOffset), index(index),
-    handler(handler)
+    handler(handler), outOfLine(outOfLine)
   {
     this->addRead(c, object, generalRegisterMask(c));
     this->addRead(c, index, generalRegisterOrConstantMask(c));
@@ -1555,7 +1568,32 @@ class BoundsCheckEvent: public Event {
         vm::TargetBytesPerWord, &oob, &oob);
     }
 
-    if (constant == 0 or constant->value->value() >= 0) {
+    if ((constant == 0 or constant->value->value() >= 0) and outOfLine) {
+      assert(c, object->source->type(c) == lir::RegisterOperand);
+      MemorySite length(static_cast<RegisterSite*>(object->source)->number,
+                        lengthOffset, lir::NoRegister, 1);
+      length.acquired = true;
+
+      if (outOfBoundsPromise == 0) {
+        outOfBoundsPromise = compiler::codePromise
+          (c, static_cast<Promise*>(0));
+      }
+
+      freezeSource(c, vm::TargetBytesPerWord, index);
+
+      // the failure path is emitted after the rest of the method, so
+      // the common case falls through:
+      ConstantSite oob(outOfBoundsPromise);
+      apply(c, lir::JumpIfLessOrEqual,
+        4, index->source,
+        index->source, 4, &length,
+        &length, vm::TargetBytesPerWord, &oob, &oob);
+
+      thawSource(c, vm::TargetBytesPerWord, index);
+
+      appendColdCall
+        (c, logicalInstruction->index, outOfBoundsPromise, handler);
+    } else if (constant == 0 or constant->value->value() >= 0) {
       assert(c, object->source->type(c) == lir::RegisterOperand);
       MemorySite length(static_cast<RegisterSite*>(object->source)->number,
                         lengthOffset, lir::NoRegister, 1);
@@ -1592,13 +1630,15 @@ class BoundsCheckEvent: public Event {
   unsigned lengthOffset;
   Value* index;
   intptr_t handler;
+  bool outOfLine;
 };
 
 void
 appendBoundsCheck(Context* c, Value* object, unsigned lengthOffset,
-                  Value* index, intptr_t handler)
+                  Value* index, intptr_t handler, bool outOfLine)
 {
-  append(c, new(c->zone) BoundsCheckEvent(c, object, lengthOffset, index, handler));
+  append(c, new(c->zone) BoundsCheckEvent
+         (c, object, lengthOffset, index, handler, outOfLine));
 }
 
 
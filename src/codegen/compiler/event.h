@@ -72,6 +72,7 @@ class Event {
   Block* block;
   LogicalInstruction* logicalInstruction;
   unsigned readCount;
+  unsigned sequence;
 };
 
 class StubReadPair {
@@ -153,7 +154,7 @@ appendJump(Context* c, lir::UnaryOperation type, Value* address, bool exit = fal
 
 void
 appendBoundsCheck(Context* c, Value* object, unsigned lengthOffset,
-                  Value* index, intptr_t handler);
+                  Value* index, intptr_t handler, bool outOfLine);
 
 void
 appendFrameSite(Context* c, Value* value, int index);
@@ -9,6 +9,7 @@
    details. */
 
 #include "codegen/compiler/context.h"
+#include "codegen/compiler/promise.h"
 #include "codegen/compiler/ir.h"
 
 namespace avian {
@@ -17,7 +18,8 @@ namespace compiler {
 
 LogicalInstruction::LogicalInstruction(int index, Stack* stack, Local* locals):
   firstEvent(0), lastEvent(0), immediatePredecessor(0), stack(stack),
-  locals(locals), machineOffset(0), subroutine(0), index(index)
+  locals(locals), machineOffset(0), subroutine(0), index(index),
+  loopDepth(0)
 { }
 
 LogicalInstruction* LogicalInstruction::next(Context* c) {
@@ -59,6 +59,7 @@ class LogicalInstruction {
   Promise* machineOffset;
   MySubroutine* subroutine;
   int index;
+  unsigned loopDepth;
 };
 
 class MySubroutine: public Compiler::Subroutine {
@@ -68,6 +69,17 @@ class MySubroutine: public Compiler::Subroutine {
   ForkState* forkState;
 };
 
+class ColdCall: public Compiler::ColdPath {
+ public:
+  ColdCall(unsigned logicalIp, CodePromise* promise, intptr_t handler):
+    Compiler::ColdPath(logicalIp, promise), promise(promise),
+    handler(handler)
+  { }
+
+  CodePromise* promise;
+  intptr_t handler;
+};
+
 class Block {
  public:
   Block(Event* head);
@@ -29,6 +29,20 @@ RegisterAllocator::RegisterAllocator(Aborter* a, const RegisterFile* registerFil
 unsigned totalFrameSize(Context* c);
 Read* live(Context* c UNUSED, Value* v);
 
+unsigned
+stealWeightPenalty(Context* c, Value* thief, Value* victim)
+{
+  // when allocating by spill weight, avoid evicting a value which is
+  // used more heavily than the one we're making room for
+  if (c->allocationPolicy != Compiler::LocalAllocation
+      and spillWeight(c, victim) > (thief ? spillWeight(c, thief) : 0))
+  {
+    return Target::StealPenalty;
+  } else {
+    return 0;
+  }
+}
+
 unsigned
 resourceCost(Context* c, Value* v, Resource* r, SiteMask mask,
              CostCalculator* costCalculator)
@@ -45,9 +59,10 @@ resourceCost(Context* c, Value* v, Resource* r, SiteMask mask,
       if (v and r->value->isBuddyOf(v)) {
         return baseCost;
       } else if (r->value->uniqueSite(c, r->site)) {
-        return baseCost + Target::StealUniquePenalty;
+        return baseCost + Target::StealUniquePenalty
+          + stealWeightPenalty(c, v, r->value);
       } else {
-        return baseCost = Target::StealPenalty;
+        return Target::StealPenalty + stealWeightPenalty(c, v, r->value);
       }
     } else {
       return baseCost;
@@ -55,6 +70,20 @@ resourceCost(Context* c, Value* v, Resource* r, SiteMask mask,
   }
 }
 
+unsigned
+registerPreferencePenalty(Context* c, Value* v, int number)
+{
+  // if the linear scan allocator gave the value a register, the
+  // others cost a little more, though still no more than memory
+  if (v and c->allocationPolicy == Compiler::LinearScanAllocation) {
+    LiveInterval* i = liveInterval(c, v);
+    if (i and i->number != lir::NoRegister and i->number != number) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 bool
 pickRegisterTarget(Context* c, int i, Value* v, uint32_t mask, int* target,
                    unsigned* cost, CostCalculator* costCalculator)
@@ -65,6 +94,10 @@ pickRegisterTarget(Context* c, int i, Value* v, uint32_t mask, int* target,
       (c, v, r, SiteMask(1 << lir::RegisterOperand, 1 << i, NoFrameIndex), costCalculator)
       + Target::MinimumRegisterCost;
 
+    if (myCost < Target::Impossible) {
+      myCost += registerPreferencePenalty(c, v, i);
+    }
+
     if ((static_cast<uint32_t>(1) << i) == mask) {
       *cost = myCost;
       return true;
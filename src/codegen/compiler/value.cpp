@@ -19,7 +19,7 @@ namespace compiler {
 
 Value::Value(Site* site, Site* target, lir::ValueType type):
   reads(0), lastRead(0), sites(site), source(0), target(target), buddy(this),
-  nextWord(this), home(NoFrameIndex), type(type), wordIndex(0)
+  nextWord(this), interval(0), definition(0), weight(0), home(NoFrameIndex), type(type), wordIndex(0)
 { }
 
 bool Value::findSite(Site* site) {
@@ -156,7 +156,36 @@ bool Value::hasBuddy(Context* c, Value* b) {
 
 
 Value* value(Context* c, lir::ValueType type, Site* site, Site* target) {
-  return new(c->zone) Value(site, target, type);
+  Value* v = new(c->zone) Value(site, target, type);
+
+  // the event which defines a value is appended after it is created
+  v->definition = c->eventCount;
+  return v;
+}
+
+unsigned spillWeight(Context* c UNUSED, Value* v) {
+  // buddies share their sites, so spilling one spills them all
+  unsigned weight = 0;
+  Value* p = v;
+  do {
+    weight += p->weight;
+    if (weight < p->weight) return ~0u;
+    p = p->buddy;
+  } while (p != v);
+
+  return weight;
+}
+
+LiveInterval* liveInterval(Context* c UNUSED, Value* v) {
+  // buddies share an interval, but some are only created once the
+  // intervals have been computed
+  Value* p = v;
+  do {
+    if (p->interval) return p->interval;
+    p = p->buddy;
+  } while (p != v);
+
+  return 0;
 }
 
 } // namespace regalloc
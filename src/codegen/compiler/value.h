@@ -20,12 +20,33 @@ namespace compiler {
 
 class Read;
 class Site;
+class Value;
 
 const int AnyFrameIndex = -2;
 const int NoFrameIndex = -1;
 
 const bool DebugSites = false;
 
+// the events, numbered in the order they were appended, during which
+// a value (along with its buddies) is live, and the register the
+// linear scan allocator gave it, if any
+class LiveInterval {
+ public:
+  LiveInterval(LiveInterval* next, Value* value, unsigned start,
+               unsigned end):
+    next(next), value(value), start(start), end(end), weight(0),
+    number(lir::NoRegister), spilled(false)
+  { }
+
+  LiveInterval* next;
+  Value* value;
+  unsigned start;
+  unsigned end;
+  unsigned weight;
+  int8_t number;
+  bool spilled;
+};
+
 class Value: public Compiler::Operand {
  public:
   Read* reads;
@@ -35,6 +56,9 @@ class Value: public Compiler::Operand {
   Site* target;
   Value* buddy;
   Value* nextWord;
+  LiveInterval* interval;
+  unsigned definition;
+  unsigned weight;
   int16_t home;
   lir::ValueType type;
   uint8_t wordIndex;
@@ -70,6 +94,10 @@ class Value: public Compiler::Operand {
 
 Value* value(Context* c, lir::ValueType type, Site* site = 0, Site* target = 0);
 
+unsigned spillWeight(Context* c, Value* v);
+
+LiveInterval* liveInterval(Context* c, Value* v);
+
 } // namespace compiler
 } // namespace codegen
 } // namespace avian
@@ -357,6 +357,10 @@ class MyArchitecture: public Architecture {
       break;
 
     case lir::Absolute:
+    case lir::PopCount:
+    case lir::CountLeadingZeros:
+    case lir::CountTrailingZeros:
+    case lir::ByteSwap:
       *thunk = true;
       break;
 
@@ -495,6 +499,10 @@ class MyArchitecture: public Architecture {
     case lir::Divide:
     case lir::Remainder:
     case lir::FloatRemainder:
+    case lir::RotateLeft:
+    case lir::RotateRight:
+    case lir::Min:
+    case lir::Max:
       *thunk = true;
       break;
 
@@ -550,6 +558,14 @@ class MyArchitecture: public Architecture {
 
   virtual Assembler* makeAssembler(Allocator* allocator, Zone* zone);
 
+  virtual unsigned features() {
+    return 0;
+  }
+
+  virtual void setFeatures(unsigned) {
+    // no optional features are used by this backend
+  }
+
   virtual void acquire() {
     ++ referenceCount;
   }
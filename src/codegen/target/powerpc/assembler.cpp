@@ -462,6 +462,10 @@ class MyArchitecture: public Architecture {
     case lir::Float2Float:
     case lir::Float2Int:
     case lir::Int2Float:
+    case lir::PopCount:
+    case lir::CountLeadingZeros:
+    case lir::CountTrailingZeros:
+    case lir::ByteSwap:
       *thunk = true;
       break;
 
@@ -563,6 +567,10 @@ class MyArchitecture: public Architecture {
     case lir::JumpIfFloatGreaterOrUnordered:
     case lir::JumpIfFloatLessOrEqualOrUnordered:
     case lir::JumpIfFloatGreaterOrEqualOrUnordered:
+    case lir::RotateLeft:
+    case lir::RotateRight:
+    case lir::Min:
+    case lir::Max:
       *thunk = true;
       break;
 
@@ -588,6 +596,14 @@ class MyArchitecture: public Architecture {
 
   virtual Assembler* makeAssembler(Allocator* allocator, Zone* zone);
 
+  virtual unsigned features() {
+    return 0;
+  }
+
+  virtual void setFeatures(unsigned) {
+    // no optional features are used by this backend
+  }
+
   virtual void acquire() {
     ++ referenceCount;
   }
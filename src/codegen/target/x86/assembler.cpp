@@ -402,8 +402,14 @@ class MyArchitecture: public Architecture {
     case lir::FloatSquareRoot:
       return false;
 
+    case lir::PopCount:
+    case lir::CountLeadingZeros:
+    case lir::CountTrailingZeros:
+      return false;
+
     case lir::Negate:
     case lir::Absolute:
+    case lir::ByteSwap:
       return true;
 
     default:
@@ -411,8 +417,18 @@ class MyArchitecture: public Architecture {
     }
   }
   
-  virtual bool alwaysCondensed(lir::TernaryOperation) {
-    return true;
+  virtual bool alwaysCondensed(lir::TernaryOperation op) {
+    switch (op) {
+    case lir::FloatAdd:
+    case lir::FloatSubtract:
+    case lir::FloatMultiply:
+    case lir::FloatDivide:
+      // the VEX encodings take a separate destination operand
+      return not useAVX(&c);
+
+    default:
+      return true;
+    }
   }
 
   virtual int returnAddressOffset() {
@@ -467,6 +483,24 @@ class MyArchitecture: public Architecture {
         *thunk = true;
       }
       break;  
+
+    case lir::PopCount:
+      if (usePopcnt(&c) and aSize <= TargetBytesPerWord) {
+        aMask.typeMask = (1 << lir::RegisterOperand);
+      } else {
+        *thunk = true;
+      }
+      break;
+
+    case lir::CountLeadingZeros:
+    case lir::CountTrailingZeros:
+    case lir::ByteSwap:
+      if (aSize <= TargetBytesPerWord) {
+        aMask.typeMask = (1 << lir::RegisterOperand);
+      } else {
+        *thunk = true;
+      }
+      break;
   
     case lir::FloatNegate:
       // floatNegateRR does not support doubles
@@ -567,10 +601,17 @@ class MyArchitecture: public Architecture {
       break;
 
     case lir::Negate:
+    case lir::ByteSwap:
       bMask.typeMask = (1 << lir::RegisterOperand);
       bMask.registerMask = aMask.registerMask;
       break;
 
+    case lir::PopCount:
+    case lir::CountLeadingZeros:
+    case lir::CountTrailingZeros:
+      bMask.typeMask = (1 << lir::RegisterOperand);
+      break;
+
     case lir::FloatNegate:
     case lir::FloatSquareRoot:
     case lir::Float2Float:
@@ -749,6 +790,29 @@ class MyArchitecture: public Architecture {
       }
     } break;
 
+    case lir::RotateLeft:
+    case lir::RotateRight:
+      if (bSize > TargetBytesPerWord) {
+        *thunk = true;
+      } else {
+        aMask.registerMask = (static_cast<uint64_t>(GeneralRegisterMask) << 32)
+          | (static_cast<uint64_t>(1) << rcx);
+        const uint32_t mask = GeneralRegisterMask & ~(1 << rcx);
+        bMask.registerMask = (static_cast<uint64_t>(mask) << 32) | mask;
+      }
+      break;
+
+    case lir::Min:
+    case lir::Max:
+      // cmov is guaranteed to be available on any processor which
+      // supports SSE2
+      if (aSize > TargetBytesPerWord or not useSSE(&c)) {
+        *thunk = true;
+      } else {
+        aMask.typeMask = (1 << lir::RegisterOperand);
+      }
+      break;
+
     case lir::JumpIfFloatEqual:
     case lir::JumpIfFloatNotEqual:
     case lir::JumpIfFloatLess:
@@ -784,14 +848,28 @@ class MyArchitecture: public Architecture {
     if (isBranch(op)) {
       cMask.typeMask = (1 << lir::ConstantOperand);
       cMask.registerMask = 0;
-    } else {
+    } else if (alwaysCondensed(op)) {
       cMask.typeMask = (1 << lir::RegisterOperand);
       cMask.registerMask = bMask.registerMask;
+    } else {
+      cMask.typeMask = (1 << lir::RegisterOperand);
+      cMask.registerMask = (static_cast<uint64_t>(FloatRegisterMask) << 32)
+        | FloatRegisterMask;
     }
   }
 
   virtual Assembler* makeAssembler(Allocator* allocator, Zone* zone);
 
+  virtual unsigned features() {
+    return c.features;
+  }
+
+  virtual void setFeatures(unsigned features) {
+    c.features = features;
+    myRegisterFile = RegisterFile
+      (GeneralRegisterMask, useSSE(&c) ? FloatRegisterMask : 0);
+  }
+
   virtual void acquire() {
     ++ referenceCount;
   }
@@ -804,7 +882,7 @@ class MyArchitecture: public Architecture {
 
   ArchitectureContext c;
   unsigned referenceCount;
-  const RegisterFile myRegisterFile;
+  RegisterFile myRegisterFile;
 };
 
 class MyAssembler: public Assembler {
@@ -1062,6 +1140,12 @@ class MyAssembler: public Assembler {
 
       arch_->c.branchOperations[branchIndex(&(arch_->c), a.type, b.type)]
         (&this->c, op, a.size, a.operand, b.operand, c.operand);
+    } else if (not arch_->alwaysCondensed(op)) {
+      assert(&this->c, c.type == lir::RegisterOperand);
+
+      arch_->c.ternaryOperations
+        [ternaryIndex(&(arch_->c), op, a.type, b.type)]
+        (&this->c, a.size, a.operand, b.size, b.operand, c.size, c.operand);
     } else {
       assert(&this->c, b.size == c.size);
       assert(&this->c, b.type == c.type);
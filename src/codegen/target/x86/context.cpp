@@ -13,13 +13,15 @@
 
 #include "context.h"
 #include "block.h"
+#include "detect.h"
 
 namespace avian {
 namespace codegen {
 namespace x86 {
 
 ArchitectureContext::ArchitectureContext(vm::System* s, bool useNativeFeatures):
-  s(s), useNativeFeatures(useNativeFeatures)
+  s(s), useNativeFeatures(useNativeFeatures),
+  features(useNativeFeatures ? detectFeatures() : 0)
 { }
 
 Context::Context(vm::System* s, vm::Allocator* a, vm::Zone* zone, ArchitectureContext* ac):
@@ -13,6 +13,7 @@
 
 #define CAST1(x) reinterpret_cast<UnaryOperationType>(x)
 #define CAST2(x) reinterpret_cast<BinaryOperationType>(x)
+#define CAST3(x) reinterpret_cast<TernaryOperationType>(x)
 #define CAST_BRANCH(x) reinterpret_cast<BranchOperationType>(x)
 
 #include <stdint.h>
@@ -50,6 +51,10 @@ typedef void (*UnaryOperationType)(Context*, unsigned, lir::Operand*);
 typedef void (*BinaryOperationType)
 (Context*, unsigned, lir::Operand*, unsigned, lir::Operand*);
 
+typedef void (*TernaryOperationType)
+(Context*, unsigned, lir::Operand*, unsigned, lir::Operand*, unsigned,
+ lir::Operand*);
+
 typedef void (*BranchOperationType)
 (Context*, lir::TernaryOperation, unsigned, lir::Operand*,
  lir::Operand*, lir::Operand*);
@@ -60,6 +65,7 @@ class ArchitectureContext {
 
   vm::System* s;
   bool useNativeFeatures;
+  unsigned features;
   OperationType operations[lir::OperationCount];
   UnaryOperationType unaryOperations[lir::UnaryOperationCount
                                      * lir::OperandTypeCount];
@@ -67,6 +73,10 @@ class ArchitectureContext {
   [(lir::BinaryOperationCount + lir::NonBranchTernaryOperationCount)
    * lir::OperandTypeCount
    * lir::OperandTypeCount];
+  TernaryOperationType ternaryOperations
+  [lir::NonBranchTernaryOperationCount
+   * lir::OperandTypeCount
+   * lir::OperandTypeCount];
   BranchOperationType branchOperations
   [lir::BranchOperationCount
    * lir::OperandTypeCount
@@ -1,4 +1,3 @@
-
 /* Copyright (c) 2008-2012, Avian Contributors
 
    Permission to use, copy, modify, and/or distribute this software
@@ -9,31 +8,132 @@
    There is NO WARRANTY for this software.  See license.txt for
    details. */
 
+#ifdef _MSC_VER
+#  include "intrin.h"
+#endif
+
 #include "avian/target.h"
 
+#include <avian/vm/codegen/targets.h>
+
 #include "context.h"
+#include "detect.h"
+
+namespace {
+
+#if (defined __i386__) || (defined __x86_64__) \
+  || (defined _M_IX86) || (defined _M_X64)
+
+void
+cpuid(unsigned leaf, unsigned subleaf, uint32_t* registers)
+{
+#ifdef _MSC_VER
+  int r[4];
+  __cpuidex(r, leaf, subleaf);
+  for (unsigned i = 0; i < 4; ++i) {
+    registers[i] = r[i];
+  }
+#elif (defined __i386__)
+  // ebx may hold the GOT pointer in position-independent code, so
+  // older compilers won't let us clobber it; swap it out instead
+  __asm__ __volatile__("movl %%ebx, %1\n\t"
+                       "cpuid\n\t"
+                       "xchgl %%ebx, %1"
+                       : "=a"(registers[0]), "=&r"(registers[1]),
+                         "=c"(registers[2]), "=d"(registers[3])
+                       : "a"(leaf), "c"(subleaf));
+#else
+  __asm__ __volatile__("cpuid"
+                       : "=a"(registers[0]), "=b"(registers[1]),
+                         "=c"(registers[2]), "=d"(registers[3])
+                       : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+uint64_t
+xgetbv()
+{
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  uint32_t low;
+  uint32_t high;
+  __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" // xgetbv
+                       : "=a"(low), "=d"(high) : "c"(0));
+  return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+}
+
+#endif
+
+} // namespace
 
 namespace avian {
 namespace codegen {
 namespace x86 {
 
-extern "C" bool
-detectFeature(unsigned ecx, unsigned edx);
+unsigned detectFeatures() {
+  unsigned features = 0;
 
-bool useSSE(ArchitectureContext* c) {
-  if (vm::TargetBytesPerWord == 8) {
-    // amd64 implies SSE2 support
-    return true;
-  } else if (c->useNativeFeatures) {
-    static int supported = -1;
-    if (supported == -1) {
-      supported = detectFeature(0, 0x2000000) // SSE 1
-        and detectFeature(0, 0x4000000); // SSE 2
-    }
-    return supported;
-  } else {
-    return false;
+#if (defined __i386__) || (defined __x86_64__) \
+  || (defined _M_IX86) || (defined _M_X64)
+  const unsigned eax = 0;
+  const unsigned ebx = 1;
+  const unsigned ecx = 2;
+  const unsigned edx = 3;
+
+  uint32_t r[4];
+  cpuid(0, 0, r);
+  unsigned maxLeaf = r[eax];
+
+  cpuid(1, 0, r);
+  if (r[edx] & (1 << 25)) features |= SSEFeature;
+  if (r[edx] & (1 << 26)) features |= SSE2Feature;
+  if (r[ecx] & (1 << 23)) features |= PopcntFeature;
+
+  // AVX is only usable if the OS saves and restores the YMM state,
+  // which it advertises via OSXSAVE and XCR0
+  if ((r[ecx] & (1 << 27)) and (r[ecx] & (1 << 28))
+      and (xgetbv() & 6) == 6)
+  {
+    features |= AvxFeature;
   }
+
+  if (maxLeaf >= 7) {
+    cpuid(7, 0, r);
+    if (r[ebx] & (1 << 3)) features |= Bmi1Feature;
+  }
+
+  cpuid(0x80000000, 0, r);
+  if (r[eax] >= 0x80000001) {
+    cpuid(0x80000001, 0, r);
+    if (r[ecx] & (1 << 5)) features |= LzcntFeature;
+  }
+#endif
+
+  return features;
+}
+
+bool useSSE(ArchitectureContext* c) {
+  // amd64 implies SSE2 support
+  return vm::TargetBytesPerWord == 8
+    or ((c->features & SSEFeature) and (c->features & SSE2Feature));
+}
+
+bool usePopcnt(ArchitectureContext* c) {
+  return c->features & PopcntFeature;
+}
+
+bool useLzcnt(ArchitectureContext* c) {
+  return c->features & LzcntFeature;
+}
+
+bool useTzcnt(ArchitectureContext* c) {
+  return c->features & Bmi1Feature;
+}
+
+bool useAVX(ArchitectureContext* c) {
+  return useSSE(c) and (c->features & AvxFeature);
 }
 
 } // namespace x86
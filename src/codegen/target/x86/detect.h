@@ -19,8 +19,18 @@ namespace x86 {
 
 class ArchitectureContext;
 
+unsigned detectFeatures();
+
 bool useSSE(ArchitectureContext* c);
 
+bool usePopcnt(ArchitectureContext* c);
+
+bool useLzcnt(ArchitectureContext* c);
+
+bool useTzcnt(ArchitectureContext* c);
+
+bool useAVX(ArchitectureContext* c);
+
 } // namespace x86
 } // namespace codegen
 } // namespace avian
@@ -21,6 +21,7 @@
 #include "encode.h"
 #include "registers.h"
 #include "fixup.h"
+#include "detect.h"
 
 using namespace avian::util;
 
@@ -88,6 +89,39 @@ void maybeRex(Context* c, unsigned size, lir::Memory* a) {
   maybeRex(c, size, lir::NoRegister, a->index, a->base, false);
 }
 
+// Emits a VEX prefix for a 128-bit instruction in the 0F opcode map.
+// The implied legacy prefix (none, 66, F3, or F2) is given by pp
+// (0 to 3), a is the operand encoded in ModRM.reg, v is the additional
+// source register (or NoRegister), and index and base are the
+// registers encoded in ModRM.rm and the SIB byte, if any.
+void vex(Context* c, unsigned pp, bool w, int a, int v, int index, int base) {
+  bool r = a != lir::NoRegister and (a & 8);
+  bool x = index != lir::NoRegister and (index & 8);
+  bool b = base != lir::NoRegister and (base & 8);
+  unsigned vvvv = (v == lir::NoRegister ? 0 : v & 15);
+
+  if (x or b or w) {
+    c->code.append(0xc4);
+    c->code.append((r ? 0 : 0x80) | (x ? 0 : 0x40) | (b ? 0 : 0x20) | 0x01);
+    c->code.append((w ? 0x80 : 0) | ((~vvvv & 15) << 3) | pp);
+  } else {
+    c->code.append(0xc5);
+    c->code.append((r ? 0 : 0x80) | ((~vvvv & 15) << 3) | pp);
+  }
+}
+
+void vex(Context* c, unsigned pp, bool w, lir::Register* a, int v,
+         lir::Register* b)
+{
+  vex(c, pp, w, a->low, v, lir::NoRegister, b->low);
+}
+
+void vex(Context* c, unsigned pp, bool w, lir::Register* a, int v,
+         lir::Memory* b)
+{
+  vex(c, pp, w, a->low, v, b->index, b->base);
+}
+
 void modrm(Context* c, uint8_t mod, int a, int b) {
   c->code.append(mod | (regCode(b) << 3) | regCode(a));
 }
@@ -157,10 +191,26 @@ void sseMoveRR(Context* c, unsigned aSize, lir::Register* a,
   assert(c, aSize >= 4);
   assert(c, aSize == bSize);
 
-  if (isFloatReg(a) and isFloatReg(b)) {
+  if (useAVX(c->ac)) {
+    if (isFloatReg(a) and isFloatReg(b)) {
+      // vmovaps copies the whole register, avoiding a dependency on
+      // the previous contents of the destination
+      vex(c, 0, false, b, lir::NoRegister, a);
+      opcode(c, 0x28);
+      modrm(c, 0xc0, a, b);
+    } else if (isFloatReg(a)) {
+      vex(c, 1, aSize == 8, a, lir::NoRegister, b);
+      opcode(c, 0x7e);
+      modrm(c, 0xc0, b, a);
+    } else {
+      vex(c, 1, aSize == 8, b, lir::NoRegister, a);
+      opcode(c, 0x6e);
+      modrm(c, 0xc0, a, b);
+    }
+  } else if (isFloatReg(a) and isFloatReg(b)) {
     if (aSize == 4) {
       opcode(c, 0xf3);
-      maybeRex(c, 4, a, b);
+      maybeRex(c, 4, b, a);
       opcode(c, 0x0f, 0x10);
       modrm(c, 0xc0, a, b);
     } else {
@@ -197,7 +247,16 @@ void sseMoveMR(Context* c, unsigned aSize, lir::Memory* a,
 {
   assert(c, aSize >= 4);
 
-  if (vm::TargetBytesPerWord == 4 and aSize == 8) {
+  if (useAVX(c->ac)) {
+    if (vm::TargetBytesPerWord == 4 and aSize == 8) {
+      vex(c, 2, false, b, lir::NoRegister, a);
+      opcode(c, 0x7e);
+    } else {
+      vex(c, 1, aSize == 8, b, lir::NoRegister, a);
+      opcode(c, 0x6e);
+    }
+    modrmSibImm(c, b, a);
+  } else if (vm::TargetBytesPerWord == 4 and aSize == 8) {
     opcode(c, 0xf3);
     opcode(c, 0x0f, 0x7e);
     modrmSibImm(c, b, a);
@@ -215,7 +274,16 @@ void sseMoveRM(Context* c, unsigned aSize, lir::Register* a,
   assert(c, aSize >= 4);
   assert(c, aSize == bSize);
 
-  if (vm::TargetBytesPerWord == 4 and aSize == 8) {
+  if (useAVX(c->ac)) {
+    if (vm::TargetBytesPerWord == 4 and aSize == 8) {
+      vex(c, 1, false, a, lir::NoRegister, b);
+      opcode(c, 0xd6);
+    } else {
+      vex(c, 1, aSize == 8, a, lir::NoRegister, b);
+      opcode(c, 0x7e);
+    }
+    modrmSibImm(c, a, b);
+  } else if (vm::TargetBytesPerWord == 4 and aSize == 8) {
     opcode(c, 0x66);
     opcode(c, 0x0f, 0xd6);
     modrmSibImm(c, a, b);
@@ -339,6 +407,22 @@ void floatMemOp(Context* c, unsigned aSize, lir::Memory* a, unsigned bSize,
   modrmSibImm(c, b, a);
 }
 
+void vexFloatRegOp(Context* c, unsigned aSize, lir::Register* a,
+                   lir::Register* b, lir::Register* dst, uint8_t op)
+{
+  vex(c, aSize == 4 ? 2 : 3, false, dst, b->low, a);
+  opcode(c, op);
+  modrm(c, 0xc0, a, dst);
+}
+
+void vexFloatMemOp(Context* c, unsigned aSize, lir::Memory* a,
+                   lir::Register* b, lir::Register* dst, uint8_t op)
+{
+  vex(c, aSize == 4 ? 2 : 3, false, dst, b->low, a);
+  opcode(c, op);
+  modrmSibImm(c, dst, a);
+}
+
 void moveCR(Context* c, unsigned aSize, lir::Constant* a,
        unsigned bSize, lir::Register* b);
 
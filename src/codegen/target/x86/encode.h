@@ -49,6 +49,14 @@ inline bool isFloatReg(lir::Register* a) {
   return a->low >= xmm0;
 }
 
+void vex(Context* c, unsigned pp, bool w, int a, int v, int index, int base);
+
+void vex(Context* c, unsigned pp, bool w, lir::Register* a, int v,
+         lir::Register* b);
+
+void vex(Context* c, unsigned pp, bool w, lir::Register* a, int v,
+         lir::Memory* b);
+
 void modrm(Context* c, uint8_t mod, int a, int b);
 
 void modrm(Context* c, uint8_t mod, lir::Register* a, lir::Register* b);
@@ -91,6 +99,12 @@ void floatRegOp(Context* c, unsigned aSize, lir::Register* a, unsigned bSize,
 void floatMemOp(Context* c, unsigned aSize, lir::Memory* a, unsigned bSize,
            lir::Register* b, uint8_t op);
 
+void vexFloatRegOp(Context* c, unsigned aSize, lir::Register* a,
+                   lir::Register* b, lir::Register* dst, uint8_t op);
+
+void vexFloatMemOp(Context* c, unsigned aSize, lir::Memory* a,
+                   lir::Register* b, lir::Register* dst, uint8_t op);
+
 void moveCR2(Context* c, UNUSED unsigned aSize, lir::Constant* a,
         UNUSED unsigned bSize, lir::Register* b, unsigned promiseOffset);
 
@@ -47,6 +47,17 @@ unsigned index(ArchitectureContext* c UNUSED, lir::TernaryOperation operation,
        * lir::OperandTypeCount * operand2);
 }
 
+unsigned ternaryIndex(ArchitectureContext* c UNUSED,
+                      lir::TernaryOperation operation,
+                      lir::OperandType operand1, lir::OperandType operand2)
+{
+  assert(c, not isBranch(operation));
+
+  return operation
+    + (lir::NonBranchTernaryOperationCount * operand1)
+    + (lir::NonBranchTernaryOperationCount * lir::OperandTypeCount * operand2);
+}
+
 unsigned branchIndex(ArchitectureContext* c UNUSED, lir::OperandType operand1,
             lir::OperandType operand2)
 {
@@ -63,6 +74,7 @@ void populateTables(ArchitectureContext* c) {
   OperationType* zo = c->operations;
   UnaryOperationType* uo = c->unaryOperations;
   BinaryOperationType* bo = c->binaryOperations;
+  TernaryOperationType* to = c->ternaryOperations;
   BranchOperationType* bro = c->branchOperations;
 
   zo[lir::Return] = return_;
@@ -164,6 +176,35 @@ void populateTables(ArchitectureContext* c) {
   bo[index(c, lir::Absolute, R, R)] = CAST2(absoluteRR);
   bo[index(c, lir::FloatAbsolute, R, R)] = CAST2(floatAbsoluteRR);
 
+  bo[index(c, lir::PopCount, R, R)] = CAST2(popCountRR);
+  bo[index(c, lir::CountLeadingZeros, R, R)] = CAST2(countLeadingZerosRR);
+  bo[index(c, lir::CountTrailingZeros, R, R)] = CAST2(countTrailingZerosRR);
+  bo[index(c, lir::ByteSwap, R, R)] = CAST2(byteSwapRR);
+
+  bo[index(c, lir::RotateLeft, R, R)] = CAST2(rotateLeftRR);
+  bo[index(c, lir::RotateLeft, C, R)] = CAST2(rotateLeftCR);
+
+  bo[index(c, lir::RotateRight, R, R)] = CAST2(rotateRightRR);
+  bo[index(c, lir::RotateRight, C, R)] = CAST2(rotateRightCR);
+
+  bo[index(c, lir::Min, R, R)] = CAST2(minRR);
+  bo[index(c, lir::Max, R, R)] = CAST2(maxRR);
+
+  // three-operand forms, used instead of the above when the
+  // destination need not be the second source (see
+  // MyArchitecture::alwaysCondensed)
+  to[ternaryIndex(c, lir::FloatAdd, R, R)] = CAST3(floatAddRRR);
+  to[ternaryIndex(c, lir::FloatAdd, M, R)] = CAST3(floatAddMRR);
+
+  to[ternaryIndex(c, lir::FloatSubtract, R, R)] = CAST3(floatSubtractRRR);
+  to[ternaryIndex(c, lir::FloatSubtract, M, R)] = CAST3(floatSubtractMRR);
+
+  to[ternaryIndex(c, lir::FloatMultiply, R, R)] = CAST3(floatMultiplyRRR);
+  to[ternaryIndex(c, lir::FloatMultiply, M, R)] = CAST3(floatMultiplyMRR);
+
+  to[ternaryIndex(c, lir::FloatDivide, R, R)] = CAST3(floatDivideRRR);
+  to[ternaryIndex(c, lir::FloatDivide, M, R)] = CAST3(floatDivideMRR);
+
   bro[branchIndex(c, R, R)] = CAST_BRANCH(branchRR);
   bro[branchIndex(c, C, R)] = CAST_BRANCH(branchCR);
   bro[branchIndex(c, C, M)] = CAST_BRANCH(branchCM);
@@ -28,6 +28,10 @@ unsigned index(ArchitectureContext*, lir::BinaryOperation operation,
 unsigned index(ArchitectureContext* c UNUSED, lir::TernaryOperation operation,
       lir::OperandType operand1, lir::OperandType operand2);
 
+unsigned ternaryIndex(ArchitectureContext* c UNUSED,
+                      lir::TernaryOperation operation,
+                      lir::OperandType operand1, lir::OperandType operand2);
+
 unsigned branchIndex(ArchitectureContext* c UNUSED, lir::OperandType operand1,
             lir::OperandType operand2);
 
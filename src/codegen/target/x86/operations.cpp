@@ -1453,6 +1453,62 @@ void floatDivideMR(Context* c, unsigned aSize, lir::Memory* a,
   floatMemOp(c, aSize, a, 4, b, 0x5e);
 }
 
+void floatAddRRR(Context* c, unsigned aSize, lir::Register* a,
+            unsigned bSize UNUSED, lir::Register* b,
+            unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatRegOp(c, aSize, a, b, dst, 0x58);
+}
+
+void floatAddMRR(Context* c, unsigned aSize, lir::Memory* a,
+            unsigned bSize UNUSED, lir::Register* b,
+            unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatMemOp(c, aSize, a, b, dst, 0x58);
+}
+
+void floatSubtractRRR(Context* c, unsigned aSize, lir::Register* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatRegOp(c, aSize, a, b, dst, 0x5c);
+}
+
+void floatSubtractMRR(Context* c, unsigned aSize, lir::Memory* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatMemOp(c, aSize, a, b, dst, 0x5c);
+}
+
+void floatMultiplyRRR(Context* c, unsigned aSize, lir::Register* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatRegOp(c, aSize, a, b, dst, 0x59);
+}
+
+void floatMultiplyMRR(Context* c, unsigned aSize, lir::Memory* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatMemOp(c, aSize, a, b, dst, 0x59);
+}
+
+void floatDivideRRR(Context* c, unsigned aSize, lir::Register* a,
+               unsigned bSize UNUSED, lir::Register* b,
+               unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatRegOp(c, aSize, a, b, dst, 0x5e);
+}
+
+void floatDivideMRR(Context* c, unsigned aSize, lir::Memory* a,
+               unsigned bSize UNUSED, lir::Register* b,
+               unsigned cSize UNUSED, lir::Register* dst)
+{
+  vexFloatMemOp(c, aSize, a, b, dst, 0x5e);
+}
+
 void float2FloatRR(Context* c, unsigned aSize, lir::Register* a,
               unsigned bSize UNUSED, lir::Register* b)
 {
@@ -1539,6 +1595,175 @@ void floatAbsoluteRR(Context* c, unsigned aSize UNUSED, lir::Register* a,
   }
 }
 
+void popCountRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b)
+{
+  assert(c, aSize == bSize and aSize <= vm::TargetBytesPerWord);
+
+  opcode(c, 0xf3);
+  maybeRex(c, aSize, b, a);
+  opcode(c, 0x0f, 0xb8);
+  modrm(c, 0xc0, a, b);
+}
+
+void countLeadingZerosRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b)
+{
+  assert(c, aSize == bSize and aSize <= vm::TargetBytesPerWord);
+
+  if (useLzcnt(c->ac)) {
+    opcode(c, 0xf3);
+    maybeRex(c, aSize, b, a);
+    opcode(c, 0x0f, 0xbd);
+    modrm(c, 0xc0, a, b);
+    return;
+  }
+
+  unsigned bits = aSize * 8;
+
+  // bsr
+  maybeRex(c, aSize, b, a);
+  opcode(c, 0x0f, 0xbd);
+  modrm(c, 0xc0, a, b);
+
+  // bsr leaves the destination undefined if the source is zero, in
+  // which case we substitute a value which the xor below will turn
+  // into the width of the operand
+  opcode(c, 0x75); // jnz
+  unsigned next = c->code.length();
+  c->code.append(0);
+
+  ResolvedPromise zeroPromise((bits * 2) - 1);
+  lir::Constant zero(&zeroPromise);
+  moveCR(c, 4, &zero, 4, b);
+
+  int8_t nextOffset = c->code.length() - next - 1;
+  c->code.set(next, &nextOffset, 1);
+
+  // convert the index of the highest set bit to a count of the zeros
+  // above it
+  ResolvedPromise maskPromise(bits - 1);
+  lir::Constant mask(&maskPromise);
+  xorCR(c, aSize, &mask, aSize, b);
+}
+
+void countTrailingZerosRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b)
+{
+  assert(c, aSize == bSize and aSize <= vm::TargetBytesPerWord);
+
+  if (useTzcnt(c->ac)) {
+    opcode(c, 0xf3);
+    maybeRex(c, aSize, b, a);
+    opcode(c, 0x0f, 0xbc);
+    modrm(c, 0xc0, a, b);
+    return;
+  }
+
+  // bsf
+  maybeRex(c, aSize, b, a);
+  opcode(c, 0x0f, 0xbc);
+  modrm(c, 0xc0, a, b);
+
+  // as with bsr above, the result is undefined for a zero source
+  opcode(c, 0x75); // jnz
+  unsigned next = c->code.length();
+  c->code.append(0);
+
+  ResolvedPromise zeroPromise(aSize * 8);
+  lir::Constant zero(&zeroPromise);
+  moveCR(c, 4, &zero, 4, b);
+
+  int8_t nextOffset = c->code.length() - next - 1;
+  c->code.set(next, &nextOffset, 1);
+}
+
+void byteSwapRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b UNUSED)
+{
+  assert(c, aSize == bSize and aSize <= vm::TargetBytesPerWord);
+  assert(c, a->low == b->low);
+
+  maybeRex(c, aSize, a);
+  opcode(c, 0x0f, 0xc8 + regCode(a));
+}
+
+void rotateLeftRR(Context* c, unsigned aSize UNUSED, lir::Register* a,
+      unsigned bSize, lir::Register* b)
+{
+  assert(c, a->low == rcx);
+  assert(c, bSize <= vm::TargetBytesPerWord);
+
+  maybeRex(c, bSize, a, b);
+  opcode(c, 0xd3, 0xc0 + regCode(b));
+}
+
+void rotateCR(Context* c, int type, unsigned bSize, lir::Constant* a,
+      lir::Register* b)
+{
+  assert(c, bSize <= vm::TargetBytesPerWord);
+
+  // the processor would mask the distance the same way, but it must
+  // fit in the immediate field
+  int64_t v = a->value->value() & ((bSize * 8) - 1);
+
+  maybeRex(c, bSize, b);
+  if (v == 1) {
+    opcode(c, 0xd1, type + regCode(b));
+  } else {
+    opcode(c, 0xc1, type + regCode(b));
+    c->code.append(v);
+  }
+}
+
+void rotateLeftCR(Context* c, unsigned aSize UNUSED, lir::Constant* a,
+      unsigned bSize, lir::Register* b)
+{
+  rotateCR(c, 0xc0, bSize, a, b);
+}
+
+void rotateRightRR(Context* c, unsigned aSize UNUSED, lir::Register* a,
+      unsigned bSize, lir::Register* b)
+{
+  assert(c, a->low == rcx);
+  assert(c, bSize <= vm::TargetBytesPerWord);
+
+  maybeRex(c, bSize, a, b);
+  opcode(c, 0xd3, 0xc8 + regCode(b));
+}
+
+void rotateRightCR(Context* c, unsigned aSize UNUSED, lir::Constant* a,
+      unsigned bSize, lir::Register* b)
+{
+  rotateCR(c, 0xc8, bSize, a, b);
+}
+
+void minRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b)
+{
+  assert(c, aSize == bSize and aSize <= vm::TargetBytesPerWord);
+
+  compareRR(c, aSize, a, aSize, b);
+
+  // cmovg
+  maybeRex(c, aSize, b, a);
+  opcode(c, 0x0f, 0x4f);
+  modrm(c, 0xc0, a, b);
+}
+
+void maxRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b)
+{
+  assert(c, aSize == bSize and aSize <= vm::TargetBytesPerWord);
+
+  compareRR(c, aSize, a, aSize, b);
+
+  // cmovl
+  maybeRex(c, aSize, b, a);
+  opcode(c, 0x0f, 0x4c);
+  modrm(c, 0xc0, a, b);
+}
+
 void absoluteRR(Context* c, unsigned aSize, lir::Register* a,
       unsigned bSize UNUSED, lir::Register* b UNUSED)
 {
@@ -236,6 +236,38 @@ void floatDivideRR(Context* c, unsigned aSize, lir::Register* a,
 void floatDivideMR(Context* c, unsigned aSize, lir::Memory* a,
               unsigned bSize UNUSED, lir::Register* b);
 
+void floatAddRRR(Context* c, unsigned aSize, lir::Register* a,
+            unsigned bSize UNUSED, lir::Register* b,
+            unsigned cSize UNUSED, lir::Register* dst);
+
+void floatAddMRR(Context* c, unsigned aSize, lir::Memory* a,
+            unsigned bSize UNUSED, lir::Register* b,
+            unsigned cSize UNUSED, lir::Register* dst);
+
+void floatSubtractRRR(Context* c, unsigned aSize, lir::Register* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst);
+
+void floatSubtractMRR(Context* c, unsigned aSize, lir::Memory* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst);
+
+void floatMultiplyRRR(Context* c, unsigned aSize, lir::Register* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst);
+
+void floatMultiplyMRR(Context* c, unsigned aSize, lir::Memory* a,
+                 unsigned bSize UNUSED, lir::Register* b,
+                 unsigned cSize UNUSED, lir::Register* dst);
+
+void floatDivideRRR(Context* c, unsigned aSize, lir::Register* a,
+               unsigned bSize UNUSED, lir::Register* b,
+               unsigned cSize UNUSED, lir::Register* dst);
+
+void floatDivideMRR(Context* c, unsigned aSize, lir::Memory* a,
+               unsigned bSize UNUSED, lir::Register* b,
+               unsigned cSize UNUSED, lir::Register* dst);
+
 void float2FloatRR(Context* c, unsigned aSize, lir::Register* a,
               unsigned bSize UNUSED, lir::Register* b);
 
@@ -260,6 +292,39 @@ void floatNegateRR(Context* c, unsigned aSize, lir::Register* a,
 void floatAbsoluteRR(Context* c, unsigned aSize UNUSED, lir::Register* a,
            unsigned bSize UNUSED, lir::Register* b);
 
+void popCountRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b);
+
+void countLeadingZerosRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b);
+
+void countTrailingZerosRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b);
+
+void byteSwapRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b UNUSED);
+
+void rotateLeftRR(Context* c, unsigned aSize UNUSED, lir::Register* a,
+      unsigned bSize, lir::Register* b);
+
+void rotateCR(Context* c, int type, unsigned bSize, lir::Constant* a,
+      lir::Register* b);
+
+void rotateLeftCR(Context* c, unsigned aSize UNUSED, lir::Constant* a,
+      unsigned bSize, lir::Register* b);
+
+void rotateRightRR(Context* c, unsigned aSize UNUSED, lir::Register* a,
+      unsigned bSize, lir::Register* b);
+
+void rotateRightCR(Context* c, unsigned aSize UNUSED, lir::Constant* a,
+      unsigned bSize, lir::Register* b);
+
+void minRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b);
+
+void maxRR(Context* c, unsigned aSize, lir::Register* a,
+      unsigned bSize UNUSED, lir::Register* b);
+
 void absoluteRR(Context* c, unsigned aSize, lir::Register* a,
       unsigned bSize UNUSED, lir::Register* b UNUSED);
 
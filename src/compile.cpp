@@ -14,6 +14,7 @@
 #include "avian/process.h"
 #include "avian/target.h"
 #include "avian/arch.h"
+#include "avian/heapwalk.h"
 
 #include <avian/vm/codegen/assembler.h>
 #include <avian/vm/codegen/architecture.h>
@@ -22,6 +23,10 @@
 
 #include <avian/util/runtime-array.h>
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 using namespace vm;
 
 extern "C" uint64_t
@@ -51,6 +56,8 @@ const bool DebugCallTable = false;
 const bool DebugMethodTree = false;
 const bool DebugFrameMaps = false;
 const bool DebugIntrinsics = false;
+const bool DebugEscapes = false;
+const bool DebugRanges = false;
 
 const bool CheckArrayBounds = true;
 
@@ -66,6 +73,32 @@ const unsigned InitialZoneCapacityInBytes = 64 * 1024;
 
 const unsigned ExecutableAreaSizeInBytes = 30 * 1024 * 1024;
 
+const unsigned DefaultCodeCacheLimitInBytes = 256 * 1024 * 1024;
+
+const uint32_t CodeCacheFileMagic = 0x41564343; // "AVCC"
+
+const uint32_t BootImageMapMagic = 0x4156424d; // "AVBM"
+
+const uint32_t CheckpointMagic = 0x41564350; // "AVCP"
+
+// stands in for the address of the default thunk in code objects
+// saved to a checkpoint, since that thunk is compiled at runtime
+const intptr_t UnlinkedCode = -1;
+
+const unsigned MaxScalarSites = 30;
+
+const unsigned MaxScalarFields = 16;
+
+const unsigned MaxScalarArguments = 16;
+
+const unsigned MaxScalarStores = 32;
+
+const unsigned MaxEscapeStateFootprint = 64 * 1024;
+
+const unsigned MaxRangeStateFootprint = 64 * 1024;
+
+const unsigned MaxLoadExpressions = 32;
+
 enum Root {
   CallTable,
   MethodTree,
@@ -75,7 +108,8 @@ enum Root {
   VirtualThunks,
   ReceiveMethod,
   WindMethod,
-  RewindMethod
+  RewindMethod,
+  CodeCache
 };
 
 enum ThunkIndex {
@@ -92,7 +126,7 @@ enum ThunkIndex {
   dummyIndex
 };
 
-const unsigned RootCount = RewindMethod + 1;
+const unsigned RootCount = CodeCache + 1;
 
 inline bool
 isVmInvokeUnsafeStack(void* ip)
@@ -103,6 +137,533 @@ isVmInvokeUnsafeStack(void* ip)
     < reinterpret_cast<uintptr_t> (voidPointer(vmInvoke_safeStack));
 }
 
+// Executable memory for compiled methods and thunks.  We allocate
+// linearly from the current segment, and when that fills up we map
+// another, provided the total stays under the limit and the new
+// segment lies within a window around the first one which is small
+// enough that code in any segment can reach code in any other with a
+// direct call or jump.  Space released by the code sweeper (see
+// sweepCode) is kept on a free list and reused first.
+class CodeAllocator: public FixedAllocator {
+ public:
+  class Segment {
+   public:
+    Segment(Segment* next, uint8_t* base, unsigned capacity):
+      next(next), base(base), capacity(capacity)
+    { }
+
+    Segment* next;
+    uint8_t* base;
+    unsigned capacity;
+  };
+
+  class Fragment {
+   public:
+    Fragment(Fragment* next, unsigned size): next(next), size(size) { }
+
+    Fragment* next;
+    unsigned size;
+  };
+
+  CodeAllocator(System* s, Allocator* allocator):
+    FixedAllocator(s, 0, 0),
+    allocator(allocator),
+    segments(0),
+    fragments(0),
+    windowStart(0),
+    windowEnd(0),
+    footprint(0),
+    limit(0),
+    segmentSize(0),
+    fragmentFootprint(0),
+    allocated(0),
+    allocatedAtSweep(0),
+    sweep(false)
+  { }
+
+  void initialize(uint8_t* base, unsigned capacity, unsigned limit,
+                  uintptr_t reach, bool sweep)
+  {
+    this->base = base;
+    this->offset = 0;
+    this->capacity = capacity;
+    this->footprint = capacity;
+    this->limit = max(limit, capacity);
+    this->segmentSize = capacity;
+    this->sweep = sweep;
+
+    windowStart = reinterpret_cast<uintptr_t>(base);
+    windowEnd = windowStart + capacity;
+
+    if (this->limit > capacity and reach > capacity) {
+      // leave room for more segments on either side of the first one
+      // while keeping the whole window within reach:
+      uintptr_t slack = (reach - capacity) / 4;
+      uintptr_t top = ~static_cast<uintptr_t>(0);
+      windowStart = windowStart > slack ? windowStart - slack : 0;
+      windowEnd = top - windowEnd > slack ? windowEnd + slack : top;
+    }
+  }
+
+  void* allocate(unsigned size, unsigned padAlignment) {
+    unsigned paddedSize = pad(size, padAlignment);
+
+    for (Fragment** p = &fragments; *p; p = &((*p)->next)) {
+      Fragment* f = *p;
+      if (f->size >= paddedSize) {
+        allocated += paddedSize;
+
+        if (f->size - paddedSize >= sizeof(Fragment)) {
+          fragmentFootprint -= paddedSize;
+          f->size -= paddedSize;
+          return reinterpret_cast<uint8_t*>(f) + f->size;
+        } else {
+          fragmentFootprint -= f->size;
+          *p = f->next;
+          return f;
+        }
+      }
+    }
+
+    if (offset + paddedSize > capacity) {
+      expect(s, grow(paddedSize));
+    }
+
+    allocated += paddedSize;
+
+    return FixedAllocator::allocate(paddedSize, padAlignment);
+  }
+
+  virtual void* allocate(unsigned size) {
+    return allocate(size, BytesPerWord);
+  }
+
+  virtual void free(const void* p, unsigned size) {
+    if (p >= base and static_cast<const uint8_t*>(p) + size == base + offset) {
+      offset -= size;
+    } else {
+      release(const_cast<void*>(p), size);
+    }
+  }
+
+  void release(void* p, unsigned size) {
+    if (size >= sizeof(Fragment)) {
+      fragments = new (p) Fragment(fragments, size);
+      fragmentFootprint += size;
+    }
+  }
+
+  bool grow(unsigned minimum) {
+    unsigned size = max(segmentSize, minimum);
+    if (limit - footprint < size) {
+      return false;
+    }
+
+    uint8_t* p = static_cast<uint8_t*>(s->tryAllocateExecutable(size, 0));
+    uintptr_t start = reinterpret_cast<uintptr_t>(p);
+    if (p == 0 or start < windowStart or start + size > windowEnd) {
+      // we can't get memory within reach of the existing code, so
+      // don't bother trying again
+      if (p) {
+        s->freeExecutable(p, size);
+      }
+      limit = footprint;
+      return false;
+    }
+
+    release(base + offset, capacity - offset);
+
+    segments = new (allocator->allocate(sizeof(Segment)))
+      Segment(segments, base, capacity);
+
+    base = p;
+    offset = 0;
+    capacity = size;
+    footprint += size;
+
+    return true;
+  }
+
+  unsigned available() {
+    return (capacity - offset) + fragmentFootprint + (limit - footprint);
+  }
+
+  // we sweep when less than an eighth of a segment is left, provided
+  // at least that much has been allocated since the last sweep
+  bool needsSweep() {
+    unsigned threshold = segmentSize / 8;
+    return sweep
+      and available() < threshold
+      and allocated - allocatedAtSweep >= threshold;
+  }
+
+  void swept() {
+    allocatedAtSweep = allocated;
+  }
+
+  void dispose() {
+    if (base) {
+      s->freeExecutable(base, capacity);
+    }
+
+    for (Segment* segment = segments; segment;) {
+      Segment* next = segment->next;
+      s->freeExecutable(segment->base, segment->capacity);
+      allocator->free(segment, sizeof(Segment));
+      segment = next;
+    }
+  }
+
+  Allocator* allocator;
+  Segment* segments;
+  Fragment* fragments;
+  uintptr_t windowStart;
+  uintptr_t windowEnd;
+  unsigned footprint;
+  unsigned limit;
+  unsigned segmentSize;
+  unsigned fragmentFootprint;
+  uintptr_t allocated;
+  uintptr_t allocatedAtSweep;
+  bool sweep;
+};
+
+// Writes a temporary file and renames it to the specified path, so
+// that other processes never see a partial one.
+bool
+writeFile(const char* path, const void* data, unsigned size)
+{
+  unsigned length = strlen(path);
+  RUNTIME_ARRAY(char, tmp, length + 5);
+  memcpy(RUNTIME_ARRAY_BODY(tmp), path, length);
+  memcpy(RUNTIME_ARRAY_BODY(tmp) + length, ".tmp", 5);
+
+  bool success = false;
+  FILE* out = vm::fopen(RUNTIME_ARRAY_BODY(tmp), "wb");
+  if (out) {
+    success = fwrite(data, 1, size, out) == size;
+    success = fclose(out) == 0 and success;
+
+    if (success) {
+#ifdef PLATFORM_WINDOWS
+      ::remove(path);
+#endif
+      success = ::rename(RUNTIME_ARRAY_BODY(tmp), path) == 0;
+    }
+
+    if (not success) {
+      ::remove(RUNTIME_ARRAY_BODY(tmp));
+    }
+  }
+
+  return success;
+}
+
+// Compiled methods saved to, and reused from, the file named by the
+// avian.jit.codecache.file property.  Each record holds a method's
+// machine code as it was right after compilation, along with its
+// tables and a symbolic description of its object pool, call sites
+// and the classes it was compiled against.  The code still refers to
+// the thunks and to its own object pool by absolute address, so the
+// records are only reused if the first code segment and the thunks
+// land exactly where they were when the file was written.  In that
+// case we reserve the space the records occupy before compiling
+// anything else, and each method is put back in its old place when
+// it is first linked (see linkCachedCode).
+class CodeCacheFile {
+ public:
+  static const unsigned ThunkWords = 12;
+
+  class Header {
+   public:
+    uint32_t magic;
+    uint32_t fingerprint;
+    uint64_t base;
+    uint32_t used;
+    uint32_t recordCount;
+    uint32_t checksum;
+    uint32_t thunks[ThunkWords];
+  };
+
+  class Entry {
+   public:
+    const uint8_t* body;
+    unsigned size;
+    uint32_t key;
+    bool linked;
+    bool dropped;
+  };
+
+  class Record {
+   public:
+    Record(Record* next, unsigned size, uint32_t key):
+      next(next), size(size), key(key)
+    { }
+
+    uint8_t* body() {
+      return reinterpret_cast<uint8_t*>(this + 1);
+    }
+
+    Record* next;
+    unsigned size;
+    uint32_t key;
+  };
+
+  CodeCacheFile(System* s, Allocator* allocator):
+    s(s),
+    allocator(allocator),
+    path(0),
+    region(0),
+    entries(0),
+    entryCount(0),
+    entryCapacity(0),
+    records(0),
+    base(0),
+    capacity(0),
+    fingerprint(0),
+    enabled(false),
+    recording(false)
+  {
+    memset(&header, 0, sizeof(Header));
+    memset(thunks, 0, sizeof(thunks));
+  }
+
+  void open(const char* path, uint32_t fingerprint) {
+    unsigned length = strlen(path) + 1;
+    this->path = static_cast<char*>(allocator->allocate(length));
+    memcpy(this->path, path, length);
+
+    this->fingerprint = fingerprint;
+    enabled = true;
+    recording = true;
+
+    if (s->success(s->map(&region, path)) and not index()) {
+      region->dispose();
+      region = 0;
+    }
+  }
+
+  bool index() {
+    const uint8_t* start = region->start();
+    const uint8_t* end = start + region->length();
+    if (region->length() < sizeof(Header)) {
+      return false;
+    }
+
+    memcpy(&header, start, sizeof(Header));
+    if (header.magic != CodeCacheFileMagic
+        or header.fingerprint != fingerprint
+        or header.checksum != hash(start + sizeof(Header),
+                                   region->length() - sizeof(Header)))
+    {
+      return false;
+    }
+
+    entryCapacity = header.recordCount;
+    entries = static_cast<Entry*>
+      (allocator->allocate(sizeof(Entry) * max(entryCapacity, 1)));
+
+    const uint8_t* p = start + sizeof(Header);
+    for (unsigned i = 0; i < entryCapacity; ++i) {
+      uint32_t words[2];
+      if (end - p < 8) {
+        return false;
+      }
+      memcpy(words, p, 8);
+      p += 8;
+
+      if (words[0] < 8 or static_cast<uintptr_t>(end - p) < words[0]) {
+        return false;
+      }
+
+      Entry* e = entries + i;
+      e->body = p;
+      e->size = words[0];
+      e->key = words[1];
+      e->linked = false;
+      e->dropped = false;
+
+      p += words[0];
+    }
+
+    entryCount = entryCapacity;
+
+    qsort(entries, entryCount, sizeof(Entry), compareEntries);
+
+    return true;
+  }
+
+  void* hint() {
+    return entryCount
+      ? reinterpret_cast<void*>(static_cast<uintptr_t>(header.base)) : 0;
+  }
+
+  // Called once the thunks have been compiled, with the first
+  // segment's base and capacity and the offset just past the thunks.
+  // Returns the offset at which further compiled code should be
+  // placed.
+  unsigned attach(uint8_t* base, unsigned capacity, unsigned offset,
+                  const uint32_t* thunks)
+  {
+    this->base = base;
+    this->capacity = capacity;
+    memcpy(this->thunks, thunks, sizeof(this->thunks));
+
+    if (entryCount == 0
+        or header.base != reinterpret_cast<uintptr_t>(base)
+        or memcmp(header.thunks, thunks, sizeof(this->thunks)) != 0
+        or header.used < offset
+        or header.used > capacity)
+    {
+      entryCount = 0;
+      return offset;
+    }
+
+    for (unsigned i = 0; i < entryCount; ++i) {
+      Entry* e = entries + i;
+      if (start(e->body) < offset or extent(e->body) > header.used) {
+        e->dropped = true;
+      }
+    }
+
+    return header.used;
+  }
+
+  bool covers(const uint8_t* p, unsigned size) {
+    return recording and base
+      and p >= base and p + size <= base + capacity;
+  }
+
+  // Returns the index of the first entry with the specified key, or
+  // entryCount if there is none.
+  unsigned find(uint32_t key) {
+    unsigned bottom = 0;
+    unsigned top = entryCount;
+    while (bottom < top) {
+      unsigned middle = bottom + ((top - bottom) / 2);
+      if (entries[middle].key < key) {
+        bottom = middle + 1;
+      } else {
+        top = middle;
+      }
+    }
+    return bottom;
+  }
+
+  void add(const uint8_t* body, unsigned size, uint32_t key) {
+    Record* r = new (allocator->allocate(sizeof(Record) + size))
+      Record(records, size, key);
+    memcpy(r->body(), body, size);
+    records = r;
+  }
+
+  void write() {
+    if (not recording) {
+      return;
+    }
+
+    recording = false;
+
+    Vector v(s, allocator, 64 * 1024);
+    v.allocate(sizeof(Header));
+
+    unsigned count = 0;
+    unsigned used = 0;
+    for (unsigned i = 0; i < entryCount; ++i) {
+      Entry* e = entries + i;
+      if (not e->dropped) {
+        append(&v, e->body, e->size, e->key, &count, &used);
+      }
+    }
+
+    for (Record* r = records; r; r = r->next) {
+      append(&v, r->body(), r->size, r->key, &count, &used);
+    }
+
+    if (count == 0) {
+      return;
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(Header));
+    h.magic = CodeCacheFileMagic;
+    h.fingerprint = fingerprint;
+    h.base = reinterpret_cast<uintptr_t>(base);
+    h.used = used;
+    h.recordCount = count;
+    h.checksum = hash(v.data + sizeof(Header), v.length() - sizeof(Header));
+    memcpy(h.thunks, thunks, sizeof(thunks));
+    v.set(0, &h, sizeof(Header));
+
+    writeFile(path, v.data, v.length());
+  }
+
+  void dispose() {
+    for (Record* r = records; r;) {
+      Record* next = r->next;
+      allocator->free(r, sizeof(Record) + r->size);
+      r = next;
+    }
+
+    if (entries) {
+      allocator->free(entries, sizeof(Entry) * max(entryCapacity, 1));
+    }
+
+    if (region) {
+      region->dispose();
+    }
+
+    if (path) {
+      allocator->free(path, strlen(path) + 1);
+    }
+  }
+
+  static unsigned start(const uint8_t* body) {
+    uint32_t v;
+    memcpy(&v, body, 4);
+    return v;
+  }
+
+  static unsigned extent(const uint8_t* body) {
+    uint32_t v[2];
+    memcpy(v, body, 8);
+    return v[0] + v[1];
+  }
+
+  static void append(Vector* v, const uint8_t* body, unsigned size,
+                     uint32_t key, unsigned* count, unsigned* used)
+  {
+    v->append4(size);
+    v->append4(key);
+    v->append(body, size);
+
+    ++ (*count);
+    *used = max(*used, extent(body));
+  }
+
+  static int compareEntries(const void* a, const void* b) {
+    uint32_t ka = static_cast<const Entry*>(a)->key;
+    uint32_t kb = static_cast<const Entry*>(b)->key;
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);
+  }
+
+  System* s;
+  Allocator* allocator;
+  char* path;
+  System::Region* region;
+  Header header;
+  Entry* entries;
+  unsigned entryCount;
+  unsigned entryCapacity;
+  Record* records;
+  uint8_t* base;
+  unsigned capacity;
+  uint32_t thunks[ThunkWords];
+  uint32_t fingerprint;
+  bool enabled;
+  bool recording;
+};
+
 class MyThread;
 
 void*
@@ -411,7 +972,7 @@ methodForIp(MyThread* t, void* ip)
 
   // we must use a version of the method tree at least as recent as the
   // compiled form of the method containing the specified address (see
-  // compile(MyThread*, FixedAllocator*, BootContext*, object)):
+  // compile(MyThread*, CodeAllocator*, BootContext*, object)):
   loadMemoryBarrier();
 
   return treeQuery(t, root(t, MethodTree), reinterpret_cast<intptr_t>(ip),
@@ -1013,6 +1574,135 @@ class BootContext {
   OffsetResolver* resolver;
 };
 
+class ScalarSite {
+ public:
+  unsigned fieldCount;
+  unsigned* offsets;
+  uint8_t* codes;
+  unsigned* slots;
+};
+
+class ScalarStore {
+ public:
+  unsigned field;
+  uint8_t code;
+  int argument;
+  int64_t value;
+};
+
+class ScalarInit {
+ public:
+  unsigned argumentCount;
+  uint8_t argumentCodes[MaxScalarArguments];
+  unsigned storeCount;
+  ScalarStore stores[MaxScalarStores];
+};
+
+class EscapeAnalysis {
+ public:
+  ScalarSite* sites;
+  int8_t* siteAt;
+  ScalarInit** initAt;
+};
+
+const uint8_t FoldedConstant = 1 << 0;
+const uint8_t InBounds = 1 << 1;
+const uint8_t ReusedLoad = 1 << 2;
+const uint8_t SavedLoad = 1 << 3;
+
+const int8_t NoLoad = -1;
+
+// a field or array length load from an object held in a local, and
+// the slot we keep its result in when it can be reused.  Index is the
+// field's constant pool index plus one, or zero for an array length.
+class LoadExpression {
+ public:
+  uint16_t index;
+  uint16_t local;
+  uint8_t code;
+  uint16_t slot;
+};
+
+// a load we perform ahead of a loop, at the single instruction which
+// enters it, so that the loop body can reuse the result
+class LoadHoist {
+ public:
+  LoadHoist* next;
+  unsigned load;
+  unsigned start;
+  unsigned end;
+};
+
+class RangeAnalysis {
+ public:
+  uint8_t* flags;
+  int32_t* constants;
+  int8_t* loadAt;
+  LoadExpression* loads;
+  LoadHoist** hoists;
+};
+
+Compiler::AllocationPolicy
+allocationPolicy(MyThread* t)
+{
+  static int policy = -1;
+  if (policy < 0) {
+    const char* name = findProperty(t, "avian.jit.regalloc");
+    if (name and strcmp(name, "loop-weighted") == 0) {
+      policy = Compiler::LoopWeightedAllocation;
+    } else if (name and strcmp(name, "linear-scan") == 0) {
+      policy = Compiler::LinearScanAllocation;
+    } else {
+      policy = Compiler::LocalAllocation;
+    }
+  }
+  return static_cast<Compiler::AllocationPolicy>(policy);
+}
+
+unsigned
+codeCacheLimit(Thread* t)
+{
+  static unsigned limit = 0;
+  if (limit == 0) {
+    // the limit is given in megabytes:
+    const char* value = findProperty(t, "avian.jit.codecache.limit");
+    int megabytes = value ? atoi(value) : 0;
+    limit = (megabytes > 0 and megabytes < 4096)
+      ? static_cast<unsigned>(megabytes) * 1024 * 1024
+      : DefaultCodeCacheLimitInBytes;
+  }
+  return limit;
+}
+
+// Returns the size of each segment of the code cache.  That's
+// normally ExecutableAreaSizeInBytes, but we use smaller ones when the
+// limit is low enough to allow only a few of those.
+unsigned
+codeSegmentSize(Thread* t)
+{
+  return min(ExecutableAreaSizeInBytes, codeCacheLimit(t) / 4);
+}
+
+bool
+codeCacheSweepEnabled(Thread* t)
+{
+  static int enabled = -1;
+  if (enabled < 0) {
+    const char* value = findProperty(t, "avian.jit.codecache.sweep");
+    // the sweeper can't see code referenced only from saved
+    // continuations, so we don't use it when they are enabled:
+    enabled = (not Continuations)
+      and value and strcmp(value, "true") == 0;
+  }
+  return enabled;
+}
+
+const char*
+codeCacheFilePath(Thread* t)
+{
+  return findProperty(t, "avian.jit.codecache.file");
+}
+
 class Context {
  public:
   class MyResource: public Thread::Resource {
@@ -1062,6 +1752,22 @@ class Context {
           assert(t, resultSize == 8);
           return local::getThunk(t, absoluteLongThunk);
 
+        case avian::codegen::lir::PopCount:
+          assert(t, resultSize == 8);
+          return local::getThunk(t, popCountLongThunk);
+
+        case avian::codegen::lir::CountLeadingZeros:
+          assert(t, resultSize == 8);
+          return local::getThunk(t, countLeadingZerosLongThunk);
+
+        case avian::codegen::lir::CountTrailingZeros:
+          assert(t, resultSize == 8);
+          return local::getThunk(t, countTrailingZerosLongThunk);
+
+        case avian::codegen::lir::ByteSwap:
+          assert(t, resultSize == 8);
+          return local::getThunk(t, byteSwapLongThunk);
+
         case avian::codegen::lir::FloatNegate:
           assert(t, resultSize == 8);
           return local::getThunk(t, negateDoubleThunk);
@@ -1100,13 +1806,29 @@ class Context {
           assert(t, resultSize == 4);
           return local::getThunk(t, absoluteIntThunk);
 
-        case avian::codegen::lir::FloatNegate:
+        case avian::codegen::lir::PopCount:
           assert(t, resultSize == 4);
-          return local::getThunk(t, negateFloatThunk);
+          return local::getThunk(t, popCountIntThunk);
 
-        case avian::codegen::lir::FloatAbsolute:
+        case avian::codegen::lir::CountLeadingZeros:
           assert(t, resultSize == 4);
-          return local::getThunk(t, absoluteFloatThunk);
+          return local::getThunk(t, countLeadingZerosIntThunk);
+
+        case avian::codegen::lir::CountTrailingZeros:
+          assert(t, resultSize == 4);
+          return local::getThunk(t, countTrailingZerosIntThunk);
+
+        case avian::codegen::lir::ByteSwap:
+          assert(t, resultSize == 4);
+          return local::getThunk(t, byteSwapIntThunk);
+
+        case avian::codegen::lir::FloatNegate:
+          assert(t, resultSize == 4);
+          return local::getThunk(t, negateFloatThunk);
+
+        case avian::codegen::lir::FloatAbsolute:
+          assert(t, resultSize == 4);
+          return local::getThunk(t, absoluteFloatThunk);
 
         case avian::codegen::lir::Float2Float:
           assert(t, resultSize == 8);
@@ -1133,11 +1855,25 @@ class Context {
       }
     }
 
-    virtual intptr_t getThunk(avian::codegen::lir::TernaryOperation op, unsigned size, unsigned,
-                              bool* threadParameter)
+    virtual intptr_t getThunk(avian::codegen::lir::TernaryOperation op, unsigned size,
+                              unsigned resultSize, bool* threadParameter)
     {
       *threadParameter = false;
 
+      // the first operand of a rotate is the distance, which is always
+      // word-sized, so we go by the size of the result instead
+      switch (op) {
+      case avian::codegen::lir::RotateLeft:
+        return local::getThunk
+          (t, resultSize == 8 ? rotateLeftLongThunk : rotateLeftIntThunk);
+
+      case avian::codegen::lir::RotateRight:
+        return local::getThunk
+          (t, resultSize == 8 ? rotateRightLongThunk : rotateRightIntThunk);
+
+      default: break;
+      }
+
       if (size == 8) {
         switch (op) {
         case avian::codegen::lir::Divide:
@@ -1148,6 +1884,12 @@ class Context {
           *threadParameter = true;
           return local::getThunk(t, moduloLongThunk);
 
+        case avian::codegen::lir::Min:
+          return local::getThunk(t, minLongThunk);
+
+        case avian::codegen::lir::Max:
+          return local::getThunk(t, maxLongThunk);
+
         case avian::codegen::lir::FloatAdd:
           return local::getThunk(t, addDoubleThunk);
 
@@ -1190,6 +1932,12 @@ class Context {
           *threadParameter = true;
           return local::getThunk(t, moduloIntThunk);
 
+        case avian::codegen::lir::Min:
+          return local::getThunk(t, minIntThunk);
+
+        case avian::codegen::lir::Max:
+          return local::getThunk(t, maxIntThunk);
+
         case avian::codegen::lir::FloatAdd:
           return local::getThunk(t, addFloatThunk);
 
@@ -1232,9 +1980,12 @@ class Context {
     zone(t->m->system, t->m->heap, InitialZoneCapacityInBytes),
     assembler(t->arch->makeAssembler(t->m->heap, &zone)),
     client(t),
-    compiler(makeCompiler(t->m->system, assembler, &zone, &client)),
+    compiler(makeCompiler(t->m->system, assembler, &zone, &client,
+                          allocationPolicy(t))),
     method(method),
     bootContext(bootContext),
+    escapes(0),
+    ranges(0),
     objectPool(0),
     subroutines(0),
     traceLog(0),
@@ -1261,6 +2012,8 @@ class Context {
     compiler(0),
     method(0),
     bootContext(0),
+    escapes(0),
+    ranges(0),
     objectPool(0),
     subroutines(0),
     traceLog(0),
@@ -1306,6 +2059,8 @@ class Context {
   avian::codegen::Compiler* compiler;
   object method;
   BootContext* bootContext;
+  EscapeAnalysis* escapes;
+  RangeAnalysis* ranges;
   PoolElement* objectPool;
   Subroutine* subroutines;
   TraceElement* traceLog;
@@ -1352,9 +2107,12 @@ storeLocal(Context* context, unsigned footprint, Compiler::Operand* value,
     (footprint, value, translateLocalIndex(context, footprint, index));
 }
 
-FixedAllocator*
+CodeAllocator*
 codeAllocator(MyThread* t);
 
+CodeCacheFile*
+codeCacheFile(MyThread* t);
+
 class Frame {
  public:
   enum StackType {
@@ -2315,7 +3073,7 @@ tryInitClass(MyThread* t, object class_)
 }
 
 void
-compile(MyThread* t, FixedAllocator* allocator, BootContext* bootContext,
+compile(MyThread* t, CodeAllocator* allocator, BootContext* bootContext,
         object method);
 
 object
@@ -2693,6 +3451,121 @@ absoluteInt(int32_t a)
   return a > 0 ? a : -a;
 }
 
+int64_t
+popCountLong(uint64_t a)
+{
+  a -= (a >> 1) & 0x5555555555555555ULL;
+  a = (a & 0x3333333333333333ULL) + ((a >> 2) & 0x3333333333333333ULL);
+  a = (a + (a >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (a * 0x0101010101010101ULL) >> 56;
+}
+
+int64_t
+popCountInt(uint32_t a)
+{
+  return popCountLong(a);
+}
+
+int64_t
+countLeadingZerosLong(uint64_t a)
+{
+  int64_t n = 64;
+  while (a) {
+    -- n;
+    a >>= 1;
+  }
+  return n;
+}
+
+int64_t
+countLeadingZerosInt(uint32_t a)
+{
+  return countLeadingZerosLong(a) - 32;
+}
+
+int64_t
+countTrailingZerosLong(uint64_t a)
+{
+  if (a == 0) {
+    return 64;
+  }
+
+  int64_t n = 0;
+  while ((a & 1) == 0) {
+    ++ n;
+    a >>= 1;
+  }
+  return n;
+}
+
+int64_t
+countTrailingZerosInt(uint32_t a)
+{
+  return a ? countTrailingZerosLong(a) : 32;
+}
+
+int64_t
+byteSwapLong(uint64_t a)
+{
+  return swapV8(a);
+}
+
+int64_t
+byteSwapInt(uint32_t a)
+{
+  return static_cast<int32_t>(swapV4(a));
+}
+
+int64_t
+rotateLeftLong(int32_t b, uint64_t a)
+{
+  b &= 63;
+  return b ? (a << b) | (a >> (64 - b)) : a;
+}
+
+int64_t
+rotateLeftInt(int32_t b, uint32_t a)
+{
+  b &= 31;
+  return static_cast<int32_t>(b ? (a << b) | (a >> (32 - b)) : a);
+}
+
+int64_t
+rotateRightLong(int32_t b, uint64_t a)
+{
+  return rotateLeftLong(- b, a);
+}
+
+int64_t
+rotateRightInt(int32_t b, uint32_t a)
+{
+  return rotateLeftInt(- b, a);
+}
+
+int64_t
+minLong(int64_t b, int64_t a)
+{
+  return a < b ? a : b;
+}
+
+int64_t
+minInt(int32_t b, int32_t a)
+{
+  return a < b ? a : b;
+}
+
+int64_t
+maxLong(int64_t b, int64_t a)
+{
+  return a > b ? a : b;
+}
+
+int64_t
+maxInt(int32_t b, int32_t a)
+{
+  return a > b ? a : b;
+}
+
 unsigned
 traceSize(Thread* t)
 {
@@ -2922,7536 +3795,13433 @@ setMaybeNull(MyThread* t, object o, unsigned offset, object value)
   }
 }
 
-void
-acquireMonitorForObject(MyThread* t, object o)
+uint64_t
+compareAndSwapInt(MyThread*, object o, uintptr_t offset, int32_t expect,
+                  int32_t update)
 {
-  if (LIKELY(o)) {
-    acquire(t, o);
-  } else {
-    throwNew(t, Machine::NullPointerExceptionType);
+  return atomicCompareAndSwap32
+    (&fieldAtOffset<uint32_t>(o, offset), expect, update);
+}
+
+uint64_t
+compareAndSwapLong(MyThread* t UNUSED, object o UNUSED,
+                   uintptr_t offset UNUSED, uint64_t expect UNUSED,
+                   uint64_t update UNUSED)
+{
+#ifdef AVIAN_HAS_CAS64
+  return atomicCompareAndSwap64
+    (&fieldAtOffset<uint64_t>(o, offset), expect, update);
+#else
+  // we only generate calls to this thunk if AVIAN_HAS_CAS64 is defined
+  abort(t);
+#endif
+}
+
+uint64_t
+compareAndSwapObject(MyThread* t, object o, uintptr_t offset, object expect,
+                     object update)
+{
+  bool success = atomicCompareAndSwap
+    (&fieldAtOffset<uintptr_t>(o, offset), reinterpret_cast<uintptr_t>(expect),
+     reinterpret_cast<uintptr_t>(update));
+
+  if (success) {
+    mark(t, o, offset);
   }
+
+  return success;
 }
 
+// copies shorter than this many bytes are done element by element,
+// which avoids the call overhead of memmove (whose vectorized loops
+// only pay off for larger copies)
+const unsigned SmallArrayCopyLimit = 64;
+
+template <class T>
 void
-acquireMonitorForObjectOnEntrance(MyThread* t, object o)
+copyElements(T* dst, const T* src, unsigned count)
 {
-  if (LIKELY(o)) {
-    t->methodLockIsClean = false;
-    acquire(t, o);
-    t->methodLockIsClean = true;
+  if (dst <= src or dst >= src + count) {
+    for (unsigned i = 0; i < count; ++i) {
+      dst[i] = src[i];
+    }
   } else {
-    throwNew(t, Machine::NullPointerExceptionType);
+    for (unsigned i = count; i > 0; --i) {
+      dst[i - 1] = src[i - 1];
+    }
   }
 }
 
+template <class T>
 void
-releaseMonitorForObject(MyThread* t, object o)
+fillElements(T* dst, T value, unsigned count)
 {
-  if (LIKELY(o)) {
-    release(t, o);
-  } else {
-    throwNew(t, Machine::NullPointerExceptionType);
+  for (unsigned i = 0; i < count; ++i) {
+    dst[i] = value;
   }
 }
 
-object
-makeMultidimensionalArray2(MyThread* t, object class_, uintptr_t* countStack,
-                           int32_t dimensions)
+void
+copyArray(MyThread* t, object src, int32_t srcOffset, object dst,
+          int32_t dstOffset, int32_t length)
 {
-  PROTECT(t, class_);
-
-  THREAD_RUNTIME_ARRAY(t, int32_t, counts, dimensions);
-  for (int i = dimensions - 1; i >= 0; --i) {
-    RUNTIME_ARRAY_BODY(counts)[i] = countStack[dimensions - i - 1];
-    if (UNLIKELY(RUNTIME_ARRAY_BODY(counts)[i] < 0)) {
-      throwNew(t, Machine::NegativeArraySizeExceptionType, "%d",
-               RUNTIME_ARRAY_BODY(counts)[i]);
-      return 0;
-    }
+  if (UNLIKELY(src == 0 or dst == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
   }
 
-  object array = makeArray(t, RUNTIME_ARRAY_BODY(counts)[0]);
-  setObjectClass(t, array, class_);
-  PROTECT(t, array);
+  object srcClass = objectClass(t, src);
+  object dstClass = objectClass(t, dst);
+  unsigned elementSize = classArrayElementSize(t, srcClass);
 
-  populateMultiArray(t, array, RUNTIME_ARRAY_BODY(counts), 0, dimensions);
+  // primitive arrays may only be copied to arrays of the same type,
+  // while reference arrays may be copied to any other reference array
+  if (UNLIKELY
+      (elementSize == 0 or classArrayElementSize(t, dstClass) == 0
+       or (srcClass != dstClass
+           and (classObjectMask(t, srcClass) == 0
+                or classObjectMask(t, dstClass) == 0))))
+  {
+    throwNew(t, Machine::ArrayStoreExceptionType);
+  }
 
-  return array;
-}
+  int32_t srcLength = fieldAtOffset<uintptr_t>(src, BytesPerWord);
+  int32_t dstLength = fieldAtOffset<uintptr_t>(dst, BytesPerWord);
 
-uint64_t
-makeMultidimensionalArray(MyThread* t, object class_, int32_t dimensions,
-                          int32_t offset)
-{
-  return reinterpret_cast<uintptr_t>
-    (makeMultidimensionalArray2
-     (t, class_, static_cast<uintptr_t*>(t->stack) + offset, dimensions));
-}
+  if (UNLIKELY(length < 0 or srcOffset < 0 or dstOffset < 0
+               or length > srcLength - srcOffset
+               or length > dstLength - dstOffset))
+  {
+    throwNew(t, Machine::ArrayIndexOutOfBoundsExceptionType);
+  }
 
-uint64_t
-makeMultidimensionalArrayFromReference(MyThread* t, object pair,
-                                       int32_t dimensions,
-                                       int32_t offset)
-{
-  return makeMultidimensionalArray
-    (t, resolveClass
-     (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
-      referenceName(t, pairSecond(t, pair))), dimensions, offset);
-}
+  uint8_t* s = &fieldAtOffset<uint8_t>(src, ArrayBody)
+    + (srcOffset * elementSize);
+  uint8_t* d = &fieldAtOffset<uint8_t>(dst, ArrayBody)
+    + (dstOffset * elementSize);
+  unsigned size = length * elementSize;
 
-void NO_RETURN
-throwArrayIndexOutOfBounds(MyThread* t)
-{
-  if (ensure(t, FixedSizeOfArrayIndexOutOfBoundsException + traceSize(t))) {
-    atomicOr(&(t->flags), Thread::TracingFlag);
-    THREAD_RESOURCE0(t, atomicAnd(&(t->flags), ~Thread::TracingFlag));
+  if (classObjectMask(t, dstClass)) {
+    copyElements(reinterpret_cast<object*>(d),
+                 reinterpret_cast<object*>(s), length);
 
-    throwNew(t, Machine::ArrayIndexOutOfBoundsExceptionType); 
+    mark(t, dst, ArrayBody + (dstOffset * BytesPerWord), length);
+  } else if (size >= SmallArrayCopyLimit) {
+    memmove(d, s, size);
   } else {
-    // not enough memory available for a new exception and stack trace
-    // -- use a preallocated instance instead
-    throw_(t, root(t, Machine::ArrayIndexOutOfBoundsException));
-  }
-}
+    switch (elementSize) {
+    case 1:
+      copyElements(d, s, length);
+      break;
 
-void NO_RETURN
-throwStackOverflow(MyThread* t)
-{
-  throwNew(t, Machine::StackOverflowErrorType); 
+    case 2:
+      copyElements(reinterpret_cast<uint16_t*>(d),
+                   reinterpret_cast<uint16_t*>(s), length);
+      break;
+
+    case 4:
+      copyElements(reinterpret_cast<uint32_t*>(d),
+                   reinterpret_cast<uint32_t*>(s), length);
+      break;
+
+    case 8:
+      copyElements(reinterpret_cast<uint64_t*>(d),
+                   reinterpret_cast<uint64_t*>(s), length);
+      break;
+
+    default: abort(t);
+    }
+  }
 }
 
-void NO_RETURN
-throw_(MyThread* t, object o)
+void
+fillArray(MyThread* t, object array, int32_t value)
 {
-  if (LIKELY(o)) {
-    vm::throw_(t, o);
-  } else {
+  if (UNLIKELY(array == 0)) {
     throwNew(t, Machine::NullPointerExceptionType);
   }
+
+  unsigned length = fieldAtOffset<uintptr_t>(array, BytesPerWord);
+  void* body = &fieldAtOffset<uint8_t>(array, ArrayBody);
+
+  switch (classArrayElementSize(t, objectClass(t, array))) {
+  case 1:
+    memset(body, value, length);
+    break;
+
+  case 2:
+    fillElements(static_cast<uint16_t*>(body), static_cast<uint16_t>(value),
+                 length);
+    break;
+
+  case 4:
+    fillElements(static_cast<uint32_t*>(body), static_cast<uint32_t>(value),
+                 length);
+    break;
+
+  default: abort(t);
+  }
 }
 
 void
-checkCast(MyThread* t, object class_, object o)
+fillLongArray(MyThread* t, object array, uint64_t value)
 {
-  if (UNLIKELY(o and not isAssignableFrom(t, class_, objectClass(t, o)))) {
-    object classNameFrom = className(t, objectClass(t, o));
-    object classNameTo   = className(t, class_);
-    THREAD_RUNTIME_ARRAY(t, char, classFrom, byteArrayLength(t, classNameFrom));
-    THREAD_RUNTIME_ARRAY(t, char, classTo,   byteArrayLength(t, classNameTo));
-    replace('/', '.', RUNTIME_ARRAY_BODY(classFrom),
-            reinterpret_cast<char*>(&byteArrayBody(t, classNameFrom, 0)));
-    replace('/', '.', RUNTIME_ARRAY_BODY(classTo),
-            reinterpret_cast<char*>(&byteArrayBody(t, classNameTo,   0)));
-    throwNew
-      (t, Machine::ClassCastExceptionType, "%s cannot be cast to %s",
-       RUNTIME_ARRAY_BODY(classFrom), RUNTIME_ARRAY_BODY(classTo));
+  if (UNLIKELY(array == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
   }
+
+  fillElements(&fieldAtOffset<uint64_t>(array, ArrayBody), value,
+               fieldAtOffset<uintptr_t>(array, BytesPerWord));
 }
 
 void
-checkCastFromReference(MyThread* t, object pair, object o)
+fillObjectArray(MyThread* t, object array, object value)
 {
-  PROTECT(t, o);
+  if (UNLIKELY(array == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
 
-  object c = resolveClass
-    (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
-     referenceName(t, pairSecond(t, pair)));
+  // check the value against the element type once, as aastore would
+  // for each element
+  if (UNLIKELY(value and not instanceOf
+               (t, classStaticTable(t, objectClass(t, array)), value)))
+  {
+    throwNew(t, Machine::ArrayStoreExceptionType);
+  }
 
-  checkCast(t, c, o);
+  unsigned length = objectArrayLength(t, array);
+  fillElements(&objectArrayBody(t, array, 0), value, length);
+
+  if (value) {
+    mark(t, array, ArrayBody, length);
+  }
 }
 
-object
-resolveField(Thread* t, object pair)
+#ifdef __SSE2__
+inline __m128i
+loadChars(const uint8_t* p)
 {
-  object reference = pairSecond(t, pair);
-  PROTECT(t, reference);
-
-  object class_ = resolveClassInObject
-    (t, classLoader(t, methodClass(t, pairFirst(t, pair))), reference,
-     ReferenceClass);
+  // widen eight Latin-1 characters to UTF-16
+  return _mm_unpacklo_epi8
+    (_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+     _mm_setzero_si128());
+}
 
-  return findInHierarchy
-    (t, class_, referenceName(t, reference), referenceSpec(t, reference),
-     findFieldInClass, Machine::NoSuchFieldErrorType);
+inline __m128i
+loadChars(const uint16_t* p)
+{
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
 }
+#endif
 
-uint64_t
-getFieldValue(Thread* t, object target, object field)
+// returns the index of the first character at which a and b differ,
+// or count if the first count characters are identical
+template <class A, class B>
+unsigned
+mismatch(const A* a, const B* b, unsigned count)
 {
-  switch (fieldCode(t, field)) {
-  case ByteField:
-  case BooleanField:
-    return fieldAtOffset<int8_t>(target, fieldOffset(t, field));
-
-  case CharField:
-  case ShortField:
-    return fieldAtOffset<int16_t>(target, fieldOffset(t, field));
-
-  case FloatField:
-  case IntField:
-    return fieldAtOffset<int32_t>(target, fieldOffset(t, field));
-
-  case DoubleField:
-  case LongField:
-    return fieldAtOffset<int64_t>(target, fieldOffset(t, field));
-
-  case ObjectField:
-    return fieldAtOffset<intptr_t>(target, fieldOffset(t, field));
-
-  default:
-    abort(t);
+  unsigned i = 0;
+#ifdef __SSE2__
+  for (; i + 8 <= count; i += 8) {
+    unsigned mask = _mm_movemask_epi8
+      (_mm_cmpeq_epi16(loadChars(a + i), loadChars(b + i))) ^ 0xFFFF;
+    if (mask) {
+      return i + (__builtin_ctz(mask) / 2);
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    if (a[i] != b[i]) {
+      return i;
+    }
   }
+  return count;
 }
 
-uint64_t
-getStaticFieldValueFromReference(MyThread* t, object pair)
+unsigned
+mismatch(const uint8_t* a, const uint8_t* b, unsigned count)
 {
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
-
-  initClass(t, fieldClass(t, field));
-
-  ACQUIRE_FIELD_FOR_READ(t, field);
-
-  return getFieldValue(t, classStaticTable(t, fieldClass(t, field)), field);
+  unsigned i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= count; i += 16) {
+    unsigned mask = _mm_movemask_epi8
+      (_mm_cmpeq_epi8
+       (_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)))) ^ 0xFFFF;
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    if (a[i] != b[i]) {
+      return i;
+    }
+  }
+  return count;
 }
 
-uint64_t
-getFieldValueFromReference(MyThread* t, object pair, object instance)
+int
+findChar(const uint8_t* s, unsigned length, uint16_t c)
 {
-  PROTECT(t, instance);
-
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
-
-  ACQUIRE_FIELD_FOR_READ(t, field);
+  if (c > 0xFF) {
+    return -1;
+  }
 
-  return getFieldValue(t, instance, field);
+  const void* p = memchr(s, c, length);
+  return p ? static_cast<const uint8_t*>(p) - s : -1;
 }
 
-void
-setStaticLongFieldValueFromReference(MyThread* t, object pair, uint64_t value)
+int
+findChar(const uint16_t* s, unsigned length, uint16_t c)
 {
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
-
-  initClass(t, fieldClass(t, field));
-
-  ACQUIRE_FIELD_FOR_WRITE(t, field);
-
-  fieldAtOffset<int64_t>
-    (classStaticTable(t, fieldClass(t, field)), fieldOffset(t, field)) = value;
+  unsigned i = 0;
+#ifdef __SSE2__
+  __m128i pattern = _mm_set1_epi16(c);
+  for (; i + 8 <= length; i += 8) {
+    unsigned mask = _mm_movemask_epi8
+      (_mm_cmpeq_epi16(loadChars(s + i), pattern));
+    if (mask) {
+      return i + (__builtin_ctz(mask) / 2);
+    }
+  }
+#endif
+  for (; i < length; ++i) {
+    if (s[i] == c) {
+      return i;
+    }
+  }
+  return -1;
 }
 
-void
-setLongFieldValueFromReference(MyThread* t, object pair, object instance,
-                               uint64_t value)
+template <class A, class B>
+int
+findString(const A* s, unsigned length, const B* pattern,
+           unsigned patternLength)
 {
-  PROTECT(t, instance);
-
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
+  if (patternLength == 0) {
+    return 0;
+  } else if (patternLength > length) {
+    return -1;
+  }
 
-  ACQUIRE_FIELD_FOR_WRITE(t, field);
+  // look for the first character, then compare the rest
+  unsigned last = length - patternLength;
+  for (unsigned i = 0; i <= last; ++i) {
+    int j = findChar(s + i, last - i + 1, pattern[0]);
+    if (j < 0) {
+      return -1;
+    }
 
-  fieldAtOffset<int64_t>(instance, fieldOffset(t, field)) = value;
+    i += j;
+    if (mismatch(s + i + 1, pattern + 1, patternLength - 1)
+        == patternLength - 1)
+    {
+      return i;
+    }
+  }
+  return -1;
 }
 
-void
-setStaticObjectFieldValueFromReference(MyThread* t, object pair, object value)
+template <class T>
+uint32_t
+hashChars(const T* s, unsigned length)
 {
-  PROTECT(t, value);
-
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
-
-  initClass(t, fieldClass(t, field));
+  // computes the same value as the usual h = (h * 31) + c loop, but
+  // four characters at a time, so the multiplies need not wait on
+  // each other
+  uint32_t h = 0;
+  unsigned i = 0;
+  for (; i + 4 <= length; i += 4) {
+    h = (h * (31 * 31 * 31 * 31))
+      + (s[i] * (31 * 31 * 31))
+      + (s[i + 1] * (31 * 31))
+      + (s[i + 2] * 31)
+      + s[i + 3];
+  }
+  for (; i < length; ++i) {
+    h = (h * 31) + s[i];
+  }
+  return h;
+}
 
-  ACQUIRE_FIELD_FOR_WRITE(t, field);
+// strings hold either Latin-1 bytes or UTF-16 characters, so each of
+// the following has a case for every combination of the two
 
-  set(t, classStaticTable(t, fieldClass(t, field)), fieldOffset(t, field),
-      value);
+inline bool
+latin1String(Thread* t, object s)
+{
+  return objectClass(t, stringData(t, s))
+    == type(t, Machine::ByteArrayType);
 }
 
-void
-setObjectFieldValueFromReference(MyThread* t, object pair, object instance,
-                                 object value)
+inline const uint8_t*
+latin1StringBody(Thread* t, object s)
 {
-  PROTECT(t, instance);
-  PROTECT(t, value);
-
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
-
-  ACQUIRE_FIELD_FOR_WRITE(t, field);
-
-  set(t, instance, fieldOffset(t, field), value);
+  return reinterpret_cast<const uint8_t*>
+    (&byteArrayBody(t, stringData(t, s), stringOffset(t, s)));
 }
 
-void
-setFieldValue(MyThread* t, object target, object field, uint32_t value)
+inline const uint16_t*
+utf16StringBody(Thread* t, object s)
 {
-  switch (fieldCode(t, field)) {
-  case ByteField:
-  case BooleanField:
-    fieldAtOffset<int8_t>(target, fieldOffset(t, field)) = value;
-    break;
-
-  case CharField:
-  case ShortField:
-    fieldAtOffset<int16_t>(target, fieldOffset(t, field)) = value;
-    break;
-
-  case FloatField:
-  case IntField:
-    fieldAtOffset<int32_t>(target, fieldOffset(t, field)) = value;
-    break;
-
-  default:
-    abort(t);
-  }
+  return &charArrayBody(t, stringData(t, s), stringOffset(t, s));
 }
 
-void
-setStaticFieldValueFromReference(MyThread* t, object pair, uint32_t value)
+uint16_t
+stringChar(Thread* t, object s, unsigned index)
 {
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
-
-  initClass(t, fieldClass(t, field));
-
-  ACQUIRE_FIELD_FOR_WRITE(t, field);
-
-  setFieldValue(t, classStaticTable(t, fieldClass(t, field)), field, value);
+  return latin1String(t, s)
+    ? latin1StringBody(t, s)[index] : utf16StringBody(t, s)[index];
 }
 
-void
-setFieldValueFromReference(MyThread* t, object pair, object instance,
-                           uint32_t value)
+template <class A>
+unsigned
+stringMismatch(Thread* t, const A* a, object b, unsigned count)
 {
-  PROTECT(t, instance);
-  object field = resolveField(t, pair);
-  PROTECT(t, field);
-
-  ACQUIRE_FIELD_FOR_WRITE(t, field);
+  return latin1String(t, b)
+    ? mismatch(a, latin1StringBody(t, b), count)
+    : mismatch(a, utf16StringBody(t, b), count);
+}
 
-  setFieldValue(t, instance, field, value);
+unsigned
+stringMismatch(Thread* t, object a, object b, unsigned count)
+{
+  return latin1String(t, a)
+    ? stringMismatch(t, latin1StringBody(t, a), b, count)
+    : stringMismatch(t, utf16StringBody(t, a), b, count);
 }
 
-uint64_t
-instanceOf64(Thread* t, object class_, object o)
+template <class B>
+int
+stringFind(Thread* t, object s, const B* pattern, unsigned patternLength)
 {
-  return instanceOf(t, class_, o);
+  return latin1String(t, s)
+    ? findString(latin1StringBody(t, s), stringLength(t, s), pattern,
+                 patternLength)
+    : findString(utf16StringBody(t, s), stringLength(t, s), pattern,
+                 patternLength);
 }
 
 uint64_t
-instanceOfFromReference(Thread* t, object pair, object o)
+stringsEqual(MyThread* t, object a, object b)
 {
-  PROTECT(t, o);
+  if (UNLIKELY(a == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
 
-  object c = resolveClass
-    (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
-     referenceName(t, pairSecond(t, pair)));
+  if (a == b) {
+    return true;
+  } else if (b == 0 or objectClass(t, b) != objectClass(t, a)) {
+    return false;
+  }
 
-  return instanceOf64(t, c, o);
+  unsigned length = stringLength(t, a);
+  return length == stringLength(t, b)
+    and stringMismatch(t, a, b, length) == length;
 }
 
 uint64_t
-makeNewGeneral64(Thread* t, object class_)
+hashString(MyThread* t, object s)
 {
-  PROTECT(t, class_);
-
-  initClass(t, class_);
+  if (UNLIKELY(s == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
 
-  return reinterpret_cast<uintptr_t>(makeNewGeneral(t, class_));
+  if (stringHashCode(t, s) == 0) {
+    stringHashCode(t, s) = latin1String(t, s)
+      ? hashChars(latin1StringBody(t, s), stringLength(t, s))
+      : hashChars(utf16StringBody(t, s), stringLength(t, s));
+  }
+  return stringHashCode(t, s);
 }
 
-uint64_t
-makeNew64(Thread* t, object class_)
+int64_t
+compareStrings(MyThread* t, object a, object b)
 {
-  PROTECT(t, class_);
+  if (UNLIKELY(a == 0 or b == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
 
-  initClass(t, class_);
+  unsigned aLength = stringLength(t, a);
+  unsigned bLength = stringLength(t, b);
+  unsigned length = aLength < bLength ? aLength : bLength;
 
-  return reinterpret_cast<uintptr_t>(makeNew(t, class_));
+  unsigned i = stringMismatch(t, a, b, length);
+  if (i < length) {
+    return static_cast<int>(stringChar(t, a, i)) - stringChar(t, b, i);
+  } else {
+    return static_cast<int>(aLength) - static_cast<int>(bLength);
+  }
 }
 
-uint64_t
-makeNewFromReference(Thread* t, object pair)
+int64_t
+indexOfChar(MyThread* t, object s, int32_t c)
 {
-  object class_ = resolveClass
-    (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
-     referenceName(t, pairSecond(t, pair)));
-
-  PROTECT(t, class_);
-
-  initClass(t, class_);
+  if (UNLIKELY(s == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
 
-  return makeNewGeneral64(t, class_);
+  if (c >= 0 and c <= 0xFFFF) {
+    return latin1String(t, s)
+      ? findChar(latin1StringBody(t, s), stringLength(t, s), c)
+      : findChar(utf16StringBody(t, s), stringLength(t, s), c);
+  } else if (c >= 0x10000 and c <= 0x10FFFF) {
+    // supplementary code points are represented as surrogate pairs
+    uint16_t pair[2];
+    pair[0] = 0xD800 | ((c - 0x10000) >> 10);
+    pair[1] = 0xDC00 | (c & 0x3FF);
+    return stringFind(t, s, pair, 2);
+  } else {
+    return -1;
+  }
 }
 
-uint64_t
-getJClass64(Thread* t, object class_)
+int64_t
+indexOfString(MyThread* t, object s, object pattern)
 {
-  return reinterpret_cast<uintptr_t>(getJClass(t, class_));
+  if (UNLIKELY(s == 0 or pattern == 0)) {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
+
+  return latin1String(t, pattern)
+    ? stringFind(t, s, latin1StringBody(t, pattern), stringLength(t, pattern))
+    : stringFind(t, s, utf16StringBody(t, pattern), stringLength(t, pattern));
 }
 
 void
-gcIfNecessary(MyThread* t)
+acquireMonitorForObject(MyThread* t, object o)
 {
-  stress(t);
-
-  if (UNLIKELY(t->flags & Thread::UseBackupHeapFlag)) {
-    collect(t, Heap::MinorCollection);
+  if (LIKELY(o)) {
+    acquire(t, o);
+  } else {
+    throwNew(t, Machine::NullPointerExceptionType);
   }
 }
 
-unsigned
-resultSize(MyThread* t, unsigned code)
+void
+acquireMonitorForObjectOnEntrance(MyThread* t, object o)
 {
-  switch (code) {
-  case ByteField:
-  case BooleanField:
-  case CharField:
-  case ShortField:
-  case FloatField:
-  case IntField:
-    return 4;
-
-  case ObjectField:
-    return TargetBytesPerWord;
-
-  case LongField:
-  case DoubleField:
-    return 8;
-
-  case VoidField:
-    return 0;
-
-  default:
-    abort(t);
+  if (LIKELY(o)) {
+    t->methodLockIsClean = false;
+    acquire(t, o);
+    t->methodLockIsClean = true;
+  } else {
+    throwNew(t, Machine::NullPointerExceptionType);
   }
 }
 
 void
-pushReturnValue(MyThread* t, Frame* frame, unsigned code,
-                Compiler::Operand* result)
+releaseMonitorForObject(MyThread* t, object o)
 {
-  switch (code) {
-  case ByteField:
-  case BooleanField:
-  case CharField:
-  case ShortField:
-  case FloatField:
-  case IntField:
-    return frame->pushInt(result);
-
-  case ObjectField:
-    return frame->pushObject(result);
+  if (LIKELY(o)) {
+    release(t, o);
+  } else {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
+}
 
-  case LongField:
-  case DoubleField:
-    return frame->pushLong(result);
+object
+makeMultidimensionalArray2(MyThread* t, object class_, uintptr_t* countStack,
+                           int32_t dimensions)
+{
+  PROTECT(t, class_);
 
-  default:
-    abort(t);
+  THREAD_RUNTIME_ARRAY(t, int32_t, counts, dimensions);
+  for (int i = dimensions - 1; i >= 0; --i) {
+    RUNTIME_ARRAY_BODY(counts)[i] = countStack[dimensions - i - 1];
+    if (UNLIKELY(RUNTIME_ARRAY_BODY(counts)[i] < 0)) {
+      throwNew(t, Machine::NegativeArraySizeExceptionType, "%d",
+               RUNTIME_ARRAY_BODY(counts)[i]);
+      return 0;
+    }
   }
+
+  object array = makeArray(t, RUNTIME_ARRAY_BODY(counts)[0]);
+  setObjectClass(t, array, class_);
+  PROTECT(t, array);
+
+  populateMultiArray(t, array, RUNTIME_ARRAY_BODY(counts), 0, dimensions);
+
+  return array;
 }
 
-Compiler::Operand*
-popField(MyThread* t, Frame* frame, int code)
+uint64_t
+makeMultidimensionalArray(MyThread* t, object class_, int32_t dimensions,
+                          int32_t offset)
 {
-  switch (code) {
-  case ByteField:
-  case BooleanField:
-  case CharField:
-  case ShortField:
-  case FloatField:
-  case IntField:
-    return frame->popInt();
+  return reinterpret_cast<uintptr_t>
+    (makeMultidimensionalArray2
+     (t, class_, static_cast<uintptr_t*>(t->stack) + offset, dimensions));
+}
 
-  case DoubleField:
-  case LongField:
-    return frame->popLong();
+uint64_t
+makeMultidimensionalArrayFromReference(MyThread* t, object pair,
+                                       int32_t dimensions,
+                                       int32_t offset)
+{
+  return makeMultidimensionalArray
+    (t, resolveClass
+     (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
+      referenceName(t, pairSecond(t, pair))), dimensions, offset);
+}
 
-  case ObjectField:
-    return frame->popObject();
+void NO_RETURN
+throwArrayIndexOutOfBounds(MyThread* t)
+{
+  if (ensure(t, FixedSizeOfArrayIndexOutOfBoundsException + traceSize(t))) {
+    atomicOr(&(t->flags), Thread::TracingFlag);
+    THREAD_RESOURCE0(t, atomicAnd(&(t->flags), ~Thread::TracingFlag));
 
-  default: abort(t);
+    throwNew(t, Machine::ArrayIndexOutOfBoundsExceptionType); 
+  } else {
+    // not enough memory available for a new exception and stack trace
+    // -- use a preallocated instance instead
+    throw_(t, root(t, Machine::ArrayIndexOutOfBoundsException));
   }
 }
 
-Compiler::OperandType
-operandTypeForFieldCode(Thread* t, unsigned code)
+void NO_RETURN
+throwStackOverflow(MyThread* t)
 {
-  switch (code) {
+  throwNew(t, Machine::StackOverflowErrorType); 
+}
+
+void NO_RETURN
+throw_(MyThread* t, object o)
+{
+  if (LIKELY(o)) {
+    vm::throw_(t, o);
+  } else {
+    throwNew(t, Machine::NullPointerExceptionType);
+  }
+}
+
+void
+checkCast(MyThread* t, object class_, object o)
+{
+  if (UNLIKELY(o and not isAssignableFrom(t, class_, objectClass(t, o)))) {
+    object classNameFrom = className(t, objectClass(t, o));
+    object classNameTo   = className(t, class_);
+    THREAD_RUNTIME_ARRAY(t, char, classFrom, byteArrayLength(t, classNameFrom));
+    THREAD_RUNTIME_ARRAY(t, char, classTo,   byteArrayLength(t, classNameTo));
+    replace('/', '.', RUNTIME_ARRAY_BODY(classFrom),
+            reinterpret_cast<char*>(&byteArrayBody(t, classNameFrom, 0)));
+    replace('/', '.', RUNTIME_ARRAY_BODY(classTo),
+            reinterpret_cast<char*>(&byteArrayBody(t, classNameTo,   0)));
+    throwNew
+      (t, Machine::ClassCastExceptionType, "%s cannot be cast to %s",
+       RUNTIME_ARRAY_BODY(classFrom), RUNTIME_ARRAY_BODY(classTo));
+  }
+}
+
+void
+checkCastFromReference(MyThread* t, object pair, object o)
+{
+  PROTECT(t, o);
+
+  object c = resolveClass
+    (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
+     referenceName(t, pairSecond(t, pair)));
+
+  checkCast(t, c, o);
+}
+
+object
+resolveField(Thread* t, object pair)
+{
+  object reference = pairSecond(t, pair);
+  PROTECT(t, reference);
+
+  object class_ = resolveClassInObject
+    (t, classLoader(t, methodClass(t, pairFirst(t, pair))), reference,
+     ReferenceClass);
+
+  return findInHierarchy
+    (t, class_, referenceName(t, reference), referenceSpec(t, reference),
+     findFieldInClass, Machine::NoSuchFieldErrorType);
+}
+
+uint64_t
+getFieldValue(Thread* t, object target, object field)
+{
+  switch (fieldCode(t, field)) {
   case ByteField:
   case BooleanField:
+    return fieldAtOffset<int8_t>(target, fieldOffset(t, field));
+
   case CharField:
   case ShortField:
-  case IntField:
-  case LongField:
-    return Compiler::IntegerType;
-
-  case ObjectField:
-    return Compiler::ObjectType;
+    return fieldAtOffset<int16_t>(target, fieldOffset(t, field));
 
   case FloatField:
+  case IntField:
+    return fieldAtOffset<int32_t>(target, fieldOffset(t, field));
+
   case DoubleField:
-    return Compiler::FloatType;
+  case LongField:
+    return fieldAtOffset<int64_t>(target, fieldOffset(t, field));
 
-  case VoidField:
-    return Compiler::VoidType;
+  case ObjectField:
+    return fieldAtOffset<intptr_t>(target, fieldOffset(t, field));
 
   default:
     abort(t);
   }
 }
 
-bool
-useLongJump(MyThread* t, uintptr_t target)
+uint64_t
+getStaticFieldValueFromReference(MyThread* t, object pair)
 {
-  uintptr_t reach = t->arch->maximumImmediateJump();
-  FixedAllocator* a = codeAllocator(t);
-  uintptr_t start = reinterpret_cast<uintptr_t>(a->base);
-  uintptr_t end = reinterpret_cast<uintptr_t>(a->base) + a->capacity;
-  assert(t, end - start < reach);
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-  return (target > end && (target - start) > reach)
-    or (target < start && (end - target) > reach);
+  initClass(t, fieldClass(t, field));
+
+  ACQUIRE_FIELD_FOR_READ(t, field);
+
+  return getFieldValue(t, classStaticTable(t, fieldClass(t, field)), field);
 }
 
-Compiler::Operand*
-compileDirectInvoke(MyThread* t, Frame* frame, object target, bool tailCall,
-                    bool useThunk, unsigned rSize, avian::codegen::Promise* addressPromise)
+uint64_t
+getFieldValueFromReference(MyThread* t, object pair, object instance)
 {
-  avian::codegen::Compiler* c = frame->c;
+  PROTECT(t, instance);
 
-  unsigned flags = (avian::codegen::TailCalls and tailCall ? Compiler::TailJump : 0);
-  unsigned traceFlags;
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-  if (addressPromise == 0 and useLongJump(t, methodAddress(t, target))) {
-    flags |= Compiler::LongJumpOrCall;
-    traceFlags = TraceElement::LongCall;
-  } else {
-    traceFlags = 0;
-  }
+  ACQUIRE_FIELD_FOR_READ(t, field);
 
-  if (useThunk
-      or (avian::codegen::TailCalls and tailCall and (methodFlags(t, target) & ACC_NATIVE)))
-  {
-    if (frame->context->bootContext == 0) {
-      flags |= Compiler::Aligned;
-    }
+  return getFieldValue(t, instance, field);
+}
 
-    if (avian::codegen::TailCalls and tailCall) {
-      traceFlags |= TraceElement::TailCall;
+void
+setStaticLongFieldValueFromReference(MyThread* t, object pair, uint64_t value)
+{
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-      TraceElement* trace = frame->trace(target, traceFlags);
+  initClass(t, fieldClass(t, field));
 
-      avian::codegen::Promise* returnAddressPromise = new
-        (frame->context->zone.allocate(sizeof(TraceElementPromise)))
-        TraceElementPromise(t->m->system, trace);
+  ACQUIRE_FIELD_FOR_WRITE(t, field);
 
-      Compiler::Operand* result = c->stackCall
-        (c->promiseConstant(returnAddressPromise, Compiler::AddressType),
-         flags,
-         trace,
-         rSize,
-         operandTypeForFieldCode(t, methodReturnCode(t, target)),
-         methodParameterFootprint(t, target));
+  fieldAtOffset<int64_t>
+    (classStaticTable(t, fieldClass(t, field)), fieldOffset(t, field)) = value;
+}
 
-      c->store
-        (TargetBytesPerWord,
-         frame->absoluteAddressOperand(returnAddressPromise),
-         TargetBytesPerWord, c->memory
-         (c->register_(t->arch->thread()), Compiler::AddressType,
-          TARGET_THREAD_TAILADDRESS));
+void
+setLongFieldValueFromReference(MyThread* t, object pair, object instance,
+                               uint64_t value)
+{
+  PROTECT(t, instance);
 
-      c->exit
-        (c->constant
-         ((methodFlags(t, target) & ACC_NATIVE)
-          ? nativeThunk(t) : defaultThunk(t),
-          Compiler::AddressType));
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-      return result;
-    } else {
-      return c->stackCall
-        (c->constant(defaultThunk(t), Compiler::AddressType),
-         flags,
-         frame->trace(target, traceFlags),
-         rSize,
-         operandTypeForFieldCode(t, methodReturnCode(t, target)),
-         methodParameterFootprint(t, target));
-    }
-  } else {
-    Compiler::Operand* address =
-      (addressPromise
-       ? c->promiseConstant(addressPromise, Compiler::AddressType)
-       : c->constant(methodAddress(t, target), Compiler::AddressType));
+  ACQUIRE_FIELD_FOR_WRITE(t, field);
 
-    return c->stackCall
-      (address,
-       flags,
-       tailCall ? 0 : frame->trace
-       ((methodFlags(t, target) & ACC_NATIVE) ? target : 0, 0),
-       rSize,
-       operandTypeForFieldCode(t, methodReturnCode(t, target)),
-       methodParameterFootprint(t, target));
-  }
+  fieldAtOffset<int64_t>(instance, fieldOffset(t, field)) = value;
 }
 
-bool
-compileDirectInvoke(MyThread* t, Frame* frame, object target, bool tailCall)
+void
+setStaticObjectFieldValueFromReference(MyThread* t, object pair, object value)
 {
-  unsigned rSize = resultSize(t, methodReturnCode(t, target));
-
-  Compiler::Operand* result = 0;
-
-  if (emptyMethod(t, target)) {
-    tailCall = false;
-  } else {
-    BootContext* bc = frame->context->bootContext;
-    if (bc) {
-      if ((methodClass(t, target) == methodClass(t, frame->context->method)
-           or (not classNeedsInit(t, methodClass(t, target))))
-          and (not (avian::codegen::TailCalls and tailCall
-                    and (methodFlags(t, target) & ACC_NATIVE))))
-      {
-        avian::codegen::Promise* p = new(bc->zone) avian::codegen::ListenPromise(t->m->system, bc->zone);
-
-        PROTECT(t, target);
-        object pointer = makePointer(t, p);
-        bc->calls = makeTriple(t, target, pointer, bc->calls);
+  PROTECT(t, value);
 
-        result = compileDirectInvoke
-          (t, frame, target, tailCall, false, rSize, p);
-      } else {
-        result = compileDirectInvoke
-          (t, frame, target, tailCall, true, rSize, 0);
-      }
-    } else if (unresolved(t, methodAddress(t, target))
-               or classNeedsInit(t, methodClass(t, target)))
-    {
-      result = compileDirectInvoke
-        (t, frame, target, tailCall, true, rSize, 0);
-    } else {
-      result = compileDirectInvoke
-        (t, frame, target, tailCall, false, rSize, 0);
-    }
-  }
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-  frame->pop(methodParameterFootprint(t, target));
+  initClass(t, fieldClass(t, field));
 
-  if (rSize) {
-    pushReturnValue(t, frame, methodReturnCode(t, target), result);
-  }
+  ACQUIRE_FIELD_FOR_WRITE(t, field);
 
-  return tailCall;
+  set(t, classStaticTable(t, fieldClass(t, field)), fieldOffset(t, field),
+      value);
 }
 
-unsigned
-methodReferenceParameterFootprint(Thread* t, object reference, bool isStatic)
+void
+setObjectFieldValueFromReference(MyThread* t, object pair, object instance,
+                                 object value)
 {
-  return parameterFootprint
-    (t, reinterpret_cast<const char*>
-     (&byteArrayBody(t, referenceSpec(t, reference), 0)), isStatic);
-}
+  PROTECT(t, instance);
+  PROTECT(t, value);
 
-int
-methodReferenceReturnCode(Thread* t, object reference)
-{
-  unsigned parameterCount;
-  unsigned returnCode;
-  scanMethodSpec
-    (t, reinterpret_cast<const char*>
-     (&byteArrayBody(t, referenceSpec(t, reference), 0)), &parameterCount,
-     &returnCode);
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-  return returnCode;
+  ACQUIRE_FIELD_FOR_WRITE(t, field);
+
+  set(t, instance, fieldOffset(t, field), value);
 }
 
 void
-compileReferenceInvoke(MyThread* t, Frame* frame, Compiler::Operand* method,
-                       object reference, bool isStatic, bool tailCall)
+setFieldValue(MyThread* t, object target, object field, uint32_t value)
 {
-  unsigned parameterFootprint
-    = methodReferenceParameterFootprint(t, reference, isStatic);
-
-  int returnCode = methodReferenceReturnCode(t, reference);
-
-  unsigned rSize = resultSize(t, returnCode);
+  switch (fieldCode(t, field)) {
+  case ByteField:
+  case BooleanField:
+    fieldAtOffset<int8_t>(target, fieldOffset(t, field)) = value;
+    break;
 
-  Compiler::Operand* result = frame->c->stackCall
-    (method,
-     tailCall ? Compiler::TailJump : 0,
-     frame->trace(0, 0),
-     rSize,
-     operandTypeForFieldCode(t, returnCode),
-     parameterFootprint);
+  case CharField:
+  case ShortField:
+    fieldAtOffset<int16_t>(target, fieldOffset(t, field)) = value;
+    break;
 
-  frame->pop(parameterFootprint);
+  case FloatField:
+  case IntField:
+    fieldAtOffset<int32_t>(target, fieldOffset(t, field)) = value;
+    break;
 
-  if (rSize) {
-    pushReturnValue(t, frame, returnCode, result);
+  default:
+    abort(t);
   }
 }
 
 void
-compileDirectReferenceInvoke(MyThread* t, Frame* frame, Thunk thunk,
-                             object reference, bool isStatic, bool tailCall)
+setStaticFieldValueFromReference(MyThread* t, object pair, uint32_t value)
 {
-  avian::codegen::Compiler* c = frame->c;
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-  PROTECT(t, reference);
+  initClass(t, fieldClass(t, field));
 
-  object pair = makePair(t, frame->context->method, reference);
+  ACQUIRE_FIELD_FOR_WRITE(t, field);
 
-  compileReferenceInvoke
-    (t, frame, c->call
-     (c->constant(getThunk(t, thunk), Compiler::AddressType),
-      0,
-      frame->trace(0, 0),
-      TargetBytesPerWord,
-      Compiler::AddressType,
-      2, c->register_(t->arch->thread()), frame->append(pair)),
-     reference, isStatic, tailCall);
+  setFieldValue(t, classStaticTable(t, fieldClass(t, field)), field, value);
 }
 
 void
-compileAbstractInvoke(MyThread* t, Frame* frame, Compiler::Operand* method,
-                      object target, bool tailCall)
+setFieldValueFromReference(MyThread* t, object pair, object instance,
+                           uint32_t value)
 {
-  unsigned parameterFootprint = methodParameterFootprint(t, target);
-  
-  int returnCode = methodReturnCode(t, target);
-
-  unsigned rSize = resultSize(t, returnCode);
+  PROTECT(t, instance);
+  object field = resolveField(t, pair);
+  PROTECT(t, field);
 
-  Compiler::Operand* result = frame->c->stackCall
-    (method,
-     tailCall ? Compiler::TailJump : 0,
-     frame->trace(0, 0),
-     rSize,
-     operandTypeForFieldCode(t, returnCode),
-     parameterFootprint);
+  ACQUIRE_FIELD_FOR_WRITE(t, field);
 
-  frame->pop(parameterFootprint);
+  setFieldValue(t, instance, field, value);
+}
 
-  if (rSize) {
-    pushReturnValue(t, frame, returnCode, result);
-  }    
+uint64_t
+instanceOf64(Thread* t, object class_, object o)
+{
+  return instanceOf(t, class_, o);
 }
 
-void
-compileDirectAbstractInvoke(MyThread* t, Frame* frame, Thunk thunk,
-                            object target, bool tailCall)
+uint64_t
+instanceOfFromReference(Thread* t, object pair, object o)
 {
-  avian::codegen::Compiler* c = frame->c;
+  PROTECT(t, o);
 
-  compileAbstractInvoke
-    (t, frame, c->call
-     (c->constant(getThunk(t, thunk), Compiler::AddressType),
-      0,
-      frame->trace(0, 0),
-      TargetBytesPerWord,
-      Compiler::AddressType,
-      2, c->register_(t->arch->thread()), frame->append(target)),
-     target, tailCall);
+  object c = resolveClass
+    (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
+     referenceName(t, pairSecond(t, pair)));
+
+  return instanceOf64(t, c, o);
 }
 
-void
-handleMonitorEvent(MyThread* t, Frame* frame, intptr_t function)
+uint64_t
+makeNewGeneral64(Thread* t, object class_)
 {
-  avian::codegen::Compiler* c = frame->c;
-  object method = frame->context->method;
+  PROTECT(t, class_);
 
-  if (methodFlags(t, method) & ACC_SYNCHRONIZED) {
-    Compiler::Operand* lock;
-    if (methodFlags(t, method) & ACC_STATIC) {
-      PROTECT(t, method);
+  initClass(t, class_);
 
-      lock = frame->append(methodClass(t, method));
-    } else {
-      lock = loadLocal(frame->context, 1, savedTargetIndex(t, method));
-    }
-    
-    c->call(c->constant(function, Compiler::AddressType),
-            0,
-            frame->trace(0, 0),
-            0,
-            Compiler::VoidType,
-            2, c->register_(t->arch->thread()), lock);
-  }
+  return reinterpret_cast<uintptr_t>(makeNewGeneral(t, class_));
 }
 
-void
-handleEntrance(MyThread* t, Frame* frame)
+uint64_t
+makeNew64(Thread* t, object class_)
 {
-  object method = frame->context->method;
+  PROTECT(t, class_);
 
-  if ((methodFlags(t, method) & (ACC_SYNCHRONIZED | ACC_STATIC))
-      == ACC_SYNCHRONIZED)
-  {
-    // save 'this' pointer in case it is overwritten.
-    unsigned index = savedTargetIndex(t, method);
-    storeLocal(frame->context, 1, loadLocal(frame->context, 1, 0), index);
-    frame->set(index, Frame::Object);
-  }
+  initClass(t, class_);
 
-  handleMonitorEvent
-    (t, frame, getThunk(t, acquireMonitorForObjectOnEntranceThunk));
+  return reinterpret_cast<uintptr_t>(makeNew(t, class_));
 }
 
-void
-handleExit(MyThread* t, Frame* frame)
+uint64_t
+makeNewAtSite64(Thread* t, object class_, AllocationSite* site)
 {
-  handleMonitorEvent
-    (t, frame, getThunk(t, releaseMonitorForObjectThunk));
-}
+  PROTECT(t, class_);
 
-bool
-inTryBlock(MyThread* t, object code, unsigned ip)
-{
-  object table = codeExceptionHandlerTable(t, code);
-  if (table) {
-    unsigned length = exceptionHandlerTableLength(t, table);
-    for (unsigned i = 0; i < length; ++i) {
-      uint64_t eh = exceptionHandlerTableBody(t, table, i);
-      if (ip >= exceptionHandlerStart(eh)
-          and ip < exceptionHandlerEnd(eh))
-      {
-        return true;
-      }
-    }
-  }
-  return false;
+  initClass(t, class_);
+
+  return reinterpret_cast<uintptr_t>(makeNew(t, class_, site));
 }
 
-bool
-needsReturnBarrier(MyThread* t, object method)
+uint64_t
+makeNewFromReference(Thread* t, object pair)
 {
-  return (methodFlags(t, method) & ConstructorFlag)
-    and (classVmFlags(t, methodClass(t, method)) & HasFinalMemberFlag);
+  object class_ = resolveClass
+    (t, classLoader(t, methodClass(t, pairFirst(t, pair))),
+     referenceName(t, pairSecond(t, pair)));
+
+  PROTECT(t, class_);
+
+  initClass(t, class_);
+
+  return makeNewGeneral64(t, class_);
 }
 
-bool
-returnsNext(MyThread* t, object code, unsigned ip)
+uint64_t
+getJClass64(Thread* t, object class_)
 {
-  switch (codeBody(t, code, ip)) {
-  case return_:
-  case areturn:
-  case ireturn:
-  case freturn:
-  case lreturn:
-  case dreturn:
-    return true;
+  return reinterpret_cast<uintptr_t>(getJClass(t, class_));
+}
 
-  case goto_: {
-    uint32_t offset = codeReadInt16(t, code, ++ip);
-    uint32_t newIp = (ip - 3) + offset;
-    assert(t, newIp < codeLength(t, code));
+void
+gcIfNecessary(MyThread* t)
+{
+  stress(t);
 
-    return returnsNext(t, code, newIp);
+  if (UNLIKELY(t->flags & Thread::UseBackupHeapFlag)) {
+    collect(t, Heap::MinorCollection);
   }
+}
 
-  case goto_w: {
-    uint32_t offset = codeReadInt32(t, code, ++ip);
-    uint32_t newIp = (ip - 5) + offset;
-    assert(t, newIp < codeLength(t, code));
-    
-    return returnsNext(t, code, newIp);
-  }
+unsigned
+resultSize(MyThread* t, unsigned code)
+{
+  switch (code) {
+  case ByteField:
+  case BooleanField:
+  case CharField:
+  case ShortField:
+  case FloatField:
+  case IntField:
+    return 4;
+
+  case ObjectField:
+    return TargetBytesPerWord;
+
+  case LongField:
+  case DoubleField:
+    return 8;
+
+  case VoidField:
+    return 0;
 
   default:
-    return false;
+    abort(t);
   }
 }
 
-bool
-isTailCall(MyThread* t, object code, unsigned ip, object caller,
-           int calleeReturnCode, object calleeClassName,
-           object calleeMethodName, object calleeMethodSpec)
+void
+pushReturnValue(MyThread* t, Frame* frame, unsigned code,
+                Compiler::Operand* result)
 {
-  return avian::codegen::TailCalls
-    and ((methodFlags(t, caller) & ACC_SYNCHRONIZED) == 0)
-    and (not inTryBlock(t, code, ip - 1))
-    and (not needsReturnBarrier(t, caller))
-    and (methodReturnCode(t, caller) == VoidField
-         or methodReturnCode(t, caller) == calleeReturnCode)
-    and returnsNext(t, code, ip)
-    and t->m->classpath->canTailCall
-    (t, caller, calleeClassName, calleeMethodName, calleeMethodSpec);
-}
+  switch (code) {
+  case ByteField:
+  case BooleanField:
+  case CharField:
+  case ShortField:
+  case FloatField:
+  case IntField:
+    return frame->pushInt(result);
 
-bool
-isTailCall(MyThread* t, object code, unsigned ip, object caller, object callee)
-{
-  return isTailCall
-    (t, code, ip, caller, methodReturnCode(t, callee),
-     className(t, methodClass(t, callee)), methodName(t, callee),
-     methodSpec(t, callee));
-}
+  case ObjectField:
+    return frame->pushObject(result);
 
-bool
-isReferenceTailCall(MyThread* t, object code, unsigned ip, object caller,
-                    object calleeReference)
-{
-  object c = referenceClass(t, calleeReference);
-  if (objectClass(t, c) == type(t, Machine::ClassType)) {
-    c = className(t, c);
-  }
+  case LongField:
+  case DoubleField:
+    return frame->pushLong(result);
 
-  return isTailCall
-    (t, code, ip, caller, methodReferenceReturnCode(t, calleeReference),
-     c, referenceName(t, calleeReference), referenceSpec(t, calleeReference));
+  default:
+    abort(t);
+  }
 }
 
-bool
-integerBranch(MyThread* t, Frame* frame, object code, unsigned& ip,
-              unsigned size, Compiler::Operand* a, Compiler::Operand* b,
-              unsigned* newIpp)
+Compiler::Operand*
+popField(MyThread* t, Frame* frame, int code)
 {
-  if (ip + 3 > codeLength(t, code)) {
-    return false;
-  }
+  switch (code) {
+  case ByteField:
+  case BooleanField:
+  case CharField:
+  case ShortField:
+  case FloatField:
+  case IntField:
+    return frame->popInt();
 
-  avian::codegen::Compiler* c = frame->c;
-  unsigned instruction = codeBody(t, code, ip++);
-  uint32_t offset = codeReadInt16(t, code, ip);
-  uint32_t newIp = (ip - 3) + offset;
-  assert(t, newIp < codeLength(t, code));
-  
-  Compiler::Operand* target = frame->machineIp(newIp);
+  case DoubleField:
+  case LongField:
+    return frame->popLong();
 
-  switch (instruction) {
-  case ifeq:
-    c->jumpIfEqual(size, a, b, target);
-    break;
+  case ObjectField:
+    return frame->popObject();
 
-  case ifne:
-    c->jumpIfNotEqual(size, a, b, target);
-    break;
+  default: abort(t);
+  }
+}
 
-  case ifgt:
-    c->jumpIfGreater(size, a, b, target);
-    break;
+Compiler::OperandType
+operandTypeForFieldCode(Thread* t, unsigned code)
+{
+  switch (code) {
+  case ByteField:
+  case BooleanField:
+  case CharField:
+  case ShortField:
+  case IntField:
+  case LongField:
+    return Compiler::IntegerType;
 
-  case ifge:
-    c->jumpIfGreaterOrEqual(size, a, b, target);
-    break;
+  case ObjectField:
+    return Compiler::ObjectType;
 
-  case iflt:
-    c->jumpIfLess(size, a, b, target);
-    break;
+  case FloatField:
+  case DoubleField:
+    return Compiler::FloatType;
 
-  case ifle:
-    c->jumpIfLessOrEqual(size, a, b, target);
-    break;
+  case VoidField:
+    return Compiler::VoidType;
 
   default:
-    ip -= 3;
-    return false;
+    abort(t);
   }
-
-  *newIpp = newIp;
-  return true;
 }
 
 bool
-floatBranch(MyThread* t, Frame* frame, object code, unsigned& ip,
-            unsigned size, bool lessIfUnordered, Compiler::Operand* a,
-            Compiler::Operand* b, unsigned* newIpp)
+useLongJump(MyThread* t, uintptr_t target)
 {
-  if (ip + 3 > codeLength(t, code)) {
-    return false;
-  }
+  uintptr_t reach = t->arch->maximumImmediateJump();
+  CodeAllocator* a = codeAllocator(t);
+  uintptr_t start = a->windowStart;
+  uintptr_t end = a->windowEnd;
+  assert(t, end - start < reach);
+
+  return (target > end && (target - start) > reach)
+    or (target < start && (end - target) > reach);
+}
 
+Compiler::Operand*
+compileDirectInvoke(MyThread* t, Frame* frame, object target, bool tailCall,
+                    bool useThunk, unsigned rSize, avian::codegen::Promise* addressPromise)
+{
   avian::codegen::Compiler* c = frame->c;
-  unsigned instruction = codeBody(t, code, ip++);
-  uint32_t offset = codeReadInt16(t, code, ip);
-  uint32_t newIp = (ip - 3) + offset;
-  assert(t, newIp < codeLength(t, code));
-  
-  Compiler::Operand* target = frame->machineIp(newIp);
 
-  switch (instruction) {
-  case ifeq:
-    c->jumpIfFloatEqual(size, a, b, target);
-    break;
+  unsigned flags = (avian::codegen::TailCalls and tailCall ? Compiler::TailJump : 0);
+  unsigned traceFlags;
 
-  case ifne:
-    c->jumpIfFloatNotEqual(size, a, b, target);
-    break;
+  if (addressPromise == 0 and useLongJump(t, methodAddress(t, target))) {
+    flags |= Compiler::LongJumpOrCall;
+    traceFlags = TraceElement::LongCall;
+  } else {
+    traceFlags = 0;
+  }
 
-  case ifgt:
-    if (lessIfUnordered) {
-      c->jumpIfFloatGreater(size, a, b, target);
-    } else {
-      c->jumpIfFloatGreaterOrUnordered(size, a, b, target);
+  if (useThunk
+      or (avian::codegen::TailCalls and tailCall and (methodFlags(t, target) & ACC_NATIVE)))
+  {
+    if (frame->context->bootContext == 0) {
+      flags |= Compiler::Aligned;
     }
-    break;
 
-  case ifge:
-    if (lessIfUnordered) {
-      c->jumpIfFloatGreaterOrEqual(size, a, b, target);
-    } else {
-      c->jumpIfFloatGreaterOrEqualOrUnordered(size, a, b, target);
-    }
-    break;
+    if (avian::codegen::TailCalls and tailCall) {
+      traceFlags |= TraceElement::TailCall;
 
-  case iflt:
-    if (lessIfUnordered) {
-      c->jumpIfFloatLessOrUnordered(size, a, b, target);
+      TraceElement* trace = frame->trace(target, traceFlags);
+
+      avian::codegen::Promise* returnAddressPromise = new
+        (frame->context->zone.allocate(sizeof(TraceElementPromise)))
+        TraceElementPromise(t->m->system, trace);
+
+      Compiler::Operand* result = c->stackCall
+        (c->promiseConstant(returnAddressPromise, Compiler::AddressType),
+         flags,
+         trace,
+         rSize,
+         operandTypeForFieldCode(t, methodReturnCode(t, target)),
+         methodParameterFootprint(t, target));
+
+      c->store
+        (TargetBytesPerWord,
+         frame->absoluteAddressOperand(returnAddressPromise),
+         TargetBytesPerWord, c->memory
+         (c->register_(t->arch->thread()), Compiler::AddressType,
+          TARGET_THREAD_TAILADDRESS));
+
+      c->exit
+        (c->constant
+         ((methodFlags(t, target) & ACC_NATIVE)
+          ? nativeThunk(t) : defaultThunk(t),
+          Compiler::AddressType));
+
+      return result;
     } else {
-      c->jumpIfFloatLess(size, a, b, target);
+      return c->stackCall
+        (c->constant(defaultThunk(t), Compiler::AddressType),
+         flags,
+         frame->trace(target, traceFlags),
+         rSize,
+         operandTypeForFieldCode(t, methodReturnCode(t, target)),
+         methodParameterFootprint(t, target));
     }
-    break;
+  } else {
+    Compiler::Operand* address =
+      (addressPromise
+       ? c->promiseConstant(addressPromise, Compiler::AddressType)
+       : c->constant(methodAddress(t, target), Compiler::AddressType));
 
-  case ifle:
-    if (lessIfUnordered) {
-      c->jumpIfFloatLessOrEqualOrUnordered(size, a, b, target);
+    return c->stackCall
+      (address,
+       flags,
+       tailCall ? 0 : frame->trace
+       ((methodFlags(t, target) & ACC_NATIVE) ? target : 0, 0),
+       rSize,
+       operandTypeForFieldCode(t, methodReturnCode(t, target)),
+       methodParameterFootprint(t, target));
+  }
+}
+
+bool
+compileDirectInvoke(MyThread* t, Frame* frame, object target, bool tailCall)
+{
+  unsigned rSize = resultSize(t, methodReturnCode(t, target));
+
+  Compiler::Operand* result = 0;
+
+  if (emptyMethod(t, target)) {
+    tailCall = false;
+  } else {
+    BootContext* bc = frame->context->bootContext;
+    if (bc) {
+      if ((methodClass(t, target) == methodClass(t, frame->context->method)
+           or (not classNeedsInit(t, methodClass(t, target))))
+          and (not (avian::codegen::TailCalls and tailCall
+                    and (methodFlags(t, target) & ACC_NATIVE))))
+      {
+        avian::codegen::Promise* p = new(bc->zone) avian::codegen::ListenPromise(t->m->system, bc->zone);
+
+        PROTECT(t, target);
+        object pointer = makePointer(t, p);
+        bc->calls = makeTriple(t, target, pointer, bc->calls);
+
+        result = compileDirectInvoke
+          (t, frame, target, tailCall, false, rSize, p);
+      } else {
+        result = compileDirectInvoke
+          (t, frame, target, tailCall, true, rSize, 0);
+      }
+    } else if (unresolved(t, methodAddress(t, target))
+               or classNeedsInit(t, methodClass(t, target))
+               or ((codeAllocator(t)->sweep or codeCacheFile(t)->enabled)
+                   and (methodFlags(t, target) & ACC_NATIVE) == 0))
+    {
+      // when the code sweeper is enabled, we always call through the
+      // thunk so there's a call node for every site it may need to
+      // reset if it evicts the target later.  Likewise, code saved to
+      // the code cache file must not refer to other methods directly.
+      result = compileDirectInvoke
+        (t, frame, target, tailCall, true, rSize, 0);
     } else {
-      c->jumpIfFloatLessOrEqual(size, a, b, target);
+      result = compileDirectInvoke
+        (t, frame, target, tailCall, false, rSize, 0);
     }
-    break;
+  }
 
-  default:
-    ip -= 3;
-    return false;
+  frame->pop(methodParameterFootprint(t, target));
+
+  if (rSize) {
+    pushReturnValue(t, frame, methodReturnCode(t, target), result);
   }
 
-  *newIpp = newIp;
-  return true;
+  return tailCall;
 }
 
-Compiler::Operand*
-popLongAddress(Frame* frame)
+unsigned
+methodReferenceParameterFootprint(Thread* t, object reference, bool isStatic)
 {
-  return TargetBytesPerWord == 8 ? frame->popLong() : frame->c->load
-    (8, 8, frame->popLong(), TargetBytesPerWord);
+  return parameterFootprint
+    (t, reinterpret_cast<const char*>
+     (&byteArrayBody(t, referenceSpec(t, reference), 0)), isStatic);
 }
 
-bool
-intrinsic(MyThread* t, Frame* frame, object target)
+int
+methodReferenceReturnCode(Thread* t, object reference)
 {
-#define MATCH(name, constant)                                           \
-  (byteArrayLength(t, name) == sizeof(constant)                         \
-   and ::strcmp(reinterpret_cast<char*>(&byteArrayBody(t, name, 0)),    \
-                constant) == 0)
+  unsigned parameterCount;
+  unsigned returnCode;
+  scanMethodSpec
+    (t, reinterpret_cast<const char*>
+     (&byteArrayBody(t, referenceSpec(t, reference), 0)), &parameterCount,
+     &returnCode);
 
-  object className = vm::className(t, methodClass(t, target));
-  if (UNLIKELY(MATCH(className, "java/lang/Math"))) {
-    avian::codegen::Compiler* c = frame->c;
-    if (MATCH(methodName(t, target), "sqrt")
-        and MATCH(methodSpec(t, target), "(D)D"))
-    {
-      frame->pushLong(c->fsqrt(8, frame->popLong()));
-      return true;
-    } else if (MATCH(methodName(t, target), "abs")) {
-      if (MATCH(methodSpec(t, target), "(I)I")) {
-        frame->pushInt(c->abs(4, frame->popInt()));
-        return true;
-      } else if (MATCH(methodSpec(t, target), "(J)J")) {
-        frame->pushLong(c->abs(8, frame->popLong()));
-        return true;
-      } else if (MATCH(methodSpec(t, target), "(F)F")) {
-        frame->pushInt(c->fabs(4, frame->popInt()));
-        return true;
-      }
-    }
-  } else if (UNLIKELY(MATCH(className, "sun/misc/Unsafe"))) {
-    avian::codegen::Compiler* c = frame->c;
-    if (MATCH(methodName(t, target), "getByte")
-        and MATCH(methodSpec(t, target), "(J)B"))
-    {
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      frame->pushInt
-        (c->load
-         (1, 1, c->memory(address, Compiler::IntegerType, 0, 0, 1),
-          TargetBytesPerWord));
-      return true;
-    } else if (MATCH(methodName(t, target), "putByte")
-               and MATCH(methodSpec(t, target), "(JB)V"))
-    {
-      Compiler::Operand* value = frame->popInt();
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      c->store
-        (TargetBytesPerWord, value, 1, c->memory
-         (address, Compiler::IntegerType, 0, 0, 1));
-      return true;
-    } else if ((MATCH(methodName(t, target), "getShort")
-                and MATCH(methodSpec(t, target), "(J)S"))
-               or (MATCH(methodName(t, target), "getChar")
-                   and MATCH(methodSpec(t, target), "(J)C")))
-    {
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      frame->pushInt
-        (c->load
-         (2, 2, c->memory(address, Compiler::IntegerType, 0, 0, 1),
-          TargetBytesPerWord));
-      return true;
-    } else if ((MATCH(methodName(t, target), "putShort")
-                and MATCH(methodSpec(t, target), "(JS)V"))
-               or (MATCH(methodName(t, target), "putChar")
-                   and MATCH(methodSpec(t, target), "(JC)V")))
-    {
-      Compiler::Operand* value = frame->popInt();
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      c->store
-        (TargetBytesPerWord, value, 2, c->memory
-         (address, Compiler::IntegerType, 0, 0, 1));
-      return true;
-    } else if ((MATCH(methodName(t, target), "getInt")
-                and MATCH(methodSpec(t, target), "(J)I"))
-               or (MATCH(methodName(t, target), "getFloat")
-                   and MATCH(methodSpec(t, target), "(J)F")))
-    {
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      frame->pushInt
-        (c->load
-         (4, 4, c->memory
-          (address, MATCH(methodName(t, target), "getInt")
-           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1),
-          TargetBytesPerWord));
-      return true;
-    } else if ((MATCH(methodName(t, target), "putInt")
-                and MATCH(methodSpec(t, target), "(JI)V"))
-               or (MATCH(methodName(t, target), "putFloat")
-                   and MATCH(methodSpec(t, target), "(JF)V")))
-    {
-      Compiler::Operand* value = frame->popInt();
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      c->store
-        (TargetBytesPerWord, value, 4, c->memory
-         (address, MATCH(methodName(t, target), "putInt")
-           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1));
-      return true;
-    } else if ((MATCH(methodName(t, target), "getLong")
-                and MATCH(methodSpec(t, target), "(J)J"))
-               or (MATCH(methodName(t, target), "getDouble")
-                   and MATCH(methodSpec(t, target), "(J)D")))
-    {
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      frame->pushLong
-        (c->load
-         (8, 8, c->memory
-          (address, MATCH(methodName(t, target), "getLong")
-           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1),
-          8));
-      return true;
-    } else if ((MATCH(methodName(t, target), "putLong")
-                and MATCH(methodSpec(t, target), "(JJ)V"))
-               or (MATCH(methodName(t, target), "putDouble")
-                   and MATCH(methodSpec(t, target), "(JD)V")))
-    {
-      Compiler::Operand* value = frame->popLong();
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      c->store
-        (8, value, 8, c->memory
-         (address, MATCH(methodName(t, target), "putLong")
-           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1));
-      return true;
-    } else if (MATCH(methodName(t, target), "getAddress")
-                and MATCH(methodSpec(t, target), "(J)J"))
-    {
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      frame->pushLong
-        (c->load
-         (TargetBytesPerWord, TargetBytesPerWord,
-          c->memory(address, Compiler::AddressType, 0, 0, 1), 8));
-      return true;
-    } else if (MATCH(methodName(t, target), "putAddress")
-               and MATCH(methodSpec(t, target), "(JJ)V"))
-    {
-      Compiler::Operand* value = frame->popLong();
-      Compiler::Operand* address = popLongAddress(frame);
-      frame->popObject();
-      c->store
-        (8, value, TargetBytesPerWord, c->memory
-         (address, Compiler::AddressType, 0, 0, 1));
-      return true;
+  return returnCode;
+}
+
+void
+compileReferenceInvoke(MyThread* t, Frame* frame, Compiler::Operand* method,
+                       object reference, bool isStatic, bool tailCall)
+{
+  unsigned parameterFootprint
+    = methodReferenceParameterFootprint(t, reference, isStatic);
+
+  int returnCode = methodReferenceReturnCode(t, reference);
+
+  unsigned rSize = resultSize(t, returnCode);
+
+  Compiler::Operand* result = frame->c->stackCall
+    (method,
+     tailCall ? Compiler::TailJump : 0,
+     frame->trace(0, 0),
+     rSize,
+     operandTypeForFieldCode(t, returnCode),
+     parameterFootprint);
+
+  frame->pop(parameterFootprint);
+
+  if (rSize) {
+    pushReturnValue(t, frame, returnCode, result);
+  }
+}
+
+void
+compileDirectReferenceInvoke(MyThread* t, Frame* frame, Thunk thunk,
+                             object reference, bool isStatic, bool tailCall)
+{
+  avian::codegen::Compiler* c = frame->c;
+
+  PROTECT(t, reference);
+
+  object pair = makePair(t, frame->context->method, reference);
+
+  compileReferenceInvoke
+    (t, frame, c->call
+     (c->constant(getThunk(t, thunk), Compiler::AddressType),
+      0,
+      frame->trace(0, 0),
+      TargetBytesPerWord,
+      Compiler::AddressType,
+      2, c->register_(t->arch->thread()), frame->append(pair)),
+     reference, isStatic, tailCall);
+}
+
+void
+compileAbstractInvoke(MyThread* t, Frame* frame, Compiler::Operand* method,
+                      object target, bool tailCall)
+{
+  unsigned parameterFootprint = methodParameterFootprint(t, target);
+  
+  int returnCode = methodReturnCode(t, target);
+
+  unsigned rSize = resultSize(t, returnCode);
+
+  Compiler::Operand* result = frame->c->stackCall
+    (method,
+     tailCall ? Compiler::TailJump : 0,
+     frame->trace(0, 0),
+     rSize,
+     operandTypeForFieldCode(t, returnCode),
+     parameterFootprint);
+
+  frame->pop(parameterFootprint);
+
+  if (rSize) {
+    pushReturnValue(t, frame, returnCode, result);
+  }    
+}
+
+void
+compileDirectAbstractInvoke(MyThread* t, Frame* frame, Thunk thunk,
+                            object target, bool tailCall)
+{
+  avian::codegen::Compiler* c = frame->c;
+
+  compileAbstractInvoke
+    (t, frame, c->call
+     (c->constant(getThunk(t, thunk), Compiler::AddressType),
+      0,
+      frame->trace(0, 0),
+      TargetBytesPerWord,
+      Compiler::AddressType,
+      2, c->register_(t->arch->thread()), frame->append(target)),
+     target, tailCall);
+}
+
+void
+handleMonitorEvent(MyThread* t, Frame* frame, intptr_t function)
+{
+  avian::codegen::Compiler* c = frame->c;
+  object method = frame->context->method;
+
+  if (methodFlags(t, method) & ACC_SYNCHRONIZED) {
+    Compiler::Operand* lock;
+    if (methodFlags(t, method) & ACC_STATIC) {
+      PROTECT(t, method);
+
+      lock = frame->append(methodClass(t, method));
+    } else {
+      lock = loadLocal(frame->context, 1, savedTargetIndex(t, method));
+    }
+    
+    c->call(c->constant(function, Compiler::AddressType),
+            0,
+            frame->trace(0, 0),
+            0,
+            Compiler::VoidType,
+            2, c->register_(t->arch->thread()), lock);
+  }
+}
+
+void
+handleEntrance(MyThread* t, Frame* frame)
+{
+  object method = frame->context->method;
+
+  if ((methodFlags(t, method) & (ACC_SYNCHRONIZED | ACC_STATIC))
+      == ACC_SYNCHRONIZED)
+  {
+    // save 'this' pointer in case it is overwritten.
+    unsigned index = savedTargetIndex(t, method);
+    storeLocal(frame->context, 1, loadLocal(frame->context, 1, 0), index);
+    frame->set(index, Frame::Object);
+  }
+
+  handleMonitorEvent
+    (t, frame, getThunk(t, acquireMonitorForObjectOnEntranceThunk));
+}
+
+void
+handleExit(MyThread* t, Frame* frame)
+{
+  handleMonitorEvent
+    (t, frame, getThunk(t, releaseMonitorForObjectThunk));
+}
+
+bool
+inTryBlock(MyThread* t, object code, unsigned ip)
+{
+  object table = codeExceptionHandlerTable(t, code);
+  if (table) {
+    unsigned length = exceptionHandlerTableLength(t, table);
+    for (unsigned i = 0; i < length; ++i) {
+      uint64_t eh = exceptionHandlerTableBody(t, table, i);
+      if (ip >= exceptionHandlerStart(eh)
+          and ip < exceptionHandlerEnd(eh))
+      {
+        return true;
+      }
     }
   }
   return false;
 }
 
-unsigned
-targetFieldOffset(Context* context, object field)
+bool
+needsReturnBarrier(MyThread* t, object method)
 {
-  if (context->bootContext) {
-    return context->bootContext->resolver->fieldOffset(context->thread, field);
-  } else {
-    return fieldOffset(context->thread, field);
+  return (methodFlags(t, method) & ConstructorFlag)
+    and (classVmFlags(t, methodClass(t, method)) & HasFinalMemberFlag);
+}
+
+bool
+returnsNext(MyThread* t, object code, unsigned ip)
+{
+  switch (codeBody(t, code, ip)) {
+  case return_:
+  case areturn:
+  case ireturn:
+  case freturn:
+  case lreturn:
+  case dreturn:
+    return true;
+
+  case goto_: {
+    uint32_t offset = codeReadInt16(t, code, ++ip);
+    uint32_t newIp = (ip - 3) + offset;
+    assert(t, newIp < codeLength(t, code));
+
+    return returnsNext(t, code, newIp);
+  }
+
+  case goto_w: {
+    uint32_t offset = codeReadInt32(t, code, ++ip);
+    uint32_t newIp = (ip - 5) + offset;
+    assert(t, newIp < codeLength(t, code));
+    
+    return returnsNext(t, code, newIp);
+  }
+
+  default:
+    return false;
   }
 }
 
-class Stack {
- public:
-  class MyResource: public Thread::Resource {
-   public:
-    MyResource(Stack* s): Resource(s->thread), s(s) { }
+bool
+isTailCall(MyThread* t, object code, unsigned ip, object caller,
+           int calleeReturnCode, object calleeClassName,
+           object calleeMethodName, object calleeMethodSpec)
+{
+  return avian::codegen::TailCalls
+    and ((methodFlags(t, caller) & ACC_SYNCHRONIZED) == 0)
+    and (not inTryBlock(t, code, ip - 1))
+    and (not needsReturnBarrier(t, caller))
+    and (methodReturnCode(t, caller) == VoidField
+         or methodReturnCode(t, caller) == calleeReturnCode)
+    and returnsNext(t, code, ip)
+    and t->m->classpath->canTailCall
+    (t, caller, calleeClassName, calleeMethodName, calleeMethodSpec);
+}
+
+bool
+isTailCall(MyThread* t, object code, unsigned ip, object caller, object callee)
+{
+  return isTailCall
+    (t, code, ip, caller, methodReturnCode(t, callee),
+     className(t, methodClass(t, callee)), methodName(t, callee),
+     methodSpec(t, callee));
+}
+
+bool
+isReferenceTailCall(MyThread* t, object code, unsigned ip, object caller,
+                    object calleeReference)
+{
+  object c = referenceClass(t, calleeReference);
+  if (objectClass(t, c) == type(t, Machine::ClassType)) {
+    c = className(t, c);
+  }
+
+  return isTailCall
+    (t, code, ip, caller, methodReferenceReturnCode(t, calleeReference),
+     c, referenceName(t, calleeReference), referenceSpec(t, calleeReference));
+}
+
+bool
+integerBranch(MyThread* t, Frame* frame, object code, unsigned& ip,
+              unsigned size, Compiler::Operand* a, Compiler::Operand* b,
+              unsigned* newIpp)
+{
+  if (ip + 3 > codeLength(t, code)) {
+    return false;
+  }
+
+  avian::codegen::Compiler* c = frame->c;
+  unsigned instruction = codeBody(t, code, ip++);
+  uint32_t offset = codeReadInt16(t, code, ip);
+  uint32_t newIp = (ip - 3) + offset;
+  assert(t, newIp < codeLength(t, code));
+  
+  Compiler::Operand* target = frame->machineIp(newIp);
+
+  switch (instruction) {
+  case ifeq:
+    c->jumpIfEqual(size, a, b, target);
+    break;
+
+  case ifne:
+    c->jumpIfNotEqual(size, a, b, target);
+    break;
+
+  case ifgt:
+    c->jumpIfGreater(size, a, b, target);
+    break;
+
+  case ifge:
+    c->jumpIfGreaterOrEqual(size, a, b, target);
+    break;
+
+  case iflt:
+    c->jumpIfLess(size, a, b, target);
+    break;
+
+  case ifle:
+    c->jumpIfLessOrEqual(size, a, b, target);
+    break;
+
+  default:
+    ip -= 3;
+    return false;
+  }
+
+  *newIpp = newIp;
+  return true;
+}
+
+bool
+floatBranch(MyThread* t, Frame* frame, object code, unsigned& ip,
+            unsigned size, bool lessIfUnordered, Compiler::Operand* a,
+            Compiler::Operand* b, unsigned* newIpp)
+{
+  if (ip + 3 > codeLength(t, code)) {
+    return false;
+  }
+
+  avian::codegen::Compiler* c = frame->c;
+  unsigned instruction = codeBody(t, code, ip++);
+  uint32_t offset = codeReadInt16(t, code, ip);
+  uint32_t newIp = (ip - 3) + offset;
+  assert(t, newIp < codeLength(t, code));
+  
+  Compiler::Operand* target = frame->machineIp(newIp);
+
+  switch (instruction) {
+  case ifeq:
+    c->jumpIfFloatEqual(size, a, b, target);
+    break;
+
+  case ifne:
+    c->jumpIfFloatNotEqual(size, a, b, target);
+    break;
+
+  case ifgt:
+    if (lessIfUnordered) {
+      c->jumpIfFloatGreater(size, a, b, target);
+    } else {
+      c->jumpIfFloatGreaterOrUnordered(size, a, b, target);
+    }
+    break;
+
+  case ifge:
+    if (lessIfUnordered) {
+      c->jumpIfFloatGreaterOrEqual(size, a, b, target);
+    } else {
+      c->jumpIfFloatGreaterOrEqualOrUnordered(size, a, b, target);
+    }
+    break;
+
+  case iflt:
+    if (lessIfUnordered) {
+      c->jumpIfFloatLessOrUnordered(size, a, b, target);
+    } else {
+      c->jumpIfFloatLess(size, a, b, target);
+    }
+    break;
+
+  case ifle:
+    if (lessIfUnordered) {
+      c->jumpIfFloatLessOrEqualOrUnordered(size, a, b, target);
+    } else {
+      c->jumpIfFloatLessOrEqual(size, a, b, target);
+    }
+    break;
+
+  default:
+    ip -= 3;
+    return false;
+  }
+
+  *newIpp = newIp;
+  return true;
+}
+
+Compiler::Operand*
+popLongAddress(Frame* frame)
+{
+  return TargetBytesPerWord == 8 ? frame->popLong() : frame->c->load
+    (8, 8, frame->popLong(), TargetBytesPerWord);
+}
+
+// pops the object and offset arguments of an Unsafe field accessor,
+// along with the Unsafe instance itself, and returns the field they
+// refer to
+Compiler::Operand*
+popUnsafeField(Frame* frame, Compiler::OperandType type)
+{
+  Compiler::Operand* offset = popLongAddress(frame);
+  Compiler::Operand* instance = frame->popObject();
+  frame->popObject();
+  return frame->c->memory(instance, type, 0, offset, 1);
+}
+
+bool
+intrinsic(MyThread* t, Frame* frame, object target)
+{
+#define MATCH(name, constant)                                           \
+  (byteArrayLength(t, name) == sizeof(constant)                         \
+   and ::strcmp(reinterpret_cast<char*>(&byteArrayBody(t, name, 0)),    \
+                constant) == 0)
+
+  object className = vm::className(t, methodClass(t, target));
+  if (UNLIKELY(MATCH(className, "java/lang/Math"))) {
+    avian::codegen::Compiler* c = frame->c;
+    if (MATCH(methodName(t, target), "sqrt")
+        and MATCH(methodSpec(t, target), "(D)D"))
+    {
+      frame->pushLong(c->fsqrt(8, frame->popLong()));
+      return true;
+    } else if (MATCH(methodName(t, target), "abs")) {
+      if (MATCH(methodSpec(t, target), "(I)I")) {
+        frame->pushInt(c->abs(4, frame->popInt()));
+        return true;
+      } else if (MATCH(methodSpec(t, target), "(J)J")) {
+        frame->pushLong(c->abs(8, frame->popLong()));
+        return true;
+      } else if (MATCH(methodSpec(t, target), "(F)F")) {
+        frame->pushInt(c->fabs(4, frame->popInt()));
+        return true;
+      }
+    } else if (MATCH(methodName(t, target), "min")
+               or MATCH(methodName(t, target), "max"))
+    {
+      bool min = MATCH(methodName(t, target), "min");
+      if (MATCH(methodSpec(t, target), "(II)I")) {
+        Compiler::Operand* a = frame->popInt();
+        Compiler::Operand* b = frame->popInt();
+        frame->pushInt(min ? c->min(4, a, b) : c->max(4, a, b));
+        return true;
+      } else if (MATCH(methodSpec(t, target), "(JJ)J")) {
+        Compiler::Operand* a = frame->popLong();
+        Compiler::Operand* b = frame->popLong();
+        frame->pushLong(min ? c->min(8, a, b) : c->max(8, a, b));
+        return true;
+      }
+    }
+  } else if (UNLIKELY(MATCH(className, "java/lang/Integer"))) {
+    avian::codegen::Compiler* c = frame->c;
+    if (MATCH(methodSpec(t, target), "(I)I")) {
+      if (MATCH(methodName(t, target), "bitCount")) {
+        frame->pushInt(c->popcnt(4, frame->popInt()));
+        return true;
+      } else if (MATCH(methodName(t, target), "numberOfLeadingZeros")) {
+        frame->pushInt(c->clz(4, frame->popInt()));
+        return true;
+      } else if (MATCH(methodName(t, target), "numberOfTrailingZeros")) {
+        frame->pushInt(c->ctz(4, frame->popInt()));
+        return true;
+      } else if (MATCH(methodName(t, target), "reverseBytes")) {
+        frame->pushInt(c->bswap(4, frame->popInt()));
+        return true;
+      }
+    } else if (MATCH(methodSpec(t, target), "(II)I")) {
+      if (MATCH(methodName(t, target), "rotateLeft")) {
+        Compiler::Operand* distance = frame->popInt();
+        frame->pushInt(c->rol(4, distance, frame->popInt()));
+        return true;
+      } else if (MATCH(methodName(t, target), "rotateRight")) {
+        Compiler::Operand* distance = frame->popInt();
+        frame->pushInt(c->ror(4, distance, frame->popInt()));
+        return true;
+      }
+    }
+  } else if (UNLIKELY(MATCH(className, "java/lang/Long"))) {
+    avian::codegen::Compiler* c = frame->c;
+    if (MATCH(methodSpec(t, target), "(J)I")) {
+      Compiler::Operand* result;
+      if (MATCH(methodName(t, target), "bitCount")) {
+        result = c->popcnt(8, frame->popLong());
+      } else if (MATCH(methodName(t, target), "numberOfLeadingZeros")) {
+        result = c->clz(8, frame->popLong());
+      } else if (MATCH(methodName(t, target), "numberOfTrailingZeros")) {
+        result = c->ctz(8, frame->popLong());
+      } else {
+        return false;
+      }
+
+      frame->pushInt(c->load(8, 8, result, TargetBytesPerWord));
+      return true;
+    } else if (MATCH(methodName(t, target), "reverseBytes")
+               and MATCH(methodSpec(t, target), "(J)J"))
+    {
+      frame->pushLong(c->bswap(8, frame->popLong()));
+      return true;
+    } else if (MATCH(methodSpec(t, target), "(JI)J")) {
+      if (MATCH(methodName(t, target), "rotateLeft")) {
+        Compiler::Operand* distance = frame->popInt();
+        frame->pushLong(c->rol(8, distance, frame->popLong()));
+        return true;
+      } else if (MATCH(methodName(t, target), "rotateRight")) {
+        Compiler::Operand* distance = frame->popInt();
+        frame->pushLong(c->ror(8, distance, frame->popLong()));
+        return true;
+      }
+    }
+  } else if (UNLIKELY(MATCH(className, "java/lang/System"))) {
+    avian::codegen::Compiler* c = frame->c;
+    if (MATCH(methodName(t, target), "arraycopy")
+        and MATCH(methodSpec(t, target),
+                  "(Ljava/lang/Object;ILjava/lang/Object;II)V"))
+    {
+      // call the copy routine directly rather than going through the
+      // native method machinery
+      Compiler::Operand* length = frame->popInt();
+      Compiler::Operand* dstOffset = frame->popInt();
+      Compiler::Operand* dst = frame->popObject();
+      Compiler::Operand* srcOffset = frame->popInt();
+      Compiler::Operand* src = frame->popObject();
+
+      c->call
+        (c->constant(getThunk(t, copyArrayThunk), Compiler::AddressType),
+         0, frame->trace(0, 0), 0, Compiler::VoidType, 6,
+         c->register_(t->arch->thread()), src, srcOffset, dst, dstOffset,
+         length);
+      return true;
+    }
+  } else if (UNLIKELY(MATCH(className, "java/lang/String"))) {
+    // String is final, so these can't be overridden
+    avian::codegen::Compiler* c = frame->c;
+    if (MATCH(methodName(t, target), "equals")
+        and MATCH(methodSpec(t, target), "(Ljava/lang/Object;)Z"))
+    {
+      Compiler::Operand* other = frame->popObject();
+      Compiler::Operand* this_ = frame->popObject();
+
+      frame->pushInt
+        (c->call
+         (c->constant(getThunk(t, stringsEqualThunk), Compiler::AddressType),
+          0, frame->trace(0, 0), 4, Compiler::IntegerType, 3,
+          c->register_(t->arch->thread()), this_, other));
+      return true;
+    } else if (MATCH(methodName(t, target), "hashCode")
+               and MATCH(methodSpec(t, target), "()I"))
+    {
+      Compiler::Operand* this_ = frame->popObject();
+
+      frame->pushInt
+        (c->call
+         (c->constant(getThunk(t, hashStringThunk), Compiler::AddressType),
+          0, frame->trace(0, 0), 4, Compiler::IntegerType, 2,
+          c->register_(t->arch->thread()), this_));
+      return true;
+    } else if (MATCH(methodName(t, target), "compareTo")
+               and MATCH(methodSpec(t, target), "(Ljava/lang/String;)I"))
+    {
+      Compiler::Operand* other = frame->popObject();
+      Compiler::Operand* this_ = frame->popObject();
+
+      frame->pushInt
+        (c->call
+         (c->constant(getThunk(t, compareStringsThunk), Compiler::AddressType),
+          0, frame->trace(0, 0), 4, Compiler::IntegerType, 3,
+          c->register_(t->arch->thread()), this_, other));
+      return true;
+    } else if (MATCH(methodName(t, target), "indexOf")
+               and MATCH(methodSpec(t, target), "(I)I"))
+    {
+      Compiler::Operand* ch = frame->popInt();
+      Compiler::Operand* this_ = frame->popObject();
+
+      frame->pushInt
+        (c->call
+         (c->constant(getThunk(t, indexOfCharThunk), Compiler::AddressType),
+          0, frame->trace(0, 0), 4, Compiler::IntegerType, 3,
+          c->register_(t->arch->thread()), this_, ch));
+      return true;
+    } else if (MATCH(methodName(t, target), "indexOf")
+               and MATCH(methodSpec(t, target), "(Ljava/lang/String;)I"))
+    {
+      Compiler::Operand* pattern = frame->popObject();
+      Compiler::Operand* this_ = frame->popObject();
+
+      frame->pushInt
+        (c->call
+         (c->constant(getThunk(t, indexOfStringThunk), Compiler::AddressType),
+          0, frame->trace(0, 0), 4, Compiler::IntegerType, 3,
+          c->register_(t->arch->thread()), this_, pattern));
+      return true;
+    }
+  } else if (UNLIKELY(MATCH(className, "java/util/Arrays"))) {
+    avian::codegen::Compiler* c = frame->c;
+    if (MATCH(methodName(t, target), "fill")) {
+      if (MATCH(methodSpec(t, target), "([JJ)V")
+          or MATCH(methodSpec(t, target), "([DD)V"))
+      {
+        Compiler::Operand* value = frame->popLong();
+        Compiler::Operand* array = frame->popObject();
+
+        c->call
+          (c->constant(getThunk(t, fillLongArrayThunk), Compiler::AddressType),
+           0, frame->trace(0, 0), 0, Compiler::VoidType, 4,
+           c->register_(t->arch->thread()), array,
+           static_cast<Compiler::Operand*>(0), value);
+        return true;
+      } else if (MATCH(methodSpec(t, target),
+                       "([Ljava/lang/Object;Ljava/lang/Object;)V"))
+      {
+        Compiler::Operand* value = frame->popObject();
+        Compiler::Operand* array = frame->popObject();
+
+        c->call
+          (c->constant
+           (getThunk(t, fillObjectArrayThunk), Compiler::AddressType),
+           0, frame->trace(0, 0), 0, Compiler::VoidType, 3,
+           c->register_(t->arch->thread()), array, value);
+        return true;
+      } else if (MATCH(methodSpec(t, target), "([BB)V")
+                 or MATCH(methodSpec(t, target), "([ZZ)V")
+                 or MATCH(methodSpec(t, target), "([CC)V")
+                 or MATCH(methodSpec(t, target), "([SS)V")
+                 or MATCH(methodSpec(t, target), "([II)V")
+                 or MATCH(methodSpec(t, target), "([FF)V"))
+      {
+        Compiler::Operand* value = frame->popInt();
+        Compiler::Operand* array = frame->popObject();
+
+        c->call
+          (c->constant(getThunk(t, fillArrayThunk), Compiler::AddressType),
+           0, frame->trace(0, 0), 0, Compiler::VoidType, 3,
+           c->register_(t->arch->thread()), array, value);
+        return true;
+      }
+    }
+  } else if (UNLIKELY(MATCH(className, "sun/misc/Unsafe"))) {
+    avian::codegen::Compiler* c = frame->c;
+    if (MATCH(methodName(t, target), "getByte")
+        and MATCH(methodSpec(t, target), "(J)B"))
+    {
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      frame->pushInt
+        (c->load
+         (1, 1, c->memory(address, Compiler::IntegerType, 0, 0, 1),
+          TargetBytesPerWord));
+      return true;
+    } else if (MATCH(methodName(t, target), "putByte")
+               and MATCH(methodSpec(t, target), "(JB)V"))
+    {
+      Compiler::Operand* value = frame->popInt();
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      c->store
+        (TargetBytesPerWord, value, 1, c->memory
+         (address, Compiler::IntegerType, 0, 0, 1));
+      return true;
+    } else if ((MATCH(methodName(t, target), "getShort")
+                and MATCH(methodSpec(t, target), "(J)S"))
+               or (MATCH(methodName(t, target), "getChar")
+                   and MATCH(methodSpec(t, target), "(J)C")))
+    {
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      frame->pushInt
+        (c->load
+         (2, 2, c->memory(address, Compiler::IntegerType, 0, 0, 1),
+          TargetBytesPerWord));
+      return true;
+    } else if ((MATCH(methodName(t, target), "putShort")
+                and MATCH(methodSpec(t, target), "(JS)V"))
+               or (MATCH(methodName(t, target), "putChar")
+                   and MATCH(methodSpec(t, target), "(JC)V")))
+    {
+      Compiler::Operand* value = frame->popInt();
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      c->store
+        (TargetBytesPerWord, value, 2, c->memory
+         (address, Compiler::IntegerType, 0, 0, 1));
+      return true;
+    } else if ((MATCH(methodName(t, target), "getInt")
+                and MATCH(methodSpec(t, target), "(J)I"))
+               or (MATCH(methodName(t, target), "getFloat")
+                   and MATCH(methodSpec(t, target), "(J)F")))
+    {
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      frame->pushInt
+        (c->load
+         (4, 4, c->memory
+          (address, MATCH(methodName(t, target), "getInt")
+           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1),
+          TargetBytesPerWord));
+      return true;
+    } else if ((MATCH(methodName(t, target), "putInt")
+                and MATCH(methodSpec(t, target), "(JI)V"))
+               or (MATCH(methodName(t, target), "putFloat")
+                   and MATCH(methodSpec(t, target), "(JF)V")))
+    {
+      Compiler::Operand* value = frame->popInt();
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      c->store
+        (TargetBytesPerWord, value, 4, c->memory
+         (address, MATCH(methodName(t, target), "putInt")
+           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1));
+      return true;
+    } else if ((MATCH(methodName(t, target), "getLong")
+                and MATCH(methodSpec(t, target), "(J)J"))
+               or (MATCH(methodName(t, target), "getDouble")
+                   and MATCH(methodSpec(t, target), "(J)D")))
+    {
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      frame->pushLong
+        (c->load
+         (8, 8, c->memory
+          (address, MATCH(methodName(t, target), "getLong")
+           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1),
+          8));
+      return true;
+    } else if ((MATCH(methodName(t, target), "putLong")
+                and MATCH(methodSpec(t, target), "(JJ)V"))
+               or (MATCH(methodName(t, target), "putDouble")
+                   and MATCH(methodSpec(t, target), "(JD)V")))
+    {
+      Compiler::Operand* value = frame->popLong();
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      c->store
+        (8, value, 8, c->memory
+         (address, MATCH(methodName(t, target), "putLong")
+           ? Compiler::IntegerType : Compiler::FloatType, 0, 0, 1));
+      return true;
+    } else if (MATCH(methodName(t, target), "getAddress")
+                and MATCH(methodSpec(t, target), "(J)J"))
+    {
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      frame->pushLong
+        (c->load
+         (TargetBytesPerWord, TargetBytesPerWord,
+          c->memory(address, Compiler::AddressType, 0, 0, 1), 8));
+      return true;
+    } else if (MATCH(methodName(t, target), "putAddress")
+               and MATCH(methodSpec(t, target), "(JJ)V"))
+    {
+      Compiler::Operand* value = frame->popLong();
+      Compiler::Operand* address = popLongAddress(frame);
+      frame->popObject();
+      c->store
+        (8, value, TargetBytesPerWord, c->memory
+         (address, Compiler::AddressType, 0, 0, 1));
+      return true;
+    } else if (MATCH(methodName(t, target), "getIntVolatile")
+               and MATCH(methodSpec(t, target), "(Ljava/lang/Object;J)I"))
+    {
+      frame->pushInt
+        (c->load
+         (4, 4, popUnsafeField(frame, Compiler::IntegerType),
+          TargetBytesPerWord));
+      c->loadBarrier();
+      return true;
+    } else if (TargetBytesPerWord == 8
+               and MATCH(methodName(t, target), "getLongVolatile")
+               and MATCH(methodSpec(t, target), "(Ljava/lang/Object;J)J"))
+    {
+      frame->pushLong
+        (c->load(8, 8, popUnsafeField(frame, Compiler::IntegerType), 8));
+      c->loadBarrier();
+      return true;
+    } else if (MATCH(methodName(t, target), "getObjectVolatile")
+               and MATCH(methodSpec(t, target),
+                         "(Ljava/lang/Object;J)Ljava/lang/Object;"))
+    {
+      frame->pushObject
+        (c->load
+         (TargetBytesPerWord, TargetBytesPerWord,
+          popUnsafeField(frame, Compiler::ObjectType), TargetBytesPerWord));
+      c->loadBarrier();
+      return true;
+    } else if ((MATCH(methodName(t, target), "putIntVolatile")
+                or MATCH(methodName(t, target), "putOrderedInt"))
+               and MATCH(methodSpec(t, target), "(Ljava/lang/Object;JI)V"))
+    {
+      // an ordered put is a volatile put without the trailing
+      // store-load barrier
+      Compiler::Operand* value = frame->popInt();
+      Compiler::Operand* field = popUnsafeField(frame, Compiler::IntegerType);
+      c->storeStoreBarrier();
+      c->store(TargetBytesPerWord, value, 4, field);
+      if (MATCH(methodName(t, target), "putIntVolatile")) {
+        c->storeLoadBarrier();
+      }
+      return true;
+    } else if (TargetBytesPerWord == 8
+               and (MATCH(methodName(t, target), "putLongVolatile")
+                    or MATCH(methodName(t, target), "putOrderedLong"))
+               and MATCH(methodSpec(t, target), "(Ljava/lang/Object;JJ)V"))
+    {
+      Compiler::Operand* value = frame->popLong();
+      Compiler::Operand* field = popUnsafeField(frame, Compiler::IntegerType);
+      c->storeStoreBarrier();
+      c->store(8, value, 8, field);
+      if (MATCH(methodName(t, target), "putLongVolatile")) {
+        c->storeLoadBarrier();
+      }
+      return true;
+    } else if ((MATCH(methodName(t, target), "putObjectVolatile")
+                or MATCH(methodName(t, target), "putOrderedObject"))
+               and MATCH(methodSpec(t, target),
+                         "(Ljava/lang/Object;JLjava/lang/Object;)V"))
+    {
+      Compiler::Operand* value = frame->popObject();
+      Compiler::Operand* offset = popLongAddress(frame);
+      Compiler::Operand* instance = frame->popObject();
+      frame->popObject();
+      c->storeStoreBarrier();
+      c->call
+        (c->constant(getThunk(t, setThunk), Compiler::AddressType),
+         0, 0, 0, Compiler::VoidType,
+         4, c->register_(t->arch->thread()), instance, offset, value);
+      if (MATCH(methodName(t, target), "putObjectVolatile")) {
+        c->storeLoadBarrier();
+      }
+      return true;
+    } else if (MATCH(methodName(t, target), "compareAndSwapInt")
+               and MATCH(methodSpec(t, target), "(Ljava/lang/Object;JII)Z"))
+    {
+      Compiler::Operand* update = frame->popInt();
+      Compiler::Operand* expect = frame->popInt();
+      Compiler::Operand* offset = popLongAddress(frame);
+      Compiler::Operand* instance = frame->popObject();
+      frame->popObject();
+      frame->pushInt
+        (c->call
+         (c->constant
+          (getThunk(t, compareAndSwapIntThunk), Compiler::AddressType),
+          0, 0, 4, Compiler::IntegerType,
+          5, c->register_(t->arch->thread()), instance, offset, expect,
+          update));
+      return true;
+#ifdef AVIAN_HAS_CAS64
+    } else if (MATCH(methodName(t, target), "compareAndSwapLong")
+               and MATCH(methodSpec(t, target), "(Ljava/lang/Object;JJJ)Z"))
+    {
+      Compiler::Operand* update = frame->popLong();
+      Compiler::Operand* expect = frame->popLong();
+      Compiler::Operand* offset = popLongAddress(frame);
+      Compiler::Operand* instance = frame->popObject();
+      frame->popObject();
+      frame->pushInt
+        (c->call
+         (c->constant
+          (getThunk(t, compareAndSwapLongThunk), Compiler::AddressType),
+          0, 0, 4, Compiler::IntegerType,
+          7, c->register_(t->arch->thread()), instance, offset,
+          static_cast<Compiler::Operand*>(0), expect,
+          static_cast<Compiler::Operand*>(0), update));
+      return true;
+#endif
+    } else if (MATCH(methodName(t, target), "compareAndSwapObject")
+               and MATCH(methodSpec(t, target),
+                         "(Ljava/lang/Object;JLjava/lang/Object;"
+                         "Ljava/lang/Object;)Z"))
+    {
+      Compiler::Operand* update = frame->popObject();
+      Compiler::Operand* expect = frame->popObject();
+      Compiler::Operand* offset = popLongAddress(frame);
+      Compiler::Operand* instance = frame->popObject();
+      frame->popObject();
+      frame->pushInt
+        (c->call
+         (c->constant
+          (getThunk(t, compareAndSwapObjectThunk), Compiler::AddressType),
+          0, 0, 4, Compiler::IntegerType,
+          5, c->register_(t->arch->thread()), instance, offset, expect,
+          update));
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned
+targetFieldOffset(Context* context, object field)
+{
+  if (context->bootContext) {
+    return context->bootContext->resolver->fieldOffset(context->thread, field);
+  } else {
+    return fieldOffset(context->thread, field);
+  }
+}
+
+class Stack {
+ public:
+  class MyResource: public Thread::Resource {
+   public:
+    MyResource(Stack* s): Resource(s->thread), s(s) { }
+
+    virtual void release() {
+      s->zone.dispose();
+    }
+
+    Stack* s;
+  };
+
+  Stack(MyThread* t):
+    thread(t),
+    zone(t->m->system, t->m->heap, 0),
+    resource(this)
+  { }
+
+  ~Stack() {
+    zone.dispose();
+  }
+
+  void pushValue(uintptr_t v) {
+    *static_cast<uintptr_t*>(push(BytesPerWord)) = v;
+  }
+
+  uintptr_t peekValue(unsigned offset) {
+    return *static_cast<uintptr_t*>(peek((offset + 1) * BytesPerWord));
+  }
+
+  uintptr_t popValue() {
+    uintptr_t v = peekValue(0);
+    pop(BytesPerWord);
+    return v;
+  }
+
+  void* push(unsigned size) {
+    return zone.allocate(size);
+  }
+
+  void* peek(unsigned size) {
+    return zone.peek(size);
+  }
+
+  void pop(unsigned size) {
+    zone.pop(size);
+  }
+
+  MyThread* thread;
+  Zone zone;
+  MyResource resource;
+};
+
+class SwitchState {
+ public:
+  SwitchState(Compiler::State* state,
+              unsigned count,
+              unsigned defaultIp,
+              Compiler::Operand* key,
+              avian::codegen::Promise* start,
+              int bottom,
+              int top):
+    state(state),
+    count(count),
+    defaultIp(defaultIp),
+    key(key),
+    start(start),
+    bottom(bottom),
+    top(top),
+    index(0)
+  { }
+
+  Frame* frame() {
+    return reinterpret_cast<Frame*>
+      (reinterpret_cast<uint8_t*>(this) - pad(count * 4) - pad(sizeof(Frame)));
+  }
+
+  uint32_t* ipTable() {
+    return reinterpret_cast<uint32_t*>
+      (reinterpret_cast<uint8_t*>(this) - pad(count * 4));
+  }
+
+  Compiler::State* state;
+  unsigned count;
+  unsigned defaultIp;
+  Compiler::Operand* key;
+  avian::codegen::Promise* start;
+  int bottom;
+  int top;
+  unsigned index;
+};
+
+// Escape analysis: an object allocated by a "new" instruction whose
+// only uses are as the receiver of getfield, putfield, monitorenter,
+// monitorexit, or a trivial constructor never becomes visible outside
+// the method that allocates it.  For such allocation sites we keep
+// the fields in extra locals instead of on the heap, push a null
+// placeholder in place of the object reference, and elide monitor
+// operations entirely.  The analysis tracks, for each local and
+// stack slot, the set of sites whose objects may be held there.
+
+const uint32_t ScalarSiteMask = (static_cast<uint32_t>(1) << MaxScalarSites)
+  - 1;
+const uint32_t VoidValue = static_cast<uint32_t>(1) << 30;
+const uint32_t OtherValue = static_cast<uint32_t>(1) << 31;
+
+const int8_t UnknownSite = -2;
+const int8_t NoSite = -1;
+
+bool
+exactScalarSite(uint32_t value)
+{
+  return value and (value & ~ScalarSiteMask) == 0
+    and (value & (value - 1)) == 0;
+}
+
+int
+scalarSiteNumber(uint32_t value)
+{
+  int n = 0;
+  while ((value & 1) == 0) {
+    value >>= 1;
+    ++ n;
+  }
+  return n;
+}
+
+unsigned
+fieldFootprintInPool(MyThread* t, object code, unsigned index)
+{
+  object o = singletonObject(t, codePool(t, code), index);
+
+  unsigned fc;
+  if (objectClass(t, o) == type(t, Machine::ReferenceType)) {
+    fc = vm::fieldCode(t, byteArrayBody(t, referenceSpec(t, o), 0));
+  } else {
+    fc = fieldCode(t, o);
+  }
+
+  return (fc == LongField or fc == DoubleField) ? 2 : 1;
+}
+
+const char*
+methodSpecInPool(MyThread* t, object code, unsigned index)
+{
+  object o = singletonObject(t, codePool(t, code), index);
+
+  return reinterpret_cast<const char*>
+    (&byteArrayBody
+     (t, objectClass(t, o) == type(t, Machine::ReferenceType)
+      ? referenceSpec(t, o) : methodSpec(t, o), 0));
+}
+
+unsigned
+returnFootprint(MyThread* t, const char* spec)
+{
+  MethodSpecIterator it(t, spec);
+  while (it.hasNext()) it.next();
+
+  switch (*it.returnSpec()) {
+  case 'V': return 0;
+  case 'J':
+  case 'D': return 2;
+  default: return 1;
+  }
+}
+
+int
+scalarField(ScalarSite* site, unsigned offset)
+{
+  for (unsigned i = 0; i < site->fieldCount; ++i) {
+    if (site->offsets[i] == offset) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+unsigned
+scalarSlot(MyThread* t, ScalarSite* site, object field)
+{
+  int i = scalarField(site, fieldOffset(t, field));
+  assert(t, i >= 0);
+  return site->slots[i];
+}
+
+class EscapeAnalyzer {
+ public:
+  EscapeAnalyzer(MyThread* t, Context* context, unsigned length,
+                 unsigned localCount, unsigned stackCount):
+    t(t),
+    context(context),
+    length(length),
+    localCount(localCount),
+    width(localCount + stackCount),
+    states(static_cast<uint32_t*>
+           (context->zone.allocate(length * width * 4))),
+    heights(static_cast<int*>(context->zone.allocate(length * sizeof(int)))),
+    values(static_cast<uint32_t*>(context->zone.allocate(width * 4))),
+    handlerValues(static_cast<uint32_t*>(context->zone.allocate(width * 4))),
+    work(static_cast<unsigned*>
+         (context->zone.allocate(length * sizeof(unsigned)))),
+    queued(static_cast<bool*>(context->zone.allocate(length))),
+    siteOf(static_cast<int8_t*>(context->zone.allocate(length))),
+    sites(static_cast<ScalarSite*>
+          (context->zone.allocate(MaxScalarSites * sizeof(ScalarSite)))),
+    siteAt(static_cast<int8_t*>(context->zone.allocate(length))),
+    initAt(static_cast<ScalarInit**>
+           (context->zone.allocate(length * sizeof(ScalarInit*)))),
+    workCount(0),
+    siteCount(0),
+    sp(0),
+    escaped(0),
+    recording(false),
+    failed(false)
+  {
+    for (unsigned i = 0; i < length; ++i) {
+      heights[i] = -1;
+    }
+    memset(queued, 0, length);
+    memset(siteOf, UnknownSite, length);
+    memset(siteAt, NoSite, length);
+    memset(initAt, 0, length * sizeof(ScalarInit*));
+  }
+
+  void push(uint32_t v) {
+    if (sp < width - localCount) {
+      values[localCount + (sp++)] = v;
+    } else {
+      failed = true;
+    }
+  }
+
+  uint32_t pop() {
+    if (sp) {
+      return values[localCount + (--sp)];
+    } else {
+      failed = true;
+      return OtherValue;
+    }
+  }
+
+  void produce(unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+      push(OtherValue);
+    }
+  }
+
+  void escape(uint32_t v) {
+    if (recording) {
+      escaped |= v & ScalarSiteMask;
+    }
+  }
+
+  void consume(unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+      escape(pop());
+    }
+  }
+
+  void use(unsigned ip, uint32_t v) {
+    if (recording) {
+      if (exactScalarSite(v)) {
+        siteAt[ip] = scalarSiteNumber(v);
+      } else {
+        escape(v);
+      }
+    }
+  }
+
+  void useField(unsigned ip, unsigned index, uint32_t v) {
+    if (recording and exactScalarSite(v)) {
+      object field = resolveField(t, context->method, index - 1, false);
+      if (field == 0 or (fieldFlags(t, field) & ACC_STATIC)
+          or scalarField(sites + scalarSiteNumber(v), fieldOffset(t, field))
+          < 0)
+      {
+        escape(v);
+        return;
+      }
+    }
+
+    use(ip, v);
+  }
+
+  void load(unsigned index, unsigned footprint) {
+    if (index + footprint <= localCount) {
+      for (unsigned i = 0; i < footprint; ++i) {
+        push(values[index + i]);
+      }
+    } else {
+      failed = true;
+    }
+  }
+
+  void store(unsigned index, unsigned footprint) {
+    if (index + footprint <= localCount) {
+      for (unsigned i = footprint; i > 0; --i) {
+        values[index + i - 1] = pop();
+      }
+    } else {
+      failed = true;
+    }
+  }
+
+  void merge(unsigned target, uint32_t* from, unsigned height) {
+    if (recording) {
+      return;
+    }
+
+    if (target >= length) {
+      failed = true;
+      return;
+    }
+
+    uint32_t* to = states + (target * width);
+    bool changed = false;
+    if (heights[target] < 0) {
+      memcpy(to, from, width * 4);
+      heights[target] = height;
+      changed = true;
+    } else if (static_cast<unsigned>(heights[target]) != height) {
+      failed = true;
+    } else {
+      for (unsigned i = 0; i < localCount + height; ++i) {
+        uint32_t v = to[i] | from[i];
+        if (v != to[i]) {
+          to[i] = v;
+          changed = true;
+        }
+      }
+    }
+
+    if (changed and not queued[target]) {
+      queued[target] = true;
+      work[workCount++] = target;
+    }
+  }
+
+  void branch(unsigned target) {
+    merge(target, values, sp);
+  }
+
+  void mergeHandlers(unsigned ip) {
+    object table = codeExceptionHandlerTable
+      (t, methodCode(t, context->method));
+    if (table) {
+      memcpy(handlerValues, values, localCount * 4);
+      handlerValues[localCount] = OtherValue;
+
+      for (unsigned i = 0; i < exceptionHandlerTableLength(t, table); ++i) {
+        uint64_t eh = exceptionHandlerTableBody(t, table, i);
+        if (ip >= exceptionHandlerStart(eh) and ip < exceptionHandlerEnd(eh)) {
+          merge(exceptionHandlerIp(eh), handlerValues, 1);
+        }
+      }
+    }
+  }
+
+  int classify(unsigned ip, unsigned index);
+
+  ScalarInit* makeInit(unsigned ip, unsigned index, int site);
+
+  bool parseConstructor(ScalarInit* init, ScalarSite* site, object method,
+                        bool arguments);
+
+  void interpret(unsigned ip);
+
+  MyThread* t;
+  Context* context;
+  unsigned length;
+  unsigned localCount;
+  unsigned width;
+  uint32_t* states;
+  int* heights;
+  uint32_t* values;
+  uint32_t* handlerValues;
+  unsigned* work;
+  bool* queued;
+  int8_t* siteOf;
+  ScalarSite* sites;
+  int8_t* siteAt;
+  ScalarInit** initAt;
+  unsigned workCount;
+  unsigned siteCount;
+  unsigned sp;
+  uint32_t escaped;
+  bool recording;
+  bool failed;
+};
+
+int
+EscapeAnalyzer::classify(unsigned ip, unsigned index)
+{
+  if (siteOf[ip] != UnknownSite) {
+    return siteOf[ip];
+  }
+
+  siteOf[ip] = NoSite;
+
+  if (siteCount == MaxScalarSites) {
+    return NoSite;
+  }
+
+  object class_ = resolveClassInPool(t, context->method, index - 1, false);
+
+  if (class_ == 0
+      or (classFlags(t, class_) & (ACC_ABSTRACT | ACC_INTERFACE)))
+  {
+    return NoSite;
+  }
+
+  unsigned count = 0;
+  for (object c = class_; c; c = classSuper(t, c)) {
+    // the allocation we'd replace would initialize every uninitialized
+    // ancestor, and a finalizer or reference type anywhere in the
+    // hierarchy needs a real object
+    if (classVmFlags(t, c)
+        & (NeedInitFlag | WeakReferenceFlag | HasFinalizerFlag))
+    {
+      return NoSite;
+    }
+
+    object table = classFieldTable(t, c);
+    if (table) {
+      for (unsigned i = 0; i < arrayLength(t, table); ++i) {
+        if ((fieldFlags(t, arrayBody(t, table, i)) & ACC_STATIC) == 0) {
+          ++ count;
+        }
+      }
+    }
+  }
+
+  if (count > MaxScalarFields) {
+    return NoSite;
+  }
+
+  ScalarSite* site = sites + siteCount;
+  site->fieldCount = 0;
+  site->offsets = static_cast<unsigned*>
+    (context->zone.allocate(count * sizeof(unsigned)));
+  site->codes = static_cast<uint8_t*>(context->zone.allocate(count));
+  site->slots = static_cast<unsigned*>
+    (context->zone.allocate(count * sizeof(unsigned)));
+
+  for (object c = class_; c; c = classSuper(t, c)) {
+    object table = classFieldTable(t, c);
+    if (table) {
+      for (unsigned i = 0; i < arrayLength(t, table); ++i) {
+        object field = arrayBody(t, table, i);
+        if ((fieldFlags(t, field) & ACC_STATIC) == 0) {
+          site->offsets[site->fieldCount] = fieldOffset(t, field);
+          site->codes[site->fieldCount] = fieldCode(t, field);
+          ++ site->fieldCount;
+        }
+      }
+    }
+  }
+
+  return siteOf[ip] = siteCount++;
+}
+
+bool
+EscapeAnalyzer::parseConstructor(ScalarInit* init, ScalarSite* site,
+                                 object method, bool arguments)
+{
+  PROTECT(t, method);
+
+  // we only inline constructors of the form
+  //
+  //   aload_0; invokespecial <super constructor>
+  //   (aload_0; <parameter or constant>; putfield)*
+  //   return
+  //
+  // which cannot throw and thus never show up in a stack trace.
+
+  loadMethodCode(t, method);
+
+  object code = methodCode(t, method);
+  if ((methodFlags(t, method) & (ACC_NATIVE | ACC_SYNCHRONIZED))
+      or code == 0
+      or (codeExceptionHandlerTable(t, code)
+          and exceptionHandlerTableLength
+          (t, codeExceptionHandlerTable(t, code))))
+  {
+    return false;
+  }
+
+  int argumentAt[MaxScalarArguments * 2 + 1];
+  for (unsigned i = 0; i < MaxScalarArguments * 2 + 1; ++i) {
+    argumentAt[i] = -1;
+  }
+
+  if (arguments) {
+    unsigned index = 1;
+    init->argumentCount = 0;
+    for (MethodSpecIterator it
+           (t, reinterpret_cast<const char*>
+            (&byteArrayBody(t, methodSpec(t, method), 0)));
+         it.hasNext();)
+    {
+      if (init->argumentCount == MaxScalarArguments) {
+        return false;
+      }
+
+      unsigned fc = vm::fieldCode(t, *it.next());
+      argumentAt[index] = init->argumentCount;
+      init->argumentCodes[init->argumentCount++] = fc;
+      index += (fc == LongField or fc == DoubleField) ? 2 : 1;
+    }
+  }
+
+  unsigned ip = 0;
+  if (classSuper(t, methodClass(t, method))) {
+    if (codeLength(t, code) < 4
+        or codeBody(t, code, 0) != aload_0
+        or codeBody(t, code, 1) != invokespecial)
+    {
+      return false;
+    }
+
+    ip = 2;
+    uint16_t index = codeReadInt16(t, code, ip);
+
+    object target = resolveMethod(t, method, index - 1, false);
+    if (target == 0
+        or methodClass(t, target) != classSuper(t, methodClass(t, method))
+        or (methodVmFlags(t, target) & ConstructorFlag) == 0
+        or methodParameterFootprint(t, target) != 1
+        or not parseConstructor(init, site, target, false))
+    {
+      return false;
+    }
+  }
+
+  while (true) {
+    code = methodCode(t, method);
+    if (ip >= codeLength(t, code)) {
+      return false;
+    }
+
+    unsigned instruction = codeBody(t, code, ip++);
+    if (instruction == return_) {
+      return true;
+    } else if (instruction != aload_0 or ip >= codeLength(t, code)) {
+      return false;
+    }
+
+    bool parameter = false;
+    int argument = -1;
+    int64_t value = 0;
+
+    instruction = codeBody(t, code, ip++);
+    switch (instruction) {
+    case aconst_null:
+    case iconst_0:
+    case lconst_0:
+      break;
+
+    case iconst_m1: value = -1; break;
+    case iconst_1:
+    case lconst_1: value = 1; break;
+    case iconst_2: value = 2; break;
+    case iconst_3: value = 3; break;
+    case iconst_4: value = 4; break;
+    case iconst_5: value = 5; break;
+
+    case fconst_0: value = floatToBits(0.0); break;
+    case fconst_1: value = floatToBits(1.0); break;
+    case fconst_2: value = floatToBits(2.0); break;
+    case dconst_0: value = doubleToBits(0.0); break;
+    case dconst_1: value = doubleToBits(1.0); break;
+
+    case bipush:
+      value = static_cast<int8_t>(codeBody(t, code, ip++));
+      break;
+
+    case sipush:
+      value = codeReadInt16(t, code, ip);
+      break;
+
+    case iload:
+    case lload:
+    case fload:
+    case dload:
+    case aload: {
+      unsigned index = codeBody(t, code, ip++);
+      parameter = true;
+      if (index <= MaxScalarArguments * 2) {
+        argument = argumentAt[index];
+      }
+    } break;
+
+    case iload_1: case lload_1: case fload_1: case dload_1: case aload_1:
+      parameter = true;
+      argument = argumentAt[1];
+      break;
+
+    case iload_2: case lload_2: case fload_2: case dload_2: case aload_2:
+      parameter = true;
+      argument = argumentAt[2];
+      break;
+
+    case iload_3: case lload_3: case fload_3: case dload_3: case aload_3:
+      parameter = true;
+      argument = argumentAt[3];
+      break;
+
+    default:
+      return false;
+    }
+
+    if ((parameter and argument < 0)
+        or ip + 3 > codeLength(t, code)
+        or codeBody(t, code, ip++) != putfield
+        or init->storeCount == MaxScalarStores)
+    {
+      return false;
+    }
+
+    uint16_t index = codeReadInt16(t, code, ip);
+
+    object field = resolveField(t, method, index - 1, false);
+    if (field == 0 or (fieldFlags(t, field) & ACC_STATIC)) {
+      return false;
+    }
+
+    int i = scalarField(site, fieldOffset(t, field));
+    if (i < 0) {
+      return false;
+    }
+
+    ScalarStore* s = init->stores + (init->storeCount++);
+    s->field = i;
+    s->code = fieldCode(t, field);
+    s->argument = argument;
+
+    switch (s->code) {
+    case ByteField:
+    case BooleanField:
+      s->value = static_cast<int8_t>(value);
+      break;
+
+    case CharField:
+      s->value = static_cast<uint16_t>(value);
+      break;
+
+    case ShortField:
+      s->value = static_cast<int16_t>(value);
+      break;
+
+    default:
+      s->value = value;
+      break;
+    }
+  }
+}
+
+ScalarInit*
+EscapeAnalyzer::makeInit(unsigned ip, unsigned index, int site)
+{
+  object target = resolveMethod(t, context->method, index - 1, false);
+  if (target == 0 or (methodVmFlags(t, target) & ConstructorFlag) == 0) {
+    return 0;
+  }
+
+  PROTECT(t, target);
+
+  // the constructor must belong to exactly the class allocated at
+  // the site, which the "new" instruction has already resolved:
+  object code = methodCode(t, context->method);
+  object class_ = 0;
+  for (unsigned i = 0; i < length; ++i) {
+    if (siteOf[i] == site) {
+      class_ = singletonObject
+        (t, codePool(t, code), ((codeBody(t, code, i + 1) << 8)
+                                | codeBody(t, code, i + 2)) - 1);
+      break;
+    }
+  }
+
+  if (class_ != methodClass(t, target)) {
+    return 0;
+  }
+
+  ScalarInit* init = new (context->zone.allocate(sizeof(ScalarInit)))
+    ScalarInit;
+  init->argumentCount = 0;
+  init->storeCount = 0;
+
+  if (parseConstructor(init, sites + site, target, true)) {
+    return initAt[ip] = init;
+  } else {
+    return 0;
+  }
+}
+
+void
+EscapeAnalyzer::interpret(unsigned ip)
+{
+  object code = methodCode(t, context->method);
+  unsigned start = ip;
+  unsigned instruction = codeBody(t, code, ip++);
+
+  switch (instruction) {
+  case aconst_null:
+  case iconst_m1: case iconst_0: case iconst_1: case iconst_2:
+  case iconst_3: case iconst_4: case iconst_5:
+  case fconst_0: case fconst_1: case fconst_2:
+    produce(1);
+    break;
+
+  case lconst_0: case lconst_1: case dconst_0: case dconst_1:
+    produce(2);
+    break;
+
+  case bipush:
+    ++ ip;
+    produce(1);
+    break;
+
+  case sipush:
+    ip += 2;
+    produce(1);
+    break;
+
+  case ldc:
+    ++ ip;
+    produce(1);
+    break;
+
+  case ldc_w:
+    ip += 2;
+    produce(1);
+    break;
+
+  case ldc2_w:
+    ip += 2;
+    produce(2);
+    break;
+
+  case iload: case fload: case aload:
+    load(codeBody(t, code, ip++), 1);
+    break;
+
+  case lload: case dload:
+    load(codeBody(t, code, ip++), 2);
+    break;
+
+  case iload_0: case fload_0: case aload_0: load(0, 1); break;
+  case iload_1: case fload_1: case aload_1: load(1, 1); break;
+  case iload_2: case fload_2: case aload_2: load(2, 1); break;
+  case iload_3: case fload_3: case aload_3: load(3, 1); break;
+
+  case lload_0: case dload_0: load(0, 2); break;
+  case lload_1: case dload_1: load(1, 2); break;
+  case lload_2: case dload_2: load(2, 2); break;
+  case lload_3: case dload_3: load(3, 2); break;
+
+  case istore: case fstore: case astore:
+    store(codeBody(t, code, ip++), 1);
+    break;
+
+  case lstore: case dstore:
+    store(codeBody(t, code, ip++), 2);
+    break;
+
+  case istore_0: case fstore_0: case astore_0: store(0, 1); break;
+  case istore_1: case fstore_1: case astore_1: store(1, 1); break;
+  case istore_2: case fstore_2: case astore_2: store(2, 1); break;
+  case istore_3: case fstore_3: case astore_3: store(3, 1); break;
+
+  case lstore_0: case dstore_0: store(0, 2); break;
+  case lstore_1: case dstore_1: store(1, 2); break;
+  case lstore_2: case dstore_2: store(2, 2); break;
+  case lstore_3: case dstore_3: store(3, 2); break;
+
+  case iinc: {
+    unsigned index = codeBody(t, code, ip);
+    ip += 2;
+    if (index < localCount) {
+      values[index] = OtherValue;
+    } else {
+      failed = true;
+    }
+  } break;
+
+  case wide: {
+    unsigned instruction = codeBody(t, code, ip++);
+    uint16_t index = codeReadInt16(t, code, ip);
+    switch (instruction) {
+    case iload: case fload: case aload: load(index, 1); break;
+    case lload: case dload: load(index, 2); break;
+    case istore: case fstore: case astore: store(index, 1); break;
+    case lstore: case dstore: store(index, 2); break;
+
+    case iinc:
+      ip += 2;
+      if (index < localCount) {
+        values[index] = OtherValue;
+      } else {
+        failed = true;
+      }
+      break;
+
+    default:
+      failed = true;
+      break;
+    }
+  } break;
+
+  case iaload: case faload: case aaload: case baload: case caload:
+  case saload:
+    consume(2);
+    produce(1);
+    break;
+
+  case laload: case daload:
+    consume(2);
+    produce(2);
+    break;
+
+  case iastore: case fastore: case aastore: case bastore: case castore:
+  case sastore:
+    consume(3);
+    break;
+
+  case lastore: case dastore:
+    consume(4);
+    break;
+
+  case pop_:
+    pop();
+    break;
+
+  case pop2:
+    pop();
+    pop();
+    break;
+
+  case dup: {
+    uint32_t a = pop();
+    push(a); push(a);
+  } break;
+
+  case dup_x1: {
+    uint32_t a = pop(); uint32_t b = pop();
+    push(a); push(b); push(a);
+  } break;
+
+  case dup_x2: {
+    uint32_t a = pop(); uint32_t b = pop(); uint32_t c = pop();
+    push(a); push(c); push(b); push(a);
+  } break;
+
+  case dup2: {
+    uint32_t a = pop(); uint32_t b = pop();
+    push(b); push(a); push(b); push(a);
+  } break;
+
+  case dup2_x1: {
+    uint32_t a = pop(); uint32_t b = pop(); uint32_t c = pop();
+    push(b); push(a); push(c); push(b); push(a);
+  } break;
+
+  case dup2_x2: {
+    uint32_t a = pop(); uint32_t b = pop(); uint32_t c = pop();
+    uint32_t d = pop();
+    push(b); push(a); push(d); push(c); push(b); push(a);
+  } break;
+
+  case swap: {
+    uint32_t a = pop(); uint32_t b = pop();
+    push(a); push(b);
+  } break;
+
+  case iadd: case isub: case imul: case idiv: case irem: case iand:
+  case ior: case ixor: case ishl: case ishr: case iushr:
+  case fadd: case fsub: case fmul: case fdiv: case frem:
+  case fcmpl: case fcmpg:
+    consume(2);
+    produce(1);
+    break;
+
+  case ladd: case lsub: case lmul: case ldiv_: case lrem: case land:
+  case lor: case lxor:
+  case dadd: case dsub: case dmul: case ddiv: case vm::drem:
+    consume(4);
+    produce(2);
+    break;
+
+  case lshl: case lshr: case lushr:
+    consume(3);
+    produce(2);
+    break;
+
+  case lcmp: case dcmpl: case dcmpg:
+    consume(4);
+    produce(1);
+    break;
+
+  case ineg: case fneg: case i2f: case f2i: case i2b: case i2c: case i2s:
+  case arraylength: case instanceof: case checkcast: case newarray:
+  case anewarray:
+    if (instruction == newarray) {
+      ++ ip;
+    } else if (instruction == instanceof or instruction == checkcast
+               or instruction == anewarray)
+    {
+      ip += 2;
+    }
+    consume(1);
+    produce(1);
+    break;
+
+  case lneg: case dneg: case l2d: case d2l:
+    consume(2);
+    produce(2);
+    break;
+
+  case i2l: case i2d: case f2l: case f2d:
+    consume(1);
+    produce(2);
+    break;
+
+  case l2i: case l2f: case d2i: case d2f:
+    consume(2);
+    produce(1);
+    break;
+
+  case ifeq: case ifne: case iflt: case ifge: case ifgt: case ifle:
+  case ifnull: case ifnonnull: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    consume(1);
+    branch(start + offset);
+  } break;
+
+  case if_icmpeq: case if_icmpne: case if_icmplt: case if_icmpge:
+  case if_icmpgt: case if_icmple: case if_acmpeq: case if_acmpne: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    consume(2);
+    branch(start + offset);
+  } break;
+
+  case goto_: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    branch(start + offset);
+  } return;
+
+  case goto_w: {
+    uint32_t offset = codeReadInt32(t, code, ip);
+    branch(start + offset);
+  } return;
+
+  case tableswitch: {
+    ip = (ip + 3) & ~3;
+    uint32_t defaultOffset = codeReadInt32(t, code, ip);
+    int32_t bottom = codeReadInt32(t, code, ip);
+    int32_t top = codeReadInt32(t, code, ip);
+
+    consume(1);
+    branch(start + defaultOffset);
+    for (int32_t i = 0; i < top - bottom + 1; ++i) {
+      if (ip + 4 > length) {
+        failed = true;
+        return;
+      }
+      uint32_t offset = codeReadInt32(t, code, ip);
+      branch(start + offset);
+    }
+  } return;
+
+  case lookupswitch: {
+    ip = (ip + 3) & ~3;
+    uint32_t defaultOffset = codeReadInt32(t, code, ip);
+    int32_t pairCount = codeReadInt32(t, code, ip);
+
+    consume(1);
+    branch(start + defaultOffset);
+    for (int32_t i = 0; i < pairCount; ++i) {
+      if (ip + 8 > length) {
+        failed = true;
+        return;
+      }
+      ip += 4;
+      uint32_t offset = codeReadInt32(t, code, ip);
+      branch(start + offset);
+    }
+  } return;
+
+  case ireturn: case freturn: case areturn: case athrow:
+    consume(1);
+    return;
+
+  case lreturn: case dreturn:
+    consume(2);
+    return;
+
+  case return_:
+    return;
+
+  case getstatic: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    produce(fieldFootprintInPool(t, code, index - 1));
+  } break;
+
+  case putstatic: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    consume(fieldFootprintInPool(t, code, index - 1));
+  } break;
+
+  case getfield: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    unsigned footprint = fieldFootprintInPool(t, code, index - 1);
+    useField(start, index, pop());
+    produce(footprint);
+  } break;
+
+  case putfield: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    consume(fieldFootprintInPool(t, code, index - 1));
+    useField(start, index, pop());
+  } break;
+
+  case monitorenter:
+  case monitorexit:
+    use(start, pop());
+    break;
+
+  case invokeinterface:
+  case invokespecial:
+  case invokestatic:
+  case invokevirtual: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    if (instruction == invokeinterface) {
+      ip += 2;
+    }
+
+    const char* spec = methodSpecInPool(t, code, index - 1);
+    unsigned footprint = parameterFootprint(t, spec, true);
+    unsigned result = returnFootprint(t, spec);
+
+    if (instruction == invokespecial and sp >= footprint + 1
+        and exactScalarSite(values[localCount + sp - footprint - 1]))
+    {
+      consume(footprint);
+
+      uint32_t receiver = pop();
+      if (recording) {
+        int site = scalarSiteNumber(receiver);
+        if (result == 0 and makeInit(start, index, site)) {
+          siteAt[start] = site;
+        } else {
+          escape(receiver);
+        }
+      }
+    } else {
+      consume(instruction == invokestatic ? footprint : footprint + 1);
+    }
+
+    produce(result);
+  } break;
+
+  case new_: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    int site = classify(start, index);
+    if (site >= 0) {
+      if (recording) {
+        // if an object from a previous execution of this instruction
+        // may still be live, both would share the same locals:
+        for (unsigned i = 0; i < localCount + sp; ++i) {
+          if (values[i] == (static_cast<uint32_t>(1) << site)) {
+            escape(values[i]);
+          }
+        }
+      }
+      push(static_cast<uint32_t>(1) << site);
+    } else {
+      push(OtherValue);
+    }
+  } break;
+
+  case multianewarray: {
+    ip += 2;
+    consume(codeBody(t, code, ip++));
+    produce(1);
+  } break;
+
+  case nop:
+    break;
+
+  default:
+    // notably jsr, jsr_w, and ret, which we don't bother to handle
+    failed = true;
+    return;
+  }
+
+  branch(ip);
+}
+
+// Gives the method being compiled room for the specified number of
+// locals, the extra ones being for the compiler's own use.
+void
+growLocals(MyThread* t, Context* context, unsigned localCount)
+{
+  // the clone shares its code object with the original method, so we
+  // make a copy:
+  object code = methodCode(t, context->method);
+  unsigned length = codeLength(t, code);
+  object copy = makeCode
+    (t, codePool(t, code), codeExceptionHandlerTable(t, code),
+     codeLineNumberTable(t, code), codeCompiled(t, code),
+     codeCompiledSize(t, code), codeMaxStack(t, code), localCount, length);
+
+  code = methodCode(t, context->method);
+  memcpy(&codeBody(t, copy, 0), &codeBody(t, code, 0), length);
+
+  set(t, context->method, MethodCode, copy);
+
+  context->rootTable = makeRootTable(t, &(context->zone), context->method);
+}
+
+void
+analyzeEscapes(MyThread* t, Context* context)
+{
+  object code = methodCode(t, context->method);
+  unsigned length = codeLength(t, code);
+  unsigned localCount = codeMaxLocals(t, code);
+  unsigned stackCount = codeMaxStack(t, code);
+
+  if (length == 0
+      or length * (localCount + stackCount) > MaxEscapeStateFootprint)
+  {
+    return;
+  }
+
+  { bool sawNew = false;
+    for (unsigned ip = 0; ip < length; ++ip) {
+      if (codeBody(t, code, ip) == new_) {
+        sawNew = true;
+        break;
+      }
+    }
+
+    // this is only a heuristic, since the byte we found may be an
+    // operand rather than an instruction, but it saves us from
+    // analyzing the majority of methods, which allocate nothing:
+    if (not sawNew) {
+      return;
+    }
+  }
+
+  EscapeAnalyzer a(t, context, length, localCount, stackCount);
+
+  unsigned parameterFootprint = methodParameterFootprint(t, context->method);
+  for (unsigned i = 0; i < localCount; ++i) {
+    a.values[i] = i < parameterFootprint ? OtherValue : VoidValue;
+  }
+  a.branch(0);
+
+  while (a.workCount and not a.failed) {
+    unsigned ip = a.work[--a.workCount];
+    a.queued[ip] = false;
+
+    memcpy(a.values, a.states + (ip * a.width), a.width * 4);
+    a.sp = a.heights[ip];
+
+    a.mergeHandlers(ip);
+    a.interpret(ip);
+    a.mergeHandlers(ip);
+  }
+
+  if (a.failed or a.siteCount == 0) {
+    return;
+  }
+
+  a.recording = true;
+  for (unsigned ip = 0; ip < length and not a.failed; ++ip) {
+    if (a.heights[ip] >= 0) {
+      memcpy(a.values, a.states + (ip * a.width), a.width * 4);
+      a.sp = a.heights[ip];
+
+      a.interpret(ip);
+    }
+  }
+
+  if (a.failed) {
+    return;
+  }
+
+  uint32_t replaced = 0;
+  unsigned slot = localCount;
+  for (unsigned i = 0; i < a.siteCount; ++i) {
+    if ((a.escaped & (static_cast<uint32_t>(1) << i)) == 0) {
+      ScalarSite* site = a.sites + i;
+      if (slot + (site->fieldCount * 2) + 2 > 0xFFFF) {
+        continue;
+      }
+
+      replaced |= static_cast<uint32_t>(1) << i;
+
+      for (unsigned j = 0; j < site->fieldCount; ++j) {
+        site->slots[j] = slot;
+        slot += (site->codes[j] == LongField or site->codes[j] == DoubleField)
+          ? 2 : 1;
+      }
+    }
+  }
+
+  if (replaced == 0) {
+    return;
+  }
+
+  for (unsigned ip = 0; ip < length; ++ip) {
+    if (a.siteOf[ip] >= 0 and a.heights[ip] >= 0) {
+      a.siteAt[ip] = a.siteOf[ip];
+    }
+
+    if (a.siteAt[ip] >= 0
+        and (replaced & (static_cast<uint32_t>(1) << a.siteAt[ip])) == 0)
+    {
+      a.siteAt[ip] = NoSite;
+      a.initAt[ip] = 0;
+    }
+  }
+
+  if (DebugEscapes) {
+    unsigned count = 0;
+    for (unsigned i = 0; i < a.siteCount; ++i) {
+      if (replaced & (static_cast<uint32_t>(1) << i)) {
+        ++ count;
+      }
+    }
+
+    fprintf(stderr, "replaced %d of %d allocation sites in %s.%s%s\n",
+            count, a.siteCount,
+            &byteArrayBody(t, className(t, methodClass(t, context->method)), 0),
+            &byteArrayBody(t, methodName(t, context->method), 0),
+            &byteArrayBody(t, methodSpec(t, context->method), 0));
+  }
+
+  growLocals(t, context, slot);
+
+  EscapeAnalysis* escapes = new (context->zone.allocate(sizeof(EscapeAnalysis)))
+    EscapeAnalysis;
+  escapes->sites = a.sites;
+  escapes->siteAt = a.siteAt;
+  escapes->initAt = a.initAt;
+
+  context->escapes = escapes;
+}
+
+ScalarSite*
+scalarSite(Context* context, unsigned ip)
+{
+  if (context->escapes and context->escapes->siteAt[ip] >= 0) {
+    return context->escapes->sites + context->escapes->siteAt[ip];
+  } else {
+    return 0;
+  }
+}
+
+const uint16_t NoLocal = 0xFFFF;
+
+const uint8_t ConstantRange = 1 << 0;
+const uint8_t NonNegativeRange = 1 << 1;
+const uint8_t NonNullRange = 1 << 2;
+
+// what we know about an int value: its exact value, if constant,
+// whether it is non-negative, and which array local (if any) has a
+// length greater than it, so that it is strictly less than that
+// length.  For a reference, we only track whether it is known to be
+// non-null.  For stack slots, local names the local the value was
+// loaded from, as long as that local has not been overwritten since.
+class RangeValue {
+ public:
+  uint8_t flags;
+  uint16_t local;
+  uint16_t below;
+  uint16_t length;
+  int32_t constant;
+};
+
+enum Relation {
+  EqualRelation,
+  NotEqualRelation,
+  LessRelation,
+  GreaterOrEqualRelation,
+  GreaterRelation,
+  LessOrEqualRelation
+};
+
+RangeValue
+unknownRange()
+{
+  RangeValue v;
+  v.flags = 0;
+  v.local = NoLocal;
+  v.below = NoLocal;
+  v.length = NoLocal;
+  v.constant = 0;
+  return v;
+}
+
+RangeValue
+constantRange(int32_t constant)
+{
+  RangeValue v = unknownRange();
+  v.flags = ConstantRange | (constant >= 0 ? NonNegativeRange : 0);
+  v.constant = constant;
+  return v;
+}
+
+RangeValue
+nonNullRange()
+{
+  RangeValue v = unknownRange();
+  v.flags = NonNullRange;
+  return v;
+}
+
+bool
+equal(const RangeValue& a, const RangeValue& b)
+{
+  return a.flags == b.flags and a.local == b.local and a.below == b.below
+    and a.length == b.length
+    and ((a.flags & ConstantRange) == 0 or a.constant == b.constant);
+}
+
+RangeValue
+meet(const RangeValue& a, const RangeValue& b)
+{
+  RangeValue v = a;
+  v.flags &= b.flags;
+  if ((v.flags & ConstantRange) and a.constant != b.constant) {
+    v.flags &= ~ConstantRange;
+  }
+  if (a.local != b.local) v.local = NoLocal;
+  if (a.below != b.below) v.below = NoLocal;
+  if (a.length != b.length) v.length = NoLocal;
+  return v;
+}
+
+bool
+foldInt(unsigned instruction, int32_t a, int32_t b, int32_t* result)
+{
+  uint32_t ua = a;
+  uint32_t ub = b;
+  switch (instruction) {
+  case iadd: *result = ua + ub; return true;
+  case isub: *result = ua - ub; return true;
+  case imul: *result = ua * ub; return true;
+  case iand: *result = a & b; return true;
+  case ior: *result = a | b; return true;
+  case ixor: *result = a ^ b; return true;
+  case ishl: *result = ua << (b & 0x1F); return true;
+  case ishr: *result = a >> (b & 0x1F); return true;
+  case iushr: *result = ua >> (b & 0x1F); return true;
+  default: return false;
+  }
+}
+
+// Forward dataflow analysis which propagates int constants through
+// locals and proves array accesses in bounds, e.g. in loops of the
+// form "for (int i = 0; i < a.length; ++i) a[i] ...".
+//
+// It also finds field and array length loads from objects held in
+// locals whose results are still available from an earlier load of
+// the same expression on every path, so the compiler can keep the
+// first result in an extra local and reuse it.  Loads inside a loop
+// may be hoisted to the instruction which enters it when that can't
+// change behavior, which makes them available throughout the loop
+// unless the loop kills them.  A load is killed by a store to its
+// local, and a field load by a store to that field or by anything
+// which might run arbitrary code, such as a call.
+class RangeAnalyzer {
+ public:
+  RangeAnalyzer(MyThread* t, Context* context, unsigned length,
+                unsigned localCount, unsigned stackCount):
+    t(t),
+    context(context),
+    length(length),
+    localCount(localCount),
+    width(localCount + stackCount),
+    states(static_cast<RangeValue*>
+           (context->zone.allocate(length * width * sizeof(RangeValue)))),
+    heights(static_cast<int*>(context->zone.allocate(length * sizeof(int)))),
+    values(static_cast<RangeValue*>
+           (context->zone.allocate(width * sizeof(RangeValue)))),
+    savedValues(static_cast<RangeValue*>
+                (context->zone.allocate(width * sizeof(RangeValue)))),
+    work(static_cast<unsigned*>
+         (context->zone.allocate(length * sizeof(unsigned)))),
+    queued(static_cast<bool*>(context->zone.allocate(length))),
+    flags(static_cast<uint8_t*>(context->zone.allocate(length))),
+    constants(static_cast<int32_t*>
+              (context->zone.allocate(length * sizeof(int32_t)))),
+    availableStates(static_cast<uint32_t*>
+                    (context->zone.allocate(length * 4))),
+    loadAt(static_cast<int8_t*>(context->zone.allocate(length))),
+    lowTargets(static_cast<int32_t*>
+               (context->zone.allocate(length * sizeof(int32_t)))),
+    highTargets(static_cast<int32_t*>
+                (context->zone.allocate(length * sizeof(int32_t)))),
+    fallsThrough(static_cast<bool*>(context->zone.allocate(length))),
+    hoists(0),
+    loads(static_cast<LoadExpression*>
+          (context->zone.allocate
+           (MaxLoadExpressions * sizeof(LoadExpression)))),
+    loadCount(0),
+    fieldLoads(0),
+    available(0),
+    current(0),
+    workCount(0),
+    sp(0),
+    recordCount(0),
+    recording(false),
+    failed(false)
+  { }
+
+  // runs the analysis to a fixed point and then records what it
+  // found for each instruction
+  void solve() {
+    for (unsigned i = 0; i < length; ++i) {
+      heights[i] = -1;
+      lowTargets[i] = -1;
+      highTargets[i] = -1;
+    }
+    memset(queued, 0, length);
+    memset(flags, 0, length);
+    memset(loadAt, NoLoad, length);
+    memset(fallsThrough, 0, length);
+    workCount = 0;
+    recordCount = 0;
+    recording = false;
+
+    for (unsigned i = 0; i < localCount; ++i) {
+      values[i] = unknownRange();
+    }
+
+    if ((methodFlags(t, context->method) & ACC_STATIC) == 0) {
+      values[0] = nonNullRange();
+    }
+
+    sp = 0;
+    available = 0;
+    branch(0);
+
+    while (workCount and not failed) {
+      unsigned ip = work[--workCount];
+      queued[ip] = false;
+
+      memcpy(values, states + (ip * width), width * sizeof(RangeValue));
+      sp = heights[ip];
+      available = availableStates[ip];
+
+      mergeHandlers(ip);
+      interpret(ip);
+      mergeHandlers(ip);
+    }
+
+    if (failed) {
+      return;
+    }
+
+    recording = true;
+    for (unsigned ip = 0; ip < length and not failed; ++ip) {
+      if (heights[ip] >= 0) {
+        memcpy(values, states + (ip * width), width * sizeof(RangeValue));
+        sp = heights[ip];
+        available = availableStates[ip];
+
+        interpret(ip);
+      }
+    }
+  }
+
+  void push(const RangeValue& v) {
+    if (sp < width - localCount) {
+      values[localCount + (sp++)] = v;
+    } else {
+      failed = true;
+    }
+  }
+
+  RangeValue pop() {
+    if (sp) {
+      return values[localCount + (--sp)];
+    } else {
+      failed = true;
+      return unknownRange();
+    }
+  }
+
+  void produce(unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+      push(unknownRange());
+    }
+  }
+
+  void consume(unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+      pop();
+    }
+  }
+
+  void record(unsigned ip, uint8_t flag, int32_t constant = 0) {
+    if (recording) {
+      flags[ip] |= flag;
+      constants[ip] = constant;
+      ++ recordCount;
+    }
+  }
+
+  // Returns the resolved field at the specified constant pool index,
+  // or null if it hasn't been resolved yet, in which case resolving
+  // it at runtime may load classes.
+  object resolvedField(unsigned index) {
+    object o = singletonObject
+      (t, codePool(t, methodCode(t, context->method)), index - 1);
+    return objectClass(t, o) == type(t, Machine::FieldType) ? o : 0;
+  }
+
+  int findLoad(unsigned index, unsigned local, unsigned code) {
+    for (unsigned i = 0; i < loadCount; ++i) {
+      if (loads[i].index == index and loads[i].local == local) {
+        return i;
+      }
+    }
+
+    if (loadCount == MaxLoadExpressions) {
+      return NoLoad;
+    }
+
+    LoadExpression* e = loads + loadCount;
+    e->index = index;
+    e->local = local;
+    e->code = code;
+    e->slot = 0;
+
+    if (index) {
+      fieldLoads |= static_cast<uint32_t>(1) << loadCount;
+    }
+
+    return loadCount++;
+  }
+
+  // notes a load of the specified expression at the specified
+  // instruction, which makes it available from then on
+  void useLoad(unsigned ip, unsigned index, unsigned code,
+               const RangeValue& instance)
+  {
+    if (instance.local == NoLocal) {
+      return;
+    }
+
+    int load = findLoad(index, instance.local, code);
+    if (load == NoLoad) {
+      return;
+    }
+
+    uint32_t bit = static_cast<uint32_t>(1) << load;
+    if (recording) {
+      loadAt[ip] = load;
+      flags[ip] |= (available & bit) ? ReusedLoad : SavedLoad;
+    }
+
+    available |= bit;
+  }
+
+  void getField(unsigned ip, unsigned index, const RangeValue& instance) {
+    object field = resolvedField(index);
+    if (field == 0) {
+      killFieldLoads();
+    } else if ((fieldFlags(t, field) & ACC_VOLATILE) == 0
+               and scalarSite(context, ip) == 0)
+    {
+      useLoad(ip, index + 1, fieldCode(t, field), instance);
+    }
+
+    refine(instance, NonNullRange, NoLocal);
+  }
+
+  void putField(unsigned index, const RangeValue& instance) {
+    object field = resolvedField(index);
+    if (field == 0) {
+      killFieldLoads();
+    } else {
+      object pool = codePool(t, methodCode(t, context->method));
+      for (unsigned i = 0; i < loadCount; ++i) {
+        if (loads[i].index
+            and singletonObject(t, pool, loads[i].index - 1) == field)
+        {
+          available &= ~(static_cast<uint32_t>(1) << i);
+        }
+      }
+    }
+
+    refine(instance, NonNullRange, NoLocal);
+  }
+
+  void killFieldLoads() {
+    available &= ~fieldLoads;
+  }
+
+  void killLoads(unsigned local) {
+    for (unsigned i = 0; i < loadCount; ++i) {
+      if (loads[i].local == local) {
+        available &= ~(static_cast<uint32_t>(1) << i);
+      }
+    }
+  }
+
+  // forget everything which depends on the old contents of a local
+  void kill(RangeValue* v, unsigned index) {
+    if (v->local == index) v->local = NoLocal;
+    if (v->below == index) v->below = NoLocal;
+    if (v->length == index) v->length = NoLocal;
+  }
+
+  void kill(unsigned index) {
+    for (unsigned i = 0; i < localCount + sp; ++i) {
+      kill(values + i, index);
+    }
+  }
+
+  void load(unsigned index, unsigned footprint) {
+    if (index + footprint <= localCount) {
+      if (footprint == 1) {
+        RangeValue v = values[index];
+        v.local = index;
+        push(v);
+      } else {
+        produce(footprint);
+      }
+    } else {
+      failed = true;
+    }
+  }
+
+  void store(unsigned index, unsigned footprint) {
+    if (index + footprint <= localCount) {
+      RangeValue v = unknownRange();
+      if (footprint == 1) {
+        v = pop();
+      } else {
+        consume(2);
+      }
+
+      for (unsigned i = 0; i < footprint; ++i) {
+        kill(index + i);
+        kill(&v, index + i);
+        killLoads(index + i);
+        values[index + i] = unknownRange();
+      }
+      v.local = NoLocal;
+      values[index] = v;
+    } else {
+      failed = true;
+    }
+  }
+
+  void increment(unsigned index, int32_t amount) {
+    if (index >= localCount) {
+      failed = true;
+      return;
+    }
+
+    RangeValue old = values[index];
+    RangeValue v = unknownRange();
+    if (old.flags & ConstantRange) {
+      v = constantRange(static_cast<uint32_t>(old.constant) + amount);
+    } else if (amount == 0) {
+      v = old;
+    } else if (amount < 0) {
+      // a non-negative value can't underflow, so it stays below
+      // whatever it was below:
+      if (old.flags & NonNegativeRange) {
+        v.below = old.below;
+      }
+    } else if (amount == 1 and (old.flags & NonNegativeRange)
+               and old.below != NoLocal)
+    {
+      // an index less than some array length can't overflow
+      v.flags |= NonNegativeRange;
+    }
+
+    kill(index);
+    killLoads(index);
+    values[index] = v;
+  }
+
+  // apply what we've learned about a value to the local it was loaded
+  // from, and to any other copies of it on the stack
+  void refine(const RangeValue& v, uint8_t flag, uint16_t below) {
+    if (v.local == NoLocal) {
+      return;
+    }
+
+    for (unsigned i = 0; i < localCount + sp; ++i) {
+      if (i == v.local or (i >= localCount and values[i].local == v.local)) {
+        values[i].flags |= flag;
+        if (below != NoLocal) {
+          values[i].below = below;
+        }
+      }
+    }
+  }
+
+  void assume(Relation relation, const RangeValue& a, const RangeValue& b) {
+    switch (relation) {
+    case LessRelation:
+      refine(a, 0, b.length != NoLocal ? b.length : b.below);
+      if (a.flags & NonNegativeRange) {
+        refine(b, NonNegativeRange, NoLocal);
+      }
+      break;
+
+    case LessOrEqualRelation:
+      refine(a, 0, b.below);
+      if (a.flags & NonNegativeRange) {
+        refine(b, NonNegativeRange, NoLocal);
+      }
+      break;
+
+    case GreaterRelation:
+      assume(LessRelation, b, a);
+      break;
+
+    case GreaterOrEqualRelation:
+      assume(LessOrEqualRelation, b, a);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  void branch(unsigned target) {
+    if (recording) {
+      if (lowTargets[current] < 0
+          or target < static_cast<unsigned>(lowTargets[current]))
+      {
+        lowTargets[current] = target;
+      }
+      if (highTargets[current] < 0
+          or target > static_cast<unsigned>(highTargets[current]))
+      {
+        highTargets[current] = target;
+      }
+    }
+
+    merge(target, values, sp, available);
+  }
+
+  void branch(unsigned target, Relation relation, const RangeValue& a,
+              const RangeValue& b)
+  {
+    memcpy(savedValues, values, width * sizeof(RangeValue));
+    assume(relation, a, b);
+    branch(target);
+
+    // the fall-through path sees the opposite relation:
+    memcpy(values, savedValues, width * sizeof(RangeValue));
+    assume(static_cast<Relation>(relation ^ 1), a, b);
+  }
+
+  void merge(unsigned target, RangeValue* from, unsigned height,
+             uint32_t available)
+  {
+    if (recording) {
+      return;
+    }
+
+    if (target >= length) {
+      failed = true;
+      return;
+    }
+
+    RangeValue* to = states + (target * width);
+    bool changed = false;
+    if (heights[target] < 0) {
+      memcpy(to, from, width * sizeof(RangeValue));
+      heights[target] = height;
+      availableStates[target] = available;
+      changed = true;
+    } else if (static_cast<unsigned>(heights[target]) != height) {
+      failed = true;
+    } else {
+      for (unsigned i = 0; i < localCount + height; ++i) {
+        RangeValue v = meet(to[i], from[i]);
+        if (not equal(v, to[i])) {
+          to[i] = v;
+          changed = true;
+        }
+      }
+
+      if ((availableStates[target] & available) != availableStates[target]) {
+        availableStates[target] &= available;
+        changed = true;
+      }
+    }
+
+    if (changed and not queued[target]) {
+      queued[target] = true;
+      work[workCount++] = target;
+    }
+  }
+
+  void mergeHandlers(unsigned ip) {
+    object table = codeExceptionHandlerTable
+      (t, methodCode(t, context->method));
+    if (table) {
+      memcpy(savedValues, values, localCount * sizeof(RangeValue));
+      savedValues[localCount] = unknownRange();
+
+      for (unsigned i = 0; i < exceptionHandlerTableLength(t, table); ++i) {
+        uint64_t eh = exceptionHandlerTableBody(t, table, i);
+        if (ip >= exceptionHandlerStart(eh) and ip < exceptionHandlerEnd(eh)) {
+          merge(exceptionHandlerIp(eh), savedValues, 1, 0);
+        }
+      }
+    }
+  }
+
+  void access(unsigned ip, const RangeValue& array, const RangeValue& index) {
+    if (array.local != NoLocal and (index.flags & NonNegativeRange)
+        and index.below == array.local)
+    {
+      record(ip, InBounds);
+    }
+
+    // if the access succeeds, the index must be in bounds and the
+    // array non-null:
+    refine(index, NonNegativeRange, array.local);
+    refine(array, NonNullRange, NoLocal);
+  }
+
+  void interpret(unsigned ip);
+
+  bool hoistable(unsigned entry, unsigned target, unsigned load);
+
+  bool hoist();
+
+  bool pruneHoists();
+
+  MyThread* t;
+  Context* context;
+  unsigned length;
+  unsigned localCount;
+  unsigned width;
+  RangeValue* states;
+  int* heights;
+  RangeValue* values;
+  RangeValue* savedValues;
+  unsigned* work;
+  bool* queued;
+  uint8_t* flags;
+  int32_t* constants;
+  uint32_t* availableStates;
+  int8_t* loadAt;
+  int32_t* lowTargets;
+  int32_t* highTargets;
+  bool* fallsThrough;
+  LoadHoist** hoists;
+  LoadExpression* loads;
+  unsigned loadCount;
+  uint32_t fieldLoads;
+  uint32_t available;
+  unsigned current;
+  unsigned workCount;
+  unsigned sp;
+  unsigned recordCount;
+  bool recording;
+  bool failed;
+};
+
+void
+RangeAnalyzer::interpret(unsigned ip)
+{
+  object code = methodCode(t, context->method);
+  unsigned start = ip;
+  unsigned instruction = codeBody(t, code, ip++);
+
+  current = start;
+
+  if (hoists) {
+    for (LoadHoist* h = hoists[start]; h; h = h->next) {
+      available |= static_cast<uint32_t>(1) << h->load;
+    }
+  }
+
+  switch (instruction) {
+  case iconst_m1: case iconst_0: case iconst_1: case iconst_2:
+  case iconst_3: case iconst_4: case iconst_5:
+    push(constantRange(static_cast<int>(instruction) - iconst_0));
+    break;
+
+  case aconst_null:
+  case fconst_0: case fconst_1: case fconst_2:
+    produce(1);
+    break;
+
+  case lconst_0: case lconst_1: case dconst_0: case dconst_1:
+    produce(2);
+    break;
+
+  case bipush:
+    push(constantRange(static_cast<int8_t>(codeBody(t, code, ip++))));
+    break;
+
+  case sipush:
+    push(constantRange(static_cast<int16_t>(codeReadInt16(t, code, ip))));
+    break;
+
+  case ldc:
+    // loading a class constant may run a class loader:
+    ++ ip;
+    killFieldLoads();
+    produce(1);
+    break;
+
+  case ldc_w:
+    ip += 2;
+    killFieldLoads();
+    produce(1);
+    break;
+
+  case ldc2_w:
+    ip += 2;
+    produce(2);
+    break;
+
+  case iload: case iload_0: case iload_1: case iload_2: case iload_3: {
+    unsigned index = instruction == iload
+      ? codeBody(t, code, ip++) : instruction - iload_0;
+    load(index, 1);
+    if (sp and (values[localCount + sp - 1].flags & ConstantRange)) {
+      record(start, FoldedConstant, values[localCount + sp - 1].constant);
+    }
+  } break;
+
+  case fload: case aload:
+    load(codeBody(t, code, ip++), 1);
+    break;
+
+  case lload: case dload:
+    load(codeBody(t, code, ip++), 2);
+    break;
+
+  case fload_0: case aload_0: load(0, 1); break;
+  case fload_1: case aload_1: load(1, 1); break;
+  case fload_2: case aload_2: load(2, 1); break;
+  case fload_3: case aload_3: load(3, 1); break;
+
+  case lload_0: case dload_0: load(0, 2); break;
+  case lload_1: case dload_1: load(1, 2); break;
+  case lload_2: case dload_2: load(2, 2); break;
+  case lload_3: case dload_3: load(3, 2); break;
+
+  case istore: case fstore: case astore:
+    store(codeBody(t, code, ip++), 1);
+    break;
+
+  case lstore: case dstore:
+    store(codeBody(t, code, ip++), 2);
+    break;
+
+  case istore_0: case fstore_0: case astore_0: store(0, 1); break;
+  case istore_1: case fstore_1: case astore_1: store(1, 1); break;
+  case istore_2: case fstore_2: case astore_2: store(2, 1); break;
+  case istore_3: case fstore_3: case astore_3: store(3, 1); break;
+
+  case lstore_0: case dstore_0: store(0, 2); break;
+  case lstore_1: case dstore_1: store(1, 2); break;
+  case lstore_2: case dstore_2: store(2, 2); break;
+  case lstore_3: case dstore_3: store(3, 2); break;
+
+  case iinc: {
+    unsigned index = codeBody(t, code, ip++);
+    int8_t amount = codeBody(t, code, ip++);
+    increment(index, amount);
+  } break;
+
+  case wide: {
+    unsigned instruction = codeBody(t, code, ip++);
+    uint16_t index = codeReadInt16(t, code, ip);
+    switch (instruction) {
+    case iload: case fload: case aload: load(index, 1); break;
+    case lload: case dload: load(index, 2); break;
+    case istore: case fstore: case astore: store(index, 1); break;
+    case lstore: case dstore: store(index, 2); break;
+
+    case iinc: {
+      int16_t amount = codeReadInt16(t, code, ip);
+      increment(index, amount);
+    } break;
+
+    default:
+      failed = true;
+      break;
+    }
+  } break;
+
+  case iaload: case faload: case aaload: case baload: case caload:
+  case saload: case laload: case daload: {
+    RangeValue index = pop();
+    RangeValue array = pop();
+    access(start, array, index);
+    produce(instruction == laload or instruction == daload ? 2 : 1);
+  } break;
+
+  case iastore: case fastore: case aastore: case bastore: case castore:
+  case sastore: case lastore: case dastore: {
+    consume(instruction == lastore or instruction == dastore ? 2 : 1);
+    RangeValue index = pop();
+    RangeValue array = pop();
+    access(start, array, index);
+  } break;
+
+  case arraylength: {
+    RangeValue array = pop();
+    useLoad(start, 0, IntField, array);
+    refine(array, NonNullRange, NoLocal);
+
+    RangeValue v = unknownRange();
+    v.flags = NonNegativeRange;
+    v.length = array.local;
+    push(v);
+  } break;
+
+  case pop_:
+    pop();
+    break;
+
+  case pop2:
+    pop();
+    pop();
+    break;
+
+  case dup: {
+    RangeValue a = pop();
+    push(a); push(a);
+  } break;
+
+  case dup_x1: {
+    RangeValue a = pop(); RangeValue b = pop();
+    push(a); push(b); push(a);
+  } break;
+
+  case dup_x2: {
+    RangeValue a = pop(); RangeValue b = pop(); RangeValue c = pop();
+    push(a); push(c); push(b); push(a);
+  } break;
+
+  case dup2: {
+    RangeValue a = pop(); RangeValue b = pop();
+    push(b); push(a); push(b); push(a);
+  } break;
+
+  case dup2_x1: {
+    RangeValue a = pop(); RangeValue b = pop(); RangeValue c = pop();
+    push(b); push(a); push(c); push(b); push(a);
+  } break;
+
+  case dup2_x2: {
+    RangeValue a = pop(); RangeValue b = pop(); RangeValue c = pop();
+    RangeValue d = pop();
+    push(b); push(a); push(d); push(c); push(b); push(a);
+  } break;
+
+  case swap: {
+    RangeValue a = pop(); RangeValue b = pop();
+    push(a); push(b);
+  } break;
+
+  case iadd: case isub: case imul: case idiv: case irem: case iand:
+  case ior: case ixor: case ishl: case ishr: case iushr: {
+    RangeValue b = pop();
+    RangeValue a = pop();
+    int32_t result;
+    if ((a.flags & ConstantRange) and (b.flags & ConstantRange)
+        and foldInt(instruction, a.constant, b.constant, &result))
+    {
+      record(start, FoldedConstant, result);
+      push(constantRange(result));
+    } else {
+      bool aPositive = a.flags & NonNegativeRange;
+      bool bPositive = b.flags & NonNegativeRange;
+
+      RangeValue v = unknownRange();
+      if ((instruction == iand and (aPositive or bPositive))
+          or ((instruction == ishr or instruction == irem) and aPositive)
+          or (instruction == idiv and aPositive and bPositive)
+          or (instruction == iushr and (b.flags & ConstantRange)
+              and (b.constant & 0x1F)))
+      {
+        v.flags = NonNegativeRange;
+      }
+      push(v);
+    }
+  } break;
+
+  case ineg: {
+    RangeValue a = pop();
+    if (a.flags & ConstantRange) {
+      int32_t result = 0 - static_cast<uint32_t>(a.constant);
+      record(start, FoldedConstant, result);
+      push(constantRange(result));
+    } else {
+      produce(1);
+    }
+  } break;
+
+  case fadd: case fsub: case fmul: case fdiv: case frem:
+  case fcmpl: case fcmpg:
+    consume(2);
+    produce(1);
+    break;
+
+  case ladd: case lsub: case lmul: case ldiv_: case lrem: case land:
+  case lor: case lxor:
+  case dadd: case dsub: case dmul: case ddiv: case vm::drem:
+    consume(4);
+    produce(2);
+    break;
+
+  case lshl: case lshr: case lushr:
+    consume(3);
+    produce(2);
+    break;
+
+  case lcmp: case dcmpl: case dcmpg:
+    consume(4);
+    produce(1);
+    break;
+
+  case fneg: case i2f: case f2i: case i2b: case i2c: case i2s:
+    consume(1);
+    produce(1);
+    break;
+
+  case instanceof: case checkcast:
+    ip += 2;
+    killFieldLoads();
+    consume(1);
+    produce(1);
+    break;
+
+  case newarray:
+    ++ ip;
+    consume(1);
+    push(nonNullRange());
+    break;
+
+  case anewarray:
+    ip += 2;
+    killFieldLoads();
+    consume(1);
+    push(nonNullRange());
+    break;
+
+  case lneg: case dneg: case l2d: case d2l:
+    consume(2);
+    produce(2);
+    break;
+
+  case i2l: case i2d: case f2l: case f2d:
+    consume(1);
+    produce(2);
+    break;
+
+  case l2i: case l2f: case d2i: case d2f:
+    consume(2);
+    produce(1);
+    break;
+
+  case ifeq: case ifne: case iflt: case ifge: case ifgt: case ifle: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    RangeValue a = pop();
+    branch(start + offset, static_cast<Relation>
+           (EqualRelation + (instruction - ifeq)), a, constantRange(0));
+  } break;
+
+  case if_icmpeq: case if_icmpne: case if_icmplt: case if_icmpge:
+  case if_icmpgt: case if_icmple: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    RangeValue b = pop();
+    RangeValue a = pop();
+    branch(start + offset, static_cast<Relation>
+           (EqualRelation + (instruction - if_icmpeq)), a, b);
+  } break;
+
+  case ifnull: case ifnonnull: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    RangeValue a = pop();
+    if (instruction == ifnonnull) {
+      memcpy(savedValues, values, width * sizeof(RangeValue));
+      refine(a, NonNullRange, NoLocal);
+      branch(start + offset);
+      memcpy(values, savedValues, width * sizeof(RangeValue));
+    } else {
+      branch(start + offset);
+      refine(a, NonNullRange, NoLocal);
+    }
+  } break;
+
+  case if_acmpeq: case if_acmpne: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    consume(2);
+    branch(start + offset);
+  } break;
+
+  case goto_: {
+    uint32_t offset = codeReadInt16(t, code, ip);
+    branch(start + offset);
+  } return;
+
+  case goto_w: {
+    uint32_t offset = codeReadInt32(t, code, ip);
+    branch(start + offset);
+  } return;
+
+  case tableswitch: {
+    ip = (ip + 3) & ~3;
+    uint32_t defaultOffset = codeReadInt32(t, code, ip);
+    int32_t bottom = codeReadInt32(t, code, ip);
+    int32_t top = codeReadInt32(t, code, ip);
+
+    consume(1);
+    branch(start + defaultOffset);
+    for (int32_t i = 0; i < top - bottom + 1; ++i) {
+      if (ip + 4 > length) {
+        failed = true;
+        return;
+      }
+      uint32_t offset = codeReadInt32(t, code, ip);
+      branch(start + offset);
+    }
+  } return;
+
+  case lookupswitch: {
+    ip = (ip + 3) & ~3;
+    uint32_t defaultOffset = codeReadInt32(t, code, ip);
+    int32_t pairCount = codeReadInt32(t, code, ip);
+
+    consume(1);
+    branch(start + defaultOffset);
+    for (int32_t i = 0; i < pairCount; ++i) {
+      if (ip + 8 > length) {
+        failed = true;
+        return;
+      }
+      ip += 4;
+      uint32_t offset = codeReadInt32(t, code, ip);
+      branch(start + offset);
+    }
+  } return;
+
+  case ireturn: case freturn: case areturn: case athrow:
+  case lreturn: case dreturn: case return_:
+    return;
+
+  case getstatic: {
+    // static accesses may initialize a class
+    uint16_t index = codeReadInt16(t, code, ip);
+    killFieldLoads();
+    produce(fieldFootprintInPool(t, code, index - 1));
+  } break;
+
+  case putstatic: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    killFieldLoads();
+    consume(fieldFootprintInPool(t, code, index - 1));
+  } break;
+
+  case getfield: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    getField(start, index, pop());
+    produce(fieldFootprintInPool(t, code, index - 1));
+  } break;
+
+  case putfield: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    consume(fieldFootprintInPool(t, code, index - 1));
+    putField(index, pop());
+  } break;
+
+  case monitorenter:
+  case monitorexit:
+    killFieldLoads();
+    refine(pop(), NonNullRange, NoLocal);
+    break;
+
+  case invokeinterface:
+  case invokespecial:
+  case invokestatic:
+  case invokevirtual: {
+    uint16_t index = codeReadInt16(t, code, ip);
+    if (instruction == invokeinterface) {
+      ip += 2;
+    }
+
+    const char* spec = methodSpecInPool(t, code, index - 1);
+    unsigned footprint = parameterFootprint(t, spec, true);
+
+    killFieldLoads();
+    consume(footprint);
+    if (instruction != invokestatic) {
+      refine(pop(), NonNullRange, NoLocal);
+    }
+    produce(returnFootprint(t, spec));
+  } break;
+
+  case new_:
+    ip += 2;
+    killFieldLoads();
+    push(nonNullRange());
+    break;
+
+  case multianewarray: {
+    ip += 2;
+    killFieldLoads();
+    consume(codeBody(t, code, ip++));
+    push(nonNullRange());
+  } break;
+
+  case nop:
+    break;
+
+  default:
+    // notably jsr, jsr_w, and ret, which we don't bother to handle
+    failed = true;
+    return;
+  }
+
+  if (recording) {
+    fallsThrough[start] = true;
+  }
+
+  merge(ip, values, sp, available);
+}
+
+// Returns the size of the instruction at the specified offset if it
+// only pushes a local or a constant, or zero otherwise.
+unsigned
+pushInstructionSize(MyThread* t, object code, unsigned ip)
+{
+  unsigned instruction = codeBody(t, code, ip);
+  if ((instruction >= aconst_null and instruction <= dconst_1)
+      or (instruction >= iload_0 and instruction <= aload_3)
+      or instruction == dup or instruction == nop)
+  {
+    return 1;
+  } else if (instruction == bipush
+             or (instruction >= iload and instruction <= aload))
+  {
+    return 2;
+  } else if (instruction == sipush) {
+    return 3;
+  } else {
+    return 0;
+  }
+}
+
+// Returns true if the instruction at the specified offset may
+// overwrite the specified local.
+bool
+storesLocal(MyThread* t, object code, unsigned ip, unsigned local)
+{
+  unsigned instruction = codeBody(t, code, ip);
+  unsigned index;
+  unsigned footprint = 1;
+  switch (instruction) {
+  case istore: case fstore: case astore: case iinc:
+    index = codeBody(t, code, ip + 1);
+    break;
+
+  case lstore: case dstore:
+    index = codeBody(t, code, ip + 1);
+    footprint = 2;
+    break;
+
+  case istore_0: case istore_1: case istore_2: case istore_3:
+    index = instruction - istore_0;
+    break;
+
+  case fstore_0: case fstore_1: case fstore_2: case fstore_3:
+    index = instruction - fstore_0;
+    break;
+
+  case astore_0: case astore_1: case astore_2: case astore_3:
+    index = instruction - astore_0;
+    break;
+
+  case lstore_0: case lstore_1: case lstore_2: case lstore_3:
+    index = instruction - lstore_0;
+    footprint = 2;
+    break;
+
+  case dstore_0: case dstore_1: case dstore_2: case dstore_3:
+    index = instruction - dstore_0;
+    footprint = 2;
+    break;
+
+  case wide: {
+    unsigned wideInstruction = codeBody(t, code, ip + 1);
+    ip += 2;
+    index = codeReadInt16(t, code, ip);
+    switch (wideInstruction) {
+    case istore: case fstore: case astore: case iinc:
+      break;
+
+    case lstore: case dstore:
+      footprint = 2;
+      break;
+
+    default:
+      return false;
+    }
+  } break;
+
+  default:
+    return false;
+  }
+
+  return local >= index and local < index + footprint;
+}
+
+// Returns true if the specified instructions are covered by the same
+// exception handlers.
+bool
+sameHandlers(MyThread* t, object code, unsigned a, unsigned b)
+{
+  object table = codeExceptionHandlerTable(t, code);
+  if (table) {
+    for (unsigned i = 0; i < exceptionHandlerTableLength(t, table); ++i) {
+      uint64_t eh = exceptionHandlerTableBody(t, table, i);
+      if ((a >= exceptionHandlerStart(eh) and a < exceptionHandlerEnd(eh))
+          != (b >= exceptionHandlerStart(eh) and b < exceptionHandlerEnd(eh)))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Returns true if we can perform the specified load just before the
+// instruction at entry, which is the only way into a loop and passes
+// control to target.  The loop is assumed not to store to the load's
+// local, so it must see the same object there as entry does.
+bool
+RangeAnalyzer::hoistable(unsigned entry, unsigned target, unsigned load)
+{
+  object code = methodCode(t, context->method);
+  LoadExpression* e = loads + load;
+
+  if (storesLocal(t, code, entry, e->local)) {
+    return false;
+  }
+
+  if (states[(entry * width) + e->local].flags & NonNullRange) {
+    return true;
+  }
+
+  // Otherwise, the load may throw a NullPointerException, which is
+  // only acceptable if the loop would have thrown it before doing
+  // anything else, and from within the same exception handlers:
+  unsigned instruction = codeBody(t, code, entry);
+  if (instruction != goto_ and instruction != goto_w
+      and pushInstructionSize(t, code, entry) == 0)
+  {
+    return false;
+  }
+
+  unsigned ip = target;
+  while (ip < length and loadAt[ip] != static_cast<int>(load)) {
+    unsigned size = pushInstructionSize(t, code, ip);
+    if (size == 0) {
+      return false;
+    }
+    ip += size;
+  }
+
+  return ip < length and sameHandlers(t, code, entry, ip);
+}
+
+// Finds loads inside loops which we can perform before entering those
+// loops instead.  Returns true if there are any.
+bool
+RangeAnalyzer::hoist()
+{
+  object code = methodCode(t, context->method);
+  object table = codeExceptionHandlerTable(t, code);
+  bool found = false;
+
+  for (unsigned end = 0; end < length; ++end) {
+    // a backward branch closes a loop starting at its target, and we
+    // only consider loops which are entered by a single instruction
+    // just before it, which is how javac lays them out:
+    if (heights[end] < 0 or lowTargets[end] < 0
+        or lowTargets[end] != highTargets[end]
+        or static_cast<unsigned>(lowTargets[end]) > end)
+    {
+      continue;
+    }
+
+    unsigned start = lowTargets[end];
+
+    int entry = static_cast<int>(start) - 1;
+    while (entry >= 0 and heights[entry] < 0) {
+      -- entry;
+    }
+
+    if (entry < 0) {
+      continue;
+    }
+
+    unsigned instruction = codeBody(t, code, entry);
+    unsigned target;
+    if ((instruction == goto_ or instruction == goto_w)
+        and lowTargets[entry] >= static_cast<int>(start)
+        and lowTargets[entry] <= static_cast<int>(end))
+    {
+      target = lowTargets[entry];
+    } else if (fallsThrough[entry] and lowTargets[entry] < 0) {
+      target = start;
+    } else {
+      continue;
+    }
+
+    bool ok = true;
+    for (unsigned ip = 0; ip < length and ok; ++ip) {
+      if (heights[ip] >= 0 and (ip < start or ip > end)
+          and ip != static_cast<unsigned>(entry)
+          and lowTargets[ip] >= 0 and lowTargets[ip] <= static_cast<int>(end)
+          and highTargets[ip] >= static_cast<int>(start))
+      {
+        ok = false;
+      }
+    }
+
+    if (ok and table) {
+      unsigned after = end + 1;
+      while (after < length and heights[after] < 0) {
+        ++ after;
+      }
+
+      for (unsigned i = 0; i < exceptionHandlerTableLength(t, table); ++i) {
+        uint64_t eh = exceptionHandlerTableBody(t, table, i);
+        unsigned handler = exceptionHandlerIp(eh);
+        if (handler >= start and handler <= end
+            and (exceptionHandlerStart(eh) < start
+                 or exceptionHandlerEnd(eh) > after))
+        {
+          ok = false;
+        }
+      }
+    }
+
+    if (not ok) {
+      continue;
+    }
+
+    // loads whose local is overwritten in the loop aren't invariant:
+    uint32_t stored = 0;
+    for (unsigned ip = start; ip <= end; ++ip) {
+      if (heights[ip] >= 0) {
+        for (unsigned i = 0; i < loadCount; ++i) {
+          if (storesLocal(t, code, ip, loads[i].local)) {
+            stored |= static_cast<uint32_t>(1) << i;
+          }
+        }
+      }
+    }
+
+    for (unsigned ip = start; ip <= end; ++ip) {
+      if (loadAt[ip] == NoLoad) {
+        continue;
+      }
+
+      unsigned load = loadAt[ip];
+      if ((stored & (static_cast<uint32_t>(1) << load))
+          or not hoistable(entry, target, load))
+      {
+        continue;
+      }
+
+      if (hoists == 0) {
+        hoists = static_cast<LoadHoist**>
+          (context->zone.allocate(length * sizeof(LoadHoist*)));
+        memset(hoists, 0, length * sizeof(LoadHoist*));
+      }
+
+      bool duplicate = false;
+      for (LoadHoist* h = hoists[entry]; h; h = h->next) {
+        if (h->load == load) {
+          duplicate = true;
+          h->start = min(h->start, start);
+          h->end = max(h->end, end);
+        }
+      }
+
+      if (not duplicate) {
+        LoadHoist* h = static_cast<LoadHoist*>
+          (context->zone.allocate(sizeof(LoadHoist)));
+        h->next = hoists[entry];
+        h->load = load;
+        h->start = start;
+        h->end = end;
+        hoists[entry] = h;
+        found = true;
+      }
+    }
+  }
+
+  return found;
+}
+
+// Removes each hoisted load which the loop it was hoisted out of
+// doesn't reuse, e.g. because the loop kills it.  Returns true if
+// there were any.
+bool
+RangeAnalyzer::pruneHoists()
+{
+  bool pruned = false;
+  for (unsigned ip = 0; ip < length; ++ip) {
+    for (LoadHoist** p = hoists + ip; *p;) {
+      bool reused = false;
+      for (unsigned i = (*p)->start; i <= (*p)->end and not reused; ++i) {
+        reused = loadAt[i] == static_cast<int>((*p)->load)
+          and (flags[i] & ReusedLoad);
+      }
+
+      if (reused) {
+        p = &((*p)->next);
+      } else {
+        *p = (*p)->next;
+        pruned = true;
+      }
+    }
+  }
+  return pruned;
+}
+
+bool
+optimizationsEnabled(MyThread* t)
+{
+  static int enabled = -1;
+  if (enabled < 0) {
+    const char* value = findProperty(t, "avian.jit.optimize");
+    enabled = (value == 0 or strcmp(value, "false") != 0);
+  }
+  return enabled;
+}
+
+void
+analyzeRanges(MyThread* t, Context* context)
+{
+  object code = methodCode(t, context->method);
+  unsigned length = codeLength(t, code);
+  unsigned localCount = codeMaxLocals(t, code);
+  unsigned stackCount = codeMaxStack(t, code);
+
+  if (length == 0
+      or length * (localCount + stackCount) > MaxRangeStateFootprint
+      or not optimizationsEnabled(t))
+  {
+    return;
+  }
+
+  { bool sawArray = false;
+    unsigned loadCount = 0;
+    for (unsigned ip = 0; ip < length; ++ip) {
+      switch (codeBody(t, code, ip)) {
+      case iaload: case faload: case aaload: case baload: case caload:
+      case saload: case laload: case daload:
+      case iastore: case fastore: case aastore: case bastore: case castore:
+      case sastore: case lastore: case dastore:
+        sawArray = true;
+        break;
+
+      case getfield: case arraylength:
+        ++ loadCount;
+        break;
+      }
+    }
+
+    // as with escape analysis, this is only a heuristic, but it limits
+    // the analysis to the methods which stand to gain the most from it:
+    if (not (sawArray or loadCount > 1)) {
+      return;
+    }
+  }
+
+  RangeAnalyzer a(t, context, length, localCount, stackCount);
+
+  a.solve();
+
+  if (a.failed) {
+    return;
+  }
+
+  // Reusing loads means adding locals, which, like scalar
+  // replacement, we only do when compiling at runtime.  We don't
+  // hoist loads when scalar replacement is in effect, since a local
+  // we'd load from may hold a replaced object:
+  bool reuseLoads = context->bootContext == 0
+    and localCount + (a.loadCount * 2) <= 0xFFFF;
+
+  if (reuseLoads and context->escapes == 0 and a.hoist()) {
+    a.solve();
+
+    if ((not a.failed) and a.pruneHoists()) {
+      a.solve();
+    }
+
+    if (a.failed) {
+      return;
+    }
+  }
+
+  uint32_t reused = 0;
+  if (reuseLoads) {
+    for (unsigned ip = 0; ip < length; ++ip) {
+      if (a.flags[ip] & ReusedLoad) {
+        reused |= static_cast<uint32_t>(1) << a.loadAt[ip];
+      }
+    }
+  }
+
+  // loads which are never reused needn't be saved, and nothing
+  // depends on hoisting them:
+  for (unsigned ip = 0; ip < length; ++ip) {
+    if (a.loadAt[ip] != NoLoad
+        and (reused & (static_cast<uint32_t>(1) << a.loadAt[ip])) == 0)
+    {
+      a.flags[ip] &= ~(ReusedLoad | SavedLoad);
+      a.loadAt[ip] = NoLoad;
+    }
+
+    if (a.hoists) {
+      for (LoadHoist** p = a.hoists + ip; *p;) {
+        if (reused & (static_cast<uint32_t>(1) << (*p)->load)) {
+          p = &((*p)->next);
+        } else {
+          *p = (*p)->next;
+        }
+      }
+    }
+  }
+
+  if (a.recordCount == 0 and reused == 0) {
+    return;
+  }
+
+  if (reused) {
+    unsigned slot = localCount;
+    for (unsigned i = 0; i < a.loadCount; ++i) {
+      if (reused & (static_cast<uint32_t>(1) << i)) {
+        LoadExpression* e = a.loads + i;
+        e->slot = slot;
+        slot += (e->code == LongField or e->code == DoubleField) ? 2 : 1;
+      }
+    }
+
+    growLocals(t, context, slot);
+  }
+
+  if (DebugRanges) {
+    unsigned folded = 0;
+    unsigned checks = 0;
+    unsigned loads = 0;
+    unsigned hoisted = 0;
+    for (unsigned ip = 0; ip < length; ++ip) {
+      if (a.flags[ip] & FoldedConstant) ++ folded;
+      if (a.flags[ip] & InBounds) ++ checks;
+      if (a.flags[ip] & ReusedLoad) ++ loads;
+      if (a.hoists) {
+        for (LoadHoist* h = a.hoists[ip]; h; h = h->next) ++ hoisted;
+      }
+    }
+
+    fprintf(stderr, "folded %d constants and %d bounds checks, reused %d "
+            "loads and hoisted %d in %s.%s%s\n",
+            folded, checks, loads, hoisted,
+            &byteArrayBody(t, className(t, methodClass(t, context->method)), 0),
+            &byteArrayBody(t, methodName(t, context->method), 0),
+            &byteArrayBody(t, methodSpec(t, context->method), 0));
+  }
+
+  RangeAnalysis* ranges = new (context->zone.allocate(sizeof(RangeAnalysis)))
+    RangeAnalysis;
+  ranges->flags = a.flags;
+  ranges->constants = a.constants;
+  ranges->loadAt = a.loadAt;
+  ranges->loads = a.loads;
+  ranges->hoists = a.hoists;
+
+  context->ranges = ranges;
+}
+
+bool
+inBounds(Context* context, unsigned ip)
+{
+  return context->ranges and (context->ranges->flags[ip] & InBounds);
+}
+
+bool
+foldedConstant(Context* context, unsigned ip, int32_t* constant)
+{
+  if (context->ranges and (context->ranges->flags[ip] & FoldedConstant)) {
+    *constant = context->ranges->constants[ip];
+    return true;
+  } else {
+    return false;
+  }
+}
+
+// Returns the load whose result the instruction at the specified
+// offset should take from a local rather than memory, if any.
+LoadExpression*
+reusedLoad(Context* context, unsigned ip)
+{
+  if (context->ranges and (context->ranges->flags[ip] & ReusedLoad)) {
+    return context->ranges->loads + context->ranges->loadAt[ip];
+  } else {
+    return 0;
+  }
+}
+
+// Returns the load whose result the instruction at the specified
+// offset should also save to a local for later reuse, if any.
+LoadExpression*
+savedLoad(Context* context, unsigned ip)
+{
+  if (context->ranges and (context->ranges->flags[ip] & SavedLoad)) {
+    return context->ranges->loads + context->ranges->loadAt[ip];
+  } else {
+    return 0;
+  }
+}
+
+LoadHoist*
+hoistedLoads(Context* context, unsigned ip)
+{
+  if (context->ranges and context->ranges->hoists) {
+    return context->ranges->hoists[ip];
+  } else {
+    return 0;
+  }
+}
+
+Compiler::Operand*
+narrowScalar(Frame* frame, unsigned code, Compiler::Operand* value)
+{
+  avian::codegen::Compiler* c = frame->c;
+
+  switch (code) {
+  case ByteField:
+  case BooleanField:
+    return c->load(TargetBytesPerWord, 1, value, TargetBytesPerWord);
+
+  case CharField:
+    return c->loadz(TargetBytesPerWord, 2, value, TargetBytesPerWord);
+
+  case ShortField:
+    return c->load(TargetBytesPerWord, 2, value, TargetBytesPerWord);
+
+  default:
+    return value;
+  }
+}
+
+void
+storeScalar(Frame* frame, unsigned code, Compiler::Operand* value,
+            unsigned slot)
+{
+  switch (code) {
+  case DoubleField:
+  case LongField:
+    storeLocal(frame->context, 2, value, slot);
+    frame->storedLong(slot);
+    break;
+
+  case ObjectField:
+    storeLocal(frame->context, 1, value, slot);
+    frame->storedObject(slot);
+    break;
+
+  default:
+    storeLocal(frame->context, 1, value, slot);
+    frame->storedInt(slot);
+    break;
+  }
+}
+
+void
+pushScalar(Frame* frame, unsigned code, Compiler::Operand* value)
+{
+  switch (code) {
+  case DoubleField:
+  case LongField:
+    frame->pushLong(value);
+    break;
+
+  case ObjectField:
+    frame->pushObject(value);
+    break;
+
+  default:
+    frame->pushInt(value);
+    break;
+  }
+}
+
+void
+loadScalar(Frame* frame, unsigned code, unsigned slot)
+{
+  switch (code) {
+  case DoubleField:
+  case LongField:
+    frame->loadLong(slot);
+    break;
+
+  case ObjectField:
+    frame->loadObject(slot);
+    break;
+
+  default:
+    frame->loadInt(slot);
+    break;
+  }
+}
+
+Compiler::Operand*
+loadField(Context* context, object field, Compiler::Operand* table)
+{
+  MyThread* t = context->thread;
+  avian::codegen::Compiler* c = context->compiler;
+
+  switch (fieldCode(t, field)) {
+  case ByteField:
+  case BooleanField:
+    return c->load
+      (1, 1, c->memory
+       (table, Compiler::IntegerType, targetFieldOffset(context, field), 0, 1),
+       TargetBytesPerWord);
+
+  case CharField:
+    return c->loadz
+      (2, 2, c->memory
+       (table, Compiler::IntegerType, targetFieldOffset(context, field), 0, 1),
+       TargetBytesPerWord);
+
+  case ShortField:
+    return c->load
+      (2, 2, c->memory
+       (table, Compiler::IntegerType, targetFieldOffset(context, field), 0, 1),
+       TargetBytesPerWord);
+
+  case FloatField:
+    return c->load
+      (4, 4, c->memory
+       (table, Compiler::FloatType, targetFieldOffset(context, field), 0, 1),
+       TargetBytesPerWord);
+
+  case IntField:
+    return c->load
+      (4, 4, c->memory
+       (table, Compiler::IntegerType, targetFieldOffset(context, field), 0, 1),
+       TargetBytesPerWord);
+
+  case DoubleField:
+    return c->load
+      (8, 8, c->memory
+       (table, Compiler::FloatType, targetFieldOffset(context, field), 0, 1),
+       8);
+
+  case LongField:
+    return c->load
+      (8, 8, c->memory
+       (table, Compiler::IntegerType, targetFieldOffset(context, field), 0, 1),
+       8);
+
+  case ObjectField:
+    return c->load
+      (TargetBytesPerWord, TargetBytesPerWord, c->memory
+       (table, Compiler::ObjectType, targetFieldOffset(context, field), 0, 1),
+       TargetBytesPerWord);
+
+  default:
+    abort(t);
+  }
+}
+
+Compiler::Operand*
+loadArrayLength(Context* context, Compiler::Operand* array)
+{
+  avian::codegen::Compiler* c = context->compiler;
+
+  return c->load
+    (TargetBytesPerWord, TargetBytesPerWord, c->memory
+     (array, Compiler::IntegerType, TargetArrayLength, 0, 1),
+     TargetBytesPerWord);
+}
+
+// saves the result of a load, which is on top of the stack, for reuse
+void
+saveLoad(Frame* frame, LoadExpression* e)
+{
+  unsigned footprint = (e->code == LongField or e->code == DoubleField)
+    ? 2 : 1;
+
+  storeScalar(frame, e->code, frame->c->peek(footprint, 0), e->slot);
+}
+
+// performs a load ahead of the loop entered by the instruction at the
+// specified offset
+void
+hoistLoad(MyThread* t, Frame* frame, object code, unsigned ip,
+          LoadExpression* e)
+{
+  Context* context = frame->context;
+  avian::codegen::Compiler* c = frame->c;
+
+  Compiler::Operand* instance = loadLocal(context, 1, e->local);
+
+  if (inTryBlock(t, code, ip)) {
+    c->saveLocals();
+    frame->trace(0, 0);
+  }
+
+  Compiler::Operand* value;
+  if (e->index) {
+    value = loadField
+      (context, resolveField(t, context->method, e->index - 1), instance);
+  } else {
+    value = loadArrayLength(context, instance);
+  }
+
+  storeScalar(frame, e->code, value, e->slot);
+}
+
+void
+compile(MyThread* t, Frame* initialFrame, unsigned initialIp,
+        int exceptionHandlerStart = -1)
+{
+  enum {
+    Return,
+    Unbranch,
+    Unsubroutine,
+    Untable0,
+    Untable1,
+    Unswitch
+  };
+
+  Frame* frame = initialFrame;
+  avian::codegen::Compiler* c = frame->c;
+  Context* context = frame->context;
+  unsigned stackSize = codeMaxStack(t, methodCode(t, context->method));
+  Stack stack(t);
+  unsigned ip = initialIp;
+  unsigned newIp;
+  stack.pushValue(Return);
+
+ start:
+  uint8_t* stackMap = static_cast<uint8_t*>(stack.push(stackSize));
+  frame = new (stack.push(sizeof(Frame))) Frame(frame, stackMap);
+
+ loop:
+  object code = methodCode(t, context->method);
+  PROTECT(t, code);
+  
+  while (ip < codeLength(t, code)) {
+    if (context->visitTable[ip] ++) {
+      // we've already visited this part of the code
+      frame->visitLogicalIp(ip);
+      goto next;
+    }
+
+    frame->startLogicalIp(ip);
+
+    if (exceptionHandlerStart >= 0) {
+      c->initLocalsFromLogicalIp(exceptionHandlerStart);
+
+      exceptionHandlerStart = -1;
+
+      frame->pushObject();
+      
+      c->call
+        (c->constant(getThunk(t, gcIfNecessaryThunk), Compiler::AddressType),
+         0,
+         frame->trace(0, 0),
+         0,
+         Compiler::VoidType,
+         1, c->register_(t->arch->thread()));
+    }
+    
+//     fprintf(stderr, "ip: %d map: %ld\n", ip, *(frame->map));
+
+    for (LoadHoist* h = hoistedLoads(context, ip); h; h = h->next) {
+      hoistLoad(t, frame, code, ip, context->ranges->loads + h->load);
+    }
+
+    unsigned instruction = codeBody(t, code, ip++);
+
+    int32_t constant;
+    if (foldedConstant(context, ip - 1, &constant)) {
+      switch (instruction) {
+      case iload:
+        ++ ip;
+        break;
+
+      case iload_0: case iload_1: case iload_2: case iload_3:
+        break;
+
+      case ineg:
+        frame->popInt();
+        break;
+
+      default:
+        frame->popInt();
+        frame->popInt();
+        break;
+      }
+
+      frame->pushInt(c->constant(constant, Compiler::IntegerType));
+      continue;
+    }
+
+    switch (instruction) {
+    case aaload:
+    case baload:
+    case caload:
+    case daload:
+    case faload:
+    case iaload:
+    case laload:
+    case saload: {
+      Compiler::Operand* index = frame->popInt();
+      Compiler::Operand* array = frame->popObject();
+
+      bool inTry = inTryBlock(t, code, ip - 1);
+      if (inTry) {
+        c->saveLocals();
+        frame->trace(0, 0);
+      }
+
+      if (CheckArrayBounds and not inBounds(context, ip - 1)) {
+        // the exception handler table can't cover code placed after
+        // the method body, so only move the failure path there when
+        // no handler applies:
+        c->checkBounds
+          (array, TargetArrayLength, index, aioobThunk(t), not inTry);
+      }
+
+      switch (instruction) {
+      case aaload:
+        frame->pushObject
+          (c->load
+           (TargetBytesPerWord, TargetBytesPerWord, c->memory
+            (array, Compiler::ObjectType, TargetArrayBody, index,
+             TargetBytesPerWord),
+            TargetBytesPerWord));
+        break;
+
+      case faload:
+        frame->pushInt
+          (c->load
+           (4, 4, c->memory
+            (array, Compiler::FloatType, TargetArrayBody, index, 4),
+            TargetBytesPerWord));
+        break;
+
+      case iaload:
+        frame->pushInt
+          (c->load
+           (4, 4, c->memory
+            (array, Compiler::IntegerType, TargetArrayBody, index, 4),
+            TargetBytesPerWord));
+        break;
+
+      case baload:
+        frame->pushInt
+          (c->load
+           (1, 1, c->memory
+            (array, Compiler::IntegerType, TargetArrayBody, index, 1),
+            TargetBytesPerWord));
+        break;
+
+      case caload:
+        frame->pushInt
+          (c->loadz
+           (2, 2, c->memory
+            (array, Compiler::IntegerType, TargetArrayBody, index, 2),
+            TargetBytesPerWord));
+        break;
+
+      case daload:
+        frame->pushLong
+          (c->load
+           (8, 8, c->memory
+            (array, Compiler::FloatType, TargetArrayBody, index, 8), 8));
+        break;
+
+      case laload:
+        frame->pushLong
+          (c->load
+           (8, 8, c->memory
+            (array, Compiler::IntegerType, TargetArrayBody, index, 8), 8));
+        break;
+
+      case saload:
+        frame->pushInt
+          (c->load
+           (2, 2, c->memory
+            (array, Compiler::IntegerType, TargetArrayBody, index, 2),
+            TargetBytesPerWord));
+        break;
+      }
+    } break;
+
+    case aastore:
+    case bastore:
+    case castore:
+    case dastore:
+    case fastore:
+    case iastore:
+    case lastore:
+    case sastore: {
+      Compiler::Operand* value;
+      if (instruction == dastore or instruction == lastore) {
+        value = frame->popLong();
+      } else if (instruction == aastore) {
+        value = frame->popObject();
+      } else {
+        value = frame->popInt();
+      }
+
+      Compiler::Operand* index = frame->popInt();
+      Compiler::Operand* array = frame->popObject();
+
+      bool inTry = inTryBlock(t, code, ip - 1);
+      if (inTry) {
+        c->saveLocals();
+        frame->trace(0, 0);
+      }
+
+      if (CheckArrayBounds and not inBounds(context, ip - 1)) {
+        // the exception handler table can't cover code placed after
+        // the method body, so only move the failure path there when
+        // no handler applies:
+        c->checkBounds
+          (array, TargetArrayLength, index, aioobThunk(t), not inTry);
+      }
+
+      switch (instruction) {
+      case aastore: {
+        c->call
+          (c->constant(getThunk(t, setMaybeNullThunk), Compiler::AddressType),
+           0,
+           frame->trace(0, 0),
+           0,
+           Compiler::VoidType,
+           4, c->register_(t->arch->thread()), array,
+           c->add
+           (4, c->constant(TargetArrayBody, Compiler::IntegerType),
+            c->shl
+            (4, c->constant(log(TargetBytesPerWord), Compiler::IntegerType),
+             index)),
+           value);
+      } break;
+
+      case fastore:
+        c->store
+          (TargetBytesPerWord, value, 4, c->memory
+           (array, Compiler::FloatType, TargetArrayBody, index, 4));
+        break;
+
+      case iastore:
+        c->store
+          (TargetBytesPerWord, value, 4, c->memory
+           (array, Compiler::IntegerType, TargetArrayBody, index, 4));
+        break;
+
+      case bastore:
+        c->store
+          (TargetBytesPerWord, value, 1, c->memory
+           (array, Compiler::IntegerType, TargetArrayBody, index, 1));
+        break;
+
+      case castore:
+      case sastore:
+        c->store
+          (TargetBytesPerWord, value, 2, c->memory
+           (array, Compiler::IntegerType, TargetArrayBody, index, 2));
+        break;
+
+      case dastore:
+        c->store
+          (8, value, 8, c->memory
+           (array, Compiler::FloatType, TargetArrayBody, index, 8));
+        break;
+
+      case lastore:
+        c->store
+          (8, value, 8, c->memory
+           (array, Compiler::IntegerType, TargetArrayBody, index, 8));
+        break;
+      }
+    } break;
+
+    case aconst_null:
+      frame->pushObject(c->constant(0, Compiler::ObjectType));
+      break;
+
+    case aload:
+      frame->loadObject(codeBody(t, code, ip++));
+      break;
+
+    case aload_0:
+      frame->loadObject(0);
+      break;
+
+    case aload_1:
+      frame->loadObject(1);
+      break;
+
+    case aload_2:
+      frame->loadObject(2);
+      break;
+
+    case aload_3:
+      frame->loadObject(3);
+      break;
+
+    case anewarray: {
+      uint16_t index = codeReadInt16(t, code, ip);
+      
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object class_ = resolveClassInPool(t, context->method, index - 1, false);
+
+      Compiler::Operand* length = frame->popInt();
+
+      object argument;
+      Thunk thunk;
+      if (LIKELY(class_)) {
+        argument = class_;
+        thunk = makeBlankObjectArrayThunk;
+      } else {
+        argument = makePair(t, context->method, reference);
+        thunk = makeBlankObjectArrayFromReferenceThunk;
+      }
+
+      frame->pushObject
+        (c->call
+         (c->constant(getThunk(t, thunk), Compiler::AddressType),
+          0,
+          frame->trace(0, 0),
+          TargetBytesPerWord,
+          Compiler::ObjectType,
+          3, c->register_(t->arch->thread()), frame->append(argument),
+          length));
+    } break;
+
+    case areturn: {
+      handleExit(t, frame);
+      c->return_(TargetBytesPerWord, frame->popObject());
+    } goto next;
+
+    case arraylength: {
+      LoadExpression* reused = reusedLoad(context, ip - 1);
+      if (reused) {
+        frame->popObject();
+        loadScalar(frame, reused->code, reused->slot);
+        break;
+      }
+
+      frame->pushInt(loadArrayLength(context, frame->popObject()));
+
+      LoadExpression* saved = savedLoad(context, ip - 1);
+      if (saved) {
+        saveLoad(frame, saved);
+      }
+    } break;
+
+    case astore:
+      frame->storeObjectOrAddress(codeBody(t, code, ip++));
+      break;
+
+    case astore_0:
+      frame->storeObjectOrAddress(0);
+      break;
+
+    case astore_1:
+      frame->storeObjectOrAddress(1);
+      break;
+
+    case astore_2:
+      frame->storeObjectOrAddress(2);
+      break;
+
+    case astore_3:
+      frame->storeObjectOrAddress(3);
+      break;
+
+    case athrow: {
+      Compiler::Operand* target = frame->popObject();
+      c->call
+        (c->constant(getThunk(t, throw_Thunk), Compiler::AddressType),
+         Compiler::NoReturn,
+         frame->trace(0, 0),
+         0,
+         Compiler::VoidType,
+         2, c->register_(t->arch->thread()), target);
+
+      if (ip == codeLength(t, code)) {
+        c->trap();
+      }
+    } goto next;
+
+    case bipush:
+      frame->pushInt
+        (c->constant
+         (static_cast<int8_t>(codeBody(t, code, ip++)),
+          Compiler::IntegerType));
+      break;
+
+    case checkcast: {
+      uint16_t index = codeReadInt16(t, code, ip);
+
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object class_ = resolveClassInPool(t, context->method, index - 1, false);
+
+      object argument;
+      Thunk thunk;
+      if (LIKELY(class_)) {
+        argument = class_;
+        thunk = checkCastThunk;
+      } else {
+        argument = makePair(t, context->method, reference);
+        thunk = checkCastFromReferenceThunk;
+      }
+
+      Compiler::Operand* instance = c->peek(1, 0);
+
+      c->call
+        (c->constant(getThunk(t, thunk), Compiler::AddressType),
+         0,
+         frame->trace(0, 0),
+         0,
+         Compiler::VoidType,
+         3, c->register_(t->arch->thread()), frame->append(argument),
+         instance);
+    } break;
+
+    case d2f: {
+        frame->pushInt(c->f2f(8, 4, frame->popLong()));
+    } break;
+
+    case d2i: {
+      frame->pushInt(c->f2i(8, 4, frame->popLong()));
+    } break;
+
+    case d2l: {
+      frame->pushLong(c->f2i(8, 8, frame->popLong()));
+    } break;
+
+    case dadd: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      frame->pushLong(c->fadd(8, a, b));
+    } break;
+
+    case dcmpg: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      if (floatBranch(t, frame, code, ip, 8, false, a, b, &newIp)) {
+        goto branch;
+      } else {
+        frame->pushInt
+          (c->call
+           (c->constant
+            (getThunk(t, compareDoublesGThunk), Compiler::AddressType),
+            0, 0, 4, Compiler::IntegerType, 4,
+            static_cast<Compiler::Operand*>(0), a,
+            static_cast<Compiler::Operand*>(0), b));
+      }
+    } break;
+
+    case dcmpl: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      if (floatBranch(t, frame, code, ip, 8, true, a, b, &newIp)) {
+        goto branch;
+      } else {
+        frame->pushInt
+          (c->call
+           (c->constant
+            (getThunk(t, compareDoublesLThunk), Compiler::AddressType),
+            0, 0, 4, Compiler::IntegerType, 4,
+            static_cast<Compiler::Operand*>(0), a,
+            static_cast<Compiler::Operand*>(0), b));
+      }
+    } break;
+
+    case dconst_0:
+      frame->pushLong(c->constant(doubleToBits(0.0), Compiler::FloatType));
+      break;
+      
+    case dconst_1:
+      frame->pushLong(c->constant(doubleToBits(1.0), Compiler::FloatType));
+      break;
+
+    case ddiv: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      frame->pushLong(c->fdiv(8, a, b));
+    } break;
+
+    case dmul: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      frame->pushLong(c->fmul(8, a, b));
+    } break;
+
+    case dneg: {
+      frame->pushLong(c->fneg(8, frame->popLong()));
+    } break;
+
+    case vm::drem: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      frame->pushLong(c->frem(8, a, b));
+    } break;
+
+    case dsub: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      frame->pushLong(c->fsub(8, a, b));
+    } break;
+
+    case dup:
+      frame->dup();
+      break;
+
+    case dup_x1:
+      frame->dupX1();
+      break;
+
+    case dup_x2:
+      frame->dupX2();
+      break;
+
+    case dup2:
+      frame->dup2();
+      break;
+
+    case dup2_x1:
+      frame->dup2X1();
+      break;
+
+    case dup2_x2:
+      frame->dup2X2();
+      break;
+
+    case f2d: {
+      frame->pushLong(c->f2f(4, 8, frame->popInt()));
+    } break;
+
+    case f2i: {
+      frame->pushInt(c->f2i(4, 4, frame->popInt()));
+    } break;
+
+    case f2l: {
+      frame->pushLong(c->f2i(4, 8, frame->popInt()));
+    } break;
+
+    case fadd: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      frame->pushInt(c->fadd(4, a, b));
+    } break;
+
+    case fcmpg: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      if (floatBranch(t, frame, code, ip, 4, false, a, b, &newIp)) {
+        goto branch;
+      } else {
+        frame->pushInt
+          (c->call
+           (c->constant
+            (getThunk(t, compareFloatsGThunk), Compiler::AddressType),
+            0, 0, 4, Compiler::IntegerType, 2, a, b));
+      }
+    } break;
+
+    case fcmpl: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      if (floatBranch(t, frame, code, ip, 4, true, a, b, &newIp)) {
+        goto branch;
+      } else {
+        frame->pushInt
+          (c->call
+           (c->constant
+            (getThunk(t, compareFloatsLThunk), Compiler::AddressType),
+            0, 0, 4, Compiler::IntegerType, 2, a, b));
+      }
+    } break;
+
+    case fconst_0:
+      frame->pushInt(c->constant(floatToBits(0.0), Compiler::FloatType));
+      break;
+      
+    case fconst_1:
+      frame->pushInt(c->constant(floatToBits(1.0), Compiler::FloatType));
+      break;
+      
+    case fconst_2:
+      frame->pushInt(c->constant(floatToBits(2.0), Compiler::FloatType));
+      break;
+
+    case fdiv: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      frame->pushInt(c->fdiv(4, a, b));
+    } break;
+
+    case fmul: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      frame->pushInt(c->fmul(4, a, b));
+    } break;
+
+    case fneg: {
+      frame->pushInt(c->fneg(4, frame->popInt()));
+    } break;
+
+    case vm::frem: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      frame->pushInt(c->frem(4, a, b));   	
+    } break;
+
+    case fsub: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      frame->pushInt(c->fsub(4, a, b));
+    } break;
+
+    case getfield:
+    case getstatic: {
+      uint16_t index = codeReadInt16(t, code, ip);
+
+      ScalarSite* scalar = scalarSite(context, ip - 3);
+      if (scalar) {
+        object field = resolveField(t, context->method, index - 1);
+
+        frame->popObject();
+        loadScalar(frame, fieldCode(t, field), scalarSlot(t, scalar, field));
+        break;
+      }
+
+      LoadExpression* reused = reusedLoad(context, ip - 3);
+      if (reused) {
+        frame->popObject();
+        loadScalar(frame, reused->code, reused->slot);
+        break;
+      }
+
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object field = resolveField(t, context->method, index - 1, false);
+
+      if (LIKELY(field)) {
+        if ((fieldFlags(t, field) & ACC_VOLATILE)
+            and TargetBytesPerWord == 4
+            and (fieldCode(t, field) == DoubleField
+                 or fieldCode(t, field) == LongField))
+        {
+          PROTECT(t, field);
+
+          c->call
+            (c->constant
+             (getThunk(t, acquireMonitorForObjectThunk),
+              Compiler::AddressType),
+             0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
+             c->register_(t->arch->thread()),
+             frame->append(field));
+        }
+
+        Compiler::Operand* table;
+
+        if (instruction == getstatic) {
+          checkField(t, field, true);
+
+          PROTECT(t, field);
+
+          if (classNeedsInit(t, fieldClass(t, field))) {
+            c->call
+              (c->constant
+               (getThunk(t, tryInitClassThunk), Compiler::AddressType),
+               0,
+               frame->trace(0, 0),
+               0,
+               Compiler::VoidType,
+               2, c->register_(t->arch->thread()),
+               frame->append(fieldClass(t, field)));
+          }
+
+          table = frame->append(classStaticTable(t, fieldClass(t, field)));
+        } else {
+          checkField(t, field, false);
+
+          table = frame->popObject();
+
+          if (inTryBlock(t, code, ip - 3)) {
+            c->saveLocals();
+            frame->trace(0, 0);
+          }
+        }
+
+        pushScalar(frame, fieldCode(t, field), loadField(context, field, table));
+
+        LoadExpression* saved = savedLoad(context, ip - 3);
+        if (saved) {
+          saveLoad(frame, saved);
+        }
+
+        if (fieldFlags(t, field) & ACC_VOLATILE) {
+          if (TargetBytesPerWord == 4
+              and (fieldCode(t, field) == DoubleField
+                   or fieldCode(t, field) == LongField))
+          {
+            c->call
+              (c->constant
+               (getThunk(t, releaseMonitorForObjectThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
+               c->register_(t->arch->thread()),
+               frame->append(field));
+          } else {
+            c->loadBarrier();
+          }
+        }
+      } else {
+        int fieldCode = vm::fieldCode
+          (t, byteArrayBody(t, referenceSpec(t, reference), 0));
+
+        object pair = makePair(t, context->method, reference);
+
+        unsigned rSize = resultSize(t, fieldCode);
+        Compiler::OperandType rType = operandTypeForFieldCode(t, fieldCode);
+
+        Compiler::Operand* result;
+        if (instruction == getstatic) {
+          result = c->call
+            (c->constant
+             (getThunk(t, getStaticFieldValueFromReferenceThunk),
+              Compiler::AddressType),
+             0, frame->trace(0, 0), rSize, rType, 2,
+             c->register_(t->arch->thread()), frame->append(pair));
+        } else {
+          Compiler::Operand* instance = frame->popObject();
+
+          result = c->call
+            (c->constant
+             (getThunk(t, getFieldValueFromReferenceThunk),
+              Compiler::AddressType),
+             0, frame->trace(0, 0), rSize, rType, 3,
+             c->register_(t->arch->thread()), frame->append(pair),
+             instance);
+        }
+
+        pushReturnValue(t, frame, fieldCode, result);
+      }
+    } break;
+
+    case goto_: {
+      uint32_t offset = codeReadInt16(t, code, ip);
+      uint32_t newIp = (ip - 3) + offset;
+      assert(t, newIp < codeLength(t, code));
+
+      c->jmp(frame->machineIp(newIp));
+      ip = newIp;
+    } break;
+
+    case goto_w: {
+      uint32_t offset = codeReadInt32(t, code, ip);
+      uint32_t newIp = (ip - 5) + offset;
+      assert(t, newIp < codeLength(t, code));
+
+      c->jmp(frame->machineIp(newIp));
+      ip = newIp;
+    } break;
+
+    case i2b: {
+      frame->pushInt
+        (c->load(TargetBytesPerWord, 1, frame->popInt(), TargetBytesPerWord));
+    } break;
+
+    case i2c: {
+      frame->pushInt
+        (c->loadz(TargetBytesPerWord, 2, frame->popInt(), TargetBytesPerWord));
+    } break;
+
+    case i2d: {
+      frame->pushLong(c->i2f(4, 8, frame->popInt()));
+    } break;
+
+    case i2f: {
+      frame->pushInt(c->i2f(4, 4, frame->popInt()));
+    } break;
+
+    case i2l:
+      frame->pushLong(c->load(TargetBytesPerWord, 4, frame->popInt(), 8));
+      break;
+
+    case i2s: {
+      frame->pushInt
+        (c->load(TargetBytesPerWord, 2, frame->popInt(), TargetBytesPerWord));
+    } break;
+      
+    case iadd: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->add(4, a, b));
+    } break;
+      
+    case iand: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->and_(4, a, b));
+    } break;
+
+    case iconst_m1:
+      frame->pushInt(c->constant(-1, Compiler::IntegerType));
+      break;
+
+    case iconst_0:
+      frame->pushInt(c->constant(0, Compiler::IntegerType));
+      break;
+
+    case iconst_1:
+      frame->pushInt(c->constant(1, Compiler::IntegerType));
+      break;
+
+    case iconst_2:
+      frame->pushInt(c->constant(2, Compiler::IntegerType));
+      break;
+
+    case iconst_3:
+      frame->pushInt(c->constant(3, Compiler::IntegerType));
+      break;
+
+    case iconst_4:
+      frame->pushInt(c->constant(4, Compiler::IntegerType));
+      break;
+
+    case iconst_5:
+      frame->pushInt(c->constant(5, Compiler::IntegerType));
+      break;
+
+    case idiv: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      if (inTryBlock(t, code, ip - 1)) {
+        c->saveLocals();
+        frame->trace(0, 0);
+      }
+
+      frame->pushInt(c->div(4, a, b));
+    } break;
+
+    case if_acmpeq:
+    case if_acmpne: {
+      uint32_t offset = codeReadInt16(t, code, ip);
+      newIp = (ip - 3) + offset;
+      assert(t, newIp < codeLength(t, code));
+        
+      Compiler::Operand* a = frame->popObject();
+      Compiler::Operand* b = frame->popObject();
+      Compiler::Operand* target = frame->machineIp(newIp);
+
+      if (instruction == if_acmpeq) {
+        c->jumpIfEqual(TargetBytesPerWord, a, b, target);
+      } else {
+        c->jumpIfNotEqual(TargetBytesPerWord, a, b, target);
+      }
+    } goto branch;
+
+    case if_icmpeq:
+    case if_icmpne:
+    case if_icmpgt:
+    case if_icmpge:
+    case if_icmplt:
+    case if_icmple: {
+      uint32_t offset = codeReadInt16(t, code, ip);
+      newIp = (ip - 3) + offset;
+      assert(t, newIp < codeLength(t, code));
+        
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      Compiler::Operand* target = frame->machineIp(newIp);
+
+      switch (instruction) {
+      case if_icmpeq:
+        c->jumpIfEqual(4, a, b, target);
+        break;
+      case if_icmpne:
+        c->jumpIfNotEqual(4, a, b, target);
+        break;
+      case if_icmpgt:
+        c->jumpIfGreater(4, a, b, target);
+        break;
+      case if_icmpge:
+        c->jumpIfGreaterOrEqual(4, a, b, target);
+        break;
+      case if_icmplt:
+        c->jumpIfLess(4, a, b, target);
+        break;
+      case if_icmple:
+        c->jumpIfLessOrEqual(4, a, b, target);
+        break;
+      default:
+        abort(t);
+      }
+    } goto branch;
+
+    case ifeq:
+    case ifne:
+    case ifgt:
+    case ifge:
+    case iflt:
+    case ifle: {
+      uint32_t offset = codeReadInt16(t, code, ip);
+      newIp = (ip - 3) + offset;
+      assert(t, newIp < codeLength(t, code));
+
+      Compiler::Operand* target = frame->machineIp(newIp);
+
+      Compiler::Operand* a = c->constant(0, Compiler::IntegerType);
+      Compiler::Operand* b = frame->popInt();
+
+      switch (instruction) {
+      case ifeq:
+        c->jumpIfEqual(4, a, b, target);
+        break;
+      case ifne:
+        c->jumpIfNotEqual(4, a, b, target);
+        break;
+      case ifgt:
+        c->jumpIfGreater(4, a, b, target);
+        break;
+      case ifge:
+        c->jumpIfGreaterOrEqual(4, a, b, target);
+        break;
+      case iflt:
+        c->jumpIfLess(4, a, b, target);
+        break;
+      case ifle:
+        c->jumpIfLessOrEqual(4, a, b, target);
+        break;
+      default:
+        abort(t);
+      }
+    } goto branch;
+
+    case ifnull:
+    case ifnonnull: {
+      uint32_t offset = codeReadInt16(t, code, ip);
+      newIp = (ip - 3) + offset;
+      assert(t, newIp < codeLength(t, code));
+
+      Compiler::Operand* a = c->constant(0, Compiler::ObjectType);
+      Compiler::Operand* b = frame->popObject();
+      Compiler::Operand* target = frame->machineIp(newIp);
+
+      if (instruction == ifnull) {
+        c->jumpIfEqual(TargetBytesPerWord, a, b, target);
+      } else {
+        c->jumpIfNotEqual(TargetBytesPerWord, a, b, target);
+      }
+    } goto branch;
+
+    case iinc: {
+      uint8_t index = codeBody(t, code, ip++);
+      int8_t count = codeBody(t, code, ip++);
+
+      storeLocal
+        (context, 1,
+         c->add
+         (4, c->constant(count, Compiler::IntegerType),
+          loadLocal(context, 1, index)),
+         index);
+    } break;
+
+    case iload:
+    case fload:
+      frame->loadInt(codeBody(t, code, ip++));
+      break;
+
+    case iload_0:
+    case fload_0:
+      frame->loadInt(0);
+      break;
+
+    case iload_1:
+    case fload_1:
+      frame->loadInt(1);
+      break;
+
+    case iload_2:
+    case fload_2:
+      frame->loadInt(2);
+      break;
+
+    case iload_3:
+    case fload_3:
+      frame->loadInt(3);
+      break;
+
+    case imul: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->mul(4, a, b));
+    } break;
+
+    case ineg: {
+      frame->pushInt(c->neg(4, frame->popInt()));
+    } break;
+
+    case instanceof: {
+      uint16_t index = codeReadInt16(t, code, ip);
+
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object class_ = resolveClassInPool(t, context->method, index - 1, false);
+
+      Compiler::Operand* instance = frame->popObject();
+
+      object argument;
+      Thunk thunk;
+      if (LIKELY(class_)) {
+        argument = class_;
+        thunk = instanceOf64Thunk;
+      } else {
+        argument = makePair(t, context->method, reference);
+        thunk = instanceOfFromReferenceThunk;
+      }
+
+      frame->pushInt
+        (c->call
+         (c->constant(getThunk(t, thunk), Compiler::AddressType),
+          0, frame->trace(0, 0), 4, Compiler::IntegerType,
+          3, c->register_(t->arch->thread()), frame->append(argument),
+          instance));
+    } break;
+
+    case invokeinterface: {
+      context->leaf = false;
+
+      uint16_t index = codeReadInt16(t, code, ip);
+      ip += 2;
+
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object target = resolveMethod(t, context->method, index - 1, false);
+
+      object argument;
+      Thunk thunk;
+      unsigned parameterFootprint;
+      int returnCode;
+      bool tailCall;
+      if (LIKELY(target)) {
+        checkMethod(t, target, false);
+
+        argument = target;
+        thunk = findInterfaceMethodFromInstanceThunk;
+        parameterFootprint = methodParameterFootprint(t, target);
+        returnCode = methodReturnCode(t, target);
+        tailCall = isTailCall(t, code, ip, context->method, target);
+      } else {
+        argument = makePair(t, context->method, reference);
+        thunk = findInterfaceMethodFromInstanceAndReferenceThunk;
+        parameterFootprint = methodReferenceParameterFootprint
+          (t, reference, false);
+        returnCode = methodReferenceReturnCode(t, reference);
+        tailCall = isReferenceTailCall
+          (t, code, ip, context->method, reference);
+      }
+
+      unsigned rSize = resultSize(t, returnCode);
+
+      Compiler::Operand* result = c->stackCall
+        (c->call
+         (c->constant(getThunk(t, thunk), Compiler::AddressType),
+          0,
+          frame->trace(0, 0),
+          TargetBytesPerWord,
+          Compiler::AddressType,
+          3, c->register_(t->arch->thread()), frame->append(argument),
+          c->peek(1, parameterFootprint - 1)),
+         tailCall ? Compiler::TailJump : 0,
+         frame->trace(0, 0),
+         rSize,
+         operandTypeForFieldCode(t, returnCode),
+         parameterFootprint);
+
+      frame->pop(parameterFootprint);
+
+      if (rSize) {
+        pushReturnValue(t, frame, returnCode, result);
+      }
+    } break;
+
+    case invokespecial: {
+      uint16_t index = codeReadInt16(t, code, ip);
+
+      ScalarSite* scalar = scalarSite(context, ip - 3);
+      if (scalar) {
+        // inline the trivial constructor of a replaced object
+        ScalarInit* init = context->escapes->initAt[ip - 3];
+
+        Compiler::Operand* arguments[MaxScalarArguments];
+        for (unsigned i = init->argumentCount; i > 0; --i) {
+          arguments[i - 1] = popField(t, frame, init->argumentCodes[i - 1]);
+        }
+
+        frame->popObject();
+
+        for (unsigned i = 0; i < init->storeCount; ++i) {
+          ScalarStore* s = init->stores + i;
+          Compiler::Operand* value;
+          if (s->argument >= 0) {
+            value = narrowScalar(frame, s->code, arguments[s->argument]);
+          } else {
+            value = c->constant
+              (s->value, operandTypeForFieldCode(t, s->code));
+          }
+
+          storeScalar(frame, s->code, value, scalar->slots[s->field]);
+        }
+        break;
+      }
+
+      context->leaf = false;
+
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object target = resolveMethod(t, context->method, index - 1, false);
+
+      if (LIKELY(target)) {
+        object class_ = methodClass(t, context->method);
+        if (isSpecialMethod(t, target, class_)) {
+          target = findVirtualMethod(t, target, classSuper(t, class_));
+        }
+
+        checkMethod(t, target, false);
+
+        bool tailCall = isTailCall(t, code, ip, context->method, target);
+
+        if (UNLIKELY(methodAbstract(t, target))) {
+          compileDirectAbstractInvoke
+            (t, frame, getMethodAddressThunk, target, tailCall);
+        } else {
+          compileDirectInvoke(t, frame, target, tailCall);
+        }
+      } else {
+        compileDirectReferenceInvoke
+          (t, frame, findSpecialMethodFromReferenceThunk, reference, false,
+           isReferenceTailCall(t, code, ip, context->method, reference));
+      }
+    } break;
+
+    case invokestatic: {
+      context->leaf = false;
+
+      uint16_t index = codeReadInt16(t, code, ip);
+
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object target = resolveMethod(t, context->method, index - 1, false);
+
+      if (LIKELY(target)) {
+        checkMethod(t, target, true);
+
+        if (not intrinsic(t, frame, target)) {
+          bool tailCall = isTailCall(t, code, ip, context->method, target);
+          compileDirectInvoke(t, frame, target, tailCall);
+        }
+      } else {
+        compileDirectReferenceInvoke
+          (t, frame, findStaticMethodFromReferenceThunk, reference, true,
+           isReferenceTailCall(t, code, ip, context->method, reference));
+      }
+    } break;
+
+    case invokevirtual: {
+      context->leaf = false;
+
+      uint16_t index = codeReadInt16(t, code, ip);
+
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
+
+      PROTECT(t, reference);
+
+      object target = resolveMethod(t, context->method, index - 1, false);
+
+      if (LIKELY(target)) {
+        checkMethod(t, target, false);
+         
+        if (not intrinsic(t, frame, target)) {
+          bool tailCall = isTailCall(t, code, ip, context->method, target);
+
+          if (LIKELY(methodVirtual(t, target))) {
+            unsigned parameterFootprint = methodParameterFootprint(t, target);
+
+            unsigned offset = TargetClassVtable
+              + (methodOffset(t, target) * TargetBytesPerWord);
+
+            Compiler::Operand* instance = c->peek(1, parameterFootprint - 1);
+
+            unsigned rSize = resultSize(t, methodReturnCode(t, target));
+
+            Compiler::Operand* result = c->stackCall
+              (c->memory
+               (c->and_
+                (TargetBytesPerWord, c->constant
+                 (TargetPointerMask, Compiler::IntegerType),
+                 c->memory(instance, Compiler::ObjectType, 0, 0, 1)),
+                Compiler::ObjectType, offset, 0, 1),
+               tailCall ? Compiler::TailJump : 0,
+               frame->trace(0, 0),
+               rSize,
+               operandTypeForFieldCode(t, methodReturnCode(t, target)),
+               parameterFootprint);
+
+            frame->pop(parameterFootprint);
+
+            if (rSize) {
+              pushReturnValue(t, frame, methodReturnCode(t, target), result);
+            }
+          } else {
+            // OpenJDK generates invokevirtual calls to private methods
+            // (e.g. readObject and writeObject for serialization), so
+            // we must handle such cases here.
+
+            compileDirectInvoke(t, frame, target, tailCall);          
+          }
+        }
+      } else {
+        PROTECT(t, reference);
+
+        object pair = makePair(t, context->method, reference);
+
+        compileReferenceInvoke
+          (t, frame, c->call
+           (c->constant(getThunk(t, findVirtualMethodFromReferenceThunk),
+                        Compiler::AddressType),
+            0,
+            frame->trace(0, 0),
+            TargetBytesPerWord,
+            Compiler::AddressType,
+            3, c->register_(t->arch->thread()), frame->append(pair),
+            c->peek(1, methodReferenceParameterFootprint
+                    (t, reference, false) - 1)),
+           reference, false, isReferenceTailCall
+           (t, code, ip, context->method, reference));
+      }
+    } break;
+
+    case ior: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->or_(4, a, b));
+    } break;
+
+    case irem: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+
+      if (inTryBlock(t, code, ip - 1)) {
+        c->saveLocals();
+        frame->trace(0, 0);
+      }
+
+      frame->pushInt(c->rem(4, a, b));
+    } break;
+
+    case ireturn:
+    case freturn: {
+      handleExit(t, frame);
+      c->return_(4, frame->popInt());
+    } goto next;
+
+    case ishl: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->shl(4, a, b));
+    } break;
+
+    case ishr: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->shr(4, a, b));
+    } break;
+
+    case istore:
+    case fstore:
+      frame->storeInt(codeBody(t, code, ip++));
+      break;
+
+    case istore_0:
+    case fstore_0:
+      frame->storeInt(0);
+      break;
+
+    case istore_1:
+    case fstore_1:
+      frame->storeInt(1);
+      break;
+
+    case istore_2:
+    case fstore_2:
+      frame->storeInt(2);
+      break;
+
+    case istore_3:
+    case fstore_3:
+      frame->storeInt(3);
+      break;
+
+    case isub: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->sub(4, a, b));
+    } break;
+
+    case iushr: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->ushr(4, a, b));
+    } break;
+
+    case ixor: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popInt();
+      frame->pushInt(c->xor_(4, a, b));
+    } break;
+
+    case jsr:
+    case jsr_w: {
+      uint32_t thisIp;
+
+      if (instruction == jsr) {
+        uint32_t offset = codeReadInt16(t, code, ip);
+        thisIp = ip - 3;
+        newIp = thisIp + offset;
+      } else {
+        uint32_t offset = codeReadInt32(t, code, ip);
+        thisIp = ip - 5;
+        newIp = thisIp + offset;
+      }
+
+      assert(t, newIp < codeLength(t, code));
+
+      unsigned start = frame->startSubroutine(newIp, c->machineIp(ip));
+
+      c->jmp(frame->machineIp(newIp));
+
+      stack.pushValue(start);
+      stack.pushValue(ip);
+      stack.pushValue(Unsubroutine);
+      ip = newIp;
+    } goto start;
+
+    case l2d: {
+      frame->pushLong(c->i2f(8, 8, frame->popLong()));
+    } break;
+
+    case l2f: {
+      frame->pushInt(c->i2f(8, 4, frame->popLong()));
+    } break;
+
+    case l2i:
+      frame->pushInt(c->load(8, 8, frame->popLong(), TargetBytesPerWord));
+      break;
+
+    case ladd: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->add(8, a, b));
+    } break;
+
+    case land: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->and_(8, a, b));
+    } break;
+
+    case lcmp: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      if (integerBranch(t, frame, code, ip, 8, a, b, &newIp)) {
+        goto branch;
+      } else {
+        frame->pushInt
+          (c->call
+           (c->constant
+            (getThunk(t, compareLongsThunk), Compiler::AddressType),
+            0, 0, 4, Compiler::IntegerType, 4,
+            static_cast<Compiler::Operand*>(0), a,
+            static_cast<Compiler::Operand*>(0), b));
+      }
+    } break;
+
+    case lconst_0:
+      frame->pushLong(c->constant(0, Compiler::IntegerType));
+      break;
+
+    case lconst_1:
+      frame->pushLong(c->constant(1, Compiler::IntegerType));
+      break;
+
+    case ldc:
+    case ldc_w: {
+      uint16_t index;
+
+      if (instruction == ldc) {
+        index = codeBody(t, code, ip++);
+      } else {
+        index = codeReadInt16(t, code, ip);
+      }
+
+      object pool = codePool(t, code);
+
+      if (singletonIsObject(t, pool, index - 1)) {
+        object v = singletonObject(t, pool, index - 1);
+
+        loadMemoryBarrier();  
+
+        if (objectClass(t, v) == type(t, Machine::ReferenceType)) {
+          object reference = v;
+          PROTECT(t, reference);
+
+          v = resolveClassInPool(t, context->method, index - 1, false);
+
+          if (UNLIKELY(v == 0)) {
+            frame->pushObject
+              (c->call
+               (c->constant
+                (getThunk(t, getJClassFromReferenceThunk),
+                 Compiler::AddressType),
+                0,
+                frame->trace(0, 0),
+                TargetBytesPerWord,
+                Compiler::ObjectType,
+                2, c->register_(t->arch->thread()),
+                frame->append(makePair(t, context->method, reference))));
+          }
+        }
+
+        if (v) {
+          if (objectClass(t, v) == type(t, Machine::ClassType)) {
+            frame->pushObject
+              (c->call
+               (c->constant
+                (getThunk(t, getJClass64Thunk), Compiler::AddressType),
+                0,
+                frame->trace(0, 0),
+                TargetBytesPerWord,
+                Compiler::ObjectType,
+                2, c->register_(t->arch->thread()), frame->append(v)));
+          } else {
+            frame->pushObject(frame->append(v));
+          }
+        }
+      } else {
+        frame->pushInt
+          (c->constant
+           (singletonValue(t, pool, index - 1),
+            singletonBit(t, pool, poolSize(t, pool), index - 1)
+            ? Compiler::FloatType : Compiler::IntegerType));
+      }
+    } break;
+
+    case ldc2_w: {
+      uint16_t index = codeReadInt16(t, code, ip);
+
+      object pool = codePool(t, code);
+
+      uint64_t v;
+      memcpy(&v, &singletonValue(t, pool, index - 1), 8);
+      frame->pushLong
+        (c->constant
+         (v, singletonBit(t, pool, poolSize(t, pool), index - 1)
+          ? Compiler::FloatType : Compiler::IntegerType));
+    } break;
+
+    case ldiv_: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      if (inTryBlock(t, code, ip - 1)) {
+        c->saveLocals();
+        frame->trace(0, 0);
+      }
+
+      frame->pushLong(c->div(8, a, b));
+    } break;
+
+    case lload:
+    case dload:
+      frame->loadLong(codeBody(t, code, ip++));
+      break;
+
+    case lload_0:
+    case dload_0:
+      frame->loadLong(0);
+      break;
+
+    case lload_1:
+    case dload_1:
+      frame->loadLong(1);
+      break;
+
+    case lload_2:
+    case dload_2:
+      frame->loadLong(2);
+      break;
+
+    case lload_3:
+    case dload_3:
+      frame->loadLong(3);
+      break;
+
+    case lmul: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->mul(8, a, b));
+    } break;
+
+    case lneg:
+      frame->pushLong(c->neg(8, frame->popLong()));
+      break;
+
+    case lookupswitch: {
+      int32_t base = ip - 1;
+
+      ip = (ip + 3) & ~3; // pad to four byte boundary
+
+      Compiler::Operand* key = frame->popInt();
+    
+      uint32_t defaultIp = base + codeReadInt32(t, code, ip);
+      assert(t, defaultIp < codeLength(t, code));
+
+      int32_t pairCount = codeReadInt32(t, code, ip);
+
+      if (pairCount) {
+        Compiler::Operand* default_ = frame->addressOperand
+          (frame->addressPromise(c->machineIp(defaultIp)));
+
+        avian::codegen::Promise* start = 0;
+        uint32_t* ipTable = static_cast<uint32_t*>
+          (stack.push(sizeof(uint32_t) * pairCount));
+        for (int32_t i = 0; i < pairCount; ++i) {
+          unsigned index = ip + (i * 8);
+          int32_t key = codeReadInt32(t, code, index);
+          uint32_t newIp = base + codeReadInt32(t, code, index);
+          assert(t, newIp < codeLength(t, code));
+
+          ipTable[i] = newIp;
+
+          avian::codegen::Promise* p = c->poolAppend(key);
+          if (i == 0) {
+            start = p;
+          }
+          c->poolAppendPromise
+            (frame->addressPromise(c->machineIp(newIp)));
+        }
+        assert(t, start);
+
+        Compiler::Operand* address = c->call
+          (c->constant(getThunk(t, lookUpAddressThunk), Compiler::AddressType),
+           0, 0, TargetBytesPerWord, Compiler::AddressType,
+           4, key, frame->absoluteAddressOperand(start),
+           c->constant(pairCount, Compiler::IntegerType), default_);
+
+        c->jmp
+          (context->bootContext ? c->add
+           (TargetBytesPerWord, c->memory
+            (c->register_(t->arch->thread()), Compiler::AddressType,
+             TARGET_THREAD_CODEIMAGE), address)
+           : address);
+
+        new (stack.push(sizeof(SwitchState))) SwitchState
+          (c->saveState(), pairCount, defaultIp, 0, 0, 0, 0);
+
+        goto switchloop;
+      } else {
+        // a switch statement with no cases, apparently
+        c->jmp(frame->machineIp(defaultIp));
+        ip = defaultIp;
+      }
+    } break;
+
+    case lor: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->or_(8, a, b));
+    } break;
+
+    case lrem: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+
+      if (inTryBlock(t, code, ip - 1)) {
+        c->saveLocals();
+        frame->trace(0, 0);
+      }
+
+      frame->pushLong(c->rem(8, a, b));
+    } break;
+
+    case lreturn:
+    case dreturn: {
+      handleExit(t, frame);
+      c->return_(8, frame->popLong());
+    } goto next;
+
+    case lshl: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->shl(8, a, b));
+    } break;
+
+    case lshr: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->shr(8, a, b));
+    } break;
+
+    case lstore:
+    case dstore:
+      frame->storeLong(codeBody(t, code, ip++));
+      break;
 
-    virtual void release() {
-      s->zone.dispose();
-    }
+    case lstore_0:
+    case dstore_0:
+      frame->storeLong(0);
+      break;
 
-    Stack* s;
-  };
+    case lstore_1:
+    case dstore_1:
+      frame->storeLong(1);
+      break;
 
-  Stack(MyThread* t):
-    thread(t),
-    zone(t->m->system, t->m->heap, 0),
-    resource(this)
-  { }
+    case lstore_2:
+    case dstore_2:
+      frame->storeLong(2);
+      break;
 
-  ~Stack() {
-    zone.dispose();
-  }
+    case lstore_3:
+    case dstore_3:
+      frame->storeLong(3);
+      break;
 
-  void pushValue(uintptr_t v) {
-    *static_cast<uintptr_t*>(push(BytesPerWord)) = v;
-  }
+    case lsub: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->sub(8, a, b));
+    } break;
 
-  uintptr_t peekValue(unsigned offset) {
-    return *static_cast<uintptr_t*>(peek((offset + 1) * BytesPerWord));
-  }
+    case lushr: {
+      Compiler::Operand* a = frame->popInt();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->ushr(8, a, b));
+    } break;
 
-  uintptr_t popValue() {
-    uintptr_t v = peekValue(0);
-    pop(BytesPerWord);
-    return v;
-  }
+    case lxor: {
+      Compiler::Operand* a = frame->popLong();
+      Compiler::Operand* b = frame->popLong();
+      frame->pushLong(c->xor_(8, a, b));
+    } break;
 
-  void* push(unsigned size) {
-    return zone.allocate(size);
-  }
+    case monitorenter: {
+      Compiler::Operand* target = frame->popObject();
+      if (scalarSite(context, ip - 1)) {
+        // no other thread can see this object, so there is nothing to
+        // synchronize with
+        break;
+      }
 
-  void* peek(unsigned size) {
-    return zone.peek(size);
-  }
+      c->call
+        (c->constant
+         (getThunk(t, acquireMonitorForObjectThunk), Compiler::AddressType),
+         0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
+         c->register_(t->arch->thread()), target);
+    } break;
 
-  void pop(unsigned size) {
-    zone.pop(size);
-  }
+    case monitorexit: {
+      Compiler::Operand* target = frame->popObject();
+      if (scalarSite(context, ip - 1)) {
+        break;
+      }
 
-  MyThread* thread;
-  Zone zone;
-  MyResource resource;
-};
+      c->call
+        (c->constant
+         (getThunk(t, releaseMonitorForObjectThunk), Compiler::AddressType),
+         0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
+         c->register_(t->arch->thread()), target);
+    } break;
 
-class SwitchState {
- public:
-  SwitchState(Compiler::State* state,
-              unsigned count,
-              unsigned defaultIp,
-              Compiler::Operand* key,
-              avian::codegen::Promise* start,
-              int bottom,
-              int top):
-    state(state),
-    count(count),
-    defaultIp(defaultIp),
-    key(key),
-    start(start),
-    bottom(bottom),
-    top(top),
-    index(0)
-  { }
+    case multianewarray: {
+      uint16_t index = codeReadInt16(t, code, ip);
+      uint8_t dimensions = codeBody(t, code, ip++);
 
-  Frame* frame() {
-    return reinterpret_cast<Frame*>
-      (reinterpret_cast<uint8_t*>(this) - pad(count * 4) - pad(sizeof(Frame)));
-  }
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
 
-  uint32_t* ipTable() {
-    return reinterpret_cast<uint32_t*>
-      (reinterpret_cast<uint8_t*>(this) - pad(count * 4));
-  }
+      PROTECT(t, reference);
 
-  Compiler::State* state;
-  unsigned count;
-  unsigned defaultIp;
-  Compiler::Operand* key;
-  avian::codegen::Promise* start;
-  int bottom;
-  int top;
-  unsigned index;
-};
+      object class_ = resolveClassInPool(t, context->method, index - 1, false);
 
-void
-compile(MyThread* t, Frame* initialFrame, unsigned initialIp,
-        int exceptionHandlerStart = -1)
-{
-  enum {
-    Return,
-    Unbranch,
-    Unsubroutine,
-    Untable0,
-    Untable1,
-    Unswitch
-  };
+      object argument;
+      Thunk thunk;
+      if (LIKELY(class_)) {
+        argument = class_;
+        thunk = makeMultidimensionalArrayThunk;
+      } else {
+        argument = makePair(t, context->method, reference);
+        thunk = makeMultidimensionalArrayFromReferenceThunk;
+      }
 
-  Frame* frame = initialFrame;
-  avian::codegen::Compiler* c = frame->c;
-  Context* context = frame->context;
-  unsigned stackSize = codeMaxStack(t, methodCode(t, context->method));
-  Stack stack(t);
-  unsigned ip = initialIp;
-  unsigned newIp;
-  stack.pushValue(Return);
+      unsigned offset
+        = localOffset
+        (t, localSize(t, context->method) + c->topOfStack(), context->method)
+        + t->arch->frameReturnAddressSize();
 
- start:
-  uint8_t* stackMap = static_cast<uint8_t*>(stack.push(stackSize));
-  frame = new (stack.push(sizeof(Frame))) Frame(frame, stackMap);
+      Compiler::Operand* result = c->call
+        (c->constant
+         (getThunk(t, thunk), Compiler::AddressType),
+         0,
+         frame->trace(0, 0),
+         TargetBytesPerWord,
+         Compiler::ObjectType,
+         4, c->register_(t->arch->thread()), frame->append(argument),
+         c->constant(dimensions, Compiler::IntegerType),
+         c->constant(offset, Compiler::IntegerType));
 
- loop:
-  object code = methodCode(t, context->method);
-  PROTECT(t, code);
-  
-  while (ip < codeLength(t, code)) {
-    if (context->visitTable[ip] ++) {
-      // we've already visited this part of the code
-      frame->visitLogicalIp(ip);
-      goto next;
-    }
+      frame->pop(dimensions);
+      frame->pushObject(result);
+    } break;
 
-    frame->startLogicalIp(ip);
+    case new_: {
+      uint16_t index = codeReadInt16(t, code, ip);
 
-    if (exceptionHandlerStart >= 0) {
-      c->initLocalsFromLogicalIp(exceptionHandlerStart);
+      ScalarSite* scalar = scalarSite(context, ip - 3);
+      if (scalar) {
+        // the fields of the object live in locals, and a null
+        // placeholder stands in for the reference itself
+        for (unsigned i = 0; i < scalar->fieldCount; ++i) {
+          storeScalar
+            (frame, scalar->codes[i], c->constant
+             (0, operandTypeForFieldCode(t, scalar->codes[i])),
+             scalar->slots[i]);
+        }
 
-      exceptionHandlerStart = -1;
+        frame->pushObject(c->constant(0, Compiler::ObjectType));
+        break;
+      }
+        
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
 
-      frame->pushObject();
-      
-      c->call
-        (c->constant(getThunk(t, gcIfNecessaryThunk), Compiler::AddressType),
-         0,
-         frame->trace(0, 0),
-         0,
-         Compiler::VoidType,
-         1, c->register_(t->arch->thread()));
-    }
-    
-//     fprintf(stderr, "ip: %d map: %ld\n", ip, *(frame->map));
+      PROTECT(t, reference);
 
-    unsigned instruction = codeBody(t, code, ip++);
+      object class_ = resolveClassInPool(t, context->method, index - 1, false);
 
-    switch (instruction) {
-    case aaload:
-    case baload:
-    case caload:
-    case daload:
-    case faload:
-    case iaload:
-    case laload:
-    case saload: {
-      Compiler::Operand* index = frame->popInt();
-      Compiler::Operand* array = frame->popObject();
+      object argument;
+      Thunk thunk;
+      AllocationSite* site = 0;
+      if (LIKELY(class_)) {
+        argument = class_;
+        if (classVmFlags(t, class_) & (WeakReferenceFlag | HasFinalizerFlag)) {
+          thunk = makeNewGeneral64Thunk;
+        } else if (context->bootContext == 0
+                   and not codeCacheFile(t)->enabled)
+        {
+          // profile the lifetime of objects allocated here so that
+          // long-lived ones may eventually be allocated directly in
+          // the tenured generation (but not if the code may be saved
+          // for another process, since the site is referenced by
+          // address):
+          site = makeAllocationSite(t, context->method, ip - 3);
+          thunk = makeNewAtSite64Thunk;
+        } else {
+          thunk = makeNew64Thunk;
+        }
+      } else {
+        argument = makePair(t, context->method, reference);
+        thunk = makeNewFromReferenceThunk;
+      }
 
-      if (inTryBlock(t, code, ip - 1)) {
-        c->saveLocals();
-        frame->trace(0, 0);
+      if (site) {
+        frame->pushObject
+          (c->call
+           (c->constant(getThunk(t, thunk), Compiler::AddressType),
+            0,
+            frame->trace(0, 0),
+            TargetBytesPerWord,
+            Compiler::ObjectType,
+            3, c->register_(t->arch->thread()), frame->append(argument),
+            c->constant(reinterpret_cast<intptr_t>(site),
+                        Compiler::AddressType)));
+      } else {
+        frame->pushObject
+          (c->call
+           (c->constant(getThunk(t, thunk), Compiler::AddressType),
+            0,
+            frame->trace(0, 0),
+            TargetBytesPerWord,
+            Compiler::ObjectType,
+            2, c->register_(t->arch->thread()), frame->append(argument)));
       }
+    } break;
 
-      if (CheckArrayBounds) {
-        c->checkBounds(array, TargetArrayLength, index, aioobThunk(t));
-      }
+    case newarray: {
+      uint8_t type = codeBody(t, code, ip++);
 
-      switch (instruction) {
-      case aaload:
-        frame->pushObject
-          (c->load
-           (TargetBytesPerWord, TargetBytesPerWord, c->memory
-            (array, Compiler::ObjectType, TargetArrayBody, index,
-             TargetBytesPerWord),
-            TargetBytesPerWord));
-        break;
+      Compiler::Operand* length = frame->popInt();
 
-      case faload:
-        frame->pushInt
-          (c->load
-           (4, 4, c->memory
-            (array, Compiler::FloatType, TargetArrayBody, index, 4),
-            TargetBytesPerWord));
-        break;
+      frame->pushObject
+        (c->call
+         (c->constant(getThunk(t, makeBlankArrayThunk), Compiler::AddressType),
+          0,
+          frame->trace(0, 0),
+          TargetBytesPerWord,
+          Compiler::ObjectType,
+          3, c->register_(t->arch->thread()),
+          c->constant(type, Compiler::IntegerType), length));
+    } break;
 
-      case iaload:
-        frame->pushInt
-          (c->load
-           (4, 4, c->memory
-            (array, Compiler::IntegerType, TargetArrayBody, index, 4),
-            TargetBytesPerWord));
-        break;
+    case nop: break;
 
-      case baload:
-        frame->pushInt
-          (c->load
-           (1, 1, c->memory
-            (array, Compiler::IntegerType, TargetArrayBody, index, 1),
-            TargetBytesPerWord));
-        break;
+    case pop_:
+      frame->pop(1);
+      break;
 
-      case caload:
-        frame->pushInt
-          (c->loadz
-           (2, 2, c->memory
-            (array, Compiler::IntegerType, TargetArrayBody, index, 2),
-            TargetBytesPerWord));
-        break;
+    case pop2:
+      frame->pop(2);
+      break;
 
-      case daload:
-        frame->pushLong
-          (c->load
-           (8, 8, c->memory
-            (array, Compiler::FloatType, TargetArrayBody, index, 8), 8));
-        break;
+    case putfield:
+    case putstatic: {
+      uint16_t index = codeReadInt16(t, code, ip);
 
-      case laload:
-        frame->pushLong
-          (c->load
-           (8, 8, c->memory
-            (array, Compiler::IntegerType, TargetArrayBody, index, 8), 8));
-        break;
+      ScalarSite* scalar = scalarSite(context, ip - 3);
+      if (scalar) {
+        object field = resolveField(t, context->method, index - 1);
 
-      case saload:
-        frame->pushInt
-          (c->load
-           (2, 2, c->memory
-            (array, Compiler::IntegerType, TargetArrayBody, index, 2),
-            TargetBytesPerWord));
+        Compiler::Operand* value = popField(t, frame, fieldCode(t, field));
+        frame->popObject();
+
+        storeScalar(frame, fieldCode(t, field), narrowScalar
+                    (frame, fieldCode(t, field), value),
+                    scalarSlot(t, scalar, field));
         break;
       }
-    } break;
+    
+      object reference = singletonObject
+        (t, codePool(t, methodCode(t, context->method)), index - 1);
 
-    case aastore:
-    case bastore:
-    case castore:
-    case dastore:
-    case fastore:
-    case iastore:
-    case lastore:
-    case sastore: {
-      Compiler::Operand* value;
-      if (instruction == dastore or instruction == lastore) {
-        value = frame->popLong();
-      } else if (instruction == aastore) {
-        value = frame->popObject();
-      } else {
-        value = frame->popInt();
-      }
+      PROTECT(t, reference);
 
-      Compiler::Operand* index = frame->popInt();
-      Compiler::Operand* array = frame->popObject();
+      object field = resolveField(t, context->method, index - 1, false);
 
-      if (inTryBlock(t, code, ip - 1)) {
-        c->saveLocals();
-        frame->trace(0, 0);
-      }
+      if (LIKELY(field)) {
+        int fieldCode = vm::fieldCode(t, field);
 
-      if (CheckArrayBounds) {
-        c->checkBounds(array, TargetArrayLength, index, aioobThunk(t));
-      }
+        object staticTable = 0;
 
-      switch (instruction) {
-      case aastore: {
-        c->call
-          (c->constant(getThunk(t, setMaybeNullThunk), Compiler::AddressType),
-           0,
-           frame->trace(0, 0),
-           0,
-           Compiler::VoidType,
-           4, c->register_(t->arch->thread()), array,
-           c->add
-           (4, c->constant(TargetArrayBody, Compiler::IntegerType),
-            c->shl
-            (4, c->constant(log(TargetBytesPerWord), Compiler::IntegerType),
-             index)),
-           value);
-      } break;
+        if (instruction == putstatic) {
+          checkField(t, field, true);
 
-      case fastore:
-        c->store
-          (TargetBytesPerWord, value, 4, c->memory
-           (array, Compiler::FloatType, TargetArrayBody, index, 4));
-        break;
+          if (classNeedsInit(t, fieldClass(t, field))) {
+            PROTECT(t, field);
 
-      case iastore:
-        c->store
-          (TargetBytesPerWord, value, 4, c->memory
-           (array, Compiler::IntegerType, TargetArrayBody, index, 4));
-        break;
+            c->call
+              (c->constant
+               (getThunk(t, tryInitClassThunk), Compiler::AddressType),
+               0,
+               frame->trace(0, 0),
+               0,
+               Compiler::VoidType,
+               2, c->register_(t->arch->thread()),
+               frame->append(fieldClass(t, field)));
+          }
 
-      case bastore:
-        c->store
-          (TargetBytesPerWord, value, 1, c->memory
-           (array, Compiler::IntegerType, TargetArrayBody, index, 1));
-        break;
+          staticTable = classStaticTable(t, fieldClass(t, field));      
+        } else {
+          checkField(t, field, false);
 
-      case castore:
-      case sastore:
-        c->store
-          (TargetBytesPerWord, value, 2, c->memory
-           (array, Compiler::IntegerType, TargetArrayBody, index, 2));
-        break;
+          if (inTryBlock(t, code, ip - 3)) {
+            c->saveLocals();
+            frame->trace(0, 0);
+          }
+        }
 
-      case dastore:
-        c->store
-          (8, value, 8, c->memory
-           (array, Compiler::FloatType, TargetArrayBody, index, 8));
-        break;
+        if (fieldFlags(t, field) & ACC_VOLATILE) {
+          if (TargetBytesPerWord == 4
+              and (fieldCode == DoubleField or fieldCode == LongField))
+          {
+            PROTECT(t, field);
 
-      case lastore:
-        c->store
-          (8, value, 8, c->memory
-           (array, Compiler::IntegerType, TargetArrayBody, index, 8));
-        break;
-      }
-    } break;
+            c->call
+              (c->constant
+               (getThunk(t, acquireMonitorForObjectThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
+               c->register_(t->arch->thread()), frame->append(field));
+          } else {
+            c->storeStoreBarrier();
+          }
+        }
 
-    case aconst_null:
-      frame->pushObject(c->constant(0, Compiler::ObjectType));
-      break;
+        Compiler::Operand* value = popField(t, frame, fieldCode);
 
-    case aload:
-      frame->loadObject(codeBody(t, code, ip++));
-      break;
+        Compiler::Operand* table;
 
-    case aload_0:
-      frame->loadObject(0);
-      break;
+        if (instruction == putstatic) {
+          PROTECT(t, field);
 
-    case aload_1:
-      frame->loadObject(1);
-      break;
+          table = frame->append(staticTable);
+        } else {
+          table = frame->popObject();
+        }
 
-    case aload_2:
-      frame->loadObject(2);
-      break;
+        switch (fieldCode) {
+        case ByteField:
+        case BooleanField:
+          c->store
+            (TargetBytesPerWord, value, 1, c->memory
+             (table, Compiler::IntegerType, targetFieldOffset
+              (context, field), 0, 1));
+          break;
 
-    case aload_3:
-      frame->loadObject(3);
-      break;
+        case CharField:
+        case ShortField:
+          c->store
+            (TargetBytesPerWord, value, 2, c->memory
+             (table, Compiler::IntegerType, targetFieldOffset
+              (context, field), 0, 1));
+          break;
+            
+        case FloatField:
+          c->store
+            (TargetBytesPerWord, value, 4, c->memory
+             (table, Compiler::FloatType, targetFieldOffset
+              (context, field), 0, 1));
+          break;
 
-    case anewarray: {
-      uint16_t index = codeReadInt16(t, code, ip);
-      
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+        case IntField:
+          c->store
+            (TargetBytesPerWord, value, 4, c->memory
+             (table, Compiler::IntegerType, targetFieldOffset
+              (context, field), 0, 1));
+          break;
 
-      PROTECT(t, reference);
+        case DoubleField:
+          c->store
+            (8, value, 8, c->memory
+             (table, Compiler::FloatType, targetFieldOffset
+              (context, field), 0, 1));
+          break;
 
-      object class_ = resolveClassInPool(t, context->method, index - 1, false);
+        case LongField:
+          c->store
+            (8, value, 8, c->memory
+             (table, Compiler::IntegerType, targetFieldOffset
+              (context, field), 0, 1));
+          break;
 
-      Compiler::Operand* length = frame->popInt();
+        case ObjectField:
+          if (instruction == putfield) {
+            c->call
+              (c->constant
+               (getThunk(t, setMaybeNullThunk), Compiler::AddressType),
+               0,
+               frame->trace(0, 0),
+               0,
+               Compiler::VoidType,
+               4, c->register_(t->arch->thread()), table,
+               c->constant(targetFieldOffset(context, field),
+                           Compiler::IntegerType),
+               value);
+          } else {
+            c->call
+              (c->constant(getThunk(t, setThunk), Compiler::AddressType),
+               0, 0, 0, Compiler::VoidType,
+               4, c->register_(t->arch->thread()), table,
+               c->constant(targetFieldOffset(context, field),
+                           Compiler::IntegerType),
+               value);
+          }
+          break;
 
-      object argument;
-      Thunk thunk;
-      if (LIKELY(class_)) {
-        argument = class_;
-        thunk = makeBlankObjectArrayThunk;
-      } else {
-        argument = makePair(t, context->method, reference);
-        thunk = makeBlankObjectArrayFromReferenceThunk;
-      }
+        default: abort(t);
+        }
 
-      frame->pushObject
-        (c->call
-         (c->constant(getThunk(t, thunk), Compiler::AddressType),
-          0,
-          frame->trace(0, 0),
-          TargetBytesPerWord,
-          Compiler::ObjectType,
-          3, c->register_(t->arch->thread()), frame->append(argument),
-          length));
-    } break;
+        if (fieldFlags(t, field) & ACC_VOLATILE) {
+          if (TargetBytesPerWord == 4
+              and (fieldCode == DoubleField or fieldCode == LongField))
+          {
+            c->call
+              (c->constant
+               (getThunk(t, releaseMonitorForObjectThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
+               c->register_(t->arch->thread()), frame->append(field));
+          } else {
+            c->storeLoadBarrier();
+          }
+        }
+      } else {
+        int fieldCode = vm::fieldCode
+          (t, byteArrayBody(t, referenceSpec(t, reference), 0));
 
-    case areturn: {
-      handleExit(t, frame);
-      c->return_(TargetBytesPerWord, frame->popObject());
-    } goto next;
+        Compiler::Operand* value = popField(t, frame, fieldCode);
+        unsigned rSize = resultSize(t, fieldCode);
+        Compiler::OperandType rType = operandTypeForFieldCode(t, fieldCode);
 
-    case arraylength: {
-      frame->pushInt
-        (c->load
-         (TargetBytesPerWord, TargetBytesPerWord,
-          c->memory
-          (frame->popObject(), Compiler::IntegerType,
-           TargetArrayLength, 0, 1),
-          TargetBytesPerWord));
-    } break;
+        object pair = makePair(t, context->method, reference);
 
-    case astore:
-      frame->storeObjectOrAddress(codeBody(t, code, ip++));
-      break;
+        switch (fieldCode) {
+        case ByteField:
+        case BooleanField:
+        case CharField:
+        case ShortField:
+        case FloatField:
+        case IntField: {
+          if (instruction == putstatic) {
+            c->call
+              (c->constant
+               (getThunk(t, setStaticFieldValueFromReferenceThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), rSize, rType, 3,
+               c->register_(t->arch->thread()), frame->append(pair),
+               value);
+          } else {
+            Compiler::Operand* instance = frame->popObject();
 
-    case astore_0:
-      frame->storeObjectOrAddress(0);
-      break;
+            c->call
+              (c->constant
+               (getThunk(t, setFieldValueFromReferenceThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), rSize, rType, 4,
+               c->register_(t->arch->thread()), frame->append(pair),
+               instance, value);
+          }
+        } break;
 
-    case astore_1:
-      frame->storeObjectOrAddress(1);
-      break;
+        case DoubleField:
+        case LongField: {
+          if (instruction == putstatic) {
+            c->call
+              (c->constant
+               (getThunk(t, setStaticLongFieldValueFromReferenceThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), rSize, rType, 4,
+               c->register_(t->arch->thread()), frame->append(pair),
+               static_cast<Compiler::Operand*>(0), value);
+          } else {
+            Compiler::Operand* instance = frame->popObject();
 
-    case astore_2:
-      frame->storeObjectOrAddress(2);
-      break;
+            c->call
+              (c->constant
+               (getThunk(t, setLongFieldValueFromReferenceThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), rSize, rType, 5,
+               c->register_(t->arch->thread()), frame->append(pair),
+               instance, static_cast<Compiler::Operand*>(0), value);
+          }
+        } break;
 
-    case astore_3:
-      frame->storeObjectOrAddress(3);
-      break;
+        case ObjectField: {
+          if (instruction == putstatic) {
+            c->call
+              (c->constant
+               (getThunk(t, setStaticObjectFieldValueFromReferenceThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), rSize, rType, 3,
+               c->register_(t->arch->thread()), frame->append(pair),
+               value);
+          } else {
+            Compiler::Operand* instance = frame->popObject();
 
-    case athrow: {
-      Compiler::Operand* target = frame->popObject();
-      c->call
-        (c->constant(getThunk(t, throw_Thunk), Compiler::AddressType),
-         Compiler::NoReturn,
-         frame->trace(0, 0),
-         0,
-         Compiler::VoidType,
-         2, c->register_(t->arch->thread()), target);
+            c->call
+              (c->constant
+               (getThunk(t, setObjectFieldValueFromReferenceThunk),
+                Compiler::AddressType),
+               0, frame->trace(0, 0), rSize, rType, 4,
+               c->register_(t->arch->thread()), frame->append(pair),
+               instance, value);
+          }
+        } break;
 
-      if (ip == codeLength(t, code)) {
-        c->trap();
+        default: abort(t);
+        }
       }
+    } break;
+
+    case ret: {
+      unsigned index = codeBody(t, code, ip);
+      frame->returnFromSubroutine(index);
     } goto next;
 
-    case bipush:
+    case return_:
+      if (needsReturnBarrier(t, context->method)) {
+        c->storeStoreBarrier();
+      }
+
+      handleExit(t, frame);
+      c->return_(0, 0);
+      goto next;
+
+    case sipush:
       frame->pushInt
         (c->constant
-         (static_cast<int8_t>(codeBody(t, code, ip++)),
+         (static_cast<int16_t>(codeReadInt16(t, code, ip)),
           Compiler::IntegerType));
       break;
 
-    case checkcast: {
-      uint16_t index = codeReadInt16(t, code, ip);
-
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
-
-      PROTECT(t, reference);
-
-      object class_ = resolveClassInPool(t, context->method, index - 1, false);
-
-      object argument;
-      Thunk thunk;
-      if (LIKELY(class_)) {
-        argument = class_;
-        thunk = checkCastThunk;
-      } else {
-        argument = makePair(t, context->method, reference);
-        thunk = checkCastFromReferenceThunk;
-      }
+    case swap:
+      frame->swap();
+      break;
 
-      Compiler::Operand* instance = c->peek(1, 0);
+    case tableswitch: {
+      int32_t base = ip - 1;
 
-      c->call
-        (c->constant(getThunk(t, thunk), Compiler::AddressType),
-         0,
-         frame->trace(0, 0),
-         0,
-         Compiler::VoidType,
-         3, c->register_(t->arch->thread()), frame->append(argument),
-         instance);
-    } break;
+      ip = (ip + 3) & ~3; // pad to four byte boundary
 
-    case d2f: {
-        frame->pushInt(c->f2f(8, 4, frame->popLong()));
-    } break;
+      uint32_t defaultIp = base + codeReadInt32(t, code, ip);
+      assert(t, defaultIp < codeLength(t, code));
+      
+      int32_t bottom = codeReadInt32(t, code, ip);
+      int32_t top = codeReadInt32(t, code, ip);
+        
+      avian::codegen::Promise* start = 0;
+      unsigned count = top - bottom + 1;
+      uint32_t* ipTable = static_cast<uint32_t*>
+        (stack.push(sizeof(uint32_t) * count));
+      for (int32_t i = 0; i < top - bottom + 1; ++i) {
+        unsigned index = ip + (i * 4);
+        uint32_t newIp = base + codeReadInt32(t, code, index);
+        assert(t, newIp < codeLength(t, code));
 
-    case d2i: {
-      frame->pushInt(c->f2i(8, 4, frame->popLong()));
-    } break;
+        ipTable[i] = newIp;
 
-    case d2l: {
-      frame->pushLong(c->f2i(8, 8, frame->popLong()));
-    } break;
+        avian::codegen::Promise* p = c->poolAppendPromise
+          (frame->addressPromise(c->machineIp(newIp)));
+        if (i == 0) {
+          start = p;
+        }
+      }
+      assert(t, start);
 
-    case dadd: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+      Compiler::Operand* key = frame->popInt();
+      
+      c->jumpIfLess(4, c->constant(bottom, Compiler::IntegerType), key,
+                    frame->machineIp(defaultIp));
 
-      frame->pushLong(c->fadd(8, a, b));
-    } break;
+      c->save(1, key);
 
-    case dcmpg: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+      new (stack.push(sizeof(SwitchState))) SwitchState
+        (c->saveState(), count, defaultIp, key, start, bottom, top);
 
-      if (floatBranch(t, frame, code, ip, 8, false, a, b, &newIp)) {
-        goto branch;
-      } else {
-        frame->pushInt
-          (c->call
-           (c->constant
-            (getThunk(t, compareDoublesGThunk), Compiler::AddressType),
-            0, 0, 4, Compiler::IntegerType, 4,
-            static_cast<Compiler::Operand*>(0), a,
-            static_cast<Compiler::Operand*>(0), b));
-      }
-    } break;
+      stack.pushValue(Untable0);
+      ip = defaultIp;
+    } goto start;
 
-    case dcmpl: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+    case wide: {
+      switch (codeBody(t, code, ip++)) {
+      case aload: {
+        frame->loadObject(codeReadInt16(t, code, ip));
+      } break;
 
-      if (floatBranch(t, frame, code, ip, 8, true, a, b, &newIp)) {
-        goto branch;
-      } else {
-        frame->pushInt
-          (c->call
-           (c->constant
-            (getThunk(t, compareDoublesLThunk), Compiler::AddressType),
-            0, 0, 4, Compiler::IntegerType, 4,
-            static_cast<Compiler::Operand*>(0), a,
-            static_cast<Compiler::Operand*>(0), b));
-      }
-    } break;
+      case astore: {
+        frame->storeObject(codeReadInt16(t, code, ip));
+      } break;
 
-    case dconst_0:
-      frame->pushLong(c->constant(doubleToBits(0.0), Compiler::FloatType));
-      break;
-      
-    case dconst_1:
-      frame->pushLong(c->constant(doubleToBits(1.0), Compiler::FloatType));
-      break;
+      case iinc: {
+        uint16_t index = codeReadInt16(t, code, ip);
+        int16_t count = codeReadInt16(t, code, ip);
 
-    case ddiv: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+        storeLocal
+          (context, 1,
+           c->add
+           (4, c->constant(count, Compiler::IntegerType), 
+            loadLocal(context, 1, index)),
+           index);
+      } break;
 
-      frame->pushLong(c->fdiv(8, a, b));
-    } break;
+      case iload: {
+        frame->loadInt(codeReadInt16(t, code, ip));
+      } break;
 
-    case dmul: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+      case istore: {
+        frame->storeInt(codeReadInt16(t, code, ip));
+      } break;
 
-      frame->pushLong(c->fmul(8, a, b));
-    } break;
+      case lload: {
+        frame->loadLong(codeReadInt16(t, code, ip));
+      } break;
 
-    case dneg: {
-      frame->pushLong(c->fneg(8, frame->popLong()));
-    } break;
+      case lstore: {
+        frame->storeLong(codeReadInt16(t, code, ip));
+      } break;
 
-    case vm::drem: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+      case ret: {
+        unsigned index = codeReadInt16(t, code, ip);
+        c->jmp(loadLocal(context, 1, index));
+        frame->returnFromSubroutine(index);
+      } goto next;
 
-      frame->pushLong(c->frem(8, a, b));
+      default: abort(t);
+      }
     } break;
 
-    case dsub: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+    default: abort(t);
+    }
+  }
 
-      frame->pushLong(c->fsub(8, a, b));
-    } break;
+ next:
+  frame->dispose();
+  frame = 0;
+  stack.pop(sizeof(Frame));
+  stack.pop(stackSize);
+  switch (stack.popValue()) {
+  case Return:
+    return;
 
-    case dup:
-      frame->dup();
-      break;
+  case Unbranch:
+    ip = stack.popValue();
+    c->restoreState(reinterpret_cast<Compiler::State*>(stack.popValue()));
+    frame = static_cast<Frame*>(stack.peek(sizeof(Frame)));
+    goto loop;
 
-    case dup_x1:
-      frame->dupX1();
-      break;
+  case Untable0: {
+    SwitchState* s = static_cast<SwitchState*>
+      (stack.peek(sizeof(SwitchState)));
 
-    case dup_x2:
-      frame->dupX2();
-      break;
+    frame = s->frame();
 
-    case dup2:
-      frame->dup2();
-      break;
+    c->restoreState(s->state);
 
-    case dup2_x1:
-      frame->dup2X1();
-      break;
+    c->jumpIfGreater(4, c->constant(s->top, Compiler::IntegerType), s->key,
+                     frame->machineIp(s->defaultIp));
+  
+    c->save(1, s->key);
+    ip = s->defaultIp;
+    stack.pushValue(Untable1);
+  } goto start;
 
-    case dup2_x2:
-      frame->dup2X2();
-      break;
+  case Untable1: {
+    SwitchState* s = static_cast<SwitchState*>
+      (stack.peek(sizeof(SwitchState)));
 
-    case f2d: {
-      frame->pushLong(c->f2f(4, 8, frame->popInt()));
-    } break;
+    frame = s->frame();
 
-    case f2i: {
-      frame->pushInt(c->f2i(4, 4, frame->popInt()));
-    } break;
+    c->restoreState(s->state);
 
-    case f2l: {
-      frame->pushLong(c->f2i(4, 8, frame->popInt()));
-    } break;
+    Compiler::Operand* normalizedKey
+      = (s->bottom
+         ? c->sub(4, c->constant(s->bottom, Compiler::IntegerType), s->key)
+         : s->key);
 
-    case fadd: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+    Compiler::Operand* entry = c->memory
+      (frame->absoluteAddressOperand(s->start), Compiler::AddressType, 0,
+       normalizedKey, TargetBytesPerWord);
 
-      frame->pushInt(c->fadd(4, a, b));
-    } break;
+    c->jmp
+      (c->load
+       (TargetBytesPerWord, TargetBytesPerWord, context->bootContext
+        ? c->add
+        (TargetBytesPerWord, c->memory
+         (c->register_(t->arch->thread()), Compiler::AddressType,
+          TARGET_THREAD_CODEIMAGE), entry)
+        : entry,
+        TargetBytesPerWord));
 
-    case fcmpg: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+    s->state = c->saveState();
+  } goto switchloop;
 
-      if (floatBranch(t, frame, code, ip, 4, false, a, b, &newIp)) {
-        goto branch;
-      } else {
-        frame->pushInt
-          (c->call
-           (c->constant
-            (getThunk(t, compareFloatsGThunk), Compiler::AddressType),
-            0, 0, 4, Compiler::IntegerType, 2, a, b));
-      }
-    } break;
+  case Unswitch: {
+    SwitchState* s = static_cast<SwitchState*>
+      (stack.peek(sizeof(SwitchState)));
+    
+    frame = s->frame();
 
-    case fcmpl: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+    c->restoreState
+      (static_cast<SwitchState*>(stack.peek(sizeof(SwitchState)))->state);
+  } goto switchloop;
 
-      if (floatBranch(t, frame, code, ip, 4, true, a, b, &newIp)) {
-        goto branch;
-      } else {
-        frame->pushInt
-          (c->call
-           (c->constant
-            (getThunk(t, compareFloatsLThunk), Compiler::AddressType),
-            0, 0, 4, Compiler::IntegerType, 2, a, b));
-      }
-    } break;
+  case Unsubroutine: {
+    ip = stack.popValue();
+    unsigned start = stack.popValue();
+    frame = reinterpret_cast<Frame*>(stack.peek(sizeof(Frame)));
+    frame->endSubroutine(start);
+  } goto loop;
 
-    case fconst_0:
-      frame->pushInt(c->constant(floatToBits(0.0), Compiler::FloatType));
-      break;
-      
-    case fconst_1:
-      frame->pushInt(c->constant(floatToBits(1.0), Compiler::FloatType));
-      break;
-      
-    case fconst_2:
-      frame->pushInt(c->constant(floatToBits(2.0), Compiler::FloatType));
-      break;
+  default:
+    abort(t);
+  }
 
-    case fdiv: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+ switchloop: {
+    SwitchState* s = static_cast<SwitchState*>
+      (stack.peek(sizeof(SwitchState)));
 
-      frame->pushInt(c->fdiv(4, a, b));
-    } break;
+    if (s->index < s->count) {
+      ip = s->ipTable()[s->index++];
+      stack.pushValue(Unswitch);
+      goto start;
+    } else {
+      ip = s->defaultIp;
+      unsigned count = s->count * 4;
+      stack.pop(sizeof(SwitchState));
+      stack.pop(count);
+      frame = reinterpret_cast<Frame*>(stack.peek(sizeof(Frame)));
+      goto loop;
+    }
+  }
 
-    case fmul: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+ branch:
+  stack.pushValue(reinterpret_cast<uintptr_t>(c->saveState()));
+  stack.pushValue(ip);
+  stack.pushValue(Unbranch);
+  ip = newIp;
+  goto start;
+}
 
-      frame->pushInt(c->fmul(4, a, b));
-    } break;
+FILE* compileLog = 0;
 
-    case fneg: {
-      frame->pushInt(c->fneg(4, frame->popInt()));
-    } break;
+void
+logCompile(MyThread* t, const void* code, unsigned size, const char* class_,
+           const char* name, const char* spec);
 
-    case vm::frem: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+int
+resolveIpForwards(Context* context, int start, int end)
+{
+  if (start < 0) {
+    start = 0;
+  }
 
-      frame->pushInt(c->frem(4, a, b));   	
-    } break;
+  while (start < end and context->visitTable[start] == 0) {
+    ++ start;
+  }
+  
+  if (start >= end) {
+    return -1;
+  } else {
+    return start;
+  }
+}
 
-    case fsub: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+int
+resolveIpBackwards(Context* context, int start, int end)
+{
+  Thread* t = context->thread;
+  if (start >= static_cast<int>
+      (codeLength(t, methodCode(t, context->method))))
+  {
+    start = codeLength(t, methodCode(t, context->method));
+  } else {
+    while (start >= end and context->visitTable[start] == 0) {
+      -- start;
+    }
+  }
+  
+  if (start < end) {
+    return -1;
+  } else {
+    return start;
+  }
+}
 
-      frame->pushInt(c->fsub(4, a, b));
-    } break;
+object
+truncateIntArray(Thread* t, object array, unsigned length)
+{
+  expect(t, intArrayLength(t, array) > length);
 
-    case getfield:
-    case getstatic: {
-      uint16_t index = codeReadInt16(t, code, ip);
-        
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+  PROTECT(t, array);
 
-      PROTECT(t, reference);
+  object newArray = makeIntArray(t, length);
+  if (length) {
+    memcpy(&intArrayBody(t, newArray, 0), &intArrayBody(t, array, 0),
+           length * 4);
+  }
 
-      object field = resolveField(t, context->method, index - 1, false);
+  return newArray;
+}
 
-      if (LIKELY(field)) {
-        if ((fieldFlags(t, field) & ACC_VOLATILE)
-            and TargetBytesPerWord == 4
-            and (fieldCode(t, field) == DoubleField
-                 or fieldCode(t, field) == LongField))
-        {
-          PROTECT(t, field);
+object
+truncateArray(Thread* t, object array, unsigned length)
+{
+  expect(t, arrayLength(t, array) > length);
 
-          c->call
-            (c->constant
-             (getThunk(t, acquireMonitorForObjectThunk),
-              Compiler::AddressType),
-             0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
-             c->register_(t->arch->thread()),
-             frame->append(field));
-        }
+  PROTECT(t, array);
 
-        Compiler::Operand* table;
+  object newArray = makeArray(t, length);
+  if (length) {
+    memcpy(&arrayBody(t, newArray, 0), &arrayBody(t, array, 0),
+           length * BytesPerWord);
+  }
 
-        if (instruction == getstatic) {
-          checkField(t, field, true);
+  return newArray;
+}
 
-          PROTECT(t, field);
+object
+truncateLineNumberTable(Thread* t, object table, unsigned length)
+{
+  expect(t, lineNumberTableLength(t, table) > length);
 
-          if (classNeedsInit(t, fieldClass(t, field))) {
-            c->call
-              (c->constant
-               (getThunk(t, tryInitClassThunk), Compiler::AddressType),
-               0,
-               frame->trace(0, 0),
-               0,
-               Compiler::VoidType,
-               2, c->register_(t->arch->thread()),
-               frame->append(fieldClass(t, field)));
-          }
+  PROTECT(t, table);
 
-          table = frame->append(classStaticTable(t, fieldClass(t, field)));
-        } else {
-          checkField(t, field, false);
+  object newTable = makeLineNumberTable(t, length);
+  if (length) {
+    memcpy(&lineNumberTableBody(t, newTable, 0),
+           &lineNumberTableBody(t, table, 0),
+           length * sizeof(uint64_t));
+  }
 
-          table = frame->popObject();
+  return newTable;
+}
 
-          if (inTryBlock(t, code, ip - 3)) {
-            c->saveLocals();
-            frame->trace(0, 0);
-          }
-        }
+object
+translateExceptionHandlerTable(MyThread* t, Context* context, intptr_t start,
+                               intptr_t end)
+{
+  avian::codegen::Compiler* c = context->compiler;
 
-        switch (fieldCode(t, field)) {
-        case ByteField:
-        case BooleanField:
-          frame->pushInt
-            (c->load
-             (1, 1, c->memory
-              (table, Compiler::IntegerType, targetFieldOffset
-               (context, field), 0, 1), TargetBytesPerWord));
-          break;
+  object oldTable = codeExceptionHandlerTable
+    (t, methodCode(t, context->method));
 
-        case CharField:
-          frame->pushInt
-            (c->loadz
-             (2, 2, c->memory
-              (table, Compiler::IntegerType, targetFieldOffset
-               (context, field), 0, 1), TargetBytesPerWord));
-          break;
+  if (oldTable) {
+    PROTECT(t, oldTable);
 
-        case ShortField:
-          frame->pushInt
-            (c->load
-             (2, 2, c->memory
-              (table, Compiler::IntegerType, targetFieldOffset
-               (context, field), 0, 1), TargetBytesPerWord));
-          break;
+    unsigned length = exceptionHandlerTableLength(t, oldTable);
 
-        case FloatField:
-          frame->pushInt
-            (c->load
-             (4, 4, c->memory
-              (table, Compiler::FloatType, targetFieldOffset
-               (context, field), 0, 1), TargetBytesPerWord));
-          break;
+    object newIndex = makeIntArray(t, length * 3);
+    PROTECT(t, newIndex);
 
-        case IntField:
-          frame->pushInt
-            (c->load
-             (4, 4, c->memory
-              (table, Compiler::IntegerType, targetFieldOffset
-               (context, field), 0, 1), TargetBytesPerWord));
-          break;
+    object newTable = makeArray(t, length + 1);
+    PROTECT(t, newTable);
 
-        case DoubleField:
-          frame->pushLong
-            (c->load
-             (8, 8, c->memory
-              (table, Compiler::FloatType, targetFieldOffset
-               (context, field), 0, 1), 8));
-          break;
+    unsigned ni = 0;
+    for (unsigned oi = 0; oi < length; ++ oi) {
+      uint64_t oldHandler = exceptionHandlerTableBody
+        (t, oldTable, oi);
 
-        case LongField:
-          frame->pushLong
-            (c->load
-             (8, 8, c->memory
-              (table, Compiler::IntegerType, targetFieldOffset
-               (context, field), 0, 1), 8));
-          break;
+      int handlerStart = resolveIpForwards
+        (context, exceptionHandlerStart(oldHandler),
+         exceptionHandlerEnd(oldHandler));
 
-        case ObjectField:
-          frame->pushObject
-            (c->load
-             (TargetBytesPerWord, TargetBytesPerWord,
-              c->memory
-              (table, Compiler::ObjectType, targetFieldOffset
-               (context, field), 0, 1), TargetBytesPerWord));
-          break;
+      if (LIKELY(handlerStart >= 0)) {
+        assert(t, handlerStart < static_cast<int>
+               (codeLength(t, methodCode(t, context->method))));
 
-        default:
-          abort(t);
-        }
+        int handlerEnd = resolveIpBackwards
+          (context, exceptionHandlerEnd(oldHandler),
+           exceptionHandlerStart(oldHandler));
 
-        if (fieldFlags(t, field) & ACC_VOLATILE) {
-          if (TargetBytesPerWord == 4
-              and (fieldCode(t, field) == DoubleField
-                   or fieldCode(t, field) == LongField))
-          {
-            c->call
-              (c->constant
-               (getThunk(t, releaseMonitorForObjectThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
-               c->register_(t->arch->thread()),
-               frame->append(field));
-          } else {
-            c->loadBarrier();
-          }
-        }
-      } else {
-        int fieldCode = vm::fieldCode
-          (t, byteArrayBody(t, referenceSpec(t, reference), 0));
+        assert(t, handlerEnd >= 0);
+        assert(t, handlerEnd <= static_cast<int>
+               (codeLength(t, methodCode(t, context->method))));
+
+        intArrayBody(t, newIndex, ni * 3)
+          = c->machineIp(handlerStart)->value() - start;
 
-        object pair = makePair(t, context->method, reference);
+        intArrayBody(t, newIndex, (ni * 3) + 1)
+          = (handlerEnd == static_cast<int>
+             (codeLength(t, methodCode(t, context->method)))
+             ? end : c->machineIp(handlerEnd)->value()) - start;
 
-        unsigned rSize = resultSize(t, fieldCode);
-        Compiler::OperandType rType = operandTypeForFieldCode(t, fieldCode);
+        intArrayBody(t, newIndex, (ni * 3) + 2)
+          = c->machineIp(exceptionHandlerIp(oldHandler))->value() - start;
 
-        Compiler::Operand* result;
-        if (instruction == getstatic) {
-          result = c->call
-            (c->constant
-             (getThunk(t, getStaticFieldValueFromReferenceThunk),
-              Compiler::AddressType),
-             0, frame->trace(0, 0), rSize, rType, 2,
-             c->register_(t->arch->thread()), frame->append(pair));
+        object type;
+        if (exceptionHandlerCatchType(oldHandler)) {
+          type = resolveClassInPool
+            (t, context->method, exceptionHandlerCatchType(oldHandler) - 1);
         } else {
-          Compiler::Operand* instance = frame->popObject();
-
-          result = c->call
-            (c->constant
-             (getThunk(t, getFieldValueFromReferenceThunk),
-              Compiler::AddressType),
-             0, frame->trace(0, 0), rSize, rType, 3,
-             c->register_(t->arch->thread()), frame->append(pair),
-             instance);
+          type = 0;
         }
 
-        pushReturnValue(t, frame, fieldCode, result);
-      }
-    } break;
+        set(t, newTable, ArrayBody + ((ni + 1) * BytesPerWord), type);
 
-    case goto_: {
-      uint32_t offset = codeReadInt16(t, code, ip);
-      uint32_t newIp = (ip - 3) + offset;
-      assert(t, newIp < codeLength(t, code));
+        ++ ni;
+      }
+    }
 
-      c->jmp(frame->machineIp(newIp));
-      ip = newIp;
-    } break;
+    if (UNLIKELY(ni < length)) {
+      newIndex = truncateIntArray(t, newIndex, ni * 3);
+      newTable = truncateArray(t, newTable, ni + 1);
+    }
 
-    case goto_w: {
-      uint32_t offset = codeReadInt32(t, code, ip);
-      uint32_t newIp = (ip - 5) + offset;
-      assert(t, newIp < codeLength(t, code));
+    set(t, newTable, ArrayBody, newIndex);
 
-      c->jmp(frame->machineIp(newIp));
-      ip = newIp;
-    } break;
+    return newTable;
+  } else {
+    return 0;
+  }
+}
 
-    case i2b: {
-      frame->pushInt
-        (c->load(TargetBytesPerWord, 1, frame->popInt(), TargetBytesPerWord));
-    } break;
+unsigned
+coldLine(MyThread* t, object table, unsigned ip)
+{
+  unsigned length = lineNumberTableLength(t, table);
+  unsigned bestIp = 0;
+  unsigned line = 0;
+  for (unsigned i = 0; i < length; ++i) {
+    uint64_t entry = lineNumberTableBody(t, table, i);
+    if (lineNumberIp(entry) <= ip and lineNumberIp(entry) >= bestIp) {
+      bestIp = lineNumberIp(entry);
+      line = lineNumberLine(entry);
+    }
+  }
+  return line;
+}
 
-    case i2c: {
-      frame->pushInt
-        (c->loadz(TargetBytesPerWord, 2, frame->popInt(), TargetBytesPerWord));
-    } break;
+object
+translateLineNumberTable(MyThread* t, Context* context, intptr_t start)
+{
+  object oldTable = codeLineNumberTable(t, methodCode(t, context->method));
+  if (oldTable) {
+    PROTECT(t, oldTable);
 
-    case i2d: {
-      frame->pushLong(c->i2f(4, 8, frame->popInt()));
-    } break;
+    unsigned coldCount = 0;
+    for (avian::codegen::Compiler::ColdPath* p
+           = context->compiler->coldPaths(); p; p = p->next)
+    {
+      ++ coldCount;
+    }
 
-    case i2f: {
-      frame->pushInt(c->i2f(4, 4, frame->popInt()));
-    } break;
+    unsigned length = lineNumberTableLength(t, oldTable);
+    object newTable = makeLineNumberTable(t, length + coldCount);
+    unsigned ni = 0;
+    for (unsigned oi = 0; oi < length; ++oi) {
+      uint64_t oldLine = lineNumberTableBody(t, oldTable, oi);
 
-    case i2l:
-      frame->pushLong(c->load(TargetBytesPerWord, 4, frame->popInt(), 8));
-      break;
+      int ip = resolveIpForwards
+        (context, lineNumberIp(oldLine), oi + 1 < length
+         ? lineNumberIp(lineNumberTableBody(t, oldTable, oi + 1)) - 1
+         : lineNumberIp(oldLine) + 1);
 
-    case i2s: {
-      frame->pushInt
-        (c->load(TargetBytesPerWord, 2, frame->popInt(), TargetBytesPerWord));
-    } break;
-      
-    case iadd: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->add(4, a, b));
-    } break;
-      
-    case iand: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->and_(4, a, b));
-    } break;
+      if (LIKELY(ip >= 0)) {
+        lineNumberTableBody(t, newTable, ni++) = lineNumber
+          (context->compiler->machineIp(ip)->value() - start,
+           lineNumberLine(oldLine));
+      }
+    }
 
-    case iconst_m1:
-      frame->pushInt(c->constant(-1, Compiler::IntegerType));
-      break;
+    // out-of-line code follows everything else, so these entries keep
+    // the table sorted by offset:
+    for (avian::codegen::Compiler::ColdPath* p
+           = context->compiler->coldPaths(); p; p = p->next)
+    {
+      lineNumberTableBody(t, newTable, ni++) = lineNumber
+        (p->address->value() - start, coldLine(t, oldTable, p->logicalIp));
+    }
 
-    case iconst_0:
-      frame->pushInt(c->constant(0, Compiler::IntegerType));
-      break;
+    if (UNLIKELY(ni < length + coldCount)) {
+      newTable = truncateLineNumberTable(t, newTable, ni);      
+    }
 
-    case iconst_1:
-      frame->pushInt(c->constant(1, Compiler::IntegerType));
-      break;
+    return newTable;
+  } else {
+    return 0;
+  }
+}
 
-    case iconst_2:
-      frame->pushInt(c->constant(2, Compiler::IntegerType));
-      break;
+void
+printSet(uintptr_t* m, unsigned limit)
+{
+  if (limit) {
+    for (unsigned i = 0; i < 32; ++i) {
+      if ((*m >> i) & 1) {
+        fprintf(stderr, "1");
+      } else {
+        fprintf(stderr, "_");
+      }
+    }
+  }
+}
 
-    case iconst_3:
-      frame->pushInt(c->constant(3, Compiler::IntegerType));
-      break;
+void
+calculateTryCatchRoots(Context* context, SubroutinePath* subroutinePath,
+                       uintptr_t* roots, unsigned mapSize, unsigned start,
+                       unsigned end)
+{
+  memset(roots, 0xFF, mapSize * BytesPerWord);
 
-    case iconst_4:
-      frame->pushInt(c->constant(4, Compiler::IntegerType));
-      break;
+  if (DebugFrameMaps) {
+    fprintf(stderr, "calculate try/catch roots from %d to %d", start, end);
+    if (subroutinePath) {
+      fprintf(stderr, " ");
+      print(subroutinePath);
+    }
+    fprintf(stderr, "\n");
+  }
 
-    case iconst_5:
-      frame->pushInt(c->constant(5, Compiler::IntegerType));
-      break;
+  for (TraceElement* te = context->traceLog; te; te = te->next) {
+    if (te->ip >= start and te->ip < end) {
+      uintptr_t* traceRoots = 0;
+      if (subroutinePath == 0) {
+        traceRoots = te->map;
+        te->watch = true;
+      } else {
+        for (SubroutineTrace* t = te->subroutineTrace; t; t = t->next) {
+          if (t->path == subroutinePath) {
+            traceRoots = t->map;
+            t->watch = true;
+            break;
+          }
+        }        
+      }
 
-    case idiv: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+      if (traceRoots) {
+        if (DebugFrameMaps) {
+          fprintf(stderr, "   use roots at ip %3d: ", te->ip);
+          printSet(traceRoots, mapSize);
+          fprintf(stderr, "\n");
+        }
 
-      if (inTryBlock(t, code, ip - 1)) {
-        c->saveLocals();
-        frame->trace(0, 0);
+        for (unsigned wi = 0; wi < mapSize; ++wi) {
+          roots[wi] &= traceRoots[wi];
+        }
+      } else {
+        if (DebugFrameMaps) {
+          fprintf(stderr, "  skip roots at ip %3d\n", te->ip);
+        }
       }
+    }
+  }
 
-      frame->pushInt(c->div(4, a, b));
+  if (DebugFrameMaps) {
+    fprintf(stderr, "result roots          : ");
+    printSet(roots, mapSize);
+    fprintf(stderr, "\n");
+  }
+}
+
+unsigned
+calculateFrameMaps(MyThread* t, Context* context, uintptr_t* originalRoots,
+                   unsigned eventIndex, SubroutinePath* subroutinePath = 0,
+                   uintptr_t* resultRoots = 0)
+{
+  // for each instruction with more than one predecessor, and for each
+  // stack position, determine if there exists a path to that
+  // instruction such that there is not an object pointer left at that
+  // stack position (i.e. it is uninitialized or contains primitive
+  // data).
+
+  unsigned mapSize = frameMapSizeInWords(t, context->method);
+
+  THREAD_RUNTIME_ARRAY(t, uintptr_t, roots, mapSize);
+  if (originalRoots) {
+    memcpy(RUNTIME_ARRAY_BODY(roots), originalRoots, mapSize * BytesPerWord);
+  } else {
+    memset(RUNTIME_ARRAY_BODY(roots), 0, mapSize * BytesPerWord);
+  }
+
+  int32_t ip = -1;
+
+  // invariant: for each stack position, roots contains a zero at that
+  // position if there exists some path to the current instruction
+  // such that there is definitely not an object pointer at that
+  // position.  Otherwise, roots contains a one at that position,
+  // meaning either all known paths result in an object pointer at
+  // that position, or the contents of that position are as yet
+  // unknown.
+
+  unsigned length = context->eventLog.length();
+  while (eventIndex < length) {
+    Event e = static_cast<Event>(context->eventLog.get(eventIndex++));
+    switch (e) {
+    case PushContextEvent: {
+      eventIndex = calculateFrameMaps
+        (t, context, RUNTIME_ARRAY_BODY(roots), eventIndex, subroutinePath,
+         resultRoots);
     } break;
 
-    case if_acmpeq:
-    case if_acmpne: {
-      uint32_t offset = codeReadInt16(t, code, ip);
-      newIp = (ip - 3) + offset;
-      assert(t, newIp < codeLength(t, code));
-        
-      Compiler::Operand* a = frame->popObject();
-      Compiler::Operand* b = frame->popObject();
-      Compiler::Operand* target = frame->machineIp(newIp);
-
-      if (instruction == if_acmpeq) {
-        c->jumpIfEqual(TargetBytesPerWord, a, b, target);
-      } else {
-        c->jumpIfNotEqual(TargetBytesPerWord, a, b, target);
-      }
-    } goto branch;
+    case PopContextEvent:
+      goto exit;
 
-    case if_icmpeq:
-    case if_icmpne:
-    case if_icmpgt:
-    case if_icmpge:
-    case if_icmplt:
-    case if_icmple: {
-      uint32_t offset = codeReadInt16(t, code, ip);
-      newIp = (ip - 3) + offset;
-      assert(t, newIp < codeLength(t, code));
-        
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      Compiler::Operand* target = frame->machineIp(newIp);
+    case IpEvent: {
+      ip = context->eventLog.get2(eventIndex);
+      eventIndex += 2;
 
-      switch (instruction) {
-      case if_icmpeq:
-        c->jumpIfEqual(4, a, b, target);
-        break;
-      case if_icmpne:
-        c->jumpIfNotEqual(4, a, b, target);
-        break;
-      case if_icmpgt:
-        c->jumpIfGreater(4, a, b, target);
-        break;
-      case if_icmpge:
-        c->jumpIfGreaterOrEqual(4, a, b, target);
-        break;
-      case if_icmplt:
-        c->jumpIfLess(4, a, b, target);
-        break;
-      case if_icmple:
-        c->jumpIfLessOrEqual(4, a, b, target);
-        break;
-      default:
-        abort(t);
+      if (DebugFrameMaps) {
+        fprintf(stderr, "       roots at ip %3d: ", ip);
+        printSet(RUNTIME_ARRAY_BODY(roots), mapSize);
+        fprintf(stderr, "\n");
       }
-    } goto branch;
-
-    case ifeq:
-    case ifne:
-    case ifgt:
-    case ifge:
-    case iflt:
-    case ifle: {
-      uint32_t offset = codeReadInt16(t, code, ip);
-      newIp = (ip - 3) + offset;
-      assert(t, newIp < codeLength(t, code));
 
-      Compiler::Operand* target = frame->machineIp(newIp);
+      uintptr_t* tableRoots
+        = (subroutinePath ? subroutinePath->rootTable : context->rootTable)
+        + (ip * mapSize);
 
-      Compiler::Operand* a = c->constant(0, Compiler::IntegerType);
-      Compiler::Operand* b = frame->popInt();
+      if (context->visitTable[ip] > 1) {
+        for (unsigned wi = 0; wi < mapSize; ++wi) {
+          uintptr_t newRoots = tableRoots[wi] & RUNTIME_ARRAY_BODY(roots)[wi];
 
-      switch (instruction) {
-      case ifeq:
-        c->jumpIfEqual(4, a, b, target);
-        break;
-      case ifne:
-        c->jumpIfNotEqual(4, a, b, target);
-        break;
-      case ifgt:
-        c->jumpIfGreater(4, a, b, target);
-        break;
-      case ifge:
-        c->jumpIfGreaterOrEqual(4, a, b, target);
-        break;
-      case iflt:
-        c->jumpIfLess(4, a, b, target);
-        break;
-      case ifle:
-        c->jumpIfLessOrEqual(4, a, b, target);
-        break;
-      default:
-        abort(t);
-      }
-    } goto branch;
+          if ((eventIndex == length
+               or context->eventLog.get(eventIndex) == PopContextEvent)
+              and newRoots != tableRoots[wi])
+          {
+            if (DebugFrameMaps) {
+              fprintf(stderr, "dirty roots!\n");
+            }
 
-    case ifnull:
-    case ifnonnull: {
-      uint32_t offset = codeReadInt16(t, code, ip);
-      newIp = (ip - 3) + offset;
-      assert(t, newIp < codeLength(t, code));
+            context->dirtyRoots = true;
+          }
 
-      Compiler::Operand* a = c->constant(0, Compiler::ObjectType);
-      Compiler::Operand* b = frame->popObject();
-      Compiler::Operand* target = frame->machineIp(newIp);
+          tableRoots[wi] = newRoots;
+          RUNTIME_ARRAY_BODY(roots)[wi] &= tableRoots[wi];
+        }
 
-      if (instruction == ifnull) {
-        c->jumpIfEqual(TargetBytesPerWord, a, b, target);
+        if (DebugFrameMaps) {
+          fprintf(stderr, " table roots at ip %3d: ", ip);
+          printSet(tableRoots, mapSize);
+          fprintf(stderr, "\n");
+        }
       } else {
-        c->jumpIfNotEqual(TargetBytesPerWord, a, b, target);
+        memcpy(tableRoots, RUNTIME_ARRAY_BODY(roots), mapSize * BytesPerWord);
       }
-    } goto branch;
+    } break;
 
-    case iinc: {
-      uint8_t index = codeBody(t, code, ip++);
-      int8_t count = codeBody(t, code, ip++);
+    case MarkEvent: {
+      unsigned i = context->eventLog.get2(eventIndex);
+      eventIndex += 2;
 
-      storeLocal
-        (context, 1,
-         c->add
-         (4, c->constant(count, Compiler::IntegerType),
-          loadLocal(context, 1, index)),
-         index);
+      markBit(RUNTIME_ARRAY_BODY(roots), i);
     } break;
 
-    case iload:
-    case fload:
-      frame->loadInt(codeBody(t, code, ip++));
-      break;
+    case ClearEvent: {
+      unsigned i = context->eventLog.get2(eventIndex);
+      eventIndex += 2;
 
-    case iload_0:
-    case fload_0:
-      frame->loadInt(0);
-      break;
+      clearBit(RUNTIME_ARRAY_BODY(roots), i);
+    } break;
 
-    case iload_1:
-    case fload_1:
-      frame->loadInt(1);
-      break;
+    case PushExceptionHandlerEvent: {
+      unsigned start = context->eventLog.get2(eventIndex);
+      eventIndex += 2;
+      unsigned end = context->eventLog.get2(eventIndex);
+      eventIndex += 2;
 
-    case iload_2:
-    case fload_2:
-      frame->loadInt(2);
-      break;
+      if (context->subroutineTable and context->subroutineTable[start]) {
+        Subroutine* s = context->subroutineTable[start];
+        unsigned originalEventIndex = eventIndex;
 
-    case iload_3:
-    case fload_3:
-      frame->loadInt(3);
-      break;
+        for (SubroutineCall* c = s->calls; c; c = c->next) {
+          for (SubroutinePath* p = c->paths; p; p = p->listNext) {
+            calculateTryCatchRoots
+              (context, p, RUNTIME_ARRAY_BODY(roots), mapSize, start, end);
 
-    case imul: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->mul(4, a, b));
-    } break;
+            eventIndex = calculateFrameMaps
+              (t, context, RUNTIME_ARRAY_BODY(roots), originalEventIndex, p);
+          }
+        }
+      } else {
+        calculateTryCatchRoots
+          (context, 0, RUNTIME_ARRAY_BODY(roots), mapSize, start, end);
 
-    case ineg: {
-      frame->pushInt(c->neg(4, frame->popInt()));
+        eventIndex = calculateFrameMaps
+          (t, context, RUNTIME_ARRAY_BODY(roots), eventIndex, 0);
+      }
     } break;
 
-    case instanceof: {
-      uint16_t index = codeReadInt16(t, code, ip);
+    case TraceEvent: {
+      TraceElement* te; context->eventLog.get(eventIndex, &te, BytesPerWord);
+      if (DebugFrameMaps) {
+        fprintf(stderr, " trace roots at ip %3d: ", ip);
+        printSet(RUNTIME_ARRAY_BODY(roots), mapSize);
+        if (subroutinePath) {
+          fprintf(stderr, " ");
+          print(subroutinePath);
+        }
+        fprintf(stderr, "\n");
+      }
+        
+      uintptr_t* map;
+      bool watch;
+      if (subroutinePath == 0) {
+        map = te->map;
+        watch = te->watch;
+      } else {
+        SubroutineTrace* trace = 0;
+        for (SubroutineTrace* t = te->subroutineTrace; t; t = t->next) {
+          if (t->path == subroutinePath) {
+            trace = t;
+            break;
+          }
+        }
 
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+        if (trace == 0) {
+          te->subroutineTrace = trace = new
+            (context->zone.allocate
+             (sizeof(SubroutineTrace) + (mapSize * BytesPerWord)))
+            SubroutineTrace(subroutinePath, te->subroutineTrace, mapSize);
 
-      PROTECT(t, reference);
+          ++ te->subroutineTraceCount;
+        }
 
-      object class_ = resolveClassInPool(t, context->method, index - 1, false);
+        map = trace->map;
+        watch = trace->watch;
+      }
 
-      Compiler::Operand* instance = frame->popObject();
+      for (unsigned wi = 0; wi < mapSize; ++wi) {
+        uintptr_t v = RUNTIME_ARRAY_BODY(roots)[wi];
+
+        if (watch and map[wi] != v) {
+          if (DebugFrameMaps) {
+            fprintf(stderr, "dirty roots due to trace watch!\n");
+          }
+
+          context->dirtyRoots = true;
+        }
 
-      object argument;
-      Thunk thunk;
-      if (LIKELY(class_)) {
-        argument = class_;
-        thunk = instanceOf64Thunk;
-      } else {
-        argument = makePair(t, context->method, reference);
-        thunk = instanceOfFromReferenceThunk;
+        map[wi] = v;
       }
 
-      frame->pushInt
-        (c->call
-         (c->constant(getThunk(t, thunk), Compiler::AddressType),
-          0, frame->trace(0, 0), 4, Compiler::IntegerType,
-          3, c->register_(t->arch->thread()), frame->append(argument),
-          instance));
+      eventIndex += BytesPerWord;
     } break;
 
-    case invokeinterface: {
-      context->leaf = false;
+    case PushSubroutineEvent: {
+      SubroutineCall* call;
+      context->eventLog.get(eventIndex, &call, BytesPerWord);
+      eventIndex += BytesPerWord;
 
-      uint16_t index = codeReadInt16(t, code, ip);
-      ip += 2;
+      unsigned nextIndex = context->eventLog.get2(eventIndex);
 
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+      eventIndex = nextIndex;
 
-      PROTECT(t, reference);
+      SubroutinePath* path = 0;
+      for (SubroutinePath* p = call->paths; p; p = p->listNext) {
+        if (p->stackNext == subroutinePath) {
+          path = p;
+          break;
+        }
+      }
 
-      object target = resolveMethod(t, context->method, index - 1, false);
+      if (path == 0) {
+        path = new(&context->zone)
+          SubroutinePath(call, subroutinePath,
+                         makeRootTable(t, &(context->zone), context->method));
+      }
 
-      object argument;
-      Thunk thunk;
-      unsigned parameterFootprint;
-      int returnCode;
-      bool tailCall;
-      if (LIKELY(target)) {
-        checkMethod(t, target, false);
+      THREAD_RUNTIME_ARRAY(t, uintptr_t, subroutineRoots, mapSize);
 
-        argument = target;
-        thunk = findInterfaceMethodFromInstanceThunk;
-        parameterFootprint = methodParameterFootprint(t, target);
-        returnCode = methodReturnCode(t, target);
-        tailCall = isTailCall(t, code, ip, context->method, target);
-      } else {
-        argument = makePair(t, context->method, reference);
-        thunk = findInterfaceMethodFromInstanceAndReferenceThunk;
-        parameterFootprint = methodReferenceParameterFootprint
-          (t, reference, false);
-        returnCode = methodReferenceReturnCode(t, reference);
-        tailCall = isReferenceTailCall
-          (t, code, ip, context->method, reference);
-      }
+      calculateFrameMaps
+        (t, context, RUNTIME_ARRAY_BODY(roots), call->subroutine->logIndex,
+         path, RUNTIME_ARRAY_BODY(subroutineRoots));
 
-      unsigned rSize = resultSize(t, returnCode);
+      for (unsigned wi = 0; wi < mapSize; ++wi) {
+        RUNTIME_ARRAY_BODY(roots)[wi]
+          &= RUNTIME_ARRAY_BODY(subroutineRoots)[wi];
+      }      
+    } break;
 
-      Compiler::Operand* result = c->stackCall
-        (c->call
-         (c->constant(getThunk(t, thunk), Compiler::AddressType),
-          0,
-          frame->trace(0, 0),
-          TargetBytesPerWord,
-          Compiler::AddressType,
-          3, c->register_(t->arch->thread()), frame->append(argument),
-          c->peek(1, parameterFootprint - 1)),
-         tailCall ? Compiler::TailJump : 0,
-         frame->trace(0, 0),
-         rSize,
-         operandTypeForFieldCode(t, returnCode),
-         parameterFootprint);
+    case PopSubroutineEvent:
+      eventIndex = static_cast<unsigned>(-1);
+      goto exit;
 
-      frame->pop(parameterFootprint);
+    default: abort(t);
+    }
+  }
 
-      if (rSize) {
-        pushReturnValue(t, frame, returnCode, result);
+ exit:
+  if (resultRoots and ip != -1) {
+    if (DebugFrameMaps) {
+      fprintf(stderr, "result roots at ip %3d: ", ip);
+      printSet(RUNTIME_ARRAY_BODY(roots), mapSize);
+      if (subroutinePath) {
+        fprintf(stderr, " ");
+        print(subroutinePath);
       }
-    } break;
+      fprintf(stderr, "\n");
+    }
 
-    case invokespecial: {
-      context->leaf = false;
+    memcpy(resultRoots, RUNTIME_ARRAY_BODY(roots), mapSize * BytesPerWord);
+  }
 
-      uint16_t index = codeReadInt16(t, code, ip);
+  return eventIndex;
+}
 
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+int
+compareTraceElementPointers(const void* va, const void* vb)
+{
+  TraceElement* a = *static_cast<TraceElement* const*>(va);
+  TraceElement* b = *static_cast<TraceElement* const*>(vb);
+  if (a->address->value() > b->address->value()) {
+    return 1;
+  } else if (a->address->value() < b->address->value()) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
 
-      PROTECT(t, reference);
+unsigned
+simpleFrameMapTableSize(MyThread* t, object method, object map)
+{
+  int size = frameMapSizeInBits(t, method);
+  return ceilingDivide(intArrayLength(t, map) * size, 32 + size);
+}
 
-      object target = resolveMethod(t, context->method, index - 1, false);
+uint8_t*
+finish(MyThread* t, CodeAllocator* allocator, avian::codegen::Assembler* a, const char* name,
+       unsigned length)
+{
+  uint8_t* start = static_cast<uint8_t*>
+    (allocator->allocate(length, TargetBytesPerWord));
 
-      if (LIKELY(target)) {
-        object class_ = methodClass(t, context->method);
-        if (isSpecialMethod(t, target, class_)) {
-          target = findVirtualMethod(t, target, classSuper(t, class_));
-        }
+  a->setDestination(start);
+  a->write();
 
-        checkMethod(t, target, false);
+  logCompile(t, start, length, 0, name, 0);
 
-        bool tailCall = isTailCall(t, code, ip, context->method, target);
+  return start;
+}
 
-        if (UNLIKELY(methodAbstract(t, target))) {
-          compileDirectAbstractInvoke
-            (t, frame, getMethodAddressThunk, target, tailCall);
-        } else {
-          compileDirectInvoke(t, frame, target, tailCall);
-        }
-      } else {
-        compileDirectReferenceInvoke
-          (t, frame, findSpecialMethodFromReferenceThunk, reference, false,
-           isReferenceTailCall(t, code, ip, context->method, reference));
-      }
-    } break;
+void
+setBit(int32_t* dst, unsigned index)
+{
+  dst[index / 32] |= static_cast<int32_t>(1) << (index % 32);
+}
 
-    case invokestatic: {
-      context->leaf = false;
+void
+clearBit(int32_t* dst, unsigned index)
+{
+  dst[index / 32] &= ~(static_cast<int32_t>(1) << (index % 32));
+}
 
-      uint16_t index = codeReadInt16(t, code, ip);
+void
+copyFrameMap(int32_t* dst, uintptr_t* src, unsigned mapSizeInBits,
+             unsigned offset, TraceElement* p,
+             SubroutinePath* subroutinePath)
+{
+  if (DebugFrameMaps) {
+    fprintf(stderr, "  orig roots at ip %3d: ", p->ip);
+    printSet(src, ceilingDivide(mapSizeInBits, BitsPerWord));
+    print(subroutinePath);
+    fprintf(stderr, "\n");
 
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+    fprintf(stderr, " final roots at ip %3d: ", p->ip);
+  }
 
-      PROTECT(t, reference);
+  for (unsigned j = 0; j < p->argumentIndex; ++j) {
+    if (getBit(src, j)) {
+      if (DebugFrameMaps) {
+        fprintf(stderr, "1");
+      }
+      setBit(dst, offset + j);
+    } else {
+      if (DebugFrameMaps) {
+        fprintf(stderr, "_");
+      }
+      clearBit(dst, offset + j);
+    }
+  }
 
-      object target = resolveMethod(t, context->method, index - 1, false);
+  if (DebugFrameMaps) {
+    print(subroutinePath);
+    fprintf(stderr, "\n");
+  }
+}
 
-      if (LIKELY(target)) {
-        checkMethod(t, target, true);
+class FrameMapTableHeader {
+ public:
+  FrameMapTableHeader(unsigned indexCount):
+    indexCount(indexCount)
+  { }
 
-        if (not intrinsic(t, frame, target)) {
-          bool tailCall = isTailCall(t, code, ip, context->method, target);
-          compileDirectInvoke(t, frame, target, tailCall);
-        }
-      } else {
-        compileDirectReferenceInvoke
-          (t, frame, findStaticMethodFromReferenceThunk, reference, true,
-           isReferenceTailCall(t, code, ip, context->method, reference));
-      }
-    } break;
+  unsigned indexCount;
+};
 
-    case invokevirtual: {
-      context->leaf = false;
+class FrameMapTableIndexElement {
+ public:
+  FrameMapTableIndexElement(int offset, unsigned base, unsigned path):
+    offset(offset),
+    base(base),
+    path(path)
+  { }
 
-      uint16_t index = codeReadInt16(t, code, ip);
+  int offset;
+  unsigned base;
+  unsigned path;
+};
+
+class FrameMapTablePath {
+ public:
+  FrameMapTablePath(unsigned stackIndex, unsigned elementCount, unsigned next):
+    stackIndex(stackIndex),
+    elementCount(elementCount),
+    next(next)
+  { }
 
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+  unsigned stackIndex;
+  unsigned elementCount;
+  unsigned next;
+  int32_t elements[0];
+};
 
-      PROTECT(t, reference);
+int
+compareInt32s(const void* va, const void* vb)
+{
+  return *static_cast<int32_t const*>(va) - *static_cast<int32_t const*>(vb);
+}
 
-      object target = resolveMethod(t, context->method, index - 1, false);
+int
+compare(SubroutinePath* a, SubroutinePath* b)
+{
+  if (a->stackNext) {
+    int d = compare(a->stackNext, b->stackNext);
+    if (d) return d;
+  }
+  int64_t av = a->call->returnAddress->value();
+  int64_t bv = b->call->returnAddress->value();
+  if (av > bv) {
+    return 1;
+  } else if (av < bv) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
 
-      if (LIKELY(target)) {
-        checkMethod(t, target, false);
-         
-        if (not intrinsic(t, frame, target)) {
-          bool tailCall = isTailCall(t, code, ip, context->method, target);
+int
+compareSubroutineTracePointers(const void* va, const void* vb)
+{
+  return compare((*static_cast<SubroutineTrace* const*>(va))->path,
+                 (*static_cast<SubroutineTrace* const*>(vb))->path);
+}
 
-          if (LIKELY(methodVirtual(t, target))) {
-            unsigned parameterFootprint = methodParameterFootprint(t, target);
+object
+makeGeneralFrameMapTable(MyThread* t, Context* context, uint8_t* start,
+                         TraceElement** elements, unsigned elementCount,
+                         unsigned pathFootprint, unsigned mapCount)
+{
+  unsigned mapSize = frameMapSizeInBits(t, context->method);
+  unsigned indexOffset = sizeof(FrameMapTableHeader);
+  unsigned mapsOffset = indexOffset
+    + (elementCount * sizeof(FrameMapTableIndexElement));
+  unsigned pathsOffset = mapsOffset + (ceilingDivide(mapCount * mapSize, 32) * 4);
 
-            unsigned offset = TargetClassVtable
-              + (methodOffset(t, target) * TargetBytesPerWord);
+  object table = makeByteArray(t, pathsOffset + pathFootprint);
+  
+  int8_t* body = &byteArrayBody(t, table, 0);
+  new (body) FrameMapTableHeader(elementCount);
+ 
+  unsigned nextTableIndex = pathsOffset;
+  unsigned nextMapIndex = 0;
+  for (unsigned i = 0; i < elementCount; ++i) {
+    TraceElement* p = elements[i];
+    unsigned mapBase = nextMapIndex;
 
-            Compiler::Operand* instance = c->peek(1, parameterFootprint - 1);
+    unsigned pathIndex;
+    if (p->subroutineTrace) {
+      FrameMapTablePath* previous = 0;
+      Subroutine* subroutine = p->subroutineTrace->path->call->subroutine;
+      for (Subroutine* s = subroutine; s; s = s->stackNext) {
+        if (s->tableIndex == 0) {
+          unsigned pathObjectSize = sizeof(FrameMapTablePath)
+            + (sizeof(int32_t) * s->callCount);
 
-            unsigned rSize = resultSize(t, methodReturnCode(t, target));
+          assert(t, nextTableIndex + pathObjectSize
+                 <= byteArrayLength(t, table));
 
-            Compiler::Operand* result = c->stackCall
-              (c->memory
-               (c->and_
-                (TargetBytesPerWord, c->constant
-                 (TargetPointerMask, Compiler::IntegerType),
-                 c->memory(instance, Compiler::ObjectType, 0, 0, 1)),
-                Compiler::ObjectType, offset, 0, 1),
-               tailCall ? Compiler::TailJump : 0,
-               frame->trace(0, 0),
-               rSize,
-               operandTypeForFieldCode(t, methodReturnCode(t, target)),
-               parameterFootprint);
+          s->tableIndex = nextTableIndex;
+          
+          nextTableIndex += pathObjectSize;
 
-            frame->pop(parameterFootprint);
+          FrameMapTablePath* current = new (body + s->tableIndex)
+            FrameMapTablePath
+            (s->stackIndex, s->callCount,
+             s->stackNext ? s->stackNext->tableIndex : 0);
 
-            if (rSize) {
-              pushReturnValue(t, frame, methodReturnCode(t, target), result);
-            }
-          } else {
-            // OpenJDK generates invokevirtual calls to private methods
-            // (e.g. readObject and writeObject for serialization), so
-            // we must handle such cases here.
+          unsigned i = 0;
+          for (SubroutineCall* c = subroutine->calls; c; c = c->next) {
+            assert(t, i < s->callCount);
 
-            compileDirectInvoke(t, frame, target, tailCall);          
+            current->elements[i++]
+              = static_cast<intptr_t>(c->returnAddress->value())
+              - reinterpret_cast<intptr_t>(start);
           }
-        }
-      } else {
-        PROTECT(t, reference);
+          assert(t, i == s->callCount);
 
-        object pair = makePair(t, context->method, reference);
+          qsort(current->elements, s->callCount, sizeof(int32_t),
+                compareInt32s);
 
-        compileReferenceInvoke
-          (t, frame, c->call
-           (c->constant(getThunk(t, findVirtualMethodFromReferenceThunk),
-                        Compiler::AddressType),
-            0,
-            frame->trace(0, 0),
-            TargetBytesPerWord,
-            Compiler::AddressType,
-            3, c->register_(t->arch->thread()), frame->append(pair),
-            c->peek(1, methodReferenceParameterFootprint
-                    (t, reference, false) - 1)),
-           reference, false, isReferenceTailCall
-           (t, code, ip, context->method, reference));
+          if (previous) {
+            previous->next = s->tableIndex;
+          }
+
+          previous = current;
+        } else {
+          break;
+        }
       }
-    } break;
 
-    case ior: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->or_(4, a, b));
-    } break;
+      pathIndex = subroutine->tableIndex;
 
-    case irem: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
+      THREAD_RUNTIME_ARRAY
+        (t, SubroutineTrace*, traces, p->subroutineTraceCount);
 
-      if (inTryBlock(t, code, ip - 1)) {
-        c->saveLocals();
-        frame->trace(0, 0);
+      unsigned i = 0;
+      for (SubroutineTrace* trace = p->subroutineTrace;
+           trace; trace = trace->next)
+      {
+        assert(t, i < p->subroutineTraceCount);
+        RUNTIME_ARRAY_BODY(traces)[i++] = trace;
       }
+      assert(t, i == p->subroutineTraceCount);
 
-      frame->pushInt(c->rem(4, a, b));
-    } break;
+      qsort(RUNTIME_ARRAY_BODY(traces), p->subroutineTraceCount,
+            sizeof(SubroutineTrace*), compareSubroutineTracePointers);
 
-    case ireturn:
-    case freturn: {
-      handleExit(t, frame);
-      c->return_(4, frame->popInt());
-    } goto next;
+      for (unsigned i = 0; i < p->subroutineTraceCount; ++i) {
+        assert(t, mapsOffset + ceilingDivide(nextMapIndex + mapSize, 32) * 4
+               <= pathsOffset);
 
-    case ishl: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->shl(4, a, b));
-    } break;
+        copyFrameMap(reinterpret_cast<int32_t*>(body + mapsOffset),
+                     RUNTIME_ARRAY_BODY(traces)[i]->map, mapSize,
+                     nextMapIndex, p, RUNTIME_ARRAY_BODY(traces)[i]->path);
 
-    case ishr: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->shr(4, a, b));
-    } break;
+        nextMapIndex += mapSize;
+      }
+    } else {
+      pathIndex = 0;
 
-    case istore:
-    case fstore:
-      frame->storeInt(codeBody(t, code, ip++));
-      break;
+      assert(t, mapsOffset + ceilingDivide(nextMapIndex + mapSize, 32) * 4
+             <= pathsOffset);
 
-    case istore_0:
-    case fstore_0:
-      frame->storeInt(0);
-      break;
+      copyFrameMap(reinterpret_cast<int32_t*>(body + mapsOffset), p->map,
+                   mapSize, nextMapIndex, p, 0);
+      
+      nextMapIndex += mapSize;
+    }
 
-    case istore_1:
-    case fstore_1:
-      frame->storeInt(1);
-      break;
+    unsigned elementIndex = indexOffset
+      + (i * sizeof(FrameMapTableIndexElement));
 
-    case istore_2:
-    case fstore_2:
-      frame->storeInt(2);
-      break;
+    assert(t, elementIndex + sizeof(FrameMapTableIndexElement) <= mapsOffset);
 
-    case istore_3:
-    case fstore_3:
-      frame->storeInt(3);
-      break;
+    new (body + elementIndex) FrameMapTableIndexElement
+      (static_cast<intptr_t>(p->address->value())
+       - reinterpret_cast<intptr_t>(start), mapBase, pathIndex);
+  }
 
-    case isub: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->sub(4, a, b));
-    } break;
+  assert(t, nextMapIndex == mapCount * mapSize);
 
-    case iushr: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->ushr(4, a, b));
-    } break;
+  return table;
+}
 
-    case ixor: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popInt();
-      frame->pushInt(c->xor_(4, a, b));
-    } break;
+object
+makeSimpleFrameMapTable(MyThread* t, Context* context, uint8_t* start, 
+                        TraceElement** elements, unsigned elementCount)
+{
+  unsigned mapSize = frameMapSizeInBits(t, context->method);
+  object table = makeIntArray
+    (t, elementCount + ceilingDivide(elementCount * mapSize, 32));
+
+  assert(t, intArrayLength(t, table) == elementCount
+         + simpleFrameMapTableSize(t, context->method, table));
+
+  for (unsigned i = 0; i < elementCount; ++i) {
+    TraceElement* p = elements[i];
 
-    case jsr:
-    case jsr_w: {
-      uint32_t thisIp;
+    intArrayBody(t, table, i) = static_cast<intptr_t>(p->address->value())
+      - reinterpret_cast<intptr_t>(start);
 
-      if (instruction == jsr) {
-        uint32_t offset = codeReadInt16(t, code, ip);
-        thisIp = ip - 3;
-        newIp = thisIp + offset;
-      } else {
-        uint32_t offset = codeReadInt32(t, code, ip);
-        thisIp = ip - 5;
-        newIp = thisIp + offset;
-      }
+    assert(t, elementCount + ceilingDivide((i + 1) * mapSize, 32)
+           <= intArrayLength(t, table));
 
-      assert(t, newIp < codeLength(t, code));
+    if (mapSize) {
+      copyFrameMap(&intArrayBody(t, table, elementCount), p->map,
+                   mapSize, i * mapSize, p, 0);
+    }
+  }
 
-      unsigned start = frame->startSubroutine(newIp, c->machineIp(ip));
+  return table;
+}
 
-      c->jmp(frame->machineIp(newIp));
+// Symbol kinds used to describe object pool entries and other
+// references to heap objects in a code cache record:
+enum CacheSymbol {
+  NullSymbol,
+  ClassSymbol,
+  StringSymbol,
+  MethodSymbol,
+  FieldSymbol,
+  ReferenceSymbol,
+  StaticTableSymbol
+};
 
-      stack.pushValue(start);
-      stack.pushValue(ip);
-      stack.pushValue(Unsubroutine);
-      ip = newIp;
-    } goto start;
+const uint32_t NullCacheString = 0xFFFFFFFF;
 
-    case l2d: {
-      frame->pushLong(c->i2f(8, 8, frame->popLong()));
-    } break;
+uint32_t
+cacheKey(Thread* t, object method)
+{
+  object class_ = methodClass(t, method);
+  object name = methodName(t, method);
+  object spec = methodSpec(t, method);
+
+  uint32_t h = hash(&byteArrayBody(t, className(t, class_), 0),
+                    byteArrayLength(t, className(t, class_)) - 1);
+  h = (h * 31) + hash(&byteArrayBody(t, name, 0),
+                      byteArrayLength(t, name) - 1);
+  return (h * 31) + hash(&byteArrayBody(t, spec, 0),
+                         byteArrayLength(t, spec) - 1);
+}
 
-    case l2f: {
-      frame->pushInt(c->i2f(8, 4, frame->popLong()));
-    } break;
+class CacheReader {
+ public:
+  CacheReader(const uint8_t* p, unsigned size):
+    p(p), end(p + size), ok(true)
+  { }
 
-    case l2i:
-      frame->pushInt(c->load(8, 8, frame->popLong(), TargetBytesPerWord));
-      break;
+  unsigned remaining() {
+    return end - p;
+  }
 
-    case ladd: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->add(8, a, b));
-    } break;
+  const uint8_t* read(unsigned size) {
+    if (ok and size <= remaining()) {
+      const uint8_t* r = p;
+      p += size;
+      return r;
+    } else {
+      ok = false;
+      return 0;
+    }
+  }
 
-    case land: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->and_(8, a, b));
-    } break;
+  unsigned read1() {
+    const uint8_t* r = read(1);
+    return r ? *r : 0;
+  }
 
-    case lcmp: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+  unsigned read2() {
+    uint16_t v = 0;
+    const uint8_t* r = read(2);
+    if (r) memcpy(&v, r, 2);
+    return v;
+  }
 
-      if (integerBranch(t, frame, code, ip, 8, a, b, &newIp)) {
-        goto branch;
-      } else {
-        frame->pushInt
-          (c->call
-           (c->constant
-            (getThunk(t, compareLongsThunk), Compiler::AddressType),
-            0, 0, 4, Compiler::IntegerType, 4,
-            static_cast<Compiler::Operand*>(0), a,
-            static_cast<Compiler::Operand*>(0), b));
-      }
-    } break;
+  unsigned read4() {
+    uint32_t v = 0;
+    const uint8_t* r = read(4);
+    if (r) memcpy(&v, r, 4);
+    return v;
+  }
 
-    case lconst_0:
-      frame->pushLong(c->constant(0, Compiler::IntegerType));
-      break;
+  // Reads a count of items which each occupy at least the specified
+  // number of bytes, failing if there can't be that many left.
+  unsigned readCount(unsigned minimumSize) {
+    unsigned count = read4();
+    if (count > remaining() / minimumSize) {
+      ok = false;
+      return 0;
+    }
+    return count;
+  }
 
-    case lconst_1:
-      frame->pushLong(c->constant(1, Compiler::IntegerType));
-      break;
+  void skipString() {
+    unsigned length = read4();
+    if (length != NullCacheString) {
+      read(length);
+    }
+  }
 
-    case ldc:
-    case ldc_w: {
-      uint16_t index;
+  bool matches(Thread* t, object array) {
+    unsigned length = read4();
+    if (array == 0) {
+      return ok and length == NullCacheString;
+    } else if (length != byteArrayLength(t, array) - 1) {
+      return false;
+    } else {
+      const uint8_t* body = read(length);
+      return body and memcmp(body, &byteArrayBody(t, array, 0), length) == 0;
+    }
+  }
 
-      if (instruction == ldc) {
-        index = codeBody(t, code, ip++);
-      } else {
-        index = codeReadInt16(t, code, ip);
-      }
+  object readByteArray(Thread* t) {
+    unsigned length = read4();
+    if (length == NullCacheString) {
+      return 0;
+    }
 
-      object pool = codePool(t, code);
+    const uint8_t* body = read(length);
+    if (body == 0) {
+      return 0;
+    }
 
-      if (singletonIsObject(t, pool, index - 1)) {
-        object v = singletonObject(t, pool, index - 1);
+    object array = makeByteArray(t, length + 1);
+    memcpy(&byteArrayBody(t, array, 0), body, length);
+    return array;
+  }
 
-        loadMemoryBarrier();  
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok;
+};
 
-        if (objectClass(t, v) == type(t, Machine::ReferenceType)) {
-          object reference = v;
-          PROTECT(t, reference);
+bool
+cacheEntryMatches(Thread* t, CodeCacheFile::Entry* e, object method)
+{
+  CacheReader r(e->body, e->size);
+  r.read(8);
 
-          v = resolveClassInPool(t, context->method, index - 1, false);
+  return r.matches(t, className(t, methodClass(t, method)))
+    and r.matches(t, methodName(t, method))
+    and r.matches(t, methodSpec(t, method));
+}
 
-          if (UNLIKELY(v == 0)) {
-            frame->pushObject
-              (c->call
-               (c->constant
-                (getThunk(t, getJClassFromReferenceThunk),
-                 Compiler::AddressType),
-                0,
-                frame->trace(0, 0),
-                TargetBytesPerWord,
-                Compiler::ObjectType,
-                2, c->register_(t->arch->thread()),
-                frame->append(makePair(t, context->method, reference))));
-          }
-        }
+void
+writeCacheString(Vector* v, Thread* t, object array)
+{
+  if (array) {
+    unsigned length = byteArrayLength(t, array) - 1;
+    v->append4(length);
+    v->append(&byteArrayBody(t, array, 0), length);
+  } else {
+    v->append4(NullCacheString);
+  }
+}
 
-        if (v) {
-          if (objectClass(t, v) == type(t, Machine::ClassType)) {
-            frame->pushObject
-              (c->call
-               (c->constant
-                (getThunk(t, getJClass64Thunk), Compiler::AddressType),
-                0,
-                frame->trace(0, 0),
-                TargetBytesPerWord,
-                Compiler::ObjectType,
-                2, c->register_(t->arch->thread()), frame->append(v)));
-          } else {
-            frame->pushObject(frame->append(v));
-          }
-        }
-      } else {
-        frame->pushInt
-          (c->constant
-           (singletonValue(t, pool, index - 1),
-            singletonBit(t, pool, poolSize(t, pool), index - 1)
-            ? Compiler::FloatType : Compiler::IntegerType));
+// Adds a class and its superclasses to the set of classes whose
+// identity and layout the cached code depends on.
+void
+noteCacheDependency(Vector* dependencies, Thread* t, object class_)
+{
+  for (; class_; class_ = classSuper(t, class_)) {
+    for (unsigned i = 0; i < dependencies->length(); i += BytesPerWord) {
+      if (reinterpret_cast<object>(dependencies->getAddress(i)) == class_) {
+        // ...and therefore its superclasses are there as well
+        return;
       }
-    } break;
+    }
 
-    case ldc2_w: {
-      uint16_t index = codeReadInt16(t, code, ip);
+    dependencies->appendAddress(class_);
+  }
+}
 
-      object pool = codePool(t, code);
+void
+writeCacheMember(Vector* v, Vector* dependencies, Thread* t, object class_,
+                 object name, object spec)
+{
+  writeCacheString(v, t, className(t, class_));
+  writeCacheString(v, t, name);
+  writeCacheString(v, t, spec);
+  noteCacheDependency(dependencies, t, class_);
+}
 
-      uint64_t v;
-      memcpy(&v, &singletonValue(t, pool, index - 1), 8);
-      frame->pushLong
-        (c->constant
-         (v, singletonBit(t, pool, poolSize(t, pool), index - 1)
-          ? Compiler::FloatType : Compiler::IntegerType));
-    } break;
+// Writes a symbolic description of the specified object, returning
+// false if it is not something we know how to find again.
+bool
+writeCacheSymbol(Vector* v, Vector* dependencies, Thread* t, object o)
+{
+  if (o == 0) {
+    v->append(NullSymbol);
+  } else if (objectClass(t, o) == type(t, Machine::ClassType)) {
+    v->append(ClassSymbol);
+    writeCacheString(v, t, className(t, o));
+    noteCacheDependency(dependencies, t, o);
+  } else if (objectClass(t, o) == type(t, Machine::StringType)) {
+    unsigned length = stringLength(t, o);
+    THREAD_RUNTIME_ARRAY(t, uint16_t, chars, length + 1);
+    stringChars(t, o, RUNTIME_ARRAY_BODY(chars));
+
+    v->append(StringSymbol);
+    v->append4(length);
+    v->append(RUNTIME_ARRAY_BODY(chars), length * 2);
+  } else if (objectClass(t, o) == type(t, Machine::MethodType)) {
+    v->append(MethodSymbol);
+    writeCacheMember(v, dependencies, t, methodClass(t, o), methodName(t, o),
+                     methodSpec(t, o));
+  } else if (objectClass(t, o) == type(t, Machine::FieldType)) {
+    v->append(FieldSymbol);
+    writeCacheMember(v, dependencies, t, fieldClass(t, o), fieldName(t, o),
+                     fieldSpec(t, o));
+  } else if (objectClass(t, o) == type(t, Machine::PairType)
+             and pairFirst(t, o)
+             and objectClass(t, pairFirst(t, o))
+             == type(t, Machine::MethodType)
+             and pairSecond(t, o)
+             and objectClass(t, pairSecond(t, o))
+             == type(t, Machine::ReferenceType))
+  { object method = pairFirst(t, o);
+    object reference = pairSecond(t, o);
+
+    v->append(ReferenceSymbol);
+    writeCacheMember(v, dependencies, t, methodClass(t, method),
+                     methodName(t, method), methodSpec(t, method));
+    writeCacheString(v, t, referenceClass(t, reference));
+    writeCacheString(v, t, referenceName(t, reference));
+    writeCacheString(v, t, referenceSpec(t, reference));
+  } else if (objectClass(t, o) == type(t, Machine::SingletonType)
+             and singletonCount(t, o)
+             and singletonIsObject(t, o, 0)
+             and singletonObject(t, o, 0)
+             and objectClass(t, singletonObject(t, o, 0))
+             == type(t, Machine::ClassType)
+             and classStaticTable(t, singletonObject(t, o, 0)) == o)
+  {
+    v->append(StaticTableSymbol);
+    writeCacheString(v, t, className(t, singletonObject(t, o, 0)));
+    noteCacheDependency(dependencies, t, singletonObject(t, o, 0));
+  } else {
+    return false;
+  }
 
-    case ldiv_: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+  return true;
+}
 
-      if (inTryBlock(t, code, ip - 1)) {
-        c->saveLocals();
-        frame->trace(0, 0);
-      }
+// Saves a description of the method just compiled in the specified
+// context to the code cache file, provided that it was placed where
+// a later run can put it back and that everything it refers to can
+// be described symbolically.  The code bytes must not have been
+// patched since they were written.
+void
+recordCachedCode(MyThread* t, Context* context, object bytecode,
+                 uint8_t* start, unsigned codeSize, unsigned total,
+                 unsigned poolFootprint)
+{
+  CodeCacheFile* file = codeCacheFile(t);
+  object method = context->method;
+  object code = methodCode(t, method);
+  unsigned size = pad(total + poolFootprint, TargetBytesPerWord);
 
-      frame->pushLong(c->div(8, a, b));
-    } break;
+  if (classHash(t, methodClass(t, method)) == 0
+      or not file->covers(start, size))
+  {
+    return;
+  }
 
-    case lload:
-    case dload:
-      frame->loadLong(codeBody(t, code, ip++));
-      break;
+  Vector v(t->m->system, t->m->heap, 1024);
+  Vector dependencies(t->m->system, t->m->heap, 256);
 
-    case lload_0:
-    case dload_0:
-      frame->loadLong(0);
-      break;
+  v.append4(start - file->base);
+  v.append4(size);
 
-    case lload_1:
-    case dload_1:
-      frame->loadLong(1);
-      break;
+  writeCacheString(&v, t, className(t, methodClass(t, method)));
+  writeCacheString(&v, t, methodName(t, method));
+  writeCacheString(&v, t, methodSpec(t, method));
 
-    case lload_2:
-    case dload_2:
-      frame->loadLong(2);
-      break;
+  v.append4(codeSize);
+  v.append4(total);
+  v.append4(poolFootprint);
+  v.append2(codeMaxStack(t, bytecode));
+  v.append2(codeMaxLocals(t, bytecode));
+  v.append(start, total);
 
-    case lload_3:
-    case dload_3:
-      frame->loadLong(3);
-      break;
+  noteCacheDependency(&dependencies, t, methodClass(t, method));
 
-    case lmul: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->mul(8, a, b));
-    } break;
+  v.append4(context->objectPoolCount);
+  for (PoolElement* p = context->objectPool; p; p = p->next) {
+    if (not writeCacheSymbol(&v, &dependencies, t, p->target)) {
+      return;
+    }
+  }
 
-    case lneg:
-      frame->pushLong(c->neg(8, frame->popLong()));
-      break;
+  object ehTable = codeExceptionHandlerTable(t, code);
+  if (ehTable) {
+    object index = arrayBody(t, ehTable, 0);
+    unsigned length = arrayLength(t, ehTable) - 1;
+    v.append4(length);
+    for (unsigned i = 0; i < length; ++i) {
+      v.append4(intArrayBody(t, index, i * 3));
+      v.append4(intArrayBody(t, index, (i * 3) + 1));
+      v.append4(intArrayBody(t, index, (i * 3) + 2));
+      writeCacheSymbol(&v, &dependencies, t, arrayBody(t, ehTable, i + 1));
+    }
+  } else {
+    v.append4(NullCacheString);
+  }
 
-    case lookupswitch: {
-      int32_t base = ip - 1;
+  object lineTable = codeLineNumberTable(t, code);
+  if (lineTable) {
+    unsigned length = lineNumberTableLength(t, lineTable);
+    v.append4(length);
+    v.append(&lineNumberTableBody(t, lineTable, 0), length * 8);
+  } else {
+    v.append4(NullCacheString);
+  }
 
-      ip = (ip + 3) & ~3; // pad to four byte boundary
+  object map = codePool(t, code);
+  if (map == 0) {
+    v.append(0);
+  } else if (objectClass(t, map) == type(t, Machine::IntArrayType)) {
+    v.append(1);
+    v.append4(intArrayLength(t, map));
+    v.append(&intArrayBody(t, map, 0), intArrayLength(t, map) * 4);
+  } else {
+    v.append(2);
+    v.append4(byteArrayLength(t, map));
+    v.append(&byteArrayBody(t, map, 0), byteArrayLength(t, map));
+  }
 
-      Compiler::Operand* key = frame->popInt();
-    
-      uint32_t defaultIp = base + codeReadInt32(t, code, ip);
-      assert(t, defaultIp < codeLength(t, code));
+  unsigned callCount = 0;
+  for (TraceElement* p = context->traceLog; p; p = p->next) {
+    if (p->address and p->target) {
+      ++ callCount;
+    }
+  }
+
+  v.append4(callCount);
+  for (TraceElement* p = context->traceLog; p; p = p->next) {
+    if (p->address and p->target) {
+      v.append4(p->address->value() - reinterpret_cast<intptr_t>(file->base));
+      v.append4(p->flags);
+      writeCacheSymbol(&v, &dependencies, t, p->target);
+    }
+  }
+
+  // the code may also depend on the layout of anything else the
+  // method's constant pool has been resolved to, e.g. via inlining:
+  object pool = codePool(t, bytecode);
+  for (unsigned i = 0; i < poolSize(t, pool); ++i) {
+    if (singletonIsObject(t, pool, i)) {
+      object o = singletonObject(t, pool, i);
+      if (o == 0) {
+        // ignore
+      } else if (objectClass(t, o) == type(t, Machine::ClassType)) {
+        noteCacheDependency(&dependencies, t, o);
+      } else if (objectClass(t, o) == type(t, Machine::MethodType)) {
+        noteCacheDependency(&dependencies, t, methodClass(t, o));
+      } else if (objectClass(t, o) == type(t, Machine::FieldType)) {
+        noteCacheDependency(&dependencies, t, fieldClass(t, o));
+      }
+    }
+  }
 
-      int32_t pairCount = codeReadInt32(t, code, ip);
+  unsigned dependencyCount = dependencies.length() / BytesPerWord;
+  v.append4(dependencyCount);
+  for (unsigned i = 0; i < dependencyCount; ++i) {
+    object c = reinterpret_cast<object>
+      (dependencies.getAddress(i * BytesPerWord));
 
-      if (pairCount) {
-        Compiler::Operand* default_ = frame->addressOperand
-          (frame->addressPromise(c->machineIp(defaultIp)));
+    writeCacheString(&v, t, className(t, c));
+    v.append4(classHash(t, c));
+    v.append(classNeedsInit(t, c) ? 0 : 1);
+  }
 
-        avian::codegen::Promise* start = 0;
-        uint32_t* ipTable = static_cast<uint32_t*>
-          (stack.push(sizeof(uint32_t) * pairCount));
-        for (int32_t i = 0; i < pairCount; ++i) {
-          unsigned index = ip + (i * 8);
-          int32_t key = codeReadInt32(t, code, index);
-          uint32_t newIp = base + codeReadInt32(t, code, index);
-          assert(t, newIp < codeLength(t, code));
+  // any record we read for this method but didn't use is now stale:
+  uint32_t key = cacheKey(t, method);
+  for (unsigned i = file->find(key);
+       i < file->entryCount and file->entries[i].key == key; ++i)
+  {
+    CodeCacheFile::Entry* e = file->entries + i;
+    if (not e->linked and cacheEntryMatches(t, e, method)) {
+      e->dropped = true;
+    }
+  }
 
-          ipTable[i] = newIp;
+  file->add(v.data, v.length(), key);
+}
 
-          avian::codegen::Promise* p = c->poolAppend(key);
-          if (i == 0) {
-            start = p;
-          }
-          c->poolAppendPromise
-            (frame->addressPromise(c->machineIp(newIp)));
-        }
-        assert(t, start);
+unsigned
+objectPoolSize(unsigned count)
+{
+  return FixedSizeOfArray + ((count + 1) * BytesPerWord);
+}
 
-        Compiler::Operand* address = c->call
-          (c->constant(getThunk(t, lookUpAddressThunk), Compiler::AddressType),
-           0, 0, TargetBytesPerWord, Compiler::AddressType,
-           4, key, frame->absoluteAddressOperand(start),
-           c->constant(pairCount, Compiler::IntegerType), default_);
+unsigned
+objectPoolFootprint(Thread* t, unsigned count)
+{
+  return pad(t->m->heap->fixedFootprint
+             (ceilingDivide(objectPoolSize(count), BytesPerWord), true),
+             BytesPerWord);
+}
 
-        c->jmp
-          (context->bootContext ? c->add
-           (TargetBytesPerWord, c->memory
-            (c->register_(t->arch->thread()), Compiler::AddressType,
-             TARGET_THREAD_CODEIMAGE), address)
-           : address);
+// Creates an immortal object pool for count objects in the specified
+// memory, which is normally just past a method's code and constants.
+object
+makeObjectPool(MyThread* t, uint8_t* memory, unsigned footprint,
+               unsigned count)
+{
+  FixedAllocator poolAllocator(t->m->system, memory, footprint);
 
-        new (stack.push(sizeof(SwitchState))) SwitchState
-          (c->saveState(), pairCount, defaultIp, 0, 0, 0, 0);
+  object pool = allocate3
+    (t, &poolAllocator, Machine::ImmortalAllocation, objectPoolSize(count),
+     true);
 
-        goto switchloop;
-      } else {
-        // a switch statement with no cases, apparently
-        c->jmp(frame->machineIp(defaultIp));
-        ip = defaultIp;
-      }
-    } break;
+  initArray(t, pool, count + 1);
+  mark(t, pool, 0);
 
-    case lor: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->or_(8, a, b));
-    } break;
+  set(t, pool, ArrayBody, root(t, ObjectPools));
+  setRoot(t, ObjectPools, pool);
 
-    case lrem: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
+  return pool;
+}
 
-      if (inTryBlock(t, code, ip - 1)) {
-        c->saveLocals();
-        frame->trace(0, 0);
-      }
+object
+finish(MyThread* t, CodeAllocator* allocator, Context* context)
+{
+  avian::codegen::Compiler* c = context->compiler;
 
-      frame->pushLong(c->rem(8, a, b));
-    } break;
+  if (false) {
+    logCompile
+      (t, 0, 0,
+       reinterpret_cast<const char*>
+       (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
+       reinterpret_cast<const char*>
+       (&byteArrayBody(t, methodName(t, context->method), 0)),
+       reinterpret_cast<const char*>
+       (&byteArrayBody(t, methodSpec(t, context->method), 0)));
+  }
 
-    case lreturn:
-    case dreturn: {
-      handleExit(t, frame);
-      c->return_(8, frame->popLong());
-    } goto next;
+  // for debugging:
+  if (false and
+      ::strcmp
+      (reinterpret_cast<const char*>
+       (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
+       "java/lang/System") == 0 and
+      ::strcmp
+      (reinterpret_cast<const char*>
+       (&byteArrayBody(t, methodName(t, context->method), 0)),
+       "<clinit>") == 0)
+  {
+    trap();
+  }
 
-    case lshl: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->shl(8, a, b));
-    } break;
+  // todo: this is a CPU-intensive operation, so consider doing it
+  // earlier before we've acquired the global class lock to improve
+  // parallelism (the downside being that it may end up being a waste
+  // of cycles if another thread compiles the same method in parallel,
+  // which might be mitigated by fine-grained, per-method locking):
+  c->compile(context->leaf ? 0 : stackOverflowThunk(t),
+             TARGET_THREAD_STACKLIMIT);
 
-    case lshr: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->shr(8, a, b));
-    } break;
+  // we must acquire the class lock here at the latest
+ 
+  unsigned codeSize = c->resolve
+    (allocator->base + allocator->offset);
 
-    case lstore:
-    case dstore:
-      frame->storeLong(codeBody(t, code, ip++));
-      break;
+  unsigned total = pad(codeSize, TargetBytesPerWord)
+    + pad(c->poolSize(), TargetBytesPerWord);
 
-    case lstore_0:
-    case dstore_0:
-      frame->storeLong(0);
-      break;
+  // unless the sweeper may reclaim this code later, the object pool
+  // is allocated as an immortal object directly after the code:
+  bool sweep = allocator->sweep and context->bootContext == 0;
 
-    case lstore_1:
-    case dstore_1:
-      frame->storeLong(1);
-      break;
+  unsigned poolFootprint = (context->objectPool and not sweep)
+    ? objectPoolFootprint(t, context->objectPoolCount) : 0;
 
-    case lstore_2:
-    case dstore_2:
-      frame->storeLong(2);
-      break;
+  target_uintptr_t* code = static_cast<target_uintptr_t*>
+    (allocator->allocate(total + poolFootprint, TargetBytesPerWord));
+  uint8_t* start = reinterpret_cast<uint8_t*>(code);
 
-    case lstore_3:
-    case dstore_3:
-      frame->storeLong(3);
-      break;
+  c->setDestination(start);
 
-    case lsub: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->sub(8, a, b));
-    } break;
+  context->executableAllocator = allocator;
+  context->executableStart = code;
+  context->executableSize = pad(total + poolFootprint, TargetBytesPerWord);
 
-    case lushr: {
-      Compiler::Operand* a = frame->popInt();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->ushr(8, a, b));
-    } break;
+  object pool = 0;
+  PROTECT(t, pool);
 
-    case lxor: {
-      Compiler::Operand* a = frame->popLong();
-      Compiler::Operand* b = frame->popLong();
-      frame->pushLong(c->xor_(8, a, b));
-    } break;
+  if (context->objectPool) {
+    if (sweep) {
+      pool = allocate3
+        (t, t->m->heap, Machine::FixedAllocation,
+         objectPoolSize(context->objectPoolCount), true);
 
-    case monitorenter: {
-      Compiler::Operand* target = frame->popObject();
-      c->call
-        (c->constant
-         (getThunk(t, acquireMonitorForObjectThunk), Compiler::AddressType),
-         0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
-         c->register_(t->arch->thread()), target);
-    } break;
+      initArray(t, pool, context->objectPoolCount + 1);
+      mark(t, pool, 0);
+    } else {
+      pool = makeObjectPool
+        (t, start + total, poolFootprint, context->objectPoolCount);
+    }
 
-    case monitorexit: {
-      Compiler::Operand* target = frame->popObject();
-      c->call
-        (c->constant
-         (getThunk(t, releaseMonitorForObjectThunk), Compiler::AddressType),
-         0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
-         c->register_(t->arch->thread()), target);
-    } break;
+    unsigned i = 1;
+    for (PoolElement* p = context->objectPool; p; p = p->next) {
+      unsigned offset = ArrayBody + ((i++) * BytesPerWord);
 
-    case multianewarray: {
-      uint16_t index = codeReadInt16(t, code, ip);
-      uint8_t dimensions = codeBody(t, code, ip++);
+      p->address = reinterpret_cast<uintptr_t>(pool) + offset;
 
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+      set(t, pool, offset, p->target);
+    }
+  }
 
-      PROTECT(t, reference);
+  c->write();
 
-      object class_ = resolveClassInPool(t, context->method, index - 1, false);
+  BootContext* bc = context->bootContext;
+  if (bc) {
+    for (avian::codegen::DelayedPromise* p = bc->addresses;
+         p != bc->addressSentinal;
+         p = p->next)
+    {
+      p->basis = new(bc->zone) avian::codegen::ResolvedPromise(p->basis->value());
+    }
+  }
 
-      object argument;
-      Thunk thunk;
-      if (LIKELY(class_)) {
-        argument = class_;
-        thunk = makeMultidimensionalArrayThunk;
-      } else {
-        argument = makePair(t, context->method, reference);
-        thunk = makeMultidimensionalArrayFromReferenceThunk;
-      }
+  object bytecode = methodCode(t, context->method);
+  PROTECT(t, bytecode);
 
-      unsigned offset
-        = localOffset
-        (t, localSize(t, context->method) + c->topOfStack(), context->method)
-        + t->arch->frameReturnAddressSize();
+  { avian::codegen::Compiler::ColdPath* cold = c->coldPaths();
+    object newExceptionHandlerTable = translateExceptionHandlerTable
+      (t, context, reinterpret_cast<intptr_t>(start),
+       cold ? cold->address->value()
+       : reinterpret_cast<intptr_t>(start) + codeSize);
 
-      Compiler::Operand* result = c->call
-        (c->constant
-         (getThunk(t, thunk), Compiler::AddressType),
-         0,
-         frame->trace(0, 0),
-         TargetBytesPerWord,
-         Compiler::ObjectType,
-         4, c->register_(t->arch->thread()), frame->append(argument),
-         c->constant(dimensions, Compiler::IntegerType),
-         c->constant(offset, Compiler::IntegerType));
+    PROTECT(t, newExceptionHandlerTable);
 
-      frame->pop(dimensions);
-      frame->pushObject(result);
-    } break;
+    object newLineNumberTable = translateLineNumberTable
+      (t, context, reinterpret_cast<intptr_t>(start));
 
-    case new_: {
-      uint16_t index = codeReadInt16(t, code, ip);
-        
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+    object code = makeCode
+      (t, 0, newExceptionHandlerTable, newLineNumberTable,
+       reinterpret_cast<uintptr_t>(start), codeSize,
+       codeMaxStack(t, bytecode), codeMaxLocals(t, bytecode), 0);
 
-      PROTECT(t, reference);
+    set(t, context->method, MethodCode, code);
+  }
+
+  if (context->traceLogCount) {
+    THREAD_RUNTIME_ARRAY(t, TraceElement*, elements, context->traceLogCount);
+    unsigned index = 0;
+    unsigned pathFootprint = 0;
+    unsigned mapCount = 0;
+    for (TraceElement* p = context->traceLog; p; p = p->next) {
+      assert(t, index < context->traceLogCount);
+
+      if (p->address) {
+        SubroutineTrace* trace = p->subroutineTrace;
+        unsigned myMapCount = 1;
+        if (trace) {
+          for (Subroutine* s = trace->path->call->subroutine;
+               s; s = s->stackNext)
+          {
+            unsigned callCount = s->callCount;
+            myMapCount *= callCount;
+            if (not s->visited) {
+              s->visited = true;
+              pathFootprint += sizeof(FrameMapTablePath)
+                + (sizeof(int32_t) * callCount);
+            }
+          }
+        }
+      
+        mapCount += myMapCount;
 
-      object class_ = resolveClassInPool(t, context->method, index - 1, false);
+        RUNTIME_ARRAY_BODY(elements)[index++] = p;
 
-      object argument;
-      Thunk thunk;
-      if (LIKELY(class_)) {
-        argument = class_;
-        if (classVmFlags(t, class_) & (WeakReferenceFlag | HasFinalizerFlag)) {
-          thunk = makeNewGeneral64Thunk;
-        } else {
-          thunk = makeNew64Thunk;
+        if (p->target) {
+          insertCallNode
+            (t, makeCallNode
+             (t, p->address->value(), p->target, p->flags, 0));
         }
-      } else {
-        argument = makePair(t, context->method, reference);
-        thunk = makeNewFromReferenceThunk;
       }
+    }
 
-      frame->pushObject
-        (c->call
-         (c->constant(getThunk(t, thunk), Compiler::AddressType),
-          0,
-          frame->trace(0, 0),
-          TargetBytesPerWord,
-          Compiler::ObjectType,
-          2, c->register_(t->arch->thread()), frame->append(argument)));
-    } break;
-
-    case newarray: {
-      uint8_t type = codeBody(t, code, ip++);
+    qsort(RUNTIME_ARRAY_BODY(elements), index,
+          sizeof(TraceElement*), compareTraceElementPointers);
 
-      Compiler::Operand* length = frame->popInt();
+    object map;
+    if (pathFootprint) {
+      map = makeGeneralFrameMapTable
+        (t, context, start, RUNTIME_ARRAY_BODY(elements), index, pathFootprint,
+         mapCount);
+    } else {
+      map = makeSimpleFrameMapTable
+        (t, context, start, RUNTIME_ARRAY_BODY(elements), index);
+    }
 
-      frame->pushObject
-        (c->call
-         (c->constant(getThunk(t, makeBlankArrayThunk), Compiler::AddressType),
-          0,
-          frame->trace(0, 0),
-          TargetBytesPerWord,
-          Compiler::ObjectType,
-          3, c->register_(t->arch->thread()),
-          c->constant(type, Compiler::IntegerType), length));
-    } break;
+    set(t, methodCode(t, context->method), CodePool, map);
+  }
 
-    case nop: break;
+  if (context->bootContext == 0 and codeCacheFile(t)->recording) {
+    recordCachedCode
+      (t, context, bytecode, start, codeSize, total, poolFootprint);
+  }
 
-    case pop_:
-      frame->pop(1);
-      break;
+  logCompile
+    (t, start, codeSize,
+     reinterpret_cast<const char*>
+     (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
+     reinterpret_cast<const char*>
+     (&byteArrayBody(t, methodName(t, context->method), 0)),
+     reinterpret_cast<const char*>
+     (&byteArrayBody(t, methodSpec(t, context->method), 0)));
 
-    case pop2:
-      frame->pop(2);
-      break;
+  // for debugging:
+  if (false and
+      ::strcmp
+      (reinterpret_cast<const char*>
+       (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
+       "java/lang/System") == 0 and
+      ::strcmp
+      (reinterpret_cast<const char*>
+       (&byteArrayBody(t, methodName(t, context->method), 0)),
+       "<clinit>") == 0)
+  {
+    trap();
+  }
+#if !defined(AVIAN_AOT_ONLY)
+  syncInstructionCache(start, codeSize);
+#endif
 
-    case putfield:
-    case putstatic: {
-      uint16_t index = codeReadInt16(t, code, ip);
-    
-      object reference = singletonObject
-        (t, codePool(t, methodCode(t, context->method)), index - 1);
+  return pool;
+}
 
-      PROTECT(t, reference);
+void
+compile(MyThread* t, Context* context)
+{
+  avian::codegen::Compiler* c = context->compiler;
 
-      object field = resolveField(t, context->method, index - 1, false);
+  if (context->bootContext == 0) {
+    analyzeEscapes(t, context);
+  }
 
-      if (LIKELY(field)) {
-        int fieldCode = vm::fieldCode(t, field);
+  analyzeRanges(t, context);
 
-        object staticTable = 0;
+//   fprintf(stderr, "compiling %s.%s%s\n",
+//           &byteArrayBody(t, className(t, methodClass(t, context->method)), 0),
+//           &byteArrayBody(t, methodName(t, context->method), 0),
+//           &byteArrayBody(t, methodSpec(t, context->method), 0));
 
-        if (instruction == putstatic) {
-          checkField(t, field, true);
+  unsigned footprint = methodParameterFootprint(t, context->method);
+  unsigned locals = localSize(t, context->method);
+  c->init(codeLength(t, methodCode(t, context->method)), footprint, locals,
+          alignedFrameSize(t, context->method));
 
-          if (classNeedsInit(t, fieldClass(t, field))) {
-            PROTECT(t, field);
+  THREAD_RUNTIME_ARRAY(t, uint8_t, stackMap,
+                codeMaxStack(t, methodCode(t, context->method)));
+  Frame frame(context, RUNTIME_ARRAY_BODY(stackMap));
 
-            c->call
-              (c->constant
-               (getThunk(t, tryInitClassThunk), Compiler::AddressType),
-               0,
-               frame->trace(0, 0),
-               0,
-               Compiler::VoidType,
-               2, c->register_(t->arch->thread()),
-               frame->append(fieldClass(t, field)));
-          }
+  unsigned index = methodParameterFootprint(t, context->method);
+  if ((methodFlags(t, context->method) & ACC_STATIC) == 0) {
+    frame.set(--index, Frame::Object);
+    c->initLocal(1, index, Compiler::ObjectType);
+  }
 
-          staticTable = classStaticTable(t, fieldClass(t, field));      
-        } else {
-          checkField(t, field, false);
+  for (MethodSpecIterator it
+         (t, reinterpret_cast<const char*>
+          (&byteArrayBody(t, methodSpec(t, context->method), 0)));
+       it.hasNext();)
+  {
+    switch (*it.next()) {
+    case 'L':
+    case '[':
+      frame.set(--index, Frame::Object);
+      c->initLocal(1, index, Compiler::ObjectType);
+      break;
+      
+    case 'J':
+      frame.set(--index, Frame::Long);
+      frame.set(--index, Frame::Long);
+      c->initLocal(2, index, Compiler::IntegerType);
+      break;
 
-          if (inTryBlock(t, code, ip - 3)) {
-            c->saveLocals();
-            frame->trace(0, 0);
-          }
-        }
+    case 'D':
+      frame.set(--index, Frame::Long);
+      frame.set(--index, Frame::Long);
+      c->initLocal(2, index, Compiler::FloatType);
+      break;
+      
+    case 'F':
+      frame.set(--index, Frame::Integer);
+      c->initLocal(1, index, Compiler::FloatType);
+      break;
+      
+    default:
+      frame.set(--index, Frame::Integer);
+      c->initLocal(1, index, Compiler::IntegerType);
+      break;
+    }
+  }
 
-        if (fieldFlags(t, field) & ACC_VOLATILE) {
-          if (TargetBytesPerWord == 4
-              and (fieldCode == DoubleField or fieldCode == LongField))
-          {
-            PROTECT(t, field);
+  handleEntrance(t, &frame);
 
-            c->call
-              (c->constant
-               (getThunk(t, acquireMonitorForObjectThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
-               c->register_(t->arch->thread()), frame->append(field));
-          } else {
-            c->storeStoreBarrier();
-          }
-        }
+  Compiler::State* state = c->saveState();
 
-        Compiler::Operand* value = popField(t, frame, fieldCode);
+  compile(t, &frame, 0);
 
-        Compiler::Operand* table;
+  context->dirtyRoots = false;
+  unsigned eventIndex = calculateFrameMaps(t, context, 0, 0);
 
-        if (instruction == putstatic) {
-          PROTECT(t, field);
+  object eht = codeExceptionHandlerTable(t, methodCode(t, context->method));
+  if (eht) {
+    PROTECT(t, eht);
 
-          table = frame->append(staticTable);
-        } else {
-          table = frame->popObject();
-        }
+    unsigned visitCount = exceptionHandlerTableLength(t, eht);
 
-        switch (fieldCode) {
-        case ByteField:
-        case BooleanField:
-          c->store
-            (TargetBytesPerWord, value, 1, c->memory
-             (table, Compiler::IntegerType, targetFieldOffset
-              (context, field), 0, 1));
-          break;
+    THREAD_RUNTIME_ARRAY(t, bool, visited, visitCount);
+    memset(RUNTIME_ARRAY_BODY(visited), 0, visitCount * sizeof(bool));
 
-        case CharField:
-        case ShortField:
-          c->store
-            (TargetBytesPerWord, value, 2, c->memory
-             (table, Compiler::IntegerType, targetFieldOffset
-              (context, field), 0, 1));
-          break;
-            
-        case FloatField:
-          c->store
-            (TargetBytesPerWord, value, 4, c->memory
-             (table, Compiler::FloatType, targetFieldOffset
-              (context, field), 0, 1));
-          break;
+    bool progress = true;
+    while (progress) {
+      progress = false;
 
-        case IntField:
-          c->store
-            (TargetBytesPerWord, value, 4, c->memory
-             (table, Compiler::IntegerType, targetFieldOffset
-              (context, field), 0, 1));
-          break;
+      for (unsigned i = 0; i < exceptionHandlerTableLength(t, eht); ++i) {
+        uint64_t eh = exceptionHandlerTableBody(t, eht, i);
+        int start = resolveIpForwards
+          (context, exceptionHandlerStart(eh), exceptionHandlerEnd(eh));
 
-        case DoubleField:
-          c->store
-            (8, value, 8, c->memory
-             (table, Compiler::FloatType, targetFieldOffset
-              (context, field), 0, 1));
-          break;
+        if ((not RUNTIME_ARRAY_BODY(visited)[i])
+            and start >= 0
+            and context->visitTable[start])
+        {
+          RUNTIME_ARRAY_BODY(visited)[i] = true;
+          progress = true;
 
-        case LongField:
-          c->store
-            (8, value, 8, c->memory
-             (table, Compiler::IntegerType, targetFieldOffset
-              (context, field), 0, 1));
-          break;
+          c->restoreState(state);
 
-        case ObjectField:
-          if (instruction == putfield) {
-            c->call
-              (c->constant
-               (getThunk(t, setMaybeNullThunk), Compiler::AddressType),
-               0,
-               frame->trace(0, 0),
-               0,
-               Compiler::VoidType,
-               4, c->register_(t->arch->thread()), table,
-               c->constant(targetFieldOffset(context, field),
-                           Compiler::IntegerType),
-               value);
-          } else {
-            c->call
-              (c->constant(getThunk(t, setThunk), Compiler::AddressType),
-               0, 0, 0, Compiler::VoidType,
-               4, c->register_(t->arch->thread()), table,
-               c->constant(targetFieldOffset(context, field),
-                           Compiler::IntegerType),
-               value);
+          THREAD_RUNTIME_ARRAY
+            (t, uint8_t, stackMap,
+             codeMaxStack(t, methodCode(t, context->method)));
+          Frame frame2(&frame, RUNTIME_ARRAY_BODY(stackMap));
+
+          unsigned end = exceptionHandlerEnd(eh);
+          if (exceptionHandlerIp(eh) >= static_cast<unsigned>(start)
+              and exceptionHandlerIp(eh) < end)
+          {
+            end = exceptionHandlerIp(eh);
           }
-          break;
 
-        default: abort(t);
-        }
+          context->eventLog.append(PushExceptionHandlerEvent);
+          context->eventLog.append2(start);
+          context->eventLog.append2(end);
 
-        if (fieldFlags(t, field) & ACC_VOLATILE) {
-          if (TargetBytesPerWord == 4
-              and (fieldCode == DoubleField or fieldCode == LongField))
+          for (unsigned i = 1;
+               i < codeMaxStack(t, methodCode(t, context->method));
+               ++i)
           {
-            c->call
-              (c->constant
-               (getThunk(t, releaseMonitorForObjectThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), 0, Compiler::VoidType, 2,
-               c->register_(t->arch->thread()), frame->append(field));
-          } else {
-            c->storeLoadBarrier();
+            frame2.set(localSize(t, context->method) + i, Frame::Integer);
           }
+
+          compile(t, &frame2, exceptionHandlerIp(eh), start);
+
+          context->eventLog.append(PopContextEvent);
+
+          eventIndex = calculateFrameMaps(t, context, 0, eventIndex);
         }
-      } else {
-        int fieldCode = vm::fieldCode
-          (t, byteArrayBody(t, referenceSpec(t, reference), 0));
+      }
+    }
+  }
 
-        Compiler::Operand* value = popField(t, frame, fieldCode);
-        unsigned rSize = resultSize(t, fieldCode);
-        Compiler::OperandType rType = operandTypeForFieldCode(t, fieldCode);
+  while (context->dirtyRoots) {
+    context->dirtyRoots = false;
+    calculateFrameMaps(t, context, 0, 0);
+  }
+}
 
-        object pair = makePair(t, context->method, reference);
+void
+updateCall(MyThread* t, avian::codegen::lir::UnaryOperation op, void* returnAddress, void* target)
+{
+  t->arch->updateCall(op, returnAddress, target);
+}
 
-        switch (fieldCode) {
-        case ByteField:
-        case BooleanField:
-        case CharField:
-        case ShortField:
-        case FloatField:
-        case IntField: {
-          if (instruction == putstatic) {
-            c->call
-              (c->constant
-               (getThunk(t, setStaticFieldValueFromReferenceThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), rSize, rType, 3,
-               c->register_(t->arch->thread()), frame->append(pair),
-               value);
-          } else {
-            Compiler::Operand* instance = frame->popObject();
+avian::codegen::lir::UnaryOperation
+callNodeOperation(Thread* t, object node)
+{
+  if (callNodeFlags(t, node) & TraceElement::LongCall) {
+    if (callNodeFlags(t, node) & TraceElement::TailCall) {
+      return avian::codegen::lir::AlignedLongJump;
+    } else {
+      return avian::codegen::lir::AlignedLongCall;
+    }
+  } else if (callNodeFlags(t, node) & TraceElement::TailCall) {
+    return avian::codegen::lir::AlignedJump;
+  } else {
+    return avian::codegen::lir::AlignedCall;
+  }
+}
 
-            c->call
-              (c->constant
-               (getThunk(t, setFieldValueFromReferenceThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), rSize, rType, 4,
-               c->register_(t->arch->thread()), frame->append(pair),
-               instance, value);
-          }
-        } break;
+void
+noteVtableEntry(MyThread* t, object method, object class_);
 
-        case DoubleField:
-        case LongField: {
-          if (instruction == putstatic) {
-            c->call
-              (c->constant
-               (getThunk(t, setStaticLongFieldValueFromReferenceThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), rSize, rType, 4,
-               c->register_(t->arch->thread()), frame->append(pair),
-               static_cast<Compiler::Operand*>(0), value);
-          } else {
-            Compiler::Operand* instance = frame->popObject();
+void*
+compileMethod2(MyThread* t, void* ip);
 
-            c->call
-              (c->constant
-               (getThunk(t, setLongFieldValueFromReferenceThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), rSize, rType, 5,
-               c->register_(t->arch->thread()), frame->append(pair),
-               instance, static_cast<Compiler::Operand*>(0), value);
-          }
-        } break;
+uint64_t
+compileMethod(MyThread* t)
+{
+  void* ip;
+  if (t->tailAddress) {
+    ip = t->tailAddress;
+    t->tailAddress = 0;
+  } else {
+    ip = getIp(t);
+  }
 
-        case ObjectField: {
-          if (instruction == putstatic) {
-            c->call
-              (c->constant
-               (getThunk(t, setStaticObjectFieldValueFromReferenceThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), rSize, rType, 3,
-               c->register_(t->arch->thread()), frame->append(pair),
-               value);
-          } else {
-            Compiler::Operand* instance = frame->popObject();
+  return reinterpret_cast<uintptr_t>(compileMethod2(t, ip));
+}
 
-            c->call
-              (c->constant
-               (getThunk(t, setObjectFieldValueFromReferenceThunk),
-                Compiler::AddressType),
-               0, frame->trace(0, 0), rSize, rType, 4,
-               c->register_(t->arch->thread()), frame->append(pair),
-               instance, value);
-          }
-        } break;
+void*
+compileVirtualMethod2(MyThread* t, object class_, unsigned index)
+{
+  // If class_ has BootstrapFlag set, that means its vtable is not yet
+  // available.  However, we must set t->trace->targetMethod to an
+  // appropriate method to ensure we can accurately scan the stack for
+  // GC roots.  We find such a method by looking for a superclass with
+  // a vtable and using it instead:
 
-        default: abort(t);
+  object c = class_;
+  while (classVmFlags(t, c) & BootstrapFlag) {
+    c = classSuper(t, c);
+  }
+  t->trace->targetMethod = arrayBody(t, classVirtualTable(t, c), index);
+
+  THREAD_RESOURCE0(t, static_cast<MyThread*>(t)->trace->targetMethod = 0;);
+
+  PROTECT(t, class_);
+
+  object target = resolveTarget(t, class_, index);
+  PROTECT(t, target);
+
+  compile(t, codeAllocator(t), 0, target);
+
+  void* address = reinterpret_cast<void*>(methodAddress(t, target));
+  if (methodFlags(t, target) & ACC_NATIVE) {
+    t->trace->nativeMethod = target;
+  } else if (codeAllocator(t)->sweep) {
+    // the sweeper must know about every vtable entry pointing to the
+    // method so it can reset them if it evicts it, and it may have
+    // done so already while we waited for the lock:
+    while (true) {
+      { ACQUIRE(t, t->m->classLock);
+
+        address = reinterpret_cast<void*>(methodAddress(t, target));
+        if (not unresolved(t, reinterpret_cast<uintptr_t>(address))) {
+          noteVtableEntry(t, target, class_);
+          classVtable(t, class_, methodOffset(t, target)) = address;
+          break;
         }
       }
-    } break;
 
-    case ret: {
-      unsigned index = codeBody(t, code, ip);
-      frame->returnFromSubroutine(index);
-    } goto next;
+      compile(t, codeAllocator(t), 0, target);
+    }
+  } else {
+    classVtable(t, class_, methodOffset(t, target)) = address;
+  }
+  return address;
+}
+
+uint64_t
+compileVirtualMethod(MyThread* t)
+{
+  object class_ = objectClass(t, static_cast<object>(t->virtualCallTarget));
+  t->virtualCallTarget = 0;
+
+  unsigned index = t->virtualCallIndex;
+  t->virtualCallIndex = 0;
+
+  return reinterpret_cast<uintptr_t>(compileVirtualMethod2(t, class_, index));
+}
+
+uint64_t
+invokeNativeFast(MyThread* t, object method, void* function)
+{
+  FastNativeFunction f; memcpy(&f, &function, sizeof(void*));
+  return f(t, method,
+           static_cast<uintptr_t*>(t->stack)
+           + t->arch->frameFooterSize()
+           + t->arch->frameReturnAddressSize());
+}
+
+uint64_t
+invokeNativeSlow(MyThread* t, object method, void* function)
+{
+  PROTECT(t, method);
 
-    case return_:
-      if (needsReturnBarrier(t, context->method)) {
-        c->storeStoreBarrier();
-      }
+  unsigned footprint = methodParameterFootprint(t, method) + 1;
+  if (methodFlags(t, method) & ACC_STATIC) {
+    ++ footprint;
+  }
+  unsigned count = methodParameterCount(t, method) + 2;
 
-      handleExit(t, frame);
-      c->return_(0, 0);
-      goto next;
+  THREAD_RUNTIME_ARRAY(t, uintptr_t, args, footprint);
+  unsigned argOffset = 0;
+  THREAD_RUNTIME_ARRAY(t, uint8_t, types, count);
+  unsigned typeOffset = 0;
 
-    case sipush:
-      frame->pushInt
-        (c->constant
-         (static_cast<int16_t>(codeReadInt16(t, code, ip)),
-          Compiler::IntegerType));
-      break;
+  RUNTIME_ARRAY_BODY(args)[argOffset++] = reinterpret_cast<uintptr_t>(t);
+  RUNTIME_ARRAY_BODY(types)[typeOffset++] = POINTER_TYPE;
 
-    case swap:
-      frame->swap();
-      break;
+  uintptr_t* sp = static_cast<uintptr_t*>(t->stack)
+    + t->arch->frameFooterSize()
+    + t->arch->frameReturnAddressSize();
 
-    case tableswitch: {
-      int32_t base = ip - 1;
+  object jclass = 0;
+  PROTECT(t, jclass);
 
-      ip = (ip + 3) & ~3; // pad to four byte boundary
+  if (methodFlags(t, method) & ACC_STATIC) {
+    jclass = getJClass(t, methodClass(t, method));
+    RUNTIME_ARRAY_BODY(args)[argOffset++]
+      = reinterpret_cast<uintptr_t>(&jclass);
+  } else {
+    RUNTIME_ARRAY_BODY(args)[argOffset++]
+      = reinterpret_cast<uintptr_t>(sp++);
+  }
+  RUNTIME_ARRAY_BODY(types)[typeOffset++] = POINTER_TYPE;
 
-      uint32_t defaultIp = base + codeReadInt32(t, code, ip);
-      assert(t, defaultIp < codeLength(t, code));
-      
-      int32_t bottom = codeReadInt32(t, code, ip);
-      int32_t top = codeReadInt32(t, code, ip);
-        
-      avian::codegen::Promise* start = 0;
-      unsigned count = top - bottom + 1;
-      uint32_t* ipTable = static_cast<uint32_t*>
-        (stack.push(sizeof(uint32_t) * count));
-      for (int32_t i = 0; i < top - bottom + 1; ++i) {
-        unsigned index = ip + (i * 4);
-        uint32_t newIp = base + codeReadInt32(t, code, index);
-        assert(t, newIp < codeLength(t, code));
+  MethodSpecIterator it
+    (t, reinterpret_cast<const char*>
+     (&byteArrayBody(t, methodSpec(t, method), 0)));
+  
+  while (it.hasNext()) {
+    unsigned type = RUNTIME_ARRAY_BODY(types)[typeOffset++]
+      = fieldType(t, fieldCode(t, *it.next()));
 
-        ipTable[i] = newIp;
+    switch (type) {
+    case INT8_TYPE:
+    case INT16_TYPE:
+    case INT32_TYPE:
+    case FLOAT_TYPE:
+      RUNTIME_ARRAY_BODY(args)[argOffset++] = *(sp++);
+      break;
 
-        avian::codegen::Promise* p = c->poolAppendPromise
-          (frame->addressPromise(c->machineIp(newIp)));
-        if (i == 0) {
-          start = p;
-        }
+    case INT64_TYPE:
+    case DOUBLE_TYPE: {
+      memcpy(RUNTIME_ARRAY_BODY(args) + argOffset, sp, 8);
+      argOffset += (8 / BytesPerWord);
+      sp += 2;
+    } break;
+
+    case POINTER_TYPE: {
+      if (*sp) {
+        RUNTIME_ARRAY_BODY(args)[argOffset++]
+          = reinterpret_cast<uintptr_t>(sp);
+      } else {
+        RUNTIME_ARRAY_BODY(args)[argOffset++] = 0;
       }
-      assert(t, start);
+      ++ sp;
+    } break;
 
-      Compiler::Operand* key = frame->popInt();
-      
-      c->jumpIfLess(4, c->constant(bottom, Compiler::IntegerType), key,
-                    frame->machineIp(defaultIp));
+    default: abort(t);
+    }
+  }
 
-      c->save(1, key);
+  unsigned returnCode = methodReturnCode(t, method);
+  unsigned returnType = fieldType(t, returnCode);
+  uint64_t result;
 
-      new (stack.push(sizeof(SwitchState))) SwitchState
-        (c->saveState(), count, defaultIp, key, start, bottom, top);
+  if (DebugNatives) {
+    fprintf(stderr, "invoke native method %s.%s\n",
+            &byteArrayBody(t, className(t, methodClass(t, method)), 0),
+            &byteArrayBody(t, methodName(t, method), 0));
+  }
 
-      stack.pushValue(Untable0);
-      ip = defaultIp;
-    } goto start;
+  if (methodFlags(t, method) & ACC_SYNCHRONIZED) {
+    if (methodFlags(t, method) & ACC_STATIC) {
+      acquire(t, methodClass(t, method));
+    } else {
+      acquire(t, *reinterpret_cast<object*>(RUNTIME_ARRAY_BODY(args)[1]));
+    }
+  }
 
-    case wide: {
-      switch (codeBody(t, code, ip++)) {
-      case aload: {
-        frame->loadObject(codeReadInt16(t, code, ip));
-      } break;
+  Reference* reference = t->reference;
 
-      case astore: {
-        frame->storeObject(codeReadInt16(t, code, ip));
-      } break;
+  { ENTER(t, Thread::IdleState);
 
-      case iinc: {
-        uint16_t index = codeReadInt16(t, code, ip);
-        int16_t count = codeReadInt16(t, code, ip);
+    bool noThrow = t->checkpoint->noThrow;
+    t->checkpoint->noThrow = true;
+    THREAD_RESOURCE(t, bool, noThrow, t->checkpoint->noThrow = noThrow);
 
-        storeLocal
-          (context, 1,
-           c->add
-           (4, c->constant(count, Compiler::IntegerType), 
-            loadLocal(context, 1, index)),
-           index);
-      } break;
+    result = t->m->system->call
+      (function,
+       RUNTIME_ARRAY_BODY(args),
+       RUNTIME_ARRAY_BODY(types),
+       count,
+       footprint * BytesPerWord,
+       returnType);
+  }
 
-      case iload: {
-        frame->loadInt(codeReadInt16(t, code, ip));
-      } break;
+  if (methodFlags(t, method) & ACC_SYNCHRONIZED) {
+    if (methodFlags(t, method) & ACC_STATIC) {
+      release(t, methodClass(t, method));
+    } else {
+      release(t, *reinterpret_cast<object*>(RUNTIME_ARRAY_BODY(args)[1]));
+    }
+  }
 
-      case istore: {
-        frame->storeInt(codeReadInt16(t, code, ip));
-      } break;
+  if (DebugNatives) {
+    fprintf(stderr, "return from native method %s.%s\n",
+            &byteArrayBody(t, className(t, methodClass(t, method)), 0),
+            &byteArrayBody(t, methodName(t, method), 0));
+  }
 
-      case lload: {
-        frame->loadLong(codeReadInt16(t, code, ip));
-      } break;
+  if (UNLIKELY(t->exception)) {
+    object exception = t->exception;
+    t->exception = 0;
+    vm::throw_(t, exception);
+  }
 
-      case lstore: {
-        frame->storeLong(codeReadInt16(t, code, ip));
-      } break;
+  switch (returnCode) {
+  case ByteField:
+  case BooleanField:
+    result = static_cast<int8_t>(result);
+    break;
 
-      case ret: {
-        unsigned index = codeReadInt16(t, code, ip);
-        c->jmp(loadLocal(context, 1, index));
-        frame->returnFromSubroutine(index);
-      } goto next;
+  case CharField:
+    result = static_cast<uint16_t>(result);
+    break;
 
-      default: abort(t);
-      }
-    } break;
+  case ShortField:
+    result = static_cast<int16_t>(result);
+    break;
 
-    default: abort(t);
-    }
-  }
+  case FloatField:
+  case IntField:
+    result = static_cast<int32_t>(result);
+    break;
 
- next:
-  frame->dispose();
-  frame = 0;
-  stack.pop(sizeof(Frame));
-  stack.pop(stackSize);
-  switch (stack.popValue()) {
-  case Return:
-    return;
+  case LongField:
+  case DoubleField:
+    break;
 
-  case Unbranch:
-    ip = stack.popValue();
-    c->restoreState(reinterpret_cast<Compiler::State*>(stack.popValue()));
-    frame = static_cast<Frame*>(stack.peek(sizeof(Frame)));
-    goto loop;
+  case ObjectField:
+    result = static_cast<uintptr_t>(result) ? *reinterpret_cast<uintptr_t*>
+      (static_cast<uintptr_t>(result)) : 0;
+    break;
 
-  case Untable0: {
-    SwitchState* s = static_cast<SwitchState*>
-      (stack.peek(sizeof(SwitchState)));
+  case VoidField:
+    result = 0;
+    break;
 
-    frame = s->frame();
+  default: abort(t);
+  }
 
-    c->restoreState(s->state);
+  while (t->reference != reference) {
+    dispose(t, t->reference);
+  }
 
-    c->jumpIfGreater(4, c->constant(s->top, Compiler::IntegerType), s->key,
-                     frame->machineIp(s->defaultIp));
+  return result;
+}
   
-    c->save(1, s->key);
-    ip = s->defaultIp;
-    stack.pushValue(Untable1);
-  } goto start;
-
-  case Untable1: {
-    SwitchState* s = static_cast<SwitchState*>
-      (stack.peek(sizeof(SwitchState)));
+uint64_t
+invokeNative2(MyThread* t, object method)
+{
+  object native = methodRuntimeDataNative(t, getMethodRuntimeData(t, method));
+  if (nativeFast(t, native)) {
+    return invokeNativeFast(t, method, nativeFunction(t, native));
+  } else {
+    return invokeNativeSlow(t, method, nativeFunction(t, native));
+  }
+}
 
-    frame = s->frame();
+uint64_t
+invokeNative(MyThread* t)
+{
+  if (t->trace->nativeMethod == 0) {
+    void* ip;
+    if (t->tailAddress) {
+      ip = t->tailAddress;
+      t->tailAddress = 0;
+    } else {
+      ip = getIp(t);
+    }
 
-    c->restoreState(s->state);
+    object node = findCallNode(t, ip);
+    object target = callNodeTarget(t, node);
+    if (callNodeFlags(t, node) & TraceElement::VirtualCall) {
+      target = resolveTarget(t, t->stack, target);
+    }
+    t->trace->nativeMethod = target;
+  }
 
-    Compiler::Operand* normalizedKey
-      = (s->bottom
-         ? c->sub(4, c->constant(s->bottom, Compiler::IntegerType), s->key)
-         : s->key);
+  assert(t, t->tailAddress == 0);
 
-    Compiler::Operand* entry = c->memory
-      (frame->absoluteAddressOperand(s->start), Compiler::AddressType, 0,
-       normalizedKey, TargetBytesPerWord);
+  uint64_t result = 0;
 
-    c->jmp
-      (c->load
-       (TargetBytesPerWord, TargetBytesPerWord, context->bootContext
-        ? c->add
-        (TargetBytesPerWord, c->memory
-         (c->register_(t->arch->thread()), Compiler::AddressType,
-          TARGET_THREAD_CODEIMAGE), entry)
-        : entry,
-        TargetBytesPerWord));
+  t->trace->targetMethod = t->trace->nativeMethod;
 
-    s->state = c->saveState();
-  } goto switchloop;
+  t->m->classpath->resolveNative(t, t->trace->nativeMethod);
 
-  case Unswitch: {
-    SwitchState* s = static_cast<SwitchState*>
-      (stack.peek(sizeof(SwitchState)));
-    
-    frame = s->frame();
+  result = invokeNative2(t, t->trace->nativeMethod);
 
-    c->restoreState
-      (static_cast<SwitchState*>(stack.peek(sizeof(SwitchState)))->state);
-  } goto switchloop;
+  unsigned parameterFootprint = methodParameterFootprint
+    (t, t->trace->targetMethod);
 
-  case Unsubroutine: {
-    ip = stack.popValue();
-    unsigned start = stack.popValue();
-    frame = reinterpret_cast<Frame*>(stack.peek(sizeof(Frame)));
-    frame->endSubroutine(start);
-  } goto loop;
+  uintptr_t* stack = static_cast<uintptr_t*>(t->stack);
 
-  default:
-    abort(t);
+  if (avian::codegen::TailCalls
+      and t->arch->argumentFootprint(parameterFootprint)
+      > t->arch->stackAlignmentInWords())
+  {
+    stack += t->arch->argumentFootprint(parameterFootprint)
+      - t->arch->stackAlignmentInWords();
   }
 
- switchloop: {
-    SwitchState* s = static_cast<SwitchState*>
-      (stack.peek(sizeof(SwitchState)));
+  stack += t->arch->frameReturnAddressSize();
 
-    if (s->index < s->count) {
-      ip = s->ipTable()[s->index++];
-      stack.pushValue(Unswitch);
-      goto start;
-    } else {
-      ip = s->defaultIp;
-      unsigned count = s->count * 4;
-      stack.pop(sizeof(SwitchState));
-      stack.pop(count);
-      frame = reinterpret_cast<Frame*>(stack.peek(sizeof(Frame)));
-      goto loop;
-    }
-  }
+  t->trace->targetMethod = 0;
+  t->trace->nativeMethod = 0;
 
- branch:
-  stack.pushValue(reinterpret_cast<uintptr_t>(c->saveState()));
-  stack.pushValue(ip);
-  stack.pushValue(Unbranch);
-  ip = newIp;
-  goto start;
-}
+  t->newStack = stack;
 
-FILE* compileLog = 0;
+  return result;
+}
 
 void
-logCompile(MyThread* t, const void* code, unsigned size, const char* class_,
-           const char* name, const char* spec);
-
-int
-resolveIpForwards(Context* context, int start, int end)
+findFrameMapInSimpleTable(MyThread* t, object method, object table,
+                          int32_t offset, int32_t** map, unsigned* start)
 {
-  if (start < 0) {
-    start = 0;
-  }
+  unsigned tableSize = simpleFrameMapTableSize(t, method, table);
+  unsigned indexSize = intArrayLength(t, table) - tableSize;
 
-  while (start < end and context->visitTable[start] == 0) {
-    ++ start;
-  }
-  
-  if (start >= end) {
-    return -1;
-  } else {
-    return start;
+  *map = &intArrayBody(t, table, indexSize);
+    
+  unsigned bottom = 0;
+  unsigned top = indexSize;
+  for (unsigned span = top - bottom; span; span = top - bottom) {
+    unsigned middle = bottom + (span / 2);
+    int32_t v = intArrayBody(t, table, middle);
+      
+    if (offset == v) {
+      *start = frameMapSizeInBits(t, method) * middle;
+      return;
+    } else if (offset < v) {
+      top = middle;
+    } else {
+      bottom = middle + 1;
+    }
   }
+
+  abort(t);
 }
 
-int
-resolveIpBackwards(Context* context, int start, int end)
+unsigned
+findFrameMap(MyThread* t, void* stack, object method, object table,
+             unsigned pathIndex)
 {
-  Thread* t = context->thread;
-  if (start >= static_cast<int>
-      (codeLength(t, methodCode(t, context->method))))
-  {
-    start = codeLength(t, methodCode(t, context->method));
-  } else {
-    while (start >= end and context->visitTable[start] == 0) {
-      -- start;
+  if (pathIndex) {
+    FrameMapTablePath* path = reinterpret_cast<FrameMapTablePath*>
+      (&byteArrayBody(t, table, pathIndex));
+    
+    void* address = static_cast<void**>(stack)[path->stackIndex];
+    uint8_t* base = reinterpret_cast<uint8_t*>(methodAddress(t, method));
+    for (unsigned i = 0; i < path->elementCount; ++i) {
+      if (address == base + path->elements[i]) {
+        return i + (path->elementCount * findFrameMap
+                    (t, stack, method, table, path->next));
+      }
     }
-  }
-  
-  if (start < end) {
-    return -1;
+
+    abort(t);
   } else {
-    return start;
+    return 0;
   }
 }
 
-object
-truncateIntArray(Thread* t, object array, unsigned length)
+void
+findFrameMapInGeneralTable(MyThread* t, void* stack, object method,
+                           object table, int32_t offset, int32_t** map,
+                           unsigned* start)
 {
-  expect(t, intArrayLength(t, array) > length);
+  FrameMapTableHeader* header = reinterpret_cast<FrameMapTableHeader*>
+    (&byteArrayBody(t, table, 0));
 
-  PROTECT(t, array);
+  FrameMapTableIndexElement* index
+    = reinterpret_cast<FrameMapTableIndexElement*>
+    (&byteArrayBody(t, table, sizeof(FrameMapTableHeader)));
 
-  object newArray = makeIntArray(t, length);
-  if (length) {
-    memcpy(&intArrayBody(t, newArray, 0), &intArrayBody(t, array, 0),
-           length * 4);
+  *map = reinterpret_cast<int32_t*>(index + header->indexCount);
+
+  unsigned bottom = 0;
+  unsigned top = header->indexCount;
+  for (unsigned span = top - bottom; span; span = top - bottom) {
+    unsigned middle = bottom + (span / 2);
+    FrameMapTableIndexElement* v = index + middle;
+                                     
+    if (offset == v->offset) {
+      *start = v->base + (findFrameMap(t, stack, method, table, v->path)
+                          * frameMapSizeInBits(t, method));
+      return;
+    } else if (offset < v->offset) {
+      top = middle;
+    } else {
+      bottom = middle + 1;
+    }
   }
 
-  return newArray;
+  abort(t);
 }
 
-object
-truncateArray(Thread* t, object array, unsigned length)
+void
+findFrameMap(MyThread* t, void* stack, object method, int32_t offset,
+             int32_t** map, unsigned* start)
 {
-  expect(t, arrayLength(t, array) > length);
-
-  PROTECT(t, array);
-
-  object newArray = makeArray(t, length);
-  if (length) {
-    memcpy(&arrayBody(t, newArray, 0), &arrayBody(t, array, 0),
-           length * BytesPerWord);
+  object table = codePool(t, methodCode(t, method));
+  if (objectClass(t, table) == type(t, Machine::IntArrayType)) {
+    findFrameMapInSimpleTable(t, method, table, offset, map, start);
+  } else {
+    findFrameMapInGeneralTable(t, stack, method, table, offset, map, start);
   }
-
-  return newArray;
 }
 
-object
-truncateLineNumberTable(Thread* t, object table, unsigned length)
+void
+visitStackAndLocals(MyThread* t, Heap::Visitor* v, void* frame, object method,
+                    void* ip)
 {
-  expect(t, lineNumberTableLength(t, table) > length);
+  unsigned count = frameMapSizeInBits(t, method);
 
-  PROTECT(t, table);
+  if (count) {
+    void* stack = stackForFrame(t, frame, method);
 
-  object newTable = makeLineNumberTable(t, length);
-  if (length) {
-    memcpy(&lineNumberTableBody(t, newTable, 0),
-           &lineNumberTableBody(t, table, 0),
-           length * sizeof(uint64_t));
+    int32_t* map;
+    unsigned offset;
+    findFrameMap
+      (t, stack, method, difference
+       (ip, reinterpret_cast<void*>(methodAddress(t, method))), &map, &offset);
+
+    for (unsigned i = 0; i < count; ++i) {
+      int j = offset + i;
+      if (map[j / 32] & (static_cast<int32_t>(1) << (j % 32))) {
+        v->visit(localObject(t, stack, method, i));        
+      }
+    }
   }
-
-  return newTable;
 }
 
-object
-translateExceptionHandlerTable(MyThread* t, Context* context, intptr_t start,
-                               intptr_t end)
+void
+visitArgument(MyThread* t, Heap::Visitor* v, void* stack, unsigned index)
 {
-  avian::codegen::Compiler* c = context->compiler;
-
-  object oldTable = codeExceptionHandlerTable
-    (t, methodCode(t, context->method));
-
-  if (oldTable) {
-    PROTECT(t, oldTable);
-
-    unsigned length = exceptionHandlerTableLength(t, oldTable);
+  v->visit(static_cast<object*>(stack)
+           + index
+           + t->arch->frameReturnAddressSize()
+           + t->arch->frameFooterSize());
+}
 
-    object newIndex = makeIntArray(t, length * 3);
-    PROTECT(t, newIndex);
+void
+visitArguments(MyThread* t, Heap::Visitor* v, void* stack, object method)
+{
+  unsigned index = 0;
 
-    object newTable = makeArray(t, length + 1);
-    PROTECT(t, newTable);
+  if ((methodFlags(t, method) & ACC_STATIC) == 0) {
+    visitArgument(t, v, stack, index++);
+  }
 
-    unsigned ni = 0;
-    for (unsigned oi = 0; oi < length; ++ oi) {
-      uint64_t oldHandler = exceptionHandlerTableBody
-        (t, oldTable, oi);
+  for (MethodSpecIterator it
+         (t, reinterpret_cast<const char*>
+          (&byteArrayBody(t, methodSpec(t, method), 0)));
+       it.hasNext();)
+  {
+    switch (*it.next()) {
+    case 'L':
+    case '[':
+      visitArgument(t, v, stack, index++);
+      break;
+      
+    case 'J':
+    case 'D':
+      index += 2;
+      break;
 
-      int handlerStart = resolveIpForwards
-        (context, exceptionHandlerStart(oldHandler),
-         exceptionHandlerEnd(oldHandler));
+    default:
+      ++ index;
+      break;
+    }
+  }
+}
 
-      if (LIKELY(handlerStart >= 0)) {
-        assert(t, handlerStart < static_cast<int>
-               (codeLength(t, methodCode(t, context->method))));
+void
+visitStack(MyThread* t, Heap::Visitor* v)
+{
+  void* ip = getIp(t);
+  void* stack = t->stack;
 
-        int handlerEnd = resolveIpBackwards
-          (context, exceptionHandlerEnd(oldHandler),
-           exceptionHandlerStart(oldHandler));
+  MyThread::CallTrace* trace = t->trace;
+  object targetMethod = (trace ? trace->targetMethod : 0);
+  object target = targetMethod;
+  bool mostRecent = true;
 
-        assert(t, handlerEnd >= 0);
-        assert(t, handlerEnd <= static_cast<int>
-               (codeLength(t, methodCode(t, context->method))));
+  while (stack) {
+    if (targetMethod) {
+      visitArguments(t, v, stack, targetMethod);
+      targetMethod = 0;
+    }
 
-        intArrayBody(t, newIndex, ni * 3)
-          = c->machineIp(handlerStart)->value() - start;
+    object method = methodForIp(t, ip);
+    if (method) {
+      PROTECT(t, method);
 
-        intArrayBody(t, newIndex, (ni * 3) + 1)
-          = (handlerEnd == static_cast<int>
-             (codeLength(t, methodCode(t, context->method)))
-             ? end : c->machineIp(handlerEnd)->value()) - start;
+      void* nextIp = ip;
+      nextFrame(t, &nextIp, &stack, method, target, mostRecent);
 
-        intArrayBody(t, newIndex, (ni * 3) + 2)
-          = c->machineIp(exceptionHandlerIp(oldHandler))->value() - start;
+      visitStackAndLocals(t, v, stack, method, ip);
 
-        object type;
-        if (exceptionHandlerCatchType(oldHandler)) {
-          type = resolveClassInPool
-            (t, context->method, exceptionHandlerCatchType(oldHandler) - 1);
-        } else {
-          type = 0;
-        }
+      ip = nextIp;
 
-        set(t, newTable, ArrayBody + ((ni + 1) * BytesPerWord), type);
+      target = method;
+    } else if (trace) {
+      stack = trace->stack;
+      ip = trace->ip;
+      trace = trace->next;
 
-        ++ ni;
+      if (trace) {
+        targetMethod = trace->targetMethod;
+        target = targetMethod;
+      } else {
+        target = 0;
       }
+    } else {
+      break;
     }
 
-    if (UNLIKELY(ni < length)) {
-      newIndex = truncateIntArray(t, newIndex, ni * 3);
-      newTable = truncateArray(t, newTable, ni + 1);
-    }
-
-    set(t, newTable, ArrayBody, newIndex);
-
-    return newTable;
-  } else {
-    return 0;
+    mostRecent = false;
   }
 }
 
-object
-translateLineNumberTable(MyThread* t, Context* context, intptr_t start)
+void
+walkContinuationBody(MyThread* t, Heap::Walker* w, object c, int start)
 {
-  object oldTable = codeLineNumberTable(t, methodCode(t, context->method));
-  if (oldTable) {
-    PROTECT(t, oldTable);
-
-    unsigned length = lineNumberTableLength(t, oldTable);
-    object newTable = makeLineNumberTable(t, length);
-    unsigned ni = 0;
-    for (unsigned oi = 0; oi < length; ++oi) {
-      uint64_t oldLine = lineNumberTableBody(t, oldTable, oi);
+  const int BodyOffset = ContinuationBody / BytesPerWord;
 
-      int ip = resolveIpForwards
-        (context, lineNumberIp(oldLine), oi + 1 < length
-         ? lineNumberIp(lineNumberTableBody(t, oldTable, oi + 1)) - 1
-         : lineNumberIp(oldLine) + 1);
+  object method = static_cast<object>
+    (t->m->heap->follow(continuationMethod(t, c)));
+  int count = frameMapSizeInBits(t, method);
 
-      if (LIKELY(ip >= 0)) {
-        lineNumberTableBody(t, newTable, ni++) = lineNumber
-          (context->compiler->machineIp(ip)->value() - start,
-           lineNumberLine(oldLine));
-      }
-    }
+  if (count) {
+    int stack = BodyOffset
+      + (continuationFramePointerOffset(t, c) / BytesPerWord)
+      - t->arch->framePointerOffset()
+      - stackOffsetFromFrame(t, method);
 
-    if (UNLIKELY(ni < length)) {
-      newTable = truncateLineNumberTable(t, newTable, ni);      
+    int first = stack + localOffsetFromStack(t, count - 1, method);
+    if (start > first) {
+      count -= start - first;
     }
 
-    return newTable;
-  } else {
-    return 0;
-  }
-}
+    int32_t* map;
+    unsigned offset;
+    findFrameMap
+      (t, reinterpret_cast<uintptr_t*>(c) + stack, method, difference
+       (continuationAddress(t, c),
+        reinterpret_cast<void*>(methodAddress(t, method))), &map, &offset);
 
-void
-printSet(uintptr_t* m, unsigned limit)
-{
-  if (limit) {
-    for (unsigned i = 0; i < 32; ++i) {
-      if ((*m >> i) & 1) {
-        fprintf(stderr, "1");
-      } else {
-        fprintf(stderr, "_");
+    for (int i = count - 1; i >= 0; --i) {
+      int j = offset + i;
+      if (map[j / 32] & (static_cast<int32_t>(1) << (j % 32))) {
+        if (not w->visit(stack + localOffsetFromStack(t, i, method))) {
+          return;
+        }
       }
     }
   }
 }
 
 void
-calculateTryCatchRoots(Context* context, SubroutinePath* subroutinePath,
-                       uintptr_t* roots, unsigned mapSize, unsigned start,
-                       unsigned end)
+callContinuation(MyThread* t, object continuation, object result,
+                 object exception, void* ip, void* stack)
 {
-  memset(roots, 0xFF, mapSize * BytesPerWord);
+  assert(t, t->exception == 0);
 
-  if (DebugFrameMaps) {
-    fprintf(stderr, "calculate try/catch roots from %d to %d", start, end);
-    if (subroutinePath) {
-      fprintf(stderr, " ");
-      print(subroutinePath);
-    }
-    fprintf(stderr, "\n");
+  if (exception) {
+    t->exception = exception;
+
+    MyThread::TraceContext c(t, ip, stack, continuation, t->trace);
+
+    void* frame;
+    findUnwindTarget(t, &ip, &frame, &stack, &continuation);
   }
 
-  for (TraceElement* te = context->traceLog; te; te = te->next) {
-    if (te->ip >= start and te->ip < end) {
-      uintptr_t* traceRoots = 0;
-      if (subroutinePath == 0) {
-        traceRoots = te->map;
-        te->watch = true;
-      } else {
-        for (SubroutineTrace* t = te->subroutineTrace; t; t = t->next) {
-          if (t->path == subroutinePath) {
-            traceRoots = t->map;
-            t->watch = true;
-            break;
-          }
-        }        
-      }
+  t->trace->nativeMethod = 0;
+  t->trace->targetMethod = 0;
 
-      if (traceRoots) {
-        if (DebugFrameMaps) {
-          fprintf(stderr, "   use roots at ip %3d: ", te->ip);
-          printSet(traceRoots, mapSize);
-          fprintf(stderr, "\n");
-        }
+  popResources(t);
+
+  transition(t, ip, stack, continuation, t->trace);
+
+  vmJump(ip, 0, stack, t, reinterpret_cast<uintptr_t>(result), 0);
+}
+
+int8_t*
+returnSpec(MyThread* t, object method)
+{
+  int8_t* s = &byteArrayBody(t, methodSpec(t, method), 0);
+  while (*s and *s != ')') ++ s;
+  expect(t, *s == ')');
+  return s + 1;
+}
+
+object
+returnClass(MyThread* t, object method)
+{
+  PROTECT(t, method);
 
-        for (unsigned wi = 0; wi < mapSize; ++wi) {
-          roots[wi] &= traceRoots[wi];
-        }
-      } else {
-        if (DebugFrameMaps) {
-          fprintf(stderr, "  skip roots at ip %3d\n", te->ip);
-        }
-      }
-    }
+  int8_t* spec = returnSpec(t, method);
+  unsigned length = strlen(reinterpret_cast<char*>(spec));
+  object name;
+  if (*spec == '[') {
+    name = makeByteArray(t, length + 1);
+    memcpy(&byteArrayBody(t, name, 0), spec, length);
+  } else {
+    assert(t, *spec == 'L');
+    assert(t, spec[length - 1] == ';');
+    name = makeByteArray(t, length - 1);
+    memcpy(&byteArrayBody(t, name, 0), spec + 1, length - 2);
   }
 
-  if (DebugFrameMaps) {
-    fprintf(stderr, "result roots          : ");
-    printSet(roots, mapSize);
-    fprintf(stderr, "\n");
-  }
+  return resolveClass(t, classLoader(t, methodClass(t, method)), name);
 }
 
-unsigned
-calculateFrameMaps(MyThread* t, Context* context, uintptr_t* originalRoots,
-                   unsigned eventIndex, SubroutinePath* subroutinePath = 0,
-                   uintptr_t* resultRoots = 0)
+bool
+compatibleReturnType(MyThread* t, object oldMethod, object newMethod)
 {
-  // for each instruction with more than one predecessor, and for each
-  // stack position, determine if there exists a path to that
-  // instruction such that there is not an object pointer left at that
-  // stack position (i.e. it is uninitialized or contains primitive
-  // data).
+  if (oldMethod == newMethod) {
+    return true;
+  } else if (methodReturnCode(t, oldMethod) == methodReturnCode(t, newMethod))
+  {
+    if (methodReturnCode(t, oldMethod) == ObjectField) {
+      PROTECT(t, newMethod);
 
-  unsigned mapSize = frameMapSizeInWords(t, context->method);
+      object oldClass = returnClass(t, oldMethod);
+      PROTECT(t, oldClass);
 
-  THREAD_RUNTIME_ARRAY(t, uintptr_t, roots, mapSize);
-  if (originalRoots) {
-    memcpy(RUNTIME_ARRAY_BODY(roots), originalRoots, mapSize * BytesPerWord);
+      object newClass = returnClass(t, newMethod);
+
+      return isAssignableFrom(t, oldClass, newClass);
+    } else {
+      return true;
+    }
   } else {
-    memset(RUNTIME_ARRAY_BODY(roots), 0, mapSize * BytesPerWord);
+    return methodReturnCode(t, oldMethod) == VoidField;
   }
+}
 
-  int32_t ip = -1;
+void
+jumpAndInvoke(MyThread* t, object method, void* stack, ...)
+{
+  t->trace->targetMethod = 0;
 
-  // invariant: for each stack position, roots contains a zero at that
-  // position if there exists some path to the current instruction
-  // such that there is definitely not an object pointer at that
-  // position.  Otherwise, roots contains a one at that position,
-  // meaning either all known paths result in an object pointer at
-  // that position, or the contents of that position are as yet
-  // unknown.
+  if (methodFlags(t, method) & ACC_NATIVE) {
+    t->trace->nativeMethod = method;
+  } else {
+    t->trace->nativeMethod = 0;
+  }
 
-  unsigned length = context->eventLog.length();
-  while (eventIndex < length) {
-    Event e = static_cast<Event>(context->eventLog.get(eventIndex++));
-    switch (e) {
-    case PushContextEvent: {
-      eventIndex = calculateFrameMaps
-        (t, context, RUNTIME_ARRAY_BODY(roots), eventIndex, subroutinePath,
-         resultRoots);
-    } break;
+  unsigned argumentCount = methodParameterFootprint(t, method);
+  THREAD_RUNTIME_ARRAY(t, uintptr_t, arguments, argumentCount);
+  va_list a; va_start(a, stack);
+  for (unsigned i = 0; i < argumentCount; ++i) {
+    RUNTIME_ARRAY_BODY(arguments)[i] = va_arg(a, uintptr_t);
+  }
+  va_end(a);
 
-    case PopContextEvent:
-      goto exit;
+  assert(t, t->exception == 0);
 
-    case IpEvent: {
-      ip = context->eventLog.get2(eventIndex);
-      eventIndex += 2;
+  popResources(t);
+  
+  vmJumpAndInvoke
+    (t, reinterpret_cast<void*>(methodAddress(t, method)),
+     stack,
+     argumentCount * BytesPerWord,
+     RUNTIME_ARRAY_BODY(arguments),
+     (t->arch->alignFrameSize(t->arch->argumentFootprint(argumentCount))
+      + t->arch->frameReturnAddressSize())
+     * BytesPerWord);
+}
 
-      if (DebugFrameMaps) {
-        fprintf(stderr, "       roots at ip %3d: ", ip);
-        printSet(RUNTIME_ARRAY_BODY(roots), mapSize);
-        fprintf(stderr, "\n");
-      }
+void
+callContinuation(MyThread* t, object continuation, object result,
+                 object exception)
+{
+  enum {
+    Call,
+    Unwind,
+    Rewind
+  } action;
 
-      uintptr_t* tableRoots
-        = (subroutinePath ? subroutinePath->rootTable : context->rootTable)
-        + (ip * mapSize);
+  object nextContinuation = 0;
 
-      if (context->visitTable[ip] > 1) {
-        for (unsigned wi = 0; wi < mapSize; ++wi) {
-          uintptr_t newRoots = tableRoots[wi] & RUNTIME_ARRAY_BODY(roots)[wi];
+  if (t->continuation == 0
+      or continuationContext(t, t->continuation)
+      != continuationContext(t, continuation))
+  {
+    PROTECT(t, continuation);
+    PROTECT(t, result);
+    PROTECT(t, exception);
 
-          if ((eventIndex == length
-               or context->eventLog.get(eventIndex) == PopContextEvent)
-              and newRoots != tableRoots[wi])
-          {
-            if (DebugFrameMaps) {
-              fprintf(stderr, "dirty roots!\n");
-            }
+    if (compatibleReturnType
+        (t, t->trace->originalMethod, continuationContextMethod
+         (t, continuationContext(t, continuation))))
+    {
+      object oldContext;
+      object unwindContext;
 
-            context->dirtyRoots = true;
-          }
+      if (t->continuation) {
+        oldContext = continuationContext(t, t->continuation);
+        unwindContext = oldContext;
+      } else {
+        oldContext = 0;
+        unwindContext = 0;
+      }
 
-          tableRoots[wi] = newRoots;
-          RUNTIME_ARRAY_BODY(roots)[wi] &= tableRoots[wi];
+      object rewindContext = 0;
+
+      for (object newContext = continuationContext(t, continuation);
+           newContext; newContext = continuationContextNext(t, newContext))
+      {
+        if (newContext == oldContext) {
+          unwindContext = 0;
+          break;
+        } else {
+          rewindContext = newContext;
         }
+      }
 
-        if (DebugFrameMaps) {
-          fprintf(stderr, " table roots at ip %3d: ", ip);
-          printSet(tableRoots, mapSize);
-          fprintf(stderr, "\n");
+      if (unwindContext
+          and continuationContextContinuation(t, unwindContext))
+      {
+        nextContinuation = continuationContextContinuation(t, unwindContext);
+        result = makeUnwindResult(t, continuation, result, exception);
+        action = Unwind;
+      } else if (rewindContext
+                 and continuationContextContinuation(t, rewindContext))
+      {
+        nextContinuation = continuationContextContinuation(t, rewindContext);
+        action = Rewind;
+
+        if (root(t, RewindMethod) == 0) {
+          PROTECT(t, nextContinuation);
+            
+          object method = resolveMethod
+            (t, root(t, Machine::BootLoader), "avian/Continuations", "rewind",
+             "(Ljava/lang/Runnable;Lavian/Callback;Ljava/lang/Object;"
+             "Ljava/lang/Throwable;)V");
+
+          PROTECT(t, method);
+            
+          compile(t, local::codeAllocator(t), 0, method);
+            
+          setRoot(t, RewindMethod, method);
         }
       } else {
-        memcpy(tableRoots, RUNTIME_ARRAY_BODY(roots), mapSize * BytesPerWord);
+        action = Call;
       }
-    } break;
+    } else {
+      throwNew(t, Machine::IncompatibleContinuationExceptionType);
+    }
+  } else {
+    action = Call;
+  }
 
-    case MarkEvent: {
-      unsigned i = context->eventLog.get2(eventIndex);
-      eventIndex += 2;
+  void* ip;
+  void* frame;
+  void* stack;
+  object threadContinuation;
+  findUnwindTarget(t, &ip, &frame, &stack, &threadContinuation);
 
-      markBit(RUNTIME_ARRAY_BODY(roots), i);
-    } break;
+  switch (action) {
+  case Call: {
+    callContinuation(t, continuation, result, exception, ip, stack);
+  } break;
 
-    case ClearEvent: {
-      unsigned i = context->eventLog.get2(eventIndex);
-      eventIndex += 2;
+  case Unwind: {
+    callContinuation(t, nextContinuation, result, 0, ip, stack);
+  } break;
 
-      clearBit(RUNTIME_ARRAY_BODY(roots), i);
-    } break;
+  case Rewind: {
+    transition(t, 0, 0, nextContinuation, t->trace);
 
-    case PushExceptionHandlerEvent: {
-      unsigned start = context->eventLog.get2(eventIndex);
-      eventIndex += 2;
-      unsigned end = context->eventLog.get2(eventIndex);
-      eventIndex += 2;
+    jumpAndInvoke
+      (t, root(t, RewindMethod), stack,
+       continuationContextBefore(t, continuationContext(t, nextContinuation)),
+       continuation, result, exception);
+  } break;
 
-      if (context->subroutineTable and context->subroutineTable[start]) {
-        Subroutine* s = context->subroutineTable[start];
-        unsigned originalEventIndex = eventIndex;
+  default:
+    abort(t);
+  }
+}
+
+void
+callWithCurrentContinuation(MyThread* t, object receiver)
+{
+  object method = 0;
+  void* ip = 0;
+  void* stack = 0;
 
-        for (SubroutineCall* c = s->calls; c; c = c->next) {
-          for (SubroutinePath* p = c->paths; p; p = p->listNext) {
-            calculateTryCatchRoots
-              (context, p, RUNTIME_ARRAY_BODY(roots), mapSize, start, end);
+  { PROTECT(t, receiver);
 
-            eventIndex = calculateFrameMaps
-              (t, context, RUNTIME_ARRAY_BODY(roots), originalEventIndex, p);
-          }
-        }
-      } else {
-        calculateTryCatchRoots
-          (context, 0, RUNTIME_ARRAY_BODY(roots), mapSize, start, end);
+    if (root(t, ReceiveMethod) == 0) {
+      object m = resolveMethod
+        (t, root(t, Machine::BootLoader), "avian/CallbackReceiver", "receive",
+         "(Lavian/Callback;)Ljava/lang/Object;");
 
-        eventIndex = calculateFrameMaps
-          (t, context, RUNTIME_ARRAY_BODY(roots), eventIndex, 0);
-      }
-    } break;
+      if (m) {
+        setRoot(t, ReceiveMethod, m);
 
-    case TraceEvent: {
-      TraceElement* te; context->eventLog.get(eventIndex, &te, BytesPerWord);
-      if (DebugFrameMaps) {
-        fprintf(stderr, " trace roots at ip %3d: ", ip);
-        printSet(RUNTIME_ARRAY_BODY(roots), mapSize);
-        if (subroutinePath) {
-          fprintf(stderr, " ");
-          print(subroutinePath);
-        }
-        fprintf(stderr, "\n");
-      }
+        object continuationClass = type(t, Machine::ContinuationType);
         
-      uintptr_t* map;
-      bool watch;
-      if (subroutinePath == 0) {
-        map = te->map;
-        watch = te->watch;
-      } else {
-        SubroutineTrace* trace = 0;
-        for (SubroutineTrace* t = te->subroutineTrace; t; t = t->next) {
-          if (t->path == subroutinePath) {
-            trace = t;
-            break;
-          }
+        if (classVmFlags(t, continuationClass) & BootstrapFlag) {
+          resolveSystemClass
+            (t, root(t, Machine::BootLoader),
+             vm::className(t, continuationClass));
         }
+      }
+    }
 
-        if (trace == 0) {
-          te->subroutineTrace = trace = new
-            (context->zone.allocate
-             (sizeof(SubroutineTrace) + (mapSize * BytesPerWord)))
-            SubroutineTrace(subroutinePath, te->subroutineTrace, mapSize);
+    method = findInterfaceMethod
+      (t, root(t, ReceiveMethod), objectClass(t, receiver));
+    PROTECT(t, method);
+        
+    compile(t, local::codeAllocator(t), 0, method);
 
-          ++ te->subroutineTraceCount;
-        }
+    t->continuation = makeCurrentContinuation(t, &ip, &stack);
+  }
 
-        map = trace->map;
-        watch = trace->watch;
-      }
+  jumpAndInvoke(t, method, stack, receiver, t->continuation);
+}
 
-      for (unsigned wi = 0; wi < mapSize; ++wi) {
-        uintptr_t v = RUNTIME_ARRAY_BODY(roots)[wi];
+void
+dynamicWind(MyThread* t, object before, object thunk, object after)
+{
+  void* ip = 0;
+  void* stack = 0;
 
-        if (watch and map[wi] != v) {
-          if (DebugFrameMaps) {
-            fprintf(stderr, "dirty roots due to trace watch!\n");
-          }
+  { PROTECT(t, before);
+    PROTECT(t, thunk);
+    PROTECT(t, after);
 
-          context->dirtyRoots = true;
-        }
+    if (root(t, WindMethod) == 0) {
+      object method = resolveMethod
+        (t, root(t, Machine::BootLoader), "avian/Continuations", "wind",
+         "(Ljava/lang/Runnable;Ljava/util/concurrent/Callable;"
+         "Ljava/lang/Runnable;)Lavian/Continuations$UnwindResult;");
 
-        map[wi] = v;
+      if (method) {
+        setRoot(t, WindMethod, method);
+        compile(t, local::codeAllocator(t), 0, method);
       }
+    }
 
-      eventIndex += BytesPerWord;
-    } break;
+    t->continuation = makeCurrentContinuation(t, &ip, &stack);
 
-    case PushSubroutineEvent: {
-      SubroutineCall* call;
-      context->eventLog.get(eventIndex, &call, BytesPerWord);
-      eventIndex += BytesPerWord;
+    object newContext = makeContinuationContext
+      (t, continuationContext(t, t->continuation), before, after,
+       t->continuation, t->trace->originalMethod);
 
-      unsigned nextIndex = context->eventLog.get2(eventIndex);
+    set(t, t->continuation, ContinuationContext, newContext);
+  }
 
-      eventIndex = nextIndex;
+  jumpAndInvoke(t, root(t, WindMethod), stack, before, thunk, after);
+}
 
-      SubroutinePath* path = 0;
-      for (SubroutinePath* p = call->paths; p; p = p->listNext) {
-        if (p->stackNext == subroutinePath) {
-          path = p;
-          break;
+class ArgumentList {
+ public:
+  ArgumentList(Thread* t, uintptr_t* array, unsigned size, bool* objectMask,
+               object this_, const char* spec, bool indirectObjects,
+               va_list arguments):
+    t(static_cast<MyThread*>(t)),
+    array(array),
+    objectMask(objectMask),
+    size(size),
+    position(0),
+    protector(this)
+  {
+    if (this_) {
+      addObject(this_);
+    }
+
+    for (MethodSpecIterator it(t, spec); it.hasNext();) {
+      switch (*it.next()) {
+      case 'L':
+      case '[':
+        if (indirectObjects) {
+          object* v = va_arg(arguments, object*);
+          addObject(v ? *v : 0);
+        } else {
+          addObject(va_arg(arguments, object));
         }
-      }
+        break;
+      
+      case 'J':
+        addLong(va_arg(arguments, uint64_t));
+        break;
 
-      if (path == 0) {
-        path = new(&context->zone)
-          SubroutinePath(call, subroutinePath,
-                         makeRootTable(t, &(context->zone), context->method));
+      case 'D':
+        addLong(doubleToBits(va_arg(arguments, double)));
+        break;
+
+      case 'F':
+        addInt(floatToBits(va_arg(arguments, double)));
+        break;
+
+      default:
+        addInt(va_arg(arguments, uint32_t));
+        break;        
       }
+    }
+  }
 
-      THREAD_RUNTIME_ARRAY(t, uintptr_t, subroutineRoots, mapSize);
+  ArgumentList(Thread* t, uintptr_t* array, unsigned size, bool* objectMask,
+               object this_, const char* spec, const jvalue* arguments):
+    t(static_cast<MyThread*>(t)),
+    array(array),
+    objectMask(objectMask),
+    size(size),
+    position(0),
+    protector(this)
+  {
+    if (this_) {
+      addObject(this_);
+    }
 
-      calculateFrameMaps
-        (t, context, RUNTIME_ARRAY_BODY(roots), call->subroutine->logIndex,
-         path, RUNTIME_ARRAY_BODY(subroutineRoots));
+    unsigned index = 0;
+    for (MethodSpecIterator it(t, spec); it.hasNext();) {
+      switch (*it.next()) {
+      case 'L':
+      case '[': {
+        object* v = arguments[index++].l;
+        addObject(v ? *v : 0);
+      } break;
+      
+      case 'J':
+        addLong(arguments[index++].j);
+        break;
 
-      for (unsigned wi = 0; wi < mapSize; ++wi) {
-        RUNTIME_ARRAY_BODY(roots)[wi]
-          &= RUNTIME_ARRAY_BODY(subroutineRoots)[wi];
-      }      
-    } break;
+      case 'D':
+        addLong(doubleToBits(arguments[index++].d));
+        break;
 
-    case PopSubroutineEvent:
-      eventIndex = static_cast<unsigned>(-1);
-      goto exit;
+      case 'F':
+        addInt(floatToBits(arguments[index++].f));
+        break;
 
-    default: abort(t);
+      default:
+        addInt(arguments[index++].i);
+        break;        
+      }
     }
   }
 
- exit:
-  if (resultRoots and ip != -1) {
-    if (DebugFrameMaps) {
-      fprintf(stderr, "result roots at ip %3d: ", ip);
-      printSet(RUNTIME_ARRAY_BODY(roots), mapSize);
-      if (subroutinePath) {
-        fprintf(stderr, " ");
-        print(subroutinePath);
+  ArgumentList(Thread* t, uintptr_t* array, unsigned size, bool* objectMask,
+               object this_, const char* spec, object arguments):
+    t(static_cast<MyThread*>(t)),
+    array(array),
+    objectMask(objectMask),
+    size(size),
+    position(0),
+    protector(this)
+  {
+    if (this_) {
+      addObject(this_);
+    }
+
+    unsigned index = 0;
+    for (MethodSpecIterator it(t, spec); it.hasNext();) {
+      switch (*it.next()) {
+      case 'L':
+      case '[':
+        addObject(objectArrayBody(t, arguments, index++));
+        break;
+      
+      case 'J':
+      case 'D':
+        addLong(fieldAtOffset<int64_t>(objectArrayBody(t, arguments, index++), 8));
+        break;
+
+      default:
+        addInt(fieldAtOffset<int32_t>(objectArrayBody(t, arguments, index++),
+                             BytesPerWord));
+        break;
       }
-      fprintf(stderr, "\n");
     }
-
-    memcpy(resultRoots, RUNTIME_ARRAY_BODY(roots), mapSize * BytesPerWord);
   }
 
-  return eventIndex;
-}
+  void addObject(object v) {
+    assert(t, position < size);
 
-int
-compareTraceElementPointers(const void* va, const void* vb)
-{
-  TraceElement* a = *static_cast<TraceElement* const*>(va);
-  TraceElement* b = *static_cast<TraceElement* const*>(vb);
-  if (a->address->value() > b->address->value()) {
-    return 1;
-  } else if (a->address->value() < b->address->value()) {
-    return -1;
-  } else {
-    return 0;
+    array[position] = reinterpret_cast<uintptr_t>(v);
+    objectMask[position] = true;
+    ++ position;
   }
-}
-
-unsigned
-simpleFrameMapTableSize(MyThread* t, object method, object map)
-{
-  int size = frameMapSizeInBits(t, method);
-  return ceilingDivide(intArrayLength(t, map) * size, 32 + size);
-}
 
-uint8_t*
-finish(MyThread* t, FixedAllocator* allocator, avian::codegen::Assembler* a, const char* name,
-       unsigned length)
-{
-  uint8_t* start = static_cast<uint8_t*>
-    (allocator->allocate(length, TargetBytesPerWord));
+  void addInt(uintptr_t v) {
+    assert(t, position < size);
 
-  a->setDestination(start);
-  a->write();
+    array[position] = v;
+    objectMask[position] = false;
+    ++ position;
+  }
 
-  logCompile(t, start, length, 0, name, 0);
+  void addLong(uint64_t v) {
+    assert(t, position < size - 1);
 
-  return start;
-}
+    memcpy(array + position, &v, 8);
 
-void
-setBit(int32_t* dst, unsigned index)
-{
-  dst[index / 32] |= static_cast<int32_t>(1) << (index % 32);
-}
+    objectMask[position] = false;
+    objectMask[position + 1] = false;
 
-void
-clearBit(int32_t* dst, unsigned index)
-{
-  dst[index / 32] &= ~(static_cast<int32_t>(1) << (index % 32));
-}
+    position += 2;
+  }
 
-void
-copyFrameMap(int32_t* dst, uintptr_t* src, unsigned mapSizeInBits,
-             unsigned offset, TraceElement* p,
-             SubroutinePath* subroutinePath)
-{
-  if (DebugFrameMaps) {
-    fprintf(stderr, "  orig roots at ip %3d: ", p->ip);
-    printSet(src, ceilingDivide(mapSizeInBits, BitsPerWord));
-    print(subroutinePath);
-    fprintf(stderr, "\n");
+  MyThread* t;
+  uintptr_t* array;
+  bool* objectMask;
+  unsigned size;
+  unsigned position;
 
-    fprintf(stderr, " final roots at ip %3d: ", p->ip);
-  }
+  class MyProtector: public Thread::Protector {
+   public:
+    MyProtector(ArgumentList* list): Protector(list->t), list(list) { }
 
-  for (unsigned j = 0; j < p->argumentIndex; ++j) {
-    if (getBit(src, j)) {
-      if (DebugFrameMaps) {
-        fprintf(stderr, "1");
-      }
-      setBit(dst, offset + j);
-    } else {
-      if (DebugFrameMaps) {
-        fprintf(stderr, "_");
+    virtual void visit(Heap::Visitor* v) {
+      for (unsigned i = 0; i < list->position; ++i) {
+        if (list->objectMask[i]) {
+          v->visit(reinterpret_cast<object*>(list->array + i));
+        }
       }
-      clearBit(dst, offset + j);
     }
-  }
 
-  if (DebugFrameMaps) {
-    print(subroutinePath);
-    fprintf(stderr, "\n");
-  }
-}
+    ArgumentList* list;
+  } protector;
+};
 
-class FrameMapTableHeader {
- public:
-  FrameMapTableHeader(unsigned indexCount):
-    indexCount(indexCount)
-  { }
+object
+invoke(Thread* thread, object method, ArgumentList* arguments)
+{
+  MyThread* t = static_cast<MyThread*>(thread);
 
-  unsigned indexCount;
-};
+  if (false) {
+    PROTECT(t, method);
 
-class FrameMapTableIndexElement {
- public:
-  FrameMapTableIndexElement(int offset, unsigned base, unsigned path):
-    offset(offset),
-    base(base),
-    path(path)
-  { }
+    compile(t, local::codeAllocator(static_cast<MyThread*>(t)), 0,
+            resolveMethod
+            (t, root(t, Machine::AppLoader),
+             "foo/ClassName",
+             "methodName",
+             "()V"));
+  }
 
-  int offset;
-  unsigned base;
-  unsigned path;
-};
+  uintptr_t stackLimit = t->stackLimit;
+  uintptr_t stackPosition = reinterpret_cast<uintptr_t>(&t);
+  if (stackLimit == 0) {
+    t->stackLimit = stackPosition - t->m->stackSizeInBytes;
+  } else if (stackPosition < stackLimit) {
+    throwNew(t, Machine::StackOverflowErrorType);
+  }
 
-class FrameMapTablePath {
- public:
-  FrameMapTablePath(unsigned stackIndex, unsigned elementCount, unsigned next):
-    stackIndex(stackIndex),
-    elementCount(elementCount),
-    next(next)
-  { }
+  THREAD_RESOURCE(t, uintptr_t, stackLimit,
+                  static_cast<MyThread*>(t)->stackLimit = stackLimit);
 
-  unsigned stackIndex;
-  unsigned elementCount;
-  unsigned next;
-  int32_t elements[0];
-};
+  unsigned returnCode = methodReturnCode(t, method);
+  unsigned returnType = fieldType(t, returnCode);
 
-int
-compareInt32s(const void* va, const void* vb)
-{
-  return *static_cast<int32_t const*>(va) - *static_cast<int32_t const*>(vb);
-}
+  uint64_t result;
 
-int
-compare(SubroutinePath* a, SubroutinePath* b)
-{
-  if (a->stackNext) {
-    int d = compare(a->stackNext, b->stackNext);
-    if (d) return d;
-  }
-  int64_t av = a->call->returnAddress->value();
-  int64_t bv = b->call->returnAddress->value();
-  if (av > bv) {
-    return 1;
-  } else if (av < bv) {
-    return -1;
-  } else {
-    return 0;
+  if (codeAllocator(t)->sweep and unresolved(t, methodAddress(t, method))) {
+    // the sweeper has evicted the method since our caller compiled it
+    compile(t, codeAllocator(t), 0, method);
   }
-}
 
-int
-compareSubroutineTracePointers(const void* va, const void* vb)
-{
-  return compare((*static_cast<SubroutineTrace* const*>(va))->path,
-                 (*static_cast<SubroutineTrace* const*>(vb))->path);
-}
+  { MyThread::CallTrace trace(t, method);
 
-object
-makeGeneralFrameMapTable(MyThread* t, Context* context, uint8_t* start,
-                         TraceElement** elements, unsigned elementCount,
-                         unsigned pathFootprint, unsigned mapCount)
-{
-  unsigned mapSize = frameMapSizeInBits(t, context->method);
-  unsigned indexOffset = sizeof(FrameMapTableHeader);
-  unsigned mapsOffset = indexOffset
-    + (elementCount * sizeof(FrameMapTableIndexElement));
-  unsigned pathsOffset = mapsOffset + (ceilingDivide(mapCount * mapSize, 32) * 4);
+    MyCheckpoint checkpoint(t);
 
-  object table = makeByteArray(t, pathsOffset + pathFootprint);
-  
-  int8_t* body = &byteArrayBody(t, table, 0);
-  new (body) FrameMapTableHeader(elementCount);
- 
-  unsigned nextTableIndex = pathsOffset;
-  unsigned nextMapIndex = 0;
-  for (unsigned i = 0; i < elementCount; ++i) {
-    TraceElement* p = elements[i];
-    unsigned mapBase = nextMapIndex;
+    assert(t, arguments->position == arguments->size);
 
-    unsigned pathIndex;
-    if (p->subroutineTrace) {
-      FrameMapTablePath* previous = 0;
-      Subroutine* subroutine = p->subroutineTrace->path->call->subroutine;
-      for (Subroutine* s = subroutine; s; s = s->stackNext) {
-        if (s->tableIndex == 0) {
-          unsigned pathObjectSize = sizeof(FrameMapTablePath)
-            + (sizeof(int32_t) * s->callCount);
+    result = vmInvoke
+      (t, reinterpret_cast<void*>(methodAddress(t, method)),
+       arguments->array,
+       arguments->position * BytesPerWord,
+       t->arch->alignFrameSize
+       (t->arch->argumentFootprint(arguments->position))
+       * BytesPerWord,
+       returnType);
+  }
 
-          assert(t, nextTableIndex + pathObjectSize
-                 <= byteArrayLength(t, table));
+  if (t->exception) { 
+    if (UNLIKELY(t->flags & Thread::UseBackupHeapFlag)) {
+      collect(t, Heap::MinorCollection);
+    }
+    
+    object exception = t->exception;
+    t->exception = 0;
+    vm::throw_(t, exception);
+  }
 
-          s->tableIndex = nextTableIndex;
-          
-          nextTableIndex += pathObjectSize;
+  object r;
+  switch (returnCode) {
+  case ByteField:
+  case BooleanField:
+  case CharField:
+  case ShortField:
+  case FloatField:
+  case IntField:
+    r = makeInt(t, result);
+    break;
+
+  case LongField:
+  case DoubleField:
+    r = makeLong(t, result);
+    break;
 
-          FrameMapTablePath* current = new (body + s->tableIndex)
-            FrameMapTablePath
-            (s->stackIndex, s->callCount,
-             s->stackNext ? s->stackNext->tableIndex : 0);
+  case ObjectField:
+    r = reinterpret_cast<object>(result);
+    break;
 
-          unsigned i = 0;
-          for (SubroutineCall* c = subroutine->calls; c; c = c->next) {
-            assert(t, i < s->callCount);
+  case VoidField:
+    r = 0;
+    break;
 
-            current->elements[i++]
-              = static_cast<intptr_t>(c->returnAddress->value())
-              - reinterpret_cast<intptr_t>(start);
-          }
-          assert(t, i == s->callCount);
+  default:
+    abort(t);
+  }
 
-          qsort(current->elements, s->callCount, sizeof(int32_t),
-                compareInt32s);
+  return r;
+}
 
-          if (previous) {
-            previous->next = s->tableIndex;
-          }
+class SignalHandler: public System::SignalHandler {
+ public:
+  SignalHandler(Machine::Type type, Machine::Root root, unsigned fixedSize):
+    m(0), type(type), root(root), fixedSize(fixedSize) { }
 
-          previous = current;
+  virtual bool handleSignal(void** ip, void** frame, void** stack,
+                            void** thread)
+  {
+    MyThread* t = static_cast<MyThread*>(m->localThread->get());
+    if (t and t->state == Thread::ActiveState) {
+      object node = methodForIp(t, *ip);
+      if (node) {
+        // add one to the IP since findLineNumber will subtract one
+        // when we make the trace:
+        MyThread::TraceContext context
+          (t, static_cast<uint8_t*>(*ip) + 1,
+           static_cast<void**>(*stack) - t->arch->frameReturnAddressSize(),
+           t->continuation, t->trace);
+
+        if (ensure(t, fixedSize + traceSize(t))) {
+          atomicOr(&(t->flags), Thread::TracingFlag);
+          t->exception = makeThrowable(t, type);
+          atomicAnd(&(t->flags), ~Thread::TracingFlag);
         } else {
-          break;
+          // not enough memory available for a new exception and stack
+          // trace -- use a preallocated instance instead
+          t->exception = vm::root(t, root);
         }
-      }
 
-      pathIndex = subroutine->tableIndex;
-
-      THREAD_RUNTIME_ARRAY
-        (t, SubroutineTrace*, traces, p->subroutineTraceCount);
-
-      unsigned i = 0;
-      for (SubroutineTrace* trace = p->subroutineTrace;
-           trace; trace = trace->next)
-      {
-        assert(t, i < p->subroutineTraceCount);
-        RUNTIME_ARRAY_BODY(traces)[i++] = trace;
-      }
-      assert(t, i == p->subroutineTraceCount);
+        // printTrace(t, t->exception);
 
-      qsort(RUNTIME_ARRAY_BODY(traces), p->subroutineTraceCount,
-            sizeof(SubroutineTrace*), compareSubroutineTracePointers);
+        object continuation;
+        findUnwindTarget(t, ip, frame, stack, &continuation);
 
-      for (unsigned i = 0; i < p->subroutineTraceCount; ++i) {
-        assert(t, mapsOffset + ceilingDivide(nextMapIndex + mapSize, 32) * 4
-               <= pathsOffset);
+        transition(t, ip, stack, continuation, t->trace);
 
-        copyFrameMap(reinterpret_cast<int32_t*>(body + mapsOffset),
-                     RUNTIME_ARRAY_BODY(traces)[i]->map, mapSize,
-                     nextMapIndex, p, RUNTIME_ARRAY_BODY(traces)[i]->path);
+        *thread = t;
 
-        nextMapIndex += mapSize;
+        return true;
       }
-    } else {
-      pathIndex = 0;
-
-      assert(t, mapsOffset + ceilingDivide(nextMapIndex + mapSize, 32) * 4
-             <= pathsOffset);
-
-      copyFrameMap(reinterpret_cast<int32_t*>(body + mapsOffset), p->map,
-                   mapSize, nextMapIndex, p, 0);
-      
-      nextMapIndex += mapSize;
     }
 
-    unsigned elementIndex = indexOffset
-      + (i * sizeof(FrameMapTableIndexElement));
-
-    assert(t, elementIndex + sizeof(FrameMapTableIndexElement) <= mapsOffset);
+    if (compileLog) {
+      fflush(compileLog);
+    }
 
-    new (body + elementIndex) FrameMapTableIndexElement
-      (static_cast<intptr_t>(p->address->value())
-       - reinterpret_cast<intptr_t>(start), mapBase, pathIndex);
+    return false;
   }
 
-  assert(t, nextMapIndex == mapCount * mapSize);
+  Machine* m;
+  Machine::Type type;
+  Machine::Root root;
+  unsigned fixedSize;
+};
 
-  return table;
-}
+bool
+isThunk(MyThread* t, void* ip);
 
-object
-makeSimpleFrameMapTable(MyThread* t, Context* context, uint8_t* start, 
-                        TraceElement** elements, unsigned elementCount)
-{
-  unsigned mapSize = frameMapSizeInBits(t, context->method);
-  object table = makeIntArray
-    (t, elementCount + ceilingDivide(elementCount * mapSize, 32));
+bool
+isVirtualThunk(MyThread* t, void* ip);
 
-  assert(t, intArrayLength(t, table) == elementCount
-         + simpleFrameMapTableSize(t, context->method, table));
+bool
+isThunkUnsafeStack(MyThread* t, void* ip);
 
-  for (unsigned i = 0; i < elementCount; ++i) {
-    TraceElement* p = elements[i];
+void
+boot(MyThread* t, BootImage* image, uint8_t* code);
 
-    intArrayBody(t, table, i) = static_cast<intptr_t>(p->address->value())
-      - reinterpret_cast<intptr_t>(start);
+void
+linkCheckpoint(MyThread* t);
 
-    assert(t, elementCount + ceilingDivide((i + 1) * mapSize, 32)
-           <= intArrayLength(t, table));
+const char*
+writeCheckpoint(MyThread* t, const char* path);
 
-    if (mapSize) {
-      copyFrameMap(&intArrayBody(t, table, elementCount), p->map,
-                   mapSize, i * mapSize, p, 0);
-    }
-  }
+class MyProcessor;
 
-  return table;
-}
+MyProcessor*
+processor(MyThread* t);
 
 void
-finish(MyThread* t, FixedAllocator* allocator, Context* context)
-{
-  avian::codegen::Compiler* c = context->compiler;
+compileThunks(MyThread* t, CodeAllocator* allocator);
 
-  if (false) {
-    logCompile
-      (t, 0, 0,
-       reinterpret_cast<const char*>
-       (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
-       reinterpret_cast<const char*>
-       (&byteArrayBody(t, methodName(t, context->method), 0)),
-       reinterpret_cast<const char*>
-       (&byteArrayBody(t, methodSpec(t, context->method), 0)));
+class CompilationHandlerList {
+public:
+  CompilationHandlerList(CompilationHandlerList* next, Processor::CompilationHandler* handler):
+    next(next),
+    handler(handler) {}
+
+  void dispose(Allocator* allocator) {
+    if(this) {
+      next->dispose(allocator);
+      handler->dispose();
+      allocator->free(this, sizeof(*this));
+    }
   }
 
-  // for debugging:
-  if (false and
-      ::strcmp
-      (reinterpret_cast<const char*>
-       (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
-       "java/lang/System") == 0 and
-      ::strcmp
-      (reinterpret_cast<const char*>
-       (&byteArrayBody(t, methodName(t, context->method), 0)),
-       "<clinit>") == 0)
-  {
-    trap();
+  CompilationHandlerList* next;
+  Processor::CompilationHandler* handler;
+};
+
+template<class T, class C>
+int checkConstant(MyThread* t, size_t expected, T C::* field, const char* name) {
+  size_t actual = reinterpret_cast<uint8_t*>(&(t->*field)) - reinterpret_cast<uint8_t*>(t);
+  if(expected != actual) {
+    fprintf(stderr, "constant mismatch (%s): \n\tconstant says: %d\n\tc++ compiler says: %d\n", name, (unsigned) expected, (unsigned) actual);
+    return 1;
   }
+  return 0;
+}
 
-  // todo: this is a CPU-intensive operation, so consider doing it
-  // earlier before we've acquired the global class lock to improve
-  // parallelism (the downside being that it may end up being a waste
-  // of cycles if another thread compiles the same method in parallel,
-  // which might be mitigated by fine-grained, per-method locking):
-  c->compile(context->leaf ? 0 : stackOverflowThunk(t),
-             TARGET_THREAD_STACKLIMIT);
+class MyProcessor: public Processor {
+ public:
+  class Thunk {
+   public:
+    Thunk():
+      start(0), frameSavedOffset(0), length(0)
+    { }
 
-  // we must acquire the class lock here at the latest
- 
-  unsigned codeSize = c->resolve
-    (allocator->base + allocator->offset);
+    Thunk(uint8_t* start, unsigned frameSavedOffset, unsigned length):
+      start(start), frameSavedOffset(frameSavedOffset), length(length)
+    { }
 
-  unsigned total = pad(codeSize, TargetBytesPerWord)
-    + pad(c->poolSize(), TargetBytesPerWord);
+    uint8_t* start;
+    unsigned frameSavedOffset;
+    unsigned length;
+  };
 
-  target_uintptr_t* code = static_cast<target_uintptr_t*>
-    (allocator->allocate(total, TargetBytesPerWord));
-  uint8_t* start = reinterpret_cast<uint8_t*>(code);
+  class ThunkCollection {
+   public:
+    Thunk default_;
+    Thunk defaultVirtual;
+    Thunk native;
+    Thunk aioob;
+    Thunk stackOverflow;
+    Thunk table;
+  };
+
+  MyProcessor(System* s, Allocator* allocator, bool useNativeFeatures):
+    s(s),
+    allocator(allocator),
+    roots(0),
+    bootImage(0),
+    heapImage(0),
+    codeImage(0),
+    codeImageSize(0),
+    bootImageRegion(0),
+    bootedImage(0),
+    checkpointPath(0),
+    checkpointData(0),
+    checkpointSize(0),
+    segFaultHandler(Machine::NullPointerExceptionType,
+                    Machine::NullPointerException,
+                    FixedSizeOfNullPointerException),
+    divideByZeroHandler(Machine::ArithmeticExceptionType,
+                        Machine::ArithmeticException,
+                        FixedSizeOfArithmeticException),
+    codeAllocator(s, allocator),
+    codeCacheFile(s, allocator),
+    callTableSize(0),
+    useNativeFeatures(useNativeFeatures),
+    compilationHandlers(0)
+  {
+    thunkTable[compileMethodIndex] = voidPointer(local::compileMethod);
+    thunkTable[compileVirtualMethodIndex] = voidPointer(compileVirtualMethod);
+    thunkTable[invokeNativeIndex] = voidPointer(invokeNative);
+    thunkTable[throwArrayIndexOutOfBoundsIndex] = voidPointer
+      (throwArrayIndexOutOfBounds);
+    thunkTable[throwStackOverflowIndex] = voidPointer(throwStackOverflow);
+#define THUNK(s) thunkTable[s##Index] = voidPointer(s);
+#include "thunks.cpp"
+#undef THUNK
+    // Set the dummyIndex entry to a constant which should require the
+    // maximum number of bytes to represent in assembly code
+    // (i.e. can't be represented by a smaller number of bytes and
+    // implicitly sign- or zero-extended).  We'll use this property
+    // later to determine the maximum size of a thunk in the thunk
+    // table.
+    thunkTable[dummyIndex] = reinterpret_cast<void*>
+      (static_cast<uintptr_t>(UINT64_C(0x5555555555555555)));
+  }
 
-  context->executableAllocator = allocator;
-  context->executableStart = code;
-  context->executableSize = total;
+  virtual Thread*
+  makeThread(Machine* m, object javaThread, Thread* parent)
+  {
+    MyThread* t = new (m->heap->allocate(sizeof(MyThread)))
+      MyThread(m, javaThread, static_cast<MyThread*>(parent),
+               useNativeFeatures);
 
-  if (context->objectPool) {
-    object pool = allocate3
-      (t, allocator, Machine::ImmortalAllocation,
-       FixedSizeOfArray + ((context->objectPoolCount + 1) * BytesPerWord),
-       true);
+    t->heapImage = heapImage;
+    t->codeImage = codeImage;
+    t->thunkTable = thunkTable;
 
-    context->executableSize = (allocator->base + allocator->offset)
-      - static_cast<uint8_t*>(context->executableStart);
+#if TARGET_BYTES_PER_WORD == BYTES_PER_WORD
 
-    initArray(t, pool, context->objectPoolCount + 1);
-    mark(t, pool, 0);
+    int mismatches =
+      checkConstant(t, TARGET_THREAD_EXCEPTION, &Thread::exception, "TARGET_THREAD_EXCEPTION") +
+      checkConstant(t, TARGET_THREAD_EXCEPTIONSTACKADJUSTMENT, &MyThread::exceptionStackAdjustment, "TARGET_THREAD_EXCEPTIONSTACKADJUSTMENT") +
+      checkConstant(t, TARGET_THREAD_EXCEPTIONOFFSET, &MyThread::exceptionOffset, "TARGET_THREAD_EXCEPTIONOFFSET") +
+      checkConstant(t, TARGET_THREAD_EXCEPTIONHANDLER, &MyThread::exceptionHandler, "TARGET_THREAD_EXCEPTIONHANDLER") +
+      checkConstant(t, TARGET_THREAD_IP, &MyThread::ip, "TARGET_THREAD_IP") +
+      checkConstant(t, TARGET_THREAD_STACK, &MyThread::stack, "TARGET_THREAD_STACK") +
+      checkConstant(t, TARGET_THREAD_NEWSTACK, &MyThread::newStack, "TARGET_THREAD_NEWSTACK") +
+      checkConstant(t, TARGET_THREAD_TAILADDRESS, &MyThread::tailAddress, "TARGET_THREAD_TAILADDRESS") +
+      checkConstant(t, TARGET_THREAD_VIRTUALCALLTARGET, &MyThread::virtualCallTarget, "TARGET_THREAD_VIRTUALCALLTARGET") +
+      checkConstant(t, TARGET_THREAD_VIRTUALCALLINDEX, &MyThread::virtualCallIndex, "TARGET_THREAD_VIRTUALCALLINDEX") +
+      checkConstant(t, TARGET_THREAD_HEAPIMAGE, &MyThread::heapImage, "TARGET_THREAD_HEAPIMAGE") +
+      checkConstant(t, TARGET_THREAD_CODEIMAGE, &MyThread::codeImage, "TARGET_THREAD_CODEIMAGE") +
+      checkConstant(t, TARGET_THREAD_THUNKTABLE, &MyThread::thunkTable, "TARGET_THREAD_THUNKTABLE") +
+      checkConstant(t, TARGET_THREAD_STACKLIMIT, &MyThread::stackLimit, "TARGET_THREAD_STACKLIMIT");
 
-    set(t, pool, ArrayBody, root(t, ObjectPools));
-    setRoot(t, ObjectPools, pool);
+    if(mismatches > 0) {
+      fprintf(stderr, "%d constant mismatches\n", mismatches);
+      abort(t);
+    }
 
-    unsigned i = 1;
-    for (PoolElement* p = context->objectPool; p; p = p->next) {
-      unsigned offset = ArrayBody + ((i++) * BytesPerWord);
+#endif
 
-      p->address = reinterpret_cast<uintptr_t>(pool) + offset;
+    t->init();
 
-      set(t, pool, offset, p->target);
-    }
+    return t;
   }
 
-  c->write();
-
-  BootContext* bc = context->bootContext;
-  if (bc) {
-    for (avian::codegen::DelayedPromise* p = bc->addresses;
-         p != bc->addressSentinal;
-         p = p->next)
-    {
-      p->basis = new(bc->zone) avian::codegen::ResolvedPromise(p->basis->value());
+  virtual object
+  makeMethod(vm::Thread* t,
+             uint8_t vmFlags,
+             uint8_t returnCode,
+             uint8_t parameterCount,
+             uint8_t parameterFootprint,
+             uint16_t flags,
+             uint16_t offset,
+             object name,
+             object spec,
+             object addendum,
+             object class_,
+             object code)
+  {
+    if (code) {
+      codeCompiled(t, code) = local::defaultThunk(static_cast<MyThread*>(t));
     }
-  }
-
-  { object newExceptionHandlerTable = translateExceptionHandlerTable
-      (t, context, reinterpret_cast<intptr_t>(start),
-       reinterpret_cast<intptr_t>(start) + codeSize);
-
-    PROTECT(t, newExceptionHandlerTable);
-
-    object newLineNumberTable = translateLineNumberTable
-      (t, context, reinterpret_cast<intptr_t>(start));
 
-    object code = methodCode(t, context->method);
-
-    code = makeCode
-      (t, 0, newExceptionHandlerTable, newLineNumberTable,
-       reinterpret_cast<uintptr_t>(start), codeSize, codeMaxStack(t, code),
-       codeMaxLocals(t, code), 0);
+    return vm::makeMethod
+      (t, vmFlags, returnCode, parameterCount, parameterFootprint, flags,
+       offset, 0, 0, name, spec, addendum, class_, code);
+  }
 
-    set(t, context->method, MethodCode, code);
+  virtual object
+  makeClass(vm::Thread* t,
+            uint16_t flags,
+            uint16_t vmFlags,
+            uint16_t fixedSize,
+            uint8_t arrayElementSize,
+            uint8_t arrayDimensions,
+            object objectMask,
+            object name,
+            object sourceFile,
+            object super,
+            object interfaceTable,
+            object virtualTable,
+            object fieldTable,
+            object methodTable,
+            object staticTable,
+            object addendum, 
+            object loader,
+            unsigned vtableLength)
+  {
+    return vm::makeClass
+      (t, flags, vmFlags, fixedSize, arrayElementSize, arrayDimensions,
+       0, objectMask, name, sourceFile, super, interfaceTable, virtualTable,
+       fieldTable, methodTable, staticTable, addendum, loader, 0, 0,
+       vtableLength);
   }
 
-  if (context->traceLogCount) {
-    THREAD_RUNTIME_ARRAY(t, TraceElement*, elements, context->traceLogCount);
-    unsigned index = 0;
-    unsigned pathFootprint = 0;
-    unsigned mapCount = 0;
-    for (TraceElement* p = context->traceLog; p; p = p->next) {
-      assert(t, index < context->traceLogCount);
+  virtual void
+  initVtable(Thread* t, object c)
+  {
+    PROTECT(t, c);
+    for (int i = classLength(t, c) - 1; i >= 0; --i) {
+      void* thunk = reinterpret_cast<void*>
+        (virtualThunk(static_cast<MyThread*>(t), i));
+      classVtable(t, c, i) = thunk;
+    }
+  }
 
-      if (p->address) {
-        SubroutineTrace* trace = p->subroutineTrace;
-        unsigned myMapCount = 1;
-        if (trace) {
-          for (Subroutine* s = trace->path->call->subroutine;
-               s; s = s->stackNext)
-          {
-            unsigned callCount = s->callCount;
-            myMapCount *= callCount;
-            if (not s->visited) {
-              s->visited = true;
-              pathFootprint += sizeof(FrameMapTablePath)
-                + (sizeof(int32_t) * callCount);
-            }
-          }
-        }
-      
-        mapCount += myMapCount;
+  virtual void
+  visitObjects(Thread* vmt, Heap::Visitor* v)
+  {
+    MyThread* t = static_cast<MyThread*>(vmt);
 
-        RUNTIME_ARRAY_BODY(elements)[index++] = p;
+    if (t == t->m->rootThread) {
+      v->visit(&roots);
+    }
 
-        if (p->target) {
-          insertCallNode
-            (t, makeCallNode
-             (t, p->address->value(), p->target, p->flags, 0));
-        }
-      }
+    for (MyThread::CallTrace* trace = t->trace; trace; trace = trace->next) {
+      v->visit(&(trace->continuation));
+      v->visit(&(trace->nativeMethod));
+      v->visit(&(trace->targetMethod));
+      v->visit(&(trace->originalMethod));
     }
 
-    qsort(RUNTIME_ARRAY_BODY(elements), index,
-          sizeof(TraceElement*), compareTraceElementPointers);
+    v->visit(&(t->continuation));
 
-    object map;
-    if (pathFootprint) {
-      map = makeGeneralFrameMapTable
-        (t, context, start, RUNTIME_ARRAY_BODY(elements), index, pathFootprint,
-         mapCount);
-    } else {
-      map = makeSimpleFrameMapTable
-        (t, context, start, RUNTIME_ARRAY_BODY(elements), index);
+    for (Reference* r = t->reference; r; r = r->next) {
+      v->visit(&(r->target));
     }
 
-    set(t, methodCode(t, context->method), CodePool, map);
+    visitStack(t, v);
   }
 
-  logCompile
-    (t, start, codeSize,
-     reinterpret_cast<const char*>
-     (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
-     reinterpret_cast<const char*>
-     (&byteArrayBody(t, methodName(t, context->method), 0)),
-     reinterpret_cast<const char*>
-     (&byteArrayBody(t, methodSpec(t, context->method), 0)));
+  virtual void
+  walkStack(Thread* vmt, StackVisitor* v)
+  {
+    MyThread* t = static_cast<MyThread*>(vmt);
 
-  // for debugging:
-  if (false and
-      ::strcmp
-      (reinterpret_cast<const char*>
-       (&byteArrayBody(t, className(t, methodClass(t, context->method)), 0)),
-       "java/lang/System") == 0 and
-      ::strcmp
-      (reinterpret_cast<const char*>
-       (&byteArrayBody(t, methodName(t, context->method), 0)),
-       "<clinit>") == 0)
+    MyStackWalker walker(t);
+    walker.walk(v);
+  }
+
+  virtual int
+  lineNumber(Thread* vmt, object method, int ip)
   {
-    trap();
+    return findLineNumber(static_cast<MyThread*>(vmt), method, ip);
   }
-#if !defined(AVIAN_AOT_ONLY)
-  syncInstructionCache(start, codeSize);
-#endif
-}
 
-void
-compile(MyThread* t, Context* context)
-{
-  avian::codegen::Compiler* c = context->compiler;
+  virtual object*
+  makeLocalReference(Thread* vmt, object o)
+  {
+    if (o) {
+      MyThread* t = static_cast<MyThread*>(vmt);
 
-//   fprintf(stderr, "compiling %s.%s%s\n",
-//           &byteArrayBody(t, className(t, methodClass(t, context->method)), 0),
-//           &byteArrayBody(t, methodName(t, context->method), 0),
-//           &byteArrayBody(t, methodSpec(t, context->method), 0));
+      for (Reference* r = t->reference; r; r = r->next) {
+        if (r->target == o) {
+          acquire(t, r);
 
-  unsigned footprint = methodParameterFootprint(t, context->method);
-  unsigned locals = localSize(t, context->method);
-  c->init(codeLength(t, methodCode(t, context->method)), footprint, locals,
-          alignedFrameSize(t, context->method));
+          return &(r->target);
+        }
+      }
 
-  THREAD_RUNTIME_ARRAY(t, uint8_t, stackMap,
-                codeMaxStack(t, methodCode(t, context->method)));
-  Frame frame(context, RUNTIME_ARRAY_BODY(stackMap));
+      Reference* r = new (t->m->heap->allocate(sizeof(Reference)))
+        Reference(o, &(t->reference), false);
+
+      acquire(t, r);
+
+      return &(r->target);
+    } else {
+      return 0;
+    }
+  }
 
-  unsigned index = methodParameterFootprint(t, context->method);
-  if ((methodFlags(t, context->method) & ACC_STATIC) == 0) {
-    frame.set(--index, Frame::Object);
-    c->initLocal(1, index, Compiler::ObjectType);
+  virtual void
+  disposeLocalReference(Thread* t, object* r)
+  {
+    if (r) {
+      release(t, reinterpret_cast<Reference*>(r));
+    }
   }
 
-  for (MethodSpecIterator it
-         (t, reinterpret_cast<const char*>
-          (&byteArrayBody(t, methodSpec(t, context->method), 0)));
-       it.hasNext();)
+  virtual bool
+  pushLocalFrame(Thread* vmt, unsigned)
   {
-    switch (*it.next()) {
-    case 'L':
-    case '[':
-      frame.set(--index, Frame::Object);
-      c->initLocal(1, index, Compiler::ObjectType);
-      break;
-      
-    case 'J':
-      frame.set(--index, Frame::Long);
-      frame.set(--index, Frame::Long);
-      c->initLocal(2, index, Compiler::IntegerType);
-      break;
+    MyThread* t = static_cast<MyThread*>(vmt);
 
-    case 'D':
-      frame.set(--index, Frame::Long);
-      frame.set(--index, Frame::Long);
-      c->initLocal(2, index, Compiler::FloatType);
-      break;
-      
-    case 'F':
-      frame.set(--index, Frame::Integer);
-      c->initLocal(1, index, Compiler::FloatType);
-      break;
-      
-    default:
-      frame.set(--index, Frame::Integer);
-      c->initLocal(1, index, Compiler::IntegerType);
-      break;
-    }
+    t->referenceFrame = new
+      (t->m->heap->allocate(sizeof(MyThread::ReferenceFrame)))
+      MyThread::ReferenceFrame(t->referenceFrame, t->reference);
+    
+    return true;
   }
 
-  handleEntrance(t, &frame);
+  virtual void
+  popLocalFrame(Thread* vmt)
+  {
+    MyThread* t = static_cast<MyThread*>(vmt);
 
-  Compiler::State* state = c->saveState();
+    MyThread::ReferenceFrame* f = t->referenceFrame;
+    t->referenceFrame = f->next;
+    while (t->reference != f->reference) {
+      vm::dispose(t, t->reference);
+    }
 
-  compile(t, &frame, 0);
+    t->m->heap->free(f, sizeof(MyThread::ReferenceFrame));
+  }
 
-  context->dirtyRoots = false;
-  unsigned eventIndex = calculateFrameMaps(t, context, 0, 0);
+  virtual object
+  invokeArray(Thread* t, object method, object this_, object arguments)
+  {
+    assert(t, t->exception == 0);
 
-  object eht = codeExceptionHandlerTable(t, methodCode(t, context->method));
-  if (eht) {
-    PROTECT(t, eht);
+    assert(t, t->state == Thread::ActiveState
+           or t->state == Thread::ExclusiveState);
 
-    unsigned visitCount = exceptionHandlerTableLength(t, eht);
+    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
 
-    THREAD_RUNTIME_ARRAY(t, bool, visited, visitCount);
-    memset(RUNTIME_ARRAY_BODY(visited), 0, visitCount * sizeof(bool));
+    method = findMethod(t, method, this_);
 
-    bool progress = true;
-    while (progress) {
-      progress = false;
+    const char* spec = reinterpret_cast<char*>
+      (&byteArrayBody(t, methodSpec(t, method), 0));
 
-      for (unsigned i = 0; i < exceptionHandlerTableLength(t, eht); ++i) {
-        uint64_t eh = exceptionHandlerTableBody(t, eht, i);
-        int start = resolveIpForwards
-          (context, exceptionHandlerStart(eh), exceptionHandlerEnd(eh));
+    unsigned size = methodParameterFootprint(t, method);
+    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
+    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
+    ArgumentList list
+      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
+       this_, spec, arguments);
+    
+    PROTECT(t, method);
 
-        if ((not RUNTIME_ARRAY_BODY(visited)[i])
-            and start >= 0
-            and context->visitTable[start])
-        {
-          RUNTIME_ARRAY_BODY(visited)[i] = true;
-          progress = true;
+    compile(static_cast<MyThread*>(t),
+            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
 
-          c->restoreState(state);
+    return local::invoke(t, method, &list);
+  }
 
-          THREAD_RUNTIME_ARRAY
-            (t, uint8_t, stackMap,
-             codeMaxStack(t, methodCode(t, context->method)));
-          Frame frame2(&frame, RUNTIME_ARRAY_BODY(stackMap));
+  virtual object
+  invokeArray(Thread* t, object method, object this_, const jvalue* arguments)
+  {
+    assert(t, t->exception == 0);
 
-          unsigned end = exceptionHandlerEnd(eh);
-          if (exceptionHandlerIp(eh) >= static_cast<unsigned>(start)
-              and exceptionHandlerIp(eh) < end)
-          {
-            end = exceptionHandlerIp(eh);
-          }
+    assert(t, t->state == Thread::ActiveState
+           or t->state == Thread::ExclusiveState);
 
-          context->eventLog.append(PushExceptionHandlerEvent);
-          context->eventLog.append2(start);
-          context->eventLog.append2(end);
+    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
+    
+    method = findMethod(t, method, this_);
 
-          for (unsigned i = 1;
-               i < codeMaxStack(t, methodCode(t, context->method));
-               ++i)
-          {
-            frame2.set(localSize(t, context->method) + i, Frame::Integer);
-          }
+    const char* spec = reinterpret_cast<char*>
+      (&byteArrayBody(t, methodSpec(t, method), 0));
 
-          compile(t, &frame2, exceptionHandlerIp(eh), start);
+    unsigned size = methodParameterFootprint(t, method);
+    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
+    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
+    ArgumentList list
+      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
+       this_, spec, arguments);
 
-          context->eventLog.append(PopContextEvent);
+    PROTECT(t, method);
 
-          eventIndex = calculateFrameMaps(t, context, 0, eventIndex);
-        }
-      }
-    }
-  }
+    compile(static_cast<MyThread*>(t),
+            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
 
-  while (context->dirtyRoots) {
-    context->dirtyRoots = false;
-    calculateFrameMaps(t, context, 0, 0);
+    return local::invoke(t, method, &list);
   }
-}
 
-void
-updateCall(MyThread* t, avian::codegen::lir::UnaryOperation op, void* returnAddress, void* target)
-{
-  t->arch->updateCall(op, returnAddress, target);
-}
+  virtual object
+  invokeList(Thread* t, object method, object this_, bool indirectObjects,
+             va_list arguments)
+  {
+    assert(t, t->exception == 0);
 
-void*
-compileMethod2(MyThread* t, void* ip);
+    assert(t, t->state == Thread::ActiveState
+           or t->state == Thread::ExclusiveState);
 
-uint64_t
-compileMethod(MyThread* t)
-{
-  void* ip;
-  if (t->tailAddress) {
-    ip = t->tailAddress;
-    t->tailAddress = 0;
-  } else {
-    ip = getIp(t);
-  }
+    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
+    
+    method = findMethod(t, method, this_);
 
-  return reinterpret_cast<uintptr_t>(compileMethod2(t, ip));
-}
+    const char* spec = reinterpret_cast<char*>
+      (&byteArrayBody(t, methodSpec(t, method), 0));
 
-void*
-compileVirtualMethod2(MyThread* t, object class_, unsigned index)
-{
-  // If class_ has BootstrapFlag set, that means its vtable is not yet
-  // available.  However, we must set t->trace->targetMethod to an
-  // appropriate method to ensure we can accurately scan the stack for
-  // GC roots.  We find such a method by looking for a superclass with
-  // a vtable and using it instead:
+    unsigned size = methodParameterFootprint(t, method);
+    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
+    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
+    ArgumentList list
+      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
+       this_, spec, indirectObjects, arguments);
 
-  object c = class_;
-  while (classVmFlags(t, c) & BootstrapFlag) {
-    c = classSuper(t, c);
+    PROTECT(t, method);
+
+    compile(static_cast<MyThread*>(t),
+            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
+
+    return local::invoke(t, method, &list);
   }
-  t->trace->targetMethod = arrayBody(t, classVirtualTable(t, c), index);
 
-  THREAD_RESOURCE0(t, static_cast<MyThread*>(t)->trace->targetMethod = 0;);
+  virtual object
+  invokeList(Thread* t, object loader, const char* className,
+             const char* methodName, const char* methodSpec,
+             object this_, va_list arguments)
+  {
+    assert(t, t->exception == 0);
 
-  PROTECT(t, class_);
+    assert(t, t->state == Thread::ActiveState
+           or t->state == Thread::ExclusiveState);
 
-  object target = resolveTarget(t, class_, index);
-  PROTECT(t, target);
+    unsigned size = parameterFootprint(t, methodSpec, this_ == 0);
+    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
+    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
+    ArgumentList list
+      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
+       this_, methodSpec, false, arguments);
 
-  compile(t, codeAllocator(t), 0, target);
+    object method = resolveMethod
+      (t, loader, className, methodName, methodSpec);
 
-  void* address = reinterpret_cast<void*>(methodAddress(t, target));
-  if (methodFlags(t, target) & ACC_NATIVE) {
-    t->trace->nativeMethod = target;
-  } else {
-    classVtable(t, class_, methodOffset(t, target)) = address;
-  }
-  return address;
-}
+    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
 
-uint64_t
-compileVirtualMethod(MyThread* t)
-{
-  object class_ = objectClass(t, static_cast<object>(t->virtualCallTarget));
-  t->virtualCallTarget = 0;
+    PROTECT(t, method);
+      
+    compile(static_cast<MyThread*>(t), 
+            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
+
+    return local::invoke(t, method, &list);
+  }
 
-  unsigned index = t->virtualCallIndex;
-  t->virtualCallIndex = 0;
+  virtual void dispose(Thread* vmt) {
+    MyThread* t = static_cast<MyThread*>(vmt);
 
-  return reinterpret_cast<uintptr_t>(compileVirtualMethod2(t, class_, index));
-}
+    while (t->reference) {
+      vm::dispose(t, t->reference);
+    }
 
-uint64_t
-invokeNativeFast(MyThread* t, object method, void* function)
-{
-  FastNativeFunction f; memcpy(&f, &function, sizeof(void*));
-  return f(t, method,
-           static_cast<uintptr_t*>(t->stack)
-           + t->arch->frameFooterSize()
-           + t->arch->frameReturnAddressSize());
-}
+    t->arch->release();
 
-uint64_t
-invokeNativeSlow(MyThread* t, object method, void* function)
-{
-  PROTECT(t, method);
+    t->m->heap->free(t, sizeof(*t));
 
-  unsigned footprint = methodParameterFootprint(t, method) + 1;
-  if (methodFlags(t, method) & ACC_STATIC) {
-    ++ footprint;
   }
-  unsigned count = methodParameterCount(t, method) + 2;
 
-  THREAD_RUNTIME_ARRAY(t, uintptr_t, args, footprint);
-  unsigned argOffset = 0;
-  THREAD_RUNTIME_ARRAY(t, uint8_t, types, count);
-  unsigned typeOffset = 0;
+  virtual void dispose() {
+#if !defined(AVIAN_AOT_ONLY)
+    codeAllocator.dispose();
+#endif
 
-  RUNTIME_ARRAY_BODY(args)[argOffset++] = reinterpret_cast<uintptr_t>(t);
-  RUNTIME_ARRAY_BODY(types)[typeOffset++] = POINTER_TYPE;
+    codeCacheFile.dispose();
 
-  uintptr_t* sp = static_cast<uintptr_t*>(t->stack)
-    + t->arch->frameFooterSize()
-    + t->arch->frameReturnAddressSize();
+    if (bootImageRegion) {
+      bootImageRegion->dispose();
+    }
 
-  object jclass = 0;
-  PROTECT(t, jclass);
+    if (checkpointData) {
+      allocator->free(checkpointData, checkpointSize);
+    }
 
-  if (methodFlags(t, method) & ACC_STATIC) {
-    jclass = getJClass(t, methodClass(t, method));
-    RUNTIME_ARRAY_BODY(args)[argOffset++]
-      = reinterpret_cast<uintptr_t>(&jclass);
-  } else {
-    RUNTIME_ARRAY_BODY(args)[argOffset++]
-      = reinterpret_cast<uintptr_t>(sp++);
+    compilationHandlers->dispose(allocator);
+
+    s->handleSegFault(0);
+
+    allocator->free(this, sizeof(*this));
   }
-  RUNTIME_ARRAY_BODY(types)[typeOffset++] = POINTER_TYPE;
 
-  MethodSpecIterator it
-    (t, reinterpret_cast<const char*>
-     (&byteArrayBody(t, methodSpec(t, method), 0)));
-  
-  while (it.hasNext()) {
-    unsigned type = RUNTIME_ARRAY_BODY(types)[typeOffset++]
-      = fieldType(t, fieldCode(t, *it.next()));
+  virtual object getStackTrace(Thread* vmt, Thread* vmTarget) {
+    MyThread* t = static_cast<MyThread*>(vmt);
+    MyThread* target = static_cast<MyThread*>(vmTarget);
+    MyProcessor* p = this;
 
-    switch (type) {
-    case INT8_TYPE:
-    case INT16_TYPE:
-    case INT32_TYPE:
-    case FLOAT_TYPE:
-      RUNTIME_ARRAY_BODY(args)[argOffset++] = *(sp++);
-      break;
+    class Visitor: public System::ThreadVisitor {
+     public:
+      Visitor(MyThread* t, MyProcessor* p, MyThread* target):
+        t(t), p(p), target(target), trace(0)
+      { }
 
-    case INT64_TYPE:
-    case DOUBLE_TYPE: {
-      memcpy(RUNTIME_ARRAY_BODY(args) + argOffset, sp, 8);
-      argOffset += (8 / BytesPerWord);
-      sp += 2;
-    } break;
+      virtual void visit(void* ip, void* stack, void* link) {
+        MyThread::TraceContext c(target, link);
 
-    case POINTER_TYPE: {
-      if (*sp) {
-        RUNTIME_ARRAY_BODY(args)[argOffset++]
-          = reinterpret_cast<uintptr_t>(sp);
-      } else {
-        RUNTIME_ARRAY_BODY(args)[argOffset++] = 0;
+        if (methodForIp(t, ip)) {
+          // we caught the thread in Java code - use the register values
+          c.ip = ip;
+          c.stack = stack;
+          c.methodIsMostRecent = true;
+        } else if (target->transition) {
+          // we caught the thread in native code while in the middle
+          // of updating the context fields (MyThread::stack, etc.)
+          static_cast<MyThread::Context&>(c) = *(target->transition);
+        } else if (isVmInvokeUnsafeStack(ip)) {
+          // we caught the thread in native code just after returning
+          // from java code, but before clearing MyThread::stack
+          // (which now contains a garbage value), and the most recent
+          // Java frame, if any, can be found in
+          // MyThread::continuation or MyThread::trace
+          c.ip = 0;
+          c.stack = 0;
+        } else if (target->stack
+                   and (not isThunkUnsafeStack(t, ip))
+                   and (not isVirtualThunk(t, ip)))
+        {
+          // we caught the thread in a thunk or native code, and the
+          // saved stack pointer indicates the most recent Java frame
+          // on the stack
+          c.ip = getIp(target);
+          c.stack = target->stack;
+        } else if (isThunk(t, ip) or isVirtualThunk(t, ip)) {
+          // we caught the thread in a thunk where the stack register
+          // indicates the most recent Java frame on the stack
+          
+          // On e.g. x86, the return address will have already been
+          // pushed onto the stack, in which case we use getIp to
+          // retrieve it.  On e.g. PowerPC and ARM, it will be in the
+          // link register.  Note that we can't just check if the link
+          // argument is null here, since we use ecx/rcx as a
+          // pseudo-link register on x86 for the purpose of tail
+          // calls.
+          c.ip = t->arch->hasLinkRegister() ? link : getIp(t, link, stack);
+          c.stack = stack;
+        } else {
+          // we caught the thread in native code, and the most recent
+          // Java frame, if any, can be found in
+          // MyThread::continuation or MyThread::trace
+          c.ip = 0;
+          c.stack = 0;
+        }
+
+        if (ensure(t, traceSize(target))) {
+          atomicOr(&(t->flags), Thread::TracingFlag);
+          trace = makeTrace(t, target);
+          atomicAnd(&(t->flags), ~Thread::TracingFlag);
+        }
       }
-      ++ sp;
-    } break;
 
-    default: abort(t);
+      MyThread* t;
+      MyProcessor* p;
+      MyThread* target;
+      object trace;
+    } visitor(t, p, target);
+
+    t->m->system->visit(t->systemThread, target->systemThread, &visitor);
+
+    if (UNLIKELY(t->flags & Thread::UseBackupHeapFlag)) {
+      PROTECT(t, visitor.trace);
+
+      collect(t, Heap::MinorCollection);
     }
-  }
 
-  unsigned returnCode = methodReturnCode(t, method);
-  unsigned returnType = fieldType(t, returnCode);
-  uint64_t result;
+    return visitor.trace ? visitor.trace : makeObjectArray(t, 0);
+  }
 
-  if (DebugNatives) {
-    fprintf(stderr, "invoke native method %s.%s\n",
-            &byteArrayBody(t, className(t, methodClass(t, method)), 0),
-            &byteArrayBody(t, methodName(t, method), 0));
+  virtual void initialize(BootImage* image, uint8_t* code, unsigned capacity) {
+    bootImage = image;
+    codeAllocator.initialize(code, capacity, capacity, 0, false);
   }
 
-  if (methodFlags(t, method) & ACC_SYNCHRONIZED) {
-    if (methodFlags(t, method) & ACC_STATIC) {
-      acquire(t, methodClass(t, method));
-    } else {
-      acquire(t, *reinterpret_cast<object*>(RUNTIME_ARRAY_BODY(args)[1]));
-    }
+  virtual void addCompilationHandler(CompilationHandler* handler) {
+    compilationHandlers = new(allocator->allocate(sizeof(CompilationHandlerList))) CompilationHandlerList(compilationHandlers, handler);
   }
 
-  Reference* reference = t->reference;
+  virtual void compileMethod(Thread* vmt, Zone* zone, object* constants,
+                             object* calls, avian::codegen::DelayedPromise** addresses,
+                             object method, OffsetResolver* resolver)
+  {
+    MyThread* t = static_cast<MyThread*>(vmt);
+    BootContext bootContext(t, *constants, *calls, *addresses, zone, resolver);
 
-  { ENTER(t, Thread::IdleState);
+    compile(t, &codeAllocator, &bootContext, method);
 
-    bool noThrow = t->checkpoint->noThrow;
-    t->checkpoint->noThrow = true;
-    THREAD_RESOURCE(t, bool, noThrow, t->checkpoint->noThrow = noThrow);
+    *constants = bootContext.constants;
+    *calls = bootContext.calls;
+    *addresses = bootContext.addresses;
+  }
 
-    result = t->m->system->call
-      (function,
-       RUNTIME_ARRAY_BODY(args),
-       RUNTIME_ARRAY_BODY(types),
-       count,
-       footprint * BytesPerWord,
-       returnType);
+  virtual void visitRoots(Thread* t, HeapWalker* w) {
+    bootImage->methodTree = w->visitRoot(root(t, MethodTree));
+    bootImage->methodTreeSentinal = w->visitRoot(root(t, MethodTreeSentinal));
+    bootImage->virtualThunks = w->visitRoot(root(t, VirtualThunks));
   }
 
-  if (methodFlags(t, method) & ACC_SYNCHRONIZED) {
-    if (methodFlags(t, method) & ACC_STATIC) {
-      release(t, methodClass(t, method));
-    } else {
-      release(t, *reinterpret_cast<object*>(RUNTIME_ARRAY_BODY(args)[1]));
+  virtual void normalizeVirtualThunks(Thread* t) {
+    for (unsigned i = 0; i < wordArrayLength(t, root(t, VirtualThunks));
+         i += 2)
+    {
+      if (wordArrayBody(t, root(t, VirtualThunks), i)) {
+        wordArrayBody(t, root(t, VirtualThunks), i)
+          -= reinterpret_cast<uintptr_t>(codeAllocator.base);
+      }
     }
   }
 
-  if (DebugNatives) {
-    fprintf(stderr, "return from native method %s.%s\n",
-            &byteArrayBody(t, className(t, methodClass(t, method)), 0),
-            &byteArrayBody(t, methodName(t, method), 0));
-  }
+  virtual unsigned* makeCallTable(Thread* t, HeapWalker* w) {
+    bootImage->codeSize = codeAllocator.offset;
+    bootImage->callCount = callTableSize;
 
-  if (UNLIKELY(t->exception)) {
-    object exception = t->exception;
-    t->exception = 0;
-    vm::throw_(t, exception);
-  }
+    unsigned* table = static_cast<unsigned*>
+      (t->m->heap->allocate(callTableSize * sizeof(unsigned) * 2));
 
-  switch (returnCode) {
-  case ByteField:
-  case BooleanField:
-    result = static_cast<int8_t>(result);
-    break;
+    unsigned index = 0;
+    for (unsigned i = 0; i < arrayLength(t, root(t, CallTable)); ++i) {
+      for (object p = arrayBody(t, root(t, CallTable), i);
+           p; p = callNodeNext(t, p))
+      {
+        table[index++] = targetVW
+          (callNodeAddress(t, p)
+           - reinterpret_cast<uintptr_t>(codeAllocator.base));
+        table[index++] = targetVW
+          (w->map()->find(callNodeTarget(t, p))
+           | (static_cast<unsigned>(callNodeFlags(t, p)) << TargetBootShift));
+      }
+    }
 
-  case CharField:
-    result = static_cast<uint16_t>(result);
-    break;
+    return table;
+  }
 
-  case ShortField:
-    result = static_cast<int16_t>(result);
-    break;
+  virtual void boot(Thread* t, BootImage* image, uint8_t* code) {
+#if !defined(AVIAN_AOT_ONLY)
+    if (codeAllocator.base == 0) {
+      // evicting methods would leave holes we can't describe in the
+      // code cache file, so the two are mutually exclusive:
+      const char* path = local::codeCacheFilePath(t);
+      if (path and not local::codeCacheSweepEnabled(t)) {
+        codeCacheFile.open
+          (path, codeCacheFingerprint(static_cast<MyThread*>(t)));
+      }
 
-  case FloatField:
-  case IntField:
-    result = static_cast<int32_t>(result);
-    break;
+      unsigned segmentSize = local::codeSegmentSize(t);
+      codeAllocator.initialize
+        (static_cast<uint8_t*>
+         (s->tryAllocateExecutable(segmentSize, codeCacheFile.hint())),
+         segmentSize, local::codeCacheLimit(t),
+         static_cast<MyThread*>(t)->arch->maximumImmediateJump(),
+         local::codeCacheSweepEnabled(t));
+    }
+#endif
 
-  case LongField:
-  case DoubleField:
-    break;
+    checkpointPath = findProperty(t, "avian.checkpoint");
 
-  case ObjectField:
-    result = static_cast<uintptr_t>(result) ? *reinterpret_cast<uintptr_t*>
-      (static_cast<uintptr_t>(result)) : 0;
-    break;
+    if (image and code) {
+      local::boot(static_cast<MyThread*>(t), image, code);
+    } else {
+      roots = makeArray(t, RootCount);
 
-  case VoidField:
-    result = 0;
-    break;
+      setRoot(t, CallTable, makeArray(t, 128));
+      
+      setRoot(t, MethodTreeSentinal, makeTreeNode(t, 0, 0, 0));
+      setRoot(t, MethodTree, root(t, MethodTreeSentinal));
+      set(t, root(t, MethodTree), TreeNodeLeft,
+          root(t, MethodTreeSentinal));
+      set(t, root(t, MethodTree), TreeNodeRight,
+          root(t, MethodTreeSentinal));
+    }
 
-  default: abort(t);
-  }
+    if (codeAllocator.sweep or mayCheckpoint()) {
+      setRoot(t, CodeCache, makeHashMap(t, 0, 0));
+    }
 
-  while (t->reference != reference) {
-    dispose(t, t->reference);
-  }
+#ifdef AVIAN_AOT_ONLY
+    thunks = bootThunks;
+#else
+    local::compileThunks(static_cast<MyThread*>(t), &codeAllocator);
 
-  return result;
-}
-  
-uint64_t
-invokeNative2(MyThread* t, object method)
-{
-  object native = methodRuntimeDataNative(t, getMethodRuntimeData(t, method));
-  if (nativeFast(t, native)) {
-    return invokeNativeFast(t, method, nativeFunction(t, native));
-  } else {
-    return invokeNativeSlow(t, method, nativeFunction(t, native));
-  }
-}
+    if (not (image and code)) {
+      bootThunks = thunks;
+    }
 
-uint64_t
-invokeNative(MyThread* t)
-{
-  if (t->trace->nativeMethod == 0) {
-    void* ip;
-    if (t->tailAddress) {
-      ip = t->tailAddress;
-      t->tailAddress = 0;
-    } else {
-      ip = getIp(t);
+    if (codeCacheFile.enabled) {
+      attachCodeCacheFile();
     }
+#endif
 
-    object node = findCallNode(t, ip);
-    object target = callNodeTarget(t, node);
-    if (callNodeFlags(t, node) & TraceElement::VirtualCall) {
-      target = resolveTarget(t, t->stack, target);
+    if (checkpointData) {
+      local::linkCheckpoint(static_cast<MyThread*>(t));
     }
-    t->trace->nativeMethod = target;
-  }
 
-  assert(t, t->tailAddress == 0);
+    segFaultHandler.m = t->m;
+    expect(t, t->m->system->success
+           (t->m->system->handleSegFault(&segFaultHandler)));
 
-  uint64_t result = 0;
+    divideByZeroHandler.m = t->m;
+    expect(t, t->m->system->success
+           (t->m->system->handleDivideByZero(&divideByZeroHandler)));
+  }
 
-  t->trace->targetMethod = t->trace->nativeMethod;
+  virtual bool checkpoint(Thread* t) {
+    if (checkpointData) {
+      return true;
+    }
 
-  t->m->classpath->resolveNative(t, t->trace->nativeMethod);
+    if (bootedImage == 0) {
+      throwNew(t, Machine::IllegalStateExceptionType,
+               "checkpoints require a boot image");
+    }
 
-  result = invokeNative2(t, t->trace->nativeMethod);
+    if (checkpointPath == 0) {
+      throwNew(t, Machine::IllegalStateExceptionType,
+               "avian.checkpoint is not set");
+    }
 
-  unsigned parameterFootprint = methodParameterFootprint
-    (t, t->trace->targetMethod);
+    const char* error = local::writeCheckpoint
+      (static_cast<MyThread*>(t), checkpointPath);
 
-  uintptr_t* stack = static_cast<uintptr_t*>(t->stack);
+    if (error) {
+      throwNew(t, Machine::IllegalStateExceptionType,
+               "unable to write checkpoint to %s: %s", checkpointPath, error);
+    }
 
-  if (avian::codegen::TailCalls
-      and t->arch->argumentFootprint(parameterFootprint)
-      > t->arch->stackAlignmentInWords())
-  {
-    stack += t->arch->argumentFootprint(parameterFootprint)
-      - t->arch->stackAlignmentInWords();
+    return false;
   }
 
-  stack += t->arch->frameReturnAddressSize();
-
-  t->trace->targetMethod = 0;
-  t->trace->nativeMethod = 0;
-
-  t->newStack = stack;
+  // whether we must keep what is needed to write a checkpoint should
+  // the application ask for one
+  bool mayCheckpoint() {
+    return checkpointPath and checkpointData == 0 and bootedImage;
+  }
 
-  return result;
-}
+  virtual void shutDown(Thread* t) {
+    ACQUIRE(t, t->m->classLock);
 
-void
-findFrameMapInSimpleTable(MyThread* t, object method, object table,
-                          int32_t offset, int32_t** map, unsigned* start)
-{
-  unsigned tableSize = simpleFrameMapTableSize(t, method, table);
-  unsigned indexSize = intArrayLength(t, table) - tableSize;
+    codeCacheFile.write();
+  }
 
-  *map = &intArrayBody(t, table, indexSize);
-    
-  unsigned bottom = 0;
-  unsigned top = indexSize;
-  for (unsigned span = top - bottom; span; span = top - bottom) {
-    unsigned middle = bottom + (span / 2);
-    int32_t v = intArrayBody(t, table, middle);
-      
-    if (offset == v) {
-      *start = frameMapSizeInBits(t, method) * middle;
-      return;
-    } else if (offset < v) {
-      top = middle;
-    } else {
-      bottom = middle + 1;
+  uint32_t codeCacheFingerprint(MyThread* t) {
+    // Anything other than the classes themselves which affects the
+    // code we generate must be reflected here.  We approximate the VM
+    // build using the relative addresses of the thunk targets.
+    uint32_t h = hash(__DATE__ " " __TIME__);
+    for (unsigned i = 0; i < dummyIndex; ++i) {
+      h = (h * 31) + static_cast<uint32_t>
+        (reinterpret_cast<uintptr_t>(thunkTable[i])
+         - reinterpret_cast<uintptr_t>(thunkTable[0]));
     }
+
+    h = (h * 31) + t->arch->features();
+    h = (h * 31) + local::allocationPolicy(t);
+    h = (h * 31) + local::optimizationsEnabled(t);
+    h = (h * 31) + TargetBytesPerWord;
+    return h;
   }
 
-  abort(t);
-}
+  void attachCodeCacheFile() {
+    const Thunk* list[] = { &(thunks.default_), &(thunks.defaultVirtual),
+                            &(thunks.native), &(thunks.aioob),
+                            &(thunks.stackOverflow), &(thunks.table) };
 
-unsigned
-findFrameMap(MyThread* t, void* stack, object method, object table,
-             unsigned pathIndex)
-{
-  if (pathIndex) {
-    FrameMapTablePath* path = reinterpret_cast<FrameMapTablePath*>
-      (&byteArrayBody(t, table, pathIndex));
-    
-    void* address = static_cast<void**>(stack)[path->stackIndex];
-    uint8_t* base = reinterpret_cast<uint8_t*>(methodAddress(t, method));
-    for (unsigned i = 0; i < path->elementCount; ++i) {
-      if (address == base + path->elements[i]) {
-        return i + (path->elementCount * findFrameMap
-                    (t, stack, method, table, path->next));
-      }
+    uint32_t layout[CodeCacheFile::ThunkWords];
+    for (unsigned i = 0; i < CodeCacheFile::ThunkWords / 2; ++i) {
+      layout[i * 2] = list[i]->start - codeAllocator.base;
+      layout[(i * 2) + 1] = list[i]->length;
     }
 
-    abort(t);
-  } else {
-    return 0;
+    codeAllocator.offset = codeCacheFile.attach
+      (codeAllocator.base, codeAllocator.capacity, codeAllocator.offset,
+       layout);
   }
-}
 
-void
-findFrameMapInGeneralTable(MyThread* t, void* stack, object method,
-                           object table, int32_t offset, int32_t** map,
-                           unsigned* start)
-{
-  FrameMapTableHeader* header = reinterpret_cast<FrameMapTableHeader*>
-    (&byteArrayBody(t, table, 0));
+  virtual void callWithCurrentContinuation(Thread* t, object receiver) {
+    if (Continuations) {
+      local::callWithCurrentContinuation(static_cast<MyThread*>(t), receiver);
+    } else {
+      abort(t);
+    }
+  }
 
-  FrameMapTableIndexElement* index
-    = reinterpret_cast<FrameMapTableIndexElement*>
-    (&byteArrayBody(t, table, sizeof(FrameMapTableHeader)));
+  virtual void dynamicWind(Thread* t, object before, object thunk,
+                           object after)
+  {
+    if (Continuations) {
+      local::dynamicWind(static_cast<MyThread*>(t), before, thunk, after);
+    } else {
+      abort(t);
+    }
+  }
 
-  *map = reinterpret_cast<int32_t*>(index + header->indexCount);
+  virtual void feedResultToContinuation(Thread* t, object continuation,
+                                        object result)
+  {
+    if (Continuations) {
+      callContinuation(static_cast<MyThread*>(t), continuation, result, 0);
+    } else {
+      abort(t);
+    }
+  }
 
-  unsigned bottom = 0;
-  unsigned top = header->indexCount;
-  for (unsigned span = top - bottom; span; span = top - bottom) {
-    unsigned middle = bottom + (span / 2);
-    FrameMapTableIndexElement* v = index + middle;
-                                     
-    if (offset == v->offset) {
-      *start = v->base + (findFrameMap(t, stack, method, table, v->path)
-                          * frameMapSizeInBits(t, method));
-      return;
-    } else if (offset < v->offset) {
-      top = middle;
+  virtual void feedExceptionToContinuation(Thread* t, object continuation,
+                                           object exception)
+  {
+    if (Continuations) {
+      callContinuation(static_cast<MyThread*>(t), continuation, 0, exception);
     } else {
-      bottom = middle + 1;
+      abort(t);
     }
   }
 
-  abort(t);
-}
+  virtual void walkContinuationBody(Thread* t, Heap::Walker* w, object o,
+                                    unsigned start)
+  {
+    if (Continuations) {
+      local::walkContinuationBody(static_cast<MyThread*>(t), w, o, start);
+    } else {
+      abort(t);
+    }
+  }
+  
+  System* s;
+  Allocator* allocator;
+  object roots;
+  BootImage* bootImage;
+  uintptr_t* heapImage;
+  uint8_t* codeImage;
+  unsigned codeImageSize;
+  System::Region* bootImageRegion;
+  BootImage* bootedImage;
+  const char* checkpointPath;
+  uint8_t* checkpointData;
+  unsigned checkpointSize;
+  SignalHandler segFaultHandler;
+  SignalHandler divideByZeroHandler;
+  CodeAllocator codeAllocator;
+  CodeCacheFile codeCacheFile;
+  ThunkCollection thunks;
+  ThunkCollection bootThunks;
+  unsigned callTableSize;
+  bool useNativeFeatures;
+  void* thunkTable[dummyIndex + 1];
+  CompilationHandlerList* compilationHandlers;
+};
 
-void
-findFrameMap(MyThread* t, void* stack, object method, int32_t offset,
-             int32_t** map, unsigned* start)
-{
-  object table = codePool(t, methodCode(t, method));
-  if (objectClass(t, table) == type(t, Machine::IntArrayType)) {
-    findFrameMapInSimpleTable(t, method, table, offset, map, start);
+const char*
+stringOrNull(const char* str) {
+  if(str) {
+    return str;
   } else {
-    findFrameMapInGeneralTable(t, stack, method, table, offset, map, start);
+    return "(null)";
   }
 }
 
+size_t
+stringOrNullSize(const char* str) {
+  return strlen(stringOrNull(str));
+}
+
 void
-visitStackAndLocals(MyThread* t, Heap::Visitor* v, void* frame, object method,
-                    void* ip)
+logCompile(MyThread* t, const void* code, unsigned size, const char* class_,
+           const char* name, const char* spec)
 {
-  unsigned count = frameMapSizeInBits(t, method);
-
-  if (count) {
-    void* stack = stackForFrame(t, frame, method);
-
-    int32_t* map;
-    unsigned offset;
-    findFrameMap
-      (t, stack, method, difference
-       (ip, reinterpret_cast<void*>(methodAddress(t, method))), &map, &offset);
-
-    for (unsigned i = 0; i < count; ++i) {
-      int j = offset + i;
-      if (map[j / 32] & (static_cast<int32_t>(1) << (j % 32))) {
-        v->visit(localObject(t, stack, method, i));        
-      }
+  static bool open = false;
+  if (not open) {
+    open = true;
+    const char* path = findProperty(t, "avian.jit.log");
+    if (path) {
+      compileLog = vm::fopen(path, "wb");
+    } else if (DebugCompile) {
+      compileLog = stderr;
     }
   }
-}
 
-void
-visitArgument(MyThread* t, Heap::Visitor* v, void* stack, unsigned index)
-{
-  v->visit(static_cast<object*>(stack)
-           + index
-           + t->arch->frameReturnAddressSize()
-           + t->arch->frameFooterSize());
-}
+  if (compileLog) {
+    fprintf(compileLog, "%p,%p %s.%s%s\n",
+            code, static_cast<const uint8_t*>(code) + size,
+            class_, name, spec);
+  }
 
-void
-visitArguments(MyThread* t, Heap::Visitor* v, void* stack, object method)
-{
-  unsigned index = 0;
+  size_t nameLength = stringOrNullSize(class_) + stringOrNullSize(name) + stringOrNullSize(spec) + 2;
 
-  if ((methodFlags(t, method) & ACC_STATIC) == 0) {
-    visitArgument(t, v, stack, index++);
-  }
+  THREAD_RUNTIME_ARRAY(t, char, completeName, nameLength);
 
-  for (MethodSpecIterator it
-         (t, reinterpret_cast<const char*>
-          (&byteArrayBody(t, methodSpec(t, method), 0)));
-       it.hasNext();)
-  {
-    switch (*it.next()) {
-    case 'L':
-    case '[':
-      visitArgument(t, v, stack, index++);
-      break;
-      
-    case 'J':
-    case 'D':
-      index += 2;
-      break;
+  sprintf(RUNTIME_ARRAY_BODY(completeName), "%s.%s%s", stringOrNull(class_), stringOrNull(name), stringOrNull(spec));
 
-    default:
-      ++ index;
-      break;
-    }
+  MyProcessor* p = static_cast<MyProcessor*>(t->m->processor);
+  for(CompilationHandlerList* h = p->compilationHandlers; h; h = h->next) {
+    h->handler->compiled(code, 0, 0, RUNTIME_ARRAY_BODY(completeName));
   }
 }
 
-void
-visitStack(MyThread* t, Heap::Visitor* v)
+void*
+compileMethod2(MyThread* t, void* ip)
 {
-  void* ip = getIp(t);
-  void* stack = t->stack;
+  object node = findCallNode(t, ip);
+  object target = callNodeTarget(t, node);
 
-  MyThread::CallTrace* trace = t->trace;
-  object targetMethod = (trace ? trace->targetMethod : 0);
-  object target = targetMethod;
-  bool mostRecent = true;
+  PROTECT(t, node);
+  PROTECT(t, target);
 
-  while (stack) {
-    if (targetMethod) {
-      visitArguments(t, v, stack, targetMethod);
-      targetMethod = 0;
-    }
+  t->trace->targetMethod = target;
 
-    object method = methodForIp(t, ip);
-    if (method) {
-      PROTECT(t, method);
+  THREAD_RESOURCE0(t, static_cast<MyThread*>(t)->trace->targetMethod = 0);
 
-      void* nextIp = ip;
-      nextFrame(t, &nextIp, &stack, method, target, mostRecent);
+  compile(t, codeAllocator(t), 0, target);
 
-      visitStackAndLocals(t, v, stack, method, ip);
+  uint8_t* updateIp = static_cast<uint8_t*>(ip);
 
-      ip = nextIp;
+  MyProcessor* p = processor(t);
 
-      target = method;
-    } else if (trace) {
-      stack = trace->stack;
-      ip = trace->ip;
-      trace = trace->next;
+  // if this was a tail call, the caller is no longer on the stack, so
+  // the sweeper may have evicted it while we were compiling:
+  bool updateCaller = (updateIp < p->codeImage
+                       or updateIp >= p->codeImage + p->codeImageSize)
+    and findCallNode(t, ip) == node;
 
-      if (trace) {
-        targetMethod = trace->targetMethod;
-        target = targetMethod;
-      } else {
-        target = 0;
-      }
-    } else {
-      break;
-    }
+  uintptr_t address;
+  if (methodFlags(t, target) & ACC_NATIVE) {
+    address = useLongJump(t, reinterpret_cast<uintptr_t>(ip))
+      or (not updateCaller) ? bootNativeThunk(t) : nativeThunk(t);
+  } else {
+    address = methodAddress(t, target);
+  }
 
-    mostRecent = false;
+  if (updateCaller) {
+    updateCall(t, callNodeOperation(t, node), updateIp,
+               reinterpret_cast<void*>(address));
   }
+
+  return reinterpret_cast<void*>(address);
 }
 
-void
-walkContinuationBody(MyThread* t, Heap::Walker* w, object c, int start)
+bool
+isThunk(MyProcessor::ThunkCollection* thunks, void* ip)
 {
-  const int BodyOffset = ContinuationBody / BytesPerWord;
-
-  object method = static_cast<object>
-    (t->m->heap->follow(continuationMethod(t, c)));
-  int count = frameMapSizeInBits(t, method);
-
-  if (count) {
-    int stack = BodyOffset
-      + (continuationFramePointerOffset(t, c) / BytesPerWord)
-      - t->arch->framePointerOffset()
-      - stackOffsetFromFrame(t, method);
-
-    int first = stack + localOffsetFromStack(t, count - 1, method);
-    if (start > first) {
-      count -= start - first;
-    }
-
-    int32_t* map;
-    unsigned offset;
-    findFrameMap
-      (t, reinterpret_cast<uintptr_t*>(c) + stack, method, difference
-       (continuationAddress(t, c),
-        reinterpret_cast<void*>(methodAddress(t, method))), &map, &offset);
+  uint8_t* thunkStart = thunks->default_.start;
+  uint8_t* thunkEnd = thunks->table.start
+    + (thunks->table.length * ThunkCount);
 
-    for (int i = count - 1; i >= 0; --i) {
-      int j = offset + i;
-      if (map[j / 32] & (static_cast<int32_t>(1) << (j % 32))) {
-        if (not w->visit(stack + localOffsetFromStack(t, i, method))) {
-          return;
-        }
-      }
-    }
-  }
+  return (reinterpret_cast<uintptr_t>(ip)
+          >= reinterpret_cast<uintptr_t>(thunkStart)
+          and reinterpret_cast<uintptr_t>(ip)
+          < reinterpret_cast<uintptr_t>(thunkEnd));
 }
 
-void
-callContinuation(MyThread* t, object continuation, object result,
-                 object exception, void* ip, void* stack)
+bool
+isThunk(MyThread* t, void* ip)
 {
-  assert(t, t->exception == 0);
-
-  if (exception) {
-    t->exception = exception;
-
-    MyThread::TraceContext c(t, ip, stack, continuation, t->trace);
-
-    void* frame;
-    findUnwindTarget(t, &ip, &frame, &stack, &continuation);
-  }
-
-  t->trace->nativeMethod = 0;
-  t->trace->targetMethod = 0;
-
-  popResources(t);
-
-  transition(t, ip, stack, continuation, t->trace);
+  MyProcessor* p = processor(t);
 
-  vmJump(ip, 0, stack, t, reinterpret_cast<uintptr_t>(result), 0);
+  return isThunk(&(p->thunks), ip) or isThunk(&(p->bootThunks), ip);
 }
 
-int8_t*
-returnSpec(MyThread* t, object method)
+bool
+isThunkUnsafeStack(MyProcessor::Thunk* thunk, void* ip)
 {
-  int8_t* s = &byteArrayBody(t, methodSpec(t, method), 0);
-  while (*s and *s != ')') ++ s;
-  expect(t, *s == ')');
-  return s + 1;
+  return reinterpret_cast<uintptr_t>(ip)
+    >= reinterpret_cast<uintptr_t>(thunk->start)
+    and reinterpret_cast<uintptr_t>(ip)
+    < reinterpret_cast<uintptr_t>(thunk->start + thunk->frameSavedOffset);
 }
 
-object
-returnClass(MyThread* t, object method)
+bool
+isThunkUnsafeStack(MyProcessor::ThunkCollection* thunks, void* ip)
 {
-  PROTECT(t, method);
+  const unsigned NamedThunkCount = 5;
 
-  int8_t* spec = returnSpec(t, method);
-  unsigned length = strlen(reinterpret_cast<char*>(spec));
-  object name;
-  if (*spec == '[') {
-    name = makeByteArray(t, length + 1);
-    memcpy(&byteArrayBody(t, name, 0), spec, length);
-  } else {
-    assert(t, *spec == 'L');
-    assert(t, spec[length - 1] == ';');
-    name = makeByteArray(t, length - 1);
-    memcpy(&byteArrayBody(t, name, 0), spec + 1, length - 2);
+  MyProcessor::Thunk table[NamedThunkCount + ThunkCount];
+
+  table[0] = thunks->default_;
+  table[1] = thunks->defaultVirtual;
+  table[2] = thunks->native;
+  table[3] = thunks->aioob;
+  table[4] = thunks->stackOverflow;
+    
+  for (unsigned i = 0; i < ThunkCount; ++i) {
+    new (table + NamedThunkCount + i) MyProcessor::Thunk
+      (thunks->table.start + (i * thunks->table.length),
+       thunks->table.frameSavedOffset,
+       thunks->table.length);
   }
 
-  return resolveClass(t, classLoader(t, methodClass(t, method)), name);
+  for (unsigned i = 0; i < NamedThunkCount + ThunkCount; ++i) {
+    if (isThunkUnsafeStack(table + i, ip)) {
+      return true;
+    }
+  }
+
+  return false;
 }
 
 bool
-compatibleReturnType(MyThread* t, object oldMethod, object newMethod)
+isVirtualThunk(MyThread* t, void* ip)
 {
-  if (oldMethod == newMethod) {
-    return true;
-  } else if (methodReturnCode(t, oldMethod) == methodReturnCode(t, newMethod))
+  for (unsigned i = 0; i < wordArrayLength(t, root(t, VirtualThunks)); i += 2)
   {
-    if (methodReturnCode(t, oldMethod) == ObjectField) {
-      PROTECT(t, newMethod);
-
-      object oldClass = returnClass(t, oldMethod);
-      PROTECT(t, oldClass);
-
-      object newClass = returnClass(t, newMethod);
+    uintptr_t start = wordArrayBody(t, root(t, VirtualThunks), i);
+    uintptr_t end = start + wordArrayBody(t, root(t, VirtualThunks), i + 1);
 
-      return isAssignableFrom(t, oldClass, newClass);
-    } else {
+    if (reinterpret_cast<uintptr_t>(ip) >= start
+        and reinterpret_cast<uintptr_t>(ip) < end)
+    {
       return true;
     }
-  } else {
-    return methodReturnCode(t, oldMethod) == VoidField;
   }
+
+  return false;
 }
 
-void
-jumpAndInvoke(MyThread* t, object method, void* stack, ...)
+bool
+isThunkUnsafeStack(MyThread* t, void* ip)
 {
-  t->trace->targetMethod = 0;
+  MyProcessor* p = processor(t);
 
-  if (methodFlags(t, method) & ACC_NATIVE) {
-    t->trace->nativeMethod = method;
-  } else {
-    t->trace->nativeMethod = 0;
-  }
+  return isThunk(t, ip)
+    and (isThunkUnsafeStack(&(p->thunks), ip)
+         or isThunkUnsafeStack(&(p->bootThunks), ip));
+}
 
-  unsigned argumentCount = methodParameterFootprint(t, method);
-  THREAD_RUNTIME_ARRAY(t, uintptr_t, arguments, argumentCount);
-  va_list a; va_start(a, stack);
-  for (unsigned i = 0; i < argumentCount; ++i) {
-    RUNTIME_ARRAY_BODY(arguments)[i] = va_arg(a, uintptr_t);
+object
+findCallNode(MyThread* t, void* address)
+{
+  if (DebugCallTable) {
+    fprintf(stderr, "find call node %p\n", address);
   }
-  va_end(a);
 
-  assert(t, t->exception == 0);
+  // we must use a version of the call table at least as recent as the
+  // compiled form of the method containing the specified address (see
+  // compile(MyThread*, Allocator*, BootContext*, object)):
+  loadMemoryBarrier();
 
-  popResources(t);
-  
-  vmJumpAndInvoke
-    (t, reinterpret_cast<void*>(methodAddress(t, method)),
-     stack,
-     argumentCount * BytesPerWord,
-     RUNTIME_ARRAY_BODY(arguments),
-     (t->arch->alignFrameSize(t->arch->argumentFootprint(argumentCount))
-      + t->arch->frameReturnAddressSize())
-     * BytesPerWord);
+  object table = root(t, CallTable);
+
+  intptr_t key = reinterpret_cast<intptr_t>(address);
+  unsigned index = static_cast<uintptr_t>(key) & (arrayLength(t, table) - 1);
+
+  for (object n = arrayBody(t, table, index);
+       n; n = callNodeNext(t, n))
+  {
+    intptr_t k = callNodeAddress(t, n);
+
+    if (k == key) {
+      return n;
+    }
+  }
+
+  return 0;
 }
 
-void
-callContinuation(MyThread* t, object continuation, object result,
-                 object exception)
+object
+resizeTable(MyThread* t, object oldTable, unsigned newLength)
 {
-  enum {
-    Call,
-    Unwind,
-    Rewind
-  } action;
+  PROTECT(t, oldTable);
 
-  object nextContinuation = 0;
+  object oldNode = 0;
+  PROTECT(t, oldNode);
 
-  if (t->continuation == 0
-      or continuationContext(t, t->continuation)
-      != continuationContext(t, continuation))
-  {
-    PROTECT(t, continuation);
-    PROTECT(t, result);
-    PROTECT(t, exception);
+  object newTable = makeArray(t, newLength);
+  PROTECT(t, newTable);
 
-    if (compatibleReturnType
-        (t, t->trace->originalMethod, continuationContextMethod
-         (t, continuationContext(t, continuation))))
+  for (unsigned i = 0; i < arrayLength(t, oldTable); ++i) {
+    for (oldNode = arrayBody(t, oldTable, i);
+         oldNode;
+         oldNode = callNodeNext(t, oldNode))
     {
-      object oldContext;
-      object unwindContext;
-
-      if (t->continuation) {
-        oldContext = continuationContext(t, t->continuation);
-        unwindContext = oldContext;
-      } else {
-        oldContext = 0;
-        unwindContext = 0;
-      }
+      intptr_t k = callNodeAddress(t, oldNode);
 
-      object rewindContext = 0;
+      unsigned index = k & (newLength - 1);
 
-      for (object newContext = continuationContext(t, continuation);
-           newContext; newContext = continuationContextNext(t, newContext))
-      {
-        if (newContext == oldContext) {
-          unwindContext = 0;
-          break;
-        } else {
-          rewindContext = newContext;
-        }
-      }
+      object newNode = makeCallNode
+        (t, callNodeAddress(t, oldNode),
+         callNodeTarget(t, oldNode),
+         callNodeFlags(t, oldNode),
+         arrayBody(t, newTable, index));
 
-      if (unwindContext
-          and continuationContextContinuation(t, unwindContext))
-      {
-        nextContinuation = continuationContextContinuation(t, unwindContext);
-        result = makeUnwindResult(t, continuation, result, exception);
-        action = Unwind;
-      } else if (rewindContext
-                 and continuationContextContinuation(t, rewindContext))
-      {
-        nextContinuation = continuationContextContinuation(t, rewindContext);
-        action = Rewind;
+      set(t, newTable, ArrayBody + (index * BytesPerWord), newNode);
+    }
+  }
 
-        if (root(t, RewindMethod) == 0) {
-          PROTECT(t, nextContinuation);
-            
-          object method = resolveMethod
-            (t, root(t, Machine::BootLoader), "avian/Continuations", "rewind",
-             "(Ljava/lang/Runnable;Lavian/Callback;Ljava/lang/Object;"
-             "Ljava/lang/Throwable;)V");
+  return newTable;
+}
 
-          PROTECT(t, method);
-            
-          compile(t, local::codeAllocator(t), 0, method);
-            
-          setRoot(t, RewindMethod, method);
-        }
-      } else {
-        action = Call;
-      }
-    } else {
-      throwNew(t, Machine::IncompatibleContinuationExceptionType);
-    }
-  } else {
-    action = Call;
+object
+insertCallNode(MyThread* t, object table, unsigned* size, object node)
+{
+  if (DebugCallTable) {
+    fprintf(stderr, "insert call node %p\n",
+            reinterpret_cast<void*>(callNodeAddress(t, node)));
   }
 
-  void* ip;
-  void* frame;
-  void* stack;
-  object threadContinuation;
-  findUnwindTarget(t, &ip, &frame, &stack, &threadContinuation);
+  PROTECT(t, table);
+  PROTECT(t, node);
 
-  switch (action) {
-  case Call: {
-    callContinuation(t, continuation, result, exception, ip, stack);
-  } break;
+  ++ (*size);
 
-  case Unwind: {
-    callContinuation(t, nextContinuation, result, 0, ip, stack);
-  } break;
+  if (*size >= arrayLength(t, table) * 2) { 
+    table = resizeTable(t, table, arrayLength(t, table) * 2);
+  }
 
-  case Rewind: {
-    transition(t, 0, 0, nextContinuation, t->trace);
+  intptr_t key = callNodeAddress(t, node);
+  unsigned index = static_cast<uintptr_t>(key) & (arrayLength(t, table) - 1);
 
-    jumpAndInvoke
-      (t, root(t, RewindMethod), stack,
-       continuationContextBefore(t, continuationContext(t, nextContinuation)),
-       continuation, result, exception);
-  } break;
+  set(t, node, CallNodeNext, arrayBody(t, table, index));
+  set(t, table, ArrayBody + (index * BytesPerWord), node);
 
-  default:
-    abort(t);
-  }
+  return table;
 }
 
 void
-callWithCurrentContinuation(MyThread* t, object receiver)
+insertCallNode(MyThread* t, object node)
 {
-  object method = 0;
-  void* ip = 0;
-  void* stack = 0;
-
-  { PROTECT(t, receiver);
-
-    if (root(t, ReceiveMethod) == 0) {
-      object m = resolveMethod
-        (t, root(t, Machine::BootLoader), "avian/CallbackReceiver", "receive",
-         "(Lavian/Callback;)Ljava/lang/Object;");
-
-      if (m) {
-        setRoot(t, ReceiveMethod, m);
-
-        object continuationClass = type(t, Machine::ContinuationType);
-        
-        if (classVmFlags(t, continuationClass) & BootstrapFlag) {
-          resolveSystemClass
-            (t, root(t, Machine::BootLoader),
-             vm::className(t, continuationClass));
-        }
-      }
-    }
-
-    method = findInterfaceMethod
-      (t, root(t, ReceiveMethod), objectClass(t, receiver));
-    PROTECT(t, method);
-        
-    compile(t, local::codeAllocator(t), 0, method);
+  setRoot(t, CallTable, insertCallNode
+          (t, root(t, CallTable), &(processor(t)->callTableSize), node));
+}
 
-    t->continuation = makeCurrentContinuation(t, &ip, &stack);
+object
+makeClassMap(Thread* t, unsigned* table, unsigned count,
+             uintptr_t* heap)
+{
+  object array = makeArray(t, nextPowerOfTwo(count));
+  object map = makeHashMap(t, 0, array);
+  PROTECT(t, map);
+  
+  for (unsigned i = 0; i < count; ++i) {
+    object c = bootObject(heap, table[i]);
+    hashMapInsert(t, map, className(t, c), c, byteArrayHash);
   }
 
-  jumpAndInvoke(t, method, stack, receiver, t->continuation);
+  return map;
 }
 
-void
-dynamicWind(MyThread* t, object before, object thunk, object after)
+object
+makeStaticTableArray(Thread* t, unsigned* bootTable, unsigned bootCount,
+                     unsigned* appTable, unsigned appCount, uintptr_t* heap)
 {
-  void* ip = 0;
-  void* stack = 0;
-
-  { PROTECT(t, before);
-    PROTECT(t, thunk);
-    PROTECT(t, after);
-
-    if (root(t, WindMethod) == 0) {
-      object method = resolveMethod
-        (t, root(t, Machine::BootLoader), "avian/Continuations", "wind",
-         "(Ljava/lang/Runnable;Ljava/util/concurrent/Callable;"
-         "Ljava/lang/Runnable;)Lavian/Continuations$UnwindResult;");
-
-      if (method) {
-        setRoot(t, WindMethod, method);
-        compile(t, local::codeAllocator(t), 0, method);
-      }
-    }
+  object array = makeArray(t, bootCount + appCount);
+  
+  for (unsigned i = 0; i < bootCount; ++i) {
+    set(t, array, ArrayBody + (i * BytesPerWord),
+        classStaticTable(t, bootObject(heap, bootTable[i])));
+  }
 
-    t->continuation = makeCurrentContinuation(t, &ip, &stack);
+  for (unsigned i = 0; i < appCount; ++i) {
+    set(t, array, ArrayBody + ((bootCount + i) * BytesPerWord),
+        classStaticTable(t, bootObject(heap, appTable[i])));
+  }
 
-    object newContext = makeContinuationContext
-      (t, continuationContext(t, t->continuation), before, after,
-       t->continuation, t->trace->originalMethod);
+  return array;
+}
 
-    set(t, t->continuation, ContinuationContext, newContext);
+object
+makeStringMap(Thread* t, unsigned* table, unsigned count, uintptr_t* heap)
+{
+  object array = makeArray(t, nextPowerOfTwo(count));
+  object map = makeWeakHashMap(t, 0, array, 0);
+  PROTECT(t, map);
+  
+  for (unsigned i = 0; i < count; ++i) {
+    object s = bootObject(heap, table[i]);
+    weakHashMapInsert(t, map, s, 0, stringHash(t, s));
   }
 
-  jumpAndInvoke(t, root(t, WindMethod), stack, before, thunk, after);
+  return map;
 }
 
-class ArgumentList {
- public:
-  ArgumentList(Thread* t, uintptr_t* array, unsigned size, bool* objectMask,
-               object this_, const char* spec, bool indirectObjects,
-               va_list arguments):
-    t(static_cast<MyThread*>(t)),
-    array(array),
-    objectMask(objectMask),
-    size(size),
-    position(0),
-    protector(this)
-  {
-    if (this_) {
-      addObject(this_);
-    }
-
-    for (MethodSpecIterator it(t, spec); it.hasNext();) {
-      switch (*it.next()) {
-      case 'L':
-      case '[':
-        if (indirectObjects) {
-          object* v = va_arg(arguments, object*);
-          addObject(v ? *v : 0);
-        } else {
-          addObject(va_arg(arguments, object));
-        }
-        break;
-      
-      case 'J':
-        addLong(va_arg(arguments, uint64_t));
-        break;
+object
+makeCallTable(MyThread* t, uintptr_t* heap, unsigned* calls, unsigned count,
+              uintptr_t base)
+{
+  object table = makeArray(t, nextPowerOfTwo(count));
+  PROTECT(t, table);
 
-      case 'D':
-        addLong(doubleToBits(va_arg(arguments, double)));
-        break;
+  unsigned size = 0;
+  for (unsigned i = 0; i < count; ++i) {
+    unsigned address = calls[i * 2];
+    unsigned target = calls[(i * 2) + 1];
 
-      case 'F':
-        addInt(floatToBits(va_arg(arguments, double)));
-        break;
+    object node = makeCallNode
+       (t, base + address, bootObject(heap, target & BootMask),
+        target >> BootShift, 0);
 
-      default:
-        addInt(va_arg(arguments, uint32_t));
-        break;        
-      }
-    }
+    table = insertCallNode(t, table, &size, node);
   }
 
-  ArgumentList(Thread* t, uintptr_t* array, unsigned size, bool* objectMask,
-               object this_, const char* spec, const jvalue* arguments):
-    t(static_cast<MyThread*>(t)),
-    array(array),
-    objectMask(objectMask),
-    size(size),
-    position(0),
-    protector(this)
-  {
-    if (this_) {
-      addObject(this_);
-    }
-
-    unsigned index = 0;
-    for (MethodSpecIterator it(t, spec); it.hasNext();) {
-      switch (*it.next()) {
-      case 'L':
-      case '[': {
-        object* v = arguments[index++].l;
-        addObject(v ? *v : 0);
-      } break;
-      
-      case 'J':
-        addLong(arguments[index++].j);
-        break;
+  return table;
+}
 
-      case 'D':
-        addLong(doubleToBits(arguments[index++].d));
-        break;
+void
+fixupHeap(MyThread* t UNUSED, uintptr_t* map, unsigned size, uintptr_t* heap)
+{
+  for (unsigned word = 0; word < size; ++word) {
+    uintptr_t w = map[word];
+    if (w) {
+      for (unsigned bit = 0; bit < BitsPerWord; ++bit) {
+        if (w & (static_cast<uintptr_t>(1) << bit)) {
+          unsigned index = indexOf(word, bit);
 
-      case 'F':
-        addInt(floatToBits(arguments[index++].f));
-        break;
+          uintptr_t* p = heap + index;
+          assert(t, *p);
+          
+          uintptr_t number = *p & BootMask;
+          uintptr_t mark = *p >> BootShift;
 
-      default:
-        addInt(arguments[index++].i);
-        break;        
+          if (number) {
+            *p = reinterpret_cast<uintptr_t>(heap + (number - 1)) | mark;
+            // fprintf(stderr, "fixup %d: %d 0x%x\n", index, static_cast<unsigned>(number), static_cast<unsigned>(*p));
+          } else {
+            *p = mark;
+          }
+        }
       }
     }
   }
+}
 
-  ArgumentList(Thread* t, uintptr_t* array, unsigned size, bool* objectMask,
-               object this_, const char* spec, object arguments):
-    t(static_cast<MyThread*>(t)),
-    array(array),
-    objectMask(objectMask),
-    size(size),
-    position(0),
-    protector(this)
-  {
-    if (this_) {
-      addObject(this_);
-    }
-
-    unsigned index = 0;
-    for (MethodSpecIterator it(t, spec); it.hasNext();) {
-      switch (*it.next()) {
-      case 'L':
-      case '[':
-        addObject(objectArrayBody(t, arguments, index++));
-        break;
-      
-      case 'J':
-      case 'D':
-        addLong(fieldAtOffset<int64_t>(objectArrayBody(t, arguments, index++), 8));
-        break;
+void
+resetClassRuntimeState(Thread* t, object c, uintptr_t* heap, unsigned heapSize)
+{
+  classRuntimeDataIndex(t, c) = 0;
 
-      default:
-        addInt(fieldAtOffset<int32_t>(objectArrayBody(t, arguments, index++),
-                             BytesPerWord));
-        break;
+  if (classArrayElementSize(t, c) == 0) {
+    object staticTable = classStaticTable(t, c);
+    if (staticTable) {
+      for (unsigned i = 0; i < singletonCount(t, staticTable); ++i) {
+        if (singletonIsObject(t, staticTable, i)
+            and (reinterpret_cast<uintptr_t*>
+                 (singletonObject(t, staticTable, i)) < heap or
+                 reinterpret_cast<uintptr_t*>
+                 (singletonObject(t, staticTable, i)) > heap + heapSize))
+        {
+          singletonObject(t, staticTable, i) = 0;
+        }
       }
     }
   }
 
-  void addObject(object v) {
-    assert(t, position < size);
-
-    array[position] = reinterpret_cast<uintptr_t>(v);
-    objectMask[position] = true;
-    ++ position;
-  }
-
-  void addInt(uintptr_t v) {
-    assert(t, position < size);
-
-    array[position] = v;
-    objectMask[position] = false;
-    ++ position;
-  }
-
-  void addLong(uint64_t v) {
-    assert(t, position < size - 1);
-
-    memcpy(array + position, &v, 8);
+  if (classMethodTable(t, c)) {
+    for (unsigned i = 0; i < arrayLength(t, classMethodTable(t, c)); ++i) {
+      object m = arrayBody(t, classMethodTable(t, c), i);
 
-    objectMask[position] = false;
-    objectMask[position + 1] = false;
+      methodNativeID(t, m) = 0;
+      methodRuntimeDataIndex(t, m) = 0;
 
-    position += 2;
+      if (methodVmFlags(t, m) & ClassInitFlag) {
+        classVmFlags(t, c) |= NeedInitFlag;
+        classVmFlags(t, c) &= ~InitErrorFlag;
+      }
+    }
   }
 
-  MyThread* t;
-  uintptr_t* array;
-  bool* objectMask;
-  unsigned size;
-  unsigned position;
+  t->m->processor->initVtable(t, c);
+}
 
-  class MyProtector: public Thread::Protector {
-   public:
-    MyProtector(ArgumentList* list): Protector(list->t), list(list) { }
+void
+resetRuntimeState(Thread* t, object map, uintptr_t* heap, unsigned heapSize)
+{
+  for (HashMapIterator it(t, map); it.hasMore();) {
+    resetClassRuntimeState(t, tripleSecond(t, it.next()), heap, heapSize);
+  }
+}
 
-    virtual void visit(Heap::Visitor* v) {
-      for (unsigned i = 0; i < list->position; ++i) {
-        if (list->objectMask[i]) {
-          v->visit(reinterpret_cast<object*>(list->array + i));
+void
+fixupClassMethods(Thread* t, object c, BootImage* image UNUSED, uint8_t* code)
+{
+  if (classMethodTable(t, c)) {
+    for (unsigned i = 0; i < arrayLength(t, classMethodTable(t, c)); ++i) {
+      object method = arrayBody(t, classMethodTable(t, c), i);
+      // code saved to a checkpoint without having been compiled is
+      // linked later, once we have a default thunk (see
+      // linkCheckpoint):
+      if (methodCode(t, method)
+          and methodCompiled(t, method) != UnlinkedCode)
+      {
+        assert(t, methodCompiled(t, method)
+               <= static_cast<int32_t>(image->codeSize));
+
+        codeCompiled(t, methodCode(t, method))
+          = methodCompiled(t, method) + reinterpret_cast<uintptr_t>(code);
+
+        if (DebugCompile) {
+          logCompile
+            (static_cast<MyThread*>(t),
+             reinterpret_cast<uint8_t*>(methodCompiled(t, method)),
+             methodCompiledSize(t, method),
+             reinterpret_cast<char*>
+             (&byteArrayBody(t, className(t, methodClass(t, method)), 0)),
+             reinterpret_cast<char*>
+             (&byteArrayBody(t, methodName(t, method), 0)),
+             reinterpret_cast<char*>
+             (&byteArrayBody(t, methodSpec(t, method), 0)));
         }
       }
     }
+  }
+}
 
-    ArgumentList* list;
-  } protector;
-};
-
-object
-invoke(Thread* thread, object method, ArgumentList* arguments)
+void
+fixupMethods(Thread* t, object map, BootImage* image, uint8_t* code)
 {
-  MyThread* t = static_cast<MyThread*>(thread);
+  for (HashMapIterator it(t, map); it.hasMore();) {
+    object c = tripleSecond(t, it.next());
 
-  if (false) {
-    PROTECT(t, method);
+    fixupClassMethods(t, c, image, code);
 
-    compile(t, local::codeAllocator(static_cast<MyThread*>(t)), 0,
-            resolveMethod
-            (t, root(t, Machine::AppLoader),
-             "foo/ClassName",
-             "methodName",
-             "()V"));
+    t->m->processor->initVtable(t, c);
   }
+}
 
-  uintptr_t stackLimit = t->stackLimit;
-  uintptr_t stackPosition = reinterpret_cast<uintptr_t>(&t);
-  if (stackLimit == 0) {
-    t->stackLimit = stackPosition - t->m->stackSizeInBytes;
-  } else if (stackPosition < stackLimit) {
-    throwNew(t, Machine::StackOverflowErrorType);
-  }
+MyProcessor::Thunk
+thunkToThunk(const BootImage::Thunk& thunk, uint8_t* base)
+{
+  return MyProcessor::Thunk
+    (base + thunk.start, thunk.frameSavedOffset, thunk.length);
+}
 
-  THREAD_RESOURCE(t, uintptr_t, stackLimit,
-                  static_cast<MyThread*>(t)->stackLimit = stackLimit);
+void
+findThunks(MyThread* t, BootImage* image, uint8_t* code)
+{
+  MyProcessor* p = processor(t);
+  
+  p->bootThunks.default_ = thunkToThunk(image->thunks.default_, code);
+  p->bootThunks.defaultVirtual
+    = thunkToThunk(image->thunks.defaultVirtual, code);
+  p->bootThunks.native = thunkToThunk(image->thunks.native, code);
+  p->bootThunks.aioob = thunkToThunk(image->thunks.aioob, code);
+  p->bootThunks.stackOverflow
+    = thunkToThunk(image->thunks.stackOverflow, code);
+  p->bootThunks.table = thunkToThunk(image->thunks.table, code);
+}
 
-  unsigned returnCode = methodReturnCode(t, method);
-  unsigned returnType = fieldType(t, returnCode);
+void
+fixupVirtualThunks(MyThread* t, uint8_t* code)
+{
+  for (unsigned i = 0; i < wordArrayLength(t, root(t, VirtualThunks)); i += 2)
+  {
+    if (wordArrayBody(t, root(t, VirtualThunks), i)) {
+      wordArrayBody(t, root(t, VirtualThunks), i)
+        = wordArrayBody(t, root(t, VirtualThunks), i)
+        + reinterpret_cast<uintptr_t>(code);
+    }
+  }
+}
 
-  uint64_t result;
+uintptr_t*
+bootHeapMap(BootImage* image)
+{
+  unsigned* callTable = reinterpret_cast<unsigned*>(image + 1)
+    + image->bootClassCount + image->appClassCount + image->stringCount;
+  unsigned* hashTable = callTable + (image->callCount * 2);
 
-  { MyThread::CallTrace trace(t, method);
+  return reinterpret_cast<uintptr_t*>
+    (padWord(reinterpret_cast<uintptr_t>
+             (hashTable + (image->hashCount * 2))));
+}
 
-    MyCheckpoint checkpoint(t);
+// returns the size of the specified image up to the end of its heap
+unsigned
+bootImageSize(BootImage* image)
+{
+  uintptr_t* heap = bootHeapMap(image) + ceilingDivide
+    (heapMapSize(image->heapSize), BytesPerWord);
 
-    assert(t, arguments->position == arguments->size);
+  return reinterpret_cast<uint8_t*>
+    (heap + ceilingDivide(image->heapSize, BytesPerWord))
+    - reinterpret_cast<uint8_t*>(image);
+}
 
-    result = vmInvoke
-      (t, reinterpret_cast<void*>(methodAddress(t, method)),
-       arguments->array,
-       arguments->position * BytesPerWord,
-       t->arch->alignFrameSize
-       (t->arch->argumentFootprint(arguments->position))
-       * BytesPerWord,
-       returnType);
-  }
+// Does to a private copy of an image and its code everything boot
+// would otherwise do to the image at startup: pointers are resolved,
+// methods are linked to their code, and vtables are filled in with
+// the image's virtual thunks.  Returns false if a vtable needs a
+// thunk which is not in the image, in which case the copy is unusable.
+bool
+prelinkBootImage(MyThread* t, BootImage* image, uint8_t* code)
+{
+  uintptr_t* heapMap = bootHeapMap(image);
+  unsigned heapMapSizeInWords = ceilingDivide
+    (heapMapSize(image->heapSize), BytesPerWord);
+  uintptr_t* heap = heapMap + heapMapSizeInWords;
 
-  if (t->exception) { 
-    if (UNLIKELY(t->flags & Thread::UseBackupHeapFlag)) {
-      collect(t, Heap::MinorCollection);
+  fixupHeap(t, heapMap, heapMapSizeInWords, heap);
+
+  object thunks = bootObject(heap, image->virtualThunks);
+  unsigned thunkCount = thunks ? wordArrayLength(t, thunks) : 0;
+  for (unsigned i = 0; i < thunkCount; i += 2) {
+    if (wordArrayBody(t, thunks, i)) {
+      wordArrayBody(t, thunks, i) += reinterpret_cast<uintptr_t>(code);
     }
-    
-    object exception = t->exception;
-    t->exception = 0;
-    vm::throw_(t, exception);
   }
 
-  object r;
-  switch (returnCode) {
-  case ByteField:
-  case BooleanField:
-  case CharField:
-  case ShortField:
-  case FloatField:
-  case IntField:
-    r = makeInt(t, result);
-    break;
-
-  case LongField:
-  case DoubleField:
-    r = makeLong(t, result);
-    break;
+  unsigned* classTable = reinterpret_cast<unsigned*>(image + 1);
+  unsigned classCount = image->bootClassCount + image->appClassCount;
+  for (unsigned i = 0; i < classCount; ++i) {
+    object c = bootObject(heap, classTable[i]);
 
-  case ObjectField:
-    r = reinterpret_cast<object>(result);
-    break;
+    fixupClassMethods(t, c, image, code);
 
-  case VoidField:
-    r = 0;
-    break;
+    for (unsigned j = 0; j < classLength(t, c); ++j) {
+      if (j * 2 >= thunkCount or wordArrayBody(t, thunks, j * 2) == 0) {
+        return false;
+      }
 
-  default:
-    abort(t);
+      classVtable(t, c, j) = reinterpret_cast<void*>
+        (wordArrayBody(t, thunks, j * 2));
+    }
   }
 
-  return r;
+  return true;
 }
 
-class SignalHandler: public System::SignalHandler {
+// A boot image and its code, prelinked for a fixed address and saved
+// to the file named by the avian.bootimage.map property.  Mapping
+// that file privately at the same address lets processes share the
+// pages of the image they never write to, where relocating the
+// image in place would give each process its own copy of all of
+// them.
+class BootImageMap {
  public:
-  SignalHandler(Machine::Type type, Machine::Root root, unsigned fixedSize):
-    m(0), type(type), root(root), fixedSize(fixedSize) { }
+  uint32_t magic;
+  uint32_t checksum;
+  uint64_t base;
+  uint32_t imageSize;
+  uint32_t codeOffset;
+  uint32_t codeSize;
+  uint32_t reserved;
+};
 
-  virtual bool handleSignal(void** ip, void** frame, void** stack,
-                            void** thread)
-  {
-    MyThread* t = static_cast<MyThread*>(m->localThread->get());
-    if (t and t->state == Thread::ActiveState) {
-      object node = methodForIp(t, *ip);
-      if (node) {
-        // add one to the IP since findLineNumber will subtract one
-        // when we make the trace:
-        MyThread::TraceContext context
-          (t, static_cast<uint8_t*>(*ip) + 1,
-           static_cast<void**>(*stack) - t->arch->frameReturnAddressSize(),
-           t->continuation, t->trace);
+BootImage*
+mappedBootImage(System::Region* region)
+{
+  return reinterpret_cast<BootImage*>
+    (const_cast<uint8_t*>(region->start()) + sizeof(BootImageMap));
+}
 
-        if (ensure(t, fixedSize + traceSize(t))) {
-          atomicOr(&(t->flags), Thread::TracingFlag);
-          t->exception = makeThrowable(t, type);
-          atomicAnd(&(t->flags), ~Thread::TracingFlag);
-        } else {
-          // not enough memory available for a new exception and stack
-          // trace -- use a preallocated instance instead
-          t->exception = vm::root(t, root);
-        }
+uint8_t*
+mappedBootCode(System::Region* region)
+{
+  const BootImageMap* header = reinterpret_cast<const BootImageMap*>
+    (region->start());
 
-        // printTrace(t, t->exception);
+  return const_cast<uint8_t*>(region->start()) + header->codeOffset;
+}
 
-        object continuation;
-        findUnwindTarget(t, ip, frame, stack, &continuation);
+// Returns a mapping of a prelinked copy of the specified image and
+// its code, writing one first if the file at the specified path is
+// missing or was made from a different image, or null if no such
+// copy can be used.
+System::Region*
+mapBootImage(MyThread* t, const char* path, BootImage* image, uint8_t* code)
+{
+  System* s = t->m->system;
+  unsigned imageSize = bootImageSize(image);
+  System::Region* region;
+
+  if (s->success(s->map(&region, path))) {
+    BootImageMap header;
+    bool valid = region->length() >= sizeof(BootImageMap);
+    if (valid) {
+      memcpy(&header, region->start(), sizeof(BootImageMap));
+      valid = header.magic == BootImageMapMagic
+        and header.checksum == image->checksum
+        and header.imageSize == imageSize
+        and header.codeSize == image->codeSize
+        and header.codeOffset == padWord(sizeof(BootImageMap) + imageSize)
+        and region->length() == header.codeOffset + header.codeSize;
+    }
+    region->dispose();
+
+    if (valid) {
+      // if the address the copy was made for is taken, we do without
+      // it rather than replace a file other processes may be using
+      if (s->success
+          (s->map(&region, path, reinterpret_cast<void*>
+                  (static_cast<uintptr_t>(header.base)))))
+      {
+        return region;
+      } else {
+        return 0;
+      }
+    }
+  }
 
-        transition(t, ip, stack, continuation, t->trace);
+  unsigned codeOffset = padWord(sizeof(BootImageMap) + imageSize);
+  unsigned size = codeOffset + image->codeSize;
+  uint8_t* copy = static_cast<uint8_t*>(s->tryAllocateExecutable(size, 0));
+  if (copy == 0) {
+    return 0;
+  }
 
-        *thread = t;
+  BootImageMap header;
+  memset(&header, 0, sizeof(BootImageMap));
+  header.magic = BootImageMapMagic;
+  header.checksum = image->checksum;
+  header.base = reinterpret_cast<uintptr_t>(copy);
+  header.imageSize = imageSize;
+  header.codeOffset = codeOffset;
+  header.codeSize = image->codeSize;
 
-        return true;
-      }
-    }
+  memcpy(copy, &header, sizeof(BootImageMap));
+  memcpy(copy + sizeof(BootImageMap), image, imageSize);
+  memcpy(copy + codeOffset, code, image->codeSize);
 
-    if (compileLog) {
-      fflush(compileLog);
-    }
+  bool success = prelinkBootImage
+    (t, reinterpret_cast<BootImage*>(copy + sizeof(BootImageMap)),
+     copy + codeOffset)
+    and writeFile(path, copy, size);
 
-    return false;
+  // the copy's address range is free once more, so unless some other
+  // thread has claimed it in the meantime, we can map the file there:
+  s->freeExecutable(copy, size);
+
+  if (success and s->success(s->map(&region, path, copy))) {
+    return region;
+  } else {
+    return 0;
   }
+}
 
-  Machine* m;
-  Machine::Type type;
-  Machine::Root root;
-  unsigned fixedSize;
+// A heap saved by writeCheckpoint to the file named by the
+// avian.checkpoint property.  The file holds this header followed by
+// a boot image made from the heap, which uses the code of the image
+// the writing process was started with.
+class CheckpointHeader {
+ public:
+  uint32_t magic;
+  uint32_t baseChecksum;
+  uint32_t size;
+  uint32_t reserved;
 };
 
-bool
-isThunk(MyThread* t, void* ip);
+// Returns a copy of the image saved to the file at the specified
+// path, or null if there is no such file or it was written by a
+// process started with an image other than the specified one.
+BootImage*
+readCheckpoint(MyThread* t, const char* path, BootImage* base)
+{
+  MyProcessor* p = processor(t);
+  System* s = t->m->system;
+  System::Region* region;
 
-bool
-isVirtualThunk(MyThread* t, void* ip);
+  if (not s->success(s->map(&region, path))) {
+    return 0;
+  }
 
-bool
-isThunkUnsafeStack(MyThread* t, void* ip);
+  CheckpointHeader header;
+  bool valid = region->length()
+    >= sizeof(CheckpointHeader) + sizeof(BootImage);
+  if (valid) {
+    memcpy(&header, region->start(), sizeof(CheckpointHeader));
 
-void
-boot(MyThread* t, BootImage* image, uint8_t* code);
+    BootImage image;
+    memcpy(&image, region->start() + sizeof(CheckpointHeader),
+           sizeof(BootImage));
 
-class MyProcessor;
+    valid = header.magic == CheckpointMagic
+      and header.baseChecksum == base->checksum
+      and header.size == region->length()
+      and image.magic == BootImage::Magic
+      and image.codeSize == base->codeSize;
+  }
 
-MyProcessor*
-processor(MyThread* t);
+  BootImage* image = 0;
+  if (valid) {
+    p->checkpointSize = header.size;
+    p->checkpointData = static_cast<uint8_t*>
+      (p->allocator->allocate(header.size));
+    memcpy(p->checkpointData, region->start(), header.size);
+
+    image = reinterpret_cast<BootImage*>
+      (p->checkpointData + sizeof(CheckpointHeader));
+  }
+
+  region->dispose();
+
+  return image;
+}
 
 void
-compileThunks(MyThread* t, FixedAllocator* allocator);
+boot(MyThread* t, BootImage* image, uint8_t* code)
+{
+  assert(t, image->magic == BootImage::Magic);
 
-class CompilationHandlerList {
-public:
-  CompilationHandlerList(CompilationHandlerList* next, Processor::CompilationHandler* handler):
-    next(next),
-    handler(handler) {}
+  MyProcessor* p = static_cast<MyProcessor*>(t->m->processor);
 
-  void dispose(Allocator* allocator) {
-    if(this) {
-      next->dispose(allocator);
-      handler->dispose();
-      allocator->free(this, sizeof(*this));
+  bool prelinked = false;
+  if (not image->initialized) {
+    if (p->checkpointPath) {
+      BootImage* restored = readCheckpoint(t, p->checkpointPath, image);
+      if (restored) {
+        image = restored;
+      }
     }
-  }
-
-  CompilationHandlerList* next;
-  Processor::CompilationHandler* handler;
-};
 
-template<class T, class C>
-int checkConstant(MyThread* t, size_t expected, T C::* field, const char* name) {
-  size_t actual = reinterpret_cast<uint8_t*>(&(t->*field)) - reinterpret_cast<uint8_t*>(t);
-  if(expected != actual) {
-    fprintf(stderr, "constant mismatch (%s): \n\tconstant says: %d\n\tc++ compiler says: %d\n", name, (unsigned) expected, (unsigned) actual);
-    return 1;
+    const char* path = findProperty(t, "avian.bootimage.map");
+    if (path) {
+      p->bootImageRegion = mapBootImage(t, path, image, code);
+      if (p->bootImageRegion) {
+        image = mappedBootImage(p->bootImageRegion);
+        code = mappedBootCode(p->bootImageRegion);
+        prelinked = true;
+      }
+    }
   }
-  return 0;
-}
 
-class MyProcessor: public Processor {
- public:
-  class Thunk {
-   public:
-    Thunk():
-      start(0), frameSavedOffset(0), length(0)
-    { }
+  unsigned* bootClassTable = reinterpret_cast<unsigned*>(image + 1);
+  unsigned* appClassTable = bootClassTable + image->bootClassCount;
+  unsigned* stringTable = appClassTable + image->appClassCount;
+  unsigned* callTable = stringTable + image->stringCount;
+  unsigned* hashTable = callTable + (image->callCount * 2);
 
-    Thunk(uint8_t* start, unsigned frameSavedOffset, unsigned length):
-      start(start), frameSavedOffset(frameSavedOffset), length(length)
-    { }
+  uintptr_t* heapMap = bootHeapMap(image);
 
-    uint8_t* start;
-    unsigned frameSavedOffset;
-    unsigned length;
-  };
+  unsigned heapMapSizeInWords = ceilingDivide
+    (heapMapSize(image->heapSize), BytesPerWord);
+  uintptr_t* heap = heapMap + heapMapSizeInWords;
 
-  class ThunkCollection {
-   public:
-    Thunk default_;
-    Thunk defaultVirtual;
-    Thunk native;
-    Thunk aioob;
-    Thunk stackOverflow;
-    Thunk table;
-  };
+  t->heapImage = p->heapImage = heap;
 
-  MyProcessor(System* s, Allocator* allocator, bool useNativeFeatures):
-    s(s),
-    allocator(allocator),
-    roots(0),
-    bootImage(0),
-    heapImage(0),
-    codeImage(0),
-    codeImageSize(0),
-    segFaultHandler(Machine::NullPointerExceptionType,
-                    Machine::NullPointerException,
-                    FixedSizeOfNullPointerException),
-    divideByZeroHandler(Machine::ArithmeticExceptionType,
-                        Machine::ArithmeticException,
-                        FixedSizeOfArithmeticException),
-    codeAllocator(s, 0, 0),
-    callTableSize(0),
-    useNativeFeatures(useNativeFeatures),
-    compilationHandlers(0)
-  {
-    thunkTable[compileMethodIndex] = voidPointer(local::compileMethod);
-    thunkTable[compileVirtualMethodIndex] = voidPointer(compileVirtualMethod);
-    thunkTable[invokeNativeIndex] = voidPointer(invokeNative);
-    thunkTable[throwArrayIndexOutOfBoundsIndex] = voidPointer
-      (throwArrayIndexOutOfBounds);
-    thunkTable[throwStackOverflowIndex] = voidPointer(throwStackOverflow);
-#define THUNK(s) thunkTable[s##Index] = voidPointer(s);
-#include "thunks.cpp"
-#undef THUNK
-    // Set the dummyIndex entry to a constant which should require the
-    // maximum number of bytes to represent in assembly code
-    // (i.e. can't be represented by a smaller number of bytes and
-    // implicitly sign- or zero-extended).  We'll use this property
-    // later to determine the maximum size of a thunk in the thunk
-    // table.
-    thunkTable[dummyIndex] = reinterpret_cast<void*>
-      (static_cast<uintptr_t>(UINT64_C(0x5555555555555555)));
+  // fprintf(stderr, "heap from %p to %p\n",
+  //         heap, heap + ceilingDivide(image->heapSize, BytesPerWord));
+
+  t->codeImage = p->codeImage = code;
+  p->codeImageSize = image->codeSize;
+
+  // fprintf(stderr, "code from %p to %p\n",
+  //         code, code + image->codeSize);
+ 
+  if (not (image->initialized or prelinked)) {
+    fixupHeap(t, heapMap, heapMapSizeInWords, heap);
   }
+  
+  t->m->heap->setImmortalHeap(heap, image->heapSize / BytesPerWord);
 
-  virtual Thread*
-  makeThread(Machine* m, object javaThread, Thread* parent)
-  {
-    MyThread* t = new (m->heap->allocate(sizeof(MyThread)))
-      MyThread(m, javaThread, static_cast<MyThread*>(parent),
-               useNativeFeatures);
+  if (image->hashCount) {
+    t->m->savedHashes = hashTable;
+    t->m->savedHashCount = image->hashCount;
+    t->m->savedHashHeap = heap;
+    t->m->savedHashHeapEnd = heap + (image->heapSize / BytesPerWord);
+  }
 
-    t->heapImage = heapImage;
-    t->codeImage = codeImage;
-    t->thunkTable = thunkTable;
+  t->m->types = bootObject(heap, image->types);
 
-#if TARGET_BYTES_PER_WORD == BYTES_PER_WORD
+  t->m->roots = makeArray(t, Machine::RootCount);
 
-    int mismatches =
-      checkConstant(t, TARGET_THREAD_EXCEPTION, &Thread::exception, "TARGET_THREAD_EXCEPTION") +
-      checkConstant(t, TARGET_THREAD_EXCEPTIONSTACKADJUSTMENT, &MyThread::exceptionStackAdjustment, "TARGET_THREAD_EXCEPTIONSTACKADJUSTMENT") +
-      checkConstant(t, TARGET_THREAD_EXCEPTIONOFFSET, &MyThread::exceptionOffset, "TARGET_THREAD_EXCEPTIONOFFSET") +
-      checkConstant(t, TARGET_THREAD_EXCEPTIONHANDLER, &MyThread::exceptionHandler, "TARGET_THREAD_EXCEPTIONHANDLER") +
-      checkConstant(t, TARGET_THREAD_IP, &MyThread::ip, "TARGET_THREAD_IP") +
-      checkConstant(t, TARGET_THREAD_STACK, &MyThread::stack, "TARGET_THREAD_STACK") +
-      checkConstant(t, TARGET_THREAD_NEWSTACK, &MyThread::newStack, "TARGET_THREAD_NEWSTACK") +
-      checkConstant(t, TARGET_THREAD_TAILADDRESS, &MyThread::tailAddress, "TARGET_THREAD_TAILADDRESS") +
-      checkConstant(t, TARGET_THREAD_VIRTUALCALLTARGET, &MyThread::virtualCallTarget, "TARGET_THREAD_VIRTUALCALLTARGET") +
-      checkConstant(t, TARGET_THREAD_VIRTUALCALLINDEX, &MyThread::virtualCallIndex, "TARGET_THREAD_VIRTUALCALLINDEX") +
-      checkConstant(t, TARGET_THREAD_HEAPIMAGE, &MyThread::heapImage, "TARGET_THREAD_HEAPIMAGE") +
-      checkConstant(t, TARGET_THREAD_CODEIMAGE, &MyThread::codeImage, "TARGET_THREAD_CODEIMAGE") +
-      checkConstant(t, TARGET_THREAD_THUNKTABLE, &MyThread::thunkTable, "TARGET_THREAD_THUNKTABLE") +
-      checkConstant(t, TARGET_THREAD_STACKLIMIT, &MyThread::stackLimit, "TARGET_THREAD_STACKLIMIT");
+  if (image->classRuntimeData) {
+    setRoot(t, Machine::ClassRuntimeDataTable,
+            bootObject(heap, image->classRuntimeData));
+  }
 
-    if(mismatches > 0) {
-      fprintf(stderr, "%d constant mismatches\n", mismatches);
-      abort(t);
-    }
+  setRoot(t, Machine::BootLoader, bootObject(heap, image->bootLoader));
+  setRoot(t, Machine::AppLoader, bootObject(heap, image->appLoader));
 
-#endif
+  p->roots = makeArray(t, RootCount);
+  
+  setRoot(t, MethodTree, bootObject(heap, image->methodTree));
+  setRoot(t, MethodTreeSentinal, bootObject(heap, image->methodTreeSentinal));
 
-    t->init();
+  setRoot(t, VirtualThunks, bootObject(heap, image->virtualThunks));
 
-    return t;
+  { object map = makeClassMap(t, bootClassTable, image->bootClassCount, heap);
+    set(t, root(t, Machine::BootLoader), ClassLoaderMap, map);
   }
 
-  virtual object
-  makeMethod(vm::Thread* t,
-             uint8_t vmFlags,
-             uint8_t returnCode,
-             uint8_t parameterCount,
-             uint8_t parameterFootprint,
-             uint16_t flags,
-             uint16_t offset,
-             object name,
-             object spec,
-             object addendum,
-             object class_,
-             object code)
-  {
-    if (code) {
-      codeCompiled(t, code) = local::defaultThunk(static_cast<MyThread*>(t));
-    }
+  systemClassLoaderFinder(t, root(t, Machine::BootLoader)) = t->m->bootFinder;
 
-    return vm::makeMethod
-      (t, vmFlags, returnCode, parameterCount, parameterFootprint, flags,
-       offset, 0, 0, name, spec, addendum, class_, code);
+  { object map = makeClassMap(t, appClassTable, image->appClassCount, heap);
+    set(t, root(t, Machine::AppLoader), ClassLoaderMap, map);
   }
 
-  virtual object
-  makeClass(vm::Thread* t,
-            uint16_t flags,
-            uint16_t vmFlags,
-            uint16_t fixedSize,
-            uint8_t arrayElementSize,
-            uint8_t arrayDimensions,
-            object objectMask,
-            object name,
-            object sourceFile,
-            object super,
-            object interfaceTable,
-            object virtualTable,
-            object fieldTable,
-            object methodTable,
-            object staticTable,
-            object addendum, 
-            object loader,
-            unsigned vtableLength)
-  {
-    return vm::makeClass
-      (t, flags, vmFlags, fixedSize, arrayElementSize, arrayDimensions,
-       0, objectMask, name, sourceFile, super, interfaceTable, virtualTable,
-       fieldTable, methodTable, staticTable, addendum, loader, 0,
-       vtableLength);
-  }
+  systemClassLoaderFinder(t, root(t, Machine::AppLoader)) = t->m->appFinder;
 
-  virtual void
-  initVtable(Thread* t, object c)
-  {
-    PROTECT(t, c);
-    for (int i = classLength(t, c) - 1; i >= 0; --i) {
-      void* thunk = reinterpret_cast<void*>
-        (virtualThunk(static_cast<MyThread*>(t), i));
-      classVtable(t, c, i) = thunk;
-    }
-  }
+  setRoot(t, Machine::StringMap, makeStringMap
+          (t, stringTable, image->stringCount, heap));
 
-  virtual void
-  visitObjects(Thread* vmt, Heap::Visitor* v)
-  {
-    MyThread* t = static_cast<MyThread*>(vmt);
+  p->callTableSize = image->callCount;
 
-    if (t == t->m->rootThread) {
-      v->visit(&roots);
-    }
+  setRoot(t, CallTable, makeCallTable
+          (t, heap, callTable, image->callCount,
+           reinterpret_cast<uintptr_t>(code)));
 
-    for (MyThread::CallTrace* trace = t->trace; trace; trace = trace->next) {
-      v->visit(&(trace->continuation));
-      v->visit(&(trace->nativeMethod));
-      v->visit(&(trace->targetMethod));
-      v->visit(&(trace->originalMethod));
-    }
+  setRoot(t, StaticTableArray, makeStaticTableArray
+          (t, bootClassTable, image->bootClassCount,
+           appClassTable, image->appClassCount, heap));
+    
+  findThunks(t, image, code);
 
-    v->visit(&(t->continuation));
+  if (image->initialized) {
+    resetRuntimeState
+      (t, classLoaderMap(t, root(t, Machine::BootLoader)), heap,
+       image->heapSize);
 
-    for (Reference* r = t->reference; r; r = r->next) {
-      v->visit(&(r->target));
+    resetRuntimeState
+      (t, classLoaderMap(t, root(t, Machine::AppLoader)), heap,
+       image->heapSize);
+
+    for (unsigned i = 0; i < arrayLength(t, t->m->types); ++i) {
+      resetClassRuntimeState
+        (t, type(t, static_cast<Machine::Type>(i)), heap, image->heapSize);
     }
+  } else if (not prelinked) {
+    fixupVirtualThunks(t, code);
 
-    visitStack(t, v);
+    // a restored heap may need thunks we have yet to compile, so its
+    // methods are linked later (see linkCheckpoint):
+    if (p->checkpointData == 0) {
+      fixupMethods
+        (t, classLoaderMap(t, root(t, Machine::BootLoader)), image, code);
+
+      fixupMethods
+        (t, classLoaderMap(t, root(t, Machine::AppLoader)), image, code);
+    }
   }
 
-  virtual void
-  walkStack(Thread* vmt, StackVisitor* v)
-  {
-    MyThread* t = static_cast<MyThread*>(vmt);
+  p->bootedImage = image;
 
-    MyStackWalker walker(t);
-    walker.walk(v);
+  // the mapped copy is never reused in place, so we leave its
+  // initialized flag alone rather than dirty its first page:
+  if (not prelinked) {
+    image->initialized = true;
   }
 
-  virtual int
-  lineNumber(Thread* vmt, object method, int ip)
-  {
-    return findLineNumber(static_cast<MyThread*>(vmt), method, ip);
-  }
+  setRoot(t, Machine::BootstrapClassMap, makeHashMap(t, 0, 0));
+}
 
-  virtual object*
-  makeLocalReference(Thread* vmt, object o)
-  {
-    if (o) {
-      MyThread* t = static_cast<MyThread*>(vmt);
+// Links the methods of a heap restored from a checkpoint to their
+// code and fills in vtables, which boot leaves to us since some of
+// them need the default thunk, or virtual thunks, compiled at runtime.
+void
+linkCheckpoint(MyThread* t)
+{
+  MyProcessor* p = processor(t);
 
-      for (Reference* r = t->reference; r; r = r->next) {
-        if (r->target == o) {
-          acquire(t, r);
+  // a prelinked copy of the image has everything but the former:
+  bool prelinked = p->bootImageRegion != 0;
+
+  for (unsigned i = 0; i < 2; ++i) {
+    object map = classLoaderMap
+      (t, root(t, i == 0 ? Machine::BootLoader : Machine::AppLoader));
+
+    for (HashMapIterator it(t, map); it.hasMore();) {
+      object c = tripleSecond(t, it.next());
+      PROTECT(t, c);
+
+      if (not prelinked) {
+        fixupClassMethods(t, c, p->bootedImage, p->codeImage);
+      }
 
-          return &(r->target);
+      object table = classMethodTable(t, c);
+      for (unsigned j = 0; table and j < arrayLength(t, table); ++j) {
+        object method = arrayBody(t, table, j);
+        if (methodCode(t, method)
+            and methodCompiled(t, method) == UnlinkedCode)
+        {
+          codeCompiled(t, methodCode(t, method)) = defaultThunk(t);
         }
       }
 
-      Reference* r = new (t->m->heap->allocate(sizeof(Reference)))
-        Reference(o, &(t->reference), false);
-
-      acquire(t, r);
-
-      return &(r->target);
-    } else {
-      return 0;
+      if (not prelinked) {
+        p->initVtable(t, c);
+      }
     }
   }
+}
 
-  virtual void
-  disposeLocalReference(Thread* t, object* r)
+// Fixed objects in a checkpoint are laid out as the heap expects
+// them (see Fixie in heap.cpp):
+const unsigned FixieSizeInBytes = 8 + (BytesPerWord * 2);
+const unsigned FixieSizeInWords = ceilingDivide
+  (FixieSizeInBytes, BytesPerWord);
+
+// Copies each object it visits into a new heap image.  Objects from
+// the image we booted from keep their offsets, since the code refers
+// to some of them that way, and all others are appended as fixed
+// objects so that they may later refer to objects allocated at
+// runtime.  Whatever refers to process state, like code addresses
+// and native pointers, is reset, or if it can't be, noted as an
+// error.
+class CheckpointVisitor: public HeapVisitor {
+ public:
+  CheckpointVisitor(MyThread* t):
+    t(t),
+    p(processor(t)),
+    heap(t->m->system, t->m->heap, 1024 * 1024),
+    map(t->m->system, t->m->heap, 64 * 1024),
+    hashes(t->m->system, t->m->heap, 64 * 1024),
+    imageSizeInWords(p->bootedImage->heapSize / BytesPerWord),
+    currentObject(0),
+    currentNumber(0),
+    currentOffset(0),
+    error(0)
   {
-    if (r) {
-      release(t, reinterpret_cast<Reference*>(r));
-    }
+    allocate(imageSizeInWords);
   }
 
-  virtual bool
-  pushLocalFrame(Thread* vmt, unsigned)
-  {
-    MyThread* t = static_cast<MyThread*>(vmt);
+  uintptr_t* words() {
+    return reinterpret_cast<uintptr_t*>(heap.data);
+  }
 
-    t->referenceFrame = new
-      (t->m->heap->allocate(sizeof(MyThread::ReferenceFrame)))
-      MyThread::ReferenceFrame(t->referenceFrame, t->reference);
-    
-    return true;
+  unsigned sizeInWords() {
+    return heap.length() / BytesPerWord;
   }
 
-  virtual void
-  popLocalFrame(Thread* vmt)
-  {
-    MyThread* t = static_cast<MyThread*>(vmt);
+  // returns the offset of a zeroed block of the specified size
+  // appended to the new heap
+  unsigned allocate(unsigned sizeInWords) {
+    unsigned offset = this->sizeInWords();
+    memset(heap.allocate(sizeInWords * BytesPerWord), 0,
+           sizeInWords * BytesPerWord);
 
-    MyThread::ReferenceFrame* f = t->referenceFrame;
-    t->referenceFrame = f->next;
-    while (t->reference != f->reference) {
-      vm::dispose(t, t->reference);
+    unsigned mapSize = ceilingDivide(offset + sizeInWords, BitsPerWord)
+      * BytesPerWord;
+    if (map.length() < mapSize) {
+      unsigned size = mapSize - map.length();
+      memset(map.allocate(size), 0, size);
     }
 
-    t->m->heap->free(f, sizeof(MyThread::ReferenceFrame));
+    return offset;
   }
 
-  virtual object
-  invokeArray(Thread* t, object method, object this_, object arguments)
-  {
-    assert(t, t->exception == 0);
+  bool inCodeImage(intptr_t address) {
+    return address >= reinterpret_cast<intptr_t>(p->codeImage)
+      and address < reinterpret_cast<intptr_t>
+      (p->codeImage + p->codeImageSize);
+  }
 
-    assert(t, t->state == Thread::ActiveState
-           or t->state == Thread::ExclusiveState);
+  void fail(const char* message) {
+    if (error == 0) {
+      error = message;
+    }
+  }
 
-    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
+  void visit(unsigned number) {
+    if (currentObject) {
+      unsigned offset = currentNumber - 1 + currentOffset;
+      uintptr_t mark = words()[offset] & (~PointerMask);
+      uintptr_t value = number | (mark << BootShift);
 
-    method = findMethod(t, method, this_);
+      if (value) markBit(reinterpret_cast<uintptr_t*>(map.data), offset);
 
-    const char* spec = reinterpret_cast<char*>
-      (&byteArrayBody(t, methodSpec(t, method), 0));
+      words()[offset] = value;
+    }
+  }
 
-    unsigned size = methodParameterFootprint(t, method);
-    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
-    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
-    ArgumentList list
-      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
-       this_, spec, arguments);
-    
-    PROTECT(t, method);
+  void reset(object o, object class_, uintptr_t* dst) {
+    if (class_ == type(t, Machine::ClassType)) {
+      for (unsigned i = 0; i < classLength(t, o); ++i) {
+        fieldAtOffset<void*>(dst, ClassVtable + (i * BytesPerWord)) = 0;
+      }
 
-    compile(static_cast<MyThread*>(t),
-            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
+      if (classVmFlags(t, o) & InitFlag) {
+        fail("a class is being initialized");
+      }
 
-    return local::invoke(t, method, &list);
+      if (not inImage(o)) {
+        object loader = classLoader(t, o);
+        if ((loader != vm::root(t, Machine::BootLoader)
+             and loader != vm::root(t, Machine::AppLoader))
+            or hashMapFind
+            (t, classLoaderMap(t, loader), className(t, o), byteArrayHash,
+             byteArrayEqual) != o)
+        {
+          fail("a class was not loaded by a system class loader");
+        }
+      }
+    } else if (class_ == type(t, Machine::MethodType)) {
+      fieldAtOffset<uint32_t>(dst, MethodNativeID) = 0;
+      fieldAtOffset<uint32_t>(dst, MethodRuntimeDataIndex) = 0;
+
+      object code = methodCode(t, o);
+      if (code and not inCodeImage(codeCompiled(t, code))
+          and not unresolved(t, codeCompiled(t, code)))
+      {
+        fail("a method was compiled without keeping its bytecode");
+      }
+    } else if (class_ == type(t, Machine::CodeType)) {
+      intptr_t compiled = codeCompiled(t, o);
+      fieldAtOffset<intptr_t>(dst, CodeCompiled) = inCodeImage(compiled)
+        ? compiled - reinterpret_cast<intptr_t>(p->codeImage)
+        : UnlinkedCode;
+    } else if (class_ == type(t, Machine::WordArrayType)
+               and (o == local::root(t, VirtualThunks)
+                    or o == bootObject
+                    (p->heapImage, p->bootedImage->virtualThunks)))
+    {
+      for (unsigned i = 0; i < wordArrayLength(t, o); i += 2) {
+        intptr_t thunk = wordArrayBody(t, o, i);
+        fieldAtOffset<intptr_t>(dst, WordArrayBody + (i * BytesPerWord))
+          = inCodeImage(thunk)
+          ? thunk - reinterpret_cast<intptr_t>(p->codeImage) : 0;
+      }
+    } else if (class_ == type(t, Machine::WeakHashMapNodeType)) {
+      fieldAtOffset<object>(dst, WeakHashMapNodeKey) = 0;
+    } else if (classVmFlags(t, class_) & WeakReferenceFlag) {
+      fieldAtOffset<object>(dst, JreferenceTarget) = 0;
+      fieldAtOffset<object>(dst, JreferenceQueue) = 0;
+      fieldAtOffset<object>(dst, JreferenceVmNext) = 0;
+    } else if (instanceOf(t, type(t, Machine::SystemClassLoaderType), o)) {
+      fieldAtOffset<void*>(dst, SystemClassLoaderFinder) = 0;
+
+      if (o != vm::root(t, Machine::BootLoader)
+          and o != vm::root(t, Machine::AppLoader))
+      {
+        fail("a class loader other than the system ones is reachable");
+      }
+    } else if (instanceOf(t, type(t, Machine::ThreadType), o)) {
+      fail("a thread is reachable");
+    } else if (class_ == type(t, Machine::NativeType)
+               or class_ == type(t, Machine::PointerType)
+               or class_ == type(t, Machine::FinderType)
+               or class_ == type(t, Machine::RegionType)
+               or class_ == type(t, Machine::MonitorType)
+               or class_ == type(t, Machine::FinalizerType)
+               or (classVmFlags(t, class_) & ContinuationFlag))
+    {
+      fail("an object referring to native state is reachable");
+    }
   }
 
-  virtual object
-  invokeArray(Thread* t, object method, object this_, const jvalue* arguments)
-  {
-    assert(t, t->exception == 0);
+  bool inImage(object o) {
+    uintptr_t* p = reinterpret_cast<uintptr_t*>(o);
+    return p >= this->p->heapImage
+      and p < this->p->heapImage + imageSizeInWords;
+  }
 
-    assert(t, t->state == Thread::ActiveState
-           or t->state == Thread::ExclusiveState);
+  virtual void root() {
+    currentObject = 0;
+  }
 
-    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
-    
-    method = findMethod(t, method, this_);
+  virtual unsigned visitNew(object o) {
+    if (o == 0) {
+      return 0;
+    }
 
-    const char* spec = reinterpret_cast<char*>
-      (&byteArrayBody(t, methodSpec(t, method), 0));
+    object class_ = objectClass(t, o);
+    unsigned size = baseSize(t, o, class_);
+    unsigned maskSize = ceilingDivide(size, BitsPerWord);
 
-    unsigned size = methodParameterFootprint(t, method);
-    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
-    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
-    ArgumentList list
-      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
-       this_, spec, arguments);
+    unsigned number;
+    bool fixed;
+    if (inImage(o)) {
+      number = (reinterpret_cast<uintptr_t*>(o) - p->heapImage) + 1;
+      fixed = objectFixed(t, o);
+    } else {
+      number = allocate(FixieSizeInWords + size + maskSize)
+        + FixieSizeInWords + 1;
+      fixed = true;
+    }
 
-    PROTECT(t, method);
+    uintptr_t* dst = words() + number - 1;
+    memcpy(dst, o, size * BytesPerWord);
 
-    compile(static_cast<MyThread*>(t),
-            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
+    if (fixed) {
+      // an immortal fixie with an empty mask:
+      uint8_t* header = reinterpret_cast<uint8_t*>(dst - FixieSizeInWords);
+      memset(header, 0, FixieSizeInBytes);
 
-    return local::invoke(t, method, &list);
-  }
+      uint16_t age = FixieTenureThreshold + 1;
+      memcpy(header, &age, 2);
 
-  virtual object
-  invokeList(Thread* t, object method, object this_, bool indirectObjects,
-             va_list arguments)
-  {
-    assert(t, t->exception == 0);
+      uint16_t flags = 1;
+      memcpy(header + 2, &flags, 2);
 
-    assert(t, t->state == Thread::ActiveState
-           or t->state == Thread::ExclusiveState);
+      uint32_t fixieSize = size;
+      memcpy(header + 4, &fixieSize, 4);
 
-    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
-    
-    method = findMethod(t, method, this_);
+      memset(dst + size, 0, maskSize * BytesPerWord);
+    }
 
-    const char* spec = reinterpret_cast<char*>
-      (&byteArrayBody(t, methodSpec(t, method), 0));
+    // the object will most likely have a new address when restored,
+    // so we note its identity hash code if it may have been taken:
+    uint32_t hash = 0;
+    bool hashed = true;
+    if (objectExtended(t, o)) {
+      hash = extendedWord(t, o, size);
+    } else if (objectFixed(t, o) or hashTaken(t, o)) {
+      hash = takeHash(t, o);
+    } else {
+      hashed = false;
+    }
 
-    unsigned size = methodParameterFootprint(t, method);
-    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
-    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
-    ArgumentList list
-      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
-       this_, spec, indirectObjects, arguments);
+    if (hashed) {
+      hashes.append4(number - 1);
+      hashes.append4(hash);
+    }
 
-    PROTECT(t, method);
+    dst[0] = (dst[0] & PointerMask) | (fixed ? FixedMark : 0);
 
-    compile(static_cast<MyThread*>(t),
-            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
+    reset(o, class_, dst);
 
-    return local::invoke(t, method, &list);
+    visit(number);
+
+    return number;
   }
 
-  virtual object
-  invokeList(Thread* t, object loader, const char* className,
-             const char* methodName, const char* methodSpec,
-             object this_, va_list arguments)
-  {
-    assert(t, t->exception == 0);
+  virtual void visitOld(object, unsigned number) {
+    visit(number);
+  }
 
-    assert(t, t->state == Thread::ActiveState
-           or t->state == Thread::ExclusiveState);
+  virtual void push(object object, unsigned number, unsigned offset) {
+    currentObject = object;
+    currentNumber = number;
+    currentOffset = offset;
+  }
 
-    unsigned size = parameterFootprint(t, methodSpec, this_ == 0);
-    THREAD_RUNTIME_ARRAY(t, uintptr_t, array, size);
-    THREAD_RUNTIME_ARRAY(t, bool, objectMask, size);
-    ArgumentList list
-      (t, RUNTIME_ARRAY_BODY(array), size, RUNTIME_ARRAY_BODY(objectMask),
-       this_, methodSpec, false, arguments);
+  virtual void pop() {
+    currentObject = 0;
+  }
 
-    object method = resolveMethod
-      (t, loader, className, methodName, methodSpec);
+  MyThread* t;
+  MyProcessor* p;
+  Vector heap;
+  Vector map;
+  Vector hashes;
+  unsigned imageSizeInWords;
+  object currentObject;
+  unsigned currentNumber;
+  unsigned currentOffset;
+  const char* error;
+};
 
-    assert(t, ((methodFlags(t, method) & ACC_STATIC) == 0) xor (this_ == 0));
+// Visits every object in the heap image we booted from, using its
+// heap map to tell where each one starts.
+const char*
+visitImageObjects(MyThread* t, HeapWalker* w)
+{
+  MyProcessor* p = processor(t);
+  uintptr_t* map = bootHeapMap(p->bootedImage);
+  unsigned sizeInWords = p->bootedImage->heapSize / BytesPerWord;
 
-    PROTECT(t, method);
-      
-    compile(static_cast<MyThread*>(t), 
-            local::codeAllocator(static_cast<MyThread*>(t)), 0, method);
+  for (unsigned i = 0; i < sizeInWords;) {
+    unsigned size;
+    if (getBit(map, i)) {
+      // the first word of an object refers to its class
+      object o = reinterpret_cast<object>(p->heapImage + i);
+      w->visitRoot(o);
 
-    return local::invoke(t, method, &list);
-  }
+      size = baseSize(t, o, objectClass(t, o));
+    } else {
+      // otherwise, we're looking at the header of a fixed object,
+      // which is followed by its body and mask
+      uint32_t bodySize;
+      memcpy(&bodySize, reinterpret_cast<uint8_t*>(p->heapImage + i) + 4, 4);
 
-  virtual void dispose(Thread* vmt) {
-    MyThread* t = static_cast<MyThread*>(vmt);
+      w->visitRoot(reinterpret_cast<object>
+                   (p->heapImage + i + FixieSizeInWords));
 
-    while (t->reference) {
-      vm::dispose(t, t->reference);
+      size = FixieSizeInWords + bodySize
+        + ceilingDivide(bodySize, BitsPerWord);
     }
 
-    t->arch->release();
-
-    t->m->heap->free(t, sizeof(*t));
+    if (size == 0 or i + size > sizeInWords) {
+      return "the boot image heap could not be parsed";
+    }
 
+    i += size;
   }
 
-  virtual void dispose() {
-    if (codeAllocator.base) {
-#if !defined(AVIAN_AOT_ONLY)
-      s->freeExecutable(codeAllocator.base, codeAllocator.capacity);
-#endif
-    }
+  return 0;
+}
 
-    compilationHandlers->dispose(allocator);
+int
+compareHashes(const void* a, const void* b)
+{
+  uint32_t ao = *static_cast<const uint32_t*>(a);
+  uint32_t bo = *static_cast<const uint32_t*>(b);
+  return ao < bo ? -1 : (ao > bo ? 1 : 0);
+}
 
-    s->handleSegFault(0);
+void
+loadLazyMethods(Thread* t, object map)
+{
+  for (HashMapIterator it(t, map); it.hasMore();) {
+    object c = tripleSecond(t, it.next());
+    PROTECT(t, c);
 
-    allocator->free(this, sizeof(*this));
+    for (unsigned i = 0; classMethodTable(t, c)
+           and i < arrayLength(t, classMethodTable(t, c)); ++i)
+    {
+      loadMethodCode(t, arrayBody(t, classMethodTable(t, c), i));
+    }
   }
+}
 
-  virtual object getStackTrace(Thread* vmt, Thread* vmTarget) {
-    MyThread* t = static_cast<MyThread*>(vmt);
-    MyThread* target = static_cast<MyThread*>(vmTarget);
-    MyProcessor* p = this;
-
-    class Visitor: public System::ThreadVisitor {
-     public:
-      Visitor(MyThread* t, MyProcessor* p, MyThread* target):
-        t(t), p(p), target(target), trace(0)
-      { }
-
-      virtual void visit(void* ip, void* stack, void* link) {
-        MyThread::TraceContext c(target, link);
+// Saves the heap to a boot image which may be used in place of the
+// one we booted from by later runs of the same program (see
+// avian.Machine.checkpoint).  Returns a description of the problem
+// if it can't be done.
+const char*
+writeCheckpoint(MyThread* t, const char* path)
+{
+  MyProcessor* p = processor(t);
+  BootImage* base = p->bootedImage;
 
-        if (methodForIp(t, ip)) {
-          // we caught the thread in Java code - use the register values
-          c.ip = ip;
-          c.stack = stack;
-          c.methodIsMostRecent = true;
-        } else if (target->transition) {
-          // we caught the thread in native code while in the middle
-          // of updating the context fields (MyThread::stack, etc.)
-          static_cast<MyThread::Context&>(c) = *(target->transition);
-        } else if (isVmInvokeUnsafeStack(ip)) {
-          // we caught the thread in native code just after returning
-          // from java code, but before clearing MyThread::stack
-          // (which now contains a garbage value), and the most recent
-          // Java frame, if any, can be found in
-          // MyThread::continuation or MyThread::trace
-          c.ip = 0;
-          c.stack = 0;
-        } else if (target->stack
-                   and (not isThunkUnsafeStack(t, ip))
-                   and (not isVirtualThunk(t, ip)))
-        {
-          // we caught the thread in a thunk or native code, and the
-          // saved stack pointer indicates the most recent Java frame
-          // on the stack
-          c.ip = getIp(target);
-          c.stack = target->stack;
-        } else if (isThunk(t, ip) or isVirtualThunk(t, ip)) {
-          // we caught the thread in a thunk where the stack register
-          // indicates the most recent Java frame on the stack
-          
-          // On e.g. x86, the return address will have already been
-          // pushed onto the stack, in which case we use getIp to
-          // retrieve it.  On e.g. PowerPC and ARM, it will be in the
-          // link register.  Note that we can't just check if the link
-          // argument is null here, since we use ecx/rcx as a
-          // pseudo-link register on x86 for the purpose of tail
-          // calls.
-          c.ip = t->arch->hasLinkRegister() ? link : getIp(t, link, stack);
-          c.stack = stack;
-        } else {
-          // we caught the thread in native code, and the most recent
-          // Java frame, if any, can be found in
-          // MyThread::continuation or MyThread::trace
-          c.ip = 0;
-          c.stack = 0;
-        }
+  // placeholders for code which has yet to be parsed refer to class
+  // files we won't have when restoring, so parse it all now:
+  loadLazyMethods(t, classLoaderMap(t, root(t, Machine::BootLoader)));
+  loadLazyMethods(t, classLoaderMap(t, root(t, Machine::AppLoader)));
 
-        if (ensure(t, traceSize(target))) {
-          atomicOr(&(t->flags), Thread::TracingFlag);
-          trace = makeTrace(t, target);
-          atomicAnd(&(t->flags), ~Thread::TracingFlag);
-        }
-      }
+  ACQUIRE(t, t->m->classLock);
+  ENTER(t, Thread::ExclusiveState);
 
-      MyThread* t;
-      MyProcessor* p;
-      MyThread* target;
-      object trace;
-    } visitor(t, p, target);
+  if (t->m->liveCount - t->m->daemonCount > 1) {
+    return "other threads are running";
+  }
 
-    t->m->system->visit(t->systemThread, target->systemThread, &visitor);
+  // code compiled at runtime is not saved, so we put back the code
+  // each such method had before it was compiled while we walk the
+  // heap.  Nothing is allocated until we're done, so the garbage
+  // collector won't see what we do here.
+  Vector compiled(t->m->system, t->m->heap, 0);
+  if (root(t, CodeCache)) {
+    for (HashMapIterator it(t, root(t, CodeCache)); it.hasMore();) {
+      object node = it.next();
+      object method = tripleFirst(t, node);
 
-    if (UNLIKELY(t->flags & Thread::UseBackupHeapFlag)) {
-      PROTECT(t, visitor.trace);
+      compiled.appendAddress(method);
+      compiled.appendAddress(methodCode(t, method));
 
-      collect(t, Heap::MinorCollection);
+      methodCode(t, method) = codeCacheEntryCode(t, tripleSecond(t, node));
     }
-
-    return visitor.trace ? visitor.trace : makeObjectArray(t, 0);
   }
 
-  virtual void initialize(BootImage* image, uint8_t* code, unsigned capacity) {
-    bootImage = image;
-    codeAllocator.base = code;
-    codeAllocator.capacity = capacity;
-  }
+  CheckpointVisitor visitor(t);
+  HeapWalker* w = makeHeapWalker(t, &visitor);
 
-  virtual void addCompilationHandler(CompilationHandler* handler) {
-    compilationHandlers = new(allocator->allocate(sizeof(CompilationHandlerList))) CompilationHandlerList(compilationHandlers, handler);
+  const char* error = visitImageObjects(t, w);
+
+  for (unsigned i = 0; i < 2; ++i) {
+    object map = classLoaderMap
+      (t, root(t, i == 0 ? Machine::BootLoader : Machine::AppLoader));
+
+    for (HashMapIterator it(t, map); it.hasMore();) {
+      w->visitRoot(tripleSecond(t, it.next()));
+    }
   }
 
-  virtual void compileMethod(Thread* vmt, Zone* zone, object* constants,
-                             object* calls, avian::codegen::DelayedPromise** addresses,
-                             object method, OffsetResolver* resolver)
-  {
-    MyThread* t = static_cast<MyThread*>(vmt);
-    BootContext bootContext(t, *constants, *calls, *addresses, zone, resolver);
+  unsigned virtualThunks = w->visitRoot(root(t, VirtualThunks));
 
-    compile(t, &codeAllocator, &bootContext, method);
+  unsigned classRuntimeData = w->visitRoot
+    (root(t, Machine::ClassRuntimeDataTable));
 
-    *constants = bootContext.constants;
-    *calls = bootContext.calls;
-    *addresses = bootContext.addresses;
+  for (unsigned i = 0; i < compiled.length(); i += BytesPerWord * 2) {
+    methodCode(t, reinterpret_cast<object>(compiled.getAddress(i)))
+      = reinterpret_cast<object>(compiled.getAddress(i + BytesPerWord));
   }
 
-  virtual void visitRoots(Thread* t, HeapWalker* w) {
-    bootImage->methodTree = w->visitRoot(root(t, MethodTree));
-    bootImage->methodTreeSentinal = w->visitRoot(root(t, MethodTreeSentinal));
-    bootImage->virtualThunks = w->visitRoot(root(t, VirtualThunks));
+  if (error == 0) {
+    error = visitor.error;
   }
 
-  virtual void normalizeVirtualThunks(Thread* t) {
-    for (unsigned i = 0; i < wordArrayLength(t, root(t, VirtualThunks));
-         i += 2)
-    {
-      if (wordArrayBody(t, root(t, VirtualThunks), i)) {
-        wordArrayBody(t, root(t, VirtualThunks), i)
-          -= reinterpret_cast<uintptr_t>(codeAllocator.base);
-      }
-    }
+  if (error) {
+    w->dispose();
+    return error;
   }
 
-  virtual unsigned* makeCallTable(Thread* t, HeapWalker* w) {
-    bootImage->codeSize = codeAllocator.offset;
-    bootImage->callCount = callTableSize;
+  Vector classes(t->m->system, t->m->heap, 1024);
+  unsigned classCounts[2];
+  for (unsigned i = 0; i < 2; ++i) {
+    object map = classLoaderMap
+      (t, root(t, i == 0 ? Machine::BootLoader : Machine::AppLoader));
 
-    unsigned* table = static_cast<unsigned*>
-      (t->m->heap->allocate(callTableSize * sizeof(unsigned) * 2));
+    classCounts[i] = 0;
+    for (HashMapIterator it(t, map); it.hasMore();) {
+      classes.append4(w->map()->find(tripleSecond(t, it.next())));
+      ++ classCounts[i];
+    }
+  }
 
-    unsigned index = 0;
-    for (unsigned i = 0; i < arrayLength(t, root(t, CallTable)); ++i) {
-      for (object p = arrayBody(t, root(t, CallTable), i);
-           p; p = callNodeNext(t, p))
+  // interned strings which are otherwise unreachable are left out
+  Vector strings(t->m->system, t->m->heap, 1024);
+  { object array = hashMapArray(t, root(t, Machine::StringMap));
+    for (unsigned i = 0; array and i < arrayLength(t, array); ++i) {
+      for (object n = arrayBody(t, array, i); n;
+           n = weakHashMapNodeNext(t, n))
       {
-        table[index++] = targetVW
-          (callNodeAddress(t, p)
-           - reinterpret_cast<uintptr_t>(codeAllocator.base));
-        table[index++] = targetVW
-          (w->map()->find(callNodeTarget(t, p))
-           | (static_cast<unsigned>(callNodeFlags(t, p)) << TargetBootShift));
+        object s = weakHashMapNodeKey(t, n);
+        int number = s ? w->map()->find(s) : -1;
+        if (number > 0) {
+          strings.append4(number);
+        }
       }
     }
-
-    return table;
   }
 
-  virtual void boot(Thread* t, BootImage* image, uint8_t* code) {
-#if !defined(AVIAN_AOT_ONLY)
-    if (codeAllocator.base == 0) {
-      codeAllocator.base = static_cast<uint8_t*>
-        (s->tryAllocateExecutable(ExecutableAreaSizeInBytes));
-      codeAllocator.capacity = ExecutableAreaSizeInBytes;
-    }
-#endif
+  w->dispose();
 
-    if (image and code) {
-      local::boot(static_cast<MyThread*>(t), image, code);
-    } else {
-      roots = makeArray(t, RootCount);
+  qsort(visitor.hashes.data, visitor.hashes.length() / 8, 8, compareHashes);
 
-      setRoot(t, CallTable, makeArray(t, 128));
-      
-      setRoot(t, MethodTreeSentinal, makeTreeNode(t, 0, 0, 0));
-      setRoot(t, MethodTree, root(t, MethodTreeSentinal));
-      set(t, root(t, MethodTree), TreeNodeLeft,
-          root(t, MethodTreeSentinal));
-      set(t, root(t, MethodTree), TreeNodeRight,
-          root(t, MethodTreeSentinal));
-    }
+  BootImage image = BootImage();
+  image.magic = BootImage::Magic;
+  image.heapSize = visitor.sizeInWords() * BytesPerWord;
+  image.codeSize = base->codeSize;
+  image.bootClassCount = classCounts[0];
+  image.appClassCount = classCounts[1];
+  image.stringCount = strings.length() / 4;
+  image.callCount = base->callCount;
+  image.hashCount = visitor.hashes.length() / 8;
+  image.bootLoader = base->bootLoader;
+  image.appLoader = base->appLoader;
+  image.types = base->types;
+  image.methodTree = base->methodTree;
+  image.methodTreeSentinal = base->methodTreeSentinal;
+  image.virtualThunks = virtualThunks;
+  image.classRuntimeData = classRuntimeData;
+  image.thunks = base->thunks;
+  image.checksum = (hash(visitor.heap.data, visitor.heap.length()) * 31)
+    + base->checksum;
 
-#ifdef AVIAN_AOT_ONLY
-    thunks = bootThunks;
-#else
-    local::compileThunks(static_cast<MyThread*>(t), &codeAllocator);
+  CheckpointHeader header;
+  memset(&header, 0, sizeof(CheckpointHeader));
+  header.magic = CheckpointMagic;
+  header.baseChecksum = base->checksum;
 
-    if (not (image and code)) {
-      bootThunks = thunks;
-    }
-#endif
+  Vector out(t->m->system, t->m->heap, 1024 * 1024);
+  out.append(&header, sizeof(CheckpointHeader));
+  out.append(&image, sizeof(BootImage));
+  out.append(classes.data, classes.length());
+  out.append(strings.data, strings.length());
 
-    segFaultHandler.m = t->m;
-    expect(t, t->m->system->success
-           (t->m->system->handleSegFault(&segFaultHandler)));
+  // the image's call sites and their targets are where they were:
+  out.append(reinterpret_cast<unsigned*>(base + 1)
+             + base->bootClassCount + base->appClassCount
+             + base->stringCount, base->callCount * sizeof(unsigned) * 2);
 
-    divideByZeroHandler.m = t->m;
-    expect(t, t->m->system->success
-           (t->m->system->handleDivideByZero(&divideByZeroHandler)));
-  }
+  out.append(visitor.hashes.data, visitor.hashes.length());
 
-  virtual void callWithCurrentContinuation(Thread* t, object receiver) {
-    if (Continuations) {
-      local::callWithCurrentContinuation(static_cast<MyThread*>(t), receiver);
-    } else {
-      abort(t);
-    }
+  while (out.length() % BytesPerWord) {
+    out.append(static_cast<uint8_t>(0));
   }
 
-  virtual void dynamicWind(Thread* t, object before, object thunk,
-                           object after)
-  {
-    if (Continuations) {
-      local::dynamicWind(static_cast<MyThread*>(t), before, thunk, after);
-    } else {
-      abort(t);
-    }
-  }
+  unsigned mapSize = heapMapSize(image.heapSize);
+  memset(out.allocate(mapSize), 0, mapSize);
+  memcpy(out.data + out.length() - mapSize, visitor.map.data,
+         min(mapSize, visitor.map.length()));
 
-  virtual void feedResultToContinuation(Thread* t, object continuation,
-                                        object result)
-  {
-    if (Continuations) {
-      callContinuation(static_cast<MyThread*>(t), continuation, result, 0);
-    } else {
-      abort(t);
-    }
-  }
+  out.append(visitor.heap.data, visitor.heap.length());
 
-  virtual void feedExceptionToContinuation(Thread* t, object continuation,
-                                           object exception)
-  {
-    if (Continuations) {
-      callContinuation(static_cast<MyThread*>(t), continuation, 0, exception);
-    } else {
-      abort(t);
-    }
-  }
+  header.size = out.length();
+  out.set(0, &header, sizeof(CheckpointHeader));
 
-  virtual void walkContinuationBody(Thread* t, Heap::Walker* w, object o,
-                                    unsigned start)
-  {
-    if (Continuations) {
-      local::walkContinuationBody(static_cast<MyThread*>(t), w, o, start);
-    } else {
-      abort(t);
-    }
+  if (not writeFile(path, out.data, out.length())) {
+    return "the file could not be written";
   }
-  
-  System* s;
-  Allocator* allocator;
-  object roots;
-  BootImage* bootImage;
-  uintptr_t* heapImage;
-  uint8_t* codeImage;
-  unsigned codeImageSize;
-  SignalHandler segFaultHandler;
-  SignalHandler divideByZeroHandler;
-  FixedAllocator codeAllocator;
-  ThunkCollection thunks;
-  ThunkCollection bootThunks;
-  unsigned callTableSize;
-  bool useNativeFeatures;
-  void* thunkTable[dummyIndex + 1];
-  CompilationHandlerList* compilationHandlers;
-};
 
-const char*
-stringOrNull(const char* str) {
-  if(str) {
-    return str;
-  } else {
-    return "(null)";
-  }
+  return 0;
 }
 
-size_t
-stringOrNullSize(const char* str) {
-  return strlen(stringOrNull(str));
+intptr_t
+getThunk(MyThread* t, Thunk thunk)
+{
+  MyProcessor* p = processor(t);
+  
+  return reinterpret_cast<intptr_t>
+    (p->thunks.table.start + (thunk * p->thunks.table.length));
 }
 
-void
-logCompile(MyThread* t, const void* code, unsigned size, const char* class_,
-           const char* name, const char* spec)
+BootImage::Thunk
+thunkToThunk(const MyProcessor::Thunk& thunk, uint8_t* base)
 {
-  static bool open = false;
-  if (not open) {
-    open = true;
-    const char* path = findProperty(t, "avian.jit.log");
-    if (path) {
-      compileLog = vm::fopen(path, "wb");
-    } else if (DebugCompile) {
-      compileLog = stderr;
-    }
-  }
-
-  if (compileLog) {
-    fprintf(compileLog, "%p,%p %s.%s%s\n",
-            code, static_cast<const uint8_t*>(code) + size,
-            class_, name, spec);
-  }
+  return BootImage::Thunk
+    (thunk.start - base, thunk.frameSavedOffset, thunk.length);
+}
 
-  size_t nameLength = stringOrNullSize(class_) + stringOrNullSize(name) + stringOrNullSize(spec) + 2;
+using avian::codegen::OperandInfo;
+namespace lir = avian::codegen::lir;
 
-  THREAD_RUNTIME_ARRAY(t, char, completeName, nameLength);
+void
+compileCall(MyThread* t, Context* c, ThunkIndex index, bool call = true)
+{
+  avian::codegen::Assembler* a = c->assembler;
 
-  sprintf(RUNTIME_ARRAY_BODY(completeName), "%s.%s%s", stringOrNull(class_), stringOrNull(name), stringOrNull(spec));
+  if (processor(t)->bootImage) {
+    lir::Memory table(t->arch->thread(), TARGET_THREAD_THUNKTABLE);
+    lir::Register scratch(t->arch->scratch());
+    a->apply(lir::Move,
+             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &table),
+             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &scratch));
+    lir::Memory proc(scratch.low, index * TargetBytesPerWord);
+    a->apply(lir::Move,
+             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &proc),
+             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &scratch));
+    a->apply
+      (call ? lir::Call : lir::Jump,
+       OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &scratch));
+  } else {
+    lir::Constant proc
+      (new(&c->zone) avian::codegen::ResolvedPromise(reinterpret_cast<intptr_t>(t->thunkTable[index])));
 
-  MyProcessor* p = static_cast<MyProcessor*>(t->m->processor);
-  for(CompilationHandlerList* h = p->compilationHandlers; h; h = h->next) {
-    h->handler->compiled(code, 0, 0, RUNTIME_ARRAY_BODY(completeName));
+    a->apply
+      (call ? lir::LongCall : lir::LongJump,
+       OperandInfo(TargetBytesPerWord, lir::ConstantOperand, &proc));
   }
 }
 
-void*
-compileMethod2(MyThread* t, void* ip)
+void
+compileThunks(MyThread* t, CodeAllocator* allocator)
 {
-  object node = findCallNode(t, ip);
-  object target = callNodeTarget(t, node);
+  MyProcessor* p = processor(t);
+
+  { Context context(t);
+    avian::codegen::Assembler* a = context.assembler;
+    
+    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
+
+    p->thunks.default_.frameSavedOffset = a->length();
+
+    lir::Register thread(t->arch->thread());
+    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
+  
+    compileCall(t, &context, compileMethodIndex);
+
+    a->popFrame(t->arch->alignFrameSize(1));
+
+    lir::Register result(t->arch->returnLow());
+    a->apply(lir::Jump,
+             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &result));
 
-  PROTECT(t, node);
-  PROTECT(t, target);
+    p->thunks.default_.length = a->endBlock(false)->resolve(0, 0);
 
-  t->trace->targetMethod = target;
+    p->thunks.default_.start = finish
+      (t, allocator, a, "default", p->thunks.default_.length);
+  }
 
-  THREAD_RESOURCE0(t, static_cast<MyThread*>(t)->trace->targetMethod = 0);
+  { Context context(t);
+    avian::codegen::Assembler* a = context.assembler;
+    
+    lir::Register class_(t->arch->virtualCallTarget());
+    lir::Memory virtualCallTargetSrc
+      (t->arch->stack(),
+       (t->arch->frameFooterSize() + t->arch->frameReturnAddressSize())
+       * TargetBytesPerWord);
 
-  compile(t, codeAllocator(t), 0, target);
+    a->apply(lir::Move,
+             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &virtualCallTargetSrc),
+             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &class_));
 
-  uint8_t* updateIp = static_cast<uint8_t*>(ip);
+    lir::Memory virtualCallTargetDst
+      (t->arch->thread(), TARGET_THREAD_VIRTUALCALLTARGET);
 
-  MyProcessor* p = processor(t);
+    a->apply(lir::Move,
+             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &class_),
+             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &virtualCallTargetDst));
 
-  bool updateCaller = updateIp < p->codeImage
-    or updateIp >= p->codeImage + p->codeImageSize;
+    lir::Register index(t->arch->virtualCallIndex());
+    lir::Memory virtualCallIndex
+      (t->arch->thread(), TARGET_THREAD_VIRTUALCALLINDEX);
 
-  uintptr_t address;
-  if (methodFlags(t, target) & ACC_NATIVE) {
-    address = useLongJump(t, reinterpret_cast<uintptr_t>(ip))
-      or (not updateCaller) ? bootNativeThunk(t) : nativeThunk(t);
-  } else {
-    address = methodAddress(t, target);
-  }
+    a->apply(lir::Move,
+             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &index),
+             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &virtualCallIndex));
+    
+    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
 
-  if (updateCaller) {
-    avian::codegen::lir::UnaryOperation op;
-    if (callNodeFlags(t, node) & TraceElement::LongCall) {
-      if (callNodeFlags(t, node) & TraceElement::TailCall) {
-        op = avian::codegen::lir::AlignedLongJump;
-      } else {
-        op = avian::codegen::lir::AlignedLongCall;
-      }
-    } else if (callNodeFlags(t, node) & TraceElement::TailCall) {
-      op = avian::codegen::lir::AlignedJump;
-    } else {
-      op = avian::codegen::lir::AlignedCall;
-    }
+    p->thunks.defaultVirtual.frameSavedOffset = a->length();
 
-    updateCall(t, op, updateIp, reinterpret_cast<void*>(address));
-  }
+    lir::Register thread(t->arch->thread());
+    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
 
-  return reinterpret_cast<void*>(address);
-}
+    compileCall(t, &context, compileVirtualMethodIndex);
+  
+    a->popFrame(t->arch->alignFrameSize(1));
 
-bool
-isThunk(MyProcessor::ThunkCollection* thunks, void* ip)
-{
-  uint8_t* thunkStart = thunks->default_.start;
-  uint8_t* thunkEnd = thunks->table.start
-    + (thunks->table.length * ThunkCount);
+    lir::Register result(t->arch->returnLow());
+    a->apply(lir::Jump,
+             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &result));
 
-  return (reinterpret_cast<uintptr_t>(ip)
-          >= reinterpret_cast<uintptr_t>(thunkStart)
-          and reinterpret_cast<uintptr_t>(ip)
-          < reinterpret_cast<uintptr_t>(thunkEnd));
-}
+    p->thunks.defaultVirtual.length = a->endBlock(false)->resolve(0, 0);
 
-bool
-isThunk(MyThread* t, void* ip)
-{
-  MyProcessor* p = processor(t);
+    p->thunks.defaultVirtual.start = finish
+      (t, allocator, a, "defaultVirtual", p->thunks.defaultVirtual.length);
+  }
 
-  return isThunk(&(p->thunks), ip) or isThunk(&(p->bootThunks), ip);
-}
+  { Context context(t);
+    avian::codegen::Assembler* a = context.assembler;
 
-bool
-isThunkUnsafeStack(MyProcessor::Thunk* thunk, void* ip)
-{
-  return reinterpret_cast<uintptr_t>(ip)
-    >= reinterpret_cast<uintptr_t>(thunk->start)
-    and reinterpret_cast<uintptr_t>(ip)
-    < reinterpret_cast<uintptr_t>(thunk->start + thunk->frameSavedOffset);
-}
+    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
 
-bool
-isThunkUnsafeStack(MyProcessor::ThunkCollection* thunks, void* ip)
-{
-  const unsigned NamedThunkCount = 5;
+    p->thunks.native.frameSavedOffset = a->length();
 
-  MyProcessor::Thunk table[NamedThunkCount + ThunkCount];
+    lir::Register thread(t->arch->thread());
+    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
 
-  table[0] = thunks->default_;
-  table[1] = thunks->defaultVirtual;
-  table[2] = thunks->native;
-  table[3] = thunks->aioob;
-  table[4] = thunks->stackOverflow;
-    
-  for (unsigned i = 0; i < ThunkCount; ++i) {
-    new (table + NamedThunkCount + i) MyProcessor::Thunk
-      (thunks->table.start + (i * thunks->table.length),
-       thunks->table.frameSavedOffset,
-       thunks->table.length);
-  }
+    compileCall(t, &context, invokeNativeIndex);
+  
+    a->popFrameAndUpdateStackAndReturn
+      (t->arch->alignFrameSize(1), TARGET_THREAD_NEWSTACK);
 
-  for (unsigned i = 0; i < NamedThunkCount + ThunkCount; ++i) {
-    if (isThunkUnsafeStack(table + i, ip)) {
-      return true;
-    }
+    p->thunks.native.length = a->endBlock(false)->resolve(0, 0);
+
+    p->thunks.native.start = finish
+      (t, allocator, a, "native", p->thunks.native.length);
   }
 
-  return false;
-}
+  { Context context(t);
+    avian::codegen::Assembler* a = context.assembler;
 
-bool
-isVirtualThunk(MyThread* t, void* ip)
-{
-  for (unsigned i = 0; i < wordArrayLength(t, root(t, VirtualThunks)); i += 2)
-  {
-    uintptr_t start = wordArrayBody(t, root(t, VirtualThunks), i);
-    uintptr_t end = start + wordArrayBody(t, root(t, VirtualThunks), i + 1);
+    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
 
-    if (reinterpret_cast<uintptr_t>(ip) >= start
-        and reinterpret_cast<uintptr_t>(ip) < end)
-    {
-      return true;
-    }
-  }
+    p->thunks.aioob.frameSavedOffset = a->length();
 
-  return false;
-}
+    lir::Register thread(t->arch->thread());
+    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
 
-bool
-isThunkUnsafeStack(MyThread* t, void* ip)
-{
-  MyProcessor* p = processor(t);
+    compileCall(t, &context, throwArrayIndexOutOfBoundsIndex);
 
-  return isThunk(t, ip)
-    and (isThunkUnsafeStack(&(p->thunks), ip)
-         or isThunkUnsafeStack(&(p->bootThunks), ip));
-}
+    p->thunks.aioob.length = a->endBlock(false)->resolve(0, 0);
 
-object
-findCallNode(MyThread* t, void* address)
-{
-  if (DebugCallTable) {
-    fprintf(stderr, "find call node %p\n", address);
+    p->thunks.aioob.start = finish
+      (t, allocator, a, "aioob", p->thunks.aioob.length);
   }
 
-  // we must use a version of the call table at least as recent as the
-  // compiled form of the method containing the specified address (see
-  // compile(MyThread*, Allocator*, BootContext*, object)):
-  loadMemoryBarrier();
-
-  object table = root(t, CallTable);
+  { Context context(t);
+    avian::codegen::Assembler* a = context.assembler;
+      
+    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
 
-  intptr_t key = reinterpret_cast<intptr_t>(address);
-  unsigned index = static_cast<uintptr_t>(key) & (arrayLength(t, table) - 1);
+    p->thunks.stackOverflow.frameSavedOffset = a->length();
 
-  for (object n = arrayBody(t, table, index);
-       n; n = callNodeNext(t, n))
-  {
-    intptr_t k = callNodeAddress(t, n);
+    lir::Register thread(t->arch->thread());
+    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
 
-    if (k == key) {
-      return n;
-    }
-  }
+    compileCall(t, &context, throwStackOverflowIndex);
 
-  return 0;
-}
+    p->thunks.stackOverflow.length = a->endBlock(false)->resolve(0, 0);
 
-object
-resizeTable(MyThread* t, object oldTable, unsigned newLength)
-{
-  PROTECT(t, oldTable);
+    p->thunks.stackOverflow.start = finish
+      (t, allocator, a, "stackOverflow", p->thunks.stackOverflow.length);
+  }
 
-  object oldNode = 0;
-  PROTECT(t, oldNode);
+  { { Context context(t);
+      avian::codegen::Assembler* a = context.assembler;
 
-  object newTable = makeArray(t, newLength);
-  PROTECT(t, newTable);
+      a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
 
-  for (unsigned i = 0; i < arrayLength(t, oldTable); ++i) {
-    for (oldNode = arrayBody(t, oldTable, i);
-         oldNode;
-         oldNode = callNodeNext(t, oldNode))
-    {
-      intptr_t k = callNodeAddress(t, oldNode);
+      p->thunks.table.frameSavedOffset = a->length();
 
-      unsigned index = k & (newLength - 1);
+      compileCall(t, &context, dummyIndex, false);
 
-      object newNode = makeCallNode
-        (t, callNodeAddress(t, oldNode),
-         callNodeTarget(t, oldNode),
-         callNodeFlags(t, oldNode),
-         arrayBody(t, newTable, index));
+      p->thunks.table.length = a->endBlock(false)->resolve(0, 0);
 
-      set(t, newTable, ArrayBody + (index * BytesPerWord), newNode);
+      p->thunks.table.start = static_cast<uint8_t*>
+        (allocator->allocate
+         (p->thunks.table.length * ThunkCount, TargetBytesPerWord));
     }
-  }
 
-  return newTable;
-}
+    uint8_t* start = p->thunks.table.start;
 
-object
-insertCallNode(MyThread* t, object table, unsigned* size, object node)
-{
-  if (DebugCallTable) {
-    fprintf(stderr, "insert call node %p\n",
-            reinterpret_cast<void*>(callNodeAddress(t, node)));
+#define THUNK(s) {                                                      \
+      Context context(t);                                               \
+      avian::codegen::Assembler* a = context.assembler;                                 \
+                                                                        \
+      a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);              \
+                                                                        \
+      p->thunks.table.frameSavedOffset = a->length();                   \
+                                                                        \
+      compileCall(t, &context, s##Index, false);                        \
+                                                                        \
+      expect(t, a->endBlock(false)->resolve(0, 0)                       \
+             <= p->thunks.table.length);                                \
+                                                                        \
+      a->setDestination(start);                                         \
+      a->write();                                                       \
+                                                                        \
+      logCompile(t, start, p->thunks.table.length, 0, #s, 0);           \
+                                                                        \
+      start += p->thunks.table.length;                                  \
+    }
+#include "thunks.cpp"
+#undef THUNK
   }
 
-  PROTECT(t, table);
-  PROTECT(t, node);
+  BootImage* image = p->bootImage;
 
-  ++ (*size);
+  if (image) {
+    uint8_t* imageBase = p->codeAllocator.base;
 
-  if (*size >= arrayLength(t, table) * 2) { 
-    table = resizeTable(t, table, arrayLength(t, table) * 2);
+    image->thunks.default_ = thunkToThunk(p->thunks.default_, imageBase);
+    image->thunks.defaultVirtual = thunkToThunk
+      (p->thunks.defaultVirtual, imageBase);
+    image->thunks.native = thunkToThunk(p->thunks.native, imageBase);
+    image->thunks.aioob = thunkToThunk(p->thunks.aioob, imageBase);
+    image->thunks.stackOverflow = thunkToThunk
+      (p->thunks.stackOverflow, imageBase);
+    image->thunks.table = thunkToThunk(p->thunks.table, imageBase);
   }
+}
 
-  intptr_t key = callNodeAddress(t, node);
-  unsigned index = static_cast<uintptr_t>(key) & (arrayLength(t, table) - 1);
+MyProcessor*
+processor(MyThread* t)
+{
+  return static_cast<MyProcessor*>(t->m->processor);
+}
 
-  set(t, node, CallNodeNext, arrayBody(t, table, index));
-  set(t, table, ArrayBody + (index * BytesPerWord), node);
+uintptr_t
+defaultThunk(MyThread* t)
+{
+  return reinterpret_cast<uintptr_t>(processor(t)->thunks.default_.start);
+}
 
-  return table;
+uintptr_t
+bootDefaultThunk(MyThread* t)
+{
+  return reinterpret_cast<uintptr_t>(processor(t)->bootThunks.default_.start);
 }
 
-void
-insertCallNode(MyThread* t, object node)
+uintptr_t
+defaultVirtualThunk(MyThread* t)
 {
-  setRoot(t, CallTable, insertCallNode
-          (t, root(t, CallTable), &(processor(t)->callTableSize), node));
+  return reinterpret_cast<uintptr_t>
+    (processor(t)->thunks.defaultVirtual.start);
 }
 
-object
-makeClassMap(Thread* t, unsigned* table, unsigned count,
-             uintptr_t* heap)
+uintptr_t
+nativeThunk(MyThread* t)
 {
-  object array = makeArray(t, nextPowerOfTwo(count));
-  object map = makeHashMap(t, 0, array);
-  PROTECT(t, map);
-  
-  for (unsigned i = 0; i < count; ++i) {
-    object c = bootObject(heap, table[i]);
-    hashMapInsert(t, map, className(t, c), c, byteArrayHash);
-  }
+  return reinterpret_cast<uintptr_t>(processor(t)->thunks.native.start);
+}
 
-  return map;
+uintptr_t
+bootNativeThunk(MyThread* t)
+{
+  return reinterpret_cast<uintptr_t>(processor(t)->bootThunks.native.start);
 }
 
-object
-makeStaticTableArray(Thread* t, unsigned* bootTable, unsigned bootCount,
-                     unsigned* appTable, unsigned appCount, uintptr_t* heap)
+uintptr_t
+aioobThunk(MyThread* t)
 {
-  object array = makeArray(t, bootCount + appCount);
-  
-  for (unsigned i = 0; i < bootCount; ++i) {
-    set(t, array, ArrayBody + (i * BytesPerWord),
-        classStaticTable(t, bootObject(heap, bootTable[i])));
-  }
+  return reinterpret_cast<uintptr_t>(processor(t)->thunks.aioob.start);
+}
 
-  for (unsigned i = 0; i < appCount; ++i) {
-    set(t, array, ArrayBody + ((bootCount + i) * BytesPerWord),
-        classStaticTable(t, bootObject(heap, appTable[i])));
-  }
+uintptr_t
+stackOverflowThunk(MyThread* t)
+{
+  return reinterpret_cast<uintptr_t>(processor(t)->thunks.stackOverflow.start);
+}
 
-  return array;
+bool
+unresolved(MyThread* t, uintptr_t methodAddress)
+{
+  return methodAddress == defaultThunk(t)
+    or methodAddress == bootDefaultThunk(t);
 }
 
-object
-makeStringMap(Thread* t, unsigned* table, unsigned count, uintptr_t* heap)
+uintptr_t
+compileVirtualThunk(MyThread* t, unsigned index, unsigned* size)
 {
-  object array = makeArray(t, nextPowerOfTwo(count));
-  object map = makeWeakHashMap(t, 0, array);
-  PROTECT(t, map);
+  Context context(t);
+  avian::codegen::Assembler* a = context.assembler;
+
+  avian::codegen::ResolvedPromise indexPromise(index);
+  lir::Constant indexConstant(&indexPromise);
+  lir::Register indexRegister(t->arch->virtualCallIndex());
+  a->apply(lir::Move,
+           OperandInfo(TargetBytesPerWord, lir::ConstantOperand, &indexConstant),
+           OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &indexRegister));
   
-  for (unsigned i = 0; i < count; ++i) {
-    object s = bootObject(heap, table[i]);
-    hashMapInsert(t, map, s, 0, stringHash);
-  }
+  avian::codegen::ResolvedPromise defaultVirtualThunkPromise(defaultVirtualThunk(t));
+  lir::Constant thunk(&defaultVirtualThunkPromise);
+  a->apply(lir::Jump,
+           OperandInfo(TargetBytesPerWord, lir::ConstantOperand, &thunk));
 
-  return map;
-}
+  *size = a->endBlock(false)->resolve(0, 0);
 
-object
-makeCallTable(MyThread* t, uintptr_t* heap, unsigned* calls, unsigned count,
-              uintptr_t base)
-{
-  object table = makeArray(t, nextPowerOfTwo(count));
-  PROTECT(t, table);
+  uint8_t* start = static_cast<uint8_t*>
+    (codeAllocator(t)->allocate(*size, TargetBytesPerWord));
 
-  unsigned size = 0;
-  for (unsigned i = 0; i < count; ++i) {
-    unsigned address = calls[i * 2];
-    unsigned target = calls[(i * 2) + 1];
+  a->setDestination(start);
+  a->write();
 
-    object node = makeCallNode
-       (t, base + address, bootObject(heap, target & BootMask),
-        target >> BootShift, 0);
+  const char* const virtualThunkBaseName = "virtualThunk";
+  const size_t virtualThunkBaseNameLength = strlen(virtualThunkBaseName);
+  const size_t maxIntStringLength = 10;
 
-    table = insertCallNode(t, table, &size, node);
-  }
+  THREAD_RUNTIME_ARRAY(t, char, virtualThunkName, virtualThunkBaseNameLength + maxIntStringLength);
 
-  return table;
+  sprintf(RUNTIME_ARRAY_BODY(virtualThunkName), "%s%d", virtualThunkBaseName, index);
+
+  logCompile(t, start, *size, 0, RUNTIME_ARRAY_BODY(virtualThunkName), 0);
+
+  return reinterpret_cast<uintptr_t>(start);
 }
 
-void
-fixupHeap(MyThread* t UNUSED, uintptr_t* map, unsigned size, uintptr_t* heap)
+uintptr_t
+virtualThunk(MyThread* t, unsigned index)
 {
-  for (unsigned word = 0; word < size; ++word) {
-    uintptr_t w = map[word];
-    if (w) {
-      for (unsigned bit = 0; bit < BitsPerWord; ++bit) {
-        if (w & (static_cast<uintptr_t>(1) << bit)) {
-          unsigned index = indexOf(word, bit);
-
-          uintptr_t* p = heap + index;
-          assert(t, *p);
-          
-          uintptr_t number = *p & BootMask;
-          uintptr_t mark = *p >> BootShift;
+  ACQUIRE(t, t->m->classLock);
 
-          if (number) {
-            *p = reinterpret_cast<uintptr_t>(heap + (number - 1)) | mark;
-            // fprintf(stderr, "fixup %d: %d 0x%x\n", index, static_cast<unsigned>(number), static_cast<unsigned>(*p));
-          } else {
-            *p = mark;
-          }
-        }
-      }
+  if (root(t, VirtualThunks) == 0
+      or wordArrayLength(t, root(t, VirtualThunks)) <= index * 2)
+  {
+    object newArray = makeWordArray(t, nextPowerOfTwo((index + 1) * 2));
+    if (root(t, VirtualThunks)) {
+      memcpy(&wordArrayBody(t, newArray, 0),
+             &wordArrayBody(t, root(t, VirtualThunks), 0),
+             wordArrayLength(t, root(t, VirtualThunks)) * BytesPerWord);
     }
+    setRoot(t, VirtualThunks, newArray);
+  }
+
+  if (wordArrayBody(t, root(t, VirtualThunks), index * 2) == 0) {
+    unsigned size;
+    uintptr_t thunk = compileVirtualThunk(t, index, &size);
+    wordArrayBody(t, root(t, VirtualThunks), index * 2) = thunk;
+    wordArrayBody(t, root(t, VirtualThunks), (index * 2) + 1) = size;
   }
+
+  return wordArrayBody(t, root(t, VirtualThunks), index * 2);
 }
 
 void
-resetClassRuntimeState(Thread* t, object c, uintptr_t* heap, unsigned heapSize)
+noteVtableEntry(MyThread* t, object method, object class_)
 {
-  classRuntimeDataIndex(t, c) = 0;
+  // the caller must hold the class lock
 
-  if (classArrayElementSize(t, c) == 0) {
-    object staticTable = classStaticTable(t, c);
-    if (staticTable) {
-      for (unsigned i = 0; i < singletonCount(t, staticTable); ++i) {
-        if (singletonIsObject(t, staticTable, i)
-            and (reinterpret_cast<uintptr_t*>
-                 (singletonObject(t, staticTable, i)) < heap or
-                 reinterpret_cast<uintptr_t*>
-                 (singletonObject(t, staticTable, i)) > heap + heapSize))
-        {
-          singletonObject(t, staticTable, i) = 0;
-        }
-      }
-    }
-  }
-
-  if (classMethodTable(t, c)) {
-    for (unsigned i = 0; i < arrayLength(t, classMethodTable(t, c)); ++i) {
-      object m = arrayBody(t, classMethodTable(t, c), i);
-
-      methodNativeID(t, m) = 0;
-      methodRuntimeDataIndex(t, m) = 0;
+  object entry = hashMapFind
+    (t, root(t, CodeCache), method, objectHash, objectEqual);
 
-      if (methodVmFlags(t, m) & ClassInitFlag) {
-        classVmFlags(t, c) |= NeedInitFlag;
-        classVmFlags(t, c) &= ~InitErrorFlag;
+  if (entry and class_ != methodClass(t, method)) {
+    for (object p = codeCacheEntryClasses(t, entry); p; p = pairSecond(t, p))
+    {
+      if (pairFirst(t, p) == class_) {
+        return;
       }
     }
-  }
 
-  t->m->processor->initVtable(t, c);
-}
+    PROTECT(t, entry);
 
-void
-resetRuntimeState(Thread* t, object map, uintptr_t* heap, unsigned heapSize)
-{
-  for (HashMapIterator it(t, map); it.hasMore();) {
-    resetClassRuntimeState(t, tripleSecond(t, it.next()), heap, heapSize);
+    object p = makePair(t, class_, codeCacheEntryClasses(t, entry));
+    set(t, entry, CodeCacheEntryClasses, p);
   }
 }
 
 void
-fixupMethods(Thread* t, object map, BootImage* image UNUSED, uint8_t* code)
+resetVtableEntry(MyThread* t, object class_, object method)
 {
-  for (HashMapIterator it(t, map); it.hasMore();) {
-    object c = tripleSecond(t, it.next());
-
-    if (classMethodTable(t, c)) {
-      for (unsigned i = 0; i < arrayLength(t, classMethodTable(t, c)); ++i) {
-        object method = arrayBody(t, classMethodTable(t, c), i);
-        if (methodCode(t, method)) {
-          assert(t, methodCompiled(t, method)
-                 <= static_cast<int32_t>(image->codeSize));
-
-          codeCompiled(t, methodCode(t, method))
-            = methodCompiled(t, method) + reinterpret_cast<uintptr_t>(code);
-
-          if (DebugCompile) {
-            logCompile
-              (static_cast<MyThread*>(t),
-               reinterpret_cast<uint8_t*>(methodCompiled(t, method)),
-               methodCompiledSize(t, method),
-               reinterpret_cast<char*>
-               (&byteArrayBody(t, className(t, methodClass(t, method)), 0)),
-               reinterpret_cast<char*>
-               (&byteArrayBody(t, methodName(t, method), 0)),
-               reinterpret_cast<char*>
-               (&byteArrayBody(t, methodSpec(t, method), 0)));
-          }
-        }
-      }
-    }
-
-    t->m->processor->initVtable(t, c);
+  void*& entry = classVtable(t, class_, methodOffset(t, method));
+  if (entry == reinterpret_cast<void*>(methodCompiled(t, method))) {
+    entry = reinterpret_cast<void*>(virtualThunk(t, methodOffset(t, method)));
   }
 }
 
-MyProcessor::Thunk
-thunkToThunk(const BootImage::Thunk& thunk, uint8_t* base)
+object
+codeCacheEntry(MyThread* t, object method)
 {
-  return MyProcessor::Thunk
-    (base + thunk.start, thunk.frameSavedOffset, thunk.length);
+  return hashMapFind(t, root(t, CodeCache), method, objectHash, objectEqual);
 }
 
-void
-findThunks(MyThread* t, BootImage* image, uint8_t* code)
+bool
+evictable(MyThread* t, object method)
 {
-  MyProcessor* p = processor(t);
-  
-  p->bootThunks.default_ = thunkToThunk(image->thunks.default_, code);
-  p->bootThunks.defaultVirtual
-    = thunkToThunk(image->thunks.defaultVirtual, code);
-  p->bootThunks.native = thunkToThunk(image->thunks.native, code);
-  p->bootThunks.aioob = thunkToThunk(image->thunks.aioob, code);
-  p->bootThunks.stackOverflow
-    = thunkToThunk(image->thunks.stackOverflow, code);
-  p->bootThunks.table = thunkToThunk(image->thunks.table, code);
+  object entry = method ? codeCacheEntry(t, method) : 0;
+  return entry and not codeCacheEntryMarked(t, entry);
 }
 
+class CodeCacheMarker: public Processor::StackVisitor {
+ public:
+  CodeCacheMarker(MyThread* t): t(t) { }
+
+  virtual bool visit(Processor::StackWalker* walker) {
+    object entry = walker->method() ? codeCacheEntry(t, walker->method()) : 0;
+    if (entry) {
+      codeCacheEntryMarked(t, entry) = true;
+    }
+    return true;
+  }
+
+  MyThread* t;
+};
+
 void
-fixupVirtualThunks(MyThread* t, uint8_t* code)
+markActiveCode(Thread* t, CodeCacheMarker* marker)
 {
-  for (unsigned i = 0; i < wordArrayLength(t, root(t, VirtualThunks)); i += 2)
-  {
-    if (wordArrayBody(t, root(t, VirtualThunks), i)) {
-      wordArrayBody(t, root(t, VirtualThunks), i)
-        = wordArrayBody(t, root(t, VirtualThunks), i)
-        + reinterpret_cast<uintptr_t>(code);
-    }
+  if (t->state != Thread::ZombieState) {
+    MyStackWalker walker(static_cast<MyThread*>(t));
+    walker.walk(marker);
+  }
+
+  for (Thread* c = t->child; c; c = c->peer) {
+    markActiveCode(c, marker);
   }
 }
 
+// Reclaims the code for each method compiled at runtime which does
+// not have a frame on any thread's stack, resetting the method to be
+// compiled again on its next call.  We find every reference to the
+// code via the call table, the vtable entries recorded in each
+// method's code cache entry, and the method tree.
 void
-boot(MyThread* t, BootImage* image, uint8_t* code)
+sweepCode(MyThread* t, CodeAllocator* allocator)
 {
-  assert(t, image->magic == BootImage::Magic);
+  ACQUIRE(t, t->m->classLock);
+  ENTER(t, Thread::ExclusiveState);
 
-  unsigned* bootClassTable = reinterpret_cast<unsigned*>(image + 1);
-  unsigned* appClassTable = bootClassTable + image->bootClassCount;
-  unsigned* stringTable = appClassTable + image->appClassCount;
-  unsigned* callTable = stringTable + image->stringCount;
+  if (not allocator->needsSweep()) {
+    // another thread got here first
+    return;
+  }
 
-  uintptr_t* heapMap = reinterpret_cast<uintptr_t*>
-    (padWord(reinterpret_cast<uintptr_t>(callTable + (image->callCount * 2))));
+  allocator->swept();
 
-  unsigned heapMapSizeInWords = ceilingDivide
-    (heapMapSize(image->heapSize), BytesPerWord);
-  uintptr_t* heap = heapMap + heapMapSizeInWords;
+  CodeCacheMarker marker(t);
+  for (Thread* p = t->m->rootThread; p; p = p->peer) {
+    markActiveCode(p, &marker);
+  }
 
-  MyProcessor* p = static_cast<MyProcessor*>(t->m->processor);
+  // reset or discard each call site which refers to or lies within
+  // code we're about to evict.  Note that we must do this before
+  // replacing the method tree, since we use it to find the method
+  // containing each site:
 
-  t->heapImage = p->heapImage = heap;
+  MyProcessor* processor = local::processor(t);
+  object table = root(t, CallTable);
+  for (unsigned i = 0; i < arrayLength(t, table); ++i) {
+    object previous = 0;
+    for (object node = arrayBody(t, table, i); node;
+         node = callNodeNext(t, node))
+    {
+      uint8_t* address = reinterpret_cast<uint8_t*>(callNodeAddress(t, node));
 
-  // fprintf(stderr, "heap from %p to %p\n",
-  //         heap, heap + ceilingDivide(image->heapSize, BytesPerWord));
+      if (evictable(t, methodForIp(t, address))) {
+        if (previous) {
+          set(t, previous, CallNodeNext, callNodeNext(t, node));
+        } else {
+          set(t, table, ArrayBody + (i * BytesPerWord), callNodeNext(t, node));
+        }
+        -- processor->callTableSize;
+        continue;
+      }
 
-  t->codeImage = p->codeImage = code;
-  p->codeImageSize = image->codeSize;
+      object target = callNodeTarget(t, node);
+      if (evictable(t, target)
+          and (callNodeFlags(t, node) & TraceElement::VirtualCall) == 0
+          and (address < processor->codeImage
+               or address >= processor->codeImage + processor->codeImageSize))
+      {
+        updateCall(t, callNodeOperation(t, node), address,
+                   reinterpret_cast<void*>(defaultThunk(t)));
+      }
 
-  // fprintf(stderr, "code from %p to %p\n",
-  //         code, code + image->codeSize);
- 
-  if (not image->initialized) {
-    fixupHeap(t, heapMap, heapMapSizeInWords, heap);
+      previous = node;
+    }
   }
-  
-  t->m->heap->setImmortalHeap(heap, image->heapSize / BytesPerWord);
 
-  t->m->types = bootObject(heap, image->types);
+  object methods = treeValues
+    (t, root(t, MethodTree), root(t, MethodTreeSentinal));
+  PROTECT(t, methods);
 
-  t->m->roots = makeArray(t, Machine::RootCount);
+  object tree = root(t, MethodTreeSentinal);
+  PROTECT(t, tree);
 
-  setRoot(t, Machine::BootLoader, bootObject(heap, image->bootLoader));
-  setRoot(t, Machine::AppLoader, bootObject(heap, image->appLoader));
+  object evicted = 0;
+  PROTECT(t, evicted);
 
-  p->roots = makeArray(t, RootCount);
-  
-  setRoot(t, MethodTree, bootObject(heap, image->methodTree));
-  setRoot(t, MethodTreeSentinal, bootObject(heap, image->methodTreeSentinal));
+  Zone zone(t->m->system, t->m->heap, 0);
 
-  setRoot(t, VirtualThunks, bootObject(heap, image->virtualThunks));
+  for (unsigned i = 0; i < arrayLength(t, methods); ++i) {
+    object method = arrayBody(t, methods, i);
+    if (evictable(t, method)) {
+      evicted = makePair(t, method, evicted);
+    } else {
+      tree = treeInsert
+        (t, &zone, tree, methodCompiled(t, method), method,
+         root(t, MethodTreeSentinal), compareIpToMethodBounds);
 
-  { object map = makeClassMap(t, bootClassTable, image->bootClassCount, heap);
-    set(t, root(t, Machine::BootLoader), ClassLoaderMap, map);
+      zone.dispose();
+    }
   }
 
-  systemClassLoaderFinder(t, root(t, Machine::BootLoader)) = t->m->bootFinder;
+  setRoot(t, MethodTree, tree);
 
-  { object map = makeClassMap(t, appClassTable, image->appClassCount, heap);
-    set(t, root(t, Machine::AppLoader), ClassLoaderMap, map);
-  }
+  for (; evicted; evicted = pairSecond(t, evicted)) {
+    object method = pairFirst(t, evicted);
+    PROTECT(t, method);
 
-  systemClassLoaderFinder(t, root(t, Machine::AppLoader)) = t->m->appFinder;
+    object entry = codeCacheEntry(t, method);
+    PROTECT(t, entry);
 
-  setRoot(t, Machine::StringMap, makeStringMap
-          (t, stringTable, image->stringCount, heap));
+    if (methodVirtual(t, method)) {
+      resetVtableEntry(t, methodClass(t, method), method);
 
-  p->callTableSize = image->callCount;
+      for (object p = codeCacheEntryClasses(t, entry); p; p = pairSecond(t, p))
+      {
+        resetVtableEntry(t, pairFirst(t, p), method);
+      }
+    }
 
-  setRoot(t, CallTable, makeCallTable
-          (t, heap, callTable, image->callCount,
-           reinterpret_cast<uintptr_t>(code)));
+    void* start = reinterpret_cast<void*>(methodCompiled(t, method));
 
-  setRoot(t, StaticTableArray, makeStaticTableArray
-          (t, bootClassTable, image->bootClassCount,
-           appClassTable, image->appClassCount, heap));
-    
-  findThunks(t, image, code);
+    set(t, method, MethodCode, codeCacheEntryCode(t, entry));
 
-  if (image->initialized) {
-    resetRuntimeState
-      (t, classLoaderMap(t, root(t, Machine::BootLoader)), heap,
-       image->heapSize);
+    hashMapRemove(t, root(t, CodeCache), method, objectHash, objectEqual);
 
-    resetRuntimeState
-      (t, classLoaderMap(t, root(t, Machine::AppLoader)), heap,
-       image->heapSize);
+    allocator->free(start, codeCacheEntryFootprint(t, entry));
 
-    for (unsigned i = 0; i < arrayLength(t, t->m->types); ++i) {
-      resetClassRuntimeState
-        (t, type(t, static_cast<Machine::Type>(i)), heap, image->heapSize);
+    if (DebugMethodTree) {
+      fprintf(stderr, "evict method at %p\n", start);
     }
-  } else {
-    fixupVirtualThunks(t, code);
-
-    fixupMethods
-      (t, classLoaderMap(t, root(t, Machine::BootLoader)), image, code);
-
-    fixupMethods
-      (t, classLoaderMap(t, root(t, Machine::AppLoader)), image, code);
   }
 
-  image->initialized = true;
-
-  setRoot(t, Machine::BootstrapClassMap, makeHashMap(t, 0, 0));
+  for (HashMapIterator it(t, root(t, CodeCache)); it.hasMore();) {
+    codeCacheEntryMarked(t, tripleSecond(t, it.next())) = false;
+  }
 }
 
-intptr_t
-getThunk(MyThread* t, Thunk thunk)
+object
+readCacheClass(MyThread* t, CacheReader* r, object loader)
 {
-  MyProcessor* p = processor(t);
-  
-  return reinterpret_cast<intptr_t>
-    (p->thunks.table.start + (thunk * p->thunks.table.length));
+  object name = r->readByteArray(t);
+  object class_ = (r->ok and name)
+    ? resolveClass(t, loader, name, false) : 0;
+
+  if (class_ == 0) {
+    r->ok = false;
+  }
+  return class_;
 }
 
-BootImage::Thunk
-thunkToThunk(const MyProcessor::Thunk& thunk, uint8_t* base)
+object
+readCacheMember(MyThread* t, CacheReader* r, object loader,
+                object (*find)(Thread*, object, object, object))
 {
-  return BootImage::Thunk
-    (thunk.start - base, thunk.frameSavedOffset, thunk.length);
-}
+  object class_ = readCacheClass(t, r, loader);
+  PROTECT(t, class_);
 
-using avian::codegen::OperandInfo;
-namespace lir = avian::codegen::lir;
+  object name = r->readByteArray(t);
+  PROTECT(t, name);
 
-void
-compileCall(MyThread* t, Context* c, ThunkIndex index, bool call = true)
-{
-  avian::codegen::Assembler* a = c->assembler;
+  object spec = r->readByteArray(t);
 
-  if (processor(t)->bootImage) {
-    lir::Memory table(t->arch->thread(), TARGET_THREAD_THUNKTABLE);
-    lir::Register scratch(t->arch->scratch());
-    a->apply(lir::Move,
-             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &table),
-             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &scratch));
-    lir::Memory proc(scratch.low, index * TargetBytesPerWord);
-    a->apply(lir::Move,
-             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &proc),
-             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &scratch));
-    a->apply
-      (call ? lir::Call : lir::Jump,
-       OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &scratch));
-  } else {
-    lir::Constant proc
-      (new(&c->zone) avian::codegen::ResolvedPromise(reinterpret_cast<intptr_t>(t->thunkTable[index])));
+  object member = (r->ok and name and spec)
+    ? find(t, class_, name, spec) : 0;
 
-    a->apply
-      (call ? lir::LongCall : lir::LongJump,
-       OperandInfo(TargetBytesPerWord, lir::ConstantOperand, &proc));
+  if (member == 0) {
+    r->ok = false;
   }
+  return member;
 }
 
-void
-compileThunks(MyThread* t, FixedAllocator* allocator)
+// Finds the object described by a symbol written by writeCacheSymbol,
+// clearing r->ok if it can't be found.
+object
+readCacheSymbol(MyThread* t, CacheReader* r, object loader)
 {
-  MyProcessor* p = processor(t);
+  PROTECT(t, loader);
 
-  { Context context(t);
-    avian::codegen::Assembler* a = context.assembler;
-    
-    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
-
-    p->thunks.default_.frameSavedOffset = a->length();
-
-    lir::Register thread(t->arch->thread());
-    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
-  
-    compileCall(t, &context, compileMethodIndex);
+  switch (r->read1()) {
+  case NullSymbol:
+    return 0;
 
-    a->popFrame(t->arch->alignFrameSize(1));
+  case ClassSymbol:
+    return readCacheClass(t, r, loader);
 
-    lir::Register result(t->arch->returnLow());
-    a->apply(lir::Jump,
-             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &result));
+  case StringSymbol: {
+    unsigned length = r->readCount(2);
+    const uint8_t* chars = r->read(length * 2);
+    if (not r->ok) {
+      return 0;
+    }
 
-    p->thunks.default_.length = a->endBlock(false)->resolve(0, 0);
+    object array = makeCharArray(t, length);
+    memcpy(&charArrayBody(t, array, 0), chars, length * 2);
 
-    p->thunks.default_.start = finish
-      (t, allocator, a, "default", p->thunks.default_.length);
+    return intern(t, t->m->classpath->makeString(t, array, 0, length));
   }
 
-  { Context context(t);
-    avian::codegen::Assembler* a = context.assembler;
-    
-    lir::Register class_(t->arch->virtualCallTarget());
-    lir::Memory virtualCallTargetSrc
-      (t->arch->stack(),
-       (t->arch->frameFooterSize() + t->arch->frameReturnAddressSize())
-       * TargetBytesPerWord);
-
-    a->apply(lir::Move,
-             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &virtualCallTargetSrc),
-             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &class_));
-
-    lir::Memory virtualCallTargetDst
-      (t->arch->thread(), TARGET_THREAD_VIRTUALCALLTARGET);
-
-    a->apply(lir::Move,
-             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &class_),
-             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &virtualCallTargetDst));
-
-    lir::Register index(t->arch->virtualCallIndex());
-    lir::Memory virtualCallIndex
-      (t->arch->thread(), TARGET_THREAD_VIRTUALCALLINDEX);
+  case MethodSymbol:
+    return readCacheMember(t, r, loader, findMethodInClass);
 
-    a->apply(lir::Move,
-             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &index),
-             OperandInfo(TargetBytesPerWord, lir::MemoryOperand, &virtualCallIndex));
-    
-    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
+  case FieldSymbol:
+    return readCacheMember(t, r, loader, findFieldInClass);
 
-    p->thunks.defaultVirtual.frameSavedOffset = a->length();
+  case ReferenceSymbol: {
+    object method = readCacheMember(t, r, loader, findMethodInClass);
+    PROTECT(t, method);
 
-    lir::Register thread(t->arch->thread());
-    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
+    object class_ = r->readByteArray(t);
+    PROTECT(t, class_);
 
-    compileCall(t, &context, compileVirtualMethodIndex);
-  
-    a->popFrame(t->arch->alignFrameSize(1));
+    object name = r->readByteArray(t);
+    PROTECT(t, name);
 
-    lir::Register result(t->arch->returnLow());
-    a->apply(lir::Jump,
-             OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &result));
+    object spec = r->readByteArray(t);
+    if (not r->ok) {
+      return 0;
+    }
 
-    p->thunks.defaultVirtual.length = a->endBlock(false)->resolve(0, 0);
+    object reference = makeReference(t, class_, name, spec);
 
-    p->thunks.defaultVirtual.start = finish
-      (t, allocator, a, "defaultVirtual", p->thunks.defaultVirtual.length);
+    return makePair(t, method, reference);
   }
 
-  { Context context(t);
-    avian::codegen::Assembler* a = context.assembler;
-
-    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
+  case StaticTableSymbol: {
+    object class_ = readCacheClass(t, r, loader);
+    object table = class_ ? classStaticTable(t, class_) : 0;
+    if (table == 0) {
+      r->ok = false;
+    }
+    return table;
+  }
 
-    p->thunks.native.frameSavedOffset = a->length();
+  default:
+    r->ok = false;
+    return 0;
+  }
+}
 
-    lir::Register thread(t->arch->thread());
-    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
+bool
+dropCachedCode(MyThread* t, CodeCacheFile::Entry* e)
+{
+  ACQUIRE(t, t->m->classLock);
 
-    compileCall(t, &context, invokeNativeIndex);
-  
-    a->popFrameAndUpdateStackAndReturn
-      (t->arch->alignFrameSize(1), TARGET_THREAD_NEWSTACK);
+  e->dropped = true;
 
-    p->thunks.native.length = a->endBlock(false)->resolve(0, 0);
+  return false;
+}
 
-    p->thunks.native.start = finish
-      (t, allocator, a, "native", p->thunks.native.length);
+void
+publishCode(MyThread* t, Zone* zone, object method, object clone)
+{
+  if (DebugMethodTree) {
+    fprintf(stderr, "insert method at %p\n",
+            reinterpret_cast<void*>(methodCompiled(t, clone)));
   }
 
-  { Context context(t);
-    avian::codegen::Assembler* a = context.assembler;
+  // We can't update the MethodCode field on the original method
+  // before it is placed into the method tree, since another thread
+  // might call the method, from which stack unwinding would fail
+  // (since there is not yet an entry in the method tree).  However,
+  // we can't insert the original method into the tree before updating
+  // the MethodCode field on it since we rely on that field to
+  // determine its position in the tree.  Therefore, we insert the
+  // clone in its place.  Later, we'll replace the clone with the
+  // original to save memory.
+
+  setRoot
+    (t, MethodTree, treeInsert
+     (t, zone, root(t, MethodTree),
+      methodCompiled(t, clone), clone, root(t, MethodTreeSentinal),
+      compareIpToMethodBounds));
 
-    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
+  storeStoreMemoryBarrier();
 
-    p->thunks.aioob.frameSavedOffset = a->length();
+  set(t, method, MethodCode, methodCode(t, clone));
 
-    lir::Register thread(t->arch->thread());
-    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
+  if (methodVirtual(t, method)) {
+    classVtable(t, methodClass(t, method), methodOffset(t, method))
+      = reinterpret_cast<void*>(methodCompiled(t, clone));
+  }
+}
 
-    compileCall(t, &context, throwArrayIndexOutOfBoundsIndex);
+// Puts the code described by the specified code cache entry back in
+// place for the specified method.  Returns true if the method has
+// been compiled by the time we return, either by us or by another
+// thread.  If anything the record refers to can't be found or has
+// changed since it was written, the entry is dropped and false is
+// returned, in which case the method must be compiled normally.
+bool
+linkCachedCode(MyThread* t, object method, CodeCacheFile::Entry* e)
+{
+  CodeCacheFile* file = codeCacheFile(t);
+  CacheReader r(e->body, e->size);
+
+  uint8_t* start = file->base + r.read4();
+  r.read4(); // executable size
+  r.skipString();
+  r.skipString();
+  r.skipString();
+
+  unsigned codeSize = r.read4();
+  unsigned total = r.read4();
+  unsigned poolFootprint = r.read4();
+  unsigned maxStack = r.read2();
+  unsigned maxLocals = r.read2();
+  const uint8_t* body = r.read(total);
+
+  object loader = classLoader(t, methodClass(t, method));
+  PROTECT(t, loader);
+
+  unsigned poolCount = r.readCount(1);
+  if (not r.ok
+      or poolFootprint != (poolCount ? objectPoolFootprint(t, poolCount) : 0))
+  {
+    return dropCachedCode(t, e);
+  }
 
-    p->thunks.aioob.length = a->endBlock(false)->resolve(0, 0);
+  object values = makeArray(t, poolCount);
+  PROTECT(t, values);
 
-    p->thunks.aioob.start = finish
-      (t, allocator, a, "aioob", p->thunks.aioob.length);
+  for (unsigned i = 0; i < poolCount; ++i) {
+    object o = readCacheSymbol(t, &r, loader);
+    if (not r.ok) {
+      return dropCachedCode(t, e);
+    }
+    set(t, values, ArrayBody + (i * BytesPerWord), o);
   }
 
-  { Context context(t);
-    avian::codegen::Assembler* a = context.assembler;
-      
-    a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
+  object ehTable = 0;
+  PROTECT(t, ehTable);
 
-    p->thunks.stackOverflow.frameSavedOffset = a->length();
+  unsigned handlerCount = r.read4();
+  if (handlerCount != NullCacheString) {
+    if (handlerCount > r.remaining() / 13) {
+      return dropCachedCode(t, e);
+    }
 
-    lir::Register thread(t->arch->thread());
-    a->pushFrame(1, TargetBytesPerWord, lir::RegisterOperand, &thread);
+    object index = makeIntArray(t, handlerCount * 3);
+    PROTECT(t, index);
 
-    compileCall(t, &context, throwStackOverflowIndex);
+    ehTable = makeArray(t, handlerCount + 1);
+    set(t, ehTable, ArrayBody, index);
 
-    p->thunks.stackOverflow.length = a->endBlock(false)->resolve(0, 0);
+    for (unsigned i = 0; i < handlerCount; ++i) {
+      intArrayBody(t, index, i * 3) = r.read4();
+      intArrayBody(t, index, (i * 3) + 1) = r.read4();
+      intArrayBody(t, index, (i * 3) + 2) = r.read4();
 
-    p->thunks.stackOverflow.start = finish
-      (t, allocator, a, "stackOverflow", p->thunks.stackOverflow.length);
+      object type = readCacheSymbol(t, &r, loader);
+      if (not r.ok) {
+        return dropCachedCode(t, e);
+      }
+      set(t, ehTable, ArrayBody + ((i + 1) * BytesPerWord), type);
+    }
   }
 
-  { { Context context(t);
-      avian::codegen::Assembler* a = context.assembler;
-
-      a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);
+  object lineTable = 0;
+  PROTECT(t, lineTable);
 
-      p->thunks.table.frameSavedOffset = a->length();
+  unsigned lineCount = r.read4();
+  if (lineCount != NullCacheString) {
+    const uint8_t* lines = lineCount <= r.remaining() / 8
+      ? r.read(lineCount * 8) : 0;
+    if (lines == 0) {
+      return dropCachedCode(t, e);
+    }
 
-      compileCall(t, &context, dummyIndex, false);
+    lineTable = makeLineNumberTable(t, lineCount);
+    memcpy(&lineNumberTableBody(t, lineTable, 0), lines, lineCount * 8);
+  }
 
-      p->thunks.table.length = a->endBlock(false)->resolve(0, 0);
+  object map = 0;
+  PROTECT(t, map);
 
-      p->thunks.table.start = static_cast<uint8_t*>
-        (allocator->allocate
-         (p->thunks.table.length * ThunkCount, TargetBytesPerWord));
+  unsigned mapKind = r.read1();
+  if (mapKind) {
+    unsigned elementSize = mapKind == 1 ? 4 : 1;
+    unsigned length = r.readCount(elementSize);
+    const uint8_t* elements = r.read(length * elementSize);
+    if (elements == 0 or mapKind > 2) {
+      return dropCachedCode(t, e);
     }
 
-    uint8_t* start = p->thunks.table.start;
-
-#define THUNK(s) {                                                      \
-      Context context(t);                                               \
-      avian::codegen::Assembler* a = context.assembler;                                 \
-                                                                        \
-      a->saveFrame(TARGET_THREAD_STACK, TARGET_THREAD_IP);              \
-                                                                        \
-      p->thunks.table.frameSavedOffset = a->length();                   \
-                                                                        \
-      compileCall(t, &context, s##Index, false);                        \
-                                                                        \
-      expect(t, a->endBlock(false)->resolve(0, 0)                       \
-             <= p->thunks.table.length);                                \
-                                                                        \
-      a->setDestination(start);                                         \
-      a->write();                                                       \
-                                                                        \
-      logCompile(t, start, p->thunks.table.length, 0, #s, 0);           \
-                                                                        \
-      start += p->thunks.table.length;                                  \
+    if (mapKind == 1) {
+      map = makeIntArray(t, length);
+      memcpy(&intArrayBody(t, map, 0), elements, length * 4);
+    } else {
+      map = makeByteArray(t, length);
+      memcpy(&byteArrayBody(t, map, 0), elements, length);
     }
-#include "thunks.cpp"
-#undef THUNK
   }
 
-  BootImage* image = p->bootImage;
+  unsigned callCount = r.readCount(9);
 
-  if (image) {
-    uint8_t* imageBase = p->codeAllocator.base;
+  object calls = makeArray(t, callCount);
+  PROTECT(t, calls);
 
-    image->thunks.default_ = thunkToThunk(p->thunks.default_, imageBase);
-    image->thunks.defaultVirtual = thunkToThunk
-      (p->thunks.defaultVirtual, imageBase);
-    image->thunks.native = thunkToThunk(p->thunks.native, imageBase);
-    image->thunks.aioob = thunkToThunk(p->thunks.aioob, imageBase);
-    image->thunks.stackOverflow = thunkToThunk
-      (p->thunks.stackOverflow, imageBase);
-    image->thunks.table = thunkToThunk(p->thunks.table, imageBase);
+  object callSites = makeIntArray(t, callCount * 2);
+  PROTECT(t, callSites);
+
+  for (unsigned i = 0; i < callCount; ++i) {
+    intArrayBody(t, callSites, i * 2) = r.read4();
+    intArrayBody(t, callSites, (i * 2) + 1) = r.read4();
+
+    object target = readCacheSymbol(t, &r, loader);
+    if (not r.ok or target == 0
+        or objectClass(t, target) != type(t, Machine::MethodType))
+    {
+      return dropCachedCode(t, e);
+    }
+    set(t, calls, ArrayBody + (i * BytesPerWord), target);
   }
-}
 
-MyProcessor*
-processor(MyThread* t)
-{
-  return static_cast<MyProcessor*>(t->m->processor);
-}
+  unsigned dependencyCount = r.readCount(9);
+  for (unsigned i = 0; i < dependencyCount; ++i) {
+    object c = readCacheClass(t, &r, loader);
+    uint32_t hash = r.read4();
+    bool initialized = r.read1();
 
-uintptr_t
-defaultThunk(MyThread* t)
-{
-  return reinterpret_cast<uintptr_t>(processor(t)->thunks.default_.start);
-}
+    if (not r.ok
+        or classHash(t, c) != hash
+        or (initialized and classNeedsInit(t, c)))
+    {
+      return dropCachedCode(t, e);
+    }
+  }
 
-uintptr_t
-bootDefaultThunk(MyThread* t)
-{
-  return reinterpret_cast<uintptr_t>(processor(t)->bootThunks.default_.start);
-}
+  if (not r.ok or r.remaining()) {
+    return dropCachedCode(t, e);
+  }
 
-uintptr_t
-defaultVirtualThunk(MyThread* t)
-{
-  return reinterpret_cast<uintptr_t>
-    (processor(t)->thunks.defaultVirtual.start);
-}
+  ACQUIRE(t, t->m->classLock);
 
-uintptr_t
-nativeThunk(MyThread* t)
-{
-  return reinterpret_cast<uintptr_t>(processor(t)->thunks.native.start);
-}
+  if (methodAddress(t, method) != defaultThunk(t)) {
+    return true;
+  }
 
-uintptr_t
-bootNativeThunk(MyThread* t)
-{
-  return reinterpret_cast<uintptr_t>(processor(t)->bootThunks.native.start);
-}
+  if (e->linked or e->dropped) {
+    // another class loader's version of this method got here first
+    return false;
+  }
 
-uintptr_t
-aioobThunk(MyThread* t)
-{
-  return reinterpret_cast<uintptr_t>(processor(t)->thunks.aioob.start);
-}
+  e->linked = true;
 
-uintptr_t
-stackOverflowThunk(MyThread* t)
-{
-  return reinterpret_cast<uintptr_t>(processor(t)->thunks.stackOverflow.start);
-}
+  memcpy(start, body, total);
 
-bool
-unresolved(MyThread* t, uintptr_t methodAddress)
-{
-  return methodAddress == defaultThunk(t)
-    or methodAddress == bootDefaultThunk(t);
-}
+  if (poolCount) {
+    object pool = makeObjectPool(t, start + total, poolFootprint, poolCount);
 
-uintptr_t
-compileVirtualThunk(MyThread* t, unsigned index, unsigned* size)
-{
-  Context context(t);
-  avian::codegen::Assembler* a = context.assembler;
+    for (unsigned i = 0; i < poolCount; ++i) {
+      set(t, pool, ArrayBody + ((i + 1) * BytesPerWord),
+          arrayBody(t, values, i));
+    }
+  }
 
-  avian::codegen::ResolvedPromise indexPromise(index);
-  lir::Constant indexConstant(&indexPromise);
-  lir::Register indexRegister(t->arch->virtualCallIndex());
-  a->apply(lir::Move,
-           OperandInfo(TargetBytesPerWord, lir::ConstantOperand, &indexConstant),
-           OperandInfo(TargetBytesPerWord, lir::RegisterOperand, &indexRegister));
-  
-  avian::codegen::ResolvedPromise defaultVirtualThunkPromise(defaultVirtualThunk(t));
-  lir::Constant thunk(&defaultVirtualThunkPromise);
-  a->apply(lir::Jump,
-           OperandInfo(TargetBytesPerWord, lir::ConstantOperand, &thunk));
+  object code = makeCode
+    (t, 0, ehTable, lineTable, reinterpret_cast<uintptr_t>(start), codeSize,
+     maxStack, maxLocals, 0);
+  PROTECT(t, code);
 
-  *size = a->endBlock(false)->resolve(0, 0);
+  set(t, code, CodePool, map);
 
-  uint8_t* start = static_cast<uint8_t*>
-    (codeAllocator(t)->allocate(*size, TargetBytesPerWord));
+  for (unsigned i = 0; i < callCount; ++i) {
+    insertCallNode
+      (t, makeCallNode
+       (t, reinterpret_cast<intptr_t>(file->base)
+        + static_cast<uint32_t>(intArrayBody(t, callSites, i * 2)),
+        arrayBody(t, calls, i), intArrayBody(t, callSites, (i * 2) + 1), 0));
+  }
 
-  a->setDestination(start);
-  a->write();
+#if !defined(AVIAN_AOT_ONLY)
+  syncInstructionCache(start, codeSize);
+#endif
 
-  const char* const virtualThunkBaseName = "virtualThunk";
-  const size_t virtualThunkBaseNameLength = strlen(virtualThunkBaseName);
-  const size_t maxIntStringLength = 10;
+  logCompile
+    (t, start, codeSize,
+     reinterpret_cast<const char*>
+     (&byteArrayBody(t, className(t, methodClass(t, method)), 0)),
+     reinterpret_cast<const char*>
+     (&byteArrayBody(t, methodName(t, method), 0)),
+     reinterpret_cast<const char*>
+     (&byteArrayBody(t, methodSpec(t, method), 0)));
 
-  THREAD_RUNTIME_ARRAY(t, char, virtualThunkName, virtualThunkBaseNameLength + maxIntStringLength);
+  object clone = methodClone(t, method);
+  PROTECT(t, clone);
 
-  sprintf(RUNTIME_ARRAY_BODY(virtualThunkName), "%s%d", virtualThunkBaseName, index);
+  set(t, clone, MethodCode, code);
 
-  logCompile(t, start, *size, 0, RUNTIME_ARRAY_BODY(virtualThunkName), 0);
+  Zone zone(t->m->system, t->m->heap, 64);
+  publishCode(t, &zone, method, clone);
 
-  return reinterpret_cast<uintptr_t>(start);
+  treeUpdate(t, root(t, MethodTree), methodCompiled(t, clone),
+             method, root(t, MethodTreeSentinal), compareIpToMethodBounds);
+
+  return true;
 }
 
-uintptr_t
-virtualThunk(MyThread* t, unsigned index)
+// Looks for a code cache entry for the specified method and, if
+// there is a usable one, links it as described above.
+bool
+linkCachedCode(MyThread* t, object method)
 {
-  ACQUIRE(t, t->m->classLock);
+  CodeCacheFile* file = codeCacheFile(t);
+  if (file->entryCount == 0) {
+    return false;
+  }
 
-  if (root(t, VirtualThunks) == 0
-      or wordArrayLength(t, root(t, VirtualThunks)) <= index * 2)
+  uint32_t key = cacheKey(t, method);
+  for (unsigned i = file->find(key);
+       i < file->entryCount and file->entries[i].key == key; ++i)
   {
-    object newArray = makeWordArray(t, nextPowerOfTwo((index + 1) * 2));
-    if (root(t, VirtualThunks)) {
-      memcpy(&wordArrayBody(t, newArray, 0),
-             &wordArrayBody(t, root(t, VirtualThunks), 0),
-             wordArrayLength(t, root(t, VirtualThunks)) * BytesPerWord);
+    CodeCacheFile::Entry* e = file->entries + i;
+    if (not (e->linked or e->dropped) and cacheEntryMatches(t, e, method)) {
+      return linkCachedCode(t, method, e);
     }
-    setRoot(t, VirtualThunks, newArray);
-  }
-
-  if (wordArrayBody(t, root(t, VirtualThunks), index * 2) == 0) {
-    unsigned size;
-    uintptr_t thunk = compileVirtualThunk(t, index, &size);
-    wordArrayBody(t, root(t, VirtualThunks), index * 2) = thunk;
-    wordArrayBody(t, root(t, VirtualThunks), (index * 2) + 1) = size;
   }
 
-  return wordArrayBody(t, root(t, VirtualThunks), index * 2);
+  return false;
 }
 
 void
-compile(MyThread* t, FixedAllocator* allocator, BootContext* bootContext,
+compile(MyThread* t, CodeAllocator* allocator, BootContext* bootContext,
         object method)
 {
   PROTECT(t, method);
@@ -10466,6 +17236,12 @@ compile(MyThread* t, FixedAllocator* allocator, BootContext* bootContext,
 
   assert(t, (methodFlags(t, method) & ACC_NATIVE) == 0);
 
+  loadMethodCode(t, method);
+
+  if (bootContext == 0 and linkCachedCode(t, method)) {
+    return;
+  }
+
   // We must avoid acquiring any locks until after the first pass of
   // compilation, since this pass may trigger classloading operations
   // involving application classloaders and thus the potential for
@@ -10483,6 +17259,10 @@ compile(MyThread* t, FixedAllocator* allocator, BootContext* bootContext,
 
   PROTECT(t, clone);
 
+  if (bootContext == 0 and allocator->needsSweep()) {
+    sweepCode(t, allocator);
+  }
+
   Context context(t, bootContext, clone);
   compile(t, &context);
 
@@ -10509,37 +17289,13 @@ compile(MyThread* t, FixedAllocator* allocator, BootContext* bootContext,
     return;
   }
 
-  finish(t, allocator, &context);
- 
-  if (DebugMethodTree) {
-    fprintf(stderr, "insert method at %p\n",
-            reinterpret_cast<void*>(methodCompiled(t, clone)));
-  }
-
-  // We can't update the MethodCode field on the original method
-  // before it is placed into the method tree, since another thread
-  // might call the method, from which stack unwinding would fail
-  // (since there is not yet an entry in the method tree).  However,
-  // we can't insert the original method into the tree before updating
-  // the MethodCode field on it since we rely on that field to
-  // determine its position in the tree.  Therefore, we insert the
-  // clone in its place.  Later, we'll replace the clone with the
-  // original to save memory.
-
-  setRoot
-    (t, MethodTree, treeInsert
-     (t, &(context.zone), root(t, MethodTree),
-      methodCompiled(t, clone), clone, root(t, MethodTreeSentinal),
-      compareIpToMethodBounds));
-
-  storeStoreMemoryBarrier();
+  object code = methodCode(t, method);
+  PROTECT(t, code);
 
-  set(t, method, MethodCode, methodCode(t, clone));
+  object pool = finish(t, allocator, &context);
+  PROTECT(t, pool);
 
-  if (methodVirtual(t, method)) {
-    classVtable(t, methodClass(t, method), methodOffset(t, method))
-      = reinterpret_cast<void*>(methodCompiled(t, clone));
-  }
+  publishCode(t, &(context.zone), method, clone);
 
   // we've compiled the method and inserted it into the tree without
   // error, so we ensure that the executable area not be deallocated
@@ -10548,6 +17304,17 @@ compile(MyThread* t, FixedAllocator* allocator, BootContext* bootContext,
 
   treeUpdate(t, root(t, MethodTree), methodCompiled(t, clone),
              method, root(t, MethodTreeSentinal), compareIpToMethodBounds);
+
+  if ((allocator->sweep or processor(t)->mayCheckpoint())
+      and bootContext == 0)
+  {
+    // keep what we need to undo all this if the sweeper evicts the
+    // method later, or if it is saved to a checkpoint:
+    object entry = makeCodeCacheEntry
+      (t, code, pool, 0, context.executableSize, false);
+
+    hashMapInsert(t, root(t, CodeCache), method, entry, objectHash);
+  }
 }
 
 object&
@@ -10563,12 +17330,18 @@ setRoot(Thread* t, Root root, object value)
       ArrayBody + (root * BytesPerWord), value);
 }
 
-FixedAllocator*
+CodeAllocator*
 codeAllocator(MyThread* t)
 {
   return &(processor(t)->codeAllocator);
 }
 
+CodeCacheFile*
+codeCacheFile(MyThread* t)
+{
+  return &(processor(t)->codeCacheFile);
+}
+
 } // namespace local
 
 } // namespace
@@ -15,6 +15,8 @@
 #include "avian/zlib-custom.h"
 #include "avian/finder.h"
 #include "avian/lzma.h"
+#include "avian/lz.h"
+#include "avian/alloc-vector.h"
 
 
 using namespace vm;
@@ -25,16 +27,31 @@ namespace {
 const bool DebugFind = false;
 const bool DebugStat = false;
 
+const uint32_t ClasspathIndexMagic = 0x41564349; // "AVCI"
+
+const unsigned MissCacheCapacity = 1024;
+const unsigned MissCacheLimit = 16 * 1024;
+
+const unsigned InflateCacheCapacity = 256;
+
 class Element {
  public:
+  enum Type {
+    DirectoryType,
+    JarType,
+    BuiltinType,
+    MissingType
+  };
+
   class Iterator {
    public:
     virtual const char* next(unsigned* size) = 0;
     virtual void dispose() = 0;
   };
 
-  Element(): next(0) { }
+  Element(): next(0), position(0) { }
 
+  virtual Type type() = 0;
   virtual Iterator* iterator() = 0;
   virtual System::Region* find(const char* name) = 0;
   virtual System::FileType stat(const char* name, unsigned* length,
@@ -44,6 +61,7 @@ class Element {
   virtual void dispose() = 0;
 
   Element* next;
+  unsigned position;
 };
 
 class DirectoryElement: public Element {
@@ -117,6 +135,10 @@ class DirectoryElement: public Element {
     sourceUrl_(append(allocator, "file:", this->name))
   { }
 
+  virtual Type type() {
+    return DirectoryType;
+  }
+
   virtual Element::Iterator* iterator() {
     return new (allocator->allocate(sizeof(Iterator)))
       Iterator(s, allocator, name, strlen(name) + 1);
@@ -175,6 +197,64 @@ class DirectoryElement: public Element {
   const char* sourceUrl_;
 };
 
+// Stands in for a path entry which did not exist when the path was
+// parsed, so that a saved classpath index can tell if it has appeared
+// since.
+class MissingElement: public Element {
+ public:
+  class Iterator: public Element::Iterator {
+   public:
+    Iterator(Allocator* allocator): allocator(allocator) { }
+
+    virtual const char* next(unsigned*) {
+      return 0;
+    }
+
+    virtual void dispose() {
+      allocator->free(this, sizeof(*this));
+    }
+
+    Allocator* allocator;
+  };
+
+  MissingElement(Allocator* allocator, const char* name):
+    allocator(allocator), name(name)
+  { }
+
+  virtual Type type() {
+    return MissingType;
+  }
+
+  virtual Element::Iterator* iterator() {
+    return new (allocator->allocate(sizeof(Iterator))) Iterator(allocator);
+  }
+
+  virtual System::Region* find(const char*) {
+    return 0;
+  }
+
+  virtual System::FileType stat(const char*, unsigned* length, bool) {
+    *length = 0;
+    return System::TypeDoesNotExist;
+  }
+
+  virtual const char* urlPrefix() {
+    return 0;
+  }
+
+  virtual const char* sourceUrl() {
+    return 0;
+  }
+
+  virtual void dispose() {
+    allocator->free(name, strlen(name) + 1);
+    allocator->free(this, sizeof(*this));
+  }
+
+  Allocator* allocator;
+  const char* name;
+};
+
 class PointerRegion: public System::Region {
  public:
   PointerRegion(System* s, Allocator* allocator, const uint8_t* start,
@@ -326,45 +406,54 @@ class JarIndex {
     return 0;
   }
 
-  System::Region* find(const char* name, const uint8_t* start) {
-    Node* n = findNode(name);
-    if (n) {
-      const uint8_t* p = n->entry;
-      switch (compressionMethod(p)) {
-      case Stored: {
-        return new (allocator->allocate(sizeof(PointerRegion)))
-          PointerRegion(s, allocator, fileData(start + localHeaderOffset(p)),
-			compressedSize(p));
-      } break;
-
-      case Deflated: {
-        DataRegion* region = new
-          (allocator->allocate(sizeof(DataRegion) + uncompressedSize(p)))
-          DataRegion(s, allocator, uncompressedSize(p));
-          
-        z_stream zStream; memset(&zStream, 0, sizeof(z_stream));
+  // Inflates the deflated entry with the specified central directory
+  // header into the specified buffer, which must be big enough to hold
+  // its uncompressed size.
+  static void inflateEntry(System* s, const uint8_t* p,
+                           const uint8_t* start, uint8_t* out)
+  {
+    z_stream zStream; memset(&zStream, 0, sizeof(z_stream));
 
-        zStream.next_in = const_cast<uint8_t*>(fileData(start +
-							localHeaderOffset(p)));
-        zStream.avail_in = compressedSize(p);
-        zStream.next_out = region->data;
-        zStream.avail_out = region->length();
+    zStream.next_in = const_cast<uint8_t*>
+      (fileData(start + localHeaderOffset(p)));
+    zStream.avail_in = compressedSize(p);
+    zStream.next_out = out;
+    zStream.avail_out = uncompressedSize(p);
 
-        // -15 means max window size and raw deflate (no zlib wrapper)
-        int r = inflateInit2(&zStream, -15);
-        expect(s, r == Z_OK);
+    // -15 means max window size and raw deflate (no zlib wrapper)
+    int r = inflateInit2(&zStream, -15);
+    expect(s, r == Z_OK);
 
-        r = inflate(&zStream, Z_FINISH);
-        expect(s, r == Z_STREAM_END);
+    r = inflate(&zStream, Z_FINISH);
+    expect(s, r == Z_STREAM_END);
 
-        inflateEnd(&zStream);
+    inflateEnd(&zStream);
+  }
 
-        return region;
-      } break;
+  // Returns the contents of the entry with the specified central
+  // directory header in the jar which starts at the specified address.
+  static System::Region* read(System* s, Allocator* allocator,
+                              const uint8_t* p, const uint8_t* start)
+  {
+    switch (compressionMethod(p)) {
+    case Stored: {
+      return new (allocator->allocate(sizeof(PointerRegion)))
+        PointerRegion(s, allocator, fileData(start + localHeaderOffset(p)),
+                      compressedSize(p));
+    } break;
 
-      default:
-        abort(s);
-      }
+    case Deflated: {
+      DataRegion* region = new
+        (allocator->allocate(sizeof(DataRegion) + uncompressedSize(p)))
+        DataRegion(s, allocator, uncompressedSize(p));
+
+      inflateEntry(s, p, start, region->data);
+
+      return region;
+    } break;
+
+    default:
+      abort(s);
     }
 
     return 0;
@@ -412,6 +501,246 @@ class JarIndex {
   Node* table[0];
 };
 
+// Keeps recently used inflated entries around, up to a fixed number of
+// bytes, evicting the least recently used ones first.  Entries are
+// reference counted so that an evicted entry remains valid until the
+// last region referring to it is disposed, and such a region also
+// keeps the cache itself alive.
+class MyInflateCache: public InflateCache {
+ public:
+  class Entry {
+   public:
+    const void* owner;
+    const uint8_t* header;
+    unsigned length;
+    unsigned referenceCount;
+    bool cached;
+    Entry* previous;
+    Entry* next;
+    Entry* chain;
+    uint8_t data[0];
+  };
+
+  class Region: public System::Region {
+   public:
+    Region(MyInflateCache* cache, Entry* entry):
+      cache(cache), entry(entry)
+    { }
+
+    virtual const uint8_t* start() {
+      return entry->data;
+    }
+
+    virtual size_t length() {
+      return entry->length;
+    }
+
+    virtual void dispose() {
+      MyInflateCache* cache = this->cache;
+      Entry* entry = this->entry;
+      cache->allocator->free(this, sizeof(*this));
+      cache->release(entry);
+    }
+
+    MyInflateCache* cache;
+    Entry* entry;
+  };
+
+  MyInflateCache(System* s, Allocator* allocator, unsigned budget):
+    s(s),
+    allocator(allocator),
+    lock(0),
+    budget(budget),
+    size(0),
+    referenceCount(1),
+    hits_(0),
+    misses_(0),
+    first(0),
+    last(0)
+  {
+    expect(s, s->success(s->make(&lock)));
+    memset(table, 0, sizeof(Entry*) * InflateCacheCapacity);
+  }
+
+  static unsigned index(const uint8_t* header) {
+    return (reinterpret_cast<uintptr_t>(header) >> 3)
+      & (InflateCacheCapacity - 1);
+  }
+
+  void link(Entry* e) {
+    e->previous = 0;
+    e->next = first;
+    if (first) {
+      first->previous = e;
+    } else {
+      last = e;
+    }
+    first = e;
+  }
+
+  void unlink(Entry* e) {
+    if (e->previous) {
+      e->previous->next = e->next;
+    } else {
+      first = e->next;
+    }
+    if (e->next) {
+      e->next->previous = e->previous;
+    } else {
+      last = e->previous;
+    }
+  }
+
+  void free(Entry* e) {
+    allocator->free(e, sizeof(Entry) + e->length);
+  }
+
+  void evict(Entry* e) {
+    unlink(e);
+
+    Entry** p = table + index(e->header);
+    while (*p != e) p = &((*p)->chain);
+    *p = e->chain;
+
+    size -= e->length;
+    e->cached = false;
+    if (e->referenceCount == 0) {
+      free(e);
+    }
+  }
+
+  Entry* lookup(const void* owner, const uint8_t* header) {
+    for (Entry* e = table[index(header)]; e; e = e->chain) {
+      if (e->owner == owner and e->header == header) {
+        return e;
+      }
+    }
+    return 0;
+  }
+
+  System::Region* find(const void* owner, const uint8_t* header,
+                       const uint8_t* start)
+  {
+    unsigned length = uncompressedSize(header);
+    if (length > budget / 4) {
+      return 0;
+    }
+
+    lock->acquire();
+    Entry* e = lookup(owner, header);
+    if (e) {
+      ++ hits_;
+      ++ e->referenceCount;
+      ++ referenceCount;
+      unlink(e);
+      link(e);
+    } else {
+      ++ misses_;
+    }
+    lock->release();
+
+    if (e == 0) {
+      // inflate without holding the lock, and check afterwards whether
+      // another thread got there first:
+      Entry* n = static_cast<Entry*>
+        (allocator->allocate(sizeof(Entry) + length));
+      JarIndex::inflateEntry(s, header, start, n->data);
+
+      lock->acquire();
+      e = lookup(owner, header);
+      if (e) {
+        ++ e->referenceCount;
+        free(n);
+      } else {
+        while (size + length > budget) {
+          evict(last);
+        }
+
+        e = n;
+        e->owner = owner;
+        e->header = header;
+        e->length = length;
+        e->referenceCount = 1;
+        e->cached = true;
+        e->chain = table[index(header)];
+        table[index(header)] = e;
+        link(e);
+        size += length;
+      }
+      ++ referenceCount;
+      lock->release();
+    }
+
+    return new (allocator->allocate(sizeof(Region))) Region(this, e);
+  }
+
+  void release(Entry* e) {
+    lock->acquire();
+    if (-- e->referenceCount == 0 and not e->cached) {
+      free(e);
+    }
+    lock->release();
+
+    // each region holds a reference to the cache as well as the entry
+    release();
+  }
+
+  // Evicts all entries belonging to the specified owner, which is
+  // about to go away.
+  void drop(const void* owner) {
+    lock->acquire();
+    for (Entry* e = first; e;) {
+      Entry* next = e->next;
+      if (e->owner == owner) {
+        evict(e);
+      }
+      e = next;
+    }
+    lock->release();
+  }
+
+  virtual void acquire() {
+    lock->acquire();
+    ++ referenceCount;
+    lock->release();
+  }
+
+  virtual void release() {
+    lock->acquire();
+    bool dead = -- referenceCount == 0;
+    lock->release();
+
+    if (dead) {
+      while (last) {
+        evict(last);
+      }
+      lock->dispose();
+      allocator->free(this, sizeof(*this)
+                      + (sizeof(Entry*) * InflateCacheCapacity));
+    }
+  }
+
+  virtual unsigned hits() {
+    return hits_;
+  }
+
+  virtual unsigned misses() {
+    return misses_;
+  }
+
+  System* s;
+  Allocator* allocator;
+  System::Mutex* lock;
+  unsigned budget;
+  unsigned size;
+  unsigned referenceCount;
+  unsigned hits_;
+  unsigned misses_;
+  Entry* first;
+  Entry* last;
+  Entry* table[0];
+};
+
 class JarElement: public Element {
  public:
   class Iterator: public Element::Iterator {
@@ -451,7 +780,7 @@ class JarElement: public Element {
                ? append(allocator, "jar:file:", this->name, "!/") : 0),
     sourceUrl_(this->name
                ? append(allocator, "file:", this->name) : 0),
-    region(0), index(0)
+    region(0), index(0), cache(0)
   { }
 
   JarElement(System* s, Allocator* allocator, const uint8_t* jarData,
@@ -464,9 +793,14 @@ class JarElement: public Element {
     sourceUrl_(name ? append(allocator, "file:", name) : 0),
     region(new (allocator->allocate(sizeof(PointerRegion)))
            PointerRegion(s, allocator, jarData, jarLength)),
-    index(JarIndex::open(s, allocator, region))
+    index(JarIndex::open(s, allocator, region)),
+    cache(0)
   { }
 
+  virtual Type type() {
+    return JarType;
+  }
+
   virtual Element::Iterator* iterator() {
     init();
 
@@ -474,14 +808,30 @@ class JarElement: public Element {
       Iterator(s, allocator, index);
   }
 
-  virtual void init() {
-    if (index == 0) {
+  bool map() {
+    if (region == 0) {
       System::Region* r;
       if (s->success(s->map(&r, name))) {
         region = r;
-        index = JarIndex::open(s, allocator, r);
       }
     }
+    return region != 0;
+  }
+
+  virtual void init() {
+    if (index == 0 and map()) {
+      index = JarIndex::open(s, allocator, region);
+    }
+  }
+
+  // Returns the contents of the entry with the specified central
+  // directory header, from the inflate cache if we have one.
+  virtual System::Region* read(const uint8_t* header) {
+    System::Region* r = 0;
+    if (cache and compressionMethod(header) == JarIndex::Deflated) {
+      r = cache->find(this, header, region->start());
+    }
+    return r ? r : JarIndex::read(s, allocator, header, region->start());
   }
 
   virtual System::Region* find(const char* name) {
@@ -489,7 +839,8 @@ class JarElement: public Element {
 
     while (*name == '/') name++;
 
-    System::Region* r = (index ? index->find(name, region->start()) : 0);
+    JarIndex::Node* n = index ? index->findNode(name) : 0;
+    System::Region* r = n ? read(n->entry) : 0;
     if (DebugFind) {
       if (r) {
         fprintf(stderr, "found %s in %s\n", name, this->name);
@@ -500,6 +851,20 @@ class JarElement: public Element {
     return r;
   }
 
+  // Returns the contents of the entry whose central directory header
+  // is at the specified offset, as recorded by a ClasspathIndex.
+  System::Region* findEntry(uint32_t entry) {
+    if (map()
+        and region->length() >= HeaderSize
+        and entry <= region->length() - HeaderSize
+        and signature(region->start() + entry) == EntrySignature)
+    {
+      return read(region->start() + entry);
+    } else {
+      return 0;
+    }
+  }
+
   virtual System::FileType stat(const char* name, unsigned* length,
                                 bool tryDirectory)
   {
@@ -536,6 +901,9 @@ class JarElement: public Element {
       allocator->free(urlPrefix_, strlen(urlPrefix_) + 1);
       allocator->free(sourceUrl_, strlen(sourceUrl_) + 1);
     }
+    if (cache) {
+      cache->drop(this);
+    }
     if (index) {
       index->dispose();
     }
@@ -553,6 +921,7 @@ class JarElement: public Element {
   const char* sourceUrl_;
   System::Region* region;
   JarIndex* index;
+  MyInflateCache* cache;
 };
 
 class BuiltinElement: public JarElement {
@@ -560,14 +929,20 @@ class BuiltinElement: public JarElement {
   BuiltinElement(System* s, Allocator* allocator, const char* name,
                  const char* libraryName):
     JarElement(s, allocator, name, false),
-    libraryName(libraryName ? copy(allocator, libraryName) : 0)
+    libraryName(libraryName ? copy(allocator, libraryName) : 0),
+    lzmaRegion(0)
   { }
 
+  virtual Type type() {
+    return BuiltinType;
+  }
+
   virtual void init() {
     if (index == 0) {
       if (s->success(s->load(&library, libraryName))) {
         bool lzma = strncmp("lzma:", name, 5) == 0;
-        const char* symbolName = lzma ? name + 5 : name;
+        bool lz = strncmp("lz:", name, 3) == 0;
+        const char* symbolName = lzma ? name + 5 : (lz ? name + 3 : name);
 
         void* p = library->resolve(symbolName);
         if (p) {
@@ -577,21 +952,32 @@ class BuiltinElement: public JarElement {
           unsigned size;
           uint8_t* data = function(&size);
           if (data) {
-            bool freePointer;
             if (lzma) {
 #ifdef AVIAN_USE_LZMA
-              unsigned outSize;
-              data = decodeLZMA(s, allocator, data, size, &outSize);
-              size = outSize;
-              freePointer = true;
+              if (isLZMABlocks(data, size)) {
+                // decode only the blocks holding the central directory
+                // for now, and the rest as entries are read
+                lzmaRegion = makeLZMARegion(s, allocator, data, size);
+                ensureCentralDirectory(lzmaRegion);
+                region = lzmaRegion;
+              } else {
+                unsigned outSize;
+                data = decodeLZMA(s, allocator, data, size, &outSize);
+                region = new (allocator->allocate(sizeof(PointerRegion)))
+                  PointerRegion(s, allocator, data, outSize, true);
+              }
 #else
               abort(s);
 #endif
+            } else if (lz) {
+              unsigned outSize;
+              data = decodeLZ(s, allocator, data, size, &outSize);
+              region = new (allocator->allocate(sizeof(PointerRegion)))
+                PointerRegion(s, allocator, data, outSize, true);
             } else {
-              freePointer = false;
+              region = new (allocator->allocate(sizeof(PointerRegion)))
+                PointerRegion(s, allocator, data, size);
             }
-            region = new (allocator->allocate(sizeof(PointerRegion)))
-              PointerRegion(s, allocator, data, size, freePointer);
             index = JarIndex::open(s, allocator, region);
           } else if (DebugFind) {
             fprintf(stderr, "%s in %s returned null\n", symbolName,
@@ -605,6 +991,52 @@ class BuiltinElement: public JarElement {
     }
   }
 
+  // Decodes the end of central directory record and the directory it
+  // points to, which is all JarIndex::open looks at.
+  static void ensureCentralDirectory(LZMARegion* region) {
+    unsigned length = region->length();
+    if (length < CentralDirectorySearchStart) {
+      return;
+    }
+
+    // the record may be followed by a comment of up to 64KB
+    unsigned tail = length < CentralDirectorySearchStart + 0xFFFF
+      ? length : CentralDirectorySearchStart + 0xFFFF;
+    region->ensure(length - tail, tail);
+
+    const uint8_t* start = region->start();
+    for (const uint8_t* p = start + length - CentralDirectorySearchStart;
+         p >= start + length - tail; --p)
+    {
+      if (signature(p) == CentralDirectorySignature) {
+        unsigned offset = centralDirectoryOffset(p);
+        if (offset < static_cast<unsigned>(p - start)) {
+          region->ensure(offset, (p - start) - offset);
+        }
+        return;
+      }
+    }
+
+    // no record where we expected one, so let JarIndex::open search
+    // the whole thing
+    region->ensure(0, length);
+  }
+
+  virtual System::Region* read(const uint8_t* header) {
+    if (lzmaRegion) {
+      unsigned offset = localHeaderOffset(header);
+      lzmaRegion->ensure(offset, LocalHeaderSize);
+
+      const uint8_t* localHeader = region->start() + offset;
+      if (offset + LocalHeaderSize <= region->length()) {
+        lzmaRegion->ensure(offset, (fileData(localHeader) - localHeader)
+                           + compressedSize(header));
+      }
+    }
+
+    return JarElement::read(header);
+  }
+
   virtual const char* urlPrefix() {
     return "avianvmresource:";
   }
@@ -623,6 +1055,7 @@ class BuiltinElement: public JarElement {
 
   System::Library* library;
   const char* libraryName;
+  LZMARegion* lzmaRegion;
 };
 
 void
@@ -802,7 +1235,8 @@ add(System* s, Element** first, Element** last, Allocator* allocator,
         fprintf(stderr, "ignore nonexistent %s\n", name);
       }
 
-      allocator->free(name, strlen(name) + 1);
+      add(first, last, new (allocator->allocate(sizeof(MissingElement)))
+          MissingElement(allocator, name));
     } break;
     }
   }
@@ -823,6 +1257,281 @@ parsePath(System* s, Allocator* allocator, const char* path,
   return first;
 }
 
+// A merged index of the entries in every jar file in a path, so that a
+// name can be found with a single hash lookup no matter how many jars
+// there are.  Only the first jar containing a given name is recorded,
+// since that is the one a search of the path would find.
+class ClasspathIndex {
+ public:
+  class Node {
+   public:
+    uint32_t hash;
+    const uint8_t* name;
+    unsigned nameLength;
+    JarElement* element;
+    uint32_t entry;
+    uint32_t length;
+    Node* next;
+  };
+
+  ClasspathIndex(System* s, Allocator* allocator, unsigned capacity,
+                 unsigned limit):
+    s(s),
+    allocator(allocator),
+    capacity(capacity),
+    limit(limit),
+    position(0),
+    nodes(static_cast<Node*>
+          (allocator->allocate(sizeof(Node) * max(limit, 1))))
+  {
+    memset(table, 0, sizeof(Node*) * capacity);
+  }
+
+  static ClasspathIndex* make(System* s, Allocator* allocator, unsigned limit)
+  {
+    unsigned capacity = 16;
+    while (capacity < limit) capacity *= 2;
+
+    return new
+      (allocator->allocate(sizeof(ClasspathIndex)
+                           + (sizeof(Node*) * capacity)))
+      ClasspathIndex(s, allocator, capacity, limit);
+  }
+
+  Node* find(const uint8_t* name, unsigned length) {
+    uint32_t h = hash(name, length);
+    for (Node* n = table[h & (capacity - 1)]; n; n = n->next) {
+      if (n->hash == h and equal(name, length, n->name, n->nameLength)) {
+        return n;
+      }
+    }
+    return 0;
+  }
+
+  void add(const uint8_t* name, unsigned nameLength, JarElement* element,
+           uint32_t entry, uint32_t length)
+  {
+    if (find(name, nameLength) == 0) {
+      expect(s, position < limit);
+
+      uint32_t h = hash(name, nameLength);
+      unsigned i = h & (capacity - 1);
+
+      Node* n = nodes + (position++);
+      n->hash = h;
+      n->name = name;
+      n->nameLength = nameLength;
+      n->element = element;
+      n->entry = entry;
+      n->length = length;
+      n->next = table[i];
+
+      table[i] = n;
+    }
+  }
+
+  void dispose() {
+    allocator->free(nodes, sizeof(Node) * max(limit, 1));
+    allocator->free(this, sizeof(*this) + (sizeof(Node*) * capacity));
+  }
+
+  System* s;
+  Allocator* allocator;
+  unsigned capacity;
+  unsigned limit;
+  unsigned position;
+  Node* nodes;
+  Node* table[0];
+};
+
+// Remembers names which could not be found anywhere in the path, so
+// that repeated probes for them need not visit every element again.
+// Once it holds MissCacheLimit names it is simply cleared.
+class MissCache {
+ public:
+  class Node {
+   public:
+    uint32_t hash;
+    unsigned length;
+    bool directory; // whether the name is known not to be a directory
+    Node* next;
+    char name[0];
+  };
+
+  MissCache(System* s, Allocator* allocator):
+    allocator(allocator),
+    lock(0),
+    count(0),
+    hits(0),
+    misses(0)
+  {
+    expect(s, s->success(s->make(&lock)));
+    memset(table, 0, sizeof(Node*) * MissCacheCapacity);
+  }
+
+  static MissCache* make(System* s, Allocator* allocator) {
+    return new
+      (allocator->allocate(sizeof(MissCache)
+                           + (sizeof(Node*) * MissCacheCapacity)))
+      MissCache(s, allocator);
+  }
+
+  bool contains(const char* name, bool tryDirectory) {
+    unsigned length = strlen(name);
+    uint32_t h = hash(reinterpret_cast<const uint8_t*>(name), length);
+
+    lock->acquire();
+    bool found = false;
+    for (Node* n = table[h & (MissCacheCapacity - 1)]; n; n = n->next) {
+      if (n->hash == h and (n->directory or not tryDirectory)
+          and equal(name, length, n->name, n->length))
+      {
+        found = true;
+        ++ hits;
+        break;
+      }
+    }
+    lock->release();
+
+    return found;
+  }
+
+  void add(const char* name, bool tryDirectory) {
+    unsigned length = strlen(name);
+    uint32_t h = hash(reinterpret_cast<const uint8_t*>(name), length);
+    unsigned i = h & (MissCacheCapacity - 1);
+
+    lock->acquire();
+    ++ misses;
+
+    Node* n = table[i];
+    while (n and not (n->hash == h and equal(name, length, n->name,
+                                             n->length)))
+    {
+      n = n->next;
+    }
+
+    if (n) {
+      n->directory = n->directory or tryDirectory;
+    } else {
+      if (count == MissCacheLimit) {
+        clear();
+      }
+
+      n = static_cast<Node*>(allocator->allocate(sizeof(Node) + length));
+      n->hash = h;
+      n->length = length;
+      n->directory = tryDirectory;
+      n->next = table[i];
+      memcpy(n->name, name, length);
+
+      table[i] = n;
+      ++ count;
+    }
+    lock->release();
+  }
+
+  void clear() {
+    for (unsigned i = 0; i < MissCacheCapacity; ++i) {
+      for (Node* n = table[i]; n;) {
+        Node* t = n;
+        n = n->next;
+        allocator->free(t, sizeof(Node) + t->length);
+      }
+      table[i] = 0;
+    }
+    count = 0;
+  }
+
+  void invalidate() {
+    lock->acquire();
+    clear();
+    lock->release();
+  }
+
+  void dispose() {
+    clear();
+    lock->dispose();
+    allocator->free(this, sizeof(*this)
+                    + (sizeof(Node*) * MissCacheCapacity));
+  }
+
+  Allocator* allocator;
+  System::Mutex* lock;
+  unsigned count;
+  unsigned hits;
+  unsigned misses;
+  Node* table[0];
+};
+
+class IndexReader {
+ public:
+  IndexReader(const uint8_t* p, unsigned size):
+    p(p), end(p + size), ok(true)
+  { }
+
+  const uint8_t* read(unsigned size) {
+    if (ok and size <= static_cast<uintptr_t>(end - p)) {
+      const uint8_t* r = p;
+      p += size;
+      return r;
+    } else {
+      ok = false;
+      return 0;
+    }
+  }
+
+  unsigned read1() {
+    const uint8_t* r = read(1);
+    return r ? *r : 0;
+  }
+
+  uint32_t read4() {
+    uint32_t v = 0;
+    const uint8_t* r = read(4);
+    if (r) memcpy(&v, r, 4);
+    return v;
+  }
+
+  int64_t read8() {
+    int64_t v = 0;
+    const uint8_t* r = read(8);
+    if (r) memcpy(&v, r, 8);
+    return v;
+  }
+
+  bool matches(const char* s) {
+    unsigned length = strlen(s);
+    const uint8_t* r = read4() == length ? read(length) : 0;
+    return r and memcmp(r, s, length) == 0;
+  }
+
+  char* readName(Allocator* allocator) {
+    unsigned length = read4();
+    const uint8_t* r = read(length);
+    if (r) {
+      char* name = static_cast<char*>(allocator->allocate(length + 1));
+      memcpy(name, r, length);
+      name[length] = 0;
+      return name;
+    } else {
+      return 0;
+    }
+  }
+
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok;
+};
+
+void
+writeString(Vector* v, const char* s)
+{
+  unsigned length = strlen(s);
+  v->append4(length);
+  v->append(s, length);
+}
+
 class MyIterator: public Finder::IteratorImp {
  public:
   MyIterator(System* s, Allocator* allocator, Element* path):
@@ -862,12 +1571,41 @@ class MyIterator: public Finder::IteratorImp {
 class MyFinder: public Finder {
  public:
   MyFinder(System* system, Allocator* allocator, const char* path,
-           const char* bootLibrary):
+           const char* bootLibrary, const char* indexPath,
+           InflateCache* cache):
     system(system),
     allocator(allocator),
-    path_(parsePath(system, allocator, path, bootLibrary)),
-    pathString(copy(allocator, path))
-  { }
+    path_(0),
+    pathString(copy(allocator, path)),
+    index(0),
+    indexRegion(0),
+    probes(0),
+    missing(MissCache::make(system, allocator)),
+    cache(static_cast<MyInflateCache*>(cache)),
+    probeCount(0),
+    elementCount(0)
+  {
+    if (indexPath == 0 or not load(indexPath, bootLibrary)) {
+      path_ = parsePath(system, allocator, path, bootLibrary);
+      buildIndex();
+
+      if (indexPath) {
+        save(indexPath);
+      }
+    }
+
+    if (cache) {
+      cache->acquire();
+
+      for (Element* e = path_; e; e = e->next) {
+        if (e->type() == Element::JarType
+            or e->type() == Element::BuiltinType)
+        {
+          static_cast<JarElement*>(e)->cache = this->cache;
+        }
+      }
+    }
+  }
 
   MyFinder(System* system, Allocator* allocator, const uint8_t* jarData,
            unsigned jarLength):
@@ -875,72 +1613,457 @@ class MyFinder: public Finder {
     allocator(allocator),
     path_(new (allocator->allocate(sizeof(JarElement)))
           JarElement(system, allocator, jarData, jarLength)),
-    pathString(0)
-  { }
+    pathString(0),
+    index(0),
+    indexRegion(0),
+    probes(0),
+    missing(MissCache::make(system, allocator)),
+    cache(0),
+    probeCount(0),
+    elementCount(0)
+  {
+    buildIndex();
+  }
 
-  virtual IteratorImp* iterator() {
-    return new (allocator->allocate(sizeof(MyIterator)))
-      MyIterator(system, allocator, path_);
+  static JarElement* jarFile(Element* e) {
+    return (e->type() == Element::JarType
+            and static_cast<JarElement*>(e)->name)
+      ? static_cast<JarElement*>(e) : 0;
   }
 
-  virtual System::Region* find(const char* name) {
+  static const char* elementName(Element* e) {
+    switch (e->type()) {
+    case Element::DirectoryType:
+      return static_cast<DirectoryElement*>(e)->originalName;
+
+    case Element::JarType:
+    case Element::BuiltinType:
+      return static_cast<JarElement*>(e)->name;
+
+    case Element::MissingType:
+      return static_cast<MissingElement*>(e)->name;
+
+    default:
+      return 0;
+    }
+  }
+
+  static bool precedes(Element* e, ClasspathIndex::Node* n) {
+    return n == 0 or e->position < n->element->position;
+  }
+
+  void buildIndex() {
+    unsigned entryCount = 0;
     for (Element* e = path_; e; e = e->next) {
-      System::Region* r = e->find(name);
-      if (r) {
-        return r;
+      e->position = elementCount++;
+
+      JarElement* jar = jarFile(e);
+      if (jar) {
+        jar->init();
+        if (jar->index) {
+          entryCount += jar->index->position;
+        }
       }
     }
-    
-    return 0;
-  }
 
-  virtual System::FileType stat(const char* name, unsigned* length,
-                                bool tryDirectory)
-  {
+    index = ClasspathIndex::make(system, allocator, entryCount);
+    probes = static_cast<Element**>
+      (allocator->allocate(sizeof(Element*) * max(elementCount, 1)));
+
     for (Element* e = path_; e; e = e->next) {
-      System::FileType type = e->stat(name, length, tryDirectory);
-      if (type != System::TypeDoesNotExist) {
-        return type;
+      JarElement* jar = jarFile(e);
+      if (jar) {
+        if (jar->index) {
+          for (unsigned i = 0; i < jar->index->position; ++i) {
+            const uint8_t* p = jar->index->nodes[i].entry;
+            index->add(fileName(p), fileNameLength(p), jar,
+                       p - jar->region->start(), uncompressedSize(p));
+          }
+
+          // the jar's own index is now only needed to iterate over its
+          // entries, so we let it be rebuilt if and when that happens:
+          jar->index->dispose();
+          jar->index = 0;
+        }
+      } else if (e->type() != Element::MissingType) {
+        probes[probeCount++] = e;
       }
     }
-    
-    return System::TypeDoesNotExist;
   }
 
-  virtual const char* urlPrefix(const char* name) {
-    for (Element* e = path_; e; e = e->next) {
-      unsigned length;
-      System::FileType type = e->stat(name, &length, true);
-      if (type != System::TypeDoesNotExist) {
-        return e->urlPrefix();
+  Element* loadElement(unsigned type, char* name, IndexReader* reader,
+                       const char* bootLibrary)
+  {
+    unsigned length;
+    switch (type) {
+    case Element::DirectoryType:
+      if (system->stat(name, &length) == System::TypeDirectory) {
+        return new (allocator->allocate(sizeof(DirectoryElement)))
+          DirectoryElement(system, allocator, name);
       }
+      break;
+
+    case Element::JarType: {
+      unsigned expectedLength = reader->read4();
+      int64_t modified = reader->read8();
+      if (reader->ok
+          and system->stat(name, &length) == System::TypeFile
+          and length == expectedLength
+          and system->lastModified(name) == modified)
+      {
+        return new (allocator->allocate(sizeof(JarElement)))
+          JarElement(system, allocator, name);
+      }
+    } break;
+
+    case Element::BuiltinType:
+      return new (allocator->allocate(sizeof(BuiltinElement)))
+        BuiltinElement(system, allocator, name, bootLibrary);
+
+    case Element::MissingType: {
+      System::FileType t = system->stat(name, &length);
+      if (t != System::TypeFile and t != System::TypeDirectory) {
+        return new (allocator->allocate(sizeof(MissingElement)))
+          MissingElement(allocator, name);
+      }
+    } break;
+
+    default:
+      break;
     }
 
+    allocator->free(name, strlen(name) + 1);
     return 0;
   }
 
-  virtual const char* sourceUrl(const char* name) {
+  // Loads an index written by save, provided it was written for the
+  // same path and working directory and nothing it was built from has
+  // changed since.  In that case we can skip opening every jar (and
+  // reading its manifest) up front.
+  bool load(const char* indexPath, const char* bootLibrary) {
+    System::Region* region;
+    if (not system->success(system->map(&region, indexPath))) {
+      return false;
+    }
+
+    const char* cwd = system->toAbsolutePath(allocator, "");
+
+    IndexReader reader(region->start(), region->length());
+    bool valid = region->length() >= 8
+      and reader.read4() == ClasspathIndexMagic
+      and reader.read4() == hash(region->start() + 8, region->length() - 8)
+      and reader.matches(cwd)
+      and reader.matches(pathString);
+
+    allocator->free(cwd, strlen(cwd) + 1);
+
+    unsigned count = valid ? reader.read4() : 0;
+    if (count > region->length()) {
+      valid = false;
+    }
+
+    Element** elements = valid ? static_cast<Element**>
+      (allocator->allocate(sizeof(Element*) * max(count, 1))) : 0;
+
+    Element* first = 0;
+    Element* last = 0;
+    unsigned loaded = 0;
+    while (valid and loaded < count) {
+      unsigned type = reader.read1();
+      char* name = reader.readName(allocator);
+      Element* e = name ? loadElement(type, name, &reader, bootLibrary) : 0;
+      if (e) {
+        e->position = loaded;
+        elements[loaded++] = e;
+        add(&first, &last, e);
+      } else {
+        valid = false;
+      }
+    }
+
+    if (valid) {
+      unsigned entryCount = reader.read4();
+      if (entryCount <= region->length() / 16) {
+        index = ClasspathIndex::make(system, allocator, entryCount);
+
+        for (unsigned i = 0; i < entryCount; ++i) {
+          unsigned position = reader.read4();
+          uint32_t entry = reader.read4();
+          uint32_t length = reader.read4();
+          unsigned nameLength = reader.read4();
+          const uint8_t* name = reader.read(nameLength);
+
+          if (name == 0 or position >= count
+              or elements[position]->type() != Element::JarType)
+          {
+            valid = false;
+            break;
+          }
+
+          index->add(name, nameLength,
+                     static_cast<JarElement*>(elements[position]), entry,
+                     length);
+        }
+      } else {
+        valid = false;
+      }
+    }
+
+    if (valid) {
+      path_ = first;
+      indexRegion = region;
+      elementCount = count;
+      probes = static_cast<Element**>
+        (allocator->allocate(sizeof(Element*) * max(elementCount, 1)));
+
+      for (unsigned i = 0; i < count; ++i) {
+        if (elements[i]->type() == Element::DirectoryType
+            or elements[i]->type() == Element::BuiltinType)
+        {
+          probes[probeCount++] = elements[i];
+        }
+      }
+    } else {
+      for (Element* e = first; e;) {
+        Element* t = e;
+        e = e->next;
+        t->dispose();
+      }
+
+      if (index) {
+        index->dispose();
+        index = 0;
+      }
+
+      region->dispose();
+    }
+
+    if (elements) {
+      allocator->free(elements, sizeof(Element*) * max(count, 1));
+    }
+
+    if (DebugFind) {
+      fprintf(stderr, "%s index %s\n", valid ? "loaded" : "ignored",
+              indexPath);
+    }
+
+    return valid;
+  }
+
+  void save(const char* indexPath) {
+    Vector v(system, allocator, 64 * 1024);
+    v.append4(ClasspathIndexMagic);
+    v.append4(0); // checksum
+
+    const char* cwd = system->toAbsolutePath(allocator, "");
+    writeString(&v, cwd);
+    allocator->free(cwd, strlen(cwd) + 1);
+
+    writeString(&v, pathString);
+
+    v.append4(elementCount);
     for (Element* e = path_; e; e = e->next) {
-      unsigned length;
-      System::FileType type = e->stat(name, &length, true);
-      if (type != System::TypeDoesNotExist) {
-        return e->sourceUrl();
+      const char* name = elementName(e);
+
+      v.append(e->type());
+      writeString(&v, name);
+
+      if (e->type() == Element::JarType) {
+        unsigned length;
+        system->stat(name, &length);
+        int64_t modified = system->lastModified(name);
+
+        v.append4(length);
+        v.append(&modified, 8);
       }
     }
 
-    return 0;
+    v.append4(index->position);
+    for (unsigned i = 0; i < index->position; ++i) {
+      ClasspathIndex::Node* n = index->nodes + i;
+      v.append4(n->element->position);
+      v.append4(n->entry);
+      v.append4(n->length);
+      v.append4(n->nameLength);
+      v.append(n->name, n->nameLength);
+    }
+
+    uint32_t checksum = hash(v.data + 8, v.length() - 8);
+    v.set(4, &checksum, 4);
+
+    // write a temporary file and rename it, so that other processes
+    // never see a partial one:
+    unsigned length = strlen(indexPath);
+    RUNTIME_ARRAY(char, tmp, length + 5);
+    memcpy(RUNTIME_ARRAY_BODY(tmp), indexPath, length);
+    memcpy(RUNTIME_ARRAY_BODY(tmp) + length, ".tmp", 5);
+
+    FILE* out = vm::fopen(RUNTIME_ARRAY_BODY(tmp), "wb");
+    if (out) {
+      bool success = fwrite(v.data, 1, v.length(), out) == v.length();
+      success = fclose(out) == 0 and success;
+
+      if (success) {
+#ifdef PLATFORM_WINDOWS
+        ::remove(indexPath);
+#endif
+        success = ::rename(RUNTIME_ARRAY_BODY(tmp), indexPath) == 0;
+      }
+
+      if (not success) {
+        ::remove(RUNTIME_ARRAY_BODY(tmp));
+      }
+    }
+  }
+
+  // Finds the first jar in the path containing the specified name or,
+  // if tryDirectory is true, a directory by that name.
+  ClasspathIndex::Node* lookup(const char* name, bool tryDirectory,
+                               System::FileType* type)
+  {
+    while (*name == '/') name++;
+
+    unsigned length = strlen(name);
+    ClasspathIndex::Node* n = index->find
+      (reinterpret_cast<const uint8_t*>(name), length);
+    *type = n ? System::TypeFile : System::TypeDoesNotExist;
+
+    if (tryDirectory) {
+      RUNTIME_ARRAY(uint8_t, d, length + 1);
+      memcpy(RUNTIME_ARRAY_BODY(d), name, length);
+      RUNTIME_ARRAY_BODY(d)[length] = '/';
+
+      ClasspathIndex::Node* dn = index->find
+        (RUNTIME_ARRAY_BODY(d), length + 1);
+      if (dn and (n == 0 or dn->element->position < n->element->position)) {
+        n = dn;
+        *type = System::TypeDirectory;
+      }
+    }
+
+    return n;
+  }
+
+  // Finds the first element in the path containing the specified
+  // name.  Only directories and builtin jars which come before the
+  // first indexed match need to be probed individually.
+  Element* locate(const char* name, unsigned* length, bool tryDirectory,
+                  System::FileType* type)
+  {
+    *length = 0;
+    if (missing->contains(name, tryDirectory)) {
+      *type = System::TypeDoesNotExist;
+      return 0;
+    }
+
+    ClasspathIndex::Node* n = lookup(name, tryDirectory, type);
+
+    for (unsigned i = 0; i < probeCount and precedes(probes[i], n); ++i) {
+      System::FileType t = probes[i]->stat(name, length, tryDirectory);
+      if (t != System::TypeDoesNotExist) {
+        *type = t;
+        return probes[i];
+      }
+    }
+
+    if (n) {
+      *length = *type == System::TypeFile ? n->length : 0;
+      return n->element;
+    } else {
+      missing->add(name, tryDirectory);
+      return 0;
+    }
+  }
+
+  virtual IteratorImp* iterator() {
+    return new (allocator->allocate(sizeof(MyIterator)))
+      MyIterator(system, allocator, path_);
+  }
+
+  virtual System::Region* find(const char* name) {
+    if (missing->contains(name, false)) {
+      return 0;
+    }
+
+    System::FileType type;
+    ClasspathIndex::Node* n = lookup(name, false, &type);
+
+    for (unsigned i = 0; i < probeCount and precedes(probes[i], n); ++i) {
+      System::Region* r = probes[i]->find(name);
+      if (r) {
+        return r;
+      }
+    }
+
+    if (n) {
+      return n->element->findEntry(n->entry);
+    } else {
+      missing->add(name, false);
+      return 0;
+    }
+  }
+
+  virtual System::FileType stat(const char* name, unsigned* length,
+                                bool tryDirectory)
+  {
+    System::FileType type;
+    locate(name, length, tryDirectory, &type);
+    return type;
+  }
+
+  virtual const char* urlPrefix(const char* name) {
+    unsigned length;
+    System::FileType type;
+    Element* e = locate(name, &length, true, &type);
+    return e ? e->urlPrefix() : 0;
+  }
+
+  virtual const char* sourceUrl(const char* name) {
+    unsigned length;
+    System::FileType type;
+    Element* e = locate(name, &length, true, &type);
+    return e ? e->sourceUrl() : 0;
   }
 
   virtual const char* path() {
     return pathString;
   }
 
+  virtual void invalidate() {
+    missing->invalidate();
+  }
+
+  virtual unsigned negativeCacheHits() {
+    return missing->hits;
+  }
+
+  virtual unsigned negativeCacheMisses() {
+    return missing->misses;
+  }
+
+  virtual InflateCache* inflateCache() {
+    return cache;
+  }
+
   virtual void dispose() {
     for (Element* e = path_; e;) {
       Element* t = e;
       e = e->next;
       t->dispose();
     }
+    if (index) {
+      index->dispose();
+    }
+    if (probes) {
+      allocator->free(probes, sizeof(Element*) * max(elementCount, 1));
+    }
+    if (indexRegion) {
+      indexRegion->dispose();
+    }
+    missing->dispose();
+    if (cache) {
+      cache->release();
+    }
     if (pathString) {
       allocator->free(pathString, strlen(pathString) + 1);
     }
@@ -951,6 +2074,13 @@ class MyFinder: public Finder {
   Allocator* allocator;
   Element* path_;
   const char* pathString;
+  ClasspathIndex* index;
+  System::Region* indexRegion;
+  Element** probes;
+  MissCache* missing;
+  MyInflateCache* cache;
+  unsigned probeCount;
+  unsigned elementCount;
 };
 
 } // namespace
@@ -958,9 +2088,20 @@ class MyFinder: public Finder {
 namespace vm {
 
 JNIEXPORT Finder*
-makeFinder(System* s, Allocator* a, const char* path, const char* bootLibrary)
+makeFinder(System* s, Allocator* a, const char* path, const char* bootLibrary,
+           const char* indexPath, InflateCache* cache)
+{
+  return new (a->allocate(sizeof(MyFinder)))
+    MyFinder(s, a, path, bootLibrary, indexPath, cache);
+}
+
+InflateCache*
+makeInflateCache(System* s, Allocator* a, unsigned budget)
 {
-  return new (a->allocate(sizeof(MyFinder))) MyFinder(s, a, path, bootLibrary);
+  return new
+    (a->allocate(sizeof(MyInflateCache)
+                 + (sizeof(MyInflateCache::Entry*) * InflateCacheCapacity)))
+    MyInflateCache(s, a, budget);
 }
 
 Finder*
@@ -614,8 +614,9 @@ class Fixie {
     }
   }
 
-  // be sure to update e.g. TargetFixieSizeInBytes in bootimage.cpp if
-  // you add/remove/change fields in this class:
+  // be sure to update e.g. TargetFixieSizeInBytes in bootimage.cpp and
+  // FixieSizeInBytes in compile.cpp if you add/remove/change fields in
+  // this class:
 
   uint16_t age;
   uint16_t flags;
@@ -1949,6 +1950,27 @@ class MyHeap: public Heap {
     return allocateFixed(allocator, sizeInWords, objectMask, 0, true);
   }
 
+  virtual void* tryAllocateTenured(unsigned sizeInWords) {
+    // objects allocated here skip gen1 entirely, so the caller must
+    // route all subsequent stores through mark() like any other gen2
+    // object.  We leave enough room for whatever the next minor
+    // collection expects to promote.
+    if (c.gen2.remaining()
+        < sizeInWords + c.tenureFootprint + c.tenurePadding)
+    {
+      return 0;
+    }
+
+    void* p = c.gen2.allocate(sizeInWords);
+    memset(p, 0, sizeInWords * BytesPerWord);
+
+    if (Verbose2) {
+      fprintf(stderr, "allocate %d tenured words at %p\n", sizeInWords, p);
+    }
+
+    return p;
+  }
+
   bool needsMark(void* p) {
     assert(&c, c.client->isFixed(p) or (not immortalHeapContains(&c, p)));
 
@@ -314,6 +314,8 @@ pushFrame(Thread* t, object method)
 {
   PROTECT(t, method);
 
+  loadMethodCode(t, method);
+
   unsigned parameterFootprint = methodParameterFootprint(t, method);
   unsigned base = t->sp - parameterFootprint;
   unsigned locals = parameterFootprint;
@@ -3015,7 +3017,7 @@ class MyProcessor: public Processor {
     return vm::makeClass
       (t, flags, vmFlags, fixedSize, arrayElementSize, arrayDimensions, 0,
        objectMask, name, sourceFile, super, interfaceTable, virtualTable,
-       fieldTable, methodTable, addendum, staticTable, loader, 0, 0);
+       fieldTable, methodTable, addendum, staticTable, loader, 0, 0, 0);
   }
 
   virtual void
@@ -3232,6 +3234,15 @@ class MyProcessor: public Processor {
   virtual void boot(vm::Thread*, BootImage* image, uint8_t* code) {
     expect(s, image == 0 and code == 0);
   }
+
+  virtual bool checkpoint(vm::Thread* t) {
+    throwNew(t, Machine::IllegalStateExceptionType,
+             "checkpoints require a boot image");
+  }
+
+  virtual void shutDown(vm::Thread*) {
+    // ignore
+  }
   
 
   virtual void callWithCurrentContinuation(vm::Thread*, object) {
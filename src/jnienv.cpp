@@ -3813,6 +3813,8 @@ JNI_CreateJavaVM(Machine** m, Thread** t, void* args)
   const char* bootClasspath = 0;
   const char* bootClasspathAppend = "";
   const char* crashDumpDirectory = 0;
+  const char* classpathIndex = 0;
+  const char* jarCacheSize = 0;
 
   unsigned propertyCount = 0;
 
@@ -3866,6 +3868,14 @@ JNI_CreateJavaVM(Machine** m, Thread** t, void* args)
                          sizeof(EMBED_PREFIX_PROPERTY)) == 0)
       {
         embedPrefix = p + sizeof(EMBED_PREFIX_PROPERTY);
+      } else if (strncmp(p, CLASSPATH_INDEX_PROPERTY "=",
+                         sizeof(CLASSPATH_INDEX_PROPERTY)) == 0)
+      {
+        classpathIndex = p + sizeof(CLASSPATH_INDEX_PROPERTY);
+      } else if (strncmp(p, JAR_CACHE_PROPERTY "=",
+                         sizeof(JAR_CACHE_PROPERTY)) == 0)
+      {
+        jarCacheSize = p + sizeof(JAR_CACHE_PROPERTY);
       }
 
       ++ propertyCount;
@@ -3908,9 +3918,14 @@ JNI_CreateJavaVM(Machine** m, Thread** t, void* args)
   if(bootLibraryEnd)
     *bootLibraryEnd = 0;
 
+  InflateCache* ic = makeInflateCache
+    (s, h, jarCacheSize ? local::parseSize(jarCacheSize) : 1024 * 1024);
+
   Finder* bf = makeFinder
-    (s, h, RUNTIME_ARRAY_BODY(bootClasspathBuffer), bootLibrary);
-  Finder* af = makeFinder(s, h, classpath, bootLibrary);
+    (s, h, RUNTIME_ARRAY_BODY(bootClasspathBuffer), bootLibrary, 0, ic);
+  Finder* af = makeFinder(s, h, classpath, bootLibrary, classpathIndex, ic);
+  ic->release();
+
   if(bootLibrary)
     free(bootLibrary);
   Processor* p = makeProcessor(s, h, true);
@@ -0,0 +1,303 @@
+/* Copyright (c) 2008-2012, Avian Contributors
+
+   Permission to use, copy, modify, and/or distribute this software
+   for any purpose with or without fee is hereby granted, provided
+   that the above copyright notice and this permission notice appear
+   in all copies.
+
+   There is NO WARRANTY for this software.  See license.txt for
+   details. */
+
+#include "avian/lz.h"
+
+using namespace vm;
+
+namespace {
+
+const unsigned MinMatch = 4;
+const unsigned MaxOffset = 0xFFFF;
+
+// the last bytes of an image are always literals, and no match may
+// start closer to the end than MatchFindLimit
+const unsigned LastLiterals = 5;
+const unsigned MatchFindLimit = 12;
+
+const unsigned HashBits = 14;
+
+uint32_t
+readLittle4(const uint8_t* p)
+{
+  return (static_cast<uint32_t>(p[3]) << 24)
+    |    (static_cast<uint32_t>(p[2]) << 16)
+    |    (static_cast<uint32_t>(p[1]) <<  8)
+    |    (static_cast<uint32_t>(p[0])      );
+}
+
+void
+writeLittle4(uint8_t* p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+unsigned
+hash4(const uint8_t* p)
+{
+  return (readLittle4(p) * 2654435761U) >> (32 - HashBits);
+}
+
+uint8_t*
+writeLength(uint8_t* op, unsigned length)
+{
+  while (length >= 255) {
+    *(op++) = 255;
+    length -= 255;
+  }
+  *(op++) = length;
+  return op;
+}
+
+// writes a sequence of the specified literals followed by a match of
+// the specified length, or by nothing if that length is zero
+uint8_t*
+writeSequence(uint8_t* op, const uint8_t* literals, unsigned literalCount,
+              unsigned offset, unsigned matchLength)
+{
+  uint8_t* token = op++;
+  unsigned t = (literalCount < 15 ? literalCount : 15) << 4;
+  if (literalCount >= 15) {
+    op = writeLength(op, literalCount - 15);
+  }
+
+  memcpy(op, literals, literalCount);
+  op += literalCount;
+
+  if (matchLength) {
+    op[0] = offset;
+    op[1] = offset >> 8;
+    op += 2;
+
+    unsigned length = matchLength - MinMatch;
+    t |= length < 15 ? length : 15;
+    if (length >= 15) {
+      op = writeLength(op, length - 15);
+    }
+  }
+
+  *token = t;
+  return op;
+}
+
+bool
+readLength(const uint8_t** ip, const uint8_t* end, unsigned* length,
+           unsigned limit)
+{
+  unsigned b;
+  do {
+    if (*ip == end or *length > limit) {
+      return false;
+    }
+    b = *((*ip)++);
+    *length += b;
+  } while (b == 255);
+  return true;
+}
+
+} // namespace
+
+namespace vm {
+
+bool
+isLZ(const uint8_t* in, unsigned inSize)
+{
+  return inSize >= LZHeaderSize and readLittle4(in) == LZMagic;
+}
+
+unsigned
+decodedLZSize(const uint8_t* in)
+{
+  return readLittle4(in + 4);
+}
+
+unsigned
+maxEncodedLZSize(unsigned inSize)
+{
+  return LZHeaderSize + inSize + (inSize / 255) + 16;
+}
+
+unsigned
+encodeLZ(const uint8_t* in, unsigned inSize, uint8_t* out)
+{
+  writeLittle4(out, LZMagic);
+  writeLittle4(out + 4, inSize);
+
+  uint8_t* op = out + LZHeaderSize;
+  unsigned anchor = 0;
+
+  if (inSize > MatchFindLimit) {
+    uint32_t table[1 << HashBits];
+    memset(table, 0, sizeof(table));
+
+    unsigned limit = inSize - MatchFindLimit;
+    unsigned ip = 0;
+    while (ip < limit) {
+      unsigned h = hash4(in + ip);
+      unsigned ref = table[h];
+      table[h] = ip;
+
+      if (ref < ip and ip - ref <= MaxOffset
+          and readLittle4(in + ref) == readLittle4(in + ip))
+      {
+        while (ip > anchor and ref > 0 and in[ip - 1] == in[ref - 1]) {
+          -- ip;
+          -- ref;
+        }
+
+        unsigned length = MinMatch;
+        while (ip + length < inSize - LastLiterals
+               and in[ip + length] == in[ref + length])
+        {
+          ++ length;
+        }
+
+        op = writeSequence(op, in + anchor, ip - anchor, ip - ref, length);
+
+        ip += length;
+        anchor = ip;
+
+        if (ip < limit) {
+          table[hash4(in + ip - 2)] = ip - 2;
+        }
+      } else {
+        // skip ahead faster the longer we go without a match, so
+        // incompressible data costs little to encode
+        ip += 1 + ((ip - anchor) >> 6);
+      }
+    }
+  }
+
+  op = writeSequence(op, in + anchor, inSize - anchor, 0, 0);
+
+  return op - out;
+}
+
+bool
+decodeLZ(const uint8_t* in, unsigned inSize, uint8_t* out, unsigned outSize)
+{
+  if (not isLZ(in, inSize) or decodedLZSize(in) != outSize) {
+    return false;
+  }
+
+  const uint8_t* ip = in + LZHeaderSize;
+  const uint8_t* end = in + inSize;
+  uint8_t* op = out;
+  uint8_t* outEnd = out + outSize;
+
+  while (ip != end) {
+    unsigned token = *(ip++);
+
+    unsigned length = token >> 4;
+    if (length == 15 and not readLength(&ip, end, &length, outSize)) {
+      return false;
+    }
+
+    if (length > static_cast<unsigned>(end - ip)
+        or length > static_cast<unsigned>(outEnd - op))
+    {
+      return false;
+    }
+
+    // short runs are common, so copy them with a fixed-size copy when
+    // there's room to spare on both sides
+    if (length <= 16 and end - ip >= 16 and outEnd - op >= 16) {
+      memcpy(op, ip, 16);
+    } else {
+      memcpy(op, ip, length);
+    }
+    op += length;
+    ip += length;
+
+    if (ip == end) {
+      break;
+    }
+
+    if (end - ip < 2) {
+      return false;
+    }
+
+    unsigned offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+
+    if (offset == 0 or offset > static_cast<unsigned>(op - out)) {
+      return false;
+    }
+
+    length = token & 15;
+    if (length == 15 and not readLength(&ip, end, &length, outSize)) {
+      return false;
+    }
+    length += MinMatch;
+
+    if (length > static_cast<unsigned>(outEnd - op)) {
+      return false;
+    }
+
+    const uint8_t* match = op - offset;
+    if (offset >= 8 and static_cast<unsigned>(outEnd - op) >= length + 8) {
+      // copy eight bytes at a time, possibly past the end of the match
+      // into space the next sequence will overwrite
+      uint8_t* matchEnd = op + length;
+      do {
+        memcpy(op, match, 8);
+        op += 8;
+        match += 8;
+      } while (op < matchEnd);
+      op = matchEnd;
+    } else {
+      // the match may overlap what it produces, so copy a byte at a
+      // time
+      while (length) {
+        *(op++) = *(match++);
+        -- length;
+      }
+    }
+  }
+
+  return op == outEnd;
+}
+
+uint8_t*
+encodeLZ(System*, Allocator* a, const uint8_t* in, unsigned inSize,
+         unsigned* outSize)
+{
+  unsigned bufferSize = maxEncodedLZSize(inSize);
+  uint8_t* buffer = static_cast<uint8_t*>(a->allocate(bufferSize));
+
+  *outSize = encodeLZ(in, inSize, buffer);
+
+  uint8_t* out = static_cast<uint8_t*>(a->allocate(*outSize));
+  memcpy(out, buffer, *outSize);
+
+  a->free(buffer, bufferSize);
+
+  return out;
+}
+
+uint8_t*
+decodeLZ(System* s, Allocator* a, const uint8_t* in, unsigned inSize,
+         unsigned* outSize)
+{
+  expect(s, isLZ(in, inSize));
+
+  *outSize = decodedLZSize(in);
+
+  uint8_t* out = static_cast<uint8_t*>(a->allocate(*outSize));
+
+  expect(s, decodeLZ(in, inSize, out, *outSize));
+
+  return out;
+}
+
+} // namespace vm
@@ -0,0 +1,306 @@
+/* Copyright (c) 2008-2012, Avian Contributors
+
+   Permission to use, copy, modify, and/or distribute this software
+   for any purpose with or without fee is hereby granted, provided
+   that the above copyright notice and this permission notice appear
+   in all copies.
+
+   There is NO WARRANTY for this software.  See license.txt for
+   details. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#include "avian/lz.h"
+
+#ifdef AVIAN_USE_LZMA
+#include "C/LzmaEnc.h"
+#include "C/LzmaDec.h"
+#endif
+
+using namespace vm;
+
+namespace {
+
+uint8_t*
+readFile(const char* name, unsigned* size)
+{
+  FILE* in = vm::fopen(name, "rb");
+  if (in == 0) {
+    fprintf(stderr, "unable to open %s\n", name);
+    return 0;
+  }
+
+  fseek(in, 0, SEEK_END);
+  long length = ftell(in);
+  fseek(in, 0, SEEK_SET);
+
+  uint8_t* data = static_cast<uint8_t*>(malloc(length > 0 ? length : 1));
+  if (data and length >= 0
+      and fread(data, 1, length, in) == static_cast<size_t>(length))
+  {
+    *size = length;
+  } else {
+    fprintf(stderr, "unable to read %s\n", name);
+    free(data);
+    data = 0;
+  }
+
+  fclose(in);
+  return data;
+}
+
+bool
+writeFile(const char* name, const uint8_t* data, unsigned size)
+{
+  bool success = false;
+  FILE* out = vm::fopen(name, "wb");
+
+  if (out) {
+    if (size == 0 or fwrite(data, size, 1, out) == 1) {
+      success = true;
+    } else {
+      fprintf(stderr, "unable to write to %s\n", name);
+    }
+
+    fclose(out);
+  } else {
+    fprintf(stderr, "unable to open %s\n", name);
+  }
+
+  return success;
+}
+
+double
+secondsSince(clock_t start)
+{
+  return static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void
+report(const char* codec, unsigned size, unsigned encodedSize, unsigned runs,
+       double seconds)
+{
+  fprintf(stderr, "%-5s %10d bytes (%5.1f%%), decoded at %8.1f MB/s\n",
+          codec, encodedSize, 100.0 * encodedSize / (size ? size : 1),
+          seconds > 0 ? (double(size) * runs) / (seconds * 1024 * 1024) : 0);
+}
+
+bool
+benchmarkLZ(const uint8_t* data, unsigned size, unsigned runs, uint8_t* out)
+{
+  uint8_t* encoded = static_cast<uint8_t*>(malloc(maxEncodedLZSize(size)));
+  if (encoded == 0) {
+    return false;
+  }
+  unsigned encodedSize = encodeLZ(data, size, encoded);
+
+  bool success = true;
+  clock_t start = clock();
+  for (unsigned i = 0; i < runs; ++i) {
+    success = decodeLZ(encoded, encodedSize, out, size) and success;
+  }
+  double seconds = secondsSince(start);
+
+  success = success and memcmp(data, out, size) == 0;
+  if (success) {
+    report("lz", size, encodedSize, runs, seconds);
+  }
+
+  free(encoded);
+  return success;
+}
+
+bool
+benchmarkZlib(const uint8_t* data, unsigned size, unsigned runs,
+              uint8_t* out)
+{
+  uLongf encodedSize = compressBound(size);
+  uint8_t* encoded = static_cast<uint8_t*>(malloc(encodedSize));
+  if (encoded == 0
+      or compress2(encoded, &encodedSize, data, size, 9) != Z_OK)
+  {
+    free(encoded);
+    return false;
+  }
+
+  bool success = true;
+  clock_t start = clock();
+  for (unsigned i = 0; i < runs; ++i) {
+    uLongf outSize = size;
+    success = uncompress(out, &outSize, encoded, encodedSize) == Z_OK
+      and outSize == size and success;
+  }
+  double seconds = secondsSince(start);
+
+  success = success and memcmp(data, out, size) == 0;
+  if (success) {
+    report("zlib", size, encodedSize, runs, seconds);
+  }
+
+  free(encoded);
+  return success;
+}
+
+#ifdef AVIAN_USE_LZMA
+
+void*
+myAllocate(void*, size_t size)
+{
+  return malloc(size);
+}
+
+void
+myFree(void*, void* address)
+{
+  free(address);
+}
+
+SRes
+myProgress(void*, UInt64, UInt64)
+{
+  return SZ_OK;
+}
+
+bool
+benchmarkLZMA(const uint8_t* data, unsigned size, unsigned runs,
+              uint8_t* out)
+{
+  const unsigned PropHeaderSize = 5;
+
+  ISzAlloc allocator = { myAllocate, myFree };
+  ICompressProgress progress = { myProgress };
+
+  CLzmaEncProps props;
+  LzmaEncProps_Init(&props);
+  props.level = 9;
+  props.writeEndMark = 1;
+
+  SizeT encodedSize = (size * 2) + 64;
+  uint8_t* encoded = static_cast<uint8_t*>(malloc(encodedSize));
+  uint8_t header[PropHeaderSize];
+  SizeT propsSize = PropHeaderSize;
+  if (encoded == 0
+      or LzmaEncode(encoded, &encodedSize, data, size, &props, header,
+                    &propsSize, 1, &progress, &allocator, &allocator)
+      != SZ_OK)
+  {
+    free(encoded);
+    return false;
+  }
+
+  bool success = true;
+  clock_t start = clock();
+  for (unsigned i = 0; i < runs; ++i) {
+    SizeT inSize = encodedSize;
+    SizeT outSize = size;
+    ELzmaStatus status;
+    success = LzmaDecode(out, &outSize, encoded, &inSize, header,
+                         PropHeaderSize, LZMA_FINISH_END, &status,
+                         &allocator) == SZ_OK
+      and outSize == size and success;
+  }
+  double seconds = secondsSince(start);
+
+  success = success and memcmp(data, out, size) == 0;
+  if (success) {
+    report("lzma", size, encodedSize + PropHeaderSize, runs, seconds);
+  }
+
+  free(encoded);
+  return success;
+}
+
+#endif // AVIAN_USE_LZMA
+
+// Compresses the specified data with each codec we have, and reports
+// the size of the result and how fast it decodes.
+bool
+benchmark(const uint8_t* data, unsigned size, unsigned runs)
+{
+  uint8_t* out = static_cast<uint8_t*>(malloc(size ? size : 1));
+  if (out == 0) {
+    fprintf(stderr, "unable to allocate output buffer\n");
+    return false;
+  }
+
+  bool success = benchmarkLZ(data, size, runs, out)
+    and benchmarkZlib(data, size, runs, out);
+#ifdef AVIAN_USE_LZMA
+  success = success and benchmarkLZMA(data, size, runs, out);
+#endif
+
+  if (not success) {
+    fprintf(stderr, "round trip failed\n");
+  }
+
+  free(out);
+  return success;
+}
+
+void
+usageAndExit(const char* program)
+{
+  fprintf(stderr,
+          "usage: %s {encode|decode} <input file> <output file>\n"
+          "       %s bench <input file> [<runs>]\n", program, program);
+  exit(-1);
+}
+
+} // namespace
+
+int
+main(int argc, const char** argv)
+{
+  if (argc < 3 or argc > 4) {
+    usageAndExit(argv[0]);
+  }
+
+  bool encode = strcmp(argv[1], "encode") == 0;
+  bool decode = strcmp(argv[1], "decode") == 0;
+  bool bench = strcmp(argv[1], "bench") == 0;
+  if (not (((encode or decode) and argc == 4) or bench)) {
+    usageAndExit(argv[0]);
+  }
+
+  unsigned size;
+  uint8_t* data = readFile(argv[2], &size);
+  if (data == 0) {
+    return -1;
+  }
+
+  bool success = false;
+
+  if (bench) {
+    int runs = argc == 4 ? atoi(argv[3]) : 10;
+    success = runs > 0 and benchmark(data, size, runs);
+  } else if (encode) {
+    uint8_t* out = static_cast<uint8_t*>(malloc(maxEncodedLZSize(size)));
+    if (out) {
+      success = writeFile(argv[3], out, encodeLZ(data, size, out));
+      free(out);
+    } else {
+      fprintf(stderr, "unable to allocate output buffer\n");
+    }
+  } else if (isLZ(data, size)) {
+    unsigned outSize = decodedLZSize(data);
+    uint8_t* out = static_cast<uint8_t*>(malloc(outSize ? outSize : 1));
+    if (out and decodeLZ(data, size, out, outSize)) {
+      success = writeFile(argv[3], out, outSize);
+    } else {
+      fprintf(stderr, "unable to decode %s\n", argv[2]);
+    }
+    free(out);
+  } else {
+    fprintf(stderr, "%s is not an LZ image\n", argv[2]);
+  }
+
+  free(data);
+
+  return (success ? 0 : -1);
+}
@@ -15,6 +15,13 @@ using namespace vm;
 
 namespace {
 
+const unsigned PropHeaderSize = 5;
+const unsigned HeaderSize = 13;
+
+// the most threads we'll use to decode the blocks of an image,
+// including the calling one
+const unsigned MaxDecodeThreads = 8;
+
 int32_t
 read4(const uint8_t* in)
 {
@@ -24,6 +31,248 @@ read4(const uint8_t* in)
     |    (static_cast<int32_t>(in[0])      );
 }
 
+// Allocates directly from the System, which, unlike the Allocator
+// passed to decodeLZMA, may be used by several threads at once.
+class SystemLzmaAllocator {
+ public:
+  SystemLzmaAllocator(System* s): s(s) {
+    allocator.Alloc = allocate;
+    allocator.Free = free;
+  }
+
+  ISzAlloc allocator;
+  System* s;
+
+  static void* allocate(void* allocator, size_t size) {
+    return static_cast<SystemLzmaAllocator*>(allocator)->s->tryAllocate(size);
+  }
+
+  static void free(void* allocator, void* address) {
+    if (address) {
+      static_cast<SystemLzmaAllocator*>(allocator)->s->free(address);
+    }
+  }
+};
+
+bool
+decode(System* s, const uint8_t* in, unsigned inSize, uint8_t* out,
+       unsigned outSize)
+{
+  if (inSize < HeaderSize or read4(in + PropHeaderSize) != int32_t(outSize)) {
+    return false;
+  }
+
+  SizeT outSizeT = outSize;
+  SizeT inSizeT = inSize - HeaderSize;
+  SystemLzmaAllocator allocator(s);
+
+  ELzmaStatus status;
+  int result = LzmaDecode
+    (out, &outSizeT, in + HeaderSize, &inSizeT, in, PropHeaderSize,
+     LZMA_FINISH_END, &status, &(allocator.allocator));
+
+  return result == SZ_OK and status == LZMA_STATUS_FINISHED_WITH_MARK
+    and outSizeT == outSize;
+}
+
+// The header and block table of an image made by encodeLZMABlocks.
+class Blocks {
+ public:
+  Blocks(System* s, Allocator* a, const uint8_t* in, unsigned inSize):
+    s(s),
+    a(a),
+    size(read4(in + 4)),
+    blockSize(read4(in + 8)),
+    count(checkedCount(s, in, inSize, size, blockSize)),
+    offsets(static_cast<unsigned*>
+            (a->allocate(sizeof(unsigned) * (count + 1)))),
+    in(in)
+  {
+    unsigned offset = BlocksHeaderSize + (count * 4);
+    for (unsigned i = 0; i < count; ++i) {
+      unsigned length = read4(in + BlocksHeaderSize + (i * 4));
+      expect(s, length <= inSize - offset);
+
+      offsets[i] = offset;
+      offset += length;
+    }
+    offsets[count] = offset;
+  }
+
+  // Returns the block count from the header of an image, having
+  // checked that it agrees with the sizes given there and that the
+  // block table fits in the image.
+  static unsigned checkedCount(System* s, const uint8_t* in, unsigned inSize,
+                               unsigned size, unsigned blockSize)
+  {
+    unsigned count = read4(in + 12);
+    expect(s, blockSize > 0);
+    expect(s, count == (size / blockSize) + (size % blockSize ? 1 : 0));
+    expect(s, count <= (inSize - BlocksHeaderSize) / 4);
+    return count;
+  }
+
+  unsigned length(unsigned block) {
+    return block == count - 1 ? size - (block * blockSize) : blockSize;
+  }
+
+  bool decode(unsigned block, uint8_t* out) {
+    return ::decode(s, in + offsets[block], offsets[block + 1] - offsets[block],
+                    out + (block * blockSize), length(block));
+  }
+
+  void dispose() {
+    a->free(offsets, sizeof(unsigned) * (count + 1));
+  }
+
+  System* s;
+  Allocator* a;
+  unsigned size;
+  unsigned blockSize;
+  unsigned count;
+  unsigned* offsets;
+  const uint8_t* in;
+};
+
+// Decodes every threadCount'th block, starting with the index'th.
+class Decoder: public System::Runnable {
+ public:
+  Decoder(Blocks* blocks, uint8_t* out, unsigned index, unsigned threadCount):
+    blocks(blocks), out(out), index(index), threadCount(threadCount),
+    thread(0), success(true)
+  { }
+
+  virtual void attach(System::Thread* t) {
+    thread = t;
+  }
+
+  virtual void run() {
+    for (unsigned i = index; i < blocks->count; i += threadCount) {
+      if (not blocks->decode(i, out)) {
+        success = false;
+      }
+    }
+  }
+
+  virtual bool interrupted() {
+    return false;
+  }
+
+  virtual void setInterrupted(bool) {
+    // ignore
+  }
+
+  Blocks* blocks;
+  uint8_t* out;
+  unsigned index;
+  unsigned threadCount;
+  System::Thread* thread;
+  bool success;
+};
+
+uint8_t*
+decodeBlocks(System* s, Allocator* a, uint8_t* in, unsigned inSize,
+             unsigned* outSize)
+{
+  Blocks blocks(s, a, in, inSize);
+
+  uint8_t* out = static_cast<uint8_t*>(a->allocate(blocks.size));
+
+  unsigned threadCount = blocks.count < MaxDecodeThreads
+    ? blocks.count : MaxDecodeThreads;
+
+  Decoder* decoders = static_cast<Decoder*>
+    (a->allocate(sizeof(Decoder) * (threadCount ? threadCount : 1)));
+
+  // this thread decodes its share of the blocks as well, and also
+  // takes on the share of any thread we couldn't start
+  for (unsigned i = 0; i < threadCount; ++i) {
+    new (decoders + i) Decoder(&blocks, out, i, threadCount);
+    if (i and not s->success(s->start(decoders + i))) {
+      decoders[i].thread = 0;
+    }
+  }
+
+  bool success = true;
+  for (unsigned i = 0; i < threadCount; ++i) {
+    if (i == 0 or decoders[i].thread == 0) {
+      decoders[i].run();
+    } else {
+      decoders[i].thread->join();
+      decoders[i].thread->dispose();
+    }
+    success = success and decoders[i].success;
+  }
+
+  a->free(decoders, sizeof(Decoder) * (threadCount ? threadCount : 1));
+  blocks.dispose();
+
+  expect(s, success);
+
+  *outSize = blocks.size;
+
+  return out;
+}
+
+class MyLZMARegion: public LZMARegion {
+ public:
+  MyLZMARegion(System* s, Allocator* a, const uint8_t* in, unsigned inSize):
+    s(s),
+    a(a),
+    blocks(s, a, in, inSize),
+    data(static_cast<uint8_t*>(a->allocate(blocks.size))),
+    decoded(static_cast<bool*>(a->allocate(blocks.count))),
+    lock(0)
+  {
+    expect(s, s->success(s->make(&lock)));
+    memset(decoded, 0, blocks.count);
+  }
+
+  virtual const uint8_t* start() {
+    return data;
+  }
+
+  virtual size_t length() {
+    return blocks.size;
+  }
+
+  virtual void ensure(unsigned offset, unsigned length) {
+    if (length == 0 or offset >= blocks.size) {
+      return;
+    }
+
+    if (length > blocks.size - offset) {
+      length = blocks.size - offset;
+    }
+
+    unsigned last = (offset + length - 1) / blocks.blockSize;
+
+    lock->acquire();
+    for (unsigned i = offset / blocks.blockSize; i <= last; ++i) {
+      if (not decoded[i]) {
+        expect(s, blocks.decode(i, data));
+        decoded[i] = true;
+      }
+    }
+    lock->release();
+  }
+
+  virtual void dispose() {
+    lock->dispose();
+    a->free(decoded, blocks.count);
+    a->free(data, blocks.size);
+    blocks.dispose();
+    a->free(this, sizeof(*this));
+  }
+
+  System* s;
+  Allocator* a;
+  Blocks blocks;
+  uint8_t* data;
+  bool* decoded;
+  System::Mutex* lock;
+};
+
 } // namespace
 
 namespace vm {
@@ -32,8 +281,9 @@ uint8_t*
 decodeLZMA(System* s, Allocator* a, uint8_t* in, unsigned inSize,
            unsigned* outSize)
 {
-  const unsigned PropHeaderSize = 5;
-  const unsigned HeaderSize = 13;
+  if (isLZMABlocks(in, inSize)) {
+    return decodeBlocks(s, a, in, inSize, outSize);
+  }
 
   int32_t outSize32 = read4(in + PropHeaderSize);
   expect(s, outSize32 >= 0);
@@ -57,5 +307,19 @@ decodeLZMA(System* s, Allocator* a, uint8_t* in, unsigned inSize,
   return out;
 }
 
-} // namespace vm
+bool
+isLZMABlocks(const uint8_t* in, unsigned inSize)
+{
+  return inSize >= BlocksHeaderSize and uint32_t(read4(in)) == BlocksMagic;
+}
+
+LZMARegion*
+makeLZMARegion(System* s, Allocator* a, const uint8_t* in, unsigned inSize)
+{
+  expect(s, isLZMABlocks(in, inSize));
 
+  return new (a->allocate(sizeof(MyLZMARegion)))
+    MyLZMARegion(s, a, in, inSize);
+}
+
+} // namespace vm
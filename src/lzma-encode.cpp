@@ -21,6 +21,15 @@ myProgress(void*, UInt64, UInt64)
   return SZ_OK;
 }
 
+void
+write4(uint8_t* out, uint32_t v)
+{
+  out[0] = v;
+  out[1] = v >> 8;
+  out[2] = v >> 16;
+  out[3] = v >> 24;
+}
+
 } // namespace
 
 namespace vm {
@@ -67,5 +76,53 @@ encodeLZMA(System* s, Allocator* a, uint8_t* in, unsigned inSize,
   return out;
 }
 
+uint8_t*
+encodeLZMABlocks(System* s, Allocator* a, uint8_t* in, unsigned inSize,
+                 unsigned blockSize, unsigned* outSize)
+{
+  expect(s, blockSize > 0);
+
+  unsigned count = (inSize + blockSize - 1) / blockSize;
+  unsigned tableSize = BlocksHeaderSize + (count * 4);
+
+  uint8_t** blocks = static_cast<uint8_t**>
+    (a->allocate(sizeof(uint8_t*) * (count ? count : 1)));
+  unsigned* sizes = static_cast<unsigned*>
+    (a->allocate(sizeof(unsigned) * (count ? count : 1)));
+
+  unsigned total = tableSize;
+  for (unsigned i = 0; i < count; ++i) {
+    unsigned offset = i * blockSize;
+    unsigned length = inSize - offset < blockSize
+      ? inSize - offset : blockSize;
+
+    blocks[i] = encodeLZMA(s, a, in + offset, length, sizes + i);
+    total += sizes[i];
+  }
+
+  uint8_t* out = static_cast<uint8_t*>(a->allocate(total));
+
+  write4(out, BlocksMagic);
+  write4(out + 4, inSize);
+  write4(out + 8, blockSize);
+  write4(out + 12, count);
+
+  unsigned offset = tableSize;
+  for (unsigned i = 0; i < count; ++i) {
+    write4(out + BlocksHeaderSize + (i * 4), sizes[i]);
+    memcpy(out + offset, blocks[i], sizes[i]);
+    offset += sizes[i];
+
+    a->free(blocks[i], sizes[i]);
+  }
+
+  a->free(sizes, sizeof(unsigned) * (count ? count : 1));
+  a->free(blocks, sizeof(uint8_t*) * (count ? count : 1));
+
+  *outSize = total;
+
+  return out;
+}
+
 } // namespace vm
 
@@ -23,6 +23,7 @@
 #  include <dlfcn.h>
 #  include <unistd.h>
 #  include <errno.h>
+#  include <pthread.h>
 #  define O_BINARY 0
 #endif
 
@@ -41,6 +42,18 @@ extern "C" {
 
 namespace {
 
+const unsigned PropHeaderSize = 5;
+const unsigned HeaderSize = 13;
+
+// see src/avian/lzma-util.h for the layout of an image made of
+// independently compressed blocks
+const uint32_t BlocksMagic = 0x425a4cff;
+const unsigned BlocksHeaderSize = 16;
+
+// the most threads we'll use to decode such an image, including the
+// main one
+const unsigned MaxDecodeThreads = 8;
+
 int32_t
 read4(const uint8_t* in)
 {
@@ -62,6 +75,165 @@ myFree(void*, void* address)
   free(address);
 }
 
+bool
+decode(const uint8_t* in, SizeT inSize, uint8_t* out, SizeT* outSize)
+{
+  ISzAlloc allocator = { myAllocate, myFree };
+  ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+
+  return SZ_OK == LzmaDecode
+    (out, outSize, in + HeaderSize, &inSize, in, PropHeaderSize,
+     LZMA_FINISH_END, &status, &allocator);
+}
+
+// Decodes every threadCount'th block of an image made of independently
+// compressed blocks, starting with the index'th.
+class Decoder {
+ public:
+  const uint8_t* in;
+  const unsigned* offsets;
+  uint8_t* out;
+  unsigned size;
+  unsigned blockSize;
+  unsigned count;
+  unsigned index;
+  unsigned threadCount;
+  bool success;
+
+  void run() {
+    for (unsigned i = index; i < count; i += threadCount) {
+      SizeT length = i == count - 1 ? size - (i * blockSize) : blockSize;
+      SizeT expected = length;
+      if (not (decode(in + offsets[i], offsets[i + 1] - offsets[i] - HeaderSize,
+                      out + (i * blockSize), &length)
+               and length == expected))
+      {
+        success = false;
+      }
+    }
+  }
+};
+
+#if (defined __MINGW32__) || (defined _MSC_VER)
+
+DWORD WINAPI
+runDecoder(void* decoder)
+{
+  static_cast<Decoder*>(decoder)->run();
+  return 0;
+}
+
+void*
+startDecoder(Decoder* decoder)
+{
+  return CreateThread(0, 0, runDecoder, decoder, 0, 0);
+}
+
+void
+joinDecoder(void* thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+#else
+
+void*
+runDecoder(void* decoder)
+{
+  static_cast<Decoder*>(decoder)->run();
+  return 0;
+}
+
+void*
+startDecoder(Decoder* decoder)
+{
+  pthread_t* thread = static_cast<pthread_t*>(malloc(sizeof(pthread_t)));
+  if (thread and pthread_create(thread, 0, runDecoder, decoder) == 0) {
+    return thread;
+  } else {
+    free(thread);
+    return 0;
+  }
+}
+
+void
+joinDecoder(void* thread)
+{
+  pthread_join(*static_cast<pthread_t*>(thread), 0);
+  free(thread);
+}
+
+#endif
+
+// Decodes an image made of independently compressed blocks, using
+// several threads at once.
+bool
+decodeBlocks(const uint8_t* in, SizeT inSize, uint8_t* out, SizeT* outSize)
+{
+  unsigned size = read4(in + 4);
+  unsigned blockSize = read4(in + 8);
+  unsigned count = read4(in + 12);
+
+  if (blockSize == 0
+      or count != (size + blockSize - 1) / blockSize
+      or BlocksHeaderSize + (count * 4) > inSize)
+  {
+    return false;
+  }
+
+  if (*outSize < size) {
+    return false;
+  }
+
+  unsigned* offsets = static_cast<unsigned*>
+    (malloc(sizeof(unsigned) * (count + 1)));
+  if (offsets == 0) {
+    return false;
+  }
+
+  unsigned offset = BlocksHeaderSize + (count * 4);
+  bool success = true;
+  for (unsigned i = 0; i < count; ++i) {
+    offsets[i] = offset;
+    offset += read4(in + BlocksHeaderSize + (i * 4));
+    if (offset > inSize or offset - offsets[i] < HeaderSize) {
+      success = false;
+    }
+  }
+  offsets[count] = offset;
+
+  const unsigned threadCount = count < MaxDecodeThreads
+    ? count : MaxDecodeThreads;
+  Decoder decoders[MaxDecodeThreads];
+  void* threads[MaxDecodeThreads];
+
+  if (success) {
+    // the main thread decodes its share as well, plus that of any
+    // thread we couldn't start
+    for (unsigned i = 0; i < threadCount; ++i) {
+      Decoder d = { in, offsets, out, size, blockSize, count, i,
+                    threadCount, true };
+      decoders[i] = d;
+      threads[i] = i ? startDecoder(decoders + i) : 0;
+    }
+
+    for (unsigned i = 0; i < threadCount; ++i) {
+      if (threads[i]) {
+        joinDecoder(threads[i]);
+      } else {
+        decoders[i].run();
+      }
+      success = success and decoders[i].success;
+    }
+  }
+
+  free(offsets);
+
+  *outSize = size;
+  return success;
+}
+
 #if (defined __MINGW32__) || (defined _MSC_VER)
 
 void*
@@ -131,22 +303,20 @@ temporaryFileName(char* buffer, unsigned)
 int
 main(int ac, const char** av)
 {
-  const unsigned PropHeaderSize = 5;
-  const unsigned HeaderSize = 13;
-
   SizeT inSize = SYMBOL(end) - SYMBOL(start);
 
-  int32_t outSize32 = read4(SYMBOL(start) + PropHeaderSize);
+  bool blocks = inSize >= BlocksHeaderSize
+    and static_cast<uint32_t>(read4(SYMBOL(start))) == BlocksMagic;
+
+  int32_t outSize32 = read4
+    (SYMBOL(start) + (blocks ? 4 : PropHeaderSize));
   SizeT outSize = outSize32;
 
   uint8_t* out = static_cast<uint8_t*>(malloc(outSize));
   if (out) {
-    ISzAlloc allocator = { myAllocate, myFree };
-    ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
-
-    if (SZ_OK == LzmaDecode
-        (out, &outSize, SYMBOL(start) + HeaderSize, &inSize, SYMBOL(start),
-         PropHeaderSize, LZMA_FINISH_END, &status, &allocator))
+    if (blocks
+        ? decodeBlocks(SYMBOL(start), inSize, out, &outSize)
+        : decode(SYMBOL(start), inSize - HeaderSize, out, &outSize))
     {
       const unsigned BufferSize = 1024;
       char buffer[BufferSize];
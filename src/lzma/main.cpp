@@ -44,12 +44,190 @@ myProgress(void*, UInt64, UInt64)
   return SZ_OK;
 }
 
+const unsigned PropHeaderSize = 5;
+const unsigned HeaderSize = 13;
+
+// see src/avian/lzma-util.h for the layout of an image made of
+// independently compressed blocks
+const uint32_t BlocksMagic = 0x425a4cff;
+const unsigned BlocksHeaderSize = 16;
+
+void
+write4(uint8_t* out, uint32_t v)
+{
+  out[0] = v;
+  out[1] = v >> 8;
+  out[2] = v >> 16;
+  out[3] = v >> 24;
+}
+
+// encodes one block, returning its size, or zero on failure
+SizeT
+encodeBlock(const uint8_t* in, SizeT inSize, uint8_t* out, SizeT outSize)
+{
+  ISzAlloc allocator = { myAllocate, myFree };
+  CLzmaEncProps props;
+  LzmaEncProps_Init(&props);
+  props.level = 9;
+  props.writeEndMark = 1;
+
+  ICompressProgress progress = { myProgress };
+
+  SizeT propsSize = PropHeaderSize;
+
+  memset(out + PropHeaderSize, 0, HeaderSize - PropHeaderSize);
+  write4(out + PropHeaderSize, inSize);
+
+  outSize -= HeaderSize;
+  int result = LzmaEncode
+    (out + HeaderSize, &outSize, in, inSize, &props, out, &propsSize, 1,
+     &progress, &allocator, &allocator);
+
+  return result == SZ_OK ? outSize + HeaderSize : 0;
+}
+
+bool
+decodeBlock(const uint8_t* in, SizeT inSize, uint8_t* out, SizeT outSize)
+{
+  ISzAlloc allocator = { myAllocate, myFree };
+  ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+  SizeT expected = outSize;
+
+  inSize -= HeaderSize;
+  int result = LzmaDecode
+    (out, &outSize, in + HeaderSize, &inSize, in, PropHeaderSize,
+     LZMA_FINISH_END, &status, &allocator);
+
+  return result == SZ_OK and outSize == expected;
+}
+
+bool
+isBlocks(const uint8_t* in, unsigned inSize)
+{
+  return inSize >= BlocksHeaderSize
+    and static_cast<uint32_t>(read4(in)) == BlocksMagic;
+}
+
+uint8_t*
+encodeBlocks(const uint8_t* in, unsigned inSize, unsigned blockSize,
+             SizeT* outSize)
+{
+  unsigned count = (inSize + blockSize - 1) / blockSize;
+  unsigned tableSize = BlocksHeaderSize + (count * 4);
+
+  // leave room for blocks which don't compress
+  SizeT capacity = tableSize + (inSize * 2) + (count * HeaderSize);
+  uint8_t* out = static_cast<uint8_t*>(malloc(capacity));
+  if (out == 0) {
+    fprintf(stderr, "unable to allocate output buffer\n");
+    return 0;
+  }
+
+  write4(out, BlocksMagic);
+  write4(out + 4, inSize);
+  write4(out + 8, blockSize);
+  write4(out + 12, count);
+
+  SizeT offset = tableSize;
+  for (unsigned i = 0; i < count; ++i) {
+    unsigned start = i * blockSize;
+    unsigned length = inSize - start < blockSize ? inSize - start : blockSize;
+
+    SizeT size = encodeBlock
+      (in + start, length, out + offset, capacity - offset);
+    if (size == 0) {
+      fprintf(stderr, "unable to encode block %d\n", i);
+      free(out);
+      return 0;
+    }
+
+    write4(out + BlocksHeaderSize + (i * 4), size);
+    offset += size;
+  }
+
+  *outSize = offset;
+  return out;
+}
+
+uint8_t*
+decodeBlocks(const uint8_t* in, unsigned inSize, SizeT* outSize)
+{
+  unsigned size = read4(in + 4);
+  unsigned blockSize = read4(in + 8);
+  unsigned count = read4(in + 12);
+
+  if (blockSize == 0
+      or count != (size + blockSize - 1) / blockSize
+      or BlocksHeaderSize + (count * 4) > inSize)
+  {
+    fprintf(stderr, "invalid block table\n");
+    return 0;
+  }
+
+  uint8_t* out = static_cast<uint8_t*>(malloc(size ? size : 1));
+  if (out == 0) {
+    fprintf(stderr, "unable to allocate output buffer\n");
+    return 0;
+  }
+
+  unsigned offset = BlocksHeaderSize + (count * 4);
+  for (unsigned i = 0; i < count; ++i) {
+    unsigned length = read4(in + BlocksHeaderSize + (i * 4));
+    unsigned start = i * blockSize;
+    if (length < HeaderSize
+        or length > inSize - offset
+        or not decodeBlock(in + offset, length, out + start,
+                           i == count - 1 ? size - start : blockSize))
+    {
+      fprintf(stderr, "unable to decode block %d\n", i);
+      free(out);
+      return 0;
+    }
+    offset += length;
+  }
+
+  *outSize = size;
+  return out;
+}
+
+bool
+writeFile(const char* name, const uint8_t* data, SizeT size)
+{
+  bool success = false;
+  FILE* outFile = fopen(name, "wb");
+
+  if (outFile) {
+    if (fwrite(data, size, 1, outFile) == 1) {
+      success = true;
+    } else {
+      fprintf(stderr, "unable to write to %s\n", name);
+    }
+
+    fclose(outFile);
+  } else {
+    fprintf(stderr, "unable to open %s\n", name);
+  }
+
+  return success;
+}
+
+void
+unmap(uint8_t* data, unsigned size)
+{
+#ifdef WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(data, size);
+#endif
+}
+
 void
 usageAndExit(const char* program)
 {
   fprintf(stderr,
-          "usage: %s {encode|decode} <input file> <output file> "
-          "[<uncompressed size>]", program);
+          "usage: %s encode <input file> <output file> [<block size>]\n"
+          "       %s decode <input file> <output file> "
+          "[<uncompressed size>]\n", program, program);
   exit(-1);
 }
 
@@ -101,10 +279,28 @@ main(int argc, const char** argv)
 
   bool success = false;
 
-  if (data) {
-    const unsigned PropHeaderSize = 5;
-    const unsigned HeaderSize = 13;
+  // a block size given to encode, or a block table found when
+  // decoding, means an image of independently compressed blocks
+  if (data and (encode ? argc == 5 : isBlocks(data, size))) {
+    SizeT outSize;
+    uint8_t* out;
+    if (encode) {
+      int blockSize = atoi(argv[4]);
+      out = blockSize > 0 ? encodeBlocks(data, size, blockSize, &outSize) : 0;
+      if (blockSize <= 0) {
+        fprintf(stderr, "invalid block size: %s\n", argv[4]);
+      }
+    } else {
+      out = decodeBlocks(data, size, &outSize);
+    }
+
+    if (out) {
+      success = writeFile(argv[3], out, outSize);
+      free(out);
+    }
 
+    unmap(data, size);
+  } else if (data) {
     SizeT outSize;
     if (encode) {
       outSize = size * 2;
@@ -151,19 +347,7 @@ main(int argc, const char** argv)
         }
 
         if (result == SZ_OK) {
-          FILE* outFile = fopen(argv[3], "wb");
-
-          if (outFile) {
-            if (fwrite(out, outSize, 1, outFile) == 1) {
-              success = true;
-            } else {
-              fprintf(stderr, "unable to write to %s\n", argv[3]);
-            }
-
-            fclose(outFile);
-          } else {
-            fprintf(stderr, "unable to open %s\n", argv[3]);
-          }
+          success = writeFile(argv[3], out, outSize);
         } else {
           fprintf(stderr, "unable to %s data: result %d status %d\n",
                   encode ? "encode" : "decode", result, status);
@@ -177,11 +361,7 @@ main(int argc, const char** argv)
       fprintf(stderr, "unable to determine uncompressed size\n");
     }
 
-#ifdef WIN32
-    UnmapViewOfFile(data);
-#else
-    munmap(data, size);
-#endif
+    unmap(data, size);
   } else {
     perror(argv[0]);
   }
@@ -16,6 +16,7 @@
 #include "avian/processor.h"
 #include "avian/arch.h"
 #include "avian/lzma.h"
+#include "avian/lz.h"
 
 #include <avian/util/runtime-array.h>
 #include <avian/util/math.h>
@@ -32,6 +33,8 @@ namespace {
 
 const bool DebugClassReader = false;
 
+const bool DebugFieldLayout = false;
+
 const unsigned NoByte = 0xFFFF;
 
 #ifdef USE_ATOMIC_OPERATIONS
@@ -502,6 +505,60 @@ clearTargetIfFinalizable(Thread* t, object r)
   }
 }
 
+void
+logAllocationSite(FILE* log, AllocationSite* site, const char* prefix)
+{
+  fprintf(log, "%s %s@%d: %d allocated, %d of %d samples tenured\n",
+          prefix, site->name, site->ip, site->allocationCount,
+          site->survivorCount, site->survivorCount + site->deathCount);
+  fflush(log);
+}
+
+void
+visitAllocationSites(Thread* t)
+{
+  Machine* m = t->m;
+
+  for (AllocationSite* site = m->allocationSites; site; site = site->next) {
+    for (unsigned i = 0; i < AllocationSiteSampleCount; ++i) {
+      object o = site->samples[i];
+      if (o) {
+        switch (m->heap->status(o)) {
+        case Heap::Unreachable:
+          ++ site->deathCount;
+          site->samples[i] = 0;
+          break;
+
+        case Heap::Tenured:
+          ++ site->survivorCount;
+          site->samples[i] = 0;
+          break;
+
+        default:
+          site->samples[i] = static_cast<object>(m->heap->follow(o));
+          break;
+        }
+      }
+    }
+
+    unsigned total = site->survivorCount + site->deathCount;
+    if ((not site->pretenured)
+        and total >= PretenureMinimumSamples
+        and site->survivorCount * 100 >= total * PretenureSurvivalPercent)
+    {
+      site->pretenured = true;
+
+      // samples taken from here on would be tenured from birth and
+      // tell us nothing, so we stop tracking them:
+      memset(site->samples, 0, sizeof(site->samples));
+
+      if (m->pretenureLog) {
+        logAllocationSite(m->pretenureLog, site, "pretenure");
+      }
+    }
+  }
+}
+
 void
 postVisit(Thread* t, Heap::Visitor* v)
 {
@@ -512,6 +569,12 @@ postVisit(Thread* t, Heap::Visitor* v)
 
   m->heap->postVisit();
 
+  // sweep the weak tables before any finalizable objects are revived
+  // below, so that entries for unreachable keys are dropped
+  weakHashMapSweep(t, v, root(t, Machine::StringMap));
+  weakHashMapSweep(t, v, root(t, Machine::ByteArrayMap));
+  weakHashMapSweep(t, v, root(t, Machine::MonitorMap));
+
   for (object p = m->weakReferences; p;) {
     object r = static_cast<object>(m->heap->follow(p));
     p = jreferenceVmNext(t, r);
@@ -683,6 +746,8 @@ postVisit(Thread* t, Heap::Visitor* v)
       }
     }
   }
+
+  visitAllocationSites(t);
 }
 
 void
@@ -876,27 +941,27 @@ makeByteArray(Thread* t, Stream& s, unsigned length)
   return value;
 }
 
-void
-removeByteArray(Thread* t, object o)
-{
-  hashMapRemove
-    (t, root(t, Machine::ByteArrayMap), o, byteArrayHash, objectEqual);
-}
-
 object
 internByteArray(Thread* t, object array)
 {
+  uint32_t hash = byteArrayHash(t, array);
+
+  object n = weakHashMapFindNode
+    (t, root(t, Machine::ByteArrayMap), array, hash, byteArrayEqual);
+  if (n) {
+    return weakHashMapNodeKey(t, n);
+  }
+
   PROTECT(t, array);
 
   ACQUIRE(t, t->m->referenceLock);
 
-  object n = hashMapFindNode
-    (t, root(t, Machine::ByteArrayMap), array, byteArrayHash, byteArrayEqual);
+  n = weakHashMapFindNode
+    (t, root(t, Machine::ByteArrayMap), array, hash, byteArrayEqual);
   if (n) {
-    return jreferenceTarget(t, tripleFirst(t, n));
+    return weakHashMapNodeKey(t, n);
   } else {
-    hashMapInsert(t, root(t, Machine::ByteArrayMap), array, 0, byteArrayHash);
-    addFinalizer(t, array, removeByteArray);
+    weakHashMapInsert(t, root(t, Machine::ByteArrayMap), array, 0, hash);
     return array;
   }
 }
@@ -1203,17 +1268,162 @@ parseInterfaceTable(Thread* t, Stream& s, object class_, object pool,
   set(t, class_, ClassInterfaceTable, interfaceTable);
 }
 
+bool
+isBootstrapType(Thread* t, object class_)
+{
+  return hashMapFind
+    (t, root(t, Machine::BootstrapClassMap), className(t, class_),
+     byteArrayHash, byteArrayEqual) != 0;
+}
+
+unsigned
+findFieldSlot(uint8_t* used, unsigned limit, unsigned size)
+{
+  for (unsigned offset = pad(BytesPerWord, size); offset + size <= limit;
+       offset += size)
+  {
+    bool free = true;
+    for (unsigned i = 0; i < size; ++i) {
+      if (used[offset + i]) {
+        free = false;
+        break;
+      }
+    }
+
+    if (free) {
+      return offset;
+    }
+  }
+  return 0;
+}
+
+unsigned
+layoutInstanceFields(Thread* t, object class_, object fieldTable)
+{
+  object super = classSuper(t, class_);
+  unsigned superSize = super ? classFixedSize(t, super) : BytesPerWord;
+  unsigned memberOffset = superSize;
+
+  // the VM accesses bootstrap types (and any fields it adds to them)
+  // at offsets fixed by the type generator, so those must be laid out
+  // in declaration order
+  if (isBootstrapType(t, class_)) {
+    if (fieldTable) {
+      for (unsigned i = 0; i < arrayLength(t, fieldTable); ++i) {
+        object field = arrayBody(t, fieldTable, i);
+        if ((fieldFlags(t, field) & ACC_STATIC) == 0) {
+          unsigned size = fieldSize(t, field);
+          while (memberOffset % size) {
+            ++ memberOffset;
+          }
+
+          fieldOffset(t, field) = memberOffset;
+
+          memberOffset += size;
+        }
+      }
+    }
+
+    return memberOffset;
+  }
+
+  // if every ancestor's layout is described entirely by its field
+  // table, we can find the holes it left and fill them with our own
+  // fields; otherwise, we start after the end of the superclass.  A
+  // bootstrap type may have slots its field table doesn't mention, so
+  // only a chain of packed classes leading directly to the root
+  // qualifies, and anything extending a bootstrap type other than the
+  // root never does.
+  bool packed = super == 0 or classSuper(t, super) == 0
+    or (classVmFlags(t, super) & PackedFlag);
+
+  if (packed) {
+    classVmFlags(t, class_) |= PackedFlag;
+  }
+
+  unsigned holeLimit = (super and packed) ? superSize : 0;
+
+  THREAD_RUNTIME_ARRAY(t, uint8_t, used, holeLimit + 1);
+  if (holeLimit) {
+    memset(RUNTIME_ARRAY_BODY(used), 0, holeLimit);
+    memset(RUNTIME_ARRAY_BODY(used), 1, BytesPerWord);
+
+    for (object c = super; c; c = classSuper(t, c)) {
+      object table = classFieldTable(t, c);
+      if (table) {
+        for (unsigned i = 0; i < arrayLength(t, table); ++i) {
+          object field = arrayBody(t, table, i);
+          if ((fieldFlags(t, field) & ACC_STATIC) == 0) {
+            memset(RUNTIME_ARRAY_BODY(used) + fieldOffset(t, field), 1,
+                   fieldSize(t, field));
+          }
+        }
+      }
+    }
+  }
+
+  unsigned declaredOffset = superSize;
+
+  if (fieldTable) {
+    // place the largest fields first so that each one is naturally
+    // aligned without padding, preserving declaration order among
+    // fields of the same size
+    for (unsigned size = 8; size; size /= 2) {
+      for (unsigned i = 0; i < arrayLength(t, fieldTable); ++i) {
+        object field = arrayBody(t, fieldTable, i);
+        if ((fieldFlags(t, field) & ACC_STATIC) == 0
+            and fieldSize(t, field) == size)
+        {
+          unsigned offset = holeLimit
+            ? findFieldSlot(RUNTIME_ARRAY_BODY(used), holeLimit, size) : 0;
+
+          if (offset) {
+            memset(RUNTIME_ARRAY_BODY(used) + offset, 1, size);
+          } else {
+            while (memberOffset % size) {
+              ++ memberOffset;
+            }
+
+            offset = memberOffset;
+
+            memberOffset += size;
+          }
+
+          fieldOffset(t, field) = offset;
+        }
+      }
+    }
+
+    if (DebugFieldLayout) {
+      for (unsigned i = 0; i < arrayLength(t, fieldTable); ++i) {
+        object field = arrayBody(t, fieldTable, i);
+        if ((fieldFlags(t, field) & ACC_STATIC) == 0) {
+          unsigned size = fieldSize(t, field);
+          while (declaredOffset % size) {
+            ++ declaredOffset;
+          }
+          declaredOffset += size;
+        }
+      }
+    }
+  }
+
+  if (DebugFieldLayout and pad(declaredOffset) != pad(memberOffset)) {
+    fprintf(stderr, "packed %s from %d to %d bytes (saved %d)\n",
+            &byteArrayBody(t, className(t, class_), 0),
+            pad(declaredOffset), pad(memberOffset),
+            pad(declaredOffset) - pad(memberOffset));
+  }
+
+  return memberOffset;
+}
+
 void
 parseFieldTable(Thread* t, Stream& s, object class_, object pool)
 {
   PROTECT(t, class_);
   PROTECT(t, pool);
 
-  unsigned memberOffset = BytesPerWord;
-  if (classSuper(t, class_)) {
-    memberOffset = classFixedSize(t, classSuper(t, class_));
-  }
-
   unsigned count = s.read2();
   if (count) {
     unsigned staticOffset = BytesPerWord * 3;
@@ -1308,13 +1518,8 @@ parseFieldTable(Thread* t, Stream& s, object class_, object pool)
           classVmFlags(t, class_) |= HasFinalMemberFlag;
         }
 
-        while (memberOffset % size) {
-          ++ memberOffset;
-        }
-
-        fieldOffset(t, field) = memberOffset;
-
-        memberOffset += size;
+        // instance field offsets are assigned by layoutInstanceFields
+        // once we've seen all of them
       }
 
       set(t, fieldTable, ArrayBody + (i * BytesPerWord), field);
@@ -1385,10 +1590,31 @@ parseFieldTable(Thread* t, Stream& s, object class_, object pool)
     }
   }
 
+  unsigned memberOffset = layoutInstanceFields
+    (t, class_, classFieldTable(t, class_));
+
   classFixedSize(t, class_) = pad(memberOffset);
-  
+
+  bool sawInstanceReferenceField = false;
+  object fieldTable = classFieldTable(t, class_);
+  if (fieldTable) {
+    for (unsigned i = 0; i < arrayLength(t, fieldTable); ++i) {
+      object field = arrayBody(t, fieldTable, i);
+      if ((fieldFlags(t, field) & ACC_STATIC) == 0
+          and fieldCode(t, field) == ObjectField)
+      {
+        sawInstanceReferenceField = true;
+        break;
+      }
+    }
+  }
+
+  // fields placed in holes left by the superclass don't change the
+  // fixed size, so we can only share the superclass mask if none of
+  // them are references
   if (classSuper(t, class_)
-      and memberOffset == classFixedSize(t, classSuper(t, class_)))
+      and memberOffset <= classFixedSize(t, classSuper(t, class_))
+      and not sawInstanceReferenceField)
   {
     set(t, class_, ClassObjectMask,
         classObjectMask(t, classSuper(t, class_)));
@@ -1410,7 +1636,6 @@ parseFieldTable(Thread* t, Stream& s, object class_, object pool)
     }
 
     bool sawReferenceField = false;
-    object fieldTable = classFieldTable(t, class_);
     if (fieldTable) {
       for (int i = arrayLength(t, fieldTable) - 1; i >= 0; --i) {
         object field = arrayBody(t, fieldTable, i);
@@ -1808,6 +2033,18 @@ disassembleCode(const char* prefix, uint8_t* code, unsigned length)
   }
 }
 
+class ParseClient: public Stream::Client {
+ public:
+  ParseClient(Thread* t): t(t) { }
+
+  virtual void NO_RETURN handleError() {
+    abort(t);
+  }
+
+ private:
+  Thread* t;
+};
+
 object
 parseCode(Thread* t, Stream& s, object pool)
 {
@@ -1869,6 +2106,51 @@ parseCode(Thread* t, Stream& s, object pool)
   return code;
 }
 
+// Where a method's code attribute may be found once it is needed.
+// This is stored in the body of the placeholder code object which
+// stands in for the real one until then.
+struct LazyCode {
+  const uint8_t* start;
+  unsigned length;
+};
+
+// Returns a placeholder for the code attribute of the specified
+// length at the current position of the stream, skipping over it, or
+// zero if the attribute should be parsed right away instead.
+object
+makeLazyCode(Thread* t, Stream& s, const uint8_t* data, unsigned length,
+             object pool)
+{
+  unsigned position = s.position();
+  const uint8_t* start = data + position;
+
+  // let parseCode deal with malformed attributes
+  if (length < 9) {
+    return 0;
+  }
+
+  unsigned maxStack = s.read2();
+  unsigned maxLocals = s.read2();
+  s.skip(length - 4);
+
+  // parse empty methods eagerly so that emptyMethod need not load
+  // anything
+  if (start[4] == 0 and start[5] == 0 and start[6] == 0 and start[7] == 1
+      and start[8] == return_)
+  {
+    s.setPosition(position);
+    return 0;
+  }
+
+  LazyCode lazy = { start, length };
+
+  object code = makeCode
+    (t, pool, 0, 0, 0, 0, maxStack, maxLocals, sizeof(LazyCode));
+  memcpy(&codeBody(t, code, 0), &lazy, sizeof(LazyCode));
+
+  return code;
+}
+
 object
 addInterfaceMethods(Thread* t, object class_, object virtualMap,
                     unsigned* virtualCount, bool makeList)
@@ -1899,7 +2181,7 @@ addInterfaceMethods(Thread* t, object class_, object virtualMap,
           if (n == 0) {
             method = makeMethod
               (t,
-               methodVmFlags(t, method),
+               methodVmFlags(t, method) & ~LazyCodeFlag,
                methodReturnCode(t, method),
                methodParameterCount(t, method),
                methodParameterFootprint(t, method),
@@ -1932,8 +2214,11 @@ addInterfaceMethods(Thread* t, object class_, object virtualMap,
   return 0;
 }
 
+// If data is non-null, method bodies may be left in place there
+// (see makeLazyCode), in which case *retain is set to true.
 void
-parseMethodTable(Thread* t, Stream& s, object class_, object pool)
+parseMethodTable(Thread* t, Stream& s, object class_, object pool,
+                 const uint8_t* data, bool* retain)
 {
   PROTECT(t, class_);
   PROTECT(t, pool);
@@ -1995,6 +2280,7 @@ parseMethodTable(Thread* t, Stream& s, object class_, object pool)
 
       addendum = 0;
       code = 0;
+      bool lazy = false;
 
       unsigned attributeCount = s.read2();
       for (unsigned j = 0; j < attributeCount; ++j) {
@@ -2004,7 +2290,16 @@ parseMethodTable(Thread* t, Stream& s, object class_, object pool)
         if (vm::strcmp(reinterpret_cast<const int8_t*>("Code"),
                        &byteArrayBody(t, attributeName, 0)) == 0)
         {
-          code = parseCode(t, s, pool);
+          if (data) {
+            code = makeLazyCode(t, s, data, length, pool);
+          }
+
+          if (code) {
+            lazy = true;
+            *retain = true;
+          } else {
+            code = parseCode(t, s, pool);
+          }
         } else if (vm::strcmp(reinterpret_cast<const int8_t*>("Exceptions"),
                               &byteArrayBody(t, attributeName, 0)) == 0)
         {
@@ -2093,6 +2388,10 @@ parseMethodTable(Thread* t, Stream& s, object class_, object pool)
 
       PROTECT(t, method);
 
+      if (lazy) {
+        methodVmFlags(t, method) |= LazyCodeFlag;
+      }
+
       if (methodVirtual(t, method)) {
         ++ declaredVirtualCount;
 
@@ -2427,6 +2726,8 @@ updateBootstrapClass(Thread* t, object bootstrapClass, object class_)
   set(t, bootstrapClass, ClassStaticTable, classStaticTable(t, class_));
   set(t, bootstrapClass, ClassAddendum, classAddendum(t, class_));
 
+  classHash(t, bootstrapClass) = classHash(t, class_);
+
   updateClassTables(t, bootstrapClass, class_);
 }
 
@@ -2591,28 +2892,6 @@ resolveArrayClass(Thread* t, object loader, object spec, bool throw_,
   }
 }
 
-void
-removeMonitor(Thread* t, object o)
-{
-  unsigned hash;
-  if (DebugMonitors) {
-    hash = objectHash(t, o);
-  }
-
-  object m = hashMapRemove
-    (t, root(t, Machine::MonitorMap), o, objectHash, objectEqual);
-
-  if (DebugMonitors) {
-    fprintf(stderr, "dispose monitor %p for object %x\n", m, hash);
-  }
-}
-
-void
-removeString(Thread* t, object o)
-{
-  hashMapRemove(t, root(t, Machine::StringMap), o, stringHash, objectEqual);
-}
-
 void
 bootClass(Thread* t, Machine::Type type, int superType, uint32_t objectMask,
           unsigned fixedSize, unsigned arrayElementSize, unsigned vtableLength)
@@ -2811,7 +3090,7 @@ boot(Thread* t)
 
   setRoot(t, Machine::BootstrapClassMap, makeHashMap(t, 0, 0));
 
-  setRoot(t, Machine::StringMap, makeWeakHashMap(t, 0, 0));
+  setRoot(t, Machine::StringMap, makeWeakHashMap(t, 0, 0, 0));
 
   makeArrayInterfaceTable(t);
 
@@ -3074,6 +3353,9 @@ Machine::Machine(System* system, Heap* heap, Finder* bootFinder,
   exclusive(0),
   finalizeThread(0),
   jniReferences(0),
+  allocationSites(0),
+  pretenureLog(0),
+  retainedRegions(0),
   properties(properties),
   propertyCount(propertyCount),
   arguments(arguments),
@@ -3093,6 +3375,11 @@ Machine::Machine(System* system, Heap* heap, Finder* bootFinder,
   libraries(0),
   errorLog(0),
   bootimage(0),
+  codeimage(0),
+  savedHashes(0),
+  savedHashCount(0),
+  savedHashHeap(0),
+  savedHashHeapEnd(0),
   types(0),
   roots(0),
   finalizers(0),
@@ -3104,6 +3391,7 @@ Machine::Machine(System* system, Heap* heap, Finder* bootFinder,
   collecting(false),
   triedBuiltinOnLoad(false),
   dumpedHeapOnOOM(false),
+  lazyCode(false),
   alive(true),
   heapPoolIndex(0)
 {
@@ -3145,6 +3433,16 @@ Machine::Machine(System* system, Heap* heap, Finder* bootFinder,
 
   if(bootstrapPropertyDup)
     free((void*)bootstrapPropertyDup);
+
+  const char* pretenureLogPath = findProperty(this, "avian.pretenure.log");
+  if (pretenureLogPath) {
+    pretenureLog = vm::fopen(pretenureLogPath, "wb");
+  }
+
+  // if true, leave method bodies in the class files they came from
+  // until they are first needed (see loadMethodCode):
+  const char* lazyCodeValue = findProperty(this, "avian.lazy.code");
+  lazyCode = lazyCodeValue and ::strcmp(lazyCodeValue, "true") == 0;
 }
 
 void
@@ -3167,6 +3465,30 @@ Machine::dispose()
     heap->free(tmp, sizeof(*tmp));
   }
 
+  for (AllocationSite* s = allocationSites; s;) {
+    AllocationSite* tmp = s;
+    s = s->next;
+
+    if (pretenureLog) {
+      logAllocationSite
+        (pretenureLog, tmp, tmp->pretenured ? "pretenured" : "site");
+    }
+
+    heap->free(tmp->name, strlen(tmp->name) + 1);
+    heap->free(tmp, sizeof(*tmp));
+  }
+
+  if (pretenureLog) {
+    fclose(pretenureLog);
+  }
+
+  for (RetainedRegion* r = retainedRegions; r;) {
+    RetainedRegion* tmp = r;
+    r = r->next;
+    tmp->region->dispose();
+    heap->free(tmp, sizeof(*tmp));
+  }
+
   for (unsigned i = 0; i < heapPoolIndex; ++i) {
     heap->free(heapPool[i], ThreadHeapSizeInBytes);
   }
@@ -3175,6 +3497,10 @@ Machine::dispose()
     heap->free(bootimage, bootimageSize);
   }
 
+  if (codeimage) {
+    system->freeExecutable(codeimage, codeimageSize);
+  }
+
   heap->free(arguments, sizeof(const char*) * argumentCount);
 
   heap->free(properties, sizeof(const char*) * propertyCount);
@@ -3231,8 +3557,9 @@ Thread::init()
     const char* imageFunctionName = findProperty(m, "avian.bootimage");
     if (imageFunctionName) {
       bool lzma = strncmp("lzma:", imageFunctionName, 5) == 0;
-      const char* symbolName
-        = lzma ? imageFunctionName + 5 : imageFunctionName;
+      bool lz = strncmp("lz:", imageFunctionName, 3) == 0;
+      const char* symbolName = lzma ? imageFunctionName + 5
+        : (lz ? imageFunctionName + 3 : imageFunctionName);
 
       void* imagep = m->libraries->resolve(symbolName);
       if (imagep) {
@@ -3249,18 +3576,36 @@ Thread::init()
 #else
           abort(this);
 #endif
+        } else if (lz) {
+          m->bootimage = image = reinterpret_cast<BootImage*>
+            (decodeLZ
+             (m->system, m->heap, imageBytes, size, &(m->bootimageSize)));
         } else {
           image = reinterpret_cast<BootImage*>(imageBytes);
         }
 
         const char* codeFunctionName = findProperty(m, "avian.codeimage");
         if (codeFunctionName) {
-          void* codep = m->libraries->resolve(codeFunctionName);
+          bool codeLZ = strncmp("lz:", codeFunctionName, 3) == 0;
+          void* codep = m->libraries->resolve
+            (codeLZ ? codeFunctionName + 3 : codeFunctionName);
           if (codep) {
             uint8_t* (*codeFunction)(unsigned*);
             memcpy(&codeFunction, &codep, BytesPerWord);
 
             code = codeFunction(&size);
+            if (codeLZ) {
+              // the code may be run from wherever we put it, as long as
+              // that memory is executable
+              expect(this, isLZ(code, size));
+              m->codeimageSize = decodedLZSize(code);
+              m->codeimage = static_cast<uint8_t*>
+                (m->system->tryAllocateExecutable(m->codeimageSize, 0));
+              expect(this, m->codeimage);
+              expect(this, decodeLZ
+                     (code, size, m->codeimage, m->codeimageSize));
+              code = m->codeimage;
+            }
           }
         }
       }
@@ -3277,10 +3622,15 @@ Thread::init()
       boot(this);
     }
 
-    setRoot(this, Machine::ByteArrayMap, makeWeakHashMap(this, 0, 0));
-    setRoot(this, Machine::MonitorMap, makeWeakHashMap(this, 0, 0));
+    setRoot(this, Machine::ByteArrayMap, makeWeakHashMap(this, 0, 0, 0));
+    setRoot(this, Machine::MonitorMap, makeWeakHashMap(this, 0, 0, 0));
 
-    setRoot(this, Machine::ClassRuntimeDataTable, makeVector(this, 0, 0));
+    // a heap restored from a checkpoint brings its own class runtime
+    // data, so that classes keep the java.lang.Class instances
+    // referred to from elsewhere in that heap:
+    if (root(this, Machine::ClassRuntimeDataTable) == 0) {
+      setRoot(this, Machine::ClassRuntimeDataTable, makeVector(this, 0, 0));
+    }
     setRoot(this, Machine::MethodRuntimeDataTable, makeVector(this, 0, 0));
     setRoot(this, Machine::JNIMethodTable, makeVector(this, 0, 0));
     setRoot(this, Machine::JNIFieldTable, makeVector(this, 0, 0));
@@ -3390,6 +3740,8 @@ shutDown(Thread* t)
 
     visitAll(t, t->m->rootThread, interruptDaemon);
   }
+
+  t->m->processor->shutDown(t);
 }
 
 void
@@ -3613,6 +3965,20 @@ allocate3(Thread* t, Allocator* allocator, Machine::AllocationType type,
       t->m->stateLock->wait(t->systemThread, 0);
     }
   }
+
+  if (type == Machine::TenuredAllocation) {
+    object o = static_cast<object>
+      (t->m->heap->tryAllocateTenured
+       (ceilingDivide(sizeInBytes, BytesPerWord)));
+
+    if (o) {
+      return o;
+    }
+
+    // there's no room in the tenured generation until the next
+    // collection grows it, so allocate normally in the meantime:
+    type = Machine::MovableAllocation;
+  }
   
   do {
     switch (type) {
@@ -3647,6 +4013,8 @@ allocate3(Thread* t, Allocator* allocator, Machine::AllocationType type,
 
     case Machine::ImmortalAllocation:
       break;
+
+    default: abort(t);
     }
 
     int pendingAllocation = t->m->heap->fixedFootprint
@@ -3746,6 +4114,68 @@ makeNewGeneral(Thread* t, object class_)
   return instance;
 }
 
+AllocationSite*
+makeAllocationSite(Thread* t, object method, unsigned ip)
+{
+  object class_ = methodClass(t, method);
+
+  unsigned classLength = byteArrayLength(t, className(t, class_)) - 1;
+  unsigned nameLength = byteArrayLength(t, methodName(t, method)) - 1;
+
+  char* name = static_cast<char*>
+    (t->m->heap->allocate(classLength + nameLength + 2));
+
+  replace('/', '.', name, reinterpret_cast<const char*>
+          (&byteArrayBody(t, className(t, class_), 0)));
+  name[classLength] = '.';
+  memcpy(name + classLength + 1, &byteArrayBody(t, methodName(t, method), 0),
+         nameLength + 1);
+
+  ACQUIRE(t, t->m->referenceLock);
+
+  AllocationSite* site = new (t->m->heap->allocate(sizeof(AllocationSite)))
+    AllocationSite(name, ip, t->m->allocationSites);
+
+  t->m->allocationSites = site;
+
+  return site;
+}
+
+object
+makeNew(Thread* t, object class_, AllocationSite* site)
+{
+  if (site->pretenured) {
+    PROTECT(t, class_);
+
+    object instance = allocate3
+      (t, t->m->heap, Machine::TenuredAllocation,
+       pad(classFixedSize(t, class_)), classObjectMask(t, class_));
+
+    setObjectClass(t, instance, class_);
+
+    // the instance may already live in gen2, in which case the heap
+    // needs to know it now refers to a (possibly younger) class:
+    mark(t, instance, 0);
+
+    return instance;
+  }
+
+  object instance = makeNew(t, class_);
+
+  // the counters and samples are updated without synchronization, so
+  // they are only approximate when several threads share a site:
+  if (++ site->allocationCount % AllocationSiteSampleInterval == 0) {
+    for (unsigned i = 0; i < AllocationSiteSampleCount; ++i) {
+      if (site->samples[i] == 0) {
+        site->samples[i] = instance;
+        break;
+      }
+    }
+  }
+
+  return instance;
+}
+
 void
 popResources(Thread* t)
 {
@@ -4070,21 +4500,11 @@ primitiveSize(Thread* t, unsigned code)
 
 object
 parseClass(Thread* t, object loader, const uint8_t* data, unsigned size,
-           Machine::Type throwType)
+           Machine::Type throwType, bool* retain)
 {
   PROTECT(t, loader);
 
-  class Client: public Stream::Client {
-   public:
-    Client(Thread* t): t(t) { }
-
-    virtual void NO_RETURN handleError() {
-      abort(t);
-    }
-
-   private:
-    Thread* t;
-  } client(t);
+  ParseClient client(t);
 
   Stream s(&client, data, size);
 
@@ -4122,6 +4542,7 @@ parseClass(Thread* t, object loader, const uint8_t* data, unsigned size,
                             0, // static table
                             loader,
                             0, // source
+                            0, // hash
                             0);// vtable length
   PROTECT(t, class_);
   
@@ -4147,7 +4568,8 @@ parseClass(Thread* t, object loader, const uint8_t* data, unsigned size,
 
   parseFieldTable(t, s, class_, pool);
 
-  parseMethodTable(t, s, class_, pool);
+  parseMethodTable
+    (t, s, class_, pool, retain and t->m->lazyCode ? data : 0, retain);
 
   parseAttributeTable(t, s, class_, pool);
 
@@ -4176,6 +4598,10 @@ parseClass(Thread* t, object loader, const uint8_t* data, unsigned size,
 
   PROTECT(t, real);
 
+  // remember what the class was made from, so compiled code which
+  // depends on it may be checked against it later:
+  classHash(t, real) = hash(data, size);
+
   t->m->processor->initVtable(t, real);
 
   updateClassTables(t, real, class_);
@@ -4199,9 +4625,51 @@ runParseClass(Thread* t, uintptr_t* arguments)
   object loader = reinterpret_cast<object>(arguments[0]);
   System::Region* region = reinterpret_cast<System::Region*>(arguments[1]);
   Machine::Type throwType = static_cast<Machine::Type>(arguments[2]);
+  bool* retain = reinterpret_cast<bool*>(arguments[3]);
 
   return reinterpret_cast<uintptr_t>
-    (parseClass(t, loader, region->start(), region->length(), throwType));
+    (parseClass
+     (t, loader, region->start(), region->length(), throwType, retain));
+}
+
+// Keeps the specified region alive until the VM is disposed.  The
+// caller must hold the class lock.
+void
+retainRegion(Thread* t, System::Region* region)
+{
+  t->m->retainedRegions = new
+    (t->m->heap->allocate(sizeof(RetainedRegion)))
+    RetainedRegion(region, t->m->retainedRegions);
+}
+
+void
+loadLazyCode(Thread* t, object method)
+{
+  PROTECT(t, method);
+
+  ACQUIRE(t, t->m->classLock);
+
+  if (methodVmFlags(t, method) & LazyCodeFlag) {
+    object stub = methodCode(t, method);
+    PROTECT(t, stub);
+
+    LazyCode lazy;
+    memcpy(&lazy, &codeBody(t, stub, 0), sizeof(LazyCode));
+
+    ParseClient client(t);
+    Stream s(&client, lazy.start, lazy.length);
+
+    object code = parseCode(t, s, codePool(t, stub));
+    codeCompiled(t, code) = codeCompiled(t, stub);
+
+    set(t, method, MethodCode, code);
+
+    // emptyMethod and loadMethodCode rely on the new code being
+    // visible before the flag is cleared:
+    storeStoreMemoryBarrier();
+
+    methodVmFlags(t, method) &= ~LazyCodeFlag;
+  }
 }
 
 object
@@ -4247,17 +4715,28 @@ resolveSystemClass(Thread* t, object loader, object spec, bool throw_,
           fprintf(stderr, "parsing %s\n", &byteArrayBody(t, spec, 0));
         }
 
-        { THREAD_RESOURCE(t, System::Region*, region, region->dispose());
+        bool retain = false;
+        bool* retained = &retain;
+
+        { THREAD_RESOURCE2(t, System::Region*, region, bool*, retained,
+                           if (*retained) {
+                             retainRegion(t, region);
+                           } else {
+                             region->dispose();
+                           });
 
           uintptr_t arguments[] = { reinterpret_cast<uintptr_t>(loader),
                                     reinterpret_cast<uintptr_t>(region),
-                                    static_cast<uintptr_t>(throwType) };
+                                    static_cast<uintptr_t>(throwType),
+                                    reinterpret_cast<uintptr_t>(&retain) };
 
           // parse class file
           class_ = reinterpret_cast<object>
             (runRaw(t, runParseClass, arguments));
 
           if (UNLIKELY(t->exception)) {
+            retain = false;
+
             if (throw_) {
               object e = t->exception;
               t->exception = 0;
@@ -4702,8 +5181,10 @@ objectMonitor(Thread* t, object o, bool createNew)
 {
   assert(t, t->state == Thread::ActiveState);
 
-  object m = hashMapFind
-    (t, root(t, Machine::MonitorMap), o, objectHash, objectEqual);
+  uint32_t hash = objectHash(t, o);
+
+  object m = weakHashMapFind
+    (t, root(t, Machine::MonitorMap), o, hash, objectEqual);
 
   if (m) {
     if (DebugMonitors) {
@@ -4717,8 +5198,8 @@ objectMonitor(Thread* t, object o, bool createNew)
 
     { ENTER(t, Thread::ExclusiveState);
 
-      m = hashMapFind
-        (t, root(t, Machine::MonitorMap), o, objectHash, objectEqual);
+      m = weakHashMapFind
+        (t, root(t, Machine::MonitorMap), o, hash, objectEqual);
 
       if (m) {
         if (DebugMonitors) {
@@ -4737,9 +5218,7 @@ objectMonitor(Thread* t, object o, bool createNew)
                 objectHash(t, o));
       }
 
-      hashMapInsert(t, root(t, Machine::MonitorMap), o, m, objectHash);
-
-      addFinalizer(t, o, removeMonitor);
+      weakHashMapInsert(t, root(t, Machine::MonitorMap), o, m, hash);
     }
 
     return m;
@@ -4748,21 +5227,60 @@ objectMonitor(Thread* t, object o, bool createNew)
   }
 }
 
+bool
+findSavedHash(Thread* t, object o, uint32_t* hash)
+{
+  // the table holds pairs of heap offsets and hash codes, sorted by
+  // offset (see writeCheckpoint in compile.cpp)
+  uintptr_t* p = reinterpret_cast<uintptr_t*>(o);
+  if (p < t->m->savedHashHeap or p >= t->m->savedHashHeapEnd) {
+    return false;
+  }
+
+  uintptr_t offset = p - t->m->savedHashHeap;
+  const uint32_t* table = t->m->savedHashes;
+  unsigned bottom = 0;
+  unsigned top = t->m->savedHashCount;
+  while (bottom < top) {
+    unsigned middle = bottom + ((top - bottom) / 2);
+    uintptr_t candidate = table[middle * 2];
+    if (offset < candidate) {
+      top = middle;
+    } else if (offset > candidate) {
+      bottom = middle + 1;
+    } else {
+      *hash = table[(middle * 2) + 1];
+      return true;
+    }
+  }
+
+  return false;
+}
+
 object
 intern(Thread* t, object s)
 {
+  uint32_t hash = stringHash(t, s);
+
+  // most calls find an existing entry, so try that first without
+  // taking the lock
+  object n = weakHashMapFindNode
+    (t, root(t, Machine::StringMap), s, hash, stringEqual);
+  if (n) {
+    return weakHashMapNodeKey(t, n);
+  }
+
   PROTECT(t, s);
 
   ACQUIRE(t, t->m->referenceLock);
 
-  object n = hashMapFindNode
-    (t, root(t, Machine::StringMap), s, stringHash, stringEqual);
+  n = weakHashMapFindNode
+    (t, root(t, Machine::StringMap), s, hash, stringEqual);
 
   if (n) {
-    return jreferenceTarget(t, tripleFirst(t, n));
+    return weakHashMapNodeKey(t, n);
   } else {
-    hashMapInsert(t, root(t, Machine::StringMap), s, 0, stringHash);
-    addFinalizer(t, s, removeString);
+    weakHashMapInsert(t, root(t, Machine::StringMap), s, 0, hash);
     return s;
   }
 }
@@ -5162,6 +5680,12 @@ defineClass(Thread* t, object loader, const uint8_t* buffer, unsigned length)
 
   saveLoadedClass(t, loader, c);
 
+  // the set of available classes is changing at runtime (e.g. code
+  // generated and written to the classpath), so don't trust earlier
+  // misses:
+  t->m->bootFinder->invalidate();
+  t->m->appFinder->invalidate();
+
   return c;
 }
 
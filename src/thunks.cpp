@@ -29,6 +29,22 @@ THUNK(negateFloat)
 THUNK(absoluteFloat)
 THUNK(absoluteLong)
 THUNK(absoluteInt)
+THUNK(popCountLong)
+THUNK(popCountInt)
+THUNK(countLeadingZerosLong)
+THUNK(countLeadingZerosInt)
+THUNK(countTrailingZerosLong)
+THUNK(countTrailingZerosInt)
+THUNK(byteSwapLong)
+THUNK(byteSwapInt)
+THUNK(rotateLeftLong)
+THUNK(rotateLeftInt)
+THUNK(rotateRightLong)
+THUNK(rotateRightInt)
+THUNK(minLong)
+THUNK(minInt)
+THUNK(maxLong)
+THUNK(maxInt)
 THUNK(divideLong)
 THUNK(divideInt)
 THUNK(moduloLong)
@@ -45,6 +61,9 @@ THUNK(makeBlankObjectArrayFromReference)
 THUNK(makeBlankArray)
 THUNK(lookUpAddress)
 THUNK(setMaybeNull)
+THUNK(compareAndSwapInt)
+THUNK(compareAndSwapLong)
+THUNK(compareAndSwapObject)
 THUNK(acquireMonitorForObject)
 THUNK(acquireMonitorForObjectOnEntrance)
 THUNK(releaseMonitorForObject)
@@ -65,8 +84,18 @@ THUNK(instanceOf64)
 THUNK(instanceOfFromReference)
 THUNK(makeNewGeneral64)
 THUNK(makeNew64)
+THUNK(makeNewAtSite64)
 THUNK(makeNewFromReference)
 THUNK(set)
 THUNK(getJClass64)
 THUNK(getJClassFromReference)
+THUNK(copyArray)
+THUNK(fillArray)
+THUNK(fillLongArray)
+THUNK(fillObjectArray)
+THUNK(stringsEqual)
+THUNK(hashString)
+THUNK(compareStrings)
+THUNK(indexOfChar)
+THUNK(indexOfString)
 THUNK(gcIfNecessary)
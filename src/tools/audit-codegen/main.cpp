@@ -14,6 +14,7 @@
 
 #include <avian/vm/codegen/lir.h>
 #include <avian/vm/codegen/assembler.h>
+#include <avian/vm/codegen/architecture.h>
 #include <avian/vm/codegen/targets.h>
 #include <avian/vm/codegen/registers.h>
 
@@ -62,7 +63,9 @@ public:
   }
 };
 
-void generateCode(BasicEnv& env) {
+// generates a sample of code for each register, returning its length
+// and storing a pointer to it, which must be freed, in *result
+unsigned generateCode(BasicEnv& env, uint8_t** result) {
   Asm a(env);
   for(RegisterIterator it(env.arch->registerFile()->generalRegisters); it.hasNext(); ) {
     int r = it.next();
@@ -81,18 +84,62 @@ void generateCode(BasicEnv& env) {
     printf("%02x ", data[i]);
   }
   printf("\n");
-  env.s->free(data);
+  *result = data;
+  return length;
+}
+
+bool writeFile(const char* path, const uint8_t* data, unsigned length) {
+  FILE* out = vm::fopen(path, "wb");
+  if(!out) {
+    return false;
+  }
+  bool ok = fwrite(data, 1, length, out) == length;
+  return fclose(out) == 0 && ok;
+}
+
+// compares the code we generated with what was generated for the
+// specified baseline, returning true if they match
+bool matchesBaseline(const char* path, const uint8_t* data, unsigned length) {
+  FILE* in = vm::fopen(path, "rb");
+  if(!in) {
+    fprintf(stderr, "unable to open baseline %s\n", path);
+    return false;
+  }
+
+  unsigned offset = 0;
+  int c;
+  bool match = true;
+  while((c = fgetc(in)) != EOF) {
+    if(offset >= length || data[offset] != c) {
+      match = false;
+      break;
+    }
+    ++ offset;
+  }
+  fclose(in);
+
+  if(match && offset != length) {
+    match = false;
+  }
+
+  if(!match) {
+    fprintf(stderr, "output differs from baseline %s at offset %d\n",
+            path, offset);
+  }
+  return match;
 }
 
 class Arguments {
 public:
   const char* output;
   const char* outputFormat;
+  const char* baseline;
 
   Arguments(int argc, char** argv) {
     ArgParser parser;
     Arg out(parser, true, "output", "<output object file>");
     Arg format(parser, true, "format", "<format of output object file>");
+    Arg baseline(parser, false, "baseline", "<output of an earlier run to compare with>");
 
     if(!parser.parse(argc, argv)) {
       exit(1);
@@ -100,6 +147,7 @@ public:
 
     output = out.value;
     outputFormat = format.value;
+    this->baseline = baseline.value;
 
     // TODO: sanitize format values
   }
@@ -110,7 +158,18 @@ int main(int argc, char** argv) {
 
   BasicEnv env;
 
-  generateCode(env);
+  uint8_t* data;
+  unsigned length = generateCode(env, &data);
+
+  int status = 0;
+  if(!writeFile(args.output, data, length)) {
+    fprintf(stderr, "unable to write %s\n", args.output);
+    status = 1;
+  } else if(args.baseline && !matchesBaseline(args.baseline, data, length)) {
+    status = 1;
+  }
+
+  env.s->free(data);
 
-  return 0;
+  return status;
 }
\ No newline at end of file
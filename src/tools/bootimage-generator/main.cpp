@@ -13,6 +13,7 @@
 #include "avian/common.h"
 #include "avian/machine.h"
 #include "avian/util.h"
+#include "avian/process.h"
 #include <avian/util/stream.h>
 #include <avian/vm/codegen/assembler.h>
 #include <avian/vm/codegen/promise.h>
@@ -20,6 +21,7 @@
 #include <avian/tools/object-writer/tools.h>
 #include <avian/util/runtime-array.h>
 #include "avian/lzma.h"
+#include "avian/lz.h"
 
 #include <avian/util/arg-parser.h>
 #include <avian/util/abort.h>
@@ -174,6 +176,16 @@ endsWith(const char* suffix, const char* s, unsigned length)
     and memcmp(suffix, s + (length - suffixLength), suffixLength) == 0;
 }
 
+// reports how long a phase of building the images took, returning the
+// time it ended so that the next phase may start from it
+int64_t
+reportPhase(System* s, const char* name, int64_t start)
+{
+  int64_t now = s->now();
+  fprintf(stderr, "%s took %d ms\n", name, static_cast<int>(now - start));
+  return now;
+}
+
 object
 getNonStaticFields(Thread* t, object typeMaps, object c, object fields,
                    unsigned* count, object* array)
@@ -278,10 +290,414 @@ targetFieldOffset(Thread* t, object typeMaps, object field)
     ->targetFixedOffsets()[fieldOffset(t, field)];
 }
 
+bool
+methodMatches(Thread* t, object method, const char* name, const char* spec)
+{
+  return (name == 0
+          or ::strcmp
+          (reinterpret_cast<char*>
+           (&byteArrayBody(t, methodName(t, method), 0)), name) == 0)
+    and (spec == 0
+         or ::strcmp
+         (reinterpret_cast<char*>
+          (&byteArrayBody(t, methodSpec(t, method), 0)), spec) == 0);
+}
+
+// Finds the classes and methods which may be used by a program,
+// starting from its entry point and any classes and methods it names
+// as being used reflectively or from native code.  A method is
+// reached if it is called directly, or if it may be the target of a
+// virtual or interface call we've reached, i.e. it is declared by a
+// class we've reached and has the name and spec of such a call.  A
+// class is reached if it is referred to by a method we've reached, or
+// is a superclass or interface of such a class.
+class Reachability: public Thread::Protector {
+ public:
+  Reachability(Thread* t):
+    Protector(t),
+    reached(0),
+    signatures(0),
+    pending(0)
+  {
+    reached = makeHashMap(t, 0, 0);
+    signatures = makeHashMap(t, 0, 0);
+  }
+
+  virtual void visit(Heap::Visitor* v) {
+    v->visit(&reached);
+    v->visit(&signatures);
+    v->visit(&pending);
+  }
+
+  bool isReached(object o) {
+    return hashMapFind(t, reached, o, objectHash, objectEqual) != 0;
+  }
+
+  void reachClass(object c) {
+    if (c == 0 or isReached(c)) {
+      return;
+    }
+
+    PROTECT(t, c);
+
+    hashMapInsert(t, reached, c, c, objectHash);
+
+    reachClass(classSuper(t, c));
+
+    object table = classInterfaceTable(t, c);
+    if (table) {
+      PROTECT(t, table);
+
+      unsigned increment = (classFlags(t, c) & ACC_INTERFACE) ? 1 : 2;
+      for (unsigned i = 0; i < arrayLength(t, table); i += increment) {
+        reachClass(arrayBody(t, table, i));
+      }
+    }
+
+    object initializer = classInitializer(t, c);
+    if (initializer) {
+      reachMethod(initializer);
+    }
+
+    // Enum.valueOf calls values() reflectively:
+    if (classSuper(t, c)
+        and ::strcmp
+        (reinterpret_cast<char*>
+         (&byteArrayBody(t, className(t, classSuper(t, c)), 0)),
+         "java/lang/Enum") == 0)
+    {
+      reachMethods(c, "values", 0);
+    }
+  }
+
+  void reachMethod(object method) {
+    if (isReached(method)) {
+      return;
+    }
+
+    PROTECT(t, method);
+
+    hashMapInsert(t, reached, method, method, objectHash);
+
+    pending = makePair(t, method, pending);
+
+    reachClass(methodClass(t, method));
+  }
+
+  void reachMethods(object c, const char* name, const char* spec) {
+    PROTECT(t, c);
+
+    object table = classMethodTable(t, c);
+    for (unsigned i = 0; table and i < arrayLength(t, table); ++i) {
+      object method = arrayBody(t, table, i);
+      if (methodMatches(t, method, name, spec)) {
+        reachMethod(method);
+        table = classMethodTable(t, c);
+      }
+    }
+  }
+
+  object signature(object method) {
+    return makeByteArray
+      (t, "%s%s", &byteArrayBody(t, methodName(t, method), 0),
+       &byteArrayBody(t, methodSpec(t, method), 0));
+  }
+
+  void reachSignature(object method) {
+    PROTECT(t, method);
+
+    object key = signature(method);
+    if (hashMapFind(t, signatures, key, byteArrayHash, byteArrayEqual) == 0) {
+      hashMapInsert(t, signatures, key, key, byteArrayHash);
+    }
+  }
+
+  bool isSignatureReached(object method) {
+    return hashMapFind
+      (t, signatures, signature(method), byteArrayHash, byteArrayEqual) != 0;
+  }
+
+  object poolClass(object code, unsigned index) {
+    object o = singletonObject(t, codePool(t, code), index - 1);
+    if (objectClass(t, o) == type(t, Machine::ReferenceType)) {
+      o = resolveClass
+        (t, root(t, Machine::BootLoader), referenceName(t, o), false);
+    }
+
+    return (o and objectClass(t, o) == type(t, Machine::ClassType)) ? o : 0;
+  }
+
+  object poolMember(object code, unsigned index,
+                    object (*find)(Thread*, object, object, object))
+  {
+    object o = singletonObject(t, codePool(t, code), index - 1);
+    if (objectClass(t, o) == type(t, Machine::ReferenceType)) {
+      PROTECT(t, o);
+
+      object c = referenceClass(t, o);
+      if (objectClass(t, c) == type(t, Machine::ByteArrayType)) {
+        c = resolveClass(t, root(t, Machine::BootLoader), c, false);
+      }
+
+      if (c == 0) {
+        return 0;
+      }
+
+      PROTECT(t, c);
+
+      // whether or not we find the member, the class is used:
+      reachClass(c);
+
+      o = findInHierarchyOrNull
+        (t, c, referenceName(t, o), referenceSpec(t, o), find);
+    }
+
+    return o;
+  }
+
+  void scan(object method) {
+    PROTECT(t, method);
+
+    loadMethodCode(t, method);
+
+    object code = methodCode(t, method);
+    if (code == 0) {
+      return;
+    }
+
+    PROTECT(t, code);
+
+    unsigned length = codeLength(t, code);
+    for (unsigned ip = 0; ip < length;) {
+      unsigned instruction = codeBody(t, code, ip++);
+
+      switch (instruction) {
+      case bipush: case iload: case lload: case fload: case dload:
+      case aload: case istore: case lstore: case fstore: case dstore:
+      case astore: case ret: case newarray:
+        ++ ip;
+        break;
+
+      case sipush: case ldc2_w: case iinc: case ifeq: case ifne: case iflt:
+      case ifge: case ifgt: case ifle: case if_icmpeq: case if_icmpne:
+      case if_icmplt: case if_icmpge: case if_icmpgt: case if_icmple:
+      case if_acmpeq: case if_acmpne: case goto_: case jsr: case ifnull:
+      case ifnonnull:
+        ip += 2;
+        break;
+
+      case goto_w: case jsr_w:
+        ip += 4;
+        break;
+
+      case ldc: case ldc_w: {
+        unsigned index = instruction == ldc
+          ? codeBody(t, code, ip++) : codeReadInt16(t, code, ip);
+
+        if (singletonIsObject(t, codePool(t, code), index - 1)) {
+          object o = singletonObject(t, codePool(t, code), index - 1);
+          if (objectClass(t, o) == type(t, Machine::ReferenceType)
+              or objectClass(t, o) == type(t, Machine::ClassType))
+          {
+            reachClass(poolClass(code, index));
+          }
+        }
+      } break;
+
+      case new_: case anewarray: case checkcast: case instanceof:
+        reachClass(poolClass(code, codeReadInt16(t, code, ip)));
+        break;
+
+      case multianewarray:
+        reachClass(poolClass(code, codeReadInt16(t, code, ip)));
+        ++ ip;
+        break;
+
+      case getfield: case putfield: case getstatic: case putstatic: {
+        object field = poolMember
+          (code, codeReadInt16(t, code, ip), findFieldInClass);
+        if (field) {
+          reachClass(fieldClass(t, field));
+        }
+      } break;
+
+      case invokestatic: case invokespecial: {
+        object target = poolMember
+          (code, codeReadInt16(t, code, ip), findMethodInClass);
+        if (target) {
+          reachMethod(target);
+        }
+      } break;
+
+      case invokevirtual: case invokeinterface: {
+        object target = poolMember
+          (code, codeReadInt16(t, code, ip), findMethodInClass);
+        if (target) {
+          PROTECT(t, target);
+
+          reachSignature(target);
+          reachMethod(target);
+        }
+
+        if (instruction == invokeinterface) {
+          ip += 2;
+        }
+      } break;
+
+      case tableswitch: {
+        ip = (ip + 3) & ~3;
+        ip += 4;
+        int32_t bottom = codeReadInt32(t, code, ip);
+        int32_t top = codeReadInt32(t, code, ip);
+        ip += (top - bottom + 1) * 4;
+      } break;
+
+      case lookupswitch: {
+        ip = (ip + 3) & ~3;
+        ip += 4;
+        int32_t pairCount = codeReadInt32(t, code, ip);
+        ip += pairCount * 8;
+      } break;
+
+      case wide:
+        ip += codeBody(t, code, ip) == iinc ? 5 : 3;
+        break;
+
+      default:
+        break;
+      }
+    }
+  }
+
+  // adds the methods of reached classes which may be the targets of
+  // reached virtual and interface calls, returning true if there
+  // were any
+  bool reachOverrides() {
+    object found = 0;
+    PROTECT(t, found);
+
+    for (HashMapIterator it(t, reached); it.hasMore();) {
+      object c = tripleFirst(t, it.next());
+      if (objectClass(t, c) == type(t, Machine::ClassType)
+          and classMethodTable(t, c))
+      {
+        PROTECT(t, c);
+
+        for (unsigned i = 0; i < arrayLength(t, classMethodTable(t, c)); ++i)
+        {
+          object method = arrayBody(t, classMethodTable(t, c), i);
+          PROTECT(t, method);
+
+          if ((methodFlags(t, method) & (ACC_STATIC | ACC_PRIVATE)) == 0
+              and (methodVmFlags(t, method) & ConstructorFlag) == 0
+              and not isReached(method)
+              and isSignatureReached(method))
+          {
+            found = makePair(t, method, found);
+          }
+        }
+      }
+    }
+
+    for (; found; found = pairSecond(t, found)) {
+      reachMethod(pairFirst(t, found));
+    }
+
+    return pending != 0;
+  }
+
+  void run() {
+    do {
+      while (pending) {
+        object method = pairFirst(t, pending);
+        pending = pairSecond(t, pending);
+
+        scan(method);
+      }
+    } while (reachOverrides());
+  }
+
+  object reached;
+  object signatures;
+  object pending;
+};
+
+// Reaches the classes and methods named by an -entry argument or a
+// line of a reflection roots file, i.e. <class name> for a class and
+// all of its methods or <class name>.<method name>[<method spec>] for
+// particular methods.
+void
+reachRoot(Thread* t, Reachability* r, const char* className,
+          const char* methodName, const char* methodSpec)
+{
+  object c = resolveSystemClass
+    (t, root(t, Machine::BootLoader), makeByteArray(t, "%s", className),
+     false);
+
+  if (c == 0) {
+    fprintf(stderr, "warning: root class %s not found\n", className);
+    return;
+  }
+
+  r->reachClass(c);
+  r->reachMethods(c, methodName, methodSpec);
+}
+
+void
+reachRoots(Thread* t, Reachability* r, const char* path)
+{
+  FILE* file = vm::fopen(path, "rb");
+  if (file == 0) {
+    fprintf(stderr, "unable to open %s\n", path);
+    abort(t);
+  }
+
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    char* start = line;
+    while (*start == ' ' or *start == '\t') ++ start;
+
+    char* end = start + strlen(start);
+    while (end > start and (end[-1] == '\n' or end[-1] == '\r'
+                            or end[-1] == ' ' or end[-1] == '\t'))
+    {
+      -- end;
+    }
+    *end = 0;
+
+    if (*start == 0 or *start == '#') {
+      continue;
+    }
+
+    char* methodName = 0;
+    char* methodSpec = 0;
+    char* dot = strchr(start, '.');
+    if (dot) {
+      *dot = 0;
+      methodName = dot + 1;
+
+      char* paren = strchr(methodName, '(');
+      if (paren) {
+        methodSpec = strdup(paren);
+        *paren = 0;
+      }
+    }
+
+    reachRoot(t, r, start, methodName, methodSpec);
+
+    if (methodSpec) {
+      free(methodSpec);
+    }
+  }
+
+  fclose(file);
+}
+
 object
 makeCodeImage(Thread* t, Zone* zone, BootImage* image, uint8_t* code,
               const char* className, const char* methodName,
-              const char* methodSpec, object typeMaps)
+              const char* methodSpec, bool treeShake,
+              const char* reflectionRoots, object typeMaps, object* reached)
 {
   PROTECT(t, typeMaps);
 
@@ -312,12 +728,20 @@ makeCodeImage(Thread* t, Zone* zone, BootImage* image, uint8_t* code,
   Finder* finder = static_cast<Finder*>
     (systemClassLoaderFinder(t, root(t, Machine::BootLoader)));
 
+  // when tree shaking, we load every class so we can tell which are
+  // reachable from the entry point, and compile only those methods
+  // which are:
+  const char* classFilter = treeShake ? 0 : className;
+
+  int64_t phase = t->m->system->now();
+
   for (Finder::Iterator it(finder); it.hasMore();) {
     unsigned nameSize = 0;
     const char* name = it.next(&nameSize);
 
     if (endsWith(".class", name, nameSize)
-        and (className == 0 or strncmp(name, className, nameSize - 6) == 0))
+        and (classFilter == 0
+             or strncmp(name, classFilter, nameSize - 6) == 0))
     {
       // fprintf(stderr, "pass 1 %.*s\n", nameSize - 6, name);
       object c = resolveSystemClass
@@ -601,12 +1025,31 @@ makeCodeImage(Thread* t, Zone* zone, BootImage* image, uint8_t* code,
     }
   }
 
+  phase = reportPhase(t->m->system, "parsing classes", phase);
+
+  if (treeShake) {
+    Reachability r(t);
+
+    reachRoot(t, &r, className, methodName, methodSpec);
+
+    if (reflectionRoots) {
+      reachRoots(t, &r, reflectionRoots);
+    }
+
+    r.run();
+
+    *reached = r.reached;
+
+    phase = reportPhase(t->m->system, "finding reachable methods", phase);
+  }
+
   for (Finder::Iterator it(finder); it.hasMore();) {
     unsigned nameSize = 0;
     const char* name = it.next(&nameSize);
 
     if (endsWith(".class", name, nameSize)
-        and (className == 0 or strncmp(name, className, nameSize - 6) == 0))
+        and (classFilter == 0
+             or strncmp(name, classFilter, nameSize - 6) == 0))
     {
       // fprintf(stderr, "pass 2 %.*s\n", nameSize - 6, name);
       object c = resolveSystemClass
@@ -618,17 +1061,9 @@ makeCodeImage(Thread* t, Zone* zone, BootImage* image, uint8_t* code,
       if (classMethodTable(t, c)) {
         for (unsigned i = 0; i < arrayLength(t, classMethodTable(t, c)); ++i) {
           object method = arrayBody(t, classMethodTable(t, c), i);
-          if (((methodName == 0
-                or ::strcmp
-                (reinterpret_cast<char*>
-                 (&byteArrayBody
-                  (t, vm::methodName(t, method), 0)), methodName) == 0)
-               and (methodSpec == 0
-                    or ::strcmp
-                    (reinterpret_cast<char*>
-                     (&byteArrayBody
-                      (t, vm::methodSpec(t, method), 0)), methodSpec)
-                    == 0)))
+          if (*reached
+              ? hashMapFind(t, *reached, method, objectHash, objectEqual) != 0
+              : methodMatches(t, method, methodName, methodSpec))
           {
             if (methodCode(t, method)
                 or (methodFlags(t, method) & ACC_NATIVE))
@@ -701,6 +1136,8 @@ makeCodeImage(Thread* t, Zone* zone, BootImage* image, uint8_t* code,
 
   t->m->processor->normalizeVirtualThunks(t);
 
+  reportPhase(t->m->system, "compiling methods", phase);
+
   return constants;
 }
 
@@ -726,6 +1163,116 @@ visitRoots(Thread* t, BootImage* image, HeapWalker* w, object constants)
   }
 }
 
+// Drops the classes tree shaking found no use for from the boot
+// loader, and thus the heap image, except those which the image
+// would refer to anyway, since those must be found by name at
+// runtime to avoid loading them a second time.
+void
+shakeClasses(Thread* t, BootImage* image, object constants, object reached)
+{
+  PROTECT(t, constants);
+  PROTECT(t, reached);
+
+  object map = classLoaderMap(t, root(t, Machine::BootLoader));
+  PROTECT(t, map);
+
+  unsigned classCount = hashMapSize(t, map);
+  unsigned methodCount = 0;
+
+  object dropped = 0;
+  PROTECT(t, dropped);
+
+  unsigned droppedCount = 0;
+  for (HashMapIterator it(t, map); it.hasMore();) {
+    object c = tripleSecond(t, it.next());
+    if (classMethodTable(t, c)) {
+      methodCount += arrayLength(t, classMethodTable(t, c));
+    }
+
+    if (hashMapFind(t, reached, c, objectHash, objectEqual) == 0) {
+      dropped = makePair(t, c, dropped);
+      ++ droppedCount;
+    }
+  }
+
+  // measure how much of the heap the image would hold both with and
+  // without the classes we're dropping:
+  class FootprintVisitor: public HeapVisitor {
+   public:
+    FootprintVisitor(Thread* t): t(t), count(0), words(0) { }
+
+    virtual void root() { }
+
+    virtual unsigned visitNew(object o) {
+      words += baseSize(t, o, objectClass(t, o));
+      return ++ count;
+    }
+
+    virtual void visitOld(object, unsigned) { }
+
+    virtual void push(object, unsigned, unsigned) { }
+
+    virtual void pop() { }
+
+    Thread* t;
+    unsigned count;
+    unsigned words;
+  } before(t), after(t);
+
+  { HeapWalker* w = makeHeapWalker(t, &before);
+    visitRoots(t, image, w, constants);
+    w->dispose();
+  }
+
+  for (object p = dropped; p; p = pairSecond(t, p)) {
+    hashMapRemove
+      (t, map, className(t, pairFirst(t, p)), byteArrayHash, byteArrayEqual);
+  }
+
+  THREAD_RUNTIME_ARRAY(t, bool, referenced, droppedCount + 1);
+
+  { HeapWalker* w = makeHeapWalker(t, &after);
+    visitRoots(t, image, w, constants);
+
+    unsigned i = 0;
+    for (object p = dropped; p; p = pairSecond(t, p)) {
+      RUNTIME_ARRAY_BODY(referenced)[i++]
+        = w->map()->find(pairFirst(t, p)) > 0;
+    }
+
+    w->dispose();
+  }
+
+  unsigned i = 0;
+  for (object p = dropped; p; p = pairSecond(t, p)) {
+    if (RUNTIME_ARRAY_BODY(referenced)[i++]) {
+      hashMapInsert
+        (t, map, className(t, pairFirst(t, p)), pairFirst(t, p),
+         byteArrayHash);
+    }
+  }
+
+  unsigned keptMethodCount = 0;
+  for (HashMapIterator it(t, map); it.hasMore();) {
+    object c = tripleSecond(t, it.next());
+    for (unsigned j = 0; classMethodTable(t, c)
+           and j < arrayLength(t, classMethodTable(t, c)); ++j)
+    {
+      if (hashMapFind
+          (t, reached, arrayBody(t, classMethodTable(t, c), j), objectHash,
+           objectEqual))
+      {
+        ++ keptMethodCount;
+      }
+    }
+  }
+
+  fprintf(stderr, "tree shaking kept %d of %d classes and reached %d of %d "
+          "methods\nreachable heap size %d before tree shaking, %d after\n",
+          hashMapSize(t, map), classCount, keptMethodCount, methodCount,
+          before.words * BytesPerWord, after.words * BytesPerWord);
+}
+
 unsigned
 targetOffset(Thread* t, object typeMaps, object p, unsigned offset)
 {
@@ -1285,7 +1832,8 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
                 const char* methodName, const char* methodSpec,
                 const char* bootimageStart, const char* bootimageEnd,
                 const char* codeimageStart, const char* codeimageEnd,
-                bool useLZMA)
+                bool useLZMA, bool useLZ, bool treeShake,
+                const char* reflectionRoots)
 {
   setRoot(t, Machine::OutOfMemoryError,
           make(t, type(t, Machine::OutOfMemoryErrorType)));
@@ -1326,6 +1874,8 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
   object classPoolMap;
   object typeMaps;
   object constants;
+  object reached = 0;
+  PROTECT(t, reached);
 
   { classPoolMap = makeHashMap(t, 0, 0);
     PROTECT(t, classPoolMap);
@@ -1476,14 +2026,19 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
     }
 
     constants = makeCodeImage
-      (t, &zone, image, code, className, methodName, methodSpec, typeMaps);
+      (t, &zone, image, code, className, methodName, methodSpec, treeShake,
+       reflectionRoots, typeMaps, &reached);
 
     PROTECT(t, constants);
 
     // these roots will not be used when the bootimage is loaded, so
     // there's no need to preserve them:
     setRoot(t, Machine::PoolMap, 0);
-    setRoot(t, Machine::ByteArrayMap, makeWeakHashMap(t, 0, 0));
+    setRoot(t, Machine::ByteArrayMap, makeWeakHashMap(t, 0, 0, 0));
+
+    if (reached) {
+      shakeClasses(t, image, constants, reached);
+    }
 
     // name all primitive classes so we don't try to update immutable
     // references at runtime:
@@ -1543,6 +2098,8 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
     }
   }
 
+  int64_t phase = t->m->system->now();
+
   target_uintptr_t* heap = static_cast<target_uintptr_t*>
     (t->m->heap->allocate(HeapCapacity));
 
@@ -1592,11 +2149,21 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
     (t->m->heap->allocate(image->stringCount * sizeof(unsigned)));
 
   { unsigned i = 0;
-    for (HashMapIterator it(t, root(t, Machine::StringMap)); it.hasMore();) {
-      stringTable[i++] = targetVW
-        (heapWalker->map()->find
-         (jreferenceTarget(t, tripleFirst(t, it.next()))));
+    object array = hashMapArray(t, root(t, Machine::StringMap));
+    for (unsigned j = 0; array and j < arrayLength(t, array); ++j) {
+      for (object n = arrayBody(t, array, j); n;
+           n = weakHashMapNodeNext(t, n))
+      {
+        // strings used only by classes dropped by tree shaking won't
+        // be in the image:
+        int number = heapWalker->map()->find(weakHashMapNodeKey(t, n));
+        if (number > 0) {
+          stringTable[i++] = targetVW(number);
+        }
+      }
     }
+
+    image->stringCount = i;
   }
 
   unsigned* callTable = t->m->processor->makeCallTable(t, heapWalker);
@@ -1604,7 +2171,12 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
   heapWalker->dispose();
 
   image->magic = BootImage::Magic;
+  image->checksum = 0;
   image->initialized = 0;
+  image->hashCount = 0;
+  image->classRuntimeData = 0;
+
+  phase = reportPhase(t->m->system, "building heap image", phase);
 
   fprintf(stderr, "class count %d string count %d call count %d\n"
           "heap size %d code size %d\n",
@@ -1653,6 +2225,18 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
 
     bootimageData.write(heap, pad(image->heapSize, TargetBytesPerWord));
 
+    // identify this image and its code, so that a relocated copy
+    // saved at runtime (see avian.bootimage.map) can be matched to it
+    { uint32_t checksum = hash
+        (bootimageData.data + sizeof(BootImage),
+         bootimageData.length - sizeof(BootImage));
+      checksum = (checksum * 31) + hash(code, image->codeSize);
+
+      image->checksum = checksum;
+      reinterpret_cast<BootImage*>(bootimageData.data)->checksum
+        = targetV4(checksum);
+    }
+
     // fwrite(code, pad(image->codeSize, TargetBytesPerWord), 1, codeOutput);
     
     Platform* platform = Platform::getPlatform(PlatformInfo((PlatformInfo::Format)AVIAN_TARGET_FORMAT, (PlatformInfo::Architecture)AVIAN_TARGET_ARCH));
@@ -1662,17 +2246,19 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
       abort();
     }
 
-    SymbolInfo bootimageSymbols[] = {
-      SymbolInfo(0, bootimageStart),
-      SymbolInfo(bootimageData.length, bootimageEnd)
-    };
-
     uint8_t* bootimage;
     unsigned bootimageLength;
-    if (useLZMA) {
+    if (useLZ) {
+      bootimage = encodeLZ(t->m->system, t->m->heap, bootimageData.data,
+                           bootimageData.length, &bootimageLength);
+
+      fprintf(stderr, "compressed heap size %d\n", bootimageLength);
+    } else if (useLZMA) {
 #ifdef AVIAN_USE_LZMA
-      bootimage = encodeLZMA(t->m->system, t->m->heap, bootimageData.data,
-                             bootimageData.length, &bootimageLength);
+      // compress in blocks, which the VM decodes in parallel at startup
+      bootimage = encodeLZMABlocks(t->m->system, t->m->heap,
+                                   bootimageData.data, bootimageData.length,
+                                   LZMABlockSize, &bootimageLength);
 
       fprintf(stderr, "compressed heap size %d\n", bootimageLength);
 #else
@@ -1683,20 +2269,49 @@ writeBootImage2(Thread* t, OutputStream* bootimageOutput, OutputStream* codeOutp
       bootimageLength = bootimageData.length;
     }
 
+    // the end symbol marks the end of what we write, which the VM
+    // needs to know to decode a compressed image
+    SymbolInfo bootimageSymbols[] = {
+      SymbolInfo(0, bootimageStart),
+      SymbolInfo(bootimageLength, bootimageEnd)
+    };
+
     platform->writeObject(bootimageOutput, Slice<SymbolInfo>(bootimageSymbols, 2), Slice<const uint8_t>(bootimage, bootimageLength), Platform::Writable, TargetBytesPerWord);
 
-    if (useLZMA) {
+    if (useLZ or useLZMA) {
       t->m->heap->free(bootimage, bootimageLength);
     }
 
-    compilationHandler.symbols.add(SymbolInfo(0, codeimageStart));
-    compilationHandler.symbols.add(SymbolInfo(image->codeSize, codeimageEnd));
+    if (useLZ) {
+      // symbols for the methods in a compressed image would be
+      // meaningless, so we write only those marking its bounds, and
+      // the VM decodes it into executable memory at startup
+      unsigned codeLength;
+      uint8_t* compressed = encodeLZ
+        (t->m->system, t->m->heap, code, image->codeSize, &codeLength);
+
+      fprintf(stderr, "compressed code size %d\n", codeLength);
+
+      SymbolInfo codeimageSymbols[] = {
+        SymbolInfo(0, codeimageStart),
+        SymbolInfo(codeLength, codeimageEnd)
+      };
 
-    platform->writeObject(codeOutput, Slice<SymbolInfo>(compilationHandler.symbols), Slice<const uint8_t>(code, image->codeSize), Platform::Executable, TargetBytesPerWord);
+      platform->writeObject(codeOutput, Slice<SymbolInfo>(codeimageSymbols, 2), Slice<const uint8_t>(compressed, codeLength), 0, TargetBytesPerWord);
 
-    for(SymbolInfo* sym = compilationHandler.symbols.begin(); sym != compilationHandler.symbols.end() - 2; sym++) {
+      t->m->heap->free(compressed, codeLength);
+    } else {
+      compilationHandler.symbols.add(SymbolInfo(0, codeimageStart));
+      compilationHandler.symbols.add(SymbolInfo(image->codeSize, codeimageEnd));
+
+      platform->writeObject(codeOutput, Slice<SymbolInfo>(compilationHandler.symbols), Slice<const uint8_t>(code, image->codeSize), Platform::Executable, TargetBytesPerWord);
+    }
+
+    for(SymbolInfo* sym = compilationHandler.symbols.begin(); sym != compilationHandler.symbols.end() - (useLZ ? 0 : 2); sym++) {
       t->m->heap->free(const_cast<void*>((const void*)sym->name.text), sym->name.length + 1);
     }
+
+    reportPhase(t->m->system, "writing images", phase);
   }
 }
 
@@ -1716,11 +2331,14 @@ writeBootImage(Thread* t, uintptr_t* arguments)
   const char* codeimageStart = reinterpret_cast<const char*>(arguments[9]);
   const char* codeimageEnd = reinterpret_cast<const char*>(arguments[10]);
   bool useLZMA = arguments[11];
+  bool treeShake = arguments[12];
+  const char* reflectionRoots = reinterpret_cast<const char*>(arguments[13]);
+  bool useLZ = arguments[14];
 
   writeBootImage2
     (t, bootimageOutput, codeOutput, image, code, className, methodName,
      methodSpec, bootimageStart, bootimageEnd, codeimageStart, codeimageEnd,
-     useLZMA);
+     useLZMA, useLZ, treeShake, reflectionRoots);
 
   return 1;
 }
@@ -1734,6 +2352,259 @@ myStrndup(const char* src, unsigned length)
   return s;
 }
 
+// An allocator which may be used by several threads at once, unlike
+// the VM heap.
+class SystemAllocator: public Allocator {
+ public:
+  SystemAllocator(System* s): s(s) { }
+
+  virtual void* tryAllocate(unsigned size) {
+    return s->tryAllocate(size);
+  }
+
+  virtual void* allocate(unsigned size) {
+    return vm::allocate(s, size);
+  }
+
+  virtual void free(const void* p, unsigned) {
+    s->free(p);
+  }
+
+  System* s;
+};
+
+// A finder which serves class files read ahead of time by a pool of
+// worker threads, each using a finder of its own, and defers to
+// another finder for everything else.  Reading and inflating class
+// files is the only part of building an image done in parallel: the
+// classes are still parsed and compiled one at a time and in the
+// same order as otherwise, since the compiler shares the VM heap,
+// the code buffer, and its tables of constants and call sites with
+// no locking.  Thus the images do not depend on the number of
+// threads.
+class PreloadingFinder: public Finder {
+ public:
+  class Entry {
+   public:
+    char* name;
+    uint8_t* data;
+    unsigned size;
+    Entry* next;
+  };
+
+  class Buffer: public System::Region {
+   public:
+    Buffer(System* s, Entry* e): s(s), e(e) { }
+
+    virtual const uint8_t* start() {
+      return e->data;
+    }
+
+    virtual size_t length() {
+      return e->size;
+    }
+
+    virtual void dispose() {
+      s->free(this);
+    }
+
+    System* s;
+    Entry* e;
+  };
+
+  class Worker: public System::Runnable {
+   public:
+    Worker(): finder(0), thread(0), index(0) { }
+
+    virtual void attach(System::Thread* t) {
+      thread = t;
+    }
+
+    virtual void run() {
+      Finder* f = makeFinder
+        (finder->s, &(finder->allocator), finder->finder->path(), 0);
+
+      for (unsigned i = index; i < finder->entryCount;
+           i += finder->workerCount)
+      {
+        Entry* e = finder->entries + i;
+        System::Region* r = f->find(e->name);
+        if (r) {
+          e->size = r->length();
+          e->data = static_cast<uint8_t*>
+            (vm::allocate(finder->s, max(1U, e->size)));
+          memcpy(e->data, r->start(), e->size);
+          r->dispose();
+        }
+      }
+
+      f->dispose();
+    }
+
+    virtual bool interrupted() {
+      return false;
+    }
+
+    virtual void setInterrupted(bool) { }
+
+    PreloadingFinder* finder;
+    System::Thread* thread;
+    unsigned index;
+  };
+
+  PreloadingFinder(System* s, Finder* finder):
+    s(s), allocator(s), finder(finder), entries(0), entryCount(0),
+    buckets(0), bucketCount(0), workerCount(0)
+  { }
+
+  // reads the class files whose names start with the specified
+  // prefix, or all of them if it is null
+  void preload(const char* prefix, unsigned threadCount) {
+    for (Finder::Iterator it(finder); it.hasMore();) {
+      unsigned nameSize = 0;
+      const char* name = it.next(&nameSize);
+      if (endsWith(".class", name, nameSize)
+          and (prefix == 0 or strncmp(name, prefix, nameSize - 6) == 0))
+      {
+        ++ entryCount;
+      }
+    }
+
+    if (entryCount == 0) {
+      return;
+    }
+
+    entries = static_cast<Entry*>
+      (vm::allocate(s, entryCount * sizeof(Entry)));
+
+    bucketCount = entryCount * 2;
+    buckets = static_cast<Entry**>
+      (vm::allocate(s, bucketCount * sizeof(Entry*)));
+    memset(buckets, 0, bucketCount * sizeof(Entry*));
+
+    unsigned i = 0;
+    for (Finder::Iterator it(finder); it.hasMore() and i < entryCount;) {
+      unsigned nameSize = 0;
+      const char* name = it.next(&nameSize);
+      if (endsWith(".class", name, nameSize)
+          and (prefix == 0 or strncmp(name, prefix, nameSize - 6) == 0))
+      {
+        Entry* e = entries + i++;
+        e->name = myStrndup(name, nameSize);
+        e->data = 0;
+        e->size = 0;
+
+        unsigned index = hash(e->name) % bucketCount;
+        e->next = buckets[index];
+        buckets[index] = e;
+      }
+    }
+    entryCount = i;
+
+    workerCount = threadCount;
+    Worker* workers = static_cast<Worker*>
+      (vm::allocate(s, workerCount * sizeof(Worker)));
+
+    for (unsigned i = 0; i < workerCount; ++i) {
+      Worker* w = new (workers + i) Worker;
+      w->finder = this;
+      w->index = i;
+      expect(s, s->success(s->start(w)));
+    }
+
+    for (unsigned i = 0; i < workerCount; ++i) {
+      workers[i].thread->join();
+      workers[i].thread->dispose();
+    }
+
+    s->free(workers);
+  }
+
+  Entry* findEntry(const char* name) {
+    if (bucketCount) {
+      for (Entry* e = buckets[hash(name) % bucketCount]; e; e = e->next) {
+        if (::strcmp(e->name, name) == 0) {
+          return e->data ? e : 0;
+        }
+      }
+    }
+    return 0;
+  }
+
+  virtual IteratorImp* iterator() {
+    return finder->iterator();
+  }
+
+  virtual System::Region* find(const char* name) {
+    Entry* e = findEntry(name);
+    if (e) {
+      return new (vm::allocate(s, sizeof(Buffer))) Buffer(s, e);
+    } else {
+      return finder->find(name);
+    }
+  }
+
+  virtual System::FileType stat(const char* name, unsigned* length,
+                                bool tryDirectory)
+  {
+    return finder->stat(name, length, tryDirectory);
+  }
+
+  virtual const char* urlPrefix(const char* name) {
+    return finder->urlPrefix(name);
+  }
+
+  virtual const char* sourceUrl(const char* name) {
+    return finder->sourceUrl(name);
+  }
+
+  virtual const char* path() {
+    return finder->path();
+  }
+
+  virtual void invalidate() {
+    finder->invalidate();
+  }
+
+  virtual unsigned negativeCacheHits() {
+    return finder->negativeCacheHits();
+  }
+
+  virtual unsigned negativeCacheMisses() {
+    return finder->negativeCacheMisses();
+  }
+
+  virtual InflateCache* inflateCache() {
+    return finder->inflateCache();
+  }
+
+  virtual void dispose() {
+    for (unsigned i = 0; i < entryCount; ++i) {
+      free(entries[i].name);
+      if (entries[i].data) {
+        s->free(entries[i].data);
+      }
+    }
+
+    if (entries) {
+      s->free(entries);
+      s->free(buckets);
+    }
+
+    finder->dispose();
+    s->free(this);
+  }
+
+  System* s;
+  SystemAllocator allocator;
+  Finder* finder;
+  Entry* entries;
+  unsigned entryCount;
+  Entry** buckets;
+  unsigned bucketCount;
+  unsigned workerCount;
+};
+
 class Arguments {
 public:
 
@@ -1753,6 +2624,12 @@ public:
   char* codeimageEnd;
 
   bool useLZMA;
+  bool useLZ;
+
+  bool treeShake;
+  const char* reflectionRoots;
+
+  int threads;
 
   bool maybeSplit(const char* src, char*& destA, char*& destB) {
     if(src) {
@@ -1784,6 +2661,10 @@ public:
     Arg bootimageSymbols(parser, false, "bootimage-symbols", "<start symbol name>:<end symbol name>");
     Arg codeimageSymbols(parser, false, "codeimage-symbols", "<start symbol name>:<end symbol name>");
     Arg useLZMA(parser, false, "use-lzma", 0);
+    Arg useLZ(parser, false, "use-lz", 0);
+    Arg treeShake(parser, false, "tree-shake", 0);
+    Arg reflectionRoots(parser, false, "reflection-roots", "<file>");
+    Arg threads(parser, false, "threads", "<number of threads reading class files>");
 
     if(!parser.parse(ac, av)) {
       parser.printUsage(av[0]);
@@ -1794,6 +2675,16 @@ public:
     this->bootimage = bootimage.value;
     this->codeimage = codeimage.value;
     this->useLZMA = useLZMA.value != 0;
+    this->useLZ = useLZ.value != 0;
+    this->treeShake = treeShake.value != 0;
+    this->reflectionRoots = reflectionRoots.value;
+    this->threads = threads.value ? atoi(threads.value) : 1;
+
+    if(this->threads < 1) {
+      fprintf(stderr, "-threads must be at least 1\n");
+      parser.printUsage(av[0]);
+      exit(1);
+    }
 
     if(entry.value) {
       if(const char* entryClassEnd = strchr(entry.value, '.')) {
@@ -1809,6 +2700,21 @@ public:
       }
     }
 
+    if(this->useLZMA && this->useLZ) {
+      fprintf(stderr, "-use-lzma and -use-lz are mutually exclusive\n");
+      parser.printUsage(av[0]);
+      exit(1);
+    }
+
+    if((this->treeShake && !entryClass) ||
+       (this->reflectionRoots && !this->treeShake))
+    {
+      fprintf(stderr, "-tree-shake requires -entry, and -reflection-roots "
+              "requires -tree-shake\n");
+      parser.printUsage(av[0]);
+      exit(1);
+    }
+
     if(!maybeSplit(bootimageSymbols.value, bootimageStart, bootimageEnd) ||
        !maybeSplit(codeimageSymbols.value, codeimageStart, codeimageEnd))
     {
@@ -1895,7 +2801,15 @@ main(int ac, const char** av)
   System* s = makeSystem(0);
   Heap* h = makeHeap(s, HeapCapacity * 2);
   Classpath* c = makeClasspath(s, h, AVIAN_JAVA_HOME, AVIAN_EMBED_PREFIX);
-  Finder* f = makeFinder(s, h, args.classpath, 0);
+  PreloadingFinder* f = new (allocate(s, sizeof(PreloadingFinder)))
+    PreloadingFinder(s, makeFinder(s, h, args.classpath, 0));
+
+  if (args.threads > 1) {
+    int64_t start = s->now();
+    f->preload(args.treeShake ? 0 : args.entryClass, args.threads);
+    reportPhase(s, "reading classes", start);
+  }
+
   Processor* p = makeProcessor(s, h, false);
 
   // todo: currently, the compiler cannot compile code with jumps or
@@ -1945,7 +2859,10 @@ main(int ac, const char** av)
     reinterpret_cast<uintptr_t>(args.bootimageEnd),
     reinterpret_cast<uintptr_t>(args.codeimageStart),
     reinterpret_cast<uintptr_t>(args.codeimageEnd),
-    static_cast<uintptr_t>(args.useLZMA)
+    static_cast<uintptr_t>(args.useLZMA),
+    static_cast<uintptr_t>(args.treeShake),
+    reinterpret_cast<uintptr_t>(args.reflectionRoots),
+    static_cast<uintptr_t>(args.useLZ)
   };
 
   run(t, writeBootImage, arguments);
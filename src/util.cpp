@@ -316,6 +316,31 @@ treeAdd(Thread* t, TreeContext* c)
   return newRoot;
 }
 
+unsigned
+treeCount(Thread* t, object node, object sentinal)
+{
+  if (node == sentinal) {
+    return 0;
+  } else {
+    return 1 + treeCount(t, treeNodeLeft(t, node), sentinal)
+      + treeCount(t, treeNodeRight(t, node), sentinal);
+  }
+}
+
+void
+treeCopyValues(Thread* t, object node, object sentinal, object array,
+               unsigned* index)
+{
+  if (node != sentinal) {
+    treeCopyValues(t, treeNodeLeft(t, node), sentinal, array, index);
+
+    set(t, array, ArrayBody + ((*index)++ * BytesPerWord),
+        getTreeNodeValue(t, node));
+
+    treeCopyValues(t, treeNodeRight(t, node), sentinal, array, index);
+  }
+}
+
 } // namespace
 
 namespace vm {
@@ -325,21 +350,13 @@ hashMapFindNode(Thread* t, object map, object key,
                 uint32_t (*hash)(Thread*, object),
                 bool (*equal)(Thread*, object, object))
 {
-  bool weak = objectClass(t, map) == type(t, Machine::WeakHashMapType);
+  assert(t, objectClass(t, map) != type(t, Machine::WeakHashMapType));
 
   object array = hashMapArray(t, map);
   if (array) {
     unsigned index = hash(t, key) & (arrayLength(t, array) - 1);
     for (object n = arrayBody(t, array, index); n; n = tripleThird(t, n)) {
-      object k = tripleFirst(t, n);
-      if (weak) {
-        k = jreferenceTarget(t, k);
-        if (k == 0) {
-          continue;
-        }
-      }
-
-      if (equal(t, key, k)) {
+      if (equal(t, key, tripleFirst(t, n))) {
         return n;
       }
     }
@@ -373,21 +390,12 @@ hashMapResize(Thread* t, object map, uint32_t (*hash)(Thread*, object),
     }
 
     if (oldArray) {
-      bool weak = objectClass(t, map) == type(t, Machine::WeakHashMapType);
       for (unsigned i = 0; i < arrayLength(t, oldArray); ++i) {
         object next;
         for (object p = arrayBody(t, oldArray, i); p; p = next) {
           next = tripleThird(t, p);
 
-          object k = tripleFirst(t, p);
-          if (weak) {
-            k = jreferenceTarget(t, k);
-            if (k == 0) {
-              continue;
-            }
-          }
-
-          unsigned index = hash(t, k) & (newLength - 1);
+          unsigned index = hash(t, tripleFirst(t, p)) & (newLength - 1);
 
           set(t, p, TripleThird, arrayBody(t, newArray, index));
           set(t, newArray, ArrayBody + (index * BytesPerWord), p);
@@ -409,9 +417,9 @@ hashMapInsert(Thread* t, object map, object key, object value,
 
   PROTECT(t, map);
 
-  uint32_t h = hash(t, key);
+  assert(t, objectClass(t, map) != type(t, Machine::WeakHashMapType));
 
-  bool weak = objectClass(t, map) == type(t, Machine::WeakHashMapType);
+  uint32_t h = hash(t, key);
 
   object array = hashMapArray(t, map);
 
@@ -426,22 +434,7 @@ hashMapInsert(Thread* t, object map, object key, object value,
     array = hashMapArray(t, map);
   }
 
-  object k = key;
-
-  if (weak) {
-    PROTECT(t, key);
-    PROTECT(t, value);
-
-    object r = makeWeakReference(t, 0, 0, 0, 0);
-    jreferenceTarget(t, r) = key;
-    jreferenceVmNext(t, r) = t->m->weakReferences;
-    t->m->weakReferences = r;
-    k = r;
-
-    array = hashMapArray(t, map);
-  }
-
-  object n = makeTriple(t, k, value, 0);
+  object n = makeTriple(t, key, value, 0);
 
   array = hashMapArray(t, map);
 
@@ -475,7 +468,7 @@ hashMapRemove(Thread* t, object map, object key,
               uint32_t (*hash)(Thread*, object),
               bool (*equal)(Thread*, object, object))
 {
-  bool weak = objectClass(t, map) == type(t, Machine::WeakHashMapType);
+  assert(t, objectClass(t, map) != type(t, Machine::WeakHashMapType));
 
   object array = hashMapArray(t, map);
   object o = 0;
@@ -483,16 +476,7 @@ hashMapRemove(Thread* t, object map, object key,
     unsigned index = hash(t, key) & (arrayLength(t, array) - 1);
     object p = 0;
     for (object n = arrayBody(t, array, index); n;) {
-      object k = tripleFirst(t, n);
-      if (weak) {
-        k = jreferenceTarget(t, k);
-        if (k == 0) {
-          n = tripleThird(t, hashMapRemoveNode(t, map, index, p, n));
-          continue;
-        }
-      }
-
-      if (equal(t, key, k)) {
+      if (equal(t, key, tripleFirst(t, n))) {
         o = tripleSecond(t, hashMapRemoveNode(t, map, index, p, n));
         break;
       } else {
@@ -512,6 +496,217 @@ hashMapRemove(Thread* t, object map, object key,
   return o;
 }
 
+object
+weakHashMapFindNode(Thread* t, object map, object key, uint32_t hash,
+                    bool (*equal)(Thread*, object, object))
+{
+  // this may be called without holding any lock, so we must tolerate
+  // concurrent inserts and resizes.  The worst that can happen is
+  // that we follow a node which has just been moved to another
+  // bucket and miss an entry, in which case the caller will retry
+  // while holding the lock which guards insertion.  We may not be
+  // interrupted by a collection since we don't allocate.
+
+  object array = hashMapArray(t, map);
+  if (array) {
+    unsigned index = hash & (arrayLength(t, array) - 1);
+    for (object n = arrayBody(t, array, index); n;
+         n = weakHashMapNodeNext(t, n))
+    {
+      if (weakHashMapNodeHash(t, n) == hash
+          and equal(t, key, weakHashMapNodeKey(t, n)))
+      {
+        return n;
+      }
+    }
+  }
+  return 0;
+}
+
+void
+weakHashMapResize(Thread* t, object map, unsigned size)
+{
+  PROTECT(t, map);
+
+  object oldArray = hashMapArray(t, map);
+  PROTECT(t, oldArray);
+
+  unsigned newLength = nextPowerOfTwo(size);
+  if (oldArray and arrayLength(t, oldArray) == newLength) {
+    return;
+  }
+
+  object newArray = makeArray(t, newLength);
+
+  if (oldArray != hashMapArray(t, map)) {
+    // a resize was performed during a GC via the makeArray call
+    // above; nothing left to do
+    return;
+  }
+
+  if (oldArray) {
+    for (unsigned i = 0; i < arrayLength(t, oldArray); ++i) {
+      object next;
+      for (object p = arrayBody(t, oldArray, i); p; p = next) {
+        next = weakHashMapNodeNext(t, p);
+
+        unsigned index = weakHashMapNodeHash(t, p) & (newLength - 1);
+
+        set(t, p, WeakHashMapNodeNext, arrayBody(t, newArray, index));
+        set(t, newArray, ArrayBody + (index * BytesPerWord), p);
+      }
+    }
+  }
+
+  storeStoreMemoryBarrier();
+
+  set(t, map, HashMapArray, newArray);
+}
+
+void
+weakHashMapInsert(Thread* t, object map, object key, object value,
+                  uint32_t hash)
+{
+  PROTECT(t, map);
+  PROTECT(t, key);
+  PROTECT(t, value);
+
+  object array = hashMapArray(t, map);
+
+  if (array == 0 or hashMapSize(t, map) + 1 >= arrayLength(t, array) * 2) {
+    weakHashMapResize(t, map, array ? arrayLength(t, array) * 2 : 16);
+  }
+
+  object n = makeWeakHashMapNode(t, 0, value, 0, 0, hash);
+
+  // the key is not traced by the collector, so no write barrier is
+  // needed; weakHashMapSweep will update or clear it as appropriate
+  weakHashMapNodeKey(t, n) = key;
+
+  // the node is born young, so add it to the list of entries the
+  // next minor collection will need to examine
+  set(t, n, WeakHashMapNodeNextYoung, weakHashMapYoung(t, map));
+
+  array = hashMapArray(t, map);
+
+  unsigned index = hash & (arrayLength(t, array) - 1);
+
+  set(t, n, WeakHashMapNodeNext, arrayBody(t, array, index));
+
+  // make sure the node is fully initialized before it becomes
+  // visible to lock-free readers
+  storeStoreMemoryBarrier();
+
+  set(t, array, ArrayBody + (index * BytesPerWord), n);
+  set(t, map, WeakHashMapYoung, n);
+
+  ++ hashMapSize(t, map);
+
+  if (hashMapSize(t, map) <= arrayLength(t, array) / 3) {
+    // this might happen if entries were swept during GC in which case
+    // we weren't able to resize at the time
+    weakHashMapResize(t, map, arrayLength(t, array) / 2);
+  }
+}
+
+void
+weakHashMapSweep(Thread* t, Heap::Visitor* v, object map)
+{
+  if (map == 0) {
+    return;
+  }
+
+  Heap* heap = t->m->heap;
+  object array = hashMapArray(t, map);
+
+  if (heap->collectionType() == Heap::MajorCollection) {
+    // every key may have moved or died, so visit them all and rebuild
+    // the young list from scratch
+    object young = 0;
+    if (array) {
+      for (unsigned i = 0; i < arrayLength(t, array); ++i) {
+        object p = 0;
+        for (object n = arrayBody(t, array, i); n;) {
+          object next = weakHashMapNodeNext(t, n);
+
+          if (heap->status(weakHashMapNodeKey(t, n)) == Heap::Unreachable) {
+            if (p) {
+              set(t, p, WeakHashMapNodeNext, next);
+            } else {
+              set(t, array, ArrayBody + (i * BytesPerWord), next);
+            }
+            -- hashMapSize(t, map);
+
+            set(t, n, WeakHashMapNodeNextYoung, 0);
+          } else {
+            v->visit(&weakHashMapNodeKey(t, n));
+
+            if (heap->status(weakHashMapNodeKey(t, n)) == Heap::Tenured) {
+              set(t, n, WeakHashMapNodeNextYoung, 0);
+            } else {
+              set(t, n, WeakHashMapNodeNextYoung, young);
+              young = n;
+            }
+
+            p = n;
+          }
+
+          n = next;
+        }
+      }
+    }
+
+    set(t, map, WeakHashMapYoung, young);
+  } else {
+    // only keys which were young before this collection can have
+    // moved or died, and those are all on the young list
+    object p = 0;
+    for (object n = weakHashMapYoung(t, map); n;) {
+      object next = weakHashMapNodeNextYoung(t, n);
+
+      bool young;
+      if (heap->status(weakHashMapNodeKey(t, n)) == Heap::Unreachable) {
+        unsigned index = weakHashMapNodeHash(t, n)
+          & (arrayLength(t, array) - 1);
+
+        object bp = 0;
+        for (object bn = arrayBody(t, array, index); bn != n;
+             bn = weakHashMapNodeNext(t, bn))
+        {
+          bp = bn;
+        }
+
+        if (bp) {
+          set(t, bp, WeakHashMapNodeNext, weakHashMapNodeNext(t, n));
+        } else {
+          set(t, array, ArrayBody + (index * BytesPerWord),
+              weakHashMapNodeNext(t, n));
+        }
+        -- hashMapSize(t, map);
+
+        young = false;
+      } else {
+        v->visit(&weakHashMapNodeKey(t, n));
+
+        young = heap->status(weakHashMapNodeKey(t, n)) != Heap::Tenured;
+      }
+
+      if (young) {
+        p = n;
+      } else {
+        if (p) {
+          set(t, p, WeakHashMapNodeNextYoung, next);
+        } else {
+          set(t, map, WeakHashMapYoung, next);
+        }
+        set(t, n, WeakHashMapNodeNextYoung, 0);
+      }
+
+      n = next;
+    }
+  }
+}
+
 void
 listAppend(Thread* t, object list, object value)
 {
@@ -600,4 +795,18 @@ treeUpdate(Thread* t, object tree, intptr_t key, object value, object sentinal,
   setTreeNodeValue(t, treeFind(t, tree, key, sentinal, compare), value);
 }
 
+object
+treeValues(Thread* t, object tree, object sentinal)
+{
+  PROTECT(t, tree);
+  PROTECT(t, sentinal);
+
+  object array = makeArray(t, treeCount(t, tree, sentinal));
+
+  unsigned index = 0;
+  treeCopyValues(t, tree, sentinal, array, &index);
+
+  return array;
+}
+
 } // namespace vm
@@ -642,7 +642,7 @@ class MySystem: public System {
     if (p) ::free(const_cast<void*>(p));
   }
 
-  virtual void* tryAllocateExecutable(unsigned sizeInBytes) {
+  virtual void* tryAllocateExecutable(unsigned sizeInBytes, void* hint) {
 #ifdef MAP_32BIT
     // map to the lower 32 bits of memory when possible so as to avoid
     // expensive relative jumps
@@ -651,7 +651,9 @@ class MySystem: public System {
     const unsigned Extra = 0;
 #endif
 
-    void* p = mmap(0, sizeInBytes, PROT_EXEC | PROT_READ | PROT_WRITE,
+    // the hint is only a preference; the kernel is free to map
+    // elsewhere if that range isn't available
+    void* p = mmap(hint, sizeInBytes, PROT_EXEC | PROT_READ | PROT_WRITE,
                    MAP_PRIVATE | MAP_ANON | Extra, -1, 0);
 
     if (p == MAP_FAILED) {
@@ -803,6 +805,43 @@ class MySystem: public System {
     return status;
   }
 
+  // Maps the specified file at exactly the specified address, or
+  // fails if that range is unavailable.  The mapping is private and
+  // writable, so pages are shared with every other process mapping
+  // the same file until they are written to.
+  virtual Status map(System::Region** region, const char* name,
+                     void* address)
+  {
+    Status status = 1;
+
+    int fd = ::open(name, O_RDONLY);
+    if (fd != -1) {
+      struct stat s;
+      int r = fstat(fd, &s);
+      if (r != -1) {
+#ifdef MAP_FIXED_NOREPLACE
+        const int Fixed = MAP_FIXED_NOREPLACE;
+#else
+        const int Fixed = 0;
+#endif
+
+        void* data = mmap(address, s.st_size,
+                          PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | Fixed, fd, 0);
+        if (data == address) {
+          *region = new (allocate(this, sizeof(Region)))
+            Region(this, static_cast<uint8_t*>(data), s.st_size);
+          status = 0;
+        } else if (data != MAP_FAILED) {
+          munmap(data, s.st_size);
+        }
+      }
+      close(fd);
+    }
+
+    return status;
+  }
+
   virtual Status open(System::Directory** directory, const char* name) {
     Status status = 1;
     
@@ -852,6 +891,23 @@ class MySystem: public System {
     }
   }
 
+  virtual int64_t lastModified(const char* name) {
+#ifdef __FreeBSD__
+    struct stat ss;
+    struct stat* s = &ss;
+#else
+    // see the comment in stat above regarding the size of this array:
+    void* array[ceilingDivide(sizeof(struct stat), sizeof(void*)) + 8];
+    struct stat* s = reinterpret_cast<struct stat*>(array);
+#endif
+
+    if (::stat(name, s) == 0) {
+      return static_cast<int64_t>(s->st_mtime) * 1000;
+    } else {
+      return 0;
+    }
+  }
+
   virtual const char* libraryPrefix() {
     return SO_PREFIX;
   }
@@ -697,9 +697,17 @@ class MySystem: public System {
   }
 
   #if !defined(AVIAN_AOT_ONLY)
-  virtual void* tryAllocateExecutable(unsigned sizeInBytes) {
-    return VirtualAlloc
-      (0, sizeInBytes, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+  virtual void* tryAllocateExecutable(unsigned sizeInBytes, void* hint) {
+    void* p = hint ? VirtualAlloc
+      (hint, sizeInBytes, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE)
+      : 0;
+
+    if (p == 0) {
+      p = VirtualAlloc
+        (0, sizeInBytes, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    }
+
+    return p;
   }
 
   virtual void freeExecutable(const void* p, unsigned) {
@@ -855,6 +863,51 @@ class MySystem: public System {
     return status;
   }
 
+  // Maps the specified file at exactly the specified address, or
+  // fails if that range is unavailable.  The view is copy-on-write,
+  // so pages are shared with every other process mapping the same
+  // file until they are written to.
+  virtual Status map(System::Region** region UNUSED, const char* name UNUSED,
+                     void* address UNUSED)
+  {
+    Status status = 1;
+#if !defined(WINAPI_FAMILY) || WINAPI_FAMILY_PARTITION(WINAPI_PARTITION_DESKTOP)
+    size_t nameLen = strlen(name) * 2;
+    RUNTIME_ARRAY(wchar_t, wideName, nameLen + 1);
+    MultiByteToWideChar(CP_UTF8, 0, name, -1, RUNTIME_ARRAY_BODY(wideName), nameLen + 1);
+    HANDLE file = CreateFileW(RUNTIME_ARRAY_BODY(wideName), FILE_READ_DATA | FILE_EXECUTE,
+                              FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+      unsigned size = GetFileSize(file, 0);
+      if (size != INVALID_FILE_SIZE) {
+        HANDLE mapping = CreateFileMapping
+          (file, 0, PAGE_EXECUTE_WRITECOPY, 0, size, 0);
+        if (mapping) {
+          void* data = MapViewOfFileEx
+            (mapping, FILE_MAP_COPY | FILE_MAP_EXECUTE, 0, 0, 0, address);
+          if (data == address) {
+            *region = new (allocate(this, sizeof(Region)))
+              Region(this, static_cast<uint8_t*>(data), size, mapping, file);
+            status = 0;
+          } else if (data) {
+            UnmapViewOfFile(data);
+          }
+
+          if (status) {
+            CloseHandle(mapping);
+          }
+        }
+      }
+
+      if (status) {
+        CloseHandle(file);
+      }
+    }
+#endif
+
+    return status;
+  }
+
   virtual Status open(System::Directory** directory, const char* name) {
     Status status = 1;
 
@@ -900,6 +953,22 @@ class MySystem: public System {
     }
   }
 
+  virtual int64_t lastModified(const char* name) {
+    size_t nameLen = strlen(name) * 2;
+    RUNTIME_ARRAY(wchar_t, wideName, nameLen + 1);
+    MultiByteToWideChar(CP_UTF8, 0, name, -1, RUNTIME_ARRAY_BODY(wideName), nameLen + 1);
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (GetFileAttributesExW
+        (RUNTIME_ARRAY_BODY(wideName), GetFileExInfoStandard, &data))
+    {
+      return (((static_cast<int64_t>(data.ftLastWriteTime.dwHighDateTime)
+                << 32) | data.ftLastWriteTime.dwLowDateTime) / 10000)
+        - 11644473600000LL;
+    } else {
+      return 0;
+    }
+  }
+
   virtual const char* libraryPrefix() {
     return SO_PREFIX;
   }
@@ -0,0 +1,171 @@
+import java.util.Arrays;
+
+public class ArrayCopy {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static void garbage() {
+    for (int i = 0; i < 64; ++i) {
+      byte[] a = new byte[1024];
+    }
+  }
+
+  private static void copyBytes(int size) {
+    byte[] a = new byte[size];
+    for (int i = 0; i < size; ++i) a[i] = (byte) i;
+
+    byte[] b = new byte[size + 2];
+    System.arraycopy(a, 0, b, 1, size);
+    expect(b[0] == 0 && b[size + 1] == 0);
+    for (int i = 0; i < size; ++i) expect(b[i + 1] == (byte) i);
+
+    // overlapping, in both directions
+    System.arraycopy(a, 0, a, 1, size - 1);
+    for (int i = 1; i < size; ++i) expect(a[i] == (byte) (i - 1));
+    System.arraycopy(a, 1, a, 0, size - 1);
+    for (int i = 0; i < size - 1; ++i) expect(a[i] == (byte) i);
+  }
+
+  private static void copyLongs(int size) {
+    long[] a = new long[size];
+    for (int i = 0; i < size; ++i) a[i] = i * 0x100000001L;
+
+    long[] b = new long[size];
+    System.arraycopy(a, 0, b, 0, size);
+    for (int i = 0; i < size; ++i) expect(b[i] == i * 0x100000001L);
+
+    System.arraycopy(a, 0, a, 2, size - 2);
+    for (int i = 2; i < size; ++i) expect(a[i] == (i - 2) * 0x100000001L);
+  }
+
+  private static void copyObjects(int size) {
+    Object[] a = new Object[size];
+    Object[] b = new Object[size];
+    for (int i = 0; i < size; ++i) a[i] = Integer.toString(i);
+
+    garbage();
+    System.gc();
+
+    // the destination is now tenured, while the strings we copy into it
+    // below are young:
+    for (int i = 0; i < size; ++i) a[i] = Integer.toString(i * 2);
+    System.arraycopy(a, 0, b, 0, size);
+
+    garbage();
+
+    for (int i = 0; i < size; ++i) expect(b[i].equals(Integer.toString(i * 2)));
+  }
+
+  public static void main(String[] args) {
+    for (int size = 2; size < 200; size += 7) {
+      copyBytes(size);
+      copyLongs(size);
+    }
+
+    copyObjects(100);
+
+    { String[] a = new String[] { "a", "b", "c" };
+      Object[] b = new Object[3];
+      System.arraycopy(a, 0, b, 0, 3);
+      expect(b[2] == "c");
+    }
+
+    try {
+      System.arraycopy(new int[3], 0, new long[3], 0, 3);
+      expect(false);
+    } catch (ArrayStoreException e) { }
+
+    try {
+      System.arraycopy(new int[3], 0, new Object[3], 0, 3);
+      expect(false);
+    } catch (ArrayStoreException e) { }
+
+    try {
+      System.arraycopy(new int[3], 1, new int[3], 0, 3);
+      expect(false);
+    } catch (IndexOutOfBoundsException e) { }
+
+    try {
+      System.arraycopy(new int[3], 0, new int[3], 0, -1);
+      expect(false);
+    } catch (IndexOutOfBoundsException e) { }
+
+    try {
+      System.arraycopy(new int[3], Integer.MAX_VALUE, new int[3], 0, 2);
+      expect(false);
+    } catch (IndexOutOfBoundsException e) { }
+
+    try {
+      System.arraycopy(null, 0, new int[3], 0, 3);
+      expect(false);
+    } catch (NullPointerException e) { }
+
+    { byte[] a = new byte[13];
+      Arrays.fill(a, (byte) -3);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == -3);
+    }
+
+    { boolean[] a = new boolean[5];
+      Arrays.fill(a, true);
+      for (int i = 0; i < a.length; ++i) expect(a[i]);
+    }
+
+    { char[] a = new char[7];
+      Arrays.fill(a, (char) 0xFFFF);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == 0xFFFF);
+    }
+
+    { short[] a = new short[7];
+      Arrays.fill(a, (short) -2);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == -2);
+    }
+
+    { int[] a = new int[9];
+      Arrays.fill(a, -42);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == -42);
+    }
+
+    { float[] a = new float[9];
+      Arrays.fill(a, 1.5f);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == 1.5f);
+    }
+
+    { long[] a = new long[9];
+      Arrays.fill(a, Long.MIN_VALUE + 1);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == Long.MIN_VALUE + 1);
+    }
+
+    { double[] a = new double[9];
+      Arrays.fill(a, -0.25);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == -0.25);
+    }
+
+    { Object[] a = new Object[9];
+      garbage();
+      System.gc();
+      Arrays.fill(a, Integer.toString(42));
+      garbage();
+      for (int i = 0; i < a.length; ++i) expect(a[i].equals("42"));
+    }
+
+    { Object[] a = new String[3];
+      try {
+        Arrays.fill(a, Integer.valueOf(1));
+        expect(false);
+      } catch (ArrayStoreException e) { }
+      for (int i = 0; i < a.length; ++i) expect(a[i] == null);
+
+      Arrays.fill(a, "x");
+      for (int i = 0; i < a.length; ++i) expect(a[i] == "x");
+
+      Arrays.fill(a, null);
+      for (int i = 0; i < a.length; ++i) expect(a[i] == null);
+    }
+
+    try {
+      Arrays.fill((int[]) null, 1);
+      expect(false);
+    } catch (NullPointerException e) { }
+  }
+}
@@ -3,6 +3,16 @@ public class Arrays {
     if (! v) throw new RuntimeException();
   }
 
+  private static int get(int[] array, int index) {
+    // no handler applies here, so the failure path may be compiled
+    // out of line:
+    return array[index];
+  }
+
+  private static void set(Object[] array, int index, Object value) {
+    array[index] = value;
+  }
+
   public static void main(String[] args) {
     { int[] array = new int[0];
       Exception exception = null;
@@ -94,5 +104,36 @@ public class Arrays {
       java.util.Arrays.hashCode(a);
       java.util.Arrays.hashCode((Object[])null);
     }
+
+    { int[] array = new int[] { 1, 2, 3 };
+      expect(get(array, 2) == 3);
+
+      for (int i = -1; i <= 3; i += 4) {
+        Exception exception = null;
+        try {
+          get(array, i);
+        } catch (ArrayIndexOutOfBoundsException e) {
+          exception = e;
+          StackTraceElement[] trace = e.getStackTrace();
+          expect(trace[0].getMethodName().equals("get"));
+          expect(trace[1].getMethodName().equals("main"));
+        }
+
+        expect(exception != null);
+      }
+
+      Object[] objects = new Object[2];
+      set(objects, 1, array);
+      expect(objects[1] == array);
+
+      Exception exception = null;
+      try {
+        set(objects, 2, array);
+      } catch (ArrayIndexOutOfBoundsException e) {
+        exception = e;
+      }
+
+      expect(exception != null);
+    }
   }
 }
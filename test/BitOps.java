@@ -0,0 +1,94 @@
+public class BitOps {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static int slowBitCount(long v) {
+    int count = 0;
+    for (int i = 0; i < 64; ++i) {
+      if ((v & (1L << i)) != 0) ++ count;
+    }
+    return count;
+  }
+
+  private static int slowLeadingZeros(long v, int bits) {
+    int count = 0;
+    for (int i = bits - 1; i >= 0 && (v & (1L << i)) == 0; --i) ++ count;
+    return count;
+  }
+
+  private static int slowTrailingZeros(long v, int bits) {
+    int count = 0;
+    for (int i = 0; i < bits && (v & (1L << i)) == 0; ++i) ++ count;
+    return count;
+  }
+
+  private static void testInt(int v) {
+    expect(Integer.bitCount(v) == slowBitCount(v & 0xFFFFFFFFL));
+    expect(Integer.numberOfLeadingZeros(v)
+           == slowLeadingZeros(v & 0xFFFFFFFFL, 32));
+    expect(Integer.numberOfTrailingZeros(v)
+           == slowTrailingZeros(v & 0xFFFFFFFFL, 32));
+    expect(Integer.reverseBytes(Integer.reverseBytes(v)) == v);
+
+    for (int d = -33; d <= 65; ++d) {
+      expect(Integer.rotateLeft(v, d) == ((v << d) | (v >>> -d)));
+      expect(Integer.rotateRight(v, d) == ((v >>> d) | (v << -d)));
+    }
+
+    // constant distances are encoded directly by the JIT:
+    expect(Integer.rotateLeft(v, 5) == ((v << 5) | (v >>> 27)));
+    expect(Integer.rotateRight(v, 40) == ((v >>> 8) | (v << 24)));
+  }
+
+  private static void testLong(long v) {
+    expect(Long.bitCount(v) == slowBitCount(v));
+    expect(Long.numberOfLeadingZeros(v) == slowLeadingZeros(v, 64));
+    expect(Long.numberOfTrailingZeros(v) == slowTrailingZeros(v, 64));
+    expect(Long.reverseBytes(Long.reverseBytes(v)) == v);
+
+    for (int d = -65; d <= 129; ++d) {
+      expect(Long.rotateLeft(v, d) == ((v << d) | (v >>> -d)));
+      expect(Long.rotateRight(v, d) == ((v >>> d) | (v << -d)));
+    }
+
+    expect(Long.rotateLeft(v, 7) == ((v << 7) | (v >>> 57)));
+    expect(Long.rotateRight(v, 72) == ((v >>> 8) | (v << 56)));
+  }
+
+  public static void main(String[] args) {
+    int[] ints = { 0, 1, -1, 2, 0x80000000, 0x7FFFFFFF, 0x12345678,
+                   0xF0F0F0F0, 0x00010000, -42 };
+    for (int i = 0; i < ints.length; ++i) {
+      testInt(ints[i]);
+    }
+
+    long[] longs = { 0L, 1L, -1L, 2L, 0x8000000000000000L,
+                     0x7FFFFFFFFFFFFFFFL, 0x123456789ABCDEF0L,
+                     0x0000000100000000L, 0x00000000FFFFFFFFL, -42L };
+    for (int i = 0; i < longs.length; ++i) {
+      testLong(longs[i]);
+    }
+
+    expect(Integer.reverseBytes(0x12345678) == 0x78563412);
+    expect(Long.reverseBytes(0x0102030405060708L) == 0x0807060504030201L);
+
+    for (int i = 0; i < ints.length; ++i) {
+      for (int j = 0; j < ints.length; ++j) {
+        int a = ints[i];
+        int b = ints[j];
+        expect(Math.min(a, b) == (a < b ? a : b));
+        expect(Math.max(a, b) == (a > b ? a : b));
+      }
+    }
+
+    for (int i = 0; i < longs.length; ++i) {
+      for (int j = 0; j < longs.length; ++j) {
+        long a = longs[i];
+        long b = longs[j];
+        expect(Math.min(a, b) == (a < b ? a : b));
+        expect(Math.max(a, b) == (a > b ? a : b));
+      }
+    }
+  }
+}
@@ -0,0 +1,205 @@
+public class EscapeAnalysis {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static class Cell {
+    public int i;
+    public long l;
+    public double d;
+    public byte b;
+    public char c;
+    public boolean z;
+    public Object o;
+
+    public Cell(int i, long l, Object o) {
+      this.i = i;
+      this.l = l;
+      this.d = 1.0;
+      this.o = o;
+    }
+  }
+
+  private static class Point {
+    public int x;
+    public int y;
+
+    public Point() { }
+
+    public Point(int x, int y) {
+      this.x = x;
+      this.y = y;
+    }
+  }
+
+  private static class Point3 extends Point {
+    public int z = 7;
+
+    public Point3() {
+      super();
+    }
+  }
+
+  private static int baseInitCount;
+
+  private static class InitBase {
+    static {
+      ++ baseInitCount;
+    }
+
+    public int x;
+  }
+
+  private static class InitSub extends InitBase {
+    // no static initializer of its own, so only the superclass needs
+    // initializing when this is allocated
+    public int y;
+
+    public InitSub(int x, int y) {
+      this.x = x;
+      this.y = y;
+    }
+  }
+
+  private static int initSub(int n) {
+    InitSub s = new InitSub(n, n + 1);
+    return s.x + s.y;
+  }
+
+  private static long sum(int count) {
+    long sum = 0;
+    for (int i = 0; i < count; ++i) {
+      // none of these objects escape, so their fields should be kept
+      // in locals instead of on the heap:
+      Cell c = new Cell(i, i * 3L, null);
+      c.b = (byte) i;
+      c.c = (char) i;
+      c.z = (i & 1) != 0;
+      c.d += i;
+
+      Point p = new Point(i, -i);
+      sum += c.i + c.l + (long) c.d + c.b + c.c + (c.z ? 1 : 0) + p.x + p.y;
+    }
+    return sum;
+  }
+
+  private static long expectedSum(int count) {
+    long sum = 0;
+    for (int i = 0; i < count; ++i) {
+      sum += i + (i * 3L) + (long) (1.0 + i) + (byte) i + (char) i
+        + ((i & 1) != 0 ? 1 : 0);
+    }
+    return sum;
+  }
+
+  private static int divide(int a, int b) {
+    Point p = new Point(a, b);
+    try {
+      p.x = p.x / p.y;
+      p.y = -1;
+    } catch (ArithmeticException e) {
+      // the update to y must not have happened, and x must be intact
+      expect(p.y == 0);
+      return p.x;
+    }
+    return p.x + p.y;
+  }
+
+  private static int locked(int n) {
+    Point p = new Point(n, 0);
+    synchronized (p) {
+      p.y = n * 2;
+    }
+    return p.x + p.y;
+  }
+
+  private static int lockedThrow(int n) {
+    Point p = new Point(n, 0);
+    try {
+      synchronized (p) {
+        p.y = n;
+        if (n > 0) {
+          throw new IllegalStateException();
+        }
+      }
+    } catch (IllegalStateException e) {
+      return p.y;
+    }
+    return -1;
+  }
+
+  private static void thrower(int n) {
+    Point p = new Point(n, n);
+    if (p.x == n) {
+      throw new IllegalArgumentException(Integer.toString(p.y));
+    }
+  }
+
+  private static Object escape(int n) {
+    Point p = new Point(n, n + 1);
+    return p;
+  }
+
+  private static int partial(boolean flag) {
+    // the object escapes on one path only, so it must be allocated
+    // normally on both
+    Point p = new Point(1, 2);
+    Object o = flag ? p : null;
+    p.x = 5;
+    return o == null ? p.x : ((Point) o).x + 10;
+  }
+
+  public static void main(String[] args) {
+    for (int i = 0; i < 3; ++i) {
+      expect(sum(10000) == expectedSum(10000));
+    }
+
+    expect(divide(10, 2) == 4);
+    expect(divide(10, 0) == 10);
+
+    expect(locked(3) == 9);
+    expect(lockedThrow(4) == 4);
+    expect(lockedThrow(0) == -1);
+
+    { Object o = new Object();
+      synchronized (o) {
+        expect(Thread.holdsLock(o));
+      }
+      expect(! Thread.holdsLock(o));
+    }
+
+    { Point3 p = new Point3();
+      p.x = 1;
+      expect(p.x + p.y + p.z == 8);
+    }
+
+    for (int i = 0; i < 100; ++i) {
+      try {
+        thrower(i);
+        expect(false);
+      } catch (IllegalArgumentException e) {
+        expect(e.getMessage().equals(Integer.toString(i)));
+
+        // replacing the objects and inlining their constructors must
+        // not introduce or lose any frames:
+        StackTraceElement[] trace = e.getStackTrace();
+        expect(trace[0].getMethodName().equals("thrower"));
+        expect(trace[1].getMethodName().equals("main"));
+        expect(trace[0].getClassName().equals("EscapeAnalysis"));
+      }
+    }
+
+    { Point p = (Point) escape(42);
+      expect(p.x == 42 && p.y == 43);
+    }
+
+    expect(baseInitCount == 0);
+    expect(initSub(3) == 7);
+    expect(baseInitCount == 1);
+    expect(initSub(4) == 9);
+    expect(baseInitCount == 1);
+
+    expect(partial(false) == 5);
+    expect(partial(true) == 15);
+  }
+}
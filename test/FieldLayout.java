@@ -0,0 +1,115 @@
+public class FieldLayout {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static class Base {
+    public byte b1;
+    public long l1;
+    public Object o1;
+    public byte b2;
+    public int i1;
+  }
+
+  private static class Derived extends Base {
+    // these should be placed in the space left over at the end of
+    // Base's layout, where possible
+    public short s1;
+    public byte b3;
+    public Object o2;
+    public char c1;
+  }
+
+  private static class MoreDerived extends Derived {
+    public boolean z1;
+    public double d1;
+    public Object o3;
+  }
+
+  private static class MyThread extends Thread {
+    public byte b1;
+  }
+
+  private static class MoreThread extends MyThread {
+    // Thread has slots the VM adds which its field table doesn't
+    // mention, so these must not be placed in what looks like a hole
+    // in its layout
+    public byte b2;
+    public short s1;
+    public int i1;
+    public Object o1;
+  }
+
+  private static void testThreadSubclass() throws Exception {
+    MoreThread t = new MoreThread();
+    t.b1 = 1;
+    t.b2 = 2;
+    t.s1 = 3;
+    t.i1 = 4;
+    t.o1 = "5";
+
+    t.start();
+    t.interrupt();
+    t.join();
+
+    expect(t.b1 == 1);
+    expect(t.b2 == 2);
+    expect(t.s1 == 3);
+    expect(t.i1 == 4);
+    expect(t.o1.equals("5"));
+  }
+
+  private static void garbage() {
+    for (int i = 0; i < 64; ++i) {
+      byte[] a = new byte[1024];
+    }
+  }
+
+  public static void main(String[] args) throws Exception {
+    MoreDerived[] array = new MoreDerived[1024];
+    for (int i = 0; i < array.length; ++i) {
+      MoreDerived d = new MoreDerived();
+      d.b1 = (byte) i;
+      d.l1 = i * 1000000007L;
+      d.o1 = Integer.toString(i);
+      d.b2 = (byte) -i;
+      d.i1 = i * 7;
+      d.s1 = (short) (i * 3);
+      d.b3 = (byte) (i + 1);
+      d.o2 = Integer.toString(i * 2);
+      d.c1 = (char) (i + 'a');
+      d.z1 = (i % 2) == 0;
+      d.d1 = i * 0.5;
+      d.o3 = Integer.toString(i * 3);
+      array[i] = d;
+    }
+
+    garbage();
+    System.gc();
+
+    for (int i = 0; i < array.length; ++i) {
+      MoreDerived d = array[i];
+      expect(d.b1 == (byte) i);
+      expect(d.l1 == i * 1000000007L);
+      expect(d.o1.equals(Integer.toString(i)));
+      expect(d.b2 == (byte) -i);
+      expect(d.i1 == i * 7);
+      expect(d.s1 == (short) (i * 3));
+      expect(d.b3 == (byte) (i + 1));
+      expect(d.o2.equals(Integer.toString(i * 2)));
+      expect(d.c1 == (char) (i + 'a'));
+      expect(d.z1 == ((i % 2) == 0));
+      expect(d.d1 == i * 0.5);
+      expect(d.o3.equals(Integer.toString(i * 3)));
+    }
+
+    // reflection must see the same offsets as compiled code
+    MoreDerived d = array[42];
+    expect(((Byte) Base.class.getField("b2").get(d)) == (byte) -42);
+    expect(((Short) Derived.class.getField("s1").get(d)) == (short) 126);
+    expect(((Boolean) MoreDerived.class.getField("z1").get(d)));
+    expect(MoreDerived.class.getField("o3").get(d).equals("126"));
+
+    testThreadSubclass();
+  }
+}
@@ -0,0 +1,46 @@
+import java.io.ByteArrayOutputStream;
+import java.io.InputStream;
+
+public class InflateCache {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static byte[] read(String name) throws Exception {
+    InputStream in = ClassLoader.getSystemResourceAsStream(name);
+    expect(in != null);
+
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    byte[] buffer = new byte[1024];
+    int c;
+    while ((c = in.read(buffer)) > 0) {
+      out.write(buffer, 0, c);
+    }
+    in.close();
+    return out.toByteArray();
+  }
+
+  public static void main(String[] args) throws Exception {
+    int hits = avian.SystemClassLoader.inflateCacheHits();
+    int misses = avian.SystemClassLoader.inflateCacheMisses();
+
+    // whether or not these come from the cache, repeated reads must
+    // see the same bytes:
+    String[] names = { "java/lang/Object.class", "java/lang/String.class",
+                       "InflateCache.class" };
+    for (int i = 0; i < names.length; ++i) {
+      byte[] first = read(names[i]);
+      expect(first.length > 0);
+      for (int j = 0; j < 10; ++j) {
+        byte[] again = read(names[i]);
+        expect(again.length == first.length);
+        for (int k = 0; k < first.length; ++k) {
+          expect(again[k] == first[k]);
+        }
+      }
+    }
+
+    expect(avian.SystemClassLoader.inflateCacheHits() >= hits);
+    expect(avian.SystemClassLoader.inflateCacheMisses() >= misses);
+  }
+}
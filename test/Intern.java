@@ -0,0 +1,59 @@
+public class Intern {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static String make(int i) {
+    return new StringBuilder().append("intern-").append(i).toString();
+  }
+
+  public static void main(String[] args) {
+    final int count = 16 * 1024;
+
+    String[] kept = new String[count / 2];
+    for (int i = 0; i < count; ++i) {
+      String s = make(i).intern();
+      if (i % 2 == 0) {
+        kept[i / 2] = s;
+      }
+    }
+
+    // the odd entries are now unreachable and should be swept from the
+    // intern table, while the even ones must keep their identity
+    System.gc();
+
+    for (int i = 0; i < count; ++i) {
+      String s = make(i);
+      String interned = s.intern();
+      if (i % 2 == 0) {
+        expect(interned == kept[i / 2]);
+      } else {
+        expect(interned.equals(s));
+      }
+      expect(interned == make(i).intern());
+    }
+
+    // monitors for objects which become unreachable should be
+    // reclaimed without the help of finalizers
+    Object[] locks = new Object[count];
+    for (int i = 0; i < count; ++i) {
+      locks[i] = new Object();
+      synchronized (locks[i]) {
+        expect(Thread.holdsLock(locks[i]));
+      }
+    }
+
+    for (int i = 0; i < count; i += 2) {
+      locks[i] = null;
+    }
+
+    System.gc();
+
+    for (int i = 1; i < count; i += 2) {
+      synchronized (locks[i]) {
+        expect(Thread.holdsLock(locks[i]));
+      }
+      expect(! Thread.holdsLock(locks[i]));
+    }
+  }
+}
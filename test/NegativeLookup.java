@@ -0,0 +1,32 @@
+public class NegativeLookup {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  public static void main(String[] args) throws Exception {
+    ClassLoader loader = NegativeLookup.class.getClassLoader();
+
+    // repeated misses are answered from the negative cache, but must
+    // behave exactly as before:
+    for (int i = 0; i < 100; ++i) {
+      try {
+        Class.forName("NegativeLookup$Missing", true, loader);
+        expect(false);
+      } catch (ClassNotFoundException e) { }
+
+      expect(loader.getResource("negative-lookup/missing.txt") == null);
+      expect(loader.getResourceAsStream("NegativeLookup$Missing.class")
+             == null);
+    }
+
+    expect(Class.forName("NegativeLookup", true, loader)
+           == NegativeLookup.class);
+    expect(loader.getResource("NegativeLookup.class") != null);
+
+    if (loader instanceof avian.SystemClassLoader) {
+      avian.SystemClassLoader s = (avian.SystemClassLoader) loader;
+      expect(s.negativeCacheHits() > 0);
+      expect(s.negativeCacheMisses() > 0);
+    }
+  }
+}
@@ -0,0 +1,65 @@
+public class Pretenure {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static class Entry {
+    public final int key;
+    public Object value;
+    public Entry next;
+
+    public Entry(int key, Object value, Entry next) {
+      this.key = key;
+      this.value = value;
+      this.next = next;
+    }
+  }
+
+  private static Entry make(int key, Object value, Entry next) {
+    // every object allocated here lives until the end of the test, so
+    // the VM should eventually decide to allocate it directly in the
+    // tenured generation
+    return new Entry(key, value, next);
+  }
+
+  private static void garbage() {
+    for (int i = 0; i < 64; ++i) {
+      byte[] a = new byte[1024];
+    }
+  }
+
+  private static void check(Entry head, int count) {
+    int i = count;
+    for (Entry e = head; e != null; e = e.next) {
+      -- i;
+      expect(e.key == i);
+      expect(e.value.equals(Integer.toString(i)));
+    }
+    expect(i == 0);
+  }
+
+  public static void main(String[] args) {
+    final int count = 256 * 1024;
+
+    Entry head = null;
+    for (int i = 0; i < count; ++i) {
+      head = make(i, null, head);
+      if (i % 1024 == 0) {
+        garbage();
+      }
+    }
+
+    // store young objects into what are now (possibly pretenured) old
+    // ones and make sure they survive minor and major collections:
+    int i = count;
+    for (Entry e = head; e != null; e = e.next) {
+      e.value = Integer.toString(-- i);
+    }
+
+    garbage();
+    check(head, count);
+
+    System.gc();
+    check(head, count);
+  }
+}
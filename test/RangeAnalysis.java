@@ -0,0 +1,194 @@
+public class RangeAnalysis {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static int sum(int[] a) {
+    // the bounds checks here may be omitted:
+    int sum = 0;
+    for (int i = 0; i < a.length; ++i) {
+      sum += a[i];
+    }
+    return sum;
+  }
+
+  private static void increment(int[] a) {
+    int n = a.length;
+    for (int i = 0; i < n; ++i) {
+      a[i] = a[i] + 1;
+    }
+  }
+
+  private static int sumBackwards(int[] a) {
+    int sum = 0;
+    for (int i = a.length - 1; i >= 0; --i) {
+      sum += a[i];
+    }
+    return sum;
+  }
+
+  private static boolean overrun(int[] a) {
+    // ...but not here:
+    try {
+      for (int i = 0; i <= a.length; ++i) {
+        a[i] = i;
+      }
+      return false;
+    } catch (ArrayIndexOutOfBoundsException e) {
+      return true;
+    }
+  }
+
+  private static boolean underrun(int[] a, int start) {
+    try {
+      for (int i = start; i < a.length; ++i) {
+        a[i] = i;
+      }
+      return false;
+    } catch (ArrayIndexOutOfBoundsException e) {
+      return true;
+    }
+  }
+
+  private static boolean stride(int[] a) {
+    try {
+      for (int i = 0; i < a.length; i += 2) {
+        a[i + 1] = i;
+      }
+      return false;
+    } catch (ArrayIndexOutOfBoundsException e) {
+      return true;
+    }
+  }
+
+  private static boolean swapped(int[] a, int[] b) {
+    try {
+      int[] c = a;
+      for (int i = 0; i < c.length; ++i) {
+        c = b;
+        c[i] = i;
+      }
+      return false;
+    } catch (ArrayIndexOutOfBoundsException e) {
+      return true;
+    }
+  }
+
+  private static boolean afterIncrement(int[] a) {
+    try {
+      for (int i = 0; i < a.length;) {
+        ++ i;
+        a[i] = i;
+      }
+      return false;
+    } catch (ArrayIndexOutOfBoundsException e) {
+      return true;
+    }
+  }
+
+  private static int constants() {
+    int a = 7;
+    int b = a * 6;
+    int c = b << 33;
+    int d = -b >>> 28;
+    int e = Integer.MAX_VALUE;
+    e += a;
+    return a + b + c + d + (e == Integer.MIN_VALUE + 6 ? 1 : 0);
+  }
+
+  private int count;
+  private int[] values;
+
+  private int sumValues() {
+    // the loads of values, its length, and count may be reused:
+    int sum = 0;
+    for (int i = 0; i < values.length; ++i) {
+      sum += values[i] * count;
+    }
+    return sum;
+  }
+
+  private int countDown() {
+    // ...but count must be reloaded after each store to it:
+    int steps = 0;
+    while (count > 0) {
+      -- count;
+      ++ steps;
+    }
+    return steps;
+  }
+
+  private int addAll(int[] a) {
+    // ...or call which might store to it:
+    int sum = 0;
+    for (int i = 0; i < a.length; ++i) {
+      sum += count;
+      bump();
+    }
+    return sum;
+  }
+
+  private void bump() {
+    ++ count;
+  }
+
+  private static int repeat(RangeAnalysis r, int times) {
+    // r may be null if the loop is never entered:
+    int sum = 0;
+    for (int i = 0; i < times; ++i) {
+      sum += r.count;
+    }
+    return sum;
+  }
+
+  private static boolean npe(RangeAnalysis r, int times) {
+    try {
+      repeat(r, times);
+      return false;
+    } catch (NullPointerException e) {
+      return true;
+    }
+  }
+
+  private static int merged(boolean flag) {
+    int a = flag ? 1 : 2;
+    return a * 10;
+  }
+
+  public static void main(String[] args) {
+    int[] a = new int[100];
+    for (int i = 0; i < a.length; ++i) {
+      a[i] = i;
+    }
+
+    expect(sum(a) == 4950);
+    increment(a);
+    expect(sum(a) == 5050);
+    expect(sumBackwards(a) == 5050);
+    expect(sum(new int[0]) == 0);
+
+    expect(overrun(new int[10]));
+    expect(underrun(new int[10], -1));
+    expect(! underrun(new int[10], 0));
+    expect(stride(new int[9]));
+    expect(! stride(new int[10]));
+    expect(swapped(new int[10], new int[5]));
+    expect(afterIncrement(new int[10]));
+
+    expect(constants() == 7 + 42 + 84 + 15 + 1);
+    expect(merged(true) == 10);
+    expect(merged(false) == 20);
+
+    RangeAnalysis r = new RangeAnalysis();
+    r.values = a;
+    r.count = 2;
+    expect(r.sumValues() == 10100);
+    expect(r.countDown() == 2);
+    expect(r.count == 0);
+    expect(r.addAll(new int[4]) == 0 + 1 + 2 + 3);
+    expect(repeat(r, 3) == 12);
+    expect(repeat(null, 0) == 0);
+    expect(! npe(null, 0));
+    expect(npe(null, 1));
+  }
+}
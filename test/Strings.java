@@ -105,6 +105,99 @@ public class Strings {
            (prematureEOS ? "\u00ae\ufffd" : "\u00ae\uaeaf"));
   }
 
+  private static int hash(String s) {
+    int h = 0;
+    for (int i = 0; i < s.length(); ++i) h = (h * 31) + s.charAt(i);
+    return h;
+  }
+
+  private static int compare(String a, String b) {
+    int end = Math.min(a.length(), b.length());
+    for (int i = 0; i < end; ++i) {
+      if (a.charAt(i) != b.charAt(i)) {
+        return a.charAt(i) - b.charAt(i);
+      }
+    }
+    return a.length() - b.length();
+  }
+
+  private static int find(String s, String pattern) {
+    for (int i = 0; i + pattern.length() <= s.length(); ++i) {
+      if (s.regionMatches(i, pattern, 0, pattern.length())) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  private static void testSearch() throws Exception {
+    // compare strings backed by byte arrays with those backed by char
+    // arrays, at lengths which exercise both the vectorized and scalar
+    // paths of each method
+    for (int length = 0; length < 40; ++length) {
+      StringBuilder sb = new StringBuilder();
+      for (int i = 0; i < length; ++i) {
+        sb.append((char) ('a' + (i % 26)));
+      }
+      String chars = new String(sb.toString().toCharArray());
+      String bytes = new String(sb.toString().getBytes("UTF-8"), "UTF-8");
+
+      expect(chars.equals(bytes));
+      expect(bytes.equals(chars));
+      expect(chars.hashCode() == hash(chars));
+      expect(bytes.hashCode() == chars.hashCode());
+      expect(chars.compareTo(bytes) == 0);
+      expect(! chars.equals(null));
+      expect(! chars.equals(sb));
+
+      for (int i = 0; i < length; ++i) {
+        char[] array = chars.toCharArray();
+        array[i] = '\u0101';
+        String different = new String(array);
+
+        expect(! chars.equals(different));
+        expect(! bytes.equals(different));
+        expect(bytes.compareTo(different) == compare(bytes, different));
+        expect(different.compareTo(bytes) == compare(different, bytes));
+        expect(different.hashCode() == hash(different));
+        expect(different.indexOf('\u0101') == i);
+        expect(bytes.indexOf(bytes.charAt(i)) == i % 26);
+        expect(different.indexOf(bytes.substring(i))
+               == find(different, bytes.substring(i)));
+        expect(bytes.indexOf(different.substring(i)) == -1);
+        expect(chars.compareTo(bytes.substring(0, i))
+               == compare(chars, bytes.substring(0, i)));
+      }
+
+      expect(bytes.indexOf('\u0101') == -1);
+      expect(bytes.indexOf('\uffff') == -1);
+      expect(chars.indexOf(-1) == -1);
+      expect(chars.indexOf("") == 0);
+      expect(bytes.indexOf(chars) == 0);
+    }
+
+    String supplementary = "ab" + new String(Character.toChars(0x1F600)) + "c";
+    expect(supplementary.indexOf(0x1F600) == 2);
+    expect(supplementary.indexOf('c') == 4);
+    expect("abc".indexOf(0x1F600) == -1);
+
+    { String s = "{\"key\": \"value\", \"other\": [1, 2, 3]}";
+      expect(s.indexOf("\"other\"") == 17);
+      expect(s.indexOf('[') == 26);
+      expect(s.indexOf("\"missing\"") == -1);
+    }
+
+    try {
+      ((String) null).equals("");
+      expect(false);
+    } catch (NullPointerException e) { }
+
+    try {
+      "".compareTo(null);
+      expect(false);
+    } catch (NullPointerException e) { }
+  }
+
   public static void main(String[] args) throws Exception {
     expect(new String(new byte[] { 99, 111, 109, 46, 101, 99, 111, 118, 97,
                                    116, 101, 46, 110, 97, 116, 46, 98, 117,
@@ -165,6 +258,8 @@ public class Strings {
     testDecode(false);
     testDecode(true);
 
+    testSearch();
+
     expect
       (java.text.MessageFormat.format
        ("{0} enjoy {1} {2}.  do {4}?  {4} do?",
@@ -5,9 +5,71 @@ public class UnsafeTest {
     if (! v) throw new RuntimeException();
   }
 
-  public static void main(String[] args) {
+  private static class Data {
+    public int i;
+    public long l;
+    public Object o;
+  }
+
+  private static void garbage() {
+    for (int i = 0; i < 64; ++i) {
+      byte[] a = new byte[1024];
+    }
+  }
+
+  private static void testFields(Unsafe u) throws Exception {
+    long intOffset = u.objectFieldOffset(Data.class.getField("i"));
+    long objectOffset = u.objectFieldOffset(Data.class.getField("o"));
+
+    Data d = new Data();
+
+    expect(u.compareAndSwapInt(d, intOffset, 0, 42));
+    expect(d.i == 42);
+    expect(! u.compareAndSwapInt(d, intOffset, 0, 43));
+    expect(d.i == 42);
+
+    // the high and low words of these differ, so a CAS which looked at
+    // only one of them, or got them from the wrong place, would fail
+    long longOffset = u.objectFieldOffset(Data.class.getField("l"));
+    long a = 0x123456789abcdef0L;
+    long b = 0x0fedcba987654321L;
+    long c = 0x0000000087654321L;
+
+    d.l = a;
+    expect(u.compareAndSwapLong(d, longOffset, a, b));
+    expect(d.l == b);
+    expect(! u.compareAndSwapLong(d, longOffset, a, c));
+    expect(! u.compareAndSwapLong(d, longOffset, c, a));
+    expect(d.l == b);
+    expect(u.compareAndSwapLong(d, longOffset, b, -1L));
+    expect(d.l == -1L);
+
+    u.putIntVolatile(d, intOffset, -1);
+    expect(d.i == -1);
+
+    u.putOrderedInt(d, intOffset, 7);
+    expect(d.i == 7);
+
+    // make d old, so the young objects stored into it below are only
+    // kept alive if the write barrier records the store
+    System.gc();
+
+    for (int i = 0; i < 1000; ++i) {
+      Object expected = d.o;
+      String s = Integer.toString(i);
+      expect(u.compareAndSwapObject(d, objectOffset, expected, s));
+      expect(! u.compareAndSwapObject(d, objectOffset, expected, "x"));
+      garbage();
+      expect(u.getObject(d, objectOffset) == s);
+      expect(d.o.equals(Integer.toString(i)));
+    }
+  }
+
+  public static void main(String[] args) throws Exception {
     Unsafe u = avian.Machine.getUnsafe();
 
+    testFields(u);
+
     final long size = 64;
     long memory = u.allocateMemory(size);
     try {
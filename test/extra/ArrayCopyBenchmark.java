@@ -0,0 +1,56 @@
+package extra;
+
+import java.util.Arrays;
+
+public class ArrayCopyBenchmark {
+  private static final int Iterations = 1000000;
+
+  private static long copy(int size, int iterations) {
+    byte[] a = new byte[size];
+    byte[] b = new byte[size];
+    long start = System.currentTimeMillis();
+    for (int i = 0; i < iterations; ++i) {
+      System.arraycopy(a, 0, b, 0, size);
+    }
+    return System.currentTimeMillis() - start;
+  }
+
+  private static long copyObjects(int size, int iterations) {
+    Object[] a = new Object[size];
+    Object[] b = new Object[size];
+    Arrays.fill(a, "x");
+    long start = System.currentTimeMillis();
+    for (int i = 0; i < iterations; ++i) {
+      System.arraycopy(a, 0, b, 0, size);
+    }
+    return System.currentTimeMillis() - start;
+  }
+
+  private static long fill(int size, int iterations) {
+    int[] a = new int[size];
+    long start = System.currentTimeMillis();
+    for (int i = 0; i < iterations; ++i) {
+      Arrays.fill(a, i);
+    }
+    return System.currentTimeMillis() - start;
+  }
+
+  public static void main(String[] args) {
+    int[] sizes = new int[] { 1, 4, 8, 16, 32, 64, 256, 4096 };
+
+    // warm up
+    for (int size: sizes) {
+      copy(size, 1000);
+      copyObjects(size, 1000);
+      fill(size, 1000);
+    }
+
+    for (int size: sizes) {
+      System.out.println
+        ("size " + size
+         + ": byte[] copy " + copy(size, Iterations) + "ms"
+         + ", Object[] copy " + copyObjects(size, Iterations) + "ms"
+         + ", int[] fill " + fill(size, Iterations) + "ms");
+    }
+  }
+}
@@ -0,0 +1,130 @@
+package extra;
+
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.FileReader;
+import java.io.InputStreamReader;
+import java.util.ArrayList;
+import java.util.List;
+
+// Measures startup time and resident memory of a VM built with
+// bootimage=true, with and without a prelinked copy of its boot image
+// mapped from a file (see avian.bootimage.map).  Usage:
+//
+//   extra.BootImageBenchmark <vm executable> <classpath> [<runs>]
+//
+// where the classpath is the one the VM should be given to find this
+// class.  Resident memory is read from /proc, so it is only reported
+// on Linux.  Of the resident pages, those backed by a file may be
+// shared with other processes, while anonymous ones may not.
+public class BootImageBenchmark {
+  private static class Result {
+    public long time;
+    public long anonymous;
+    public long file;
+  }
+
+  private static Result run(String vm, String classpath, String map)
+    throws Exception
+  {
+    List<String> command = new ArrayList<String>();
+    command.add(vm);
+    command.add("-cp");
+    command.add(classpath);
+    if (map != null) {
+      command.add("-Davian.bootimage.map=" + map);
+    }
+    command.add("extra.BootImageBenchmarkProbe");
+
+    Result result = new Result();
+    result.anonymous = -1;
+    result.file = -1;
+
+    long start = System.currentTimeMillis();
+    Process p = Runtime.getRuntime().exec
+      (command.toArray(new String[command.size()]));
+    BufferedReader in = new BufferedReader
+      (new InputStreamReader(p.getInputStream()));
+    String line;
+    while ((line = in.readLine()) != null) {
+      String[] fields = line.trim().split(" +");
+      if (fields.length == 2 && fields[0].equals("anonymous")) {
+        result.anonymous = Long.parseLong(fields[1]);
+      } else if (fields.length == 2 && fields[0].equals("file")) {
+        result.file = Long.parseLong(fields[1]);
+      }
+    }
+    in.close();
+    int status = p.waitFor();
+    result.time = System.currentTimeMillis() - start;
+    if (status != 0) {
+      throw new RuntimeException("child exited with status " + status);
+    }
+    return result;
+  }
+
+  private static String describe(Result sum, int runs) {
+    return (sum.time / runs) + " ms, "
+      + (sum.anonymous < 0 ? "n/a" : (sum.anonymous / runs) + " kB")
+      + " anonymous, "
+      + (sum.file < 0 ? "n/a" : (sum.file / runs) + " kB")
+      + " file-backed";
+  }
+
+  private static void add(Result sum, Result r) {
+    sum.time += r.time;
+    sum.anonymous = r.anonymous < 0 ? -1 : sum.anonymous + r.anonymous;
+    sum.file = r.file < 0 ? -1 : sum.file + r.file;
+  }
+
+  public static void main(String[] args) throws Exception {
+    String vm = args[0];
+    String classpath = args[1];
+    int runs = args.length > 2 ? Integer.parseInt(args[2]) : 10;
+
+    File map = new File("bootimage-benchmark.map");
+    map.delete();
+
+    // the first mapped run writes the file; later ones reuse it
+    run(vm, classpath, null);
+    run(vm, classpath, map.getPath());
+
+    Result plain = new Result();
+    Result mapped = new Result();
+    for (int i = 0; i < runs; ++i) {
+      add(plain, run(vm, classpath, null));
+      add(mapped, run(vm, classpath, map.getPath()));
+    }
+
+    System.out.println("relocated: " + describe(plain, runs));
+    System.out.println("mapped: " + describe(mapped, runs));
+  }
+}
+
+class BootImageBenchmarkProbe {
+  private static long kilobytes(String line) {
+    String[] fields = line.trim().split("[ \t]+");
+    return Long.parseLong(fields[1]);
+  }
+
+  public static void main(String[] args) throws Exception {
+    File status = new File("/proc/self/status");
+    if (! status.exists()) {
+      return;
+    }
+
+    BufferedReader in = new BufferedReader(new FileReader(status));
+    try {
+      String line;
+      while ((line = in.readLine()) != null) {
+        if (line.startsWith("RssAnon:")) {
+          System.out.println("anonymous " + kilobytes(line));
+        } else if (line.startsWith("RssFile:")) {
+          System.out.println("file " + kilobytes(line));
+        }
+      }
+    } finally {
+      in.close();
+    }
+  }
+}
@@ -0,0 +1,61 @@
+package extra;
+
+import java.util.HashMap;
+import java.util.Map;
+
+// Run twice with -Davian.checkpoint set to the same file: the first
+// run writes a checkpoint and the second, which should also be given
+// -Dextra.Checkpoint.restored=true, starts from it.  The VM must be
+// built with bootimage=true.
+public class Checkpoint {
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static class State {
+    public static final Object identity = new Object();
+    public static final int identityHash = System.identityHashCode(identity);
+    public static final Map<Object, String> map
+      = new HashMap<Object, String>();
+    public static final int[] squares = new int[1000];
+    public static int runs;
+
+    static {
+      // this map is keyed by identity hash code, so it can only be
+      // searched after a restore if those are preserved
+      for (int i = 0; i < 100; ++i) {
+        map.put(new Object(), Integer.toString(i));
+      }
+      map.put(identity, "identity");
+
+      for (int i = 0; i < squares.length; ++i) {
+        squares[i] = i * i;
+      }
+    }
+  }
+
+  public static void main(String[] args) {
+    boolean shouldRestore = "true".equals
+      (System.getProperty("extra.Checkpoint.restored"));
+
+    int run = ++ State.runs;
+
+    boolean restored = avian.Machine.checkpoint();
+
+    // a restored run sees the count saved by the run which wrote the
+    // checkpoint, while a fresh one initializes State itself
+    expect(restored == (run > 1));
+    if (shouldRestore) {
+      expect(restored);
+    }
+
+    expect(System.identityHashCode(State.identity) == State.identityHash);
+    expect(State.identity.hashCode() == State.identityHash);
+    expect(State.map.get(State.identity).equals("identity"));
+    expect(State.map.size() == 101);
+
+    for (int i = 0; i < State.squares.length; ++i) {
+      expect(State.squares[i] == i * i);
+    }
+  }
+}
@@ -0,0 +1,111 @@
+package extra;
+
+import java.io.File;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+
+// Measures startup time of a program with costly static initializers,
+// with and without restoring a checkpoint of its heap written once
+// they have run (see avian.Machine.checkpoint).  The VM must be built
+// with bootimage=true.  Usage:
+//
+//   extra.CheckpointBenchmark <vm executable> <classpath> [<runs>]
+//
+// where the classpath is the one the VM should be given to find this
+// class.
+public class CheckpointBenchmark {
+  private static long run(String vm, String classpath, String checkpoint)
+    throws Exception
+  {
+    List<String> command = new ArrayList<String>();
+    command.add(vm);
+    command.add("-cp");
+    command.add(classpath);
+    if (checkpoint != null) {
+      command.add("-Davian.checkpoint=" + checkpoint);
+    }
+    command.add("extra.CheckpointBenchmarkProbe");
+
+    long start = System.currentTimeMillis();
+    Process p = Runtime.getRuntime().exec
+      (command.toArray(new String[command.size()]));
+    int status = p.waitFor();
+    long time = System.currentTimeMillis() - start;
+    if (status != 0) {
+      throw new RuntimeException("child exited with status " + status);
+    }
+    return time;
+  }
+
+  public static void main(String[] args) throws Exception {
+    String vm = args[0];
+    String classpath = args[1];
+    int runs = args.length > 2 ? Integer.parseInt(args[2]) : 10;
+
+    File checkpoint = new File("checkpoint-benchmark.bin");
+    checkpoint.delete();
+
+    // the first checkpointed run writes the file; later ones restore it
+    run(vm, classpath, null);
+    run(vm, classpath, checkpoint.getPath());
+    if (! checkpoint.exists()) {
+      throw new RuntimeException("no checkpoint was written");
+    }
+
+    long plain = 0;
+    long restored = 0;
+    for (int i = 0; i < runs; ++i) {
+      plain += run(vm, classpath, null);
+      restored += run(vm, classpath, checkpoint.getPath());
+    }
+
+    System.out.println
+      ("initialized: " + (plain / runs) + " ms; restored: "
+       + (restored / runs) + " ms");
+  }
+}
+
+class CheckpointBenchmarkProbe {
+  private static final Map<String, Integer> Table
+    = new HashMap<String, Integer>();
+
+  private static final int[] Primes;
+
+  static {
+    for (int i = 0; i < 50000; ++i) {
+      Table.put("key" + i, i);
+    }
+
+    boolean[] composite = new boolean[200000];
+    int count = 0;
+    for (int i = 2; i < composite.length; ++i) {
+      if (! composite[i]) {
+        ++ count;
+        for (int j = i * 2; j < composite.length; j += i) {
+          composite[j] = true;
+        }
+      }
+    }
+
+    Primes = new int[count];
+    for (int i = 2, j = 0; i < composite.length; ++i) {
+      if (! composite[i]) {
+        Primes[j++] = i;
+      }
+    }
+  }
+
+  public static void main(String[] args) {
+    if (System.getProperty("avian.checkpoint") != null) {
+      // returns true if we were restored from a checkpoint, in which
+      // case the statics above are as they were when it was written
+      avian.Machine.checkpoint();
+    }
+
+    if (Table.get("key42") != 42 || Primes[3] != 7) {
+      throw new RuntimeException();
+    }
+  }
+}
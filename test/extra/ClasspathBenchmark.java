@@ -0,0 +1,193 @@
+package extra;
+
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
+import java.util.zip.CRC32;
+
+// Measures VM startup with a long classpath of generated jars, the
+// last of which holds the main class.  Usage:
+//
+//   extra.ClasspathBenchmark <vm executable> [<jar count> [<runs>]]
+//
+// Each configuration is run with and without an on-disk classpath
+// index (see avian.classpath.index).
+public class ClasspathBenchmark {
+  private static final int EntriesPerJar = 40;
+
+  private static byte[] read(InputStream in) throws IOException {
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    byte[] buffer = new byte[4096];
+    int c;
+    while ((c = in.read(buffer)) > 0) {
+      out.write(buffer, 0, c);
+    }
+    in.close();
+    return out.toByteArray();
+  }
+
+  private static void write2(OutputStream out, int v) throws IOException {
+    out.write(v & 0xFF);
+    out.write((v >>> 8) & 0xFF);
+  }
+
+  private static void write4(OutputStream out, int v) throws IOException {
+    write2(out, v);
+    write2(out, v >>> 16);
+  }
+
+  // writes an uncompressed zip file by hand, since we may not have a
+  // ZipOutputStream to work with
+  private static void writeJar(File file, String[] names, byte[][] contents)
+    throws IOException
+  {
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    ByteArrayOutputStream directory = new ByteArrayOutputStream();
+
+    for (int i = 0; i < names.length; ++i) {
+      byte[] name = names[i].getBytes("UTF-8");
+      byte[] body = contents[i];
+      CRC32 crc = new CRC32();
+      crc.update(body, 0, body.length);
+      int checksum = (int) crc.getValue();
+      int offset = out.size();
+
+      write4(out, 0x04034b50);
+      write2(out, 10); // version needed
+      write2(out, 0); // flags
+      write2(out, 0); // method (stored)
+      write4(out, 0); // time and date
+      write4(out, checksum);
+      write4(out, body.length);
+      write4(out, body.length);
+      write2(out, name.length);
+      write2(out, 0); // extra length
+      out.write(name);
+      out.write(body);
+
+      write4(directory, 0x02014b50);
+      write2(directory, 20); // version made by
+      write2(directory, 10); // version needed
+      write2(directory, 0); // flags
+      write2(directory, 0); // method (stored)
+      write4(directory, 0); // time and date
+      write4(directory, checksum);
+      write4(directory, body.length);
+      write4(directory, body.length);
+      write2(directory, name.length);
+      write2(directory, 0); // extra length
+      write2(directory, 0); // comment length
+      write2(directory, 0); // disk number
+      write2(directory, 0); // internal attributes
+      write4(directory, 0); // external attributes
+      write4(directory, offset);
+      directory.write(name);
+    }
+
+    int directoryOffset = out.size();
+    out.write(directory.toByteArray());
+
+    write4(out, 0x06054b50);
+    write2(out, 0); // disk number
+    write2(out, 0); // directory disk number
+    write2(out, names.length);
+    write2(out, names.length);
+    write4(out, directory.size());
+    write4(out, directoryOffset);
+    write2(out, 0); // comment length
+
+    OutputStream stream = new FileOutputStream(file);
+    stream.write(out.toByteArray());
+    stream.close();
+  }
+
+  private static String makeClasspath(File directory, int count)
+    throws IOException
+  {
+    byte[] probe = read
+      (ClasspathBenchmark.class.getResourceAsStream
+       ("ClasspathBenchmarkProbe.class"));
+    byte[] filler = new byte[64];
+
+    StringBuilder sb = new StringBuilder();
+    for (int i = 0; i < count; ++i) {
+      boolean last = i == count - 1;
+      int entries = last ? EntriesPerJar + 1 : EntriesPerJar;
+      String[] names = new String[entries];
+      byte[][] contents = new byte[entries][];
+      for (int j = 0; j < EntriesPerJar; ++j) {
+        names[j] = "jar" + i + "/Entry" + j + ".class";
+        contents[j] = filler;
+      }
+      if (last) {
+        names[EntriesPerJar] = "extra/ClasspathBenchmarkProbe.class";
+        contents[EntriesPerJar] = probe;
+      }
+
+      File jar = new File(directory, "bench" + i + ".jar");
+      writeJar(jar, names, contents);
+
+      if (i > 0) sb.append(File.pathSeparatorChar);
+      sb.append(jar.getPath());
+    }
+    return sb.toString();
+  }
+
+  private static long run(String vm, String classpath, String index)
+    throws Exception
+  {
+    String[] command = index == null
+      ? new String[] { vm, "-cp", classpath, "extra.ClasspathBenchmarkProbe" }
+      : new String[] { vm, "-cp", classpath,
+                       "-Davian.classpath.index=" + index,
+                       "extra.ClasspathBenchmarkProbe" };
+
+    long start = System.currentTimeMillis();
+    Process p = Runtime.getRuntime().exec(command);
+    int status = p.waitFor();
+    long time = System.currentTimeMillis() - start;
+    if (status != 0) {
+      throw new RuntimeException("child exited with status " + status);
+    }
+    return time;
+  }
+
+  public static void main(String[] args) throws Exception {
+    String vm = args[0];
+    int count = args.length > 1 ? Integer.parseInt(args[1]) : 500;
+    int runs = args.length > 2 ? Integer.parseInt(args[2]) : 10;
+
+    File directory = new File("classpath-benchmark");
+    directory.mkdirs();
+    String classpath = makeClasspath(directory, count);
+    String index = new File(directory, "classpath.index").getPath();
+
+    // the first indexed run writes the index; later ones reuse it
+    run(vm, classpath, null);
+    run(vm, classpath, index);
+
+    long plain = 0;
+    long indexed = 0;
+    for (int i = 0; i < runs; ++i) {
+      plain += run(vm, classpath, null);
+      indexed += run(vm, classpath, index);
+    }
+
+    System.out.println
+      (count + " jars: " + (plain / runs) + " ms without index, "
+       + (indexed / runs) + " ms with index");
+  }
+}
+
+class ClasspathBenchmarkProbe {
+  public static void main(String[] args) {
+    if (ClasspathBenchmarkProbe.class.getResource("/jar0/Entry0.class")
+        == null)
+    {
+      throw new RuntimeException();
+    }
+  }
+}
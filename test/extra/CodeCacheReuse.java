@@ -0,0 +1,162 @@
+package extra;
+
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+
+// Runs the VM named by -Dextra.CodeCacheReuse.vm three times with the
+// same -Davian.jit.codecache.file.  The first run writes the file, the
+// second should link Target's code from it rather than compile it,
+// and the third loads a modified copy of Target whose hash no longer
+// matches, so its cached code must be rejected and recompiled.  We
+// tell which methods were compiled using -Davian.jit.log, since code
+// linked from the file is not logged.
+public class CodeCacheReuse {
+  private static final String Cache = "code-cache-test.bin";
+  private static final String Log = "code-cache-test.log";
+  private static final String ModifiedClasses = "code-cache-test";
+  private static final String TargetName = "CodeCacheReuse$Target";
+  private static final String TargetMain
+    = "extra/CodeCacheReuse$Target.main([Ljava/lang/String;)V";
+
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static File findClass(String name, File directory) {
+    for (File file: directory.listFiles()) {
+      if (file.isFile()) {
+        if (file.getName().equals(name + ".class")) {
+          return file;
+        }
+      } else if (file.isDirectory()) {
+        File result = findClass(name, file);
+        if (result != null) {
+          return result;
+        }
+      }
+    }
+    return null;
+  }
+
+  private static byte[] read(File file) throws IOException {
+    byte[] bytes = new byte[(int) file.length()];
+    FileInputStream in = new FileInputStream(file);
+    try {
+      if (in.read(bytes) != (int) file.length()) {
+        throw new RuntimeException();
+      }
+      return bytes;
+    } finally {
+      in.close();
+    }
+  }
+
+  private static void write(File file, byte[] bytes) throws IOException {
+    FileOutputStream out = new FileOutputStream(file);
+    try {
+      out.write(bytes);
+    } finally {
+      out.close();
+    }
+  }
+
+  private static void delete(String path) {
+    File file = new File(path);
+    if (file.exists()) {
+      expect(file.delete());
+    }
+  }
+
+  // Replaces the only occurrence of one string with another of the
+  // same length.
+  private static void replace(byte[] bytes, String from, String to) {
+    byte[] a = from.getBytes();
+    byte[] b = to.getBytes();
+    expect(a.length == b.length);
+
+    int found = -1;
+    for (int i = 0; i + a.length <= bytes.length; ++i) {
+      int j = 0;
+      while (j < a.length && bytes[i + j] == a[j]) ++ j;
+      if (j == a.length) {
+        expect(found < 0);
+        found = i;
+      }
+    }
+    expect(found >= 0);
+
+    System.arraycopy(b, 0, bytes, found, b.length);
+  }
+
+  // Runs Target with the specified classpath, expecting it to see the
+  // specified value, and returns whether its main method was
+  // compiled rather than linked from the code cache file.
+  private static boolean run(String vm, String classpath, String expected)
+    throws Exception
+  {
+    delete(Log);
+
+    Process process = Runtime.getRuntime().exec
+      (new String[] { vm,
+                      "-Davian.jit.codecache.file=" + Cache,
+                      "-Davian.jit.log=" + Log,
+                      "-Dextra.CodeCacheReuse.expected=" + expected,
+                      "-cp", classpath,
+                      "extra." + TargetName });
+    expect(process.waitFor() == 0);
+
+    // the log is only created once something is compiled
+    File log = new File(Log);
+    return log.exists() && new String(read(log)).indexOf(TargetMain) >= 0;
+  }
+
+  public static void main(String[] args) throws Exception {
+    String vm = System.getProperty("extra.CodeCacheReuse.vm");
+    expect(vm != null);
+
+    // a copy left by an earlier run would be found first below
+    File directory = new File(ModifiedClasses + File.separator + "extra");
+    delete(new File(directory, TargetName + ".class").getPath());
+
+    File original = findClass
+      (TargetName, new File(System.getProperty("user.dir")));
+    String classpath = original.getParentFile().getParent();
+
+    delete(Cache);
+
+    // nothing to reuse yet:
+    expect(run(vm, classpath, "ORIGINAL"));
+    expect(new File(Cache).exists());
+
+    // the same classes, so the cached code should be used:
+    expect(! run(vm, classpath, "ORIGINAL"));
+
+    // a different Target, which must not run the code compiled for
+    // the original:
+    directory.mkdirs();
+    byte[] bytes = read(original);
+    replace(bytes, "ORIGINAL", "MODIFIED");
+    write(new File(directory, original.getName()), bytes);
+
+    expect(run(vm, ModifiedClasses + File.pathSeparator + classpath,
+               "MODIFIED"));
+
+    delete(Cache);
+    delete(Log);
+  }
+
+  public static class Target {
+    public static String value() {
+      return "ORIGINAL";
+    }
+
+    public static void main(String[] args) {
+      String expected = System.getProperty("extra.CodeCacheReuse.expected");
+      if (! value().equals(expected)) {
+        throw new RuntimeException();
+      }
+    }
+  }
+}
@@ -0,0 +1,437 @@
+package extra;
+
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.IOException;
+
+// Run with a small -Davian.jit.codecache.limit and
+// -Davian.jit.codecache.sweep=true.  This loads and runs the same
+// code-heavy class over and over through fresh class loaders, so the
+// code cache fills up well past its limit and must be swept, evicting
+// methods which were compiled and called earlier.  Those methods are
+// then called again to make sure they are recompiled correctly.
+public class CodeCacheSweep {
+  private static final int Iterations = 500;
+
+  private static void expect(boolean v) {
+    if (! v) throw new RuntimeException();
+  }
+
+  private static File findClass(String name, File directory) {
+    for (File file: directory.listFiles()) {
+      if (file.isFile()) {
+        if (file.getName().equals(name + ".class")) {
+          return file;
+        }
+      } else if (file.isDirectory()) {
+        File result = findClass(name, file);
+        if (result != null) {
+          return result;
+        }
+      }
+    }
+    return null;
+  }
+
+  private static byte[] read(File file) throws IOException {
+    byte[] bytes = new byte[(int) file.length()];
+    FileInputStream in = new FileInputStream(file);
+    try {
+      if (in.read(bytes) != (int) file.length()) {
+        throw new RuntimeException();
+      }
+      return bytes;
+    } finally {
+      in.close();
+    }
+  }
+
+  private static int[] run(Worker worker) {
+    int[] results = new int[16];
+    for (int i = 0; i < results.length; ++i) {
+      results[i] = worker.run(i * 12345);
+    }
+    return results;
+  }
+
+  private static void expectEqual(int[] a, int[] b) {
+    expect(a.length == b.length);
+    for (int i = 0; i < a.length; ++i) {
+      expect(a[i] == b[i]);
+    }
+  }
+
+  private static int square(int x) {
+    return x * x;
+  }
+
+  public static void main(String[] args) throws Exception {
+    // compile and call a static, an interface and a virtual method
+    // before the cache is swept
+    expect(square(7) == 49);
+    Payload payload = new Payload();
+    int[] expected = run(payload);
+    int sum = payload.sum();
+
+    byte[] bytes = read
+      (findClass("CodeCacheSweep$Payload",
+                 new File(System.getProperty("user.dir"))));
+
+    for (int i = 0; i < Iterations; ++i) {
+      Worker worker = (Worker) new MyClassLoader
+        (CodeCacheSweep.class.getClassLoader()).defineClass
+        ("extra.CodeCacheSweep$Payload", bytes).newInstance();
+
+      expectEqual(run(worker), expected);
+    }
+
+    // by now each of these has been evicted at least once
+    expect(square(9) == 81);
+    expectEqual(run(payload), expected);
+    expect(payload.sum() == sum);
+    expectEqual(run(new Payload()), expected);
+  }
+
+  private static class MyClassLoader extends ClassLoader {
+    public MyClassLoader(ClassLoader parent) {
+      super(parent);
+    }
+
+    public Class defineClass(String name, byte[] bytes) {
+      return defineClass(name, bytes, 0, bytes.length);
+    }
+  }
+
+  public interface Worker {
+    public int run(int x);
+  }
+
+  public static class Payload implements Worker {
+    private final int[] values = new int[16];
+
+    public Payload() {
+      for (int i = 0; i < values.length; ++i) {
+        values[i] = i * 0x9e3779b9;
+      }
+    }
+
+    public int sum() {
+      int sum = 0;
+      for (int i = 0; i < values.length; ++i) {
+        sum += values[i];
+      }
+      return sum;
+    }
+
+    public int run(int x) {
+      return m0(x) ^ m1(x + 1) ^ m2(x + 2) ^ m3(x + 3)
+        ^ m4(x + 4) ^ m5(x + 5) ^ m6(x + 6) ^ m7(x + 7)
+        ^ m8(x + 8) ^ m9(x + 9) ^ m10(x + 10) ^ m11(x + 11)
+        ^ m12(x + 12) ^ m13(x + 13) ^ m14(x + 14) ^ m15(x + 15);
+    }
+
+    private int m0(int x) {
+      int a = x, b = x ^ 4096, c = x * 31;
+      for (int i = 0; i < 4; ++i) {
+        a += b ^ (c >>> 1);
+        b -= c * 5 + (a << 4);
+        c ^= a + (b >>> 7);
+        a = (a << 10) | (a >>> (32 - 10));
+        b += a * 11 - c;
+        c = c * 13 + (b ^ a);
+        a += b ^ (c >>> 6);
+        b -= c * 17 + (a << 9);
+        c ^= a + (b >>> 12);
+        a = (a << 2) | (a >>> (32 - 2));
+        b += a * 23 - c;
+        c = c * 3 + (b ^ a);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m1(int x) {
+      int a = x, b = x ^ 5073, c = x * 33;
+      for (int i = 0; i < 4; ++i) {
+        b -= c * 13 + (a << 8);
+        c ^= a + (b >>> 11);
+        a = (a << 1) | (a >>> (32 - 1));
+        b += a * 19 - c;
+        c = c * 21 + (b ^ a);
+        a += b ^ (c >>> 10);
+        b -= c * 3 + (a << 13);
+        c ^= a + (b >>> 3);
+        a = (a << 6) | (a >>> (32 - 6));
+        b += a * 9 - c;
+        c = c * 11 + (b ^ a);
+        a += b ^ (c >>> 2);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m2(int x) {
+      int a = x, b = x ^ 6050, c = x * 35;
+      for (int i = 0; i < 4; ++i) {
+        c ^= a + (b >>> 2);
+        a = (a << 5) | (a >>> (32 - 5));
+        b += a * 5 - c;
+        c = c * 7 + (b ^ a);
+        a += b ^ (c >>> 1);
+        b -= c * 11 + (a << 4);
+        c ^= a + (b >>> 7);
+        a = (a << 10) | (a >>> (32 - 10));
+        b += a * 17 - c;
+        c = c * 19 + (b ^ a);
+        a += b ^ (c >>> 6);
+        b -= c * 23 + (a << 9);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m3(int x) {
+      int a = x, b = x ^ 7027, c = x * 37;
+      for (int i = 0; i < 4; ++i) {
+        a = (a << 9) | (a >>> (32 - 9));
+        b += a * 13 - c;
+        c = c * 15 + (b ^ a);
+        a += b ^ (c >>> 5);
+        b -= c * 19 + (a << 8);
+        c ^= a + (b >>> 11);
+        a = (a << 1) | (a >>> (32 - 1));
+        b += a * 3 - c;
+        c = c * 5 + (b ^ a);
+        a += b ^ (c >>> 10);
+        b -= c * 9 + (a << 13);
+        c ^= a + (b >>> 3);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m4(int x) {
+      int a = x, b = x ^ 8004, c = x * 39;
+      for (int i = 0; i < 4; ++i) {
+        b += a * 21 - c;
+        c = c * 23 + (b ^ a);
+        a += b ^ (c >>> 9);
+        b -= c * 5 + (a << 12);
+        c ^= a + (b >>> 2);
+        a = (a << 5) | (a >>> (32 - 5));
+        b += a * 11 - c;
+        c = c * 13 + (b ^ a);
+        a += b ^ (c >>> 1);
+        b -= c * 17 + (a << 4);
+        c ^= a + (b >>> 7);
+        a = (a << 10) | (a >>> (32 - 10));
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m5(int x) {
+      int a = x, b = x ^ 8981, c = x * 41;
+      for (int i = 0; i < 4; ++i) {
+        c = c * 9 + (b ^ a);
+        a += b ^ (c >>> 13);
+        b -= c * 13 + (a << 3);
+        c ^= a + (b >>> 6);
+        a = (a << 9) | (a >>> (32 - 9));
+        b += a * 19 - c;
+        c = c * 21 + (b ^ a);
+        a += b ^ (c >>> 5);
+        b -= c * 3 + (a << 8);
+        c ^= a + (b >>> 11);
+        a = (a << 1) | (a >>> (32 - 1));
+        b += a * 9 - c;
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m6(int x) {
+      int a = x, b = x ^ 9958, c = x * 43;
+      for (int i = 0; i < 4; ++i) {
+        a += b ^ (c >>> 4);
+        b -= c * 21 + (a << 7);
+        c ^= a + (b >>> 10);
+        a = (a << 13) | (a >>> (32 - 13));
+        b += a * 5 - c;
+        c = c * 7 + (b ^ a);
+        a += b ^ (c >>> 9);
+        b -= c * 11 + (a << 12);
+        c ^= a + (b >>> 2);
+        a = (a << 5) | (a >>> (32 - 5));
+        b += a * 17 - c;
+        c = c * 19 + (b ^ a);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m7(int x) {
+      int a = x, b = x ^ 10935, c = x * 45;
+      for (int i = 0; i < 4; ++i) {
+        b -= c * 7 + (a << 11);
+        c ^= a + (b >>> 1);
+        a = (a << 4) | (a >>> (32 - 4));
+        b += a * 13 - c;
+        c = c * 15 + (b ^ a);
+        a += b ^ (c >>> 13);
+        b -= c * 19 + (a << 3);
+        c ^= a + (b >>> 6);
+        a = (a << 9) | (a >>> (32 - 9));
+        b += a * 3 - c;
+        c = c * 5 + (b ^ a);
+        a += b ^ (c >>> 5);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m8(int x) {
+      int a = x, b = x ^ 11912, c = x * 47;
+      for (int i = 0; i < 4; ++i) {
+        c ^= a + (b >>> 5);
+        a = (a << 8) | (a >>> (32 - 8));
+        b += a * 21 - c;
+        c = c * 23 + (b ^ a);
+        a += b ^ (c >>> 4);
+        b -= c * 5 + (a << 7);
+        c ^= a + (b >>> 10);
+        a = (a << 13) | (a >>> (32 - 13));
+        b += a * 11 - c;
+        c = c * 13 + (b ^ a);
+        a += b ^ (c >>> 9);
+        b -= c * 17 + (a << 12);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m9(int x) {
+      int a = x, b = x ^ 12889, c = x * 49;
+      for (int i = 0; i < 4; ++i) {
+        a = (a << 12) | (a >>> (32 - 12));
+        b += a * 7 - c;
+        c = c * 9 + (b ^ a);
+        a += b ^ (c >>> 8);
+        b -= c * 13 + (a << 11);
+        c ^= a + (b >>> 1);
+        a = (a << 4) | (a >>> (32 - 4));
+        b += a * 19 - c;
+        c = c * 21 + (b ^ a);
+        a += b ^ (c >>> 13);
+        b -= c * 3 + (a << 3);
+        c ^= a + (b >>> 6);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m10(int x) {
+      int a = x, b = x ^ 13866, c = x * 51;
+      for (int i = 0; i < 4; ++i) {
+        b += a * 15 - c;
+        c = c * 17 + (b ^ a);
+        a += b ^ (c >>> 12);
+        b -= c * 21 + (a << 2);
+        c ^= a + (b >>> 5);
+        a = (a << 8) | (a >>> (32 - 8));
+        b += a * 5 - c;
+        c = c * 7 + (b ^ a);
+        a += b ^ (c >>> 4);
+        b -= c * 11 + (a << 7);
+        c ^= a + (b >>> 10);
+        a = (a << 13) | (a >>> (32 - 13));
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m11(int x) {
+      int a = x, b = x ^ 14843, c = x * 53;
+      for (int i = 0; i < 4; ++i) {
+        c = c * 3 + (b ^ a);
+        a += b ^ (c >>> 3);
+        b -= c * 7 + (a << 6);
+        c ^= a + (b >>> 9);
+        a = (a << 12) | (a >>> (32 - 12));
+        b += a * 13 - c;
+        c = c * 15 + (b ^ a);
+        a += b ^ (c >>> 8);
+        b -= c * 19 + (a << 11);
+        c ^= a + (b >>> 1);
+        a = (a << 4) | (a >>> (32 - 4));
+        b += a * 3 - c;
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m12(int x) {
+      int a = x, b = x ^ 15820, c = x * 55;
+      for (int i = 0; i < 4; ++i) {
+        a += b ^ (c >>> 7);
+        b -= c * 15 + (a << 10);
+        c ^= a + (b >>> 13);
+        a = (a << 3) | (a >>> (32 - 3));
+        b += a * 21 - c;
+        c = c * 23 + (b ^ a);
+        a += b ^ (c >>> 12);
+        b -= c * 5 + (a << 2);
+        c ^= a + (b >>> 5);
+        a = (a << 8) | (a >>> (32 - 8));
+        b += a * 11 - c;
+        c = c * 13 + (b ^ a);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m13(int x) {
+      int a = x, b = x ^ 16797, c = x * 57;
+      for (int i = 0; i < 4; ++i) {
+        b -= c * 23 + (a << 1);
+        c ^= a + (b >>> 4);
+        a = (a << 7) | (a >>> (32 - 7));
+        b += a * 7 - c;
+        c = c * 9 + (b ^ a);
+        a += b ^ (c >>> 3);
+        b -= c * 13 + (a << 6);
+        c ^= a + (b >>> 9);
+        a = (a << 12) | (a >>> (32 - 12));
+        b += a * 19 - c;
+        c = c * 21 + (b ^ a);
+        a += b ^ (c >>> 8);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m14(int x) {
+      int a = x, b = x ^ 17774, c = x * 59;
+      for (int i = 0; i < 4; ++i) {
+        c ^= a + (b >>> 8);
+        a = (a << 11) | (a >>> (32 - 11));
+        b += a * 15 - c;
+        c = c * 17 + (b ^ a);
+        a += b ^ (c >>> 7);
+        b -= c * 21 + (a << 10);
+        c ^= a + (b >>> 13);
+        a = (a << 3) | (a >>> (32 - 3));
+        b += a * 5 - c;
+        c = c * 7 + (b ^ a);
+        a += b ^ (c >>> 12);
+        b -= c * 11 + (a << 2);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+
+    private int m15(int x) {
+      int a = x, b = x ^ 18751, c = x * 61;
+      for (int i = 0; i < 4; ++i) {
+        a = (a << 2) | (a >>> (32 - 2));
+        b += a * 23 - c;
+        c = c * 3 + (b ^ a);
+        a += b ^ (c >>> 11);
+        b -= c * 7 + (a << 1);
+        c ^= a + (b >>> 4);
+        a = (a << 7) | (a >>> (32 - 7));
+        b += a * 13 - c;
+        c = c * 15 + (b ^ a);
+        a += b ^ (c >>> 3);
+        b -= c * 19 + (a << 6);
+        c ^= a + (b >>> 9);
+      }
+      return a ^ b ^ c ^ values[x & (values.length - 1)];
+    }
+  }
+}
@@ -0,0 +1,155 @@
+package extra;
+
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.FileReader;
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.TreeMap;
+
+// Measures the cost of loading classes whose methods are mostly never
+// run, with and without avian.lazy.code.  Usage:
+//
+//   extra.LazyCodeBenchmark <vm executable> <classpath> [<runs>]
+//
+// where the classpath is the one the VM should be given to find this
+// class.  On VMs built with heapdump=true, the size of the reachable
+// heap once the classes are loaded is reported as well.
+public class LazyCodeBenchmark {
+  private static long run(String vm, String classpath, boolean lazy,
+                          String footprint)
+    throws Exception
+  {
+    List<String> command = new ArrayList<String>();
+    command.add(vm);
+    command.add("-cp");
+    command.add(classpath);
+    if (lazy) {
+      command.add("-Davian.lazy.code=true");
+    }
+    command.add("extra.LazyCodeBenchmarkProbe");
+    if (footprint != null) {
+      command.add(footprint);
+    }
+
+    long start = System.currentTimeMillis();
+    Process p = Runtime.getRuntime().exec
+      (command.toArray(new String[command.size()]));
+    int status = p.waitFor();
+    long time = System.currentTimeMillis() - start;
+    if (status != 0) {
+      throw new RuntimeException("child exited with status " + status);
+    }
+    return time;
+  }
+
+  // returns the total reachable heap size from a report written by
+  // avian.Machine.dumpHeapFootprint, or -1 if there is no such report
+  private static long heapBytes(File report) throws IOException {
+    if (! report.exists()) {
+      return -1;
+    }
+
+    long total = -1;
+    BufferedReader in = new BufferedReader(new FileReader(report));
+    try {
+      String line;
+      while ((line = in.readLine()) != null) {
+        String[] fields = line.trim().split(" +");
+        if (fields.length == 5 && fields[4].equals("(total)")) {
+          total = Long.parseLong(fields[1]);
+        }
+      }
+    } finally {
+      in.close();
+    }
+    report.delete();
+    return total;
+  }
+
+  private static String footprint(File report) throws IOException {
+    long bytes = heapBytes(report);
+    return bytes < 0 ? "n/a" : bytes + " bytes";
+  }
+
+  public static void main(String[] args) throws Exception {
+    String vm = args[0];
+    String classpath = args[1];
+    int runs = args.length > 2 ? Integer.parseInt(args[2]) : 10;
+
+    File report = new File("lazy-code-footprint.txt");
+
+    run(vm, classpath, false, report.getPath());
+    String eagerFootprint = footprint(report);
+    run(vm, classpath, true, report.getPath());
+    String lazyFootprint = footprint(report);
+
+    long eager = 0;
+    long lazy = 0;
+    for (int i = 0; i < runs; ++i) {
+      eager += run(vm, classpath, false, null);
+      lazy += run(vm, classpath, true, null);
+    }
+
+    System.out.println
+      ("eager: " + (eager / runs) + " ms, heap " + eagerFootprint
+       + "; lazy: " + (lazy / runs) + " ms, heap " + lazyFootprint);
+  }
+}
+
+class LazyCodeBenchmarkProbe {
+  private static final String[] Classes = {
+    "java.util.TreeMap",
+    "java.util.TreeSet",
+    "java.util.LinkedList",
+    "java.util.Hashtable",
+    "java.util.WeakHashMap",
+    "java.util.IdentityHashMap",
+    "java.util.Collections",
+    "java.util.BitSet",
+    "java.util.Calendar",
+    "java.util.Date",
+    "java.util.Random",
+    "java.util.StringTokenizer",
+    "java.util.UUID",
+    "java.util.Vector",
+    "java.util.regex.Pattern",
+    "java.util.regex.Matcher",
+    "java.util.zip.Inflater",
+    "java.util.zip.Deflater",
+    "java.math.BigInteger",
+    "java.text.MessageFormat",
+    "java.io.BufferedReader",
+    "java.io.PrintStream",
+    "java.net.URL"
+  };
+
+  public static void main(String[] args) throws Exception {
+    for (int i = 0; i < Classes.length; ++i) {
+      try {
+        Class.forName(Classes[i]);
+      } catch (ClassNotFoundException e) {
+        // not every class library has all of these
+      }
+    }
+
+    // run a little of what we loaded, so lazily loaded methods are
+    // exercised too
+    TreeMap<String, Integer> map = new TreeMap<String, Integer>();
+    for (int i = 0; i < 100; ++i) {
+      map.put(Integer.toString(i), i);
+    }
+    if (map.get("42") != 42) {
+      throw new RuntimeException();
+    }
+
+    if (args.length > 0) {
+      try {
+        avian.Machine.dumpHeapFootprint(args[0]);
+      } catch (UnsatisfiedLinkError e) {
+        // not a heapdump build
+      }
+    }
+  }
+}
@@ -27,14 +27,21 @@ echo
 
 printf "%12s------- Java tests -------\n" ""
 for test in ${tests}; do
+  # a test may be preceded by options which apply to that run only
+  case ${test} in
+    -* )
+      test_flags="${test_flags} ${test}"
+      continue;;
+  esac
+
   printf "%24s: " "${test}"
 
   case ${mode} in
     debug|debug-fast|fast|small )
-      ${vm} ${flags} ${test} >>${log} 2>&1;;
+      ${vm} ${flags} ${test_flags} ${test} >>${log} 2>&1;;
 
     stress* )
-      ${vg} ${vm} ${flags} ${test} \
+      ${vg} ${vm} ${flags} ${test_flags} ${test} \
         >>${log} 2>&1;;
 
     * )
@@ -48,6 +55,8 @@ for test in ${tests}; do
     echo "fail"
     trouble=1
   fi
+
+  test_flags=
 done
 
 echo
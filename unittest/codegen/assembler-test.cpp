@@ -94,3 +94,90 @@ public:
 
   }
 } architecturePlanTest;
+
+#if (AVIAN_TARGET_ARCH == AVIAN_ARCH_X86) \
+  || (AVIAN_TARGET_ARCH == AVIAN_ARCH_X86_64)
+
+class X86FeatureEncodingTest : public Test {
+public:
+  X86FeatureEncodingTest():
+    Test("X86FeatureEncoding")
+  {}
+
+  void expectCode(Asm& a, const uint8_t* expected, unsigned length) {
+    a.a->endBlock(false)->resolve(0, 0);
+    assertEqual(length, a.a->length());
+
+    uint8_t code[64];
+    a.a->setDestination(code);
+    a.a->write();
+
+    for (unsigned i = 0; i < length; ++i) {
+      assertEqual(expected[i], code[i]);
+    }
+  }
+
+  virtual void run() {
+    BasicEnv env;
+    const lir::OperandType R = lir::RegisterOperand;
+
+    // the x86 backend numbers the SSE registers after the general
+    // purpose ones
+    lir::Register rax(0);
+    lir::Register rcx(1);
+    lir::Register xmm0(16);
+    lir::Register xmm1(17);
+    lir::Register xmm2(18);
+
+    env.arch->setFeatures(x86::SSEFeature | x86::SSE2Feature);
+    assertTrue(env.arch->alwaysCondensed(lir::FloatAdd));
+
+    { Asm a(env);
+      // addsd %xmm0,%xmm1; movsd %xmm1,%xmm2
+      a.a->apply(lir::FloatAdd, OperandInfo(8, R, &xmm0),
+                 OperandInfo(8, R, &xmm1), OperandInfo(8, R, &xmm1));
+      a.a->apply(lir::Move, OperandInfo(8, R, &xmm1),
+                 OperandInfo(8, R, &xmm2));
+
+      const uint8_t expected[] = { 0xf2, 0x0f, 0x58, 0xc8,
+                                   0xf2, 0x0f, 0x10, 0xd1 };
+      expectCode(a, expected, sizeof(expected));
+    }
+
+    env.arch->setFeatures(x86::SSEFeature | x86::SSE2Feature
+                          | x86::AvxFeature | x86::LzcntFeature);
+    assertFalse(env.arch->alwaysCondensed(lir::FloatAdd));
+    assertEqual(x86::SSEFeature | x86::SSE2Feature | x86::AvxFeature
+                | x86::LzcntFeature, env.arch->features());
+
+    { Asm a(env);
+      // vaddsd %xmm0,%xmm1,%xmm2; vmovaps %xmm1,%xmm2; lzcnt %eax,%ecx
+      a.a->apply(lir::FloatAdd, OperandInfo(8, R, &xmm0),
+                 OperandInfo(8, R, &xmm1), OperandInfo(8, R, &xmm2));
+      a.a->apply(lir::Move, OperandInfo(8, R, &xmm1),
+                 OperandInfo(8, R, &xmm2));
+      a.a->apply(lir::CountLeadingZeros, OperandInfo(4, R, &rax),
+                 OperandInfo(4, R, &rcx));
+
+      const uint8_t expected[] = { 0xc5, 0xf3, 0x58, 0xd0,
+                                   0xc5, 0xf8, 0x28, 0xd1,
+                                   0xf3, 0x0f, 0xbd, 0xc8 };
+      expectCode(a, expected, sizeof(expected));
+    }
+
+    if (vm::TargetBytesPerWord == 8) {
+      lir::Register xmm8(24);
+      lir::Register xmm9(25);
+
+      Asm a(env);
+      // vsubss %xmm8,%xmm1,%xmm9 needs the three byte prefix
+      a.a->apply(lir::FloatSubtract, OperandInfo(4, R, &xmm8),
+                 OperandInfo(4, R, &xmm1), OperandInfo(4, R, &xmm9));
+
+      const uint8_t expected[] = { 0xc4, 0x41, 0x72, 0x5c, 0xc8 };
+      expectCode(a, expected, sizeof(expected));
+    }
+  }
+} x86FeatureEncodingTest;
+
+#endif
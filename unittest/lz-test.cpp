@@ -0,0 +1,79 @@
+/* Copyright (c) 2008-2012, Avian Contributors
+
+   Permission to use, copy, modify, and/or distribute this software
+   for any purpose with or without fee is hereby granted, provided
+   that the above copyright notice and this permission notice appear
+   in all copies.
+
+   There is NO WARRANTY for this software.  See license.txt for
+   details. */
+
+#include <stdio.h>
+
+#include "avian/lz.h"
+
+#include "test-harness.h"
+
+using namespace vm;
+
+class LZTest : public Test {
+public:
+  LZTest():
+    Test("LZ")
+  {}
+
+  static const unsigned Size = 100 * 1024;
+
+  uint8_t data[Size];
+  uint8_t encoded[Size + (Size / 255) + 64];
+  uint8_t decoded[Size];
+
+  // encodes and decodes the first size bytes of data, returning the
+  // size of the image
+  unsigned roundTrip(unsigned size) {
+    unsigned encodedSize = encodeLZ(data, size, encoded);
+    assertTrue(encodedSize <= maxEncodedLZSize(size));
+    assertTrue(isLZ(encoded, encodedSize));
+    assertEqual<unsigned>(size, decodedLZSize(encoded));
+    assertTrue(decodeLZ(encoded, encodedSize, decoded, size));
+    assertTrue(memcmp(data, decoded, size) == 0);
+    return encodedSize;
+  }
+
+  virtual void run() {
+    uint32_t seed = 42;
+    for (unsigned i = 0; i < Size; ++i) {
+      seed = seed * 1103515245 + 12345;
+      data[i] = seed >> 16;
+    }
+
+    // incompressible data, of sizes around the limits on where
+    // matches may fall
+    for (unsigned i = 0; i < 20; ++i) {
+      roundTrip(i);
+    }
+    assertTrue(roundTrip(Size) <= maxEncodedLZSize(Size));
+
+    // a run, which makes matches overlapping what they produce
+    memset(data, 'a', Size);
+    assertTrue(roundTrip(Size) < Size / 100);
+
+    // text-like data, with matches at a variety of offsets and lengths
+    const char* words[] = { "class ", "java/lang/", "Object", "String",
+                            "<init>", "()V", "(Ljava/lang/String;)V" };
+    unsigned position = 0;
+    for (unsigned i = 0; position < Size; ++i) {
+      const char* word = words[(i * 7 + (i >> 3)) % 7];
+      for (const char* p = word; *p and position < Size; ++p) {
+        data[position++] = *p;
+      }
+    }
+    unsigned encodedSize = roundTrip(Size);
+    assertTrue(encodedSize < Size / 4);
+
+    // a truncated or mislabeled image is rejected rather than decoded
+    assertFalse(decodeLZ(encoded, encodedSize - 1, decoded, Size));
+    assertFalse(decodeLZ(encoded, encodedSize, decoded, Size - 1));
+    assertFalse(decodeLZ(encoded, LZHeaderSize - 1, decoded, Size));
+  }
+} lzTest;